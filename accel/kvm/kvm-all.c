@@ -37,6 +37,7 @@
 #include "exec/ram_addr.h"
 #include "qemu/event_notifier.h"
 #include "qemu/main-loop.h"
+#include "qemu/lockable.h"
 #include "trace.h"
 #include "hw/irq.h"
 #include "qapi/visitor.h"
@@ -69,6 +70,13 @@
 #define KVM_GUESTDBG_BLOCKIRQ 0
 #endif
 
+/*
+ * With dirty-ring-reapers=0, use one reaper for every this many vCPUs,
+ * up to KVM_DIRTY_RING_MAX_REAPERS.
+ */
+#define KVM_DIRTY_RING_VCPUS_PER_REAPER 32
+#define KVM_DIRTY_RING_MAX_REAPERS 16
+
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
@@ -390,6 +398,7 @@ int kvm_create_vcpu(CPUState *cpu)
 
     cpu->kvm_fd = kvm_fd;
     cpu->kvm_state = s;
+    cpu->kvm_vcpu_stats_fd = -1;
     cpu->vcpu_dirty = true;
     cpu->dirty_pages = 0;
     cpu->throttle_us_per_full = 0;
@@ -711,7 +720,8 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    /* Rings of different vCPUs may be reaped in parallel */
+    set_bit_atomic(offset, mem->dirty_bmap);
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -784,6 +794,66 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+/* Should be with all slots_lock held for the address spaces. */
+static uint64_t kvm_dirty_ring_reap_shard(KVMState *s, unsigned int shard)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint64_t total = 0;
+    CPUState *cpu;
+
+    RCU_READ_LOCK_GUARD();
+
+    CPU_FOREACH(cpu) {
+        if (cpu->cpu_index / r->vcpus_per_shard == shard) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+
+    return total;
+}
+
+static void *kvm_dirty_ring_reap_helper_thread(void *opaque)
+{
+    struct KVMDirtyRingReapHelper *h = opaque;
+
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&h->sem);
+        h->total = kvm_dirty_ring_reap_shard(kvm_state, h->shard);
+        qemu_sem_post(&kvm_state->reaper.helpers_done);
+    }
+
+    g_assert_not_reached();
+}
+
+/*
+ * Reap the rings of all vCPUs, one shard per thread.  The caller holds
+ * the slots lock throughout, so that nothing looks at the slot dirty
+ * bitmaps before the rings are reset.
+ */
+static uint64_t kvm_dirty_ring_reap_all(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint64_t total;
+    int i;
+
+    for (i = 0; i < r->nr_shards - 1; i++) {
+        qemu_sem_post(&r->helpers[i].sem);
+    }
+
+    total = kvm_dirty_ring_reap_shard(s, 0);
+
+    for (i = 0; i < r->nr_shards - 1; i++) {
+        qemu_sem_wait(&r->helpers_done);
+    }
+    for (i = 0; i < r->nr_shards - 1; i++) {
+        total += r->helpers[i].total;
+    }
+
+    return total;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -795,6 +865,8 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 
     if (cpu) {
         total = kvm_dirty_ring_reap_one(s, cpu);
+    } else if (s->reaper.nr_shards > 1) {
+        total = kvm_dirty_ring_reap_all(s);
     } else {
         CPU_FOREACH(cpu) {
             total += kvm_dirty_ring_reap_one(s, cpu);
@@ -1528,9 +1600,31 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     g_assert_not_reached();
 }
 
-static void kvm_dirty_ring_reaper_init(KVMState *s)
+static void kvm_dirty_ring_reaper_init(KVMState *s, unsigned int max_cpus)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
+    unsigned int nr_shards = s->kvm_dirty_ring_reapers;
+    int i;
+
+    if (!nr_shards) {
+        nr_shards = MIN(DIV_ROUND_UP(max_cpus, KVM_DIRTY_RING_VCPUS_PER_REAPER),
+                        KVM_DIRTY_RING_MAX_REAPERS);
+    }
+    r->vcpus_per_shard = DIV_ROUND_UP(max_cpus, nr_shards);
+    r->nr_shards = DIV_ROUND_UP(max_cpus, r->vcpus_per_shard);
+
+    qemu_sem_init(&r->helpers_done, 0);
+    r->helpers = g_new0(struct KVMDirtyRingReapHelper, r->nr_shards - 1);
+    for (i = 0; i < r->nr_shards - 1; i++) {
+        struct KVMDirtyRingReapHelper *h = &r->helpers[i];
+        g_autofree char *name = g_strdup_printf("kvm-reaper-%d", i + 1);
+
+        h->shard = i + 1;
+        qemu_sem_init(&h->sem, 0);
+        qemu_thread_create(&h->thread, name,
+                           kvm_dirty_ring_reap_helper_thread,
+                           h, QEMU_THREAD_JOINABLE);
+    }
 
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
@@ -1943,10 +2037,32 @@ void kvm_irqchip_commit_routes(KVMState *s)
         return;
     }
 
+    /*
+     * Every commit hands the whole table to KVM, so skip it while a batch
+     * is open or when the table is the same as the one KVM already has.
+     */
+    if (s->irq_routes_batch || !s->irq_routes_dirty) {
+        return;
+    }
+
     s->irq_routes->flags = 0;
     trace_kvm_irqchip_commit_routes();
     ret = kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
     assert(ret == 0);
+    s->irq_routes_dirty = false;
+}
+
+void kvm_irqchip_begin_route_batch(KVMState *s)
+{
+    s->irq_routes_batch++;
+}
+
+void kvm_irqchip_end_route_batch(KVMState *s)
+{
+    assert(s->irq_routes_batch > 0);
+    if (--s->irq_routes_batch == 0) {
+        kvm_irqchip_commit_routes(s);
+    }
 }
 
 void kvm_add_routing_entry(KVMState *s,
@@ -1969,6 +2085,7 @@ void kvm_add_routing_entry(KVMState *s,
     new = &s->irq_routes->entries[n];
 
     *new = *entry;
+    s->irq_routes_dirty = true;
 
     set_gsi(s, entry->gsi);
 }
@@ -1990,6 +2107,7 @@ static int kvm_update_routing_entry(KVMState *s,
         }
 
         *entry = *new_entry;
+        s->irq_routes_dirty = true;
 
         return 0;
     }
@@ -2025,6 +2143,7 @@ void kvm_irqchip_release_virq(KVMState *s, int virq)
         if (e->gsi == virq) {
             s->irq_routes->nr--;
             *e = s->irq_routes->entries[s->irq_routes->nr];
+            s->irq_routes_dirty = true;
         }
     }
     clear_gsi(s, virq);
@@ -2376,6 +2495,12 @@ static void query_stats_cb(StatsResultList **result, StatsTarget target,
                            strList *names, strList *targets, Error **errp);
 static void query_stats_schemas_cb(StatsSchemaList **result, Error **errp);
 
+/*
+ * query-stats may run out-of-band, without the BQL; this protects the
+ * stats descriptor cache.  Entries are never freed once in the cache.
+ */
+static QemuMutex kvm_stats_lock;
+
 uint32_t kvm_dirty_ring_size(void)
 {
     return kvm_state->kvm_dirty_ring_size;
@@ -2691,12 +2816,13 @@ static int kvm_init(MachineState *ms)
     }
 
     if (s->kvm_dirty_ring_size) {
-        kvm_dirty_ring_reaper_init(s);
+        kvm_dirty_ring_reaper_init(s, ms->smp.max_cpus);
     }
 
     if (kvm_check_extension(kvm_state, KVM_CAP_BINARY_STATS_FD)) {
+        qemu_mutex_init(&kvm_stats_lock);
         add_stats_callbacks(STATS_PROVIDER_KVM, query_stats_cb,
-                            query_stats_schemas_cb);
+                            query_stats_schemas_cb, true);
     }
 
     return 0;
@@ -3821,6 +3947,40 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_reapers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > KVM_DIRTY_RING_MAX_REAPERS) {
+        error_setg(errp, "dirty-ring-reapers must be at most %d.",
+                   KVM_DIRTY_RING_MAX_REAPERS);
+        return;
+    }
+
+    s->kvm_dirty_ring_reapers = value;
+}
+
 static char *kvm_get_device(Object *obj,
                             Error **errp G_GNUC_UNUSED)
 {
@@ -3866,6 +4026,7 @@ static void kvm_accel_instance_init(Object *obj)
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
     s->kvm_dirty_ring_with_bitmap = false;
+    s->kvm_dirty_ring_reapers = 0;
     s->kvm_eager_split_size = 0;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
@@ -3887,11 +4048,24 @@ static int kvm_gdbstub_sstep_flags(void)
     return kvm_sstep_flags;
 }
 
+static void kvm_cpu_common_unrealize(CPUState *cpu)
+{
+    /*
+     * query-stats walks the CPU list without the BQL, so the stats fd
+     * may only be closed now that the vCPU has been removed from it.
+     */
+    if (cpu->kvm_state && cpu->kvm_vcpu_stats_fd >= 0) {
+        close(cpu->kvm_vcpu_stats_fd);
+        cpu->kvm_vcpu_stats_fd = -1;
+    }
+}
+
 static void kvm_accel_class_init(ObjectClass *oc, void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
     ac->name = "KVM";
     ac->init_machine = kvm_init;
+    ac->cpu_common_unrealize = kvm_cpu_common_unrealize;
     ac->has_memory = kvm_accel_has_memory;
     ac->allowed = &kvm_allowed;
     ac->gdbstub_supported_sstep_flags = kvm_gdbstub_sstep_flags;
@@ -3914,6 +4088,12 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reapers", "uint32",
+        kvm_get_dirty_ring_reapers, kvm_set_dirty_ring_reapers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reapers",
+        "Number of threads reaping the KVM dirty rings (default: 0, i.e. auto)");
+
     object_class_property_add_str(oc, "device", kvm_get_device, kvm_set_device);
     object_class_property_set_description(oc, "device",
         "Path to the device node to use (default: /dev/kvm)");
@@ -4122,6 +4302,8 @@ static StatsDescriptors *find_stats_descriptors(StatsTarget target, int stats_fd
     size_t size_desc;
     ssize_t ret;
 
+    QEMU_LOCK_GUARD(&kvm_stats_lock);
+
     ident = StatsTarget_str(target);
     QTAILQ_FOREACH(descriptors, &stats_descriptors, next) {
         if (g_str_equal(descriptors->ident, ident)) {
@@ -4314,12 +4496,19 @@ static void query_stats_cb(StatsResultList **result, StatsTarget target,
         stats_args.result.stats = result;
         stats_args.names = names;
         stats_args.errp = errp;
+        /* keep vCPUs from going away when called without the BQL */
+        cpu_list_lock();
         CPU_FOREACH(cpu) {
+            /* vCPUs are on the list before their stats fd is opened */
+            if (!qatomic_load_acquire(&cpu->created)) {
+                continue;
+            }
             if (!apply_str_list_filter(cpu->parent_obj.canonical_path, targets)) {
                 continue;
             }
             query_stats_vcpu(cpu, &stats_args);
         }
+        cpu_list_unlock();
         break;
     }
     default:
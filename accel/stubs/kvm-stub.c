@@ -71,6 +71,14 @@ void kvm_irqchip_commit_routes(KVMState *s)
 {
 }
 
+void kvm_irqchip_begin_route_batch(KVMState *s)
+{
+}
+
+void kvm_irqchip_end_route_batch(KVMState *s)
+{
+}
+
 void kvm_irqchip_add_change_notifier(Notifier *n)
 {
 }
@@ -245,6 +245,60 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
     return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
 }
 
+static TranslationBlock *tb_jmp_cache_l2_lookup(CPUJumpCache *jc, vaddr pc,
+                                                uint64_t cs_base,
+                                                uint32_t flags,
+                                                uint32_t cflags)
+{
+    CPUJumpCacheEntry *set = jc->l2[tb_jmp_cache_l2_hash_func(pc)];
+
+    for (int i = 0; i < TB_JMP_L2_WAYS; i++) {
+        TranslationBlock *tb = qatomic_read(&set[i].tb);
+
+        if (tb &&
+            set[i].pc == pc &&
+            tb->cs_base == cs_base &&
+            tb->flags == flags &&
+            tb_cflags(tb) == cflags) {
+            /* It moves back to the first level */
+            qatomic_set(&set[i].tb, NULL);
+            return tb;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Install @tb at @hash in the first level, moving the entry it replaces
+ * to the most recently used way of its second level set.
+ */
+static void tb_jmp_cache_insert(CPUJumpCache *jc, uint32_t hash, vaddr pc,
+                                TranslationBlock *tb)
+{
+    TranslationBlock *old = qatomic_read(&jc->array[hash].tb);
+
+    if (old && old != tb) {
+        vaddr old_pc = jc->array[hash].pc;
+        CPUJumpCacheEntry *set = jc->l2[tb_jmp_cache_l2_hash_func(old_pc)];
+        int i;
+
+        for (i = 0; i < TB_JMP_L2_WAYS - 1; i++) {
+            if (!qatomic_read(&set[i].tb)) {
+                break;
+            }
+        }
+        for (; i > 0; i--) {
+            set[i].pc = set[i - 1].pc;
+            qatomic_set(&set[i].tb, qatomic_read(&set[i - 1].tb));
+        }
+        set[0].pc = old_pc;
+        qatomic_set(&set[0].tb, old);
+    }
+
+    jc->array[hash].pc = pc;
+    qatomic_set(&jc->array[hash].tb, tb);
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                                           uint64_t cs_base, uint32_t flags,
@@ -269,13 +323,15 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
         goto hit;
     }
 
-    tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
+    tb = tb_jmp_cache_l2_lookup(jc, pc, cs_base, flags, cflags);
     if (tb == NULL) {
-        return NULL;
+        tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
+        if (tb == NULL) {
+            return NULL;
+        }
     }
 
-    jc->array[hash].pc = pc;
-    qatomic_set(&jc->array[hash].tb, tb);
+    tb_jmp_cache_insert(jc, hash, pc, tb);
 
 hit:
     /*
@@ -986,9 +1042,6 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
 
             tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
             if (tb == NULL) {
-                CPUJumpCache *jc;
-                uint32_t h;
-
                 mmap_lock();
                 tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
                 mmap_unlock();
@@ -997,10 +1050,8 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
                  */
-                h = tb_jmp_cache_hash_func(pc);
-                jc = cpu->tb_jmp_cache;
-                jc->array[h].pc = pc;
-                qatomic_set(&jc->array[h].tb, tb);
+                tb_jmp_cache_insert(cpu->tb_jmp_cache,
+                                    tb_jmp_cache_hash_func(pc), pc, tb);
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -1013,6 +1064,10 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             if (tb_page_addr1(tb) != -1) {
                 last_tb = NULL;
             }
+
+            if (unlikely(qatomic_read(&cpu->profile_sample_pending))) {
+                tcg_profile_sample(cpu, pc);
+            }
 #endif
             /* See if we can patch the calling TB. */
             if (last_tb) {
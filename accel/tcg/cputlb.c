@@ -152,12 +152,13 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 {
     desc->window_begin_ns = ns;
     desc->window_max_entries = max_entries;
+    desc->window_evictions = 0;
 }
 
 static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
 {
     CPUJumpCache *jc = cpu->tb_jmp_cache;
-    int i, i0;
+    int i, j, i0;
 
     if (unlikely(!jc)) {
         return;
@@ -167,6 +168,14 @@ static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
     for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
         qatomic_set(&jc->array[i0 + i].tb, NULL);
     }
+
+    QEMU_BUILD_BUG_ON(TB_JMP_PAGE_BITS < TB_JMP_L2_SHIFT);
+    i0 >>= TB_JMP_L2_SHIFT;
+    for (i = 0; i < TB_JMP_PAGE_SIZE >> TB_JMP_L2_SHIFT; i++) {
+        for (j = 0; j < TB_JMP_L2_WAYS; j++) {
+            qatomic_set(&jc->l2[i0 + i][j].tb, NULL);
+        }
+    }
 }
 
 /**
@@ -208,6 +217,10 @@ static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
  * is direct mapped, so we want the use rate to be low (or at least not too
  * high), since otherwise we are likely to have a significant amount of
  * conflict misses.
+ *
+ * 4. Also increase the size when more valid entries were evicted in the
+ * window than the TLB holds and the use rate is not low, as a sign of
+ * conflict misses that the victim TLB cannot absorb.
  */
 static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
                                   int64_t now)
@@ -224,7 +237,7 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
     }
     rate = desc->window_max_entries * 100 / old_size;
 
-    if (rate > 70) {
+    if (rate > 70 || (rate >= 30 && desc->window_evictions > old_size)) {
         new_size = MIN(old_size << 1, 1 << CPU_TLB_DYN_MAX_BITS);
     } else if (rate < 30 && window_expired) {
         size_t ceil = pow2ceil(desc->window_max_entries);
@@ -289,7 +302,7 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
-    desc->vindex = 0;
+    memset(desc->vindex, 0, sizeof(desc->vindex));
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
@@ -374,6 +387,31 @@ static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
     }
 }
 
+static void tlb_flush_sync_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    cpu->neg.tlb.c.sync_pending = false;
+}
+
+/*
+ * tlb_flush_sync: create the synchronisation point of a synced flush
+ *
+ * The flush of the source cpu has already been done, and the other cpus
+ * have their flush queued.  Queue safe work so that the source cpu
+ * waits for all of them to leave the guest code at the end of its TB.
+ * Any further synced flush from the same TB shares that point, rather
+ * than starting an exclusive section of its own.  With a single cpu,
+ * there is nothing to wait for.
+ */
+static void tlb_flush_sync(CPUState *src)
+{
+    if (src->neg.tlb.c.sync_pending ||
+        (first_cpu == src && !CPU_NEXT(src))) {
+        return;
+    }
+    src->neg.tlb.c.sync_pending = true;
+    async_safe_run_on_cpu(src, tlb_flush_sync_async_work, RUN_ON_CPU_NULL);
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     uint16_t asked = data.host_int;
@@ -435,7 +473,8 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
     flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    fn(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_flush_sync(src_cpu);
 }
 
 void tlb_flush_all_cpus_synced(CPUState *src_cpu)
@@ -468,6 +507,45 @@ static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
     return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
 }
 
+/* Return the first entry of the victim tlb set for PAGE.  */
+static inline size_t vtlb_set_first(vaddr page)
+{
+    uint64_t pfn = (target_ulong)page >> TARGET_PAGE_BITS;
+
+    return ((pfn * 0x9e3779b97f4a7c15ull) >> (64 - CPU_VTLB_SET_BITS)) *
+           CPU_VTLB_WAYS;
+}
+
+/* Return the page of a tlb entry that is not empty.  */
+static vaddr tlb_entry_page(const CPUTLBEntry *te)
+{
+    int i;
+
+    for (i = 0; i < MMU_ACCESS_COUNT; i++) {
+        if (te->addr_idx[i] != -1) {
+            return te->addr_idx[i] & TARGET_PAGE_MASK;
+        }
+    }
+    g_assert_not_reached();
+}
+
+/*
+ * Return the victim tlb way that receives an entry for PAGE: a free
+ * way of its set if there is one, else the ways of the set in turn.
+ */
+static size_t vtlb_set_victim(CPUTLBDesc *desc, vaddr page)
+{
+    size_t first = vtlb_set_first(page);
+    size_t vidx;
+
+    for (vidx = first; vidx < first + CPU_VTLB_WAYS; vidx++) {
+        if (tlb_entry_is_empty(&desc->vtable[vidx])) {
+            return vidx;
+        }
+    }
+    return first + desc->vindex[first / CPU_VTLB_WAYS]++ % CPU_VTLB_WAYS;
+}
+
 /* Called with tlb_c.lock held */
 static bool tlb_flush_entry_mask_locked(CPUTLBEntry *tlb_entry,
                                         vaddr page,
@@ -638,8 +716,6 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     if (idxmap < TARGET_PAGE_SIZE) {
         flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                          RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                              RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
         CPUState *dst_cpu;
         TLBFlushPageByMMUIdxData *d;
@@ -654,13 +730,10 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                  RUN_ON_CPU_HOST_PTR(d));
             }
         }
-
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
-                              RUN_ON_CPU_HOST_PTR(d));
     }
+
+    tlb_flush_page_by_mmuidx_async_0(src_cpu, addr, idxmap);
+    tlb_flush_sync(src_cpu);
 }
 
 void tlb_flush_page_all_cpus_synced(CPUState *src, vaddr addr)
@@ -846,9 +919,8 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
         }
     }
 
-    p = g_memdup(&d, sizeof(d));
-    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
-                          RUN_ON_CPU_HOST_PTR(p));
+    tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
+    tlb_flush_sync(src_cpu);
 }
 
 void tlb_flush_page_bits_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
@@ -1051,6 +1123,8 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
 
     assert_cpu_is_self(cpu);
 
+    qatomic_set(&tlb->c.fill_count, tlb->c.fill_count + 1);
+
     if (full->lg_page_size <= TARGET_PAGE_BITS) {
         sz = TARGET_PAGE_SIZE;
     } else {
@@ -1142,13 +1216,14 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, addr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        size_t vidx = vtlb_set_victim(desc, tlb_entry_page(te));
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
         /* Evict the old entry into the victim tlb.  */
         copy_tlb_helper_locked(tv, te);
         desc->vfulltlb[vidx] = desc->fulltlb[index];
         tlb_n_used_entries_dec(cpu, mmu_idx);
+        desc->window_evictions++;
     }
 
     /* refill the tlb */
@@ -1297,27 +1372,40 @@ static void io_failed(CPUState *cpu, CPUTLBEntryFull *full, vaddr addr,
 static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
                            MMUAccessType access_type, vaddr page)
 {
+    size_t first = vtlb_set_first(page);
     size_t vidx;
 
     assert_cpu_is_self(cpu);
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+    for (vidx = first; vidx < first + CPU_VTLB_WAYS; ++vidx) {
         CPUTLBEntry *vtlb = &cpu->neg.tlb.d[mmu_idx].vtable[vidx];
         uint64_t cmp = tlb_read_idx(vtlb, access_type);
 
         if (cmp == page) {
-            /* Found entry in victim tlb, swap tlb and iotlb.  */
+            /*
+             * Found entry in victim tlb: move it into the tlb, and the
+             * entry it displaces into the set of its own page, where the
+             * next lookup for that page will search for it.
+             */
+            CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
             CPUTLBEntry tmptlb, *tlb = &cpu->neg.tlb.f[mmu_idx].table[index];
+            CPUTLBEntryFull tmpf = desc->fulltlb[index];
 
             qemu_spin_lock(&cpu->neg.tlb.c.lock);
             copy_tlb_helper_locked(&tmptlb, tlb);
             copy_tlb_helper_locked(tlb, vtlb);
-            copy_tlb_helper_locked(vtlb, &tmptlb);
+            desc->fulltlb[index] = desc->vfulltlb[vidx];
+            memset(vtlb, -1, sizeof(*vtlb));
+
+            if (!tlb_entry_is_empty(&tmptlb)) {
+                size_t dst = vtlb_set_victim(desc, tlb_entry_page(&tmptlb));
+
+                copy_tlb_helper_locked(&desc->vtable[dst], &tmptlb);
+                desc->vfulltlb[dst] = tmpf;
+            }
             qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 
-            CPUTLBEntryFull *f1 = &cpu->neg.tlb.d[mmu_idx].fulltlb[index];
-            CPUTLBEntryFull *f2 = &cpu->neg.tlb.d[mmu_idx].vfulltlb[vidx];
-            CPUTLBEntryFull tmpf;
-            tmpf = *f1; *f1 = *f2; *f2 = tmpf;
+            qatomic_set(&cpu->neg.tlb.c.vtlb_hit_count,
+                        cpu->neg.tlb.c.vtlb_hit_count + 1);
             return true;
         }
     }
@@ -53,6 +53,9 @@ TranslationBlock *tb_link_page(TranslationBlock *tb);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
                                uintptr_t host_pc);
 
+/* Record a sample of the sampling profiler at @pc, see tcg-profile.c */
+void tcg_profile_sample(CPUState *cpu, vaddr pc);
+
 bool tcg_exec_realizefn(CPUState *cpu, Error **errp);
 void tcg_exec_unrealizefn(CPUState *cpu);
 
@@ -141,6 +141,19 @@ static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+static void tlb_fill_counts(size_t *pvhit, size_t *pfill)
+{
+    CPUState *cpu;
+    size_t vhit = 0, fill = 0;
+
+    CPU_FOREACH(cpu) {
+        vhit += qatomic_read(&cpu->neg.tlb.c.vtlb_hit_count);
+        fill += qatomic_read(&cpu->neg.tlb.c.fill_count);
+    }
+    *pvhit = vhit;
+    *pfill = fill;
+}
+
 static void tcg_dump_info(GString *buf)
 {
     g_string_append_printf(buf, "[TCG profiler not compiled]\n");
@@ -150,7 +163,7 @@ static void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
-    size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t nb_tbs, flush_full, flush_part, flush_elide, vtlb_hit, fill;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -196,6 +209,9 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    tlb_fill_counts(&vtlb_hit, &fill);
+    g_string_append_printf(buf, "TLB victim hits     %zu\n", vtlb_hit);
+    g_string_append_printf(buf, "TLB refills         %zu\n", fill);
     tcg_dump_info(buf);
 }
 
@@ -239,6 +255,7 @@ static void hmp_tcg_register(void)
 {
     monitor_register_hmp_info_hrt("jit", qmp_x_query_jit);
     monitor_register_hmp_info_hrt("opcount", qmp_x_query_opcount);
+    monitor_register_hmp_info_hrt("tcg-profile", qmp_x_query_tcg_profile);
 }
 
 type_init(hmp_tcg_register);
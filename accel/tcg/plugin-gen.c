@@ -212,6 +212,37 @@ static void gen_mem_cb(struct qemu_plugin_regular_cb *cb,
     tcg_temp_free_i32(cpu_index);
 }
 
+/* The drain is a conditional callback before the instruction */
+static void gen_mem_buffer_cb(struct qemu_plugin_buffer_cb *cb,
+                              qemu_plugin_meminfo_t meminfo, TCGv_i64 addr)
+{
+    qemu_plugin_u64 count = { .score = cb->buf->score, .offset = 0 };
+    TCGv_ptr ptr = gen_plugin_u64_ptr(count);
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+    TCGv_i64 n = tcg_temp_ebb_new_i64();
+    TCGv_i64 ofs = tcg_temp_ebb_new_i64();
+
+    tcg_gen_ld_i64(n, ptr, 0);
+    tcg_gen_umin_i64(n, n, tcg_constant_i64(cb->buf->capacity - 1));
+    tcg_gen_muli_i64(ofs, n, sizeof(struct qemu_plugin_mem_record));
+    tcg_gen_trunc_i64_ptr(rec, ofs);
+    tcg_gen_add_ptr(rec, rec, ptr);
+
+    /* Record n + 1 follows the count in record 0 */
+    tcg_gen_st_i64(addr, rec, sizeof(struct qemu_plugin_mem_record) +
+                   offsetof(struct qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i32(tcg_constant_i32(meminfo), rec,
+                   sizeof(struct qemu_plugin_mem_record) +
+                   offsetof(struct qemu_plugin_mem_record, info));
+    tcg_gen_addi_i64(n, n, 1);
+    tcg_gen_st_i64(n, ptr, 0);
+
+    tcg_temp_free_i64(ofs);
+    tcg_temp_free_i64(n);
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(ptr);
+}
+
 static void inject_cb(struct qemu_plugin_dyn_cb *cb)
 
 {
@@ -243,6 +274,11 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
             gen_mem_cb(&cb->regular, meminfo, addr);
         }
         break;
+    case PLUGIN_CB_MEM_BUFFER:
+        if (rw & cb->buffer.rw) {
+            gen_mem_buffer_cb(&cb->buffer, meminfo, addr);
+        }
+        break;
     case PLUGIN_CB_INLINE_ADD_U64:
     case PLUGIN_CB_INLINE_STORE_U64:
         if (rw & cb->inline_insn.rw) {
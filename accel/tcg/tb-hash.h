@@ -60,6 +60,17 @@ static inline unsigned int tb_jmp_cache_hash_func(vaddr pc)
 
 #endif /* CONFIG_SOFTMMU */
 
+/*
+ * The second level keeps the top bits of the first level hash, so that
+ * the sets for one page are contiguous too.
+ */
+#define TB_JMP_L2_SHIFT (TB_JMP_CACHE_BITS - TB_JMP_L2_BITS)
+
+static inline unsigned int tb_jmp_cache_l2_hash_func(vaddr pc)
+{
+    return tb_jmp_cache_hash_func(pc) >> TB_JMP_L2_SHIFT;
+}
+
 static inline
 uint32_t tb_hash_func(tb_page_addr_t phys_pc, vaddr pc,
                       uint32_t flags, uint64_t flags2, uint32_t cf_mask)
@@ -15,6 +15,10 @@
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+#define TB_JMP_L2_BITS 8
+#define TB_JMP_L2_SETS (1 << TB_JMP_L2_BITS)
+#define TB_JMP_L2_WAYS 4
+
 /*
  * Invalidated in parallel; all accesses to 'tb' must be atomic.
  * A valid entry is read/written by a single CPU, therefore there is
@@ -22,12 +26,21 @@
  * non-NULL value of 'tb'.  Strictly speaking pc is only needed for
  * CF_PCREL, but it's used always for simplicity.
  */
+typedef struct CPUJumpCacheEntry {
+    TranslationBlock *tb;
+    vaddr pc;
+} CPUJumpCacheEntry;
+
 typedef struct CPUJumpCache {
     struct rcu_head rcu;
-    struct {
-        TranslationBlock *tb;
-        vaddr pc;
-    } array[TB_JMP_CACHE_SIZE];
+    CPUJumpCacheEntry array[TB_JMP_CACHE_SIZE];
+    /*
+     * Entries displaced from 'array'.  They are matched on the whole
+     * lookup key, so that indirect branches alternating between targets
+     * that alias in 'array', or one pc reached with different flags,
+     * still avoid the global hash table.  Same access rules as 'array'.
+     */
+    CPUJumpCacheEntry l2[TB_JMP_L2_SETS][TB_JMP_L2_WAYS];
 } CPUJumpCache;
 
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
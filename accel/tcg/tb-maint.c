@@ -771,7 +771,12 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
         tcg_flush_jmp_cache(cpu);
     }
 
-    qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
+    /*
+     * Keep the table at the size it grew to: the code buffer is about to
+     * fill up with the same working set again, and shrinking would make
+     * every vCPU stall on the same series of resizes after each flush.
+     */
+    qht_reset(&tb_ctx.htable);
     tb_remove_all();
 
     tcg_region_reset_all();
@@ -886,6 +891,7 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
         }
     } else {
         uint32_t h = tb_jmp_cache_hash_func(tb->pc);
+        uint32_t h2 = tb_jmp_cache_l2_hash_func(tb->pc);
 
         CPU_FOREACH(cpu) {
             CPUJumpCache *jc = cpu->tb_jmp_cache;
@@ -893,6 +899,11 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
             if (qatomic_read(&jc->array[h].tb) == tb) {
                 qatomic_set(&jc->array[h].tb, NULL);
             }
+            for (int i = 0; i < TB_JMP_L2_WAYS; i++) {
+                if (qatomic_read(&jc->l2[h2][i].tb) == tb) {
+                    qatomic_set(&jc->l2[h2][i].tb, NULL);
+                }
+            }
         }
     }
 }
@@ -1090,6 +1101,24 @@ bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc)
     return false;
 }
 #else
+/* Return true if the part of @tb in page @n intersects [@start, @last]. */
+static bool tb_page_intersects(TranslationBlock *tb, int n,
+                               tb_page_addr_t start, tb_page_addr_t last)
+{
+    tb_page_addr_t tb_start, tb_last;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    tb_start = tb_page_addr0(tb);
+    tb_last = tb_start + tb->size - 1;
+    if (n == 0) {
+        tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
+    } else {
+        tb_start = tb_page_addr1(tb);
+        tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
+    }
+    return !(tb_last < start || tb_start > last);
+}
+
 /*
  * @p must be non-NULL.
  * Call with all @pages locked.
@@ -1115,18 +1144,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
      * XXX: see if in some cases it could be faster to invalidate all the code
      */
     PAGE_FOR_EACH_TB(start, last, p, tb, n) {
-        tb_page_addr_t tb_start, tb_last;
-
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        tb_start = tb_page_addr0(tb);
-        tb_last = tb_start + tb->size - 1;
-        if (n == 0) {
-            tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
-        } else {
-            tb_start = tb_page_addr1(tb);
-            tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
-        }
-        if (!(tb_last < start || tb_start > last)) {
+        if (tb_page_intersects(tb, n, start, last)) {
 #ifdef TARGET_HAS_PRECISE_SMC
             if (current_tb == tb &&
                 (tb_cflags(current_tb) & CF_COUNT_MASK) != 1) {
@@ -1221,6 +1239,35 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    uintptr_t retaddr)
 {
     struct page_collection *pages;
+    PageDesc *p = page_find(ram_addr >> TARGET_PAGE_BITS);
+    TranslationBlock *tb;
+    PageForEachNext n;
+    bool hit = false;
+
+    if (!p) {
+        return;
+    }
+
+    /*
+     * Most writes to a page that holds code, e.g. from a JIT in the guest,
+     * do not overlap any TB.  Check that with the lock of this page only,
+     * before locking the pages of all of its TBs as well.
+     */
+    page_lock(p);
+    PAGE_FOR_EACH_TB(ram_addr, ram_addr + size - 1, p, tb, n) {
+        if (tb_page_intersects(tb, n, ram_addr, ram_addr + size - 1)) {
+            hit = true;
+            break;
+        }
+    }
+    if (!hit) {
+        if (!p->first_tb) {
+            tlb_unprotect_code(ram_addr);
+        }
+        page_unlock(p);
+        return;
+    }
+    page_unlock(p);
 
     pages = page_collection_lock(ram_addr, ram_addr + size - 1);
     tb_invalidate_phys_page_fast__locked(pages, ram_addr, size, retaddr);
@@ -0,0 +1,155 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ *  Sampling profiler for guest code running under TCG
+ *
+ * A host timer asks every running vCPU to leave its chain of TBs; the
+ * program counter of the next TB it looks up is the sample.  Nothing is
+ * instrumented, so guest code runs at full speed between samples.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/lockable.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qapi/type-helpers.h"
+#include "qapi/qapi-commands-machine.h"
+#include "hw/core/cpu.h"
+#include "sysemu/tcg.h"
+#include "internal-common.h"
+
+typedef struct TCGProfileEntry {
+    vaddr pc;
+    uint64_t samples;
+} TCGProfileEntry;
+
+static struct {
+    QemuMutex lock;
+    /* protected by lock, NULL until profiling is first enabled */
+    GHashTable *entries;
+    /* protected by the BQL */
+    QEMUTimer *timer;
+    int64_t period_ns;
+} tcg_profile;
+
+static void __attribute__((__constructor__)) tcg_profile_init(void)
+{
+    qemu_mutex_init(&tcg_profile.lock);
+}
+
+static void tcg_profile_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (!cpu->halted) {
+            qatomic_set(&cpu->profile_sample_pending, true);
+            cpu_exit(cpu);
+        }
+    }
+    timer_mod(tcg_profile.timer,
+              qemu_clock_get_ns(QEMU_CLOCK_HOST) + tcg_profile.period_ns);
+}
+
+void tcg_profile_sample(CPUState *cpu, vaddr pc)
+{
+    TCGProfileEntry *e;
+
+    qatomic_set(&cpu->profile_sample_pending, false);
+
+    QEMU_LOCK_GUARD(&tcg_profile.lock);
+    e = g_hash_table_lookup(tcg_profile.entries, &pc);
+    if (!e) {
+        e = g_new0(TCGProfileEntry, 1);
+        e->pc = pc;
+        g_hash_table_insert(tcg_profile.entries, &e->pc, e);
+    }
+    e->samples++;
+}
+
+void qmp_x_tcg_profile(bool enable, bool has_period, uint32_t period,
+                       Error **errp)
+{
+    if (!tcg_enabled()) {
+        error_setg(errp, "Profiling is only available with accel=tcg");
+        return;
+    }
+
+    if (!enable) {
+        if (tcg_profile.timer) {
+            timer_del(tcg_profile.timer);
+        }
+        return;
+    }
+
+    if (has_period && !period) {
+        error_setg(errp, "Parameter 'period' must be positive");
+        return;
+    }
+
+    /* Every start collects a new profile */
+    WITH_QEMU_LOCK_GUARD(&tcg_profile.lock) {
+        if (tcg_profile.entries) {
+            g_hash_table_remove_all(tcg_profile.entries);
+        } else {
+            tcg_profile.entries = g_hash_table_new_full(g_int64_hash,
+                                                        g_int64_equal,
+                                                        NULL, g_free);
+        }
+    }
+
+    if (!tcg_profile.timer) {
+        tcg_profile.timer = timer_new_ns(QEMU_CLOCK_HOST, tcg_profile_tick,
+                                         NULL);
+    }
+    tcg_profile.period_ns = (has_period ? period : 1000) * SCALE_US;
+    timer_mod(tcg_profile.timer,
+              qemu_clock_get_ns(QEMU_CLOCK_HOST) + tcg_profile.period_ns);
+}
+
+static gint tcg_profile_entry_cmp(gconstpointer a, gconstpointer b)
+{
+    const TCGProfileEntry *ea = *(TCGProfileEntry **)a;
+    const TCGProfileEntry *eb = *(TCGProfileEntry **)b;
+
+    if (ea->samples != eb->samples) {
+        return ea->samples > eb->samples ? -1 : 1;
+    }
+    return ea->pc < eb->pc ? -1 : ea->pc > eb->pc;
+}
+
+HumanReadableText *qmp_x_query_tcg_profile(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+    g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func(g_free);
+    GHashTableIter iter;
+    gpointer value;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "Profiling is only available with accel=tcg");
+        return NULL;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&tcg_profile.lock) {
+        if (!tcg_profile.entries) {
+            error_setg(errp, "No profile was collected, see x-tcg-profile");
+            return NULL;
+        }
+
+        g_hash_table_iter_init(&iter, tcg_profile.entries);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            g_ptr_array_add(entries, g_memdup2(value,
+                                               sizeof(TCGProfileEntry)));
+        }
+    }
+
+    g_ptr_array_sort(entries, tcg_profile_entry_cmp);
+    for (guint i = 0; i < entries->len; i++) {
+        TCGProfileEntry *e = g_ptr_array_index(entries, i);
+
+        g_string_append_printf(buf, "0x%" VADDR_PRIx " %" PRIu64 "\n",
+                               e->pc, e->samples);
+    }
+
+    return human_readable_text_from_str(buf);
+}
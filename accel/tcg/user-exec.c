@@ -23,6 +23,7 @@
 #include "tcg/tcg.h"
 #include "qemu/bitops.h"
 #include "qemu/rcu.h"
+#include "qemu/seqlock.h"
 #include "exec/cpu_ldst.h"
 #include "qemu/main-loop.h"
 #include "exec/translate-all.h"
@@ -154,6 +155,20 @@ typedef struct PageFlagsNode {
 
 static IntervalTreeRoot pageflags_root;
 
+/*
+ * Syscalls validate every guest buffer with page_check_range, usually
+ * against the mapping they validated last time.  Remember the last node
+ * that passed on each thread; the sequence count, bumped on every change
+ * to the tree, tells when it may be stale.
+ */
+static QemuSeqLock pageflags_seq;
+
+static __thread struct {
+    target_ulong start, last;
+    int flags;
+    unsigned seq;
+} pageflags_cache;
+
 static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
 {
     IntervalTreeNode *n;
@@ -217,24 +232,25 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
-    PageFlagsNode *p = pageflags_find(address, address);
+    PageFlagsNode *p;
+    unsigned seq;
+    int flags;
 
     /*
      * See util/interval-tree.c re lockless lookups: no false positives but
-     * there are false negatives.  If we find nothing, retry with the mmap
-     * lock acquired.
+     * there are false negatives, and only while the tree is being changed.
+     * Retry until a lookup did not overlap a change, so that the fault
+     * path never waits for the mmap lock.  With the lock held, nothing
+     * but this thread can be changing the tree.
      */
-    if (p) {
-        return p->flags;
-    }
-    if (have_mmap_lock()) {
-        return 0;
-    }
+    do {
+        seq = seqlock_read_begin(&pageflags_seq);
+        p = pageflags_find(address, address);
+        flags = p ? p->flags : 0;
+    } while (!p && !have_mmap_lock() &&
+             seqlock_read_retry(&pageflags_seq, seq));
 
-    mmap_lock();
-    p = pageflags_find(address, address);
-    mmap_unlock();
-    return p ? p->flags : 0;
+    return flags;
 }
 
 /* A subroutine of page_set_flags: insert a new node for [start,last]. */
@@ -253,6 +269,7 @@ static bool pageflags_unset(target_ulong start, target_ulong last)
 {
     bool inval_tb = false;
 
+    seqlock_write_begin(&pageflags_seq);
     while (true) {
         PageFlagsNode *p = pageflags_find(start, last);
         target_ulong p_last;
@@ -286,6 +303,7 @@ static bool pageflags_unset(target_ulong start, target_ulong last)
             break;
         }
     }
+    seqlock_write_end(&pageflags_seq);
 
     return inval_tb;
 }
@@ -354,6 +372,7 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
     int p_flags, merge_flags;
     bool inval_tb = false;
 
+    seqlock_write_begin(&pageflags_seq);
  restart:
     p = pageflags_find(start, last);
     if (!p) {
@@ -482,6 +501,7 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
     }
 
  done:
+    seqlock_write_end(&pageflags_seq);
     return inval_tb;
 }
 
@@ -529,6 +549,7 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
 {
     target_ulong last;
     int locked;  /* tri-state: =0: unlocked, +1: global, -1: local */
+    unsigned seq;
     bool ret;
 
     if (len == 0) {
@@ -540,16 +561,27 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
         return false; /* wrap around */
     }
 
+    /* The count is rounded down while a change is in progress. */
+    seq = seqlock_read_begin(&pageflags_seq);
+    if (pageflags_cache.seq == seq
+        && (pageflags_cache.flags & PAGE_VALID)
+        && !(flags & ~pageflags_cache.flags)
+        && start >= pageflags_cache.start
+        && last <= pageflags_cache.last
+        && !seqlock_read_retry(&pageflags_seq, seq)) {
+        return true;
+    }
+
     locked = have_mmap_lock();
     while (true) {
         PageFlagsNode *p = pageflags_find(start, last);
         int missing;
 
         if (!p) {
-            if (!locked) {
+            if (!locked && seqlock_read_retry(&pageflags_seq, seq)) {
                 /*
-                 * Lockless lookups have false negatives.
-                 * Retry with the lock held.
+                 * Lockless lookups have false negatives while the tree
+                 * is changed.  Retry with the lock held.
                  */
                 mmap_lock();
                 locked = -1;
@@ -590,6 +622,19 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
         }
 
         if (last <= p->itree.last) {
+            if (!missing) {
+                target_ulong p_start = p->itree.start;
+                target_ulong p_last = p->itree.last;
+                int p_flags = p->flags;
+
+                /* Only cache what was read outside of a change. */
+                if (!seqlock_read_retry(&pageflags_seq, seq)) {
+                    pageflags_cache.start = p_start;
+                    pageflags_cache.last = p_last;
+                    pageflags_cache.flags = p_flags;
+                    pageflags_cache.seq = seq;
+                }
+            }
             ret = true; /* ok */
             break;
         }
@@ -369,6 +369,53 @@ void audio_sample_from_uint64(void *samples, int pos,
 #endif
 }
 
+/*
+ * Frames are processed a vector at a time wherever the same operation
+ * applies to both channels, using the compiler's generic vector types so
+ * that every host gets its native SIMD instructions.  A vector holds one
+ * frame of the integer mixing engine or two of the float one.
+ */
+#ifdef FLOAT_MIXENG
+typedef mixeng_real mixeng_vec __attribute__((vector_size(16)));
+#else
+typedef int64_t mixeng_vec __attribute__((vector_size(16)));
+#endif
+#define MIXENG_VEC_FRAMES (sizeof(mixeng_vec) / sizeof(struct st_sample))
+
+static inline mixeng_vec mixeng_vec_load(const struct st_sample *p)
+{
+    mixeng_vec v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void mixeng_vec_store(struct st_sample *p, mixeng_vec v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static void mixeng_copy(struct st_sample *dst, const struct st_sample *src,
+                        size_t frames)
+{
+    memcpy(dst, src, frames * sizeof(struct st_sample));
+}
+
+static void mixeng_add(struct st_sample *dst, const struct st_sample *src,
+                       size_t frames)
+{
+    size_t i;
+
+    for (i = 0; i + MIXENG_VEC_FRAMES <= frames; i += MIXENG_VEC_FRAMES) {
+        mixeng_vec_store(dst + i, mixeng_vec_load(dst + i) +
+                                  mixeng_vec_load(src + i));
+    }
+    for (; i < frames; i++) {
+        dst[i].l += src[i].l;
+        dst[i].r += src[i].r;
+    }
+}
+
 /*
  * August 21, 1998
  * Copyright 1998 Fabrice Bellard.
@@ -429,10 +476,12 @@ void *st_rate_start (int inrate, int outrate)
 
 #define NAME st_rate_flow_mix
 #define OP(a, b) a += b
+#define OP_FRAMES mixeng_add
 #include "rate_template.h"
 
 #define NAME st_rate_flow
 #define OP(a, b) a = b
+#define OP_FRAMES mixeng_copy
 #include "rate_template.h"
 
 void st_rate_stop (void *opaque)
@@ -527,11 +576,34 @@ void mixeng_clear (struct st_sample *buf, int len)
 
 void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
 {
+    mixeng_vec v;
+    size_t i;
+
     if (vol->mute) {
         mixeng_clear (buf, len);
         return;
     }
 
+    /* the common case, the multiplication would leave samples untouched */
+    if (vol->l == nominal_volume.l && vol->r == nominal_volume.r) {
+        return;
+    }
+
+#ifdef FLOAT_MIXENG
+    v = (mixeng_vec) { vol->l, vol->r, vol->l, vol->r };
+#else
+    v = (mixeng_vec) { vol->l, vol->r };
+#endif
+    for (i = 0; i + MIXENG_VEC_FRAMES <= len; i += MIXENG_VEC_FRAMES) {
+#ifdef FLOAT_MIXENG
+        mixeng_vec_store(buf, mixeng_vec_load(buf) * v);
+#else
+        mixeng_vec_store(buf, (mixeng_vec_load(buf) * v) >> 32);
+#endif
+        buf += MIXENG_VEC_FRAMES;
+    }
+
+    len -= i;
     while (len--) {
 #ifdef FLOAT_MIXENG
         buf->l = buf->l * vol->l;
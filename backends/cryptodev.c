@@ -630,7 +630,7 @@ cryptodev_backend_class_init(ObjectClass *oc, void *data)
                               NULL, NULL);
 
     add_stats_callbacks(STATS_PROVIDER_CRYPTODEV, cryptodev_backend_stats_cb,
-                        cryptodev_backend_schemas_cb);
+                        cryptodev_backend_schemas_cb, false);
 }
 
 static const TypeInfo cryptodev_backend_info = {
@@ -420,8 +420,13 @@ BlockDriverState *bdrv_new(void)
     for (i = 0; i < BLOCK_OP_TYPE_MAX; i++) {
         QLIST_INIT(&bs->op_blockers[i]);
     }
+    for (i = 0; i < BDRV_TRACKED_REQUEST_SHARDS; i++) {
+        qemu_mutex_init(&bs->tracked_requests[i].lock);
+        QLIST_INIT(&bs->tracked_requests[i].reqs);
+    }
     qemu_mutex_init(&bs->reqs_lock);
     qemu_mutex_init(&bs->dirty_bitmap_mutex);
+    seqlock_init(&bs->dirty_bitmap_seqlock);
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
 
@@ -5534,6 +5539,8 @@ int bdrv_replace_child_bs(BdrvChild *child, BlockDriverState *new_bs,
 
 static void bdrv_delete(BlockDriverState *bs)
 {
+    int i;
+
     assert(bdrv_op_blocker_is_empty(bs));
     assert(!bs->refcnt);
     GLOBAL_STATE_CODE();
@@ -5546,6 +5553,9 @@ static void bdrv_delete(BlockDriverState *bs)
 
     bdrv_close(bs);
 
+    for (i = 0; i < BDRV_TRACKED_REQUEST_SHARDS; i++) {
+        qemu_mutex_destroy(&bs->tracked_requests[i].lock);
+    }
     qemu_mutex_destroy(&bs->reqs_lock);
 
     g_free(bs);
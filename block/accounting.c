@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "block/accounting.h"
 #include "block/block_int.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
 
@@ -200,6 +201,118 @@ void block_latency_histograms_clear(BlockAcctStats *stats)
     }
 }
 
+static unsigned block_latency_pct_index(int64_t latency_ns)
+{
+    unsigned shift;
+
+    if (latency_ns < BLOCK_LATENCY_PCT_SUB_BUCKETS) {
+        return MAX(latency_ns, 0);
+    }
+    if (latency_ns >= 1LL << BLOCK_LATENCY_PCT_MAX_BITS) {
+        return BLOCK_LATENCY_PCT_BUCKETS - 1;
+    }
+
+    shift = 63 - clz64(latency_ns) - BLOCK_LATENCY_PCT_SUB_BITS;
+    return (shift + 1) * BLOCK_LATENCY_PCT_SUB_BUCKETS +
+           ((latency_ns >> shift) & (BLOCK_LATENCY_PCT_SUB_BUCKETS - 1));
+}
+
+/* Returns the latency in the middle of the bucket with index @index */
+static uint64_t block_latency_pct_value(unsigned index)
+{
+    unsigned shift;
+    uint64_t lower;
+
+    if (index < BLOCK_LATENCY_PCT_SUB_BUCKETS) {
+        return index;
+    }
+
+    shift = index / BLOCK_LATENCY_PCT_SUB_BUCKETS - 1;
+    lower = (uint64_t)(BLOCK_LATENCY_PCT_SUB_BUCKETS +
+                       index % BLOCK_LATENCY_PCT_SUB_BUCKETS) << shift;
+    return lower + ((1ULL << shift) >> 1);
+}
+
+/*
+ * Walk the buckets of @hist, minus those of @base if it is non-NULL, and store
+ * the latencies for the given @percentiles in @values.
+ *
+ * Returns false if no request has been accounted in that difference.
+ */
+static bool block_latency_pct_walk(const BlockLatencyPercentileHistogram *hist,
+                                   const BlockLatencyPercentileHistogram *base,
+                                   const double *percentiles, uint64_t *values,
+                                   int count)
+{
+    uint64_t total = hist->count - (base ? base->count : 0);
+    uint64_t seen = 0;
+    unsigned index;
+    int i = 0;
+
+    if (!total) {
+        return false;
+    }
+
+    for (index = 0; index < BLOCK_LATENCY_PCT_BUCKETS && i < count; index++) {
+        seen += hist->buckets[index] - (base ? base->buckets[index] : 0);
+        while (i < count &&
+               seen >= MAX(percentiles[i] / 100.0 * total, 1.0))
+        {
+            values[i++] = block_latency_pct_value(index);
+        }
+    }
+    assert(i == count);
+
+    return true;
+}
+
+/*
+ * Compute the latencies (in nanoseconds) below which the given @percentiles
+ * of all accounted requests of @type finished.  @percentiles must be in
+ * ascending order and between 0 and 100; the results are stored in @values.
+ *
+ * Returns false (leaving @values untouched) if no request has been accounted
+ * yet.
+ */
+bool block_latency_percentiles(BlockAcctStats *stats, enum BlockAcctType type,
+                               const double *percentiles, uint64_t *values,
+                               int count)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    QEMU_LOCK_GUARD(&stats->lock);
+    return block_latency_pct_walk(&stats->latency_pct[type], NULL,
+                                  percentiles, values, count);
+}
+
+/*
+ * Like block_latency_percentiles(), but only for the requests accounted since
+ * the previous call with the same @since.  @since holds the state of that
+ * previous call and is updated; zero-initialize it to start from the very
+ * first request.
+ */
+bool block_latency_percentiles_since(BlockAcctStats *stats,
+                                     enum BlockAcctType type,
+                                     BlockLatencyPercentileHistogram *since,
+                                     const double *percentiles,
+                                     uint64_t *values, int count)
+{
+    BlockLatencyPercentileHistogram *hist = &stats->latency_pct[type];
+    bool ret;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    QEMU_LOCK_GUARD(&stats->lock);
+    /* The histogram may have been cleared in the meantime */
+    if (hist->count < since->count) {
+        memset(since, 0, sizeof(*since));
+    }
+    ret = block_latency_pct_walk(hist, since, percentiles, values, count);
+    *since = *hist;
+
+    return ret;
+}
+
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
@@ -229,9 +342,15 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                         latency_ns);
 
         if (!failed || stats->account_failed) {
+            BlockLatencyPercentileHistogram *pct =
+                &stats->latency_pct[cookie->type];
+
             stats->total_time_ns[cookie->type] += latency_ns;
             stats->last_access_time_ns = time_ns;
 
+            pct->buckets[block_latency_pct_index(latency_ns)]++;
+            pct->count++;
+
             QSLIST_FOREACH(s, &stats->intervals, entries) {
                 timed_average_account(&s->latency[cookie->type], latency_ns);
             }
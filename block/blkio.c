@@ -33,14 +33,13 @@ typedef struct BlkioBounceBuf {
     struct iovec buf;
 } BlkioBounceBuf;
 
+/* Queues are handed out to submitting AioContexts, see blkio_get_queue_ctx() */
+#define BLKIO_MAX_QUEUES 8
+
 typedef struct {
-    /*
-     * libblkio is not thread-safe so this lock protects ->blkio and
-     * ->blkioq.
-     */
-    QemuMutex blkio_lock;
-    struct blkio *blkio;
-    struct blkioq *blkioq; /* make this multi-queue in the future... */
+    /* libblkio queues are not thread-safe so this lock protects ->blkioq */
+    QemuMutex lock;
+    struct blkioq *blkioq;
     int completion_fd;
 
     /*
@@ -50,6 +49,18 @@ typedef struct {
      * fd and poll handlers.
      */
     struct blkio_completion poll_completion;
+} BlkioQueue;
+
+typedef struct {
+    /* libblkio is not thread-safe so this lock protects ->blkio */
+    QemuMutex blkio_lock;
+    struct blkio *blkio;
+
+    BlkioQueue queues[BLKIO_MAX_QUEUES];
+    int num_queues;
+
+    /* The AioContext that claimed each queue, or NULL */
+    AioContext *queue_ctx[BLKIO_MAX_QUEUES];
 
     /*
      * Protects ->bounce_pool, ->bounce_bufs, ->bounce_available.
@@ -231,24 +242,23 @@ typedef struct {
 
 static void blkio_completion_fd_read(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    BDRVBlkioState *s = bs->opaque;
+    BlkioQueue *q = opaque;
     uint64_t val;
     int ret;
 
     /* Polling may have already fetched a completion */
-    if (s->poll_completion.user_data != NULL) {
-        BlkioCoData *cod = s->poll_completion.user_data;
-        cod->ret = s->poll_completion.ret;
+    if (q->poll_completion.user_data != NULL) {
+        BlkioCoData *cod = q->poll_completion.user_data;
+        cod->ret = q->poll_completion.ret;
 
         /* Clear it in case aio_co_wake() enters a nested event loop */
-        s->poll_completion.user_data = NULL;
+        q->poll_completion.user_data = NULL;
 
         aio_co_wake(cod->coroutine);
     }
 
     /* Reset completion fd status */
-    ret = read(s->completion_fd, &val, sizeof(val));
+    ret = read(q->completion_fd, &val, sizeof(val));
 
     /* Ignore errors, there's nothing we can do */
     (void)ret;
@@ -261,8 +271,8 @@ static void blkio_completion_fd_read(void *opaque)
     while (true) {
         struct blkio_completion completion;
 
-        WITH_QEMU_LOCK_GUARD(&s->blkio_lock) {
-            ret = blkioq_do_io(s->blkioq, &completion, 0, 1, NULL);
+        WITH_QEMU_LOCK_GUARD(&q->lock) {
+            ret = blkioq_do_io(q->blkioq, &completion, 0, 1, NULL);
         }
         if (ret != 1) {
             break;
@@ -276,17 +286,16 @@ static void blkio_completion_fd_read(void *opaque)
 
 static bool blkio_completion_fd_poll(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    BDRVBlkioState *s = bs->opaque;
+    BlkioQueue *q = opaque;
     int ret;
 
     /* Just in case we already fetched a completion */
-    if (s->poll_completion.user_data != NULL) {
+    if (q->poll_completion.user_data != NULL) {
         return true;
     }
 
-    WITH_QEMU_LOCK_GUARD(&s->blkio_lock) {
-        ret = blkioq_do_io(s->blkioq, &s->poll_completion, 0, 1, NULL);
+    WITH_QEMU_LOCK_GUARD(&q->lock) {
+        ret = blkioq_do_io(q->blkioq, &q->poll_completion, 0, 1, NULL);
     }
     return ret == 1;
 }
@@ -296,62 +305,92 @@ static void blkio_completion_fd_poll_ready(void *opaque)
     blkio_completion_fd_read(opaque);
 }
 
+/*
+ * Completions of all queues are processed in the BDS's AioContext, only
+ * submission is spread across the AioContexts that issue requests.
+ */
 static void blkio_attach_aio_context(BlockDriverState *bs,
                                      AioContext *new_context)
 {
     BDRVBlkioState *s = bs->opaque;
 
-    aio_set_fd_handler(new_context, s->completion_fd,
-                       blkio_completion_fd_read, NULL,
-                       blkio_completion_fd_poll,
-                       blkio_completion_fd_poll_ready, bs);
+    for (int i = 0; i < s->num_queues; i++) {
+        aio_set_fd_handler(new_context, s->queues[i].completion_fd,
+                           blkio_completion_fd_read, NULL,
+                           blkio_completion_fd_poll,
+                           blkio_completion_fd_poll_ready, &s->queues[i]);
+    }
 }
 
 static void blkio_detach_aio_context(BlockDriverState *bs)
 {
     BDRVBlkioState *s = bs->opaque;
 
-    aio_set_fd_handler(bdrv_get_aio_context(bs), s->completion_fd, NULL, NULL,
-                       NULL, NULL, NULL);
+    for (int i = 0; i < s->num_queues; i++) {
+        aio_set_fd_handler(bdrv_get_aio_context(bs),
+                           s->queues[i].completion_fd, NULL, NULL,
+                           NULL, NULL, NULL);
+    }
+}
+
+/*
+ * Each AioContext that submits requests claims a queue of its own while
+ * there are enough of them, so that iothreads serving a multiqueue device do
+ * not contend on one queue and its lock.
+ */
+static BlkioQueue *blkio_get_queue_ctx(BDRVBlkioState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    for (int i = 0; i < s->num_queues; i++) {
+        AioContext *owner = qatomic_read(&s->queue_ctx[i]);
+
+        if (owner == ctx ||
+            (!owner && qatomic_cmpxchg(&s->queue_ctx[i], NULL, ctx) == NULL)) {
+            return &s->queues[i];
+        }
+    }
+
+    /* More AioContexts than queues, share them */
+    return &s->queues[g_direct_hash(ctx) % s->num_queues];
 }
 
 /*
  * Called by defer_call_end() or immediately if not in a deferred section.
- * Called without blkio_lock.
+ * Called without the queue lock.
  */
 static void blkio_deferred_fn(void *opaque)
 {
-    BDRVBlkioState *s = opaque;
+    BlkioQueue *q = opaque;
 
-    WITH_QEMU_LOCK_GUARD(&s->blkio_lock) {
-        blkioq_do_io(s->blkioq, NULL, 0, 0, NULL);
+    WITH_QEMU_LOCK_GUARD(&q->lock) {
+        blkioq_do_io(q->blkioq, NULL, 0, 0, NULL);
     }
 }
 
 /*
- * Schedule I/O submission after enqueuing a new request. Called without
- * blkio_lock.
+ * Schedule I/O submission after enqueuing a new request. Called without the
+ * queue lock.
  */
-static void blkio_submit_io(BlockDriverState *bs)
+static void blkio_submit_io(BlkioQueue *q)
 {
-    BDRVBlkioState *s = bs->opaque;
-
-    defer_call(blkio_deferred_fn, s);
+    defer_call(blkio_deferred_fn, q);
 }
 
 static int coroutine_fn
 blkio_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
 {
     BDRVBlkioState *s = bs->opaque;
+    BlkioQueue *q = blkio_get_queue_ctx(s);
     BlkioCoData cod = {
         .coroutine = qemu_coroutine_self(),
     };
 
-    WITH_QEMU_LOCK_GUARD(&s->blkio_lock) {
-        blkioq_discard(s->blkioq, offset, bytes, &cod, 0);
+    WITH_QEMU_LOCK_GUARD(&q->lock) {
+        blkioq_discard(q->blkioq, offset, bytes, &cod, 0);
     }
 
-    blkio_submit_io(bs);
+    blkio_submit_io(q);
     qemu_coroutine_yield();
     return cod.ret;
 }
@@ -364,6 +403,7 @@ blkio_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
         .coroutine = qemu_coroutine_self(),
     };
     BDRVBlkioState *s = bs->opaque;
+    BlkioQueue *q = blkio_get_queue_ctx(s);
     bool use_bounce_buffer =
         s->needs_mem_regions && !(flags & BDRV_REQ_REGISTERED_BUF);
     BlkioBounceBuf bounce;
@@ -380,11 +420,11 @@ blkio_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
         iovcnt = 1;
     }
 
-    WITH_QEMU_LOCK_GUARD(&s->blkio_lock) {
-        blkioq_readv(s->blkioq, offset, iov, iovcnt, &cod, 0);
+    WITH_QEMU_LOCK_GUARD(&q->lock) {
+        blkioq_readv(q->blkioq, offset, iov, iovcnt, &cod, 0);
     }
 
-    blkio_submit_io(bs);
+    blkio_submit_io(q);
     qemu_coroutine_yield();
 
     if (use_bounce_buffer) {
@@ -408,6 +448,7 @@ static int coroutine_fn blkio_co_pwritev(BlockDriverState *bs, int64_t offset,
         .coroutine = qemu_coroutine_self(),
     };
     BDRVBlkioState *s = bs->opaque;
+    BlkioQueue *q = blkio_get_queue_ctx(s);
     bool use_bounce_buffer =
         s->needs_mem_regions && !(flags & BDRV_REQ_REGISTERED_BUF);
     BlkioBounceBuf bounce;
@@ -425,11 +466,11 @@ static int coroutine_fn blkio_co_pwritev(BlockDriverState *bs, int64_t offset,
         iovcnt = 1;
     }
 
-    WITH_QEMU_LOCK_GUARD(&s->blkio_lock) {
-        blkioq_writev(s->blkioq, offset, iov, iovcnt, &cod, blkio_flags);
+    WITH_QEMU_LOCK_GUARD(&q->lock) {
+        blkioq_writev(q->blkioq, offset, iov, iovcnt, &cod, blkio_flags);
     }
 
-    blkio_submit_io(bs);
+    blkio_submit_io(q);
     qemu_coroutine_yield();
 
     if (use_bounce_buffer) {
@@ -442,15 +483,16 @@ static int coroutine_fn blkio_co_pwritev(BlockDriverState *bs, int64_t offset,
 static int coroutine_fn blkio_co_flush(BlockDriverState *bs)
 {
     BDRVBlkioState *s = bs->opaque;
+    BlkioQueue *q = blkio_get_queue_ctx(s);
     BlkioCoData cod = {
         .coroutine = qemu_coroutine_self(),
     };
 
-    WITH_QEMU_LOCK_GUARD(&s->blkio_lock) {
-        blkioq_flush(s->blkioq, &cod, 0);
+    WITH_QEMU_LOCK_GUARD(&q->lock) {
+        blkioq_flush(q->blkioq, &cod, 0);
     }
 
-    blkio_submit_io(bs);
+    blkio_submit_io(q);
     qemu_coroutine_yield();
     return cod.ret;
 }
@@ -459,6 +501,7 @@ static int coroutine_fn blkio_co_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int64_t bytes, BdrvRequestFlags flags)
 {
     BDRVBlkioState *s = bs->opaque;
+    BlkioQueue *q = blkio_get_queue_ctx(s);
     BlkioCoData cod = {
         .coroutine = qemu_coroutine_self(),
     };
@@ -474,11 +517,11 @@ static int coroutine_fn blkio_co_pwrite_zeroes(BlockDriverState *bs,
         blkio_flags |= BLKIO_REQ_NO_FALLBACK;
     }
 
-    WITH_QEMU_LOCK_GUARD(&s->blkio_lock) {
-        blkioq_write_zeroes(s->blkioq, offset, bytes, &cod, blkio_flags);
+    WITH_QEMU_LOCK_GUARD(&q->lock) {
+        blkioq_write_zeroes(q->blkioq, offset, bytes, &cod, blkio_flags);
     }
 
-    blkio_submit_io(bs);
+    blkio_submit_io(q);
     qemu_coroutine_yield();
     return cod.ret;
 }
@@ -887,6 +930,21 @@ static int blkio_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+    /*
+     * Use one queue per host CPU if the libblkio driver supports several,
+     * multiqueue devices then submit from each iothread to its own queue.
+     */
+    ret = blkio_get_int(s->blkio, "max-queues", &s->num_queues);
+    if (ret < 0 || s->num_queues < 1) {
+        s->num_queues = 1;
+    }
+    s->num_queues = MIN(s->num_queues,
+                        MIN(g_get_num_processors(), BLKIO_MAX_QUEUES));
+    if (s->num_queues > 1 &&
+        blkio_set_int(s->blkio, "num-queues", s->num_queues) < 0) {
+        s->num_queues = 1;
+    }
+
     ret = blkio_start(s->blkio);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "blkio_start failed: %s",
@@ -908,9 +966,14 @@ static int blkio_open(BlockDriverState *bs, QDict *options, int flags,
     qemu_co_mutex_init(&s->bounce_lock);
     qemu_co_queue_init(&s->bounce_available);
     QLIST_INIT(&s->bounce_bufs);
-    s->blkioq = blkio_get_queue(s->blkio, 0);
-    s->completion_fd = blkioq_get_completion_fd(s->blkioq);
-    blkioq_set_completion_fd_enabled(s->blkioq, true);
+    for (int i = 0; i < s->num_queues; i++) {
+        BlkioQueue *q = &s->queues[i];
+
+        qemu_mutex_init(&q->lock);
+        q->blkioq = blkio_get_queue(s->blkio, i);
+        q->completion_fd = blkioq_get_completion_fd(q->blkioq);
+        blkioq_set_completion_fd_enabled(q->blkioq, true);
+    }
 
     blkio_attach_aio_context(bs, bdrv_get_aio_context(bs));
     return 0;
@@ -924,6 +987,9 @@ static void blkio_close(BlockDriverState *bs)
 
     qemu_mutex_destroy(&s->blkio_lock);
     blkio_detach_aio_context(bs);
+    for (int i = 0; i < s->num_queues; i++) {
+        qemu_mutex_destroy(&s->queues[i].lock);
+    }
     blkio_destroy(&s->blkio);
 
     if (s->may_pin_mem_regions) {
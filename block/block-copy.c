@@ -54,6 +54,8 @@ typedef struct BlockCopyCallState {
     int max_workers;
     int64_t max_chunk;
     bool ignore_ratelimit;
+    /* Whether tasks may leave writing to the target to the background */
+    bool staged;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
     /* Coroutine where async block-copy is running */
@@ -125,6 +127,11 @@ typedef struct BlockCopyState {
      * Fields initialized in block_copy_state_new()
      * and never changed.
      */
+    /*
+     * @copy_bitmap_bs is the node block-copy works for.  Staged copies are
+     * accounted in its in_flight counter, so draining it waits for them.
+     */
+    BlockDriverState *copy_bitmap_bs;
     int64_t cluster_size;
     int64_t max_transfer;
     uint64_t len;
@@ -138,6 +145,22 @@ typedef struct BlockCopyState {
     int64_t in_flight_bytes;
     BlockCopyMethod method;
     bool discard_source;
+    /*
+     * @staging_max: limit for the memory of staged copies, i.e. copies that
+     * have read the source data into a buffer and are still writing it to the
+     * target in the background.  Zero disables staging.
+     * @staging_bytes: memory currently used by staged copies.
+     * @staged_error: set by the first staged copy that failed to write to the
+     * target.  The source data it held has been overwritten by then, so all
+     * further block-copy calls fail with this error.
+     * @staged_reqs: requests of staged copies.  These are kept apart from
+     * @reqs, because the source data is already safe once a copy is staged:
+     * block_copy() callers need not wait for them.
+     */
+    uint64_t staging_max;
+    uint64_t staging_bytes;
+    int staged_error;
+    BlockReqList staged_reqs;
     BlockReqList reqs;
     QLIST_HEAD(, BlockCopyCallState) calls;
     /*
@@ -426,6 +449,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
     *s = (BlockCopyState) {
         .source = source,
         .target = target,
+        .copy_bitmap_bs = copy_bitmap_bs,
         .copy_bitmap = copy_bitmap,
         .cluster_size = cluster_size,
         .len = bdrv_dirty_bitmap_size(copy_bitmap),
@@ -441,6 +465,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
 
     ratelimit_init(&s->rate_limit);
     qemu_co_mutex_init(&s->lock);
+    QLIST_INIT(&s->staged_reqs);
     QLIST_INIT(&s->reqs);
     QLIST_INIT(&s->calls);
 
@@ -578,17 +603,150 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
     return ret;
 }
 
+typedef struct BlockCopyStagedWrite {
+    BlockCopyTask task;
+    void *bounce_buffer; /* NULL for COPY_WRITE_ZEROES */
+} BlockCopyStagedWrite;
+
+static void coroutine_fn block_copy_staged_write_co(void *opaque)
+{
+    BlockCopyStagedWrite *sw = opaque;
+    BlockCopyTask *t = &sw->task;
+    BlockCopyState *s = t->s;
+    int64_t nbytes = MIN(task_end(t), s->len) - t->req.offset;
+    int ret;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        if (sw->bounce_buffer) {
+            ret = bdrv_co_pwrite(s->target, t->req.offset, nbytes,
+                                 sw->bounce_buffer, s->write_flags);
+        } else {
+            ret = bdrv_co_pwrite_zeroes(s->target, t->req.offset, nbytes,
+                                        s->write_flags &
+                                        ~BDRV_REQ_WRITE_COMPRESSED);
+        }
+    }
+    if (ret < 0) {
+        trace_block_copy_write_fail(s, t->req.offset, ret);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        if (ret < 0) {
+            if (!s->staged_error) {
+                s->staged_error = ret;
+            }
+        } else if (s->progress) {
+            progress_work_done(s->progress, t->req.bytes);
+        }
+        if (sw->bounce_buffer) {
+            s->staging_bytes -= t->req.bytes;
+        }
+    }
+    co_put_to_shres(s->mem, t->req.bytes);
+    /*
+     * Do not mark the area dirty again on failure: the source has new data by
+     * now, and @staged_error fails all further copies anyway.
+     */
+    block_copy_task_end(t, 0);
+
+    bdrv_dec_in_flight(s->copy_bitmap_bs);
+    qemu_vfree(sw->bounce_buffer);
+    g_free(sw);
+}
+
+/*
+ * Try to copy @t in two steps: read the source data into a buffer now, and
+ * leave writing it to the target to a background coroutine.  The task's
+ * request moves over to that coroutine and stays in s->staged_reqs until the
+ * write is done.
+ *
+ * Returns 0 if the copy has been staged, 1 if it has to be done
+ * synchronously, and -errno if reading the source failed.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+block_copy_try_stage(BlockCopyTask *t, bool *error_is_read)
+{
+    BlockCopyState *s = t->s;
+    int64_t nbytes = MIN(task_end(t), s->len) - t->req.offset;
+    bool need_buffer = t->method != COPY_WRITE_ZEROES;
+    BlockCopyStagedWrite *sw;
+    void *bounce_buffer = NULL;
+    int ret;
+
+    /*
+     * Copy offloading needs the source data to still be there, and discarding
+     * the source after the write would drop the data the guest is about to
+     * write there.
+     */
+    if (t->method == COPY_RANGE_SMALL || t->method == COPY_RANGE_FULL ||
+        s->discard_source) {
+        return 1;
+    }
+
+    if (need_buffer) {
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            if (s->staging_bytes + t->req.bytes > s->staging_max) {
+                return 1;
+            }
+            s->staging_bytes += t->req.bytes;
+        }
+
+        bounce_buffer = qemu_blockalign(s->source->bs, nbytes);
+        ret = bdrv_co_pread(s->source, t->req.offset, nbytes, bounce_buffer, 0);
+        if (ret < 0) {
+            trace_block_copy_read_fail(s, t->req.offset, ret);
+            *error_is_read = true;
+            qemu_vfree(bounce_buffer);
+            WITH_QEMU_LOCK_GUARD(&s->lock) {
+                s->staging_bytes -= t->req.bytes;
+            }
+            return ret;
+        }
+    }
+
+    sw = g_new(BlockCopyStagedWrite, 1);
+    *sw = (BlockCopyStagedWrite) {
+        .task = {
+            .s = s,
+            .method = t->method,
+        },
+        .bounce_buffer = bounce_buffer,
+    };
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        reqlist_init_req(&s->staged_reqs, &sw->task.req, t->req.offset,
+                         t->req.bytes);
+        reqlist_remove_req(&t->req);
+    }
+
+    bdrv_inc_in_flight(s->copy_bitmap_bs);
+    aio_co_enter(bdrv_get_aio_context(s->copy_bitmap_bs),
+                 qemu_coroutine_create(block_copy_staged_write_co, sw));
+
+    return 0;
+}
+
 static coroutine_fn int block_copy_task_entry(AioTask *task)
 {
     BlockCopyTask *t = container_of(task, BlockCopyTask, task);
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
-    int ret = -1;
+    int ret = 1; /* positive: copy synchronously */
 
-    WITH_GRAPH_RDLOCK_GUARD() {
-        ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
-                                 &error_is_read);
+    if (t->call_state->staged) {
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = block_copy_try_stage(t, &error_is_read);
+        }
+        if (ret == 0) {
+            return 0;
+        }
+    }
+
+    if (ret > 0) {
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
+                                     &error_is_read);
+        }
     }
 
     WITH_QEMU_LOCK_GUARD(&s->lock) {
@@ -765,6 +923,14 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
     assert(QEMU_IS_ALIGNED(offset, s->cluster_size));
     assert(QEMU_IS_ALIGNED(bytes, s->cluster_size));
 
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        if (s->staged_error) {
+            call_state->ret = s->staged_error;
+            call_state->error_is_read = false;
+            return s->staged_error;
+        }
+    }
+
     while (bytes && aio_task_pool_status(aio) == 0 &&
            !qatomic_read(&call_state->cancelled)) {
         BlockCopyTask *task;
@@ -852,6 +1018,14 @@ out:
     return ret < 0 ? ret : found_dirty;
 }
 
+int coroutine_fn block_copy_wait_staged(BlockCopyState *s, int64_t offset,
+                                        int64_t bytes)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+    reqlist_wait_all(&s->staged_reqs, offset, bytes, &s->lock);
+    return s->staged_error;
+}
+
 void block_copy_kick(BlockCopyCallState *call_state)
 {
     qemu_co_sleep_wake(&call_state->sleep);
@@ -903,6 +1077,15 @@ block_copy_common(BlockCopyCallState *call_state)
                                                        call_state->offset,
                                                        call_state->bytes) >= 0;
                 }
+                if (ret == 0 && !call_state->staged) {
+                    /*
+                     * Staged copies in the area have to reach the target,
+                     * too.  If they fail, block_copy_dirty_clusters() will
+                     * report it on retry.
+                     */
+                    ret = reqlist_wait_one(&s->staged_reqs, call_state->offset,
+                                           call_state->bytes, &s->lock);
+                }
             }
         }
 
@@ -949,6 +1132,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
         .offset = start,
         .bytes = bytes,
         .ignore_ratelimit = ignore_ratelimit,
+        .staged = s->staging_max > 0,
         .max_workers = BLOCK_COPY_MAX_WORKERS,
         .cb = cb,
         .cb_opaque = cb_opaque,
@@ -1062,6 +1246,12 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
     qatomic_set(&s->skip_unallocated, skip);
 }
 
+/* Only set before running the job, no need for locking. */
+void block_copy_set_staging(BlockCopyState *s, uint64_t max_bytes)
+{
+    s->staging_max = max_bytes;
+}
+
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
 {
     ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
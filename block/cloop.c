@@ -24,8 +24,10 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "block/aio_task.h"
 #include "block/block-io.h"
 #include "block/block_int.h"
+#include "block/thread-pool.h"
 #include "qemu/module.h"
 #include "qemu/bswap.h"
 #include <zlib.h>
@@ -33,16 +35,31 @@
 /* Maximum compressed block size */
 #define MAX_BLOCK_SIZE (64 * 1024 * 1024)
 
+/* Decompressed blocks kept in memory: up to 16 MB, but 1 to 8 blocks */
+#define CLOOP_CACHE_BYTES (16 * 1024 * 1024)
+#define CLOOP_CACHE_MAX 8
+
+/* Blocks decompressed ahead of a sequential reader */
+#define CLOOP_PREFETCH_BLOCKS 2
+
+typedef struct CloopCacheEntry {
+    uint32_t block_num;         /* n_blocks if the entry holds no block */
+    uint64_t last_used;
+    uint8_t *data;
+} CloopCacheEntry;
+
 typedef struct BDRVCloopState {
     CoMutex lock;
     uint32_t block_size;
     uint32_t n_blocks;
     uint64_t *offsets;
     uint32_t sectors_per_block;
-    uint32_t current_block;
-    uint8_t *compressed_block;
-    uint8_t *uncompressed_block;
-    z_stream zstream;
+
+    /* protected by lock */
+    uint64_t next_sector;   /* where the last request ended */
+    uint64_t lru_clock;
+    int cache_size;
+    CloopCacheEntry cache[CLOOP_CACHE_MAX];
 } BDRVCloopState;
 
 static int cloop_probe(const uint8_t *buf, int buf_size, const char *filename)
@@ -64,7 +81,7 @@ static int cloop_open(BlockDriverState *bs, QDict *options, int flags,
                       Error **errp)
 {
     BDRVCloopState *s = bs->opaque;
-    uint32_t offsets_size, max_compressed_block_size = 1, i;
+    uint32_t offsets_size, i;
     int ret;
 
     GLOBAL_STATE_CODE();
@@ -166,7 +183,7 @@ static int cloop_open(BlockDriverState *bs, QDict *options, int flags,
         /* Compressed blocks should be smaller than the uncompressed block size
          * but maybe compression performed poorly so the compressed block is
          * actually bigger.  Clamp down on unrealistic values to prevent
-         * ridiculous s->compressed_block allocation.
+         * ridiculous compressed buffer allocation.
          */
         if (size > 2 * MAX_BLOCK_SIZE) {
             error_setg(errp, "invalid compressed block size at index %" PRIu32
@@ -175,31 +192,15 @@ static int cloop_open(BlockDriverState *bs, QDict *options, int flags,
             goto fail;
         }
 
-        if (size > max_compressed_block_size) {
-            max_compressed_block_size = size;
-        }
-    }
-
-    /* initialize zlib engine */
-    s->compressed_block = g_try_malloc(max_compressed_block_size + 1);
-    if (s->compressed_block == NULL) {
-        error_setg(errp, "Could not allocate compressed_block");
-        ret = -ENOMEM;
-        goto fail;
-    }
-
-    s->uncompressed_block = g_try_malloc(s->block_size);
-    if (s->uncompressed_block == NULL) {
-        error_setg(errp, "Could not allocate uncompressed_block");
-        ret = -ENOMEM;
-        goto fail;
     }
 
-    if (inflateInit(&s->zstream) != Z_OK) {
-        ret = -EINVAL;
-        goto fail;
+    /* Cache entries are allocated when they are first used */
+    s->cache_size = MAX(1, MIN(CLOOP_CACHE_MAX,
+                               CLOOP_CACHE_BYTES / s->block_size));
+    for (i = 0; i < s->cache_size; i++) {
+        s->cache[i].block_num = s->n_blocks;
     }
-    s->current_block = s->n_blocks;
+    s->next_sector = UINT64_MAX;
 
     s->sectors_per_block = s->block_size/512;
     bs->total_sectors = s->n_blocks * s->sectors_per_block;
@@ -208,8 +209,6 @@ static int cloop_open(BlockDriverState *bs, QDict *options, int flags,
 
 fail:
     g_free(s->offsets);
-    g_free(s->compressed_block);
-    g_free(s->uncompressed_block);
     return ret;
 }
 
@@ -218,37 +217,166 @@ static void cloop_refresh_limits(BlockDriverState *bs, Error **errp)
     bs->bl.request_alignment = BDRV_SECTOR_SIZE; /* No sub-sector I/O */
 }
 
-static int coroutine_fn GRAPH_RDLOCK
-cloop_read_block(BlockDriverState *bs, int block_num)
+typedef struct CloopInflate {
+    uint8_t *in;
+    uint32_t in_len;
+    uint8_t *out;
+    uint32_t out_len;
+} CloopInflate;
+
+static int cloop_inflate_worker(void *opaque)
 {
-    BDRVCloopState *s = bs->opaque;
+    CloopInflate *inf = opaque;
+    z_stream zstream = {};
+    int ret;
+
+    if (inflateInit(&zstream) != Z_OK) {
+        return -EINVAL;
+    }
+    zstream.next_in = inf->in;
+    zstream.avail_in = inf->in_len;
+    zstream.next_out = inf->out;
+    zstream.avail_out = inf->out_len;
+    ret = inflate(&zstream, Z_FINISH);
+    if (ret != Z_STREAM_END || zstream.total_out != inf->out_len) {
+        ret = -EIO;
+    } else {
+        ret = 0;
+    }
+    inflateEnd(&zstream);
+    return ret;
+}
+
+typedef struct CloopDecodeTask {
+    AioTask task;
+    BlockDriverState *bs;
+    CloopCacheEntry *entry;
+    uint32_t block_num;
+} CloopDecodeTask;
+
+static int coroutine_fn GRAPH_RDLOCK cloop_decode_task_entry(AioTask *task)
+{
+    CloopDecodeTask *t = container_of(task, CloopDecodeTask, task);
+    BDRVCloopState *s = t->bs->opaque;
+    uint32_t bytes = s->offsets[t->block_num + 1] - s->offsets[t->block_num];
+    g_autofree uint8_t *compressed = NULL;
+    CloopInflate inf;
+    int ret;
+
+    if (!t->entry->data) {
+        t->entry->data = g_try_malloc(s->block_size);
+        if (!t->entry->data) {
+            return -ENOMEM;
+        }
+    }
+
+    compressed = g_try_malloc(bytes);
+    if (bytes && !compressed) {
+        return -ENOMEM;
+    }
+
+    ret = bdrv_co_pread(t->bs->file, s->offsets[t->block_num], bytes,
+                        compressed, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    inf = (CloopInflate) {
+        .in = compressed,
+        .in_len = bytes,
+        .out = t->entry->data,
+        .out_len = s->block_size,
+    };
+    ret = thread_pool_submit_co(cloop_inflate_worker, &inf);
+    if (ret < 0) {
+        return ret;
+    }
 
-    if (s->current_block != block_num) {
-        int ret;
-        uint32_t bytes = s->offsets[block_num + 1] - s->offsets[block_num];
+    t->entry->block_num = t->block_num;
+    return 0;
+}
+
+static CloopCacheEntry *cloop_cache_find(BDRVCloopState *s, uint32_t block_num)
+{
+    int i;
 
-        ret = bdrv_co_pread(bs->file, s->offsets[block_num], bytes,
-                            s->compressed_block, 0);
-        if (ret < 0) {
-            return -1;
+    for (i = 0; i < s->cache_size; i++) {
+        if (s->cache[i].block_num == block_num) {
+            return &s->cache[i];
         }
+    }
+    return NULL;
+}
 
-        s->zstream.next_in = s->compressed_block;
-        s->zstream.avail_in = bytes;
-        s->zstream.next_out = s->uncompressed_block;
-        s->zstream.avail_out = s->block_size;
-        ret = inflateReset(&s->zstream);
-        if (ret != Z_OK) {
-            return -1;
+/* Take the least recently used entry for a block about to be decoded */
+static CloopCacheEntry *cloop_cache_evict(BDRVCloopState *s)
+{
+    CloopCacheEntry *entry = &s->cache[0];
+    int i;
+
+    for (i = 1; i < s->cache_size; i++) {
+        if (s->cache[i].last_used < entry->last_used) {
+            entry = &s->cache[i];
         }
-        ret = inflate(&s->zstream, Z_FINISH);
-        if (ret != Z_STREAM_END || s->zstream.total_out != s->block_size) {
-            return -1;
+    }
+    entry->block_num = s->n_blocks;
+    entry->last_used = ++s->lru_clock;
+    return entry;
+}
+
+/*
+ * Return the cache entry holding @block_num, or NULL on error.
+ *
+ * On a miss, the blocks up to @last_block (the end of the current request)
+ * are decoded together, plus a few more if the request is @sequential,
+ * with decompression running in parallel in the thread pool.
+ */
+static CloopCacheEntry * coroutine_fn GRAPH_RDLOCK
+cloop_read_block(BlockDriverState *bs, uint32_t block_num, uint32_t last_block,
+                 bool sequential)
+{
+    BDRVCloopState *s = bs->opaque;
+    CloopCacheEntry *entry;
+    AioTaskPool *pool;
+    uint32_t n;
+
+    entry = cloop_cache_find(s, block_num);
+    if (entry) {
+        entry->last_used = ++s->lru_clock;
+        return entry;
+    }
+
+    if (sequential) {
+        last_block += CLOOP_PREFETCH_BLOCKS;
+    }
+    last_block = MIN(last_block, s->n_blocks - 1);
+    last_block = MIN(last_block, block_num + s->cache_size - 1);
+
+    pool = aio_task_pool_new(s->cache_size);
+    for (n = block_num; n <= last_block; n++) {
+        CloopDecodeTask *t;
+
+        if (n != block_num && cloop_cache_find(s, n)) {
+            continue;
         }
 
-        s->current_block = block_num;
+        t = g_new(CloopDecodeTask, 1);
+        *t = (CloopDecodeTask) {
+            .task.func = cloop_decode_task_entry,
+            .bs = bs,
+            .entry = cloop_cache_evict(s),
+            .block_num = n,
+        };
+        if (n == block_num) {
+            entry = t->entry;
+        }
+        aio_task_pool_start_task(pool, &t->task);
     }
-    return 0;
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+
+    /* Failing to prefetch a block is not an error for this request */
+    return entry->block_num == block_num ? entry : NULL;
 }
 
 static int coroutine_fn GRAPH_RDLOCK
@@ -258,6 +386,7 @@ cloop_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
     BDRVCloopState *s = bs->opaque;
     uint64_t sector_num = offset >> BDRV_SECTOR_BITS;
     int nb_sectors = bytes >> BDRV_SECTOR_BITS;
+    bool sequential;
     int ret, i;
 
     assert(QEMU_IS_ALIGNED(offset, BDRV_SECTOR_SIZE));
@@ -265,17 +394,30 @@ cloop_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /*
+     * Decide once per request: the blocks of a single request are always
+     * consecutive, so looking at every sector would prefetch for random
+     * reads too.
+     */
+    sequential = sector_num == s->next_sector;
+    s->next_sector = sector_num + nb_sectors;
+
     for (i = 0; i < nb_sectors; i++) {
+        CloopCacheEntry *entry;
         void *data;
         uint32_t sector_offset_in_block =
             ((sector_num + i) % s->sectors_per_block),
             block_num = (sector_num + i) / s->sectors_per_block;
-        if (cloop_read_block(bs, block_num) != 0) {
+
+        entry = cloop_read_block(bs, block_num,
+                                 (sector_num + nb_sectors - 1) /
+                                 s->sectors_per_block, sequential);
+        if (!entry) {
             ret = -EIO;
             goto fail;
         }
 
-        data = s->uncompressed_block + sector_offset_in_block * 512;
+        data = entry->data + sector_offset_in_block * 512;
         qemu_iovec_from_buf(qiov, i * 512, data, 512);
     }
 
@@ -289,10 +431,12 @@ fail:
 static void cloop_close(BlockDriverState *bs)
 {
     BDRVCloopState *s = bs->opaque;
+    int i;
+
     g_free(s->offsets);
-    g_free(s->compressed_block);
-    g_free(s->uncompressed_block);
-    inflateEnd(&s->zstream);
+    for (i = 0; i < s->cache_size; i++) {
+        g_free(s->cache[i].data);
+    }
 }
 
 static BlockDriver bdrv_cloop = {
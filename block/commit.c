@@ -15,6 +15,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/block_int.h"
 #include "block/blockjob_int.h"
 #include "qapi/error.h"
@@ -29,6 +30,9 @@ enum {
      * contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
+
+    /* Number of chunks that are copied in parallel */
+    COMMIT_MAX_WORKERS = 8,
 };
 
 typedef struct CommitBlockJob {
@@ -126,14 +130,49 @@ static void commit_clean(Job *job)
     blk_unref(s->top);
 }
 
+typedef struct CommitExtent {
+    int64_t offset;
+    int64_t bytes;
+    bool copy;
+    bool error_in_source;
+    int ret;
+} CommitExtent;
+
+typedef struct CommitTask {
+    AioTask task;
+    CommitBlockJob *s;
+    CommitExtent *extent;
+    void *buf;
+} CommitTask;
+
+static int coroutine_fn commit_task_entry(AioTask *task)
+{
+    CommitTask *t = container_of(task, CommitTask, task);
+    CommitExtent *e = t->extent;
+    int ret;
+
+    assert(e->bytes < SIZE_MAX);
+
+    ret = blk_co_pread(t->s->top, e->offset, e->bytes, t->buf, 0);
+    if (ret >= 0) {
+        ret = blk_co_pwrite(t->s->base, e->offset, e->bytes, t->buf, 0);
+        if (ret < 0) {
+            e->error_in_source = false;
+        }
+    }
+
+    e->ret = ret;
+    return ret;
+}
+
 static int coroutine_fn commit_run(Job *job, Error **errp)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
     int64_t offset;
     int ret = 0;
-    int64_t n = 0; /* bytes */
-    QEMU_AUTO_VFREE void *buf = NULL;
+    void *bufs[COMMIT_MAX_WORKERS];
     int64_t len, base_len;
+    int i;
 
     len = blk_co_getlength(s->top);
     if (len < 0) {
@@ -153,11 +192,15 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         }
     }
 
-    buf = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
+    for (i = 0; i < COMMIT_MAX_WORKERS; i++) {
+        bufs[i] = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
+    }
 
-    for (offset = 0; offset < len; offset += n) {
-        bool copy;
-        bool error_in_source = true;
+    offset = 0;
+    while (offset < len) {
+        CommitExtent extents[COMMIT_MAX_WORKERS];
+        AioTaskPool *pool;
+        int nr_extents = 0;
 
         /* Note that even when no rate limit is applied we need to yield
          * with no pending I/O here so that bdrv_drain_all() returns.
@@ -166,42 +209,77 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
-        /* Copy if allocated above the base */
-        ret = blk_co_is_allocated_above(s->top, s->base_overlay, true,
-                                        offset, COMMIT_BUFFER_SIZE, &n);
-        copy = (ret > 0);
-        trace_commit_one_iteration(s, offset, n, ret);
-        if (copy) {
-            assert(n < SIZE_MAX);
-
-            ret = blk_co_pread(s->top, offset, n, buf, 0);
-            if (ret >= 0) {
-                ret = blk_co_pwrite(s->base, offset, n, buf, 0);
-                if (ret < 0) {
-                    error_in_source = false;
-                }
+
+        /* Copy the next few chunks that are allocated above the base */
+        pool = aio_task_pool_new(COMMIT_MAX_WORKERS);
+        while (nr_extents < COMMIT_MAX_WORKERS && offset < len) {
+            CommitExtent *e = &extents[nr_extents];
+            int64_t n = 0; /* bytes */
+
+            ret = blk_co_is_allocated_above(s->top, s->base_overlay, true,
+                                            offset, COMMIT_BUFFER_SIZE, &n);
+            trace_commit_one_iteration(s, offset, n, ret);
+
+            *e = (CommitExtent) {
+                .offset = offset,
+                .bytes = n,
+                .copy = (ret > 0),
+                .error_in_source = true,
+                .ret = ret,
+            };
+            offset += n;
+
+            if (e->copy) {
+                CommitTask *t = g_new(CommitTask, 1);
+
+                *t = (CommitTask) {
+                    .task.func = commit_task_entry,
+                    .s = s,
+                    .extent = e,
+                    .buf = bufs[nr_extents],
+                };
+                aio_task_pool_start_task(pool, &t->task);
             }
-        }
-        if (ret < 0) {
-            BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error,
-                                       error_in_source, -ret);
-            if (action == BLOCK_ERROR_ACTION_REPORT) {
-                return ret;
-            } else {
-                n = 0;
-                continue;
+            nr_extents++;
+            if (ret < 0) {
+                break;
             }
         }
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
+        aio_task_pool_wait_all(pool);
+        aio_task_pool_free(pool);
+
+        /* Account for the chunks in order, as if copied one by one */
+        for (i = 0; i < nr_extents; i++) {
+            CommitExtent *e = &extents[i];
+
+            if (e->ret < 0) {
+                BlockErrorAction action =
+                    block_job_error_action(&s->common, s->on_error,
+                                           e->error_in_source, -e->ret);
+                if (action == BLOCK_ERROR_ACTION_REPORT) {
+                    ret = e->ret;
+                    goto out;
+                } else {
+                    /* Retry from here, later chunks are redone as well */
+                    offset = e->offset;
+                    break;
+                }
+            }
+            /* Publish progress */
+            job_progress_update(&s->common.job, e->bytes);
 
-        if (copy) {
-            block_job_ratelimit_processed_bytes(&s->common, n);
+            if (e->copy) {
+                block_job_ratelimit_processed_bytes(&s->common, e->bytes);
+            }
         }
     }
 
-    return 0;
+    ret = 0;
+out:
+    for (i = 0; i < COMMIT_MAX_WORKERS; i++) {
+        qemu_vfree(bufs[i]);
+    }
+    return ret;
 }
 
 static const BlockJobDriver commit_job_driver = {
@@ -45,6 +45,7 @@ typedef struct BDRVCopyBeforeWriteState {
     OnCbwError on_cbw_error;
     uint64_t cbw_timeout_ns;
     bool discard_source;
+    bool staging;
 
     /*
      * @lock: protects access to @access_bitmap, @done_bitmap and
@@ -232,6 +233,17 @@ cbw_snapshot_read_lock(BlockDriverState *bs, int64_t offset, int64_t bytes,
          * cbw_snapshot_read_unlock(). We don't need to lock something to read
          * from s->target.
          */
+        if (s->staging) {
+            int ret = block_copy_wait_staged(s->bcs, offset, *pnum);
+
+            if (ret < 0) {
+                if (!s->snapshot_error) {
+                    s->snapshot_error = ret;
+                }
+                g_free(req);
+                return NULL;
+            }
+        }
         *req = (BlockReq) {.offset = -1, .bytes = -1};
         *file = s->target;
     } else {
@@ -419,6 +431,7 @@ static BlockdevOptions *cbw_parse_options(QDict *options, Error **errp)
     qdict_del(options, "on-cbw-error");
     qdict_del(options, "cbw-timeout");
     qdict_del(options, "min-cluster-size");
+    qdict_del(options, "staging-size");
 
 out:
     visit_free(v);
@@ -487,6 +500,11 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
         return -EINVAL;
     }
 
+    if (opts->has_staging_size && opts->staging_size) {
+        block_copy_set_staging(s->bcs, opts->staging_size);
+        s->staging = true;
+    }
+
     cluster_size = block_copy_cluster_size(s->bcs);
 
     s->done_bitmap = bdrv_create_dirty_bitmap(bs, cluster_size, NULL, errp);
@@ -550,6 +568,7 @@ BlockDriverState *bdrv_cbw_append(BlockDriverState *source,
                                   const char *filter_node_name,
                                   bool discard_source,
                                   uint64_t min_cluster_size,
+                                  uint64_t staging_size,
                                   BlockCopyState **bcs,
                                   Error **errp)
 {
@@ -577,6 +596,14 @@ BlockDriverState *bdrv_cbw_append(BlockDriverState *source,
     }
     qdict_put_int(opts, "min-cluster-size", (int64_t)min_cluster_size);
 
+    if (staging_size > INT64_MAX) {
+        error_setg(errp, "staging-size too large: %" PRIu64 " > %" PRIi64,
+                   staging_size, INT64_MAX);
+        qobject_unref(opts);
+        return NULL;
+    }
+    qdict_put_int(opts, "staging-size", (int64_t)staging_size);
+
     top = bdrv_insert_node(source, opts, flags, errp);
     if (!top) {
         return NULL;
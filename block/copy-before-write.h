@@ -41,6 +41,7 @@ BlockDriverState *bdrv_cbw_append(BlockDriverState *source,
                                   const char *filter_node_name,
                                   bool discard_source,
                                   uint64_t min_cluster_size,
+                                  uint64_t staging_size,
                                   BlockCopyState **bcs,
                                   Error **errp);
 void bdrv_cbw_drop(BlockDriverState *bs);
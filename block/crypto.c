@@ -32,6 +32,7 @@
 #include "qemu/option.h"
 #include "qemu/cutils.h"
 #include "qemu/memalign.h"
+#include "block/thread-pool.h"
 #include "crypto.h"
 
 typedef struct BlockCrypto BlockCrypto;
@@ -466,6 +467,103 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+/*
+ * Buffers of at least two chunks are split into chunks that are encrypted
+ * or decrypted in parallel by the thread pool.  Smaller buffers are
+ * processed in the coroutine, where they take less time than a round trip
+ * through a worker thread.
+ */
+#define BLOCK_CRYPTO_THREAD_CHUNK (64 * 1024)
+
+typedef struct BlockCryptoEncDec {
+    Coroutine *co;
+    unsigned int pending;
+    int ret;
+} BlockCryptoEncDec;
+
+typedef struct BlockCryptoEncDecTask {
+    BlockCryptoEncDec *encdec;
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    bool encrypt;
+} BlockCryptoEncDecTask;
+
+static int block_crypto_encdec(QCryptoBlock *block, uint64_t offset,
+                               uint8_t *buf, size_t len, bool encrypt)
+{
+    int ret;
+
+    if (encrypt) {
+        ret = qcrypto_block_encrypt(block, offset, buf, len, NULL);
+    } else {
+        ret = qcrypto_block_decrypt(block, offset, buf, len, NULL);
+    }
+    return ret < 0 ? -EIO : 0;
+}
+
+static int block_crypto_encdec_pool_func(void *opaque)
+{
+    BlockCryptoEncDecTask *task = opaque;
+
+    return block_crypto_encdec(task->block, task->offset, task->buf,
+                               task->len, task->encrypt);
+}
+
+static void block_crypto_encdec_cb(void *opaque, int ret)
+{
+    BlockCryptoEncDecTask *task = opaque;
+    BlockCryptoEncDec *encdec = task->encdec;
+
+    if (ret < 0) {
+        encdec->ret = ret;
+    }
+    if (--encdec->pending == 0) {
+        aio_co_wake(encdec->co);
+    }
+}
+
+static int coroutine_fn
+block_crypto_co_encdec(BlockCrypto *crypto, uint64_t offset, uint8_t *buf,
+                       size_t len, bool encrypt)
+{
+    BlockCryptoEncDec encdec = {
+        .co = qemu_coroutine_self(),
+    };
+    g_autofree BlockCryptoEncDecTask *tasks = NULL;
+    unsigned int n, i;
+
+    if (len < 2 * BLOCK_CRYPTO_THREAD_CHUNK) {
+        return block_crypto_encdec(crypto->block, offset, buf, len, encrypt);
+    }
+
+    n = DIV_ROUND_UP(len, BLOCK_CRYPTO_THREAD_CHUNK);
+    tasks = g_new(BlockCryptoEncDecTask, n);
+    encdec.pending = n;
+
+    /* The chunk size is a multiple of any encryption sector size */
+    for (i = 0; i < n; i++) {
+        size_t done = (size_t)i * BLOCK_CRYPTO_THREAD_CHUNK;
+
+        tasks[i] = (BlockCryptoEncDecTask) {
+            .encdec = &encdec,
+            .block = crypto->block,
+            .offset = offset + done,
+            .buf = buf + done,
+            .len = MIN(len - done, BLOCK_CRYPTO_THREAD_CHUNK),
+            .encrypt = encrypt,
+        };
+        thread_pool_submit_aio(block_crypto_encdec_pool_func, &tasks[i],
+                               block_crypto_encdec_cb, &tasks[i]);
+    }
+
+    while (encdec.pending) {
+        qemu_coroutine_yield();
+    }
+    return encdec.ret;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
                        QEMUIOVector *qiov, BdrvRequestFlags flags)
@@ -508,9 +606,9 @@ block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(crypto, offset + bytes_done,
+                                     cipher_data, cur_bytes, false);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -565,9 +663,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(crypto, offset + bytes_done,
+                                     cipher_data, cur_bytes, true);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -52,6 +52,9 @@
 #define CURL_NUM_ACB    8
 #define CURL_TIMEOUT_MAX 10000
 
+/* Read-ahead windows kept in flight beyond the end of a sequential read */
+#define CURL_PREFETCH_WINDOWS 2
+
 #define CURL_BLOCK_OPT_URL       "url"
 #define CURL_BLOCK_OPT_READAHEAD "readahead"
 #define CURL_BLOCK_OPT_SSLVERIFY "sslverify"
@@ -101,6 +104,7 @@ typedef struct CURLState
     char range[128];
     char errmsg[CURL_ERROR_SIZE];
     char in_use;
+    uint64_t last_used;
 } CURLState;
 
 typedef struct BDRVCURLState {
@@ -118,6 +122,8 @@ typedef struct BDRVCURLState {
     AioContext *aio_context;
     QemuMutex mutex;
     CoQueue free_state_waitq;
+    uint64_t lru_clock;
+    uint64_t last_read_end;
     char *username;
     char *password;
     char *proxyusername;
@@ -288,6 +294,7 @@ static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
         {
             char *buf = state->orig_buf + (start - state->buf_start);
 
+            state->last_used = ++s->lru_clock;
             qemu_iovec_from_buf(acb->qiov, 0, buf, clamped_len);
             if (clamped_len < len) {
                 qemu_iovec_memset(acb->qiov, clamped_len, 0, len - clamped_len);
@@ -441,13 +448,16 @@ static CURLState *curl_find_state(BDRVCURLState *s)
     CURLState *state = NULL;
     int i;
 
+    /* Evict the least recently used buffer, so read-ahead data stays around */
     for (i = 0; i < CURL_NUM_STATES; i++) {
-        if (!s->states[i].in_use) {
+        if (!s->states[i].in_use &&
+            (!state || s->states[i].last_used < state->last_used)) {
             state = &s->states[i];
-            state->in_use = 1;
-            break;
         }
     }
+    if (state) {
+        state->in_use = 1;
+    }
     return state;
 }
 
@@ -482,6 +492,12 @@ static int curl_init_state(BDRVCURLState *s, CURLState *state)
             curl_easy_setopt(state->curl, CURLOPT_FAILONERROR, 1)) {
             goto err;
         }
+#if LIBCURL_VERSION_NUM >= 0x072b00
+        /* Prefer multiplexing over an existing HTTP/2 connection */
+        if (curl_easy_setopt(state->curl, CURLOPT_PIPEWAIT, 1L)) {
+            goto err;
+        }
+#endif
         if (s->username) {
             if (curl_easy_setopt(state->curl, CURLOPT_USERNAME, s->username)) {
                 goto err;
@@ -608,6 +624,9 @@ static void curl_attach_aio_context(BlockDriverState *bs,
     curl_multi_setopt(s->multi, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERFUNCTION, curl_timer_cb);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    curl_multi_setopt(s->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 }
 
 static QemuOptsList runtime_opts = {
@@ -882,18 +901,104 @@ out_noclean:
     return -EINVAL;
 }
 
+/* Called with s->mutex held.  */
+static int curl_start_transfer(BDRVCURLState *s, CURLState *state,
+                               uint64_t start, size_t len)
+{
+    int running;
+
+    state->buf_off = 0;
+    g_free(state->orig_buf);
+    state->buf_start = start;
+    state->buf_len = len;
+    state->orig_buf = g_try_malloc(state->buf_len);
+    if (state->buf_len && state->orig_buf == NULL) {
+        return -ENOMEM;
+    }
+    state->last_used = ++s->lru_clock;
+
+    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64,
+             start, start + len - 1);
+    if (curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range) ||
+        curl_multi_add_handle(s->multi, state->curl) != CURLM_OK) {
+        return -EIO;
+    }
+
+    /* Tell curl it needs to kick things off */
+    curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    return 0;
+}
+
+/*
+ * For sequential reads, fetch the next read-ahead windows on other
+ * connections while the guest is still consuming the current one.  One
+ * connection is always left free for other requests.
+ *
+ * Called with s->mutex held.
+ */
+static void curl_prefetch(BDRVCURLState *s, uint64_t end)
+{
+    uint64_t start = end;
+    CURLState *state;
+    int nr_free = 0;
+    int i, j;
+
+    /* Skip the buffers that already hold or are fetching the stream */
+    for (j = 0; j < CURL_NUM_STATES; j++) {
+        for (i = 0; i < CURL_NUM_STATES; i++) {
+            uint64_t buf_end;
+
+            state = &s->states[i];
+            buf_end = state->buf_start +
+                      (state->in_use ? state->buf_len : state->buf_off);
+            if (state->orig_buf && start >= state->buf_start &&
+                start < buf_end) {
+                start = buf_end;
+                break;
+            }
+        }
+        if (i == CURL_NUM_STATES) {
+            break;
+        }
+    }
+
+    if (!s->readahead_size || start >= s->len ||
+        start >= end + CURL_PREFETCH_WINDOWS * s->readahead_size) {
+        return;
+    }
+
+    for (i = 0; i < CURL_NUM_STATES; i++) {
+        nr_free += !s->states[i].in_use;
+    }
+    if (nr_free < 2) {
+        return;
+    }
+
+    state = curl_find_state(s);
+    if (curl_init_state(s, state) < 0 ||
+        curl_start_transfer(s, state, start,
+                            MIN(s->readahead_size, s->len - start)) < 0) {
+        curl_clean_state(state);
+        return;
+    }
+    trace_curl_prefetch(start, state->range);
+}
+
 static void coroutine_fn curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
 {
     CURLState *state;
-    int running;
+    int ret;
 
     BDRVCURLState *s = bs->opaque;
 
     uint64_t start = acb->offset;
-    uint64_t end;
+    bool sequential;
 
     qemu_mutex_lock(&s->mutex);
 
+    sequential = start == s->last_read_end;
+    s->last_read_end = start + acb->bytes;
+
     // In case we have the requested data already (e.g. read-ahead),
     // we can just call the callback and be done.
     if (curl_find_buf(s, start, acb->bytes, acb)) {
@@ -918,34 +1023,23 @@ static void coroutine_fn curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
     acb->start = 0;
     acb->end = MIN(acb->bytes, s->len - start);
 
-    state->buf_off = 0;
-    g_free(state->orig_buf);
-    state->buf_start = start;
-    state->buf_len = MIN(acb->end + s->readahead_size, s->len - start);
-    end = start + state->buf_len - 1;
-    state->orig_buf = g_try_malloc(state->buf_len);
-    if (state->buf_len && state->orig_buf == NULL) {
-        curl_clean_state(state);
-        acb->ret = -ENOMEM;
-        goto out;
-    }
     state->acb[0] = acb;
-
-    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64, start, end);
-    trace_curl_setup_preadv(acb->bytes, start, state->range);
-    if (curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range) ||
-        curl_multi_add_handle(s->multi, state->curl) != CURLM_OK) {
+    ret = curl_start_transfer(s, state, start,
+                              MIN(acb->end + s->readahead_size,
+                                  s->len - start));
+    if (ret < 0) {
         state->acb[0] = NULL;
-        acb->ret = -EIO;
+        acb->ret = ret;
 
         curl_clean_state(state);
         goto out;
     }
-
-    /* Tell curl it needs to kick things off */
-    curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    trace_curl_setup_preadv(acb->bytes, start, state->range);
 
 out:
+    if (sequential) {
+        curl_prefetch(s, s->last_read_end);
+    }
     qemu_mutex_unlock(&s->mutex);
 }
 
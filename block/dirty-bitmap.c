@@ -61,9 +61,19 @@ struct BdrvDirtyBitmapIter {
     BdrvDirtyBitmap *bitmap;
 };
 
+/*
+ * Everything but bdrv_set_dirty() takes the lock through here.  As the caller
+ * may clear bits, enable bitmaps or add new ones, forget the range that
+ * bdrv_set_dirty() knows to be dirty.
+ */
 static inline void bdrv_dirty_bitmaps_lock(BlockDriverState *bs)
 {
     qemu_mutex_lock(&bs->dirty_bitmap_mutex);
+    if (bs->dirty_known_bytes) {
+        seqlock_write_begin(&bs->dirty_bitmap_seqlock);
+        bs->dirty_known_bytes = 0;
+        seqlock_write_end(&bs->dirty_bitmap_seqlock);
+    }
 }
 
 static inline void bdrv_dirty_bitmaps_unlock(BlockDriverState *bs)
@@ -653,16 +663,76 @@ void bdrv_dirty_bitmap_deserialize_finish(BdrvDirtyBitmap *bitmap)
     hbitmap_deserialize_finish(bitmap->bitmap);
 }
 
+/*
+ * Return whether [@offset, @offset + @bytes) is known to be set in all enabled
+ * dirty bitmaps of @bs.  Called without dirty_bitmap_mutex.
+ *
+ * A stale "true" is fine: it means the range was dirty at some point after the
+ * write that is being recorded had completed, so whoever clears it afterwards
+ * and then reads the data sees that write.
+ */
+static bool bdrv_dirty_range_known(BlockDriverState *bs,
+                                   int64_t offset, int64_t bytes)
+{
+    int64_t known_offset, known_bytes;
+    unsigned seq;
+
+    /* Order the completion of the write before the check */
+    smp_mb();
+
+    do {
+        seq = seqlock_read_begin(&bs->dirty_bitmap_seqlock);
+        known_offset = bs->dirty_known_offset;
+        known_bytes = bs->dirty_known_bytes;
+    } while (seqlock_read_retry(&bs->dirty_bitmap_seqlock, seq));
+
+    return known_bytes && offset >= known_offset &&
+           offset + bytes <= known_offset + known_bytes;
+}
+
+/*
+ * Remember that [@offset, @offset + @bytes) has just been set in all enabled
+ * bitmaps.  Sequential writes grow the known range instead of replacing it.
+ * Called with dirty_bitmap_mutex held.
+ */
+static void bdrv_dirty_range_remember(BlockDriverState *bs,
+                                      int64_t offset, int64_t bytes)
+{
+    int64_t known_end = bs->dirty_known_offset + bs->dirty_known_bytes;
+    int64_t end = offset + bytes;
+
+    if (bs->dirty_known_bytes && offset <= known_end &&
+        end >= bs->dirty_known_offset)
+    {
+        offset = MIN(offset, bs->dirty_known_offset);
+        end = MAX(end, known_end);
+    }
+
+    seqlock_write_begin(&bs->dirty_bitmap_seqlock);
+    bs->dirty_known_offset = offset;
+    bs->dirty_known_bytes = end - offset;
+    seqlock_write_end(&bs->dirty_bitmap_seqlock);
+}
+
 void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
 {
     BdrvDirtyBitmap *bitmap;
     IO_CODE();
 
-    if (QLIST_EMPTY(&bs->dirty_bitmaps)) {
+    if (QLIST_EMPTY(&bs->dirty_bitmaps) || !bytes) {
         return;
     }
 
-    bdrv_dirty_bitmaps_lock(bs);
+    /*
+     * Setting bits that are already set changes nothing, so rewrites of a hot
+     * area do not need to serialize with each other on dirty_bitmap_mutex.
+     */
+    if (bdrv_dirty_range_known(bs, offset, bytes)) {
+        return;
+    }
+
+    /* Not bdrv_dirty_bitmaps_lock(), which would forget the known range */
+    qemu_mutex_lock(&bs->dirty_bitmap_mutex);
     QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
         if (!bdrv_dirty_bitmap_enabled(bitmap)) {
             continue;
@@ -670,6 +740,7 @@ void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
         assert(!bdrv_dirty_bitmap_readonly(bitmap));
         hbitmap_set(bitmap->bitmap, offset, bytes);
     }
+    bdrv_dirty_range_remember(bs, offset, bytes);
     bdrv_dirty_bitmaps_unlock(bs);
 }
 
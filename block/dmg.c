@@ -23,8 +23,10 @@
  */
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "block/aio_task.h"
 #include "block/block-io.h"
 #include "block/block_int.h"
+#include "block/thread-pool.h"
 #include "qemu/bswap.h"
 #include "qemu/error-report.h"
 #include "qemu/module.h"
@@ -454,7 +456,7 @@ static int dmg_open(BlockDriverState *bs, QDict *options, int flags,
     uint64_t rsrc_fork_offset, rsrc_fork_length;
     uint64_t plist_xml_offset, plist_xml_length;
     int64_t offset;
-    int ret;
+    int ret, i;
 
     GLOBAL_STATE_CODE();
 
@@ -559,22 +561,15 @@ static int dmg_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
-    /* initialize zlib engine */
-    s->compressed_chunk = qemu_try_blockalign(bs->file->bs,
-                                              ds.max_compressed_size + 1);
-    s->uncompressed_chunk = qemu_try_blockalign(bs->file->bs,
-                                                512 * ds.max_sectors_per_chunk);
-    if (s->compressed_chunk == NULL || s->uncompressed_chunk == NULL) {
-        ret = -ENOMEM;
-        goto fail;
-    }
-
-    if (inflateInit(&s->zstream) != Z_OK) {
-        ret = -EINVAL;
-        goto fail;
+    /* Cache entries are allocated when they are first used */
+    s->cache_chunk_bytes = 512 * (uint64_t)ds.max_sectors_per_chunk;
+    s->cache_size = MAX(1, MIN(DMG_CACHE_MAX,
+                               DMG_CACHE_BYTES / s->cache_chunk_bytes));
+    for (i = 0; i < s->cache_size; i++) {
+        s->cache[i].chunk = s->n_chunks;
     }
-
     s->current_chunk = s->n_chunks;
+    s->next_sector = UINT64_MAX;
 
     qemu_co_mutex_init(&s->lock);
     return 0;
@@ -585,8 +580,6 @@ fail:
     g_free(s->lengths);
     g_free(s->sectors);
     g_free(s->sectorcounts);
-    qemu_vfree(s->compressed_chunk);
-    qemu_vfree(s->uncompressed_chunk);
     return ret;
 }
 
@@ -627,100 +620,232 @@ err:
     return s->n_chunks; /* error */
 }
 
-static int coroutine_fn GRAPH_RDLOCK
-dmg_read_chunk(BlockDriverState *bs, uint64_t sector_num)
+typedef struct DMGDecompress {
+    uint32_t type;
+    uint8_t *in;
+    uint64_t in_len;
+    uint8_t *out;
+    uint64_t out_len;
+} DMGDecompress;
+
+static int dmg_decompress_worker(void *opaque)
+{
+    DMGDecompress *d = opaque;
+    z_stream zstream = {};
+    int ret;
+
+    switch (d->type) {
+    case UDZO: /* zlib compressed */
+        if (inflateInit(&zstream) != Z_OK) {
+            return -1;
+        }
+        zstream.next_in = d->in;
+        zstream.avail_in = d->in_len;
+        zstream.next_out = d->out;
+        zstream.avail_out = d->out_len;
+        ret = inflate(&zstream, Z_FINISH);
+        if (ret != Z_STREAM_END || zstream.total_out != d->out_len) {
+            ret = -1;
+        } else {
+            ret = 0;
+        }
+        inflateEnd(&zstream);
+        return ret;
+    case UDBZ: /* bzip2 compressed */
+        return dmg_uncompress_bz2((char *)d->in, (unsigned int) d->in_len,
+                                  (char *)d->out, (unsigned int) d->out_len);
+    case ULFO:
+        return dmg_uncompress_lzfse((char *)d->in, (unsigned int) d->in_len,
+                                    (char *)d->out, (unsigned int) d->out_len);
+    default:
+        g_assert_not_reached();
+    }
+}
+
+typedef struct DMGDecodeTask {
+    AioTask task;
+    BlockDriverState *bs;
+    DMGCacheEntry *entry;
+    uint32_t chunk;
+} DMGDecodeTask;
+
+static int coroutine_fn GRAPH_RDLOCK dmg_decode_task_entry(AioTask *task)
 {
+    DMGDecodeTask *t = container_of(task, DMGDecodeTask, task);
+    BlockDriverState *bs = t->bs;
     BDRVDMGState *s = bs->opaque;
+    uint32_t chunk = t->chunk;
+    uint8_t *compressed = NULL;
+    DMGDecompress d;
+    int ret;
+
+    if (!t->entry->data) {
+        t->entry->data = qemu_try_blockalign(bs->file->bs,
+                                             s->cache_chunk_bytes);
+        if (!t->entry->data) {
+            return -ENOMEM;
+        }
+    }
+
+    switch (s->types[chunk]) { /* block entry type */
+    case UDZO: /* zlib compressed */
+    case UDBZ: /* bzip2 compressed */
+    case ULFO:
+        if ((s->types[chunk] == UDBZ && !dmg_uncompress_bz2) ||
+            (s->types[chunk] == ULFO && !dmg_uncompress_lzfse)) {
+            break;
+        }
+        /* we need to buffer, because only the chunk as whole can be
+         * inflated. */
+        compressed = qemu_try_blockalign(bs->file->bs, s->lengths[chunk] + 1);
+        if (!compressed) {
+            return -ENOMEM;
+        }
+        ret = bdrv_co_pread(bs->file, s->offsets[chunk], s->lengths[chunk],
+                            compressed, 0);
+        if (ret < 0) {
+            goto out;
+        }
+
+        d = (DMGDecompress) {
+            .type = s->types[chunk],
+            .in = compressed,
+            .in_len = s->lengths[chunk],
+            .out = t->entry->data,
+            .out_len = 512 * s->sectorcounts[chunk],
+        };
+        ret = thread_pool_submit_co(dmg_decompress_worker, &d);
+        if (ret < 0) {
+            goto out;
+        }
+        break;
+    case UDRW: /* copy */
+        ret = bdrv_co_pread(bs->file, s->offsets[chunk], s->lengths[chunk],
+                            t->entry->data, 0);
+        if (ret < 0) {
+            return ret;
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    t->entry->chunk = chunk;
+    ret = 0;
+out:
+    qemu_vfree(compressed);
+    return ret;
+}
+
+/* UDZE and UDIG chunks are not read, see dmg_co_preadv */
+static bool dmg_chunk_needs_buffer(BDRVDMGState *s, uint32_t chunk)
+{
+    return s->types[chunk] != UDZE && s->types[chunk] != UDIG;
+}
+
+static DMGCacheEntry *dmg_cache_find(BDRVDMGState *s, uint32_t chunk)
+{
+    int i;
+
+    for (i = 0; i < s->cache_size; i++) {
+        if (s->cache[i].chunk == chunk) {
+            return &s->cache[i];
+        }
+    }
+    return NULL;
+}
+
+/* Take the least recently used entry for a chunk about to be decoded */
+static DMGCacheEntry *dmg_cache_evict(BDRVDMGState *s)
+{
+    DMGCacheEntry *entry = &s->cache[0];
+    int i;
 
-    if (!is_sector_in_chunk(s, s->current_chunk, sector_num)) {
-        int ret;
-        uint32_t chunk = search_chunk(s, sector_num);
+    for (i = 1; i < s->cache_size; i++) {
+        if (s->cache[i].last_used < entry->last_used) {
+            entry = &s->cache[i];
+        }
+    }
+    entry->chunk = s->n_chunks;
+    entry->last_used = ++s->lru_clock;
+    return entry;
+}
+
+/*
+ * Make s->current_chunk the chunk containing @sector_num and return its
+ * cache entry in *@entry (NULL for chunks that read as zeroes).
+ *
+ * On a miss, the chunks up to @last_sector (the end of the current request)
+ * are decoded together, plus a few more if the request is @sequential, with
+ * decompression running in parallel in the thread pool.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+dmg_read_chunk(BlockDriverState *bs, uint64_t sector_num, uint64_t last_sector,
+               bool sequential, DMGCacheEntry **entry)
+{
+    BDRVDMGState *s = bs->opaque;
+    AioTaskPool *pool;
+    uint32_t chunk, last_chunk, n;
 
+    if (is_sector_in_chunk(s, s->current_chunk, sector_num)) {
+        chunk = s->current_chunk;
+    } else {
+        chunk = search_chunk(s, sector_num);
         if (chunk >= s->n_chunks) {
             return -1;
         }
+    }
+    s->current_chunk = chunk;
 
-        s->current_chunk = s->n_chunks;
-        switch (s->types[chunk]) { /* block entry type */
-        case UDZO: { /* zlib compressed */
-            /* we need to buffer, because only the chunk as whole can be
-             * inflated. */
-            ret = bdrv_co_pread(bs->file, s->offsets[chunk], s->lengths[chunk],
-                                s->compressed_chunk, 0);
-            if (ret < 0) {
-                return -1;
-            }
+    *entry = NULL;
+    if (!dmg_chunk_needs_buffer(s, chunk)) {
+        return 0;
+    }
 
-            s->zstream.next_in = s->compressed_chunk;
-            s->zstream.avail_in = s->lengths[chunk];
-            s->zstream.next_out = s->uncompressed_chunk;
-            s->zstream.avail_out = 512 * s->sectorcounts[chunk];
-            ret = inflateReset(&s->zstream);
-            if (ret != Z_OK) {
-                return -1;
-            }
-            ret = inflate(&s->zstream, Z_FINISH);
-            if (ret != Z_STREAM_END ||
-                s->zstream.total_out != 512 * s->sectorcounts[chunk]) {
-                return -1;
-            }
-            break; }
-        case UDBZ: /* bzip2 compressed */
-            if (!dmg_uncompress_bz2) {
-                break;
-            }
-            /* we need to buffer, because only the chunk as whole can be
-             * inflated. */
-            ret = bdrv_co_pread(bs->file, s->offsets[chunk], s->lengths[chunk],
-                                s->compressed_chunk, 0);
-            if (ret < 0) {
-                return -1;
-            }
+    *entry = dmg_cache_find(s, chunk);
+    if (*entry) {
+        (*entry)->last_used = ++s->lru_clock;
+        return 0;
+    }
 
-            ret = dmg_uncompress_bz2((char *)s->compressed_chunk,
-                                     (unsigned int) s->lengths[chunk],
-                                     (char *)s->uncompressed_chunk,
-                                     (unsigned int)
-                                         (512 * s->sectorcounts[chunk]));
-            if (ret < 0) {
-                return ret;
-            }
-            break;
-        case ULFO:
-            if (!dmg_uncompress_lzfse) {
-                break;
-            }
-            /* we need to buffer, because only the chunk as whole can be
-             * inflated. */
-            ret = bdrv_co_pread(bs->file, s->offsets[chunk], s->lengths[chunk],
-                                s->compressed_chunk, 0);
-            if (ret < 0) {
-                return -1;
-            }
+    last_chunk = search_chunk(s, last_sector);
+    if (last_chunk >= s->n_chunks) {
+        last_chunk = chunk;
+    }
+    if (sequential) {
+        last_chunk += DMG_PREFETCH_CHUNKS;
+    }
+    last_chunk = MIN(last_chunk, s->n_chunks - 1);
+    last_chunk = MIN(last_chunk, chunk + s->cache_size - 1);
 
-            ret = dmg_uncompress_lzfse((char *)s->compressed_chunk,
-                                       (unsigned int) s->lengths[chunk],
-                                       (char *)s->uncompressed_chunk,
-                                       (unsigned int)
-                                           (512 * s->sectorcounts[chunk]));
-            if (ret < 0) {
-                return ret;
-            }
-            break;
-        case UDRW: /* copy */
-            ret = bdrv_co_pread(bs->file, s->offsets[chunk], s->lengths[chunk],
-                                s->uncompressed_chunk, 0);
-            if (ret < 0) {
-                return -1;
-            }
-            break;
-        case UDZE: /* zeros */
-        case UDIG: /* ignore */
-            /* see dmg_read, it is treated specially. No buffer needs to be
-             * pre-filled, the zeroes can be set directly. */
-            break;
+    pool = aio_task_pool_new(s->cache_size);
+    for (n = chunk; n <= last_chunk; n++) {
+        DMGDecodeTask *t;
+
+        if (!dmg_chunk_needs_buffer(s, n) ||
+            (n != chunk && dmg_cache_find(s, n))) {
+            continue;
+        }
+
+        t = g_new(DMGDecodeTask, 1);
+        *t = (DMGDecodeTask) {
+            .task.func = dmg_decode_task_entry,
+            .bs = bs,
+            .entry = dmg_cache_evict(s),
+            .chunk = n,
+        };
+        if (n == chunk) {
+            *entry = t->entry;
         }
-        s->current_chunk = chunk;
+        aio_task_pool_start_task(pool, &t->task);
+    }
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+
+    /* Failing to prefetch a chunk is not an error for this request */
+    if ((*entry)->chunk != chunk) {
+        s->current_chunk = s->n_chunks;
+        return -1;
     }
     return 0;
 }
@@ -732,6 +857,7 @@ dmg_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
     BDRVDMGState *s = bs->opaque;
     uint64_t sector_num = offset >> BDRV_SECTOR_BITS;
     int nb_sectors = bytes >> BDRV_SECTOR_BITS;
+    bool sequential;
     int ret, i;
 
     assert(QEMU_IS_ALIGNED(offset, BDRV_SECTOR_SIZE));
@@ -739,24 +865,33 @@ dmg_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /*
+     * Decide once per request: the chunks of a single request are always
+     * consecutive, so looking at every sector would prefetch for random
+     * reads too.
+     */
+    sequential = sector_num == s->next_sector;
+    s->next_sector = sector_num + nb_sectors;
+
     for (i = 0; i < nb_sectors; i++) {
         uint32_t sector_offset_in_chunk;
+        DMGCacheEntry *entry;
         void *data;
 
-        if (dmg_read_chunk(bs, sector_num + i) != 0) {
+        if (dmg_read_chunk(bs, sector_num + i, sector_num + nb_sectors - 1,
+                           sequential, &entry) != 0) {
             ret = -EIO;
             goto fail;
         }
         /* Special case: current chunk is all zeroes. Do not perform a memcpy as
-         * s->uncompressed_chunk may be too small to cover the large all-zeroes
+         * the cache entries may be too small to cover the large all-zeroes
          * section. dmg_read_chunk is called to find s->current_chunk */
-        if (s->types[s->current_chunk] == UDZE
-            || s->types[s->current_chunk] == UDIG) { /* all zeroes block entry */
+        if (!entry) { /* all zeroes block entry */
             qemu_iovec_memset(qiov, i * 512, 0, 512);
             continue;
         }
         sector_offset_in_chunk = sector_num + i - s->sectors[s->current_chunk];
-        data = s->uncompressed_chunk + sector_offset_in_chunk * 512;
+        data = entry->data + sector_offset_in_chunk * 512;
         qemu_iovec_from_buf(qiov, i * 512, data, 512);
     }
 
@@ -769,16 +904,16 @@ fail:
 static void dmg_close(BlockDriverState *bs)
 {
     BDRVDMGState *s = bs->opaque;
+    int i;
 
     g_free(s->types);
     g_free(s->offsets);
     g_free(s->lengths);
     g_free(s->sectors);
     g_free(s->sectorcounts);
-    qemu_vfree(s->compressed_chunk);
-    qemu_vfree(s->uncompressed_chunk);
-
-    inflateEnd(&s->zstream);
+    for (i = 0; i < s->cache_size; i++) {
+        qemu_vfree(s->cache[i].data);
+    }
 }
 
 static BlockDriver bdrv_dmg = {
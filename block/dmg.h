@@ -29,6 +29,19 @@
 #include "block/block_int.h"
 #include <zlib.h>
 
+/* Decompressed chunks kept in memory: up to 16 MB, but 1 to 8 chunks */
+#define DMG_CACHE_BYTES (16 * 1024 * 1024)
+#define DMG_CACHE_MAX 8
+
+/* Chunks decompressed ahead of a sequential reader */
+#define DMG_PREFETCH_CHUNKS 2
+
+typedef struct DMGCacheEntry {
+    uint32_t chunk;             /* n_chunks if the entry holds no chunk */
+    uint64_t last_used;
+    uint8_t *data;
+} DMGCacheEntry;
+
 typedef struct BDRVDMGState {
     CoMutex lock;
     /* each chunk contains a certain number of sectors,
@@ -45,10 +58,14 @@ typedef struct BDRVDMGState {
     uint64_t *lengths;
     uint64_t *sectors;
     uint64_t *sectorcounts;
+
+    /* protected by lock */
     uint32_t current_chunk;
-    uint8_t *compressed_chunk;
-    uint8_t *uncompressed_chunk;
-    z_stream zstream;
+    uint64_t next_sector;   /* where the last request ended */
+    uint64_t lru_clock;
+    uint64_t cache_chunk_bytes;
+    int cache_size;
+    DMGCacheEntry cache[DMG_CACHE_MAX];
 } BDRVDMGState;
 
 typedef int BdrvDmgUncompressFunc(char *next_in, unsigned int avail_in,
@@ -202,6 +202,82 @@ fail:
     return NULL;
 }
 
+bool blk_exp_iothreads_init(BlockExportIOThreads *threads, strList *iothreads,
+                            Error **errp)
+{
+    strList *node;
+    size_t i;
+
+    *threads = (BlockExportIOThreads) {};
+
+    for (node = iothreads; node; node = node->next) {
+        threads->num_iothreads++;
+    }
+    if (!threads->num_iothreads) {
+        error_setg(errp, "iothreads must not be empty");
+        return false;
+    }
+
+    threads->iothreads = g_new0(IOThread *, threads->num_iothreads);
+    for (node = iothreads, i = 0; node; node = node->next, i++) {
+        IOThread *iothread = iothread_by_id(node->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", node->value);
+            blk_exp_iothreads_cleanup(threads);
+            return false;
+        }
+        threads->iothreads[i] = iothread;
+        object_ref(OBJECT(iothread));
+    }
+
+    return true;
+}
+
+void blk_exp_iothreads_cleanup(BlockExportIOThreads *threads)
+{
+    size_t i;
+
+    for (i = 0; i < threads->num_iothreads; i++) {
+        if (threads->iothreads[i]) {
+            object_unref(OBJECT(threads->iothreads[i]));
+        }
+    }
+
+    g_free(threads->iothreads);
+    *threads = (BlockExportIOThreads) {};
+}
+
+bool blk_exp_vq_iothreads_init(BlockExportVqIOThreads *vq_iothreads,
+                               strList *iothreads, uint16_t num_queues,
+                               Error **errp)
+{
+    BlockExportIOThreads *threads = &vq_iothreads->threads;
+    size_t i;
+
+    *vq_iothreads = (BlockExportVqIOThreads) {};
+
+    if (!blk_exp_iothreads_init(threads, iothreads, errp)) {
+        return false;
+    }
+
+    vq_iothreads->vq_ctx = g_new0(AioContext *, num_queues);
+    for (i = 0; i < num_queues; i++) {
+        IOThread *iothread = threads->iothreads[i % threads->num_iothreads];
+
+        vq_iothreads->vq_ctx[i] = iothread_get_aio_context(iothread);
+    }
+
+    return true;
+}
+
+void blk_exp_vq_iothreads_cleanup(BlockExportVqIOThreads *vq_iothreads)
+{
+    blk_exp_iothreads_cleanup(&vq_iothreads->threads);
+    g_free(vq_iothreads->vq_ctx);
+    *vq_iothreads = (BlockExportVqIOThreads) {};
+}
+
 void blk_exp_ref(BlockExport *exp)
 {
     assert(qatomic_read(&exp->refcount) > 0);
@@ -49,10 +49,21 @@ typedef struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
+    /*
+     * Request buffers of finished requests, ready for reuse.  Every request
+     * is processed in a coroutine of its own and needs its own buffer, so
+     * this holds at most as many as there were requests in flight at once.
+     */
+    GSList *spare_bufs;
     unsigned int in_flight; /* atomic */
     bool mounted, fd_handler_set_up;
 
+    /*
+     * Serializes changes of the image length, so that concurrent requests
+     * that grow the image cannot truncate over each other's data
+     */
+    CoMutex resize_lock;
+
     char *mountpoint;
     bool writable;
     bool growable;
@@ -140,6 +151,8 @@ static int fuse_export_create(BlockExport *blk_exp,
 
     blk_set_dev_ops(exp->common.blk, &fuse_export_blk_dev_ops, exp);
 
+    qemu_co_mutex_init(&exp->resize_lock);
+
     /*
      * We handle draining ourselves using an in-flight counter and by disabling
      * the FUSE fd handler. Do not queue BlockBackend requests, they need to
@@ -282,28 +295,36 @@ fail:
 }
 
 /**
- * Callback to be invoked when the FUSE session FD can be read from.
- * (This is basically the FUSE event loop.)
+ * Read one request and process it.  Once it yields for I/O, the next
+ * request can be read and processed concurrently.
  */
-static void read_from_fuse_export(void *opaque)
+static void coroutine_fn co_read_from_fuse_export(void *opaque)
 {
     FuseExport *exp = opaque;
+    struct fuse_buf fuse_buf = {};
     int ret;
 
-    blk_exp_ref(&exp->common);
-
-    qatomic_inc(&exp->in_flight);
+    if (exp->spare_bufs) {
+        /* libfuse allocates a buffer if .mem is NULL, so recycle ours */
+        fuse_buf.mem = exp->spare_bufs->data;
+        exp->spare_bufs = g_slist_delete_link(exp->spare_bufs,
+                                              exp->spare_bufs);
+    }
 
     do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
+        ret = fuse_session_receive_buf(exp->fuse_session, &fuse_buf);
     } while (ret == -EINTR);
     if (ret < 0) {
         goto out;
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+    fuse_session_process_buf(exp->fuse_session, &fuse_buf);
 
 out:
+    if (fuse_buf.mem) {
+        exp->spare_bufs = g_slist_prepend(exp->spare_bufs, fuse_buf.mem);
+    }
+
     if (qatomic_fetch_dec(&exp->in_flight) == 1) {
         aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
     }
@@ -311,6 +332,23 @@ out:
     blk_exp_unref(&exp->common);
 }
 
+/**
+ * Callback to be invoked when the FUSE session FD can be read from.
+ * (This is basically the FUSE event loop.)
+ */
+static void read_from_fuse_export(void *opaque)
+{
+    FuseExport *exp = opaque;
+    Coroutine *co;
+
+    blk_exp_ref(&exp->common);
+
+    qatomic_inc(&exp->in_flight);
+
+    co = qemu_coroutine_create(co_read_from_fuse_export, exp);
+    qemu_coroutine_enter(co);
+}
+
 static void fuse_export_shutdown(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
@@ -347,7 +385,7 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    g_slist_free_full(exp->spare_bufs, free);
     g_free(exp->mountpoint);
 }
 
@@ -441,8 +479,47 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_attr(req, &statbuf, 1.);
 }
 
-static int fuse_do_truncate(const FuseExport *exp, int64_t size,
-                            bool req_zero_write, PreallocMode prealloc)
+typedef struct FuseSetPermData {
+    BlockBackend *blk;
+    uint64_t perm;
+    uint64_t shared_perm;
+    Error **errp;
+    int ret;
+    Coroutine *co;
+} FuseSetPermData;
+
+static void fuse_set_perm_bh(void *opaque)
+{
+    FuseSetPermData *data = opaque;
+
+    data->ret = blk_set_perm(data->blk, data->perm, data->shared_perm,
+                             data->errp);
+    aio_co_wake(data->co);
+}
+
+/**
+ * blk_set_perm() cannot be called in coroutine context, so leave the
+ * request coroutine for it.  Must be called in the main thread.
+ */
+static int coroutine_fn fuse_co_set_perm(BlockBackend *blk, uint64_t perm,
+                                         uint64_t shared_perm, Error **errp)
+{
+    FuseSetPermData data = {
+        .blk = blk,
+        .perm = perm,
+        .shared_perm = shared_perm,
+        .errp = errp,
+        .co = qemu_coroutine_self(),
+    };
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), fuse_set_perm_bh, &data);
+    qemu_coroutine_yield();
+    return data.ret;
+}
+
+static int coroutine_fn fuse_do_truncate(const FuseExport *exp, int64_t size,
+                                         bool req_zero_write,
+                                         PreallocMode prealloc)
 {
     uint64_t blk_perm, blk_shared_perm;
     BdrvRequestFlags truncate_flags = 0;
@@ -465,8 +542,8 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
 
         blk_get_perm(exp->common.blk, &blk_perm, &blk_shared_perm);
 
-        ret = blk_set_perm(exp->common.blk, blk_perm | BLK_PERM_RESIZE,
-                           blk_shared_perm, NULL);
+        ret = fuse_co_set_perm(exp->common.blk, blk_perm | BLK_PERM_RESIZE,
+                               blk_shared_perm, NULL);
         if (ret < 0) {
             return ret;
         }
@@ -477,14 +554,38 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
 
     if (add_resize_perm) {
         /* Must succeed, because we are only giving up the RESIZE permission */
-        ret_check = blk_set_perm(exp->common.blk, blk_perm,
-                                 blk_shared_perm, &error_abort);
+        ret_check = fuse_co_set_perm(exp->common.blk, blk_perm,
+                                     blk_shared_perm, &error_abort);
         assert(ret_check == 0);
     }
 
     return ret;
 }
 
+/**
+ * Grow the image to at least @size bytes.  The length is checked again under
+ * exp->resize_lock, so a request that needs less than a concurrent one has
+ * already grown the image to leaves it alone instead of shrinking it.
+ */
+static int coroutine_fn fuse_co_grow(FuseExport *exp, int64_t size,
+                                     bool req_zero_write,
+                                     PreallocMode prealloc)
+{
+    int64_t length;
+
+    QEMU_LOCK_GUARD(&exp->resize_lock);
+
+    length = blk_co_getlength(exp->common.blk);
+    if (length < 0) {
+        return length;
+    }
+    if (size <= length) {
+        return 0;
+    }
+
+    return fuse_do_truncate(exp, size, req_zero_write, prealloc);
+}
+
 /**
  * Let clients set file attributes.  Only resizing and changing
  * permissions (st_mode, st_uid, st_gid) is allowed.
@@ -493,8 +594,9 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
  * without allow_other cannot be given a different UID or GID, and
  * they cannot be given non-owner access.
  */
-static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
-                         int to_set, struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
+             int to_set, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int supported_attrs;
@@ -538,7 +640,10 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
             return;
         }
 
-        ret = fuse_do_truncate(exp, statbuf->st_size, true, PREALLOC_MODE_OFF);
+        WITH_QEMU_LOCK_GUARD(&exp->resize_lock) {
+            ret = fuse_do_truncate(exp, statbuf->st_size, true,
+                                   PREALLOC_MODE_OFF);
+        }
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -573,8 +678,9 @@ static void fuse_open(fuse_req_t req, fuse_ino_t inode,
 /**
  * Handle client reads from the exported image.
  */
-static void fuse_read(fuse_req_t req, fuse_ino_t inode,
-                      size_t size, off_t offset, struct fuse_file_info *fi)
+static void coroutine_fn fuse_read(fuse_req_t req, fuse_ino_t inode,
+                                   size_t size, off_t offset,
+                                   struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t length;
@@ -591,7 +697,7 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
      * Clients will expect short reads at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
@@ -607,7 +713,7 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
         return;
     }
 
-    ret = blk_pread(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pread(exp->common.blk, offset, size, buf, 0);
     if (ret >= 0) {
         fuse_reply_buf(req, buf, size);
     } else {
@@ -620,8 +726,9 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
 /**
  * Handle client writes to the exported image.
  */
-static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
-                       size_t size, off_t offset, struct fuse_file_info *fi)
+static void coroutine_fn fuse_write(fuse_req_t req, fuse_ino_t inode,
+                                    const char *buf, size_t size, off_t offset,
+                                    struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t length;
@@ -642,7 +749,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
      * Clients will expect short writes at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
@@ -650,7 +757,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
 
     if (offset + size > length) {
         if (exp->growable) {
-            ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
+            ret = fuse_co_grow(exp, offset + size, true, PREALLOC_MODE_OFF);
             if (ret < 0) {
                 fuse_reply_err(req, -ret);
                 return;
@@ -660,7 +767,7 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
         }
     }
 
-    ret = blk_pwrite(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pwrite(exp->common.blk, offset, size, buf, 0);
     if (ret >= 0) {
         fuse_reply_write(req, size);
     } else {
@@ -671,9 +778,9 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
 /**
  * Let clients perform various fallocate() operations.
  */
-static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
-                           off_t offset, off_t length,
-                           struct fuse_file_info *fi)
+static void coroutine_fn
+fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
+               off_t offset, off_t length, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t blk_len;
@@ -697,6 +804,15 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
 #endif /* CONFIG_FALLOCATE_PUNCH_HOLE */
 
     if (!mode) {
+        QEMU_LOCK_GUARD(&exp->resize_lock);
+
+        /* The image may have grown since, check again under the lock */
+        blk_len = blk_co_getlength(exp->common.blk);
+        if (blk_len < 0) {
+            fuse_reply_err(req, -blk_len);
+            return;
+        }
+
         /* We can only fallocate at the EOF with a truncate */
         if (offset < blk_len) {
             fuse_reply_err(req, EOPNOTSUPP);
@@ -744,8 +860,8 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     else if (mode & FALLOC_FL_ZERO_RANGE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + length > blk_len) {
             /* No need for zeroes, we are going to write them ourselves */
-            ret = fuse_do_truncate(exp, offset + length, false,
-                                   PREALLOC_MODE_OFF);
+            ret = fuse_co_grow(exp, offset + length, false,
+                               PREALLOC_MODE_OFF);
             if (ret < 0) {
                 fuse_reply_err(req, -ret);
                 return;
@@ -796,8 +912,9 @@ static void fuse_flush(fuse_req_t req, fuse_ino_t inode,
 /**
  * Let clients inquire allocation status.
  */
-static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
-                       int whence, struct fuse_file_info *fi)
+static void coroutine_fn fuse_lseek(fuse_req_t req, fuse_ino_t inode,
+                                    off_t offset, int whence,
+                                    struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
 
@@ -810,8 +927,8 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
         int64_t pnum;
         int ret;
 
-        ret = bdrv_block_status_above(blk_bs(exp->common.blk), NULL,
-                                      offset, INT64_MAX, &pnum, NULL, NULL);
+        ret = blk_co_block_status_above(exp->common.blk, NULL,
+                                        offset, INT64_MAX, &pnum, NULL, NULL);
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -866,6 +983,7 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
 }
 #endif
 
+/* All of these are called in the request coroutine */
 static const struct fuse_lowlevel_ops fuse_ops = {
     .init       = fuse_init,
     .lookup     = fuse_lookup,
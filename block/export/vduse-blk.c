@@ -16,6 +16,8 @@
 #include "qapi/error.h"
 #include "block/export.h"
 #include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "sysemu/iothread.h"
 #include "util/block-helpers.h"
 #include "subprojects/libvduse/libvduse.h"
 #include "virtio-blk-handler.h"
@@ -33,6 +35,9 @@ typedef struct VduseBlkExport {
     char *recon_file;
     unsigned int inflight; /* atomic */
     bool vqs_started;
+    bool drained; /* between drained_begin and drained_end */
+    bool quiesced; /* see vduse_blk_quiesce_iothreads() */
+    BlockExportVqIOThreads vq_iothreads;
 } VduseBlkExport;
 
 typedef struct VduseBlkReq {
@@ -128,15 +133,34 @@ static void on_vduse_vq_kick(void *opaque)
     vduse_blk_vq_handler(dev, vq);
 }
 
+static AioContext *vduse_blk_vq_get_aio_context(VduseBlkExport *vblk_exp,
+                                                VduseVirtq *vq)
+{
+    if (vblk_exp->vq_iothreads.vq_ctx) {
+        for (uint16_t i = 0; i < vblk_exp->num_queues; i++) {
+            if (vduse_dev_get_queue(vblk_exp->dev, i) == vq) {
+                return vblk_exp->vq_iothreads.vq_ctx[i];
+            }
+        }
+        g_assert_not_reached();
+    }
+    return vblk_exp->export.ctx;
+}
+
 static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    int fd = vduse_queue_get_fd(vq);
 
     if (!vblk_exp->vqs_started) {
         return; /* vduse_blk_drained_end() will start vqs later */
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
+    if (fd < 0) {
+        return;
+    }
+
+    aio_set_fd_handler(vduse_blk_vq_get_aio_context(vblk_exp, vq), fd,
                        on_vduse_vq_kick, NULL, NULL, NULL, vq);
     /* Make sure we don't miss any kick after reconnecting */
     eventfd_write(vduse_queue_get_fd(vq), 1);
@@ -151,7 +175,7 @@ static void vduse_blk_disable_queue(VduseDev *dev, VduseVirtq *vq)
         return;
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, fd,
+    aio_set_fd_handler(vduse_blk_vq_get_aio_context(vblk_exp, vq), fd,
                        NULL, NULL, NULL, NULL, NULL);
 }
 
@@ -160,16 +184,78 @@ static const VduseOps vduse_blk_ops = {
     .disable_queue = vduse_blk_disable_queue,
 };
 
+static void vduse_blk_stop_virtqueues(VduseBlkExport *vblk_exp);
+static void vduse_blk_start_virtqueues(VduseBlkExport *vblk_exp);
+
+static void vduse_blk_sync_bh(void *opaque)
+{
+    /* Nothing to do, running at all means that no kick handler is active */
+}
+
+/*
+ * With virtqueues in IOThreads, stop them and wait for in-flight requests so
+ * that libvduse can change virtqueue state without racing with them. Runs in
+ * the main loop thread.
+ */
+static bool vduse_blk_quiesce_iothreads(VduseBlkExport *vblk_exp)
+{
+    BlockExportVqIOThreads *vq_iothreads = &vblk_exp->vq_iothreads;
+    size_t i;
+
+    if (!vq_iothreads->vq_ctx || !vblk_exp->vqs_started) {
+        return false;
+    }
+
+    vduse_blk_stop_virtqueues(vblk_exp);
+    vblk_exp->quiesced = true;
+
+    for (i = 0; i < vq_iothreads->threads.num_iothreads; i++) {
+        IOThread *iothread = vq_iothreads->threads.iothreads[i];
+
+        aio_wait_bh_oneshot(iothread_get_aio_context(iothread),
+                            vduse_blk_sync_bh, NULL);
+    }
+    AIO_WAIT_WHILE_UNLOCKED(NULL, qatomic_read(&vblk_exp->inflight) > 0);
+
+    return true;
+}
+
 static void on_vduse_dev_kick(void *opaque)
 {
     VduseDev *dev = opaque;
+    VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    bool quiesced = vduse_blk_quiesce_iothreads(vblk_exp);
 
     vduse_dev_handler(dev);
+
+    /*
+     * A drained section may have begun while waiting for the IOThreads,
+     * vduse_blk_drained_end() starts the virtqueues then.
+     */
+    if (quiesced) {
+        vblk_exp->quiesced = false;
+        if (!vblk_exp->drained) {
+            vduse_blk_start_virtqueues(vblk_exp);
+        }
+    }
+}
+
+/*
+ * If the virtqueues are processed in IOThreads, the device fd is handled in
+ * the main loop where vduse_blk_quiesce_iothreads() can wait for them.
+ */
+static AioContext *vduse_blk_dev_get_aio_context(VduseBlkExport *vblk_exp)
+{
+    if (vblk_exp->vq_iothreads.vq_ctx) {
+        return qemu_get_aio_context();
+    }
+    return vblk_exp->export.ctx;
 }
 
 static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
 {
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_dev_get_fd(vblk_exp->dev),
+    aio_set_fd_handler(vduse_blk_dev_get_aio_context(vblk_exp),
+                       vduse_dev_get_fd(vblk_exp->dev),
                        on_vduse_dev_kick, NULL, NULL, NULL,
                        vblk_exp->dev);
 
@@ -178,7 +264,8 @@ static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
 
 static void vduse_blk_detach_ctx(VduseBlkExport *vblk_exp)
 {
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_dev_get_fd(vblk_exp->dev),
+    aio_set_fd_handler(vduse_blk_dev_get_aio_context(vblk_exp),
+                       vduse_dev_get_fd(vblk_exp->dev),
                        NULL, NULL, NULL, NULL, NULL);
 
     /* Virtqueues are handled by vduse_blk_drained_begin() */
@@ -239,6 +326,7 @@ static void vduse_blk_drained_begin(void *opaque)
     BlockExport *exp = opaque;
     VduseBlkExport *vblk_exp = container_of(exp, VduseBlkExport, export);
 
+    vblk_exp->drained = true;
     vduse_blk_stop_virtqueues(vblk_exp);
 }
 
@@ -247,7 +335,11 @@ static void vduse_blk_drained_end(void *opaque)
     BlockExport *exp = opaque;
     VduseBlkExport *vblk_exp = container_of(exp, VduseBlkExport, export);
 
-    vduse_blk_start_virtqueues(vblk_exp);
+    vblk_exp->drained = false;
+    /* The virtqueues stay stopped until on_vduse_dev_kick() is done */
+    if (!vblk_exp->quiesced) {
+        vduse_blk_start_virtqueues(vblk_exp);
+    }
 }
 
 static bool vduse_blk_drained_poll(void *opaque)
@@ -304,6 +396,12 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
             return -EINVAL;
         }
     }
+    if (vblk_opts->has_iothreads &&
+        !blk_exp_vq_iothreads_init(&vblk_exp->vq_iothreads,
+                                   vblk_opts->iothreads, num_queues, errp)) {
+        return -EINVAL;
+    }
+
     vblk_exp->num_queues = num_queues;
     vblk_exp->handler.blk = exp->blk;
     vblk_exp->handler.serial = g_strdup(vblk_opts->serial ?: "");
@@ -364,7 +462,8 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         vduse_dev_setup_queue(vblk_exp->dev, i, queue_size);
     }
 
-    aio_set_fd_handler(exp->ctx, vduse_dev_get_fd(vblk_exp->dev),
+    aio_set_fd_handler(vduse_blk_dev_get_aio_context(vblk_exp),
+                       vduse_dev_get_fd(vblk_exp->dev),
                        on_vduse_dev_kick, NULL, NULL, NULL, vblk_exp->dev);
 
     blk_add_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
@@ -384,6 +483,7 @@ err:
     g_free(vblk_exp->recon_file);
 err_dev:
     g_free(vblk_exp->handler.serial);
+    blk_exp_vq_iothreads_cleanup(&vblk_exp->vq_iothreads);
     return ret;
 }
 
@@ -403,6 +503,7 @@ static void vduse_blk_exp_delete(BlockExport *exp)
     }
     g_free(vblk_exp->recon_file);
     g_free(vblk_exp->handler.serial);
+    blk_exp_vq_iothreads_cleanup(&vblk_exp->vq_iothreads);
 }
 
 /* Called with exp->ctx acquired */
@@ -161,6 +161,8 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    /* s->fd and registered buffers are registered with io_uring */
+    bool luring_fixed:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -561,6 +563,12 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+        {
+            .name = "aio-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "use io_uring fixed buffers and registered files "
+                    "(pins guest RAM, default: off)",
+        },
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -640,6 +648,14 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
 #endif
 
+    /* Fixed buffers pin guest RAM, which breaks balloon and virtio-mem */
+    s->luring_fixed = qemu_opt_get_bool(opts, "aio-fixed-buffers", false);
+    if (s->luring_fixed && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-fixed-buffers requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
     locking = qapi_enum_parse(&OnOffAuto_lookup,
@@ -809,6 +825,11 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->luring_fixed) {
+        luring_register_file(s->fd);
+    }
+#endif
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -2618,12 +2639,40 @@ static void raw_close(BlockDriverState *bs)
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+        if (s->luring_fixed) {
+            luring_unregister_file(s->fd);
+        }
 #endif
         qemu_close(s->fd);
         s->fd = -1;
     }
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    /* Use the memory as io_uring fixed buffers if possible */
+    if (s->luring_fixed) {
+        luring_register_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->luring_fixed) {
+        luring_unregister_buf(host, size);
+    }
+}
+#endif
+
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
  * new space according to @prealloc.
@@ -3809,6 +3858,12 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        if (s->luring_fixed) {
+            luring_unregister_file(s->fd);
+            luring_register_file(s->perm_change_fd);
+        }
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3916,6 +3971,10 @@ BlockDriver bdrv_file = {
     .bdrv_check_perm = raw_check_perm,
     .bdrv_set_perm   = raw_set_perm,
     .bdrv_abort_perm_update = raw_abort_perm_update,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
     .create_opts = &raw_create_opts,
     .mutable_opts = mutable_opts,
 };
@@ -4093,6 +4152,28 @@ static bool hdev_is_sg(BlockDriverState *bs)
     return false;
 }
 
+#if defined(__linux__)
+/*
+ * NVMe generic character devices (/dev/ngXnY) only support passthrough
+ * commands, not read()/write().
+ */
+static bool hdev_is_nvme_generic(int fd)
+{
+    g_autofree char *sysfs_path = NULL;
+    g_autofree char *link = NULL;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || !S_ISCHR(st.st_mode)) {
+        return false;
+    }
+
+    sysfs_path = g_strdup_printf("/sys/dev/char/%u:%u",
+                                 major(st.st_rdev), minor(st.st_rdev));
+    link = g_file_read_link(sysfs_path, NULL);
+    return link && strstr(link, "/nvme-generic/");
+}
+#endif
+
 static int hdev_open(BlockDriverState *bs, QDict *options, int flags,
                      Error **errp)
 {
@@ -4175,6 +4256,19 @@ hdev_open_Mac_error:
         return ret;
     }
 
+#if defined(__linux__)
+    if (hdev_is_nvme_generic(s->fd)) {
+        error_setg(errp, "'%s' is an NVMe generic character device, which "
+                   "does not support regular I/O", bs->filename);
+#ifdef CONFIG_BLKIO
+        error_append_hint(errp, "Use the 'nvme-io_uring' driver to access "
+                          "it with io_uring passthrough commands.\n");
+#endif
+        raw_close(bs);
+        return -ENOTSUP;
+    }
+#endif
+
     /* Since this does ioctl the device must be already opened */
     bs->sg = hdev_is_sg(bs);
 
@@ -4282,6 +4376,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_abort_perm_update = raw_abort_perm_update,
     .bdrv_probe_blocksizes = hdev_probe_blocksizes,
     .bdrv_probe_geometry = hdev_probe_geometry,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
 
     /* generic scsi device */
 #ifdef __linux__
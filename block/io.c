@@ -32,6 +32,7 @@
 #include "block/coroutines.h"
 #include "block/dirty-bitmap.h"
 #include "block/write-threshold.h"
+#include "qemu/coroutine-tls.h"
 #include "qemu/cutils.h"
 #include "qemu/memalign.h"
 #include "qapi/error.h"
@@ -577,6 +578,40 @@ void bdrv_drain_all(void)
     bdrv_drain_all_end();
 }
 
+/* Index + 1 of the tracked requests shard of this thread, 0 if unassigned */
+QEMU_DEFINE_STATIC_CO_TLS(unsigned, tracked_request_shard)
+
+static BdrvTrackedRequestShard *tracked_request_get_shard(BlockDriverState *bs)
+{
+    static unsigned next_shard;
+    unsigned shard = get_tracked_request_shard();
+
+    if (!shard) {
+        shard = qatomic_fetch_inc(&next_shard) % BDRV_TRACKED_REQUEST_SHARDS;
+        set_tracked_request_shard(++shard);
+    }
+
+    return &bs->tracked_requests[shard - 1];
+}
+
+static void tracked_requests_lock_all(BlockDriverState *bs)
+{
+    int i;
+
+    for (i = 0; i < BDRV_TRACKED_REQUEST_SHARDS; i++) {
+        qemu_mutex_lock(&bs->tracked_requests[i].lock);
+    }
+}
+
+static void tracked_requests_unlock_all(BlockDriverState *bs)
+{
+    int i;
+
+    for (i = 0; i < BDRV_TRACKED_REQUEST_SHARDS; i++) {
+        qemu_mutex_unlock(&bs->tracked_requests[i].lock);
+    }
+}
+
 /**
  * Remove an active request from the tracked requests list
  *
@@ -588,14 +623,15 @@ static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req)
         qatomic_dec(&req->bs->serialising_in_flight);
     }
 
-    qemu_mutex_lock(&req->bs->reqs_lock);
+    qemu_mutex_lock(&req->shard->lock);
     QLIST_REMOVE(req, list);
-    qemu_mutex_unlock(&req->bs->reqs_lock);
+    qemu_mutex_unlock(&req->shard->lock);
 
     /*
      * At this point qemu_co_queue_wait(&req->wait_queue, ...) won't be called
      * anymore because the request has been removed from the list, so it's safe
-     * to restart the queue outside reqs_lock to minimize the critical section.
+     * to restart the queue outside the shard lock to minimize the critical
+     * section.
      */
     qemu_co_queue_restart_all(&req->wait_queue);
 }
@@ -624,9 +660,15 @@ static void coroutine_fn tracked_request_begin(BdrvTrackedRequest *req,
 
     qemu_co_queue_init(&req->wait_queue);
 
-    qemu_mutex_lock(&bs->reqs_lock);
-    QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
-    qemu_mutex_unlock(&bs->reqs_lock);
+    /*
+     * Only the shard lock is needed here: serialising requests increase
+     * serialising_in_flight with all shard locks held, so either they see
+     * this request, or bdrv_wait_serialising_requests() sees them.
+     */
+    req->shard = tracked_request_get_shard(bs);
+    qemu_mutex_lock(&req->shard->lock);
+    QLIST_INSERT_HEAD(&req->shard->reqs, req, list);
+    qemu_mutex_unlock(&req->shard->lock);
 }
 
 static bool tracked_request_overlaps(BdrvTrackedRequest *req,
@@ -645,33 +687,36 @@ static bool tracked_request_overlaps(BdrvTrackedRequest *req,
     return true;
 }
 
-/* Called with self->bs->reqs_lock held */
+/* Called with all tracked request shard locks of self->bs held */
 static coroutine_fn BdrvTrackedRequest *
 bdrv_find_conflicting_request(BdrvTrackedRequest *self)
 {
     BdrvTrackedRequest *req;
+    int i;
 
-    QLIST_FOREACH(req, &self->bs->tracked_requests, list) {
-        if (req == self || (!req->serialising && !self->serialising)) {
-            continue;
-        }
-        if (tracked_request_overlaps(req, self->overlap_offset,
-                                     self->overlap_bytes))
-        {
-            /*
-             * Hitting this means there was a reentrant request, for
-             * example, a block driver issuing nested requests.  This must
-             * never happen since it means deadlock.
-             */
-            assert(qemu_coroutine_self() != req->co);
+    for (i = 0; i < BDRV_TRACKED_REQUEST_SHARDS; i++) {
+        QLIST_FOREACH(req, &self->bs->tracked_requests[i].reqs, list) {
+            if (req == self || (!req->serialising && !self->serialising)) {
+                continue;
+            }
+            if (tracked_request_overlaps(req, self->overlap_offset,
+                                         self->overlap_bytes))
+            {
+                /*
+                 * Hitting this means there was a reentrant request, for
+                 * example, a block driver issuing nested requests.  This
+                 * must never happen since it means deadlock.
+                 */
+                assert(qemu_coroutine_self() != req->co);
 
-            /*
-             * If the request is already (indirectly) waiting for us, or
-             * will wait for us as soon as it wakes up, then just go on
-             * (instead of producing a deadlock in the former case).
-             */
-            if (!req->waiting_for) {
-                return req;
+                /*
+                 * If the request is already (indirectly) waiting for us, or
+                 * will wait for us as soon as it wakes up, then just go on
+                 * (instead of producing a deadlock in the former case).
+                 */
+                if (!req->waiting_for) {
+                    return req;
+                }
             }
         }
     }
@@ -679,20 +724,37 @@ bdrv_find_conflicting_request(BdrvTrackedRequest *self)
     return NULL;
 }
 
-/* Called with self->bs->reqs_lock held */
+/* Called with all tracked request shard locks of self->bs held */
 static void coroutine_fn
 bdrv_wait_serialising_requests_locked(BdrvTrackedRequest *self)
 {
+    BlockDriverState *bs = self->bs;
     BdrvTrackedRequest *req;
 
     while ((req = bdrv_find_conflicting_request(self))) {
+        BdrvTrackedRequestShard *shard = req->shard;
+        int i;
+
         self->waiting_for = req;
-        qemu_co_queue_wait(&req->wait_queue, &self->bs->reqs_lock);
+
+        /*
+         * tracked_request_end() takes only the lock of its own shard, so
+         * that is the one to wait with
+         */
+        for (i = 0; i < BDRV_TRACKED_REQUEST_SHARDS; i++) {
+            if (&bs->tracked_requests[i] != shard) {
+                qemu_mutex_unlock(&bs->tracked_requests[i].lock);
+            }
+        }
+        qemu_co_queue_wait(&req->wait_queue, &shard->lock);
+        qemu_mutex_unlock(&shard->lock);
+
+        tracked_requests_lock_all(bs);
         self->waiting_for = NULL;
     }
 }
 
-/* Called with req->bs->reqs_lock held */
+/* Called with all tracked request shard locks of req->bs held */
 static void tracked_request_set_serialising(BdrvTrackedRequest *req,
                                             uint64_t align)
 {
@@ -719,11 +781,15 @@ BdrvTrackedRequest *coroutine_fn bdrv_co_get_self_request(BlockDriverState *bs)
 {
     BdrvTrackedRequest *req;
     Coroutine *self = qemu_coroutine_self();
+    int i;
     IO_CODE();
 
-    QLIST_FOREACH(req, &bs->tracked_requests, list) {
-        if (req->co == self) {
-            return req;
+    for (i = 0; i < BDRV_TRACKED_REQUEST_SHARDS; i++) {
+        QEMU_LOCK_GUARD(&bs->tracked_requests[i].lock);
+        QLIST_FOREACH(req, &bs->tracked_requests[i].reqs, list) {
+            if (req->co == self) {
+                return req;
+            }
         }
     }
 
@@ -790,9 +856,9 @@ bdrv_wait_serialising_requests(BdrvTrackedRequest *self)
         return;
     }
 
-    qemu_mutex_lock(&bs->reqs_lock);
+    tracked_requests_lock_all(bs);
     bdrv_wait_serialising_requests_locked(self);
-    qemu_mutex_unlock(&bs->reqs_lock);
+    tracked_requests_unlock_all(bs);
 }
 
 void coroutine_fn bdrv_make_request_serialising(BdrvTrackedRequest *req,
@@ -800,12 +866,12 @@ void coroutine_fn bdrv_make_request_serialising(BdrvTrackedRequest *req,
 {
     IO_CODE();
 
-    qemu_mutex_lock(&req->bs->reqs_lock);
+    tracked_requests_lock_all(req->bs);
 
     tracked_request_set_serialising(req, align);
     bdrv_wait_serialising_requests_locked(req);
 
-    qemu_mutex_unlock(&req->bs->reqs_lock);
+    tracked_requests_unlock_all(req->bs);
 }
 
 int bdrv_check_qiov_request(int64_t offset, int64_t bytes,
@@ -1456,6 +1522,7 @@ out:
 typedef struct BdrvRequestPadding {
     uint8_t *buf;
     size_t buf_len;
+    size_t buf_align;
     uint8_t *tail_buf;
     size_t head;
     size_t tail;
@@ -1468,6 +1535,94 @@ typedef struct BdrvRequestPadding {
     QEMUIOVector pre_collapse_qiov;
 } BdrvRequestPadding;
 
+/*
+ * Padding buffers are needed for every unaligned request and are at most two
+ * times the request alignment in size, so allocating them anew each time is
+ * needlessly expensive.  Keep a small number of them cached per thread (i.e.
+ * per AioContext); a buffer may be returned to a different thread's cache
+ * than the one it was taken from, which does no harm.
+ */
+#define BDRV_PADDING_POOL_MAX_SIZE 16
+
+typedef struct BdrvPaddingPoolEntry {
+    void *buf;
+    size_t len;
+    size_t align;
+} BdrvPaddingPoolEntry;
+
+typedef struct BdrvPaddingPool {
+    BdrvPaddingPoolEntry entries[BDRV_PADDING_POOL_MAX_SIZE];
+    unsigned int size;
+} BdrvPaddingPool;
+
+QEMU_DEFINE_STATIC_CO_TLS(BdrvPaddingPool, padding_pool)
+QEMU_DEFINE_STATIC_CO_TLS(Notifier, padding_pool_cleanup_notifier)
+
+static void padding_pool_cleanup(Notifier *n, void *value)
+{
+    BdrvPaddingPool *pool = get_ptr_padding_pool();
+
+    while (pool->size > 0) {
+        qemu_vfree(pool->entries[--pool->size].buf);
+    }
+}
+
+/* Ensure the atexit notifier is registered */
+static void padding_pool_cleanup_init_once(void)
+{
+    Notifier *notifier = get_ptr_padding_pool_cleanup_notifier();
+    if (!notifier->notify) {
+        notifier->notify = padding_pool_cleanup;
+        qemu_thread_atexit_add(notifier);
+    }
+}
+
+/*
+ * Get a buffer of @len bytes aligned to at least @align from the pool, or
+ * allocate a new one.  *@buf_align is set to the actual alignment, which must
+ * be passed to bdrv_padding_buf_put().
+ */
+static void *bdrv_padding_buf_get(size_t len, size_t align, size_t *buf_align)
+{
+    BdrvPaddingPool *pool = get_ptr_padding_pool();
+    unsigned int i;
+
+    for (i = 0; i < pool->size; i++) {
+        BdrvPaddingPoolEntry *entry = &pool->entries[i];
+
+        if (entry->len == len && entry->align >= align) {
+            void *buf = entry->buf;
+
+            *buf_align = entry->align;
+            *entry = pool->entries[--pool->size];
+            return buf;
+        }
+    }
+
+    *buf_align = align;
+    return qemu_memalign(align, len);
+}
+
+static void bdrv_padding_buf_put(void *buf, size_t len, size_t align)
+{
+    BdrvPaddingPool *pool = get_ptr_padding_pool();
+
+    if (pool->size == BDRV_PADDING_POOL_MAX_SIZE) {
+        /* Evict the oldest entry, newer ones are more likely to match */
+        qemu_vfree(pool->entries[0].buf);
+        memmove(&pool->entries[0], &pool->entries[1],
+                (BDRV_PADDING_POOL_MAX_SIZE - 1) * sizeof(pool->entries[0]));
+        pool->size--;
+    }
+
+    padding_pool_cleanup_init_once();
+    pool->entries[pool->size++] = (BdrvPaddingPoolEntry) {
+        .buf = buf,
+        .len = len,
+        .align = align,
+    };
+}
+
 static bool bdrv_init_padding(BlockDriverState *bs,
                               int64_t offset, int64_t bytes,
                               bool write,
@@ -1496,7 +1651,8 @@ static bool bdrv_init_padding(BlockDriverState *bs,
 
     sum = pad->head + bytes + pad->tail;
     pad->buf_len = (sum > align && pad->head && pad->tail) ? 2 * align : align;
-    pad->buf = qemu_blockalign(bs, pad->buf_len);
+    pad->buf = bdrv_padding_buf_get(pad->buf_len, bdrv_opt_mem_align(bs),
+                                    &pad->buf_align);
     pad->merge_reads = sum == pad->buf_len;
     if (pad->tail) {
         pad->tail_buf = pad->buf + pad->buf_len - align;
@@ -1586,7 +1742,7 @@ static void bdrv_padding_finalize(BdrvRequestPadding *pad)
         qemu_iovec_destroy(&pad->pre_collapse_qiov);
     }
     if (pad->buf) {
-        qemu_vfree(pad->buf);
+        bdrv_padding_buf_put(pad->buf, pad->buf_len, pad->buf_align);
         qemu_iovec_destroy(&pad->local_qiov);
     }
     memset(pad, 0, sizeof(*pad));
@@ -1975,15 +2131,19 @@ bdrv_co_write_req_prepare(BdrvChild *child, int64_t offset, int64_t bytes,
     assert(!((flags & BDRV_REQ_NO_WAIT) && !(flags & BDRV_REQ_SERIALISING)));
 
     if (flags & BDRV_REQ_SERIALISING) {
-        QEMU_LOCK_GUARD(&bs->reqs_lock);
+        int64_t cluster_size = bdrv_get_cluster_size(bs);
+
+        tracked_requests_lock_all(bs);
 
-        tracked_request_set_serialising(req, bdrv_get_cluster_size(bs));
+        tracked_request_set_serialising(req, cluster_size);
 
         if ((flags & BDRV_REQ_NO_WAIT) && bdrv_find_conflicting_request(req)) {
+            tracked_requests_unlock_all(bs);
             return -EBUSY;
         }
 
         bdrv_wait_serialising_requests_locked(req);
+        tracked_requests_unlock_all(bs);
     } else {
         bdrv_wait_serialising_requests(req);
     }
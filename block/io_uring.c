@@ -16,7 +16,11 @@
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/bitmap.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 #include "sysemu/block-backend.h"
 #include "trace.h"
 
@@ -40,6 +44,9 @@ typedef struct LuringAIOCB {
      */
     int total_read;
     QEMUIOVector resubmit_qiov;
+
+    /* Registered file index the request uses, or -1 */
+    int file_index;
 } LuringAIOCB;
 
 typedef struct LuringQueue {
@@ -58,8 +65,504 @@ struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Whether fixed buffers and registered files can be used on this ring */
+    bool fixed_bufs;
+    bool fixed_files;
+
+    /* Protected by luring_fixed_lock, in luring_states */
+    QLIST_ENTRY(LuringState) next;
 };
 
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+/*
+ * Memory registered with bdrv_register_buf() (usually guest RAM) is
+ * registered as fixed buffers and image file descriptors are registered as
+ * files with all rings, so the kernel neither has to pin pages nor look up
+ * the file for every request.
+ *
+ * The kernel limits the size of a single fixed buffer, so each registered
+ * memory region is split into as many buffers as necessary.
+ */
+#define LURING_FIXED_BUF_MAX_SIZE   (1 * GiB)
+#define LURING_MAX_FIXED_BUFS       1024
+#define LURING_MAX_FIXED_REGIONS    32
+#define LURING_MAX_FIXED_FILES      64
+#define LURING_FIXED_FILE_RELEASING (-2)
+
+typedef struct LuringFixedRegion {
+    void *host;
+    size_t size;
+    unsigned int first_buf; /* Index of the region's first fixed buffer */
+    unsigned int refcnt;
+} LuringFixedRegion;
+
+/*
+ * Table of the buffers and files registered with all rings.  It is looked up
+ * in the I/O path under RCU and replaced as a whole on updates.
+ */
+typedef struct LuringFixedTable {
+    struct rcu_head rcu;
+    unsigned int nb_regions;
+    LuringFixedRegion regions[LURING_MAX_FIXED_REGIONS];
+    DECLARE_BITMAP(used_bufs, LURING_MAX_FIXED_BUFS);
+
+    /*
+     * Registered file descriptor per file index, -1 if unused, or
+     * LURING_FIXED_FILE_RELEASING while luring_unregister_file() waits for
+     * readers of the old table
+     */
+    int files[LURING_MAX_FIXED_FILES];
+
+    /* File indices are allocated round-robin */
+    unsigned int next_file;
+} LuringFixedTable;
+
+/*
+ * Number of requests per file index that have been prepared but not yet
+ * completed.  An index is only reused for another file once it drops to
+ * zero, so that no request ends up on the wrong file.
+ */
+static unsigned int luring_fixed_file_users[LURING_MAX_FIXED_FILES];
+
+/* Serializes updates of luring_fixed_table and protects luring_states */
+static QemuMutex luring_fixed_lock;
+static LuringFixedTable *luring_fixed_table;
+static QLIST_HEAD(, LuringState) luring_states =
+    QLIST_HEAD_INITIALIZER(luring_states);
+
+static void __attribute__((__constructor__)) luring_fixed_init(void)
+{
+    int i;
+
+    qemu_mutex_init(&luring_fixed_lock);
+    luring_fixed_table = g_new0(LuringFixedTable, 1);
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        luring_fixed_table->files[i] = -1;
+    }
+}
+
+/* Called with luring_fixed_lock held; returns a copy to modify */
+static LuringFixedTable *luring_fixed_table_dup(void)
+{
+    return g_memdup2(luring_fixed_table, sizeof(*luring_fixed_table));
+}
+
+/* Called with luring_fixed_lock held */
+static void luring_fixed_table_publish(LuringFixedTable *table)
+{
+    LuringFixedTable *old = luring_fixed_table;
+
+    qatomic_rcu_set(&luring_fixed_table, table);
+    g_free_rcu(old, rcu);
+}
+
+/*
+ * Register @region's memory as fixed buffers with @s's ring, or unregister it
+ * if @add is false.
+ */
+static int luring_fixed_region_update(LuringState *s,
+                                      const LuringFixedRegion *region,
+                                      bool add)
+{
+    unsigned int nb_bufs = DIV_ROUND_UP(region->size,
+                                        LURING_FIXED_BUF_MAX_SIZE);
+    g_autofree struct iovec *iov = g_new0(struct iovec, nb_bufs);
+    unsigned int i;
+    int ret;
+
+    if (add) {
+        for (i = 0; i < nb_bufs; i++) {
+            size_t offset = (size_t)i * LURING_FIXED_BUF_MAX_SIZE;
+
+            iov[i].iov_base = region->host + offset;
+            iov[i].iov_len = MIN(region->size - offset,
+                                 LURING_FIXED_BUF_MAX_SIZE);
+        }
+    }
+
+    ret = io_uring_register_buffers_update_tag(&s->ring, region->first_buf,
+                                               iov, NULL, nb_bufs);
+    return ret < 0 ? ret : 0;
+}
+
+static int luring_fixed_file_update(LuringState *s, unsigned int index,
+                                    int fd)
+{
+    int ret = io_uring_register_files_update(&s->ring, index, &fd, 1);
+    return ret < 0 ? ret : 0;
+}
+
+static void luring_fixed_setup(LuringState *s)
+{
+    LuringFixedTable *table;
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    table = luring_fixed_table;
+    QLIST_INSERT_HEAD(&luring_states, s, next);
+
+    s->fixed_bufs =
+        io_uring_register_buffers_sparse(&s->ring, LURING_MAX_FIXED_BUFS) == 0;
+    for (i = 0; s->fixed_bufs && i < table->nb_regions; i++) {
+        if (luring_fixed_region_update(s, &table->regions[i], true) < 0) {
+            io_uring_unregister_buffers(&s->ring);
+            s->fixed_bufs = false;
+        }
+    }
+
+    s->fixed_files =
+        io_uring_register_files_sparse(&s->ring, LURING_MAX_FIXED_FILES) == 0;
+    for (i = 0; s->fixed_files && i < LURING_MAX_FIXED_FILES; i++) {
+        if (table->files[i] >= 0 &&
+            luring_fixed_file_update(s, i, table->files[i]) < 0)
+        {
+            io_uring_unregister_files(&s->ring);
+            s->fixed_files = false;
+        }
+    }
+
+    trace_luring_fixed_setup(s, s->fixed_bufs, s->fixed_files);
+}
+
+static void luring_fixed_cleanup(LuringState *s)
+{
+    WITH_QEMU_LOCK_GUARD(&luring_fixed_lock) {
+        QLIST_REMOVE(s, next);
+    }
+}
+
+void luring_register_buf(void *host, size_t size)
+{
+    LuringFixedTable *table;
+    LuringFixedRegion *region;
+    LuringState *s, *failed = NULL;
+    unsigned int nb_bufs, i;
+    int ret = 0;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    table = luring_fixed_table;
+    for (i = 0; i < table->nb_regions; i++) {
+        region = &table->regions[i];
+        if (region->host == host && region->size == size) {
+            /* Only the reference count changes, nothing RCU readers look at */
+            region->refcnt++;
+            return;
+        }
+    }
+
+    nb_bufs = DIV_ROUND_UP(size, LURING_FIXED_BUF_MAX_SIZE);
+    table = luring_fixed_table_dup();
+    region = &table->regions[table->nb_regions];
+    *region = (LuringFixedRegion) {
+        .host = host,
+        .size = size,
+        .first_buf = bitmap_find_next_zero_area(table->used_bufs,
+                                                LURING_MAX_FIXED_BUFS, 0,
+                                                nb_bufs, 0),
+        .refcnt = 1,
+    };
+
+    if (table->nb_regions == LURING_MAX_FIXED_REGIONS ||
+        region->first_buf + nb_bufs > LURING_MAX_FIXED_BUFS)
+    {
+        /* Out of fixed buffers; I/O to this region works without them */
+        trace_luring_register_buf(host, size, -ENOSPC);
+        g_free(table);
+        return;
+    }
+
+    /*
+     * Fixed buffers pin the memory, so discarding it (e.g. virtio-mem,
+     * virtio-balloon) would leave the kernel with stale pages.  If discards
+     * are required, do without fixed buffers.
+     */
+    ret = ram_block_discard_disable(true);
+    if (ret < 0) {
+        trace_luring_register_buf(host, size, ret);
+        g_free(table);
+        return;
+    }
+
+    QLIST_FOREACH(s, &luring_states, next) {
+        if (s->fixed_bufs) {
+            ret = luring_fixed_region_update(s, region, true);
+            if (ret < 0) {
+                failed = s;
+                break;
+            }
+        }
+    }
+    trace_luring_register_buf(host, size, ret);
+
+    if (failed) {
+        /* Probably RLIMIT_MEMLOCK; leave the region unregistered everywhere */
+        QLIST_FOREACH(s, &luring_states, next) {
+            if (s == failed) {
+                break;
+            }
+            if (s->fixed_bufs) {
+                luring_fixed_region_update(s, region, false);
+            }
+        }
+        ram_block_discard_disable(false);
+        g_free(table);
+        return;
+    }
+
+    bitmap_set(table->used_bufs, region->first_buf, nb_bufs);
+    table->nb_regions++;
+    luring_fixed_table_publish(table);
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringFixedTable *table;
+    LuringFixedRegion region;
+    LuringState *s;
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    table = luring_fixed_table;
+    for (i = 0; i < table->nb_regions; i++) {
+        if (table->regions[i].host == host && table->regions[i].size == size) {
+            break;
+        }
+    }
+    if (i == table->nb_regions) {
+        /* Registration failed, or fixed buffers are unsupported */
+        return;
+    }
+    if (--table->regions[i].refcnt > 0) {
+        return;
+    }
+
+    /*
+     * The caller guarantees that there is no I/O to this region any more, so
+     * it does not matter that RCU readers may still see the old table.
+     */
+    region = table->regions[i];
+    table = luring_fixed_table_dup();
+    table->regions[i] = table->regions[--table->nb_regions];
+    bitmap_clear(table->used_bufs, region.first_buf,
+                 DIV_ROUND_UP(size, LURING_FIXED_BUF_MAX_SIZE));
+    luring_fixed_table_publish(table);
+
+    QLIST_FOREACH(s, &luring_states, next) {
+        if (s->fixed_bufs) {
+            luring_fixed_region_update(s, &region, false);
+        }
+    }
+    ram_block_discard_disable(false);
+    trace_luring_unregister_buf(host, size);
+}
+
+void luring_register_file(int fd)
+{
+    LuringFixedTable *table;
+    LuringState *s, *failed = NULL;
+    unsigned int index, i;
+    int ret = 0;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    table = luring_fixed_table;
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        index = (table->next_file + i) % LURING_MAX_FIXED_FILES;
+        if (table->files[index] == -1 &&
+            !qatomic_read(&luring_fixed_file_users[index])) {
+            break;
+        }
+    }
+    if (i == LURING_MAX_FIXED_FILES) {
+        trace_luring_register_file(fd, -1, -ENOSPC);
+        return;
+    }
+
+    QLIST_FOREACH(s, &luring_states, next) {
+        if (s->fixed_files) {
+            ret = luring_fixed_file_update(s, index, fd);
+            if (ret < 0) {
+                failed = s;
+                break;
+            }
+        }
+    }
+    trace_luring_register_file(fd, index, ret);
+
+    if (failed) {
+        QLIST_FOREACH(s, &luring_states, next) {
+            if (s == failed) {
+                break;
+            }
+            if (s->fixed_files) {
+                luring_fixed_file_update(s, index, -1);
+            }
+        }
+        return;
+    }
+
+    table = luring_fixed_table_dup();
+    table->files[index] = fd;
+    table->next_file = (index + 1) % LURING_MAX_FIXED_FILES;
+    luring_fixed_table_publish(table);
+}
+
+void luring_unregister_file(int fd)
+{
+    LuringFixedTable *table;
+    LuringState *s;
+    unsigned int index;
+
+    WITH_QEMU_LOCK_GUARD(&luring_fixed_lock) {
+        table = luring_fixed_table;
+        for (index = 0; index < LURING_MAX_FIXED_FILES; index++) {
+            if (table->files[index] == fd) {
+                break;
+            }
+        }
+        if (index == LURING_MAX_FIXED_FILES) {
+            return;
+        }
+
+        /* New requests stop using the index, but it is not free yet */
+        table = luring_fixed_table_dup();
+        table->files[index] = LURING_FIXED_FILE_RELEASING;
+        luring_fixed_table_publish(table);
+    }
+
+    /*
+     * Requests that found @fd in the old table have taken their reference
+     * to the index after this, so luring_register_file() sees them.  This
+     * waits for other threads, so do not hold luring_fixed_lock meanwhile.
+     */
+    synchronize_rcu();
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    /* Drop the rings' references so that e.g. file locks are released */
+    QLIST_FOREACH(s, &luring_states, next) {
+        if (s->fixed_files) {
+            luring_fixed_file_update(s, index, -1);
+        }
+    }
+
+    table = luring_fixed_table_dup();
+    table->files[index] = -1;
+    luring_fixed_table_publish(table);
+    trace_luring_unregister_file(fd, index);
+}
+
+/*
+ * Return the index of the fixed buffer that contains @len bytes at @base, or
+ * -1 if there is none.  Must be called under the RCU read lock.
+ */
+static int luring_fixed_buf_lookup(LuringState *s, void *base, size_t len)
+{
+    LuringFixedTable *table;
+    unsigned int i;
+
+    if (!s->fixed_bufs) {
+        return -1;
+    }
+
+    table = qatomic_rcu_read(&luring_fixed_table);
+    for (i = 0; i < table->nb_regions; i++) {
+        LuringFixedRegion *region = &table->regions[i];
+        size_t offset;
+
+        if (base < region->host || base >= region->host + region->size) {
+            continue;
+        }
+
+        offset = base - region->host;
+        if (len > region->size - offset ||
+            offset / LURING_FIXED_BUF_MAX_SIZE !=
+            (offset + len - 1) / LURING_FIXED_BUF_MAX_SIZE)
+        {
+            /* Crossing the end of the region or of a fixed buffer */
+            return -1;
+        }
+        return region->first_buf + offset / LURING_FIXED_BUF_MAX_SIZE;
+    }
+
+    return -1;
+}
+
+/*
+ * Return the registered file index of @fd and take a reference to it, or
+ * return -1 if it is not registered.  Must be called under the RCU read lock.
+ */
+static int luring_fixed_file_lookup(LuringState *s, int fd)
+{
+    LuringFixedTable *table;
+    unsigned int index;
+
+    if (!s->fixed_files) {
+        return -1;
+    }
+
+    table = qatomic_rcu_read(&luring_fixed_table);
+    for (index = 0; index < LURING_MAX_FIXED_FILES; index++) {
+        if (table->files[index] == fd) {
+            qatomic_inc(&luring_fixed_file_users[index]);
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+/* Drop the reference taken by luring_fixed_file_lookup() */
+static void luring_fixed_file_put(int index)
+{
+    if (index >= 0) {
+        qatomic_dec(&luring_fixed_file_users[index]);
+    }
+}
+#else /* !HAVE_IO_URING_REGISTER_BUFFERS_SPARSE */
+static void luring_fixed_setup(LuringState *s)
+{
+}
+
+static void luring_fixed_cleanup(LuringState *s)
+{
+}
+
+void luring_register_buf(void *host, size_t size)
+{
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+}
+
+void luring_register_file(int fd)
+{
+}
+
+void luring_unregister_file(int fd)
+{
+}
+
+static int luring_fixed_buf_lookup(LuringState *s, void *base, size_t len)
+{
+    return -1;
+}
+
+static int luring_fixed_file_lookup(LuringState *s, int fd)
+{
+    return -1;
+}
+
+static void luring_fixed_file_put(int index)
+{
+}
+#endif
+
 /**
  * luring_resubmit:
  *
@@ -102,8 +605,14 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update sqe */
     luringcb->sqeq.off += nread;
-    luringcb->sqeq.addr = (uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* Still within the same fixed buffer */
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len -= nread;
+    } else {
+        luringcb->sqeq.addr = (uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
@@ -339,19 +848,40 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    QEMUIOVector *qiov = luringcb->qiov;
+    int file_index, buf_index = -1;
+
+    RCU_READ_LOCK_GUARD();
+
+    file_index = luring_fixed_file_lookup(s, fd);
+    if (file_index >= 0) {
+        luringcb->file_index = file_index;
+        fd = file_index;
+    }
+
+    /* Fixed buffer requests cannot be vectored */
+    if (type != QEMU_AIO_FLUSH && qiov->niov == 1) {
+        buf_index = luring_fixed_buf_lookup(s, qiov->iov[0].iov_base,
+                                            qiov->iov[0].iov_len);
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
-        break;
     case QEMU_AIO_ZONE_APPEND:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                      qiov->iov[0].iov_len, offset, buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, qiov->iov, qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                     qiov->iov[0].iov_len, offset, buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, qiov->iov, qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -361,6 +891,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (file_index >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -390,18 +923,21 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
+        .file_index = -1,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
     ret = luring_do_submit(fd, &luringcb, s, offset, type);
 
     if (ret < 0) {
+        luring_fixed_file_put(luringcb.file_index);
         return ret;
     }
 
     if (luringcb.ret == -EINPROGRESS) {
         qemu_coroutine_yield();
     }
+    luring_fixed_file_put(luringcb.file_index);
     return luringcb.ret;
 }
 
@@ -422,15 +958,31 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(bool sqpoll, unsigned int sqpoll_idle_ms,
+                         int sqpoll_cpu, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (sqpoll) {
+        /*
+         * A kernel thread picks up new requests from the submission queue,
+         * so io_uring_submit() only needs a system call to wake it up after
+         * it has been idle for sqpoll_idle_ms.
+         */
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = sqpoll_idle_ms;
+        if (sqpoll_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = sqpoll_cpu;
+        }
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
@@ -438,12 +990,14 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+    luring_fixed_setup(s);
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    luring_fixed_cleanup(s);
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
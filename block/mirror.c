@@ -27,6 +27,7 @@
 
 #define MAX_IN_FLIGHT 16
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
+#define MAX_SEQUENTIAL_IO_BYTES (4 << 20) /* 4 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
 /* The mirroring buffer is a list of granularity-sized chunks.
@@ -480,15 +481,34 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
+/*
+ * Limit for a single copy operation within a dirty area of @area_bytes.
+ * Scattered dirty chunks are copied one area at a time anyway, so only long
+ * sequentially dirty areas are affected: those are split into fewer, larger
+ * requests, as long as a few of them still fit into the buffer together.
+ */
+static int64_t mirror_max_io_bytes(MirrorBlockJob *s, int64_t area_bytes)
+{
+    int64_t max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+
+    if (area_bytes >= s->buf_size / 2) {
+        max_io_bytes = MAX(max_io_bytes, MIN(s->buf_size / 4,
+                                             MAX_SEQUENTIAL_IO_BYTES));
+    }
+
+    return QEMU_ALIGN_DOWN(MIN(max_io_bytes, s->granularity * s->max_iov),
+                           s->granularity);
+}
+
 static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source;
     MirrorOp *pseudo_op;
     int64_t offset;
-    /* At least the first dirty chunk is mirrored in one iteration. */
-    int nb_chunks = 1;
+    int64_t dirty_start, dirty_bytes, end_chunk;
+    int nb_chunks;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int64_t max_io_bytes;
 
     bdrv_graph_co_rdlock();
     source = s->mirror_top_bs->backing->bs;
@@ -515,29 +535,27 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
 
     job_pause_point(&s->common.job);
 
-    /* Find the number of consecutive dirty chunks following the first dirty
-     * one, and wait for in flight requests in them. */
+    /*
+     * Find the dirty area starting at @offset in a single bitmap lookup, and
+     * cut it short before the first chunk that is still in flight.
+     */
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
-    while (nb_chunks * s->granularity < s->buf_size) {
-        int64_t next_dirty;
-        int64_t next_offset = offset + nb_chunks * s->granularity;
-        int64_t next_chunk = next_offset / s->granularity;
-        if (next_offset >= s->bdev_length ||
-            !bdrv_dirty_bitmap_get_locked(s->dirty_bitmap, next_offset)) {
-            break;
-        }
-        if (test_bit(next_chunk, s->in_flight_bitmap)) {
-            break;
-        }
-
-        next_dirty = bdrv_dirty_iter_next(s->dbi);
-        if (next_dirty > next_offset || next_dirty < 0) {
-            /* The bitmap iterator's cache is stale, refresh it */
-            bdrv_set_dirty_iter(s->dbi, next_offset);
-            next_dirty = bdrv_dirty_iter_next(s->dbi);
-        }
-        assert(next_dirty == next_offset);
-        nb_chunks++;
+    if (!bdrv_dirty_bitmap_next_dirty_area(s->dirty_bitmap, offset,
+                                           s->bdev_length, s->buf_size,
+                                           &dirty_start, &dirty_bytes) ||
+        dirty_start != offset) {
+        /* At least the first dirty chunk is mirrored in one iteration. */
+        dirty_bytes = s->granularity;
+    }
+    nb_chunks = DIV_ROUND_UP(dirty_bytes, s->granularity);
+    end_chunk = find_next_bit(s->in_flight_bitmap,
+                              offset / s->granularity + nb_chunks,
+                              offset / s->granularity + 1);
+    nb_chunks = end_chunk - offset / s->granularity;
+    if (offset + nb_chunks * s->granularity < s->bdev_length) {
+        bdrv_set_dirty_iter(s->dbi, offset + nb_chunks * s->granularity);
+    } else {
+        bdrv_set_dirty_iter(s->dbi, 0);
     }
 
     /* Clear dirty bits before querying the block status, because
@@ -563,6 +581,8 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     qemu_co_queue_init(&pseudo_op->waiting_requests);
     QTAILQ_INSERT_TAIL(&s->ops_in_flight, pseudo_op, next);
 
+    max_io_bytes = mirror_max_io_bytes(s, nb_chunks * s->granularity);
+
     bitmap_set(s->in_flight_bitmap, offset / s->granularity, nb_chunks);
     while (nb_chunks > 0 && offset < s->bdev_length) {
         int ret = -1;
@@ -938,6 +958,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     char backing_filename[2]; /* we only need 2 characters because we are only
                                  checking for a NULL string */
     int ret = 0;
+    int i;
 
     bdrv_graph_co_rdlock();
     bs = bdrv_filter_bs(s->mirror_top_bs);
@@ -1132,7 +1153,9 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
             /* The two disks are in sync.  Exit and report successful
              * completion.
              */
-            assert(QLIST_EMPTY(&bs->tracked_requests));
+            for (i = 0; i < BDRV_TRACKED_REQUEST_SHARDS; i++) {
+                assert(QLIST_EMPTY(&bs->tracked_requests[i].reqs));
+            }
             need_drain = false;
             break;
         }
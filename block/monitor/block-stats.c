@@ -0,0 +1,270 @@
+/*
+ * Block layer statistics for the query-stats QMP command
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/accounting.h"
+#include "block/throttle-groups.h"
+#include "hw/qdev-core.h"
+#include "qapi/qapi-types-stats.h"
+#include "qemu/module.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/stats.h"
+
+static const struct {
+    const char *name;
+    enum BlockAcctType type;
+} block_stats_types[] = {
+    { "rd", BLOCK_ACCT_READ },
+    { "wr", BLOCK_ACCT_WRITE },
+    { "zone-append", BLOCK_ACCT_ZONE_APPEND },
+    { "flush", BLOCK_ACCT_FLUSH },
+    { "unmap", BLOCK_ACCT_UNMAP },
+};
+
+static const char *const block_stats_percentile_names[] = {
+    "p50", "p90", "p99", "p999",
+};
+
+static const double block_stats_percentiles[] = {
+    50.0, 90.0, 99.0, 99.9,
+};
+
+QEMU_BUILD_BUG_ON(ARRAY_SIZE(block_stats_percentile_names) !=
+                  ARRAY_SIZE(block_stats_percentiles));
+
+static const struct {
+    const char *name;
+    ThrottleDirection direction;
+} throttle_group_stats_directions[] = {
+    { "rd", THROTTLE_READ },
+    { "wr", THROTTLE_WRITE },
+};
+
+static const struct {
+    const char *name;
+    size_t offset;
+    bool in_bytes;
+} throttle_group_stats_fields[] = {
+    { "requests", offsetof(ThrottleGroupStats, requests) },
+    { "throttled", offsetof(ThrottleGroupStats, throttled) },
+    { "bytes", offsetof(ThrottleGroupStats, bytes), true },
+};
+
+/* Takes ownership of @name */
+static StatsList *block_stats_add_scalar(StatsList *stats_list, char *name,
+                                         uint64_t value, strList *names)
+{
+    Stats *s;
+
+    if (!apply_str_list_filter(name, names)) {
+        g_free(name);
+        return stats_list;
+    }
+
+    s = g_new0(Stats, 1);
+    s->name = name;
+    s->value = g_new0(StatsValue, 1);
+    s->value->type = QTYPE_QNUM;
+    s->value->u.scalar = value;
+    QAPI_LIST_PREPEND(stats_list, s);
+
+    return stats_list;
+}
+
+static StatsList *block_stats_add_operations(StatsList *stats_list,
+                                             BlockAcctStats *stats,
+                                             const char *type_name,
+                                             enum BlockAcctType type,
+                                             strList *names)
+{
+    return block_stats_add_scalar(stats_list,
+                                  g_strdup_printf("%s-operations", type_name),
+                                  stats->nr_ops[type], names);
+}
+
+static StatsList *block_stats_add_latencies(StatsList *stats_list,
+                                            BlockAcctStats *stats,
+                                            const char *type_name,
+                                            enum BlockAcctType type,
+                                            strList *names)
+{
+    uint64_t values[ARRAY_SIZE(block_stats_percentiles)];
+    int i;
+
+    if (!block_latency_percentiles(stats, type, block_stats_percentiles,
+                                   values, ARRAY_SIZE(values))) {
+        return stats_list;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(values); i++) {
+        g_autofree char *name =
+            g_strdup_printf("%s-latency-%s", type_name,
+                            block_stats_percentile_names[i]);
+        Stats *s;
+
+        if (!apply_str_list_filter(name, names)) {
+            continue;
+        }
+
+        s = g_new0(Stats, 1);
+        s->name = g_steal_pointer(&name);
+        s->value = g_new0(StatsValue, 1);
+        s->value->type = QTYPE_QNUM;
+        s->value->u.scalar = values[i];
+        QAPI_LIST_PREPEND(stats_list, s);
+    }
+
+    return stats_list;
+}
+
+static void throttle_group_stats_cb(StatsResultList **result, strList *names)
+{
+    ThrottleGroup *tg;
+
+    for (tg = throttle_group_next(NULL); tg; tg = throttle_group_next(tg)) {
+        g_autofree char *qom_path = object_get_canonical_path(OBJECT(tg));
+        StatsList *stats_list = NULL;
+        ThrottleGroupStats stats;
+        int i, j;
+
+        /* Groups created for the legacy throttling.group option have none */
+        if (!qom_path) {
+            continue;
+        }
+
+        throttle_group_get_stats(tg, &stats);
+        for (i = 0; i < ARRAY_SIZE(throttle_group_stats_directions); i++) {
+            for (j = 0; j < ARRAY_SIZE(throttle_group_stats_fields); j++) {
+                uint64_t *values = (uint64_t *)((char *)&stats +
+                    throttle_group_stats_fields[j].offset);
+
+                stats_list = block_stats_add_scalar(stats_list,
+                    g_strdup_printf("%s-%s",
+                                    throttle_group_stats_directions[i].name,
+                                    throttle_group_stats_fields[j].name),
+                    values[throttle_group_stats_directions[i].direction],
+                    names);
+            }
+        }
+
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_BLOCK, qom_path,
+                            stats_list);
+        }
+    }
+}
+
+static void block_stats_cb(StatsResultList **result, StatsTarget target,
+                           strList *names, strList *targets, Error **errp)
+{
+    BlockBackend *blk;
+
+    if (target == STATS_TARGET_THROTTLE_GROUP) {
+        throttle_group_stats_cb(result, names);
+        return;
+    }
+    if (target != STATS_TARGET_BLOCK) {
+        return;
+    }
+
+    for (blk = blk_all_next(NULL); blk; blk = blk_all_next(blk)) {
+        DeviceState *dev = blk_get_attached_dev(blk);
+        g_autofree char *qom_path = NULL;
+        StatsList *stats_list = NULL;
+        int i;
+
+        /* Without a device, there is no QOM path to identify the backend */
+        if (!dev) {
+            continue;
+        }
+
+        qom_path = object_get_canonical_path(OBJECT(dev));
+        if (!apply_str_list_filter(qom_path, targets)) {
+            continue;
+        }
+
+        for (i = 0; i < ARRAY_SIZE(block_stats_types); i++) {
+            stats_list = block_stats_add_operations(stats_list,
+                                                    blk_get_stats(blk),
+                                                    block_stats_types[i].name,
+                                                    block_stats_types[i].type,
+                                                    names);
+            stats_list = block_stats_add_latencies(stats_list,
+                                                   blk_get_stats(blk),
+                                                   block_stats_types[i].name,
+                                                   block_stats_types[i].type,
+                                                   names);
+        }
+
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_BLOCK, qom_path,
+                            stats_list);
+        }
+    }
+}
+
+static void block_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(block_stats_types); i++) {
+        StatsSchemaValue *ops = g_new0(StatsSchemaValue, 1);
+
+        ops->name = g_strdup_printf("%s-operations",
+                                    block_stats_types[i].name);
+        ops->type = STATS_TYPE_CUMULATIVE;
+        QAPI_LIST_PREPEND(stats_list, ops);
+
+        for (j = 0; j < ARRAY_SIZE(block_stats_percentile_names); j++) {
+            StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+            value->name = g_strdup_printf("%s-latency-%s",
+                                          block_stats_types[i].name,
+                                          block_stats_percentile_names[j]);
+            value->type = STATS_TYPE_INSTANT;
+            value->has_unit = true;
+            value->unit = STATS_UNIT_SECONDS;
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = -9;
+            QAPI_LIST_PREPEND(stats_list, value);
+        }
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_BLOCK, STATS_TARGET_BLOCK,
+                     stats_list);
+
+    stats_list = NULL;
+    for (i = 0; i < ARRAY_SIZE(throttle_group_stats_directions); i++) {
+        for (j = 0; j < ARRAY_SIZE(throttle_group_stats_fields); j++) {
+            StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+            value->name = g_strdup_printf("%s-%s",
+                                    throttle_group_stats_directions[i].name,
+                                    throttle_group_stats_fields[j].name);
+            value->type = STATS_TYPE_CUMULATIVE;
+            if (throttle_group_stats_fields[j].in_bytes) {
+                value->has_unit = true;
+                value->unit = STATS_UNIT_BYTES;
+            }
+            QAPI_LIST_PREPEND(stats_list, value);
+        }
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_BLOCK,
+                     STATS_TARGET_THROTTLE_GROUP, stats_list);
+}
+
+static void block_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BLOCK, block_stats_cb,
+                        block_schemas_cb, false);
+}
+
+block_init(block_stats_register);
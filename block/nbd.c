@@ -47,7 +47,8 @@
 #include "qemu/yank.h"
 
 #define EN_OPTSTR ":exportname="
-#define MAX_NBD_REQUESTS    16
+#define NBD_DEFAULT_MAX_REQUESTS    16
+#define NBD_MAX_REQUESTS_LIMIT      1024
 
 #define COOKIE_TO_INDEX(cookie) ((cookie) - 1)
 #define INDEX_TO_COOKIE(index)  ((index) + 1)
@@ -77,7 +78,7 @@ typedef struct BDRVNBDState {
     NBDClientState state;
     CoQueue free_sema;
     unsigned in_flight;
-    NBDClientRequest requests[MAX_NBD_REQUESTS];
+    NBDClientRequest *requests; /* max_requests entries */
     QEMUTimer *reconnect_delay_timer;
 
     /* Protects sending data on the socket.  */
@@ -97,6 +98,7 @@ typedef struct BDRVNBDState {
     /* Connection parameters */
     uint32_t reconnect_delay;
     uint32_t open_timeout;
+    unsigned max_requests;
     SocketAddress *saddr;
     char *export;
     char *tlscredsid;
@@ -134,6 +136,8 @@ static void nbd_clear_bdrvstate(BlockDriverState *bs)
     s->tlshostname = NULL;
     g_free(s->x_dirty_bitmap);
     s->x_dirty_bitmap = NULL;
+    g_free(s->requests);
+    s->requests = NULL;
 }
 
 /* Called with s->receive_mutex taken.  */
@@ -153,7 +157,7 @@ static void coroutine_fn nbd_recv_coroutines_wake(BDRVNBDState *s)
     int i;
 
     QEMU_LOCK_GUARD(&s->receive_mutex);
-    for (i = 0; i < MAX_NBD_REQUESTS; i++) {
+    for (i = 0; i < s->max_requests; i++) {
         if (nbd_recv_coroutine_wake_one(&s->requests[i])) {
             return;
         }
@@ -474,7 +478,7 @@ static coroutine_fn int nbd_receive_replies(BDRVNBDState *s, uint64_t cookie,
             return -EINVAL;
         }
         ind2 = COOKIE_TO_INDEX(s->reply.cookie);
-        if (ind2 >= MAX_NBD_REQUESTS || !s->requests[ind2].coroutine) {
+        if (ind2 >= s->max_requests || !s->requests[ind2].coroutine) {
             nbd_channel_error(s, -EINVAL);
             error_setg(errp, "unexpected cookie value");
             return -EINVAL;
@@ -495,7 +499,7 @@ nbd_co_send_request(BlockDriverState *bs, NBDRequest *request,
     int rc, i = -1;
 
     qemu_mutex_lock(&s->requests_lock);
-    while (s->in_flight == MAX_NBD_REQUESTS ||
+    while (s->in_flight == s->max_requests ||
            (s->state != NBD_CLIENT_CONNECTED && s->in_flight > 0)) {
         qemu_co_queue_wait(&s->free_sema, &s->requests_lock);
     }
@@ -512,13 +516,13 @@ nbd_co_send_request(BlockDriverState *bs, NBDRequest *request,
         }
     }
 
-    for (i = 0; i < MAX_NBD_REQUESTS; i++) {
+    for (i = 0; i < s->max_requests; i++) {
         if (s->requests[i].coroutine == NULL) {
             break;
         }
     }
 
-    assert(i < MAX_NBD_REQUESTS);
+    assert(i < s->max_requests);
     s->requests[i].coroutine = qemu_coroutine_self();
     s->requests[i].offset = request->from;
     s->requests[i].receiving = false;
@@ -1840,6 +1844,12 @@ static QemuOptsList nbd_runtime_opts = {
                     "attempts until successful or until @open-timeout seconds "
                     "have elapsed. Default 0",
         },
+        {
+            .name = "max-requests",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of requests in flight on the "
+                    "connection. Default 16",
+        },
         { /* end of list */ }
     },
 };
@@ -1849,6 +1859,7 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 {
     BDRVNBDState *s = bs->opaque;
     QemuOpts *opts;
+    uint64_t max_requests;
     int ret = -EINVAL;
 
     opts = qemu_opts_create(&nbd_runtime_opts, NULL, 0, &error_abort);
@@ -1896,6 +1907,16 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
     s->open_timeout = qemu_opt_get_number(opts, "open-timeout", 0);
 
+    max_requests = qemu_opt_get_number(opts, "max-requests",
+                                       NBD_DEFAULT_MAX_REQUESTS);
+    if (max_requests < 1 || max_requests > NBD_MAX_REQUESTS_LIMIT) {
+        error_setg(errp, "max-requests must be between 1 and %d",
+                   NBD_MAX_REQUESTS_LIMIT);
+        goto error;
+    }
+    s->max_requests = max_requests;
+    s->requests = g_new0(NBDClientRequest, s->max_requests);
+
     ret = 0;
 
  error:
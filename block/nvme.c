@@ -49,6 +49,9 @@ typedef struct BDRVNVMeState BDRVNVMeState;
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
+/* I/O queue pairs are handed out to submitting AioContexts, see nvme_ioq() */
+#define NVME_MAX_IO_QUEUES 8
+
 /* This driver shares a single MSIX IRQ for the admin and I/O queues */
 enum {
     MSIX_SHARED_IRQ_IDX = 0,
@@ -110,6 +113,8 @@ struct BDRVNVMeState {
      */
     NVMeQueuePair **queues;
     unsigned queue_count;
+    /* The AioContext that claimed each I/O queue pair, or NULL */
+    AioContext *ioq_ctx[NVME_MAX_IO_QUEUES];
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -698,6 +703,11 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     };
     if (nvme_admin_cmd_sync(bs, &cmd)) {
         error_setg(errp, "Failed to create SQ io queue [%u]", n);
+        cmd = (NvmeCmd) {
+            .opcode = NVME_ADM_CMD_DELETE_CQ,
+            .cdw10 = cpu_to_le32(n),
+        };
+        nvme_admin_cmd_sync(bs, &cmd);
         goto out_error;
     }
     s->queues = g_renew(NVMeQueuePair *, s->queues, n + 1);
@@ -752,6 +762,8 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     uint64_t timeout_ms;
     uint64_t deadline, now;
     volatile NvmeBar *regs = NULL;
+    unsigned nr_io_queues;
+    NvmeCmd cmd;
 
     qemu_co_mutex_init(&s->dma_map_lock);
     qemu_co_queue_init(&s->dma_flush_queue);
@@ -880,9 +892,32 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
-    /* Set up command queues. */
+    /*
+     * Set up command queues.  Ask for one I/O queue pair per host CPU; the
+     * controller may grant fewer, which makes creating the others fail.
+     */
+    nr_io_queues = MIN(g_get_num_processors(), NVME_MAX_IO_QUEUES);
+    cmd = (NvmeCmd) {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((nr_io_queues - 1) << 16) | (nr_io_queues - 1)),
+    };
+    if (nvme_admin_cmd_sync(bs, &cmd)) {
+        nr_io_queues = 1;
+    }
+
     if (!nvme_add_io_queue(bs, errp)) {
         ret = -EIO;
+        goto out;
+    }
+    while (s->queue_count < INDEX_IO(nr_io_queues)) {
+        Error *local_err = NULL;
+
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            trace_nvme_add_io_queue_failed(s, error_get_pretty(local_err));
+            error_free(local_err);
+            break;
+        }
     }
 out:
     if (regs) {
@@ -1180,6 +1215,31 @@ static void nvme_rw_cb(void *opaque, int ret)
     replay_bh_schedule_oneshot_event(data->ctx, nvme_rw_cb_bh, data);
 }
 
+/*
+ * Every AioContext that submits requests claims an I/O queue pair of its own
+ * while there are enough of them, so that iothreads serving a multiqueue
+ * device do not contend on one submission queue.  Completions for all
+ * queues are still processed in the BDS's AioContext.
+ */
+static NVMeQueuePair *nvme_ioq(BDRVNVMeState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    unsigned nr_io_queues = s->queue_count - 1;
+    unsigned i;
+
+    for (i = 0; i < nr_io_queues; i++) {
+        AioContext *owner = qatomic_read(&s->ioq_ctx[i]);
+
+        if (owner == ctx ||
+            (!owner && qatomic_cmpxchg(&s->ioq_ctx[i], NULL, ctx) == NULL)) {
+            return s->queues[INDEX_IO(i)];
+        }
+    }
+
+    /* More AioContexts than queue pairs, share them */
+    return s->queues[INDEX_IO(g_direct_hash(ctx) % nr_io_queues)];
+}
+
 static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
                                             uint64_t offset, uint64_t bytes,
                                             QEMUIOVector *qiov,
@@ -1188,7 +1248,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_ioq(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1309,7 +1369,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_ioq(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1340,7 +1400,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_ioq(s);
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1403,7 +1463,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_ioq(s);
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
@@ -33,6 +33,7 @@
 #include "qemu/osdep.h"
 
 #include "block/block_int.h"
+#include "block/blockjob.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
 #include "qapi/qmp/qdict.h"
@@ -572,3 +573,31 @@ void qmp_block_latency_histogram_set(
         }
     }
 }
+
+void qmp_block_job_set_latency_target(const char *device, const char *qdev,
+                                      uint64_t latency, Error **errp)
+{
+    BlockBackend *blk = NULL;
+    BlockJob *job;
+
+    if (latency) {
+        if (!qdev) {
+            error_setg(errp, "Parameter 'qdev' is required");
+            return;
+        }
+        blk = blk_by_qdev_id(qdev, errp);
+        if (!blk) {
+            return;
+        }
+    }
+
+    JOB_LOCK_GUARD();
+    job = block_job_get_locked(device);
+    if (!job) {
+        error_set(errp, ERROR_CLASS_DEVICE_NOT_ACTIVE,
+                  "Block job '%s' not found", device);
+        return;
+    }
+
+    block_job_set_latency_target_locked(job, blk, latency, errp);
+}
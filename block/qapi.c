@@ -491,6 +491,26 @@ bdrv_latency_histogram_stats(BlockLatencyHistogram *hist)
     return info;
 }
 
+static BlockLatencyPercentiles *
+bdrv_latency_percentiles_stats(BlockAcctStats *stats, enum BlockAcctType type)
+{
+    static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+    uint64_t values[ARRAY_SIZE(percentiles)];
+    BlockLatencyPercentiles *info;
+
+    if (!block_latency_percentiles(stats, type, percentiles, values,
+                                   ARRAY_SIZE(percentiles))) {
+        return NULL;
+    }
+
+    info = g_new0(BlockLatencyPercentiles, 1);
+    info->p50 = values[0];
+    info->p90 = values[1];
+    info->p99 = values[2];
+    info->p999 = values[3];
+    return info;
+}
+
 static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
 {
     BlockAcctStats *stats = blk_get_stats(blk);
@@ -586,6 +606,17 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
         = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_ZONE_APPEND]);
     ds->flush_latency_histogram
         = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_FLUSH]);
+
+    ds->rd_latency_percentiles
+        = bdrv_latency_percentiles_stats(stats, BLOCK_ACCT_READ);
+    ds->wr_latency_percentiles
+        = bdrv_latency_percentiles_stats(stats, BLOCK_ACCT_WRITE);
+    ds->zone_append_latency_percentiles
+        = bdrv_latency_percentiles_stats(stats, BLOCK_ACCT_ZONE_APPEND);
+    ds->flush_latency_percentiles
+        = bdrv_latency_percentiles_stats(stats, BLOCK_ACCT_FLUSH);
+    ds->unmap_latency_percentiles
+        = bdrv_latency_percentiles_stats(stats, BLOCK_ACCT_UNMAP);
 }
 
 static BlockStats * GRAPH_RDLOCK
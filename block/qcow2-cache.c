@@ -25,14 +25,23 @@
 #include "qemu/osdep.h"
 #include "block/block-io.h"
 #include "qemu/memalign.h"
+#include "qemu/xxhash.h"
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * Cached tables are indexed by a hash table (chained through hash_next) so
+ * that lookups don't have to scan the whole cache, and replaced using the
+ * CLOCK algorithm: every access sets the referenced bit, and the clock hand
+ * gives each unused entry a second chance before evicting it.
+ */
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
+    int      hash_next;
     bool     dirty;
+    bool     referenced;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -44,6 +53,9 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+    int                    *hash_buckets;
+    unsigned                hash_mask;
+    int                     clock_hand;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +71,52 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return qemu_xxhash2(offset / c->table_size) & c->hash_mask;
+}
+
+/* Return the index of the entry caching @offset, or -1 if there is none */
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = c->hash_buckets[qcow2_cache_hash(c, offset)]; i >= 0;
+         i = c->entries[i].hash_next) {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, int64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->offset == offset) {
+        return;
+    }
+
+    if (t->offset) {
+        int *link = &c->hash_buckets[qcow2_cache_hash(c, t->offset)];
+        while (*link != i) {
+            assert(*link >= 0);
+            link = &c->entries[*link].hash_next;
+        }
+        *link = t->hash_next;
+        t->hash_next = -1;
+    }
+
+    t->offset = offset;
+
+    if (offset) {
+        int *bucket = &c->hash_buckets[qcow2_cache_hash(c, offset)];
+        t->hash_next = *bucket;
+        *bucket = i;
+    }
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,8 +164,9 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
+            c->entries[i].referenced = false;
             i++;
             to_clean++;
         }
@@ -125,6 +184,8 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    unsigned num_buckets;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -138,11 +199,24 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    /* Keep the load factor of the hash table at or below one half */
+    num_buckets = pow2ceil(num_tables) * 2;
+    c->hash_mask = num_buckets - 1;
+    c->hash_buckets = g_try_new(int, num_buckets);
+
+    if (!c->entries || !c->table_array || !c->hash_buckets) {
         qemu_vfree(c->table_array);
+        g_free(c->hash_buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    for (i = 0; i < num_buckets; i++) {
+        c->hash_buckets[i] = -1;
+    }
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].hash_next = -1;
     }
 
     return c;
@@ -157,6 +231,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->hash_buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -179,19 +254,15 @@ qcow2_cache_flush_dependency(BlockDriverState *bs, Qcow2Cache *c)
     return 0;
 }
 
+/*
+ * Makes sure that everything that must be on disk before the tables of @c may
+ * be written actually is.
+ */
 static int GRAPH_RDLOCK
-qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
+qcow2_cache_write_prepare(BlockDriverState *bs, Qcow2Cache *c)
 {
-    BDRVQcow2State *s = bs->opaque;
     int ret = 0;
 
-    if (!c->entries[i].dirty || !c->entries[i].offset) {
-        return 0;
-    }
-
-    trace_qcow2_cache_entry_flush(qemu_coroutine_self(),
-                                  c == s->l2_table_cache, i);
-
     if (c->depends) {
         ret = qcow2_cache_flush_dependency(bs, c);
     } else if (c->depends_on_flush) {
@@ -201,9 +272,18 @@ qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
         }
     }
 
-    if (ret < 0) {
-        return ret;
-    }
+    return ret;
+}
+
+/*
+ * Runs the overlap check for dirty entry @i and accounts for the write that
+ * is about to follow.
+ */
+static int GRAPH_RDLOCK
+qcow2_cache_entry_check_write(BlockDriverState *bs, Qcow2Cache *c, int i)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
 
     if (c == s->refcount_block_cache) {
         ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_REFCOUNT_BLOCK,
@@ -226,6 +306,32 @@ qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
         BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE);
     }
 
+    return 0;
+}
+
+static int GRAPH_RDLOCK
+qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (!c->entries[i].dirty || !c->entries[i].offset) {
+        return 0;
+    }
+
+    trace_qcow2_cache_entry_flush(qemu_coroutine_self(),
+                                  c == s->l2_table_cache, i);
+
+    ret = qcow2_cache_write_prepare(bs, c);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = qcow2_cache_entry_check_write(bs, c, i);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = bdrv_pwrite(bs->file, c->entries[i].offset, c->table_size,
                       qcow2_cache_get_table_addr(c, i), 0);
     if (ret < 0) {
@@ -237,20 +343,98 @@ qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
     return 0;
 }
 
+typedef struct Qcow2DirtyTable {
+    int64_t offset;
+    int     idx;
+} Qcow2DirtyTable;
+
+static int qcow2_dirty_table_cmp(const void *a, const void *b)
+{
+    const Qcow2DirtyTable *ta = a, *tb = b;
+
+    return ta->offset < tb->offset ? -1 : ta->offset > tb->offset;
+}
+
+/*
+ * Writes back all dirty tables. Tables that are adjacent in the image file
+ * are written with a single vectored request, so that flushing many tables
+ * that were updated together (e.g. slices of the same L2 table, or refcount
+ * blocks allocated in a row) doesn't cost one round trip per table.
+ */
 int qcow2_cache_write(BlockDriverState *bs, Qcow2Cache *c)
 {
     BDRVQcow2State *s = bs->opaque;
+    g_autofree Qcow2DirtyTable *dirty = NULL;
+    int nb_dirty = 0;
+    int max_batch = MIN(IOV_MAX, BDRV_REQUEST_MAX_BYTES / c->table_size);
     int result = 0;
     int ret;
-    int i;
+    int i, j, k;
 
     trace_qcow2_cache_flush(qemu_coroutine_self(), c == s->l2_table_cache);
 
     for (i = 0; i < c->size; i++) {
-        ret = qcow2_cache_entry_flush(bs, c, i);
+        if (c->entries[i].dirty && c->entries[i].offset) {
+            if (!dirty) {
+                dirty = g_new(Qcow2DirtyTable, c->size);
+            }
+            dirty[nb_dirty].offset = c->entries[i].offset;
+            dirty[nb_dirty].idx = i;
+            nb_dirty++;
+        }
+    }
+
+    if (nb_dirty == 0) {
+        return 0;
+    }
+
+    ret = qcow2_cache_write_prepare(bs, c);
+    if (ret < 0) {
+        return ret;
+    }
+
+    qsort(dirty, nb_dirty, sizeof(dirty[0]), qcow2_dirty_table_cmp);
+
+    for (i = 0; i < nb_dirty; i = j) {
+        QEMUIOVector qiov;
+        int64_t start = dirty[i].offset;
+
+        qemu_iovec_init(&qiov, 1);
+        ret = 0;
+        for (j = i; j < nb_dirty && qiov.niov < max_batch; j++) {
+            if (dirty[j].offset != start + qiov.size) {
+                break;
+            }
+
+            trace_qcow2_cache_entry_flush(qemu_coroutine_self(),
+                                          c == s->l2_table_cache,
+                                          dirty[j].idx);
+            ret = qcow2_cache_entry_check_write(bs, c, dirty[j].idx);
+            if (ret < 0) {
+                /* Leave this table dirty and write what we have so far */
+                j++;
+                break;
+            }
+            qemu_iovec_add(&qiov, qcow2_cache_get_table_addr(c, dirty[j].idx),
+                           c->table_size);
+        }
         if (ret < 0 && result != -ENOSPC) {
             result = ret;
         }
+
+        if (qiov.size) {
+            ret = bdrv_pwritev(bs->file, start, qiov.size, &qiov, 0);
+            if (ret < 0) {
+                if (result != -ENOSPC) {
+                    result = ret;
+                }
+            } else {
+                for (k = i; k < i + qiov.niov; k++) {
+                    c->entries[dirty[k].idx].dirty = false;
+                }
+            }
+        }
+        qemu_iovec_destroy(&qiov);
     }
 
     return result;
@@ -309,13 +493,15 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
+        qcow2_cache_set_offset(c, i, 0);
         c->entries[i].lru_counter = 0;
+        c->entries[i].referenced = false;
     }
 
     qcow2_cache_table_release(c, 0, c->size);
 
     c->lru_counter = 0;
+    c->clock_hand = 0;
 
     return 0;
 }
@@ -326,10 +512,8 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 {
     BDRVQcow2State *s = bs->opaque;
     int i;
+    int n;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -344,29 +528,40 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
+    i = qcow2_cache_lookup(c, offset);
+    if (i >= 0) {
+        goto found;
+    }
+
+    /*
+     * Cache miss: advance the clock hand to the next unused entry whose
+     * referenced bit is clear, clearing bits on the way.  Two full turns are
+     * enough to find a victim if there is any unused entry at all.
+     */
+    for (n = 0; n < 2 * c->size; n++) {
+        Qcow2CachedTable *t = &c->entries[c->clock_hand];
+
+        i = c->clock_hand;
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
         }
-        if (++i == c->size) {
-            i = 0;
+
+        if (t->ref == 0) {
+            if (!t->referenced || !t->offset) {
+                break;
+            }
+            t->referenced = false;
         }
-    } while (i != lookup_index);
+        i = -1;
+    }
 
-    if (min_lru_index == -1) {
+    if (i == -1) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
-    /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    /* Write the victim table back and replace it */
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -377,7 +572,7 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -390,11 +585,12 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
     c->entries[i].ref++;
+    c->entries[i].referenced = true;
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -438,14 +634,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -454,9 +645,10 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
+    c->entries[i].referenced = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
@@ -535,6 +535,48 @@ do_perform_cow_read(BlockDriverState *bs, uint64_t src_cluster_offset,
     return 0;
 }
 
+/*
+ * Read the COW region @r of @m into @buf. The subclusters in @skip (a bitmap
+ * of the subclusters of the cluster that contains @r) are not read but
+ * zeroed, each run of the other subclusters is read with one request.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+do_perform_cow_read_region(BlockDriverState *bs, QCowL2Meta *m,
+                           Qcow2COWRegion *r, uint8_t *buf, uint32_t skip)
+{
+    BDRVQcow2State *s = bs->opaque;
+    unsigned pos = 0;
+    int ret;
+
+    while (pos < r->nb_bytes) {
+        unsigned offset = r->offset + pos;
+        bool skipped = skip & (1U << offset_to_sc_index(s, offset));
+        unsigned len = 0;
+
+        do {
+            len = MIN(ROUND_UP(offset + len + 1, s->subcluster_size) - offset,
+                      r->nb_bytes - pos);
+        } while (pos + len < r->nb_bytes &&
+                 !!(skip & (1U << offset_to_sc_index(s, offset + len))) ==
+                 skipped);
+
+        if (skipped) {
+            memset(buf + pos, 0, len);
+        } else {
+            QEMUIOVector qiov;
+
+            qemu_iovec_init_buf(&qiov, buf + pos, len);
+            ret = do_perform_cow_read(bs, m->offset, offset, &qiov);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        pos += len;
+    }
+
+    return 0;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 do_perform_cow_write(BlockDriverState *bs, uint64_t cluster_offset,
                      unsigned offset_in_cluster, QEMUIOVector *qiov)
@@ -563,6 +605,35 @@ do_perform_cow_write(BlockDriverState *bs, uint64_t cluster_offset,
 }
 
 
+/*
+ * Returns the number of bytes (at most @max_bytes) from @offset up to the next
+ * L1 entry that references an L2 table. The caller must have checked that the
+ * L1 entry for @offset does not reference one.
+ */
+static uint64_t count_unallocated_l1_bytes(BDRVQcow2State *s, uint64_t offset,
+                                           uint64_t max_bytes)
+{
+    uint64_t l1_index = offset_to_l1_index(s, offset);
+    int l1_bits = s->l2_bits + s->cluster_bits;
+    uint64_t end;
+
+    while (l1_index < s->l1_size &&
+           !(s->l1_table[l1_index] & L1E_OFFSET_MASK)) {
+        l1_index++;
+        if ((l1_index << l1_bits) - offset >= max_bytes) {
+            return max_bytes;
+        }
+    }
+
+    if (l1_index >= s->l1_size) {
+        /* Everything beyond the L1 table is unallocated */
+        return max_bytes;
+    }
+
+    end = l1_index << l1_bits;
+    return MIN(end - offset, max_bytes);
+}
+
 /*
  * get_host_offset
  *
@@ -592,12 +663,12 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
     uint64_t l1_index, l2_offset, *l2_slice, l2_entry, l2_bitmap;
     int sc;
     unsigned int offset_in_cluster;
-    uint64_t bytes_available, bytes_needed, nb_clusters;
+    uint64_t bytes_available, bytes_needed, bytes_requested, nb_clusters;
     QCow2SubclusterType type;
     int ret;
 
     offset_in_cluster = offset_into_cluster(s, offset);
-    bytes_needed = (uint64_t) *bytes + offset_in_cluster;
+    bytes_requested = bytes_needed = (uint64_t) *bytes + offset_in_cluster;
 
     /* compute how many bytes there are between the start of the cluster
      * containing offset and the end of the l2 slice that contains
@@ -615,14 +686,19 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
     /* seek to the l2 offset in the l1 table */
 
     l1_index = offset_to_l1_index(s, offset);
-    if (l1_index >= s->l1_size) {
-        type = QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN;
-        goto out;
-    }
-
-    l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    l2_offset = l1_index < s->l1_size ?
+                s->l1_table[l1_index] & L1E_OFFSET_MASK : 0;
     if (!l2_offset) {
+        /*
+         * Nothing to load, so don't stop at the end of the L2 slice, but
+         * report the whole run of unused L1 entries at once. This saves a
+         * lot of calls when scanning sparse images.
+         */
         type = QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN;
+        bytes_needed = bytes_requested;
+        bytes_available = count_unallocated_l1_bytes(s,
+                                                     offset - offset_in_cluster,
+                                                     bytes_requested);
         goto out;
     }
 
@@ -908,7 +984,8 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
     /* If we have to read both the start and end COW regions and the
      * middle region is not too large then perform just one read
      * operation */
-    merge_reads = start->nb_bytes && end->nb_bytes && data_bytes <= 16384;
+    merge_reads = start->nb_bytes && end->nb_bytes && data_bytes <= 16384 &&
+                  !m->cow_start_skip && !m->cow_end_skip;
     if (merge_reads) {
         buffer_size = start->nb_bytes + data_bytes + end->nb_bytes;
     } else {
@@ -945,15 +1022,14 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
         qemu_iovec_add(&qiov, start_buffer, buffer_size);
         ret = do_perform_cow_read(bs, m->offset, start->offset, &qiov);
     } else {
-        qemu_iovec_add(&qiov, start_buffer, start->nb_bytes);
-        ret = do_perform_cow_read(bs, m->offset, start->offset, &qiov);
+        ret = do_perform_cow_read_region(bs, m, start, start_buffer,
+                                         m->cow_start_skip);
         if (ret < 0) {
             goto fail;
         }
 
-        qemu_iovec_reset(&qiov);
-        qemu_iovec_add(&qiov, end_buffer, end->nb_bytes);
-        ret = do_perform_cow_read(bs, m->offset, end->offset, &qiov);
+        ret = do_perform_cow_read_region(bs, m, end, end_buffer,
+                                         m->cow_end_skip);
     }
     if (ret < 0) {
         goto fail;
@@ -1088,6 +1164,8 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
             uint64_t l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
             unsigned written_from = m->cow_start.offset;
             unsigned written_to = m->cow_end.offset + m->cow_end.nb_bytes;
+            uint64_t written;
+            uint32_t skipped = 0;
             int first_sc, last_sc;
             /* Narrow written_from and written_to down to the current cluster */
             written_from = MAX(written_from, i << s->cluster_bits);
@@ -1095,8 +1173,17 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
             assert(written_from < written_to);
             first_sc = offset_to_sc_index(s, written_from);
             last_sc  = offset_to_sc_index(s, written_to - 1);
-            l2_bitmap |= QCOW_OFLAG_SUB_ALLOC_RANGE(first_sc, last_sc + 1);
-            l2_bitmap &= ~QCOW_OFLAG_SUB_ZERO_RANGE(first_sc, last_sc + 1);
+            /* Subclusters that perform_cow() did not copy keep their state */
+            if (i == 0) {
+                skipped |= m->cow_start_skip;
+            }
+            if (i == m->nb_clusters - 1) {
+                skipped |= m->cow_end_skip;
+            }
+            written = QCOW_OFLAG_SUB_ALLOC_RANGE(first_sc, last_sc + 1) &
+                      ~(uint64_t)skipped;
+            l2_bitmap |= written;
+            l2_bitmap &= ~(written << 32);
             set_l2_bitmap(s, l2_slice, l2_index + i, l2_bitmap);
         }
      }
@@ -1165,6 +1252,7 @@ calculate_l2_meta(BlockDriverState *bs, uint64_t host_cluster_offset,
     int sc_index, l2_index = offset_to_l2_slice_index(s, guest_offset);
     uint64_t l2_entry, l2_bitmap;
     unsigned cow_start_from, cow_end_to;
+    uint32_t cow_start_skip = 0, cow_end_skip = 0;
     unsigned cow_start_to = offset_into_cluster(s, guest_offset);
     unsigned cow_end_from = cow_start_to + bytes;
     unsigned nb_clusters = size_to_clusters(s, cow_end_from);
@@ -1226,8 +1314,11 @@ calculate_l2_meta(BlockDriverState *bs, uint64_t host_cluster_offset,
             if (has_subclusters(s)) {
                 /* Skip all leading zero and unallocated subclusters */
                 uint32_t alloc_bitmap = l2_bitmap & QCOW_L2_BITMAP_ALL_ALLOC;
-                cow_start_from =
-                    MIN(sc_index, ctz32(alloc_bitmap)) << s->subcluster_bits;
+                int first_sc = MIN(sc_index, ctz32(alloc_bitmap));
+                cow_start_from = first_sc << s->subcluster_bits;
+                /* And don't copy those between allocated subclusters either */
+                cow_start_skip = ~alloc_bitmap &
+                                 QCOW_OFLAG_SUB_ALLOC_RANGE(first_sc, sc_index);
             } else {
                 cow_start_from = 0;
             }
@@ -1272,9 +1363,13 @@ calculate_l2_meta(BlockDriverState *bs, uint64_t host_cluster_offset,
             if (has_subclusters(s)) {
                 /* Skip all trailing zero and unallocated subclusters */
                 uint32_t alloc_bitmap = l2_bitmap & QCOW_L2_BITMAP_ALL_ALLOC;
+                int last_sc;
                 cow_end_to -=
                     MIN(s->subclusters_per_cluster - sc_index - 1,
                         clz32(alloc_bitmap)) << s->subcluster_bits;
+                last_sc = offset_to_sc_index(s, cow_end_to - 1);
+                cow_end_skip = ~alloc_bitmap &
+                    QCOW_OFLAG_SUB_ALLOC_RANGE(sc_index + 1, last_sc + 1);
             }
             break;
         case QCOW2_SUBCLUSTER_ZERO_PLAIN:
@@ -1316,6 +1411,8 @@ calculate_l2_meta(BlockDriverState *bs, uint64_t host_cluster_offset,
             .offset     = cow_end_from,
             .nb_bytes   = cow_end_to - cow_end_from,
         },
+        .cow_start_skip = cow_start_skip,
+        .cow_end_skip   = cow_end_skip,
     };
 
     qemu_co_queue_init(&(*m)->dependent_requests);
@@ -1606,6 +1703,7 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
                         uint64_t *host_offset, uint64_t *nb_clusters)
 {
     BDRVQcow2State *s = bs->opaque;
+    int64_t cluster_offset;
 
     trace_qcow2_do_alloc_clusters_offset(qemu_coroutine_self(), guest_offset,
                                          *host_offset, *nb_clusters);
@@ -1619,22 +1717,12 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
-    if (*host_offset == INV_OFFSET) {
-        int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
-        if (cluster_offset < 0) {
-            return cluster_offset;
-        }
-        *host_offset = cluster_offset;
-        return 0;
-    } else {
-        int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
-        if (ret < 0) {
-            return ret;
-        }
-        *nb_clusters = ret;
-        return 0;
+    cluster_offset = qcow2_alloc_data_clusters(bs, *host_offset, nb_clusters);
+    if (cluster_offset < 0) {
+        return cluster_offset;
     }
+    *host_offset = cluster_offset;
+    return 0;
 }
 
 /*
@@ -2107,9 +2195,14 @@ zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
     return nb_clusters;
 }
 
+/*
+ * Make @nb_subclusters subclusters starting at @offset read as zeroes. With
+ * @discard, the subclusters are only deallocated if there is no backing file
+ * (and so read as zeroes anyway), and compressed clusters are left alone.
+ */
 static int coroutine_fn GRAPH_RDLOCK
 zero_l2_subclusters(BlockDriverState *bs, uint64_t offset,
-                    unsigned nb_subclusters)
+                    unsigned nb_subclusters, bool discard)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l2_slice;
@@ -2128,7 +2221,8 @@ zero_l2_subclusters(BlockDriverState *bs, uint64_t offset,
 
     switch (qcow2_get_cluster_type(bs, get_l2_entry(s, l2_slice, l2_index))) {
     case QCOW2_CLUSTER_COMPRESSED:
-        ret = -ENOTSUP; /* We cannot partially zeroize compressed clusters */
+        /* We cannot partially zeroize compressed clusters */
+        ret = discard ? 0 : -ENOTSUP;
         goto out;
     case QCOW2_CLUSTER_NORMAL:
     case QCOW2_CLUSTER_UNALLOCATED:
@@ -2139,7 +2233,9 @@ zero_l2_subclusters(BlockDriverState *bs, uint64_t offset,
 
     old_l2_bitmap = l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index);
 
-    l2_bitmap |=  QCOW_OFLAG_SUB_ZERO_RANGE(sc, sc + nb_subclusters);
+    if (!discard || bs->backing) {
+        l2_bitmap |= QCOW_OFLAG_SUB_ZERO_RANGE(sc, sc + nb_subclusters);
+    }
     l2_bitmap &= ~QCOW_OFLAG_SUB_ALLOC_RANGE(sc, sc + nb_subclusters);
 
     if (old_l2_bitmap != l2_bitmap) {
@@ -2202,7 +2298,7 @@ int coroutine_fn qcow2_subcluster_zeroize(BlockDriverState *bs, uint64_t offset,
 
     if (head) {
         ret = zero_l2_subclusters(bs, offset - head,
-                                  size_to_subclusters(s, head));
+                                  size_to_subclusters(s, head), false);
         if (ret < 0) {
             goto fail;
         }
@@ -2223,7 +2319,8 @@ int coroutine_fn qcow2_subcluster_zeroize(BlockDriverState *bs, uint64_t offset,
     }
 
     if (tail) {
-        ret = zero_l2_subclusters(bs, end_offset, size_to_subclusters(s, tail));
+        ret = zero_l2_subclusters(bs, end_offset, size_to_subclusters(s, tail),
+                                  false);
         if (ret < 0) {
             goto fail;
         }
@@ -2237,6 +2334,30 @@ fail:
     return ret;
 }
 
+/*
+ * Discards the subclusters in [@offset, @offset + @bytes), which must be
+ * subcluster-aligned and lie within a single cluster. The host cluster stays
+ * allocated, but later copy-on-write does not need to copy the discarded
+ * subclusters any more.
+ */
+int coroutine_fn qcow2_subcluster_discard(BlockDriverState *bs, uint64_t offset,
+                                          uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    assert(has_subclusters(s));
+    assert(offset_into_subcluster(s, offset | bytes) == 0);
+    assert(offset_to_sc_index(s, offset) + size_to_subclusters(s, bytes) <=
+           s->subclusters_per_cluster);
+
+    /* The external data file must keep the old data */
+    if (data_file_is_raw(bs)) {
+        return -ENOTSUP;
+    }
+
+    return zero_l2_subclusters(bs, offset, size_to_subclusters(s, bytes), true);
+}
+
 /*
  * Expands all zero clusters in a specific L1 table (or deallocates them, for
  * non-backed non-pre-allocated zero clusters).
@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "block/block-io.h"
+#include "block/aio_task.h"
 #include "qapi/error.h"
 #include "qcow2.h"
 #include "qemu/range.h"
@@ -815,6 +816,7 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
     int64_t start, last, cluster_offset;
     void *refcount_block = NULL;
     int64_t old_table_index = -1;
+    bool freed = false;
     int ret;
 
 #ifdef DEBUG_ALLOC2
@@ -828,9 +830,23 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
         return 0;
     }
 
+    /*
+     * Dropping a reference must not reach the disk before the L2 entry that
+     * held it is gone.  With lazy refcounts the image is marked dirty
+     * instead, so the refcounts are rebuilt after a crash and refcount
+     * blocks can be written back without flushing the L2 cache first.
+     * That keeps discard-heavy workloads from flushing both caches over and
+     * over when they interleave with allocations, which order the caches
+     * the other way round.
+     */
     if (decrease) {
-        qcow2_cache_set_dependency(bs, s->refcount_block_cache,
-            s->l2_table_cache);
+        if (s->use_lazy_refcounts) {
+            qcow2_mark_dirty(bs);
+        }
+        if (qcow2_need_accurate_refcounts(s)) {
+            qcow2_cache_set_dependency(bs, s->refcount_block_cache,
+                s->l2_table_cache);
+        }
     }
 
     start = start_of_cluster(s, offset);
@@ -888,6 +904,7 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
         if (refcount == 0) {
             void *table;
 
+            freed = true;
             table = qcow2_cache_is_table_offset(s->refcount_block_cache,
                                                 offset);
             if (table != NULL) {
@@ -909,6 +926,11 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
 
     ret = 0;
 fail:
+    if (freed) {
+        /* The host clusters may be reused for other data now */
+        qcow2_decompressed_cache_invalidate(bs);
+    }
+
     if (!s->cache_discards) {
         qcow2_process_discards(bs, ret);
     }
@@ -1065,6 +1087,91 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+/*
+ * Allocates host clusters for guest data.
+ *
+ * If @offset is INV_OFFSET, exactly *@nb_clusters contiguous clusters are
+ * allocated anywhere in the image file. Otherwise, as many clusters as
+ * possible up to *@nb_clusters are allocated starting at @offset, and
+ * *@nb_clusters is updated to the number of clusters actually allocated
+ * (which may be 0).
+ *
+ * If the alloc-batch-size option is set, new allocations are rounded up to
+ * that size and the excess clusters are kept reserved for the following
+ * requests, so that only one refcount update is needed for the whole batch.
+ * Reserved clusters have a refcount of 1 but are not referenced by any L2
+ * table yet; they must be given back with qcow2_release_reserved_clusters()
+ * before anything looks at the refcounts as a whole.
+ *
+ * Returns the host offset of the first allocated cluster, or -errno.
+ */
+int64_t coroutine_fn GRAPH_RDLOCK
+qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t offset,
+                          uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t n = *nb_clusters;
+    int64_t ret;
+
+    if (offset != INV_OFFSET) {
+        if (s->reserved_clusters && offset == s->reserved_offset) {
+            n = MIN(n, s->reserved_clusters);
+            s->reserved_offset += n << s->cluster_bits;
+            s->reserved_clusters -= n;
+            *nb_clusters = n;
+            return offset;
+        }
+
+        ret = qcow2_alloc_clusters_at(bs, offset, n);
+        if (ret < 0) {
+            return ret;
+        }
+        *nb_clusters = ret;
+        return offset;
+    }
+
+    if (s->reserved_clusters < n) {
+        if (s->alloc_batch_clusters <= n) {
+            return qcow2_alloc_clusters(bs, n << s->cluster_bits);
+        }
+
+        /*
+         * Give back what is left of the old batch first, so that the new one
+         * can reuse those clusters if they are followed by free space
+         */
+        qcow2_release_reserved_clusters(bs);
+
+        ret = qcow2_alloc_clusters(bs,
+                                   s->alloc_batch_clusters << s->cluster_bits);
+        if (ret < 0) {
+            return ret;
+        }
+        s->reserved_offset = ret;
+        s->reserved_clusters = s->alloc_batch_clusters;
+    }
+
+    ret = s->reserved_offset;
+    s->reserved_offset += n << s->cluster_bits;
+    s->reserved_clusters -= n;
+    return ret;
+}
+
+/*
+ * Frees all clusters that qcow2_alloc_data_clusters() has reserved, but not
+ * handed out yet.
+ */
+void qcow2_release_reserved_clusters(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->reserved_clusters) {
+        qcow2_free_clusters(bs, s->reserved_offset,
+                            s->reserved_clusters << s->cluster_bits,
+                            QCOW2_DISCARD_NEVER);
+        s->reserved_clusters = 0;
+    }
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -1656,6 +1763,8 @@ fail:
  * referenced in the L2 table. While doing so, performs some checks on L2
  * entries.
  *
+ * @l2_table is the L2 table if it has already been read from disk, or NULL.
+ *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
@@ -1663,22 +1772,26 @@ static int coroutine_fn GRAPH_RDLOCK
 check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                    void **refcount_table,
                    int64_t *refcount_table_size, int64_t l2_offset,
-                   int flags, BdrvCheckMode fix, bool active)
+                   uint64_t *l2_table, int flags, BdrvCheckMode fix,
+                   bool active)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t l2_entry, l2_bitmap;
     uint64_t next_contiguous_offset = 0;
     int i, ret;
     size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
-    g_autofree uint64_t *l2_table = g_malloc(l2_size_bytes);
+    g_autofree uint64_t *l2_buf = NULL;
     bool metadata_overlap;
 
     /* Read L2 table from disk */
-    ret = bdrv_co_pread(bs->file, l2_offset, l2_size_bytes, l2_table, 0);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        return ret;
+    if (!l2_table) {
+        l2_table = l2_buf = g_malloc(l2_size_bytes);
+        ret = bdrv_co_pread(bs->file, l2_offset, l2_size_bytes, l2_table, 0);
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+            res->check_errors++;
+            return ret;
+        }
     }
 
     /* Do the actual checks */
@@ -1851,6 +1964,65 @@ check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
     return 0;
 }
 
+typedef struct CheckL2ReadTask {
+    AioTask task;
+    BlockDriverState *bs;
+    uint64_t l2_offset;
+    uint64_t **l2_table;
+} CheckL2ReadTask;
+
+static int coroutine_fn GRAPH_RDLOCK check_l2_read_task_entry(AioTask *task)
+{
+    CheckL2ReadTask *t = container_of(task, CheckL2ReadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    size_t l2_size_bytes = s->l2_size * l2_entry_size(s);
+    uint64_t *l2_table = g_malloc(l2_size_bytes);
+
+    /* On error, check_refcounts_l2() retries the read and reports it */
+    if (bdrv_co_pread(t->bs->file, t->l2_offset, l2_size_bytes,
+                      l2_table, 0) < 0) {
+        g_free(l2_table);
+        return 0;
+    }
+
+    *t->l2_table = l2_table;
+    return 0;
+}
+
+/*
+ * Reads the L2 tables referenced by @l1_entries in parallel, so that checking
+ * huge images is not bound by the latency of one L2 table read after another.
+ * The tables are still checked one by one and in order, which keeps error
+ * reporting the same.  Tables that fail to read are left NULL.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+check_prefetch_l2_tables(BlockDriverState *bs, const uint64_t *l1_entries,
+                         int count, uint64_t **l2_tables)
+{
+    AioTaskPool *pool = aio_task_pool_new(QCOW2_MAX_WORKERS);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        CheckL2ReadTask *t;
+
+        if (!l1_entries[i]) {
+            continue;
+        }
+
+        t = g_new(CheckL2ReadTask, 1);
+        *t = (CheckL2ReadTask) {
+            .task.func = check_l2_read_task_entry,
+            .bs = bs,
+            .l2_offset = l1_entries[i] & L1E_OFFSET_MASK,
+            .l2_table = &l2_tables[i],
+        };
+        aio_task_pool_start_task(pool, &t->task);
+    }
+
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+}
+
 /*
  * Increases the refcount for the L1 table, its L2 tables and all referenced
  * clusters in the given refcount table. While doing so, performs some checks
@@ -1868,6 +2040,7 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
     BDRVQcow2State *s = bs->opaque;
     size_t l1_size_bytes = l1_size * L1E_SIZE;
     g_autofree uint64_t *l1_table = NULL;
+    uint64_t *l2_tables[QCOW2_MAX_WORKERS] = {};
     uint64_t l2_offset;
     int i, ret;
 
@@ -1902,6 +2075,15 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
 
     /* Do the actual checks */
     for (i = 0; i < l1_size; i++) {
+        int slot = i % QCOW2_MAX_WORKERS;
+
+        /* Repairs may rewrite L2 tables, so only prefetch when not fixing */
+        if (!fix && slot == 0) {
+            check_prefetch_l2_tables(bs, &l1_table[i],
+                                     MIN(QCOW2_MAX_WORKERS, l1_size - i),
+                                     l2_tables);
+        }
+
         if (!l1_table[i]) {
             continue;
         }
@@ -1919,7 +2101,7 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
                                        refcount_table, refcount_table_size,
                                        l2_offset, s->cluster_size);
         if (ret < 0) {
-            return ret;
+            goto out;
         }
 
         /* L2 tables are cluster aligned */
@@ -1931,14 +2113,21 @@ check_refcounts_l1(BlockDriverState *bs, BdrvCheckResult *res,
 
         /* Process and check L2 entries */
         ret = check_refcounts_l2(bs, res, refcount_table,
-                                 refcount_table_size, l2_offset, flags,
-                                 fix, active);
+                                 refcount_table_size, l2_offset,
+                                 l2_tables[slot], flags, fix, active);
+        g_free(l2_tables[slot]);
+        l2_tables[slot] = NULL;
         if (ret < 0) {
-            return ret;
+            goto out;
         }
     }
 
-    return 0;
+    ret = 0;
+out:
+    for (i = 0; i < QCOW2_MAX_WORKERS; i++) {
+        g_free(l2_tables[i]);
+    }
+    return ret;
 }
 
 /*
@@ -2287,6 +2476,16 @@ calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
+    /* compression dictionary */
+    if (s->compression_dict_ext.length) {
+        ret = qcow2_inc_refcounts_imrt(bs, res, refcount_table, nb_clusters,
+                                       s->compression_dict_ext.offset,
+                                       s->compression_dict_ext.length);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     /* bitmaps */
     ret = qcow2_check_bitmaps_refcounts(bs, res, refcount_table, nb_clusters);
     if (ret < 0) {
@@ -3040,6 +3239,13 @@ int qcow2_check_metadata_overlap(BlockDriverState *bs, int ign, int64_t offset,
         }
     }
 
+    if ((chk & QCOW2_OL_COMPRESSION_DICT) && s->compression_dict_ext.length) {
+        if (overlaps_with(s->compression_dict_ext.offset,
+                          s->compression_dict_ext.length)) {
+            return QCOW2_OL_COMPRESSION_DICT;
+        }
+    }
+
     return 0;
 }
 
@@ -3053,6 +3259,7 @@ static const char *metadata_ol_names[] = {
     [QCOW2_OL_INACTIVE_L1_BITNR]        = "inactive L1 table",
     [QCOW2_OL_INACTIVE_L2_BITNR]        = "inactive L2 table",
     [QCOW2_OL_BITMAP_DIRECTORY_BITNR]   = "bitmap directory",
+    [QCOW2_OL_COMPRESSION_DICT_BITNR]   = "compression dictionary",
 };
 QEMU_BUILD_BUG_ON(QCOW2_OL_MAX_BITNR != ARRAY_SIZE(metadata_ol_names));
 
@@ -33,10 +33,13 @@
 #include <zstd_errors.h>
 #endif
 
+#include "qapi/error.h"
 #include "qcow2.h"
 #include "block/block-io.h"
+#include "block/block_int-io.h"
 #include "block/thread-pool.h"
 #include "crypto.h"
+#include "qemu/memalign.h"
 
 static int coroutine_fn
 qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
@@ -45,7 +48,7 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
     BDRVQcow2State *s = bs->opaque;
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= s->max_threads) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
@@ -67,12 +70,14 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
  */
 
 typedef ssize_t (*Qcow2CompressFunc)(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size);
+                                     const void *src, size_t src_size,
+                                     Qcow2CompressionDict *dict);
 typedef struct Qcow2CompressData {
     void *dest;
     size_t dest_size;
     const void *src;
     size_t src_size;
+    Qcow2CompressionDict *dict;
     ssize_t ret;
 
     Qcow2CompressFunc func;
@@ -91,7 +96,8 @@ typedef struct Qcow2CompressData {
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   Qcow2CompressionDict *dict)
 {
     ssize_t ret;
     z_stream strm;
@@ -138,7 +144,8 @@ static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
  *          -EIO on fail
  */
 static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     Qcow2CompressionDict *dict)
 {
     int ret;
     z_stream strm;
@@ -173,6 +180,40 @@ static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
 
 #ifdef CONFIG_ZSTD
 
+/*
+ * Digested zstd dictionary. Both objects are read-only once created, so they
+ * can be shared by all compression threads.
+ */
+struct Qcow2CompressionDict {
+    ZSTD_CDict *cdict;
+    ZSTD_DDict *ddict;
+};
+
+Qcow2CompressionDict *qcow2_compression_dict_new(const void *buf, size_t len,
+                                                 Error **errp)
+{
+    Qcow2CompressionDict *dict = g_new0(Qcow2CompressionDict, 1);
+
+    dict->cdict = ZSTD_createCDict(buf, len, ZSTD_CLEVEL_DEFAULT);
+    dict->ddict = ZSTD_createDDict(buf, len);
+    if (!dict->cdict || !dict->ddict) {
+        error_setg(errp, "Could not load zstd compression dictionary");
+        qcow2_compression_dict_free(dict);
+        return NULL;
+    }
+
+    return dict;
+}
+
+void qcow2_compression_dict_free(Qcow2CompressionDict *dict)
+{
+    if (dict) {
+        ZSTD_freeCDict(dict->cdict);
+        ZSTD_freeDDict(dict->ddict);
+        g_free(dict);
+    }
+}
+
 /*
  * qcow2_zstd_compress()
  *
@@ -180,13 +221,15 @@ static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @dict - dictionary to compress with, or NULL
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   Qcow2CompressionDict *dict)
 {
     ssize_t ret;
     size_t zstd_ret;
@@ -205,6 +248,10 @@ static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
     if (!cctx) {
         return -EIO;
     }
+    if (dict && ZSTD_isError(ZSTD_CCtx_refCDict(cctx, dict->cdict))) {
+        ret = -EIO;
+        goto out;
+    }
     /*
      * Use the zstd streamed interface for symmetry with decompression,
      * where streaming is essential since we don't record the exact
@@ -249,12 +296,14 @@ out:
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @dict - dictionary the data was compressed with, or NULL
  *
  * Returns: 0 on success
  *          -EIO on any error
  */
 static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     Qcow2CompressionDict *dict)
 {
     size_t zstd_ret = 0;
     ssize_t ret = 0;
@@ -273,6 +322,10 @@ static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
     if (!dctx) {
         return -EIO;
     }
+    if (dict && ZSTD_isError(ZSTD_DCtx_refDDict(dctx, dict->ddict))) {
+        ZSTD_freeDCtx(dctx);
+        return -EIO;
+    }
 
     /*
      * The compressed stream from the input buffer may consist of more
@@ -323,6 +376,20 @@ static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
     assert(ret == 0 || ret == -EIO);
     return ret;
 }
+
+#else /* !CONFIG_ZSTD */
+
+Qcow2CompressionDict *qcow2_compression_dict_new(const void *buf, size_t len,
+                                                 Error **errp)
+{
+    error_setg(errp, "Compression dictionaries require zstd support");
+    return NULL;
+}
+
+void qcow2_compression_dict_free(Qcow2CompressionDict *dict)
+{
+    assert(!dict);
+}
 #endif
 
 static int qcow2_compress_pool_func(void *opaque)
@@ -330,7 +397,7 @@ static int qcow2_compress_pool_func(void *opaque)
     Qcow2CompressData *data = opaque;
 
     data->ret = data->func(data->dest, data->dest_size,
-                           data->src, data->src_size);
+                           data->src, data->src_size, data->dict);
 
     return 0;
 }
@@ -339,11 +406,13 @@ static ssize_t coroutine_fn
 qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                      const void *src, size_t src_size, Qcow2CompressFunc func)
 {
+    BDRVQcow2State *s = bs->opaque;
     Qcow2CompressData arg = {
         .dest = dest,
         .dest_size = dest_size,
         .src = src,
         .src_size = src_size,
+        .dict = s->compression_dict,
         .func = func,
     };
 
@@ -380,6 +449,11 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
     case QCOW2_COMPRESSION_TYPE_ZSTD:
         fn = qcow2_zstd_compress;
         break;
+
+    case QCOW2_COMPRESSION_TYPE_ZSTD_DICT:
+        assert(s->compression_dict);
+        fn = qcow2_zstd_compress;
+        break;
 #endif
     default:
         abort();
@@ -417,6 +491,11 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
     case QCOW2_COMPRESSION_TYPE_ZSTD:
         fn = qcow2_zstd_decompress;
         break;
+
+    case QCOW2_COMPRESSION_TYPE_ZSTD_DICT:
+        assert(s->compression_dict);
+        fn = qcow2_zstd_decompress;
+        break;
 #endif
     default:
         abort();
@@ -426,6 +505,325 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
 }
 
 
+/*
+ * Decompressed cluster cache
+ *
+ * Guest requests are usually smaller than a cluster, so reading a compressed
+ * cluster sequentially would decompress it once for every request. Keep the
+ * most recently used decompressed clusters around, and when the guest reads
+ * sequentially, decompress the following compressed clusters in the
+ * background so that they are ready by the time the guest gets there. The
+ * read-ahead requests run in parallel on the thread pool.
+ *
+ * Entries are keyed by the host offset of the compressed data. Compressed
+ * data never changes while its host cluster is in use, so the cache is only
+ * invalidated when a cluster refcount drops to zero.
+ */
+
+typedef struct Qcow2DecompressedCluster {
+    uint64_t coffset;   /* host offset of the compressed data, 0 if unused */
+    uint8_t *buf;
+    uint64_t lru_counter;
+    bool loading;       /* the data is being read and decompressed */
+    CoQueue waiters;    /* requests waiting for the data to be loaded */
+} Qcow2DecompressedCluster;
+
+struct Qcow2DecompressedCache {
+    QemuMutex lock;
+    Qcow2DecompressedCluster *entries;
+    int size;
+    int readahead;
+    uint64_t lru_counter;
+    /* Incremented on invalidation, so that loads in flight are dropped */
+    uint64_t generation;
+    /* Guest cluster of the last compressed read, to detect sequential reads */
+    uint64_t last_guest_cluster;
+    /* Guest offset up to which read-ahead has been started */
+    uint64_t readahead_end;
+};
+
+typedef struct Qcow2ReadaheadCo {
+    BlockDriverState *bs;
+    uint64_t offset;
+} Qcow2ReadaheadCo;
+
+Qcow2DecompressedCache *qcow2_decompressed_cache_create(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCache *c;
+    int i;
+
+    c = g_new0(Qcow2DecompressedCache, 1);
+    c->size = MAX(1, MIN(QCOW2_DECOMPRESSED_CACHE_ENTRIES,
+                         QCOW2_DECOMPRESSED_CACHE_MAX_SIZE >> s->cluster_bits));
+    /* Don't let read-ahead evict the cluster that the guest is reading */
+    c->readahead = MIN(QCOW2_COMPRESSED_READAHEAD, c->size / 2);
+    c->entries = g_new0(Qcow2DecompressedCluster, c->size);
+    for (i = 0; i < c->size; i++) {
+        qemu_co_queue_init(&c->entries[i].waiters);
+    }
+    c->last_guest_cluster = INV_OFFSET;
+    qemu_mutex_init(&c->lock);
+
+    return c;
+}
+
+void qcow2_decompressed_cache_destroy(Qcow2DecompressedCache *c)
+{
+    int i;
+
+    if (!c) {
+        return;
+    }
+
+    for (i = 0; i < c->size; i++) {
+        assert(!c->entries[i].loading);
+        qemu_vfree(c->entries[i].buf);
+    }
+    qemu_mutex_destroy(&c->lock);
+    g_free(c->entries);
+    g_free(c);
+}
+
+/* Drops all cached clusters, must be called when host clusters are freed */
+void qcow2_decompressed_cache_invalidate(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCache *c = s->decompressed_cache;
+    int i;
+
+    if (!c) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&c->lock);
+    c->generation++;
+    for (i = 0; i < c->size; i++) {
+        if (!c->entries[i].loading) {
+            c->entries[i].coffset = 0;
+        }
+    }
+}
+
+/* Called with c->lock held */
+static Qcow2DecompressedCluster *
+qcow2_decompressed_cache_find(Qcow2DecompressedCache *c, uint64_t coffset)
+{
+    int i;
+
+    for (i = 0; i < c->size; i++) {
+        if (c->entries[i].coffset == coffset) {
+            return &c->entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Called with c->lock held, returns NULL if all entries are being loaded */
+static Qcow2DecompressedCluster *
+qcow2_decompressed_cache_evict(Qcow2DecompressedCache *c)
+{
+    Qcow2DecompressedCluster *victim = NULL;
+    int i;
+
+    for (i = 0; i < c->size; i++) {
+        Qcow2DecompressedCluster *e = &c->entries[i];
+        if (!e->loading &&
+            (!victim || e->lru_counter < victim->lru_counter)) {
+            victim = e;
+        }
+    }
+    return victim;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_load_compressed(BlockDriverState *bs, uint64_t coffset, int csize,
+                         uint8_t *out_buf)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree uint8_t *buf = NULL;
+    int ret;
+
+    buf = g_try_malloc(csize);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*
+ * Copies @bytes bytes at @offset_in_cluster of the compressed cluster
+ * described by @l2_entry into @qiov, going through the decompressed cluster
+ * cache.  If @qiov is NULL, only makes sure that the cluster is cached (or
+ * being loaded) without waiting for other requests.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_get_decompressed(BlockDriverState *bs, uint64_t l2_entry,
+                          int offset_in_cluster, uint64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCache *c = s->decompressed_cache;
+    Qcow2DecompressedCluster *e;
+    uint64_t coffset, generation;
+    uint8_t *buf;
+    int csize;
+    int ret;
+
+    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+
+    qemu_mutex_lock(&c->lock);
+    while ((e = qcow2_decompressed_cache_find(c, coffset))) {
+        if (!e->loading) {
+            e->lru_counter = ++c->lru_counter;
+            if (qiov) {
+                qemu_iovec_from_buf(qiov, qiov_offset,
+                                    e->buf + offset_in_cluster, bytes);
+            }
+            qemu_mutex_unlock(&c->lock);
+            return 0;
+        }
+        if (!qiov) {
+            qemu_mutex_unlock(&c->lock);
+            return 0;
+        }
+        qemu_co_queue_wait(&e->waiters, &c->lock);
+    }
+
+    e = qcow2_decompressed_cache_evict(c);
+    if (e) {
+        e->coffset = coffset;
+        e->loading = true;
+    }
+    generation = c->generation;
+    qemu_mutex_unlock(&c->lock);
+
+    buf = qemu_try_blockalign(bs, s->cluster_size);
+    if (!buf) {
+        ret = -ENOMEM;
+    } else {
+        ret = qcow2_co_load_compressed(bs, coffset, csize, buf);
+    }
+    if (ret == 0 && qiov) {
+        qemu_iovec_from_buf(qiov, qiov_offset, buf + offset_in_cluster, bytes);
+    }
+
+    if (e) {
+        qemu_mutex_lock(&c->lock);
+        if (ret == 0 && generation == c->generation) {
+            uint8_t *old_buf = e->buf;
+            e->buf = buf;
+            buf = old_buf;
+            e->lru_counter = ++c->lru_counter;
+        } else {
+            e->coffset = 0;
+        }
+        e->loading = false;
+        qemu_co_enter_all(&e->waiters, &c->lock);
+        qemu_mutex_unlock(&c->lock);
+    }
+
+    qemu_vfree(buf);
+    return ret;
+}
+
+static void coroutine_fn qcow2_co_readahead_entry(void *opaque)
+{
+    Qcow2ReadaheadCo *rco = opaque;
+    BlockDriverState *bs = rco->bs;
+    BDRVQcow2State *s = bs->opaque;
+    QCow2SubclusterType type;
+    unsigned int bytes = s->cluster_size;
+    uint64_t l2_entry;
+    int ret;
+
+    bdrv_graph_co_rdlock();
+
+    qemu_co_mutex_lock(&s->lock);
+    ret = qcow2_get_host_offset(bs, rco->offset, &bytes, &l2_entry, &type);
+    qemu_co_mutex_unlock(&s->lock);
+
+    /* Errors are ignored, the guest will see them when it gets there */
+    if (ret == 0 && type == QCOW2_SUBCLUSTER_COMPRESSED) {
+        qcow2_co_get_decompressed(bs, l2_entry, 0, 0, NULL, 0);
+    }
+
+    bdrv_graph_co_rdunlock();
+    bdrv_dec_in_flight(bs);
+    g_free(rco);
+}
+
+/* Starts read-ahead if @guest_cluster continues a sequential read */
+static void coroutine_fn
+qcow2_decompressed_cache_readahead(BlockDriverState *bs, uint64_t guest_cluster)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCache *c = s->decompressed_cache;
+    uint64_t start, end, offset;
+
+    qemu_mutex_lock(&c->lock);
+    if (c->last_guest_cluster == INV_OFFSET ||
+        (guest_cluster != c->last_guest_cluster &&
+         guest_cluster != c->last_guest_cluster + s->cluster_size)) {
+        /* Random access, don't waste memory and CPU */
+        c->last_guest_cluster = guest_cluster;
+        c->readahead_end = 0;
+        qemu_mutex_unlock(&c->lock);
+        return;
+    }
+
+    c->last_guest_cluster = guest_cluster;
+    start = MAX(c->readahead_end, guest_cluster + s->cluster_size);
+    end = MIN(guest_cluster + ((uint64_t) c->readahead + 1) * s->cluster_size,
+              bs->total_sectors * BDRV_SECTOR_SIZE);
+    if (start < end) {
+        c->readahead_end = end;
+    }
+    qemu_mutex_unlock(&c->lock);
+
+    for (offset = start; offset < end; offset += s->cluster_size) {
+        Qcow2ReadaheadCo *rco = g_new(Qcow2ReadaheadCo, 1);
+        Coroutine *co;
+
+        *rco = (Qcow2ReadaheadCo) {
+            .bs = bs,
+            .offset = offset,
+        };
+        bdrv_inc_in_flight(bs);
+        co = qemu_coroutine_create(qcow2_co_readahead_entry, rco);
+        aio_co_enter(bdrv_get_aio_context(bs), co);
+    }
+}
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_compressed(BlockDriverState *bs, uint64_t l2_entry,
+                           uint64_t offset, uint64_t bytes,
+                           QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t guest_cluster = start_of_cluster(s, offset);
+
+    if (s->decompressed_cache->readahead) {
+        qcow2_decompressed_cache_readahead(bs, guest_cluster);
+    }
+
+    return qcow2_co_get_decompressed(bs, l2_entry,
+                                     offset_into_cluster(s, offset), bytes,
+                                     qiov, qiov_offset);
+}
+
+
 /*
  * Cryptography
  */
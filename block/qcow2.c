@@ -73,14 +73,7 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
 #define  QCOW2_EXT_MAGIC_DATA_FILE 0x44415441
-
-static int coroutine_fn
-qcow2_co_preadv_compressed(BlockDriverState *bs,
-                           uint64_t l2_entry,
-                           uint64_t offset,
-                           uint64_t bytes,
-                           QEMUIOVector *qiov,
-                           size_t qiov_offset);
+#define  QCOW2_EXT_MAGIC_COMPRESSION_DICT 0x7a646963
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -432,6 +425,68 @@ qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             break;
         }
 
+        case QCOW2_EXT_MAGIC_COMPRESSION_DICT:
+        {
+            Qcow2CompressionDictExtension *dict_ext = &s->compression_dict_ext;
+            g_autofree void *dict_buf = NULL;
+
+            if (s->compression_type != QCOW2_COMPRESSION_TYPE_ZSTD_DICT) {
+                error_setg(errp, "Compression dictionary header extension "
+                           "only expected with zstd-dict compression type");
+                return -EINVAL;
+            }
+            if (ext.len != sizeof(*dict_ext)) {
+                error_setg(errp, "Compression dictionary header extension "
+                           "size %u, but expected size %zu", ext.len,
+                           sizeof(*dict_ext));
+                return -EINVAL;
+            }
+
+            ret = bdrv_co_pread(bs->file, offset, ext.len, dict_ext, 0);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "Unable to read compression "
+                                 "dictionary header extension");
+                return ret;
+            }
+            dict_ext->offset = be64_to_cpu(dict_ext->offset);
+            dict_ext->length = be64_to_cpu(dict_ext->length);
+
+            if (!dict_ext->length ||
+                dict_ext->length > QCOW2_MAX_COMPRESSION_DICT_SIZE) {
+                error_setg(errp, "Compression dictionary size %" PRIu64
+                           " is invalid", dict_ext->length);
+                return -EINVAL;
+            }
+            if (offset_into_cluster(s, dict_ext->offset)) {
+                error_setg(errp, "Compression dictionary offset '%" PRIu64
+                           "' is not a multiple of cluster size '%u'",
+                           dict_ext->offset, s->cluster_size);
+                return -EINVAL;
+            }
+
+            if (flags & BDRV_O_NO_IO) {
+                break;
+            }
+
+            dict_buf = g_malloc(dict_ext->length);
+            ret = bdrv_co_pread(bs->file, dict_ext->offset, dict_ext->length,
+                                dict_buf, 0);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "Could not read compression "
+                                 "dictionary");
+                return ret;
+            }
+
+            qcow2_compression_dict_free(s->compression_dict);
+            s->compression_dict = qcow2_compression_dict_new(dict_buf,
+                                                             dict_ext->length,
+                                                             errp);
+            if (!s->compression_dict) {
+                return -EINVAL;
+            }
+            break;
+        }
+
         default:
             /* unknown magic - save it in case we need to rewrite the header */
             /* If you add a new feature, make sure to also update the fast
@@ -614,6 +669,9 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
     memset(result, 0, sizeof(*result));
 
+    /* Reserved clusters would show up as leaks */
+    qcow2_release_reserved_clusters(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -621,6 +679,13 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
     }
 
     ret = qcow2_check_refcounts(bs, &refcount_res, fix);
+    if (fix) {
+        /*
+         * Repairing may have freed clusters behind update_refcount()'s
+         * back, even if it failed half-way
+         */
+        qcow2_decompressed_cache_invalidate(bs);
+    }
     qcow2_add_check_result(result, &refcount_res, true);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -696,11 +761,14 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_OVERLAP_INACTIVE_L1,
     QCOW2_OPT_OVERLAP_INACTIVE_L2,
     QCOW2_OPT_OVERLAP_BITMAP_DIRECTORY,
+    QCOW2_OPT_OVERLAP_COMPRESSION_DICT,
     QCOW2_OPT_CACHE_SIZE,
     QCOW2_OPT_L2_CACHE_SIZE,
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_ALLOC_BATCH_SIZE,
+    QCOW2_OPT_WORKER_THREADS,
     NULL
 };
 
@@ -791,6 +859,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "Check for unintended writes into the bitmap directory",
         },
+        {
+            .name = QCOW2_OPT_OVERLAP_COMPRESSION_DICT,
+            .type = QEMU_OPT_BOOL,
+            .help = "Check for unintended writes into the compression "
+                    "dictionary",
+        },
         {
             .name = QCOW2_OPT_CACHE_SIZE,
             .type = QEMU_OPT_SIZE,
@@ -817,6 +891,18 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_BATCH_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Allocate host clusters for guest data in batches of "
+                    "this size (0 disables batching)",
+        },
+        {
+            .name = QCOW2_OPT_WORKER_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of threads that compress, decompress, "
+                    "encrypt or decrypt data for this image in parallel",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -833,6 +919,7 @@ static const char *overlap_bool_option_names[QCOW2_OL_MAX_BITNR] = {
     [QCOW2_OL_INACTIVE_L1_BITNR]      = QCOW2_OPT_OVERLAP_INACTIVE_L1,
     [QCOW2_OL_INACTIVE_L2_BITNR]      = QCOW2_OPT_OVERLAP_INACTIVE_L2,
     [QCOW2_OL_BITMAP_DIRECTORY_BITNR] = QCOW2_OPT_OVERLAP_BITMAP_DIRECTORY,
+    [QCOW2_OL_COMPRESSION_DICT_BITNR] = QCOW2_OPT_OVERLAP_COMPRESSION_DICT,
 };
 
 static void cache_clean_timer_cb(void *opaque)
@@ -979,6 +1066,8 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t alloc_batch_clusters;
+    int max_threads;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -991,6 +1080,8 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t alloc_batch_size;
+    uint64_t worker_threads;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1079,6 +1170,26 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    /* Batched allocation of data clusters */
+    alloc_batch_size = qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_BATCH_SIZE, 0);
+    if (alloc_batch_size > BDRV_REQUEST_MAX_BYTES) {
+        error_setg(errp, QCOW2_OPT_ALLOC_BATCH_SIZE " must not exceed %"
+                   PRIu64, (uint64_t) BDRV_REQUEST_MAX_BYTES);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->alloc_batch_clusters = alloc_batch_size >> s->cluster_bits;
+
+    worker_threads = qemu_opt_get_number(opts, QCOW2_OPT_WORKER_THREADS,
+                                         QCOW2_DEFAULT_WORKER_THREADS);
+    if (worker_threads < 1 || worker_threads > QCOW2_MAX_WORKER_THREADS) {
+        error_setg(errp, QCOW2_OPT_WORKER_THREADS " must be between 1 and %d",
+                   QCOW2_MAX_WORKER_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->max_threads = worker_threads;
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1245,6 +1356,9 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    s->alloc_batch_clusters = r->alloc_batch_clusters;
+    s->max_threads = r->max_threads;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1284,6 +1398,7 @@ static int validate_compression_type(BDRVQcow2State *s, Error **errp)
     case QCOW2_COMPRESSION_TYPE_ZLIB:
 #ifdef CONFIG_ZSTD
     case QCOW2_COMPRESSION_TYPE_ZSTD:
+    case QCOW2_COMPRESSION_TYPE_ZSTD_DICT:
 #endif
         break;
 
@@ -1636,6 +1751,13 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
+    if (s->compression_type == QCOW2_COMPRESSION_TYPE_ZSTD_DICT &&
+        !s->compression_dict_ext.length) {
+        error_setg(errp, "Missing compression dictionary header extension");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     if (open_data_file && (flags & BDRV_O_NO_IO)) {
         /*
          * Don't open the data file for 'qemu-img info' so that it can be used
@@ -1888,6 +2010,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    s->decompressed_cache = qcow2_decompressed_cache_create(bs);
 
     return ret;
 
@@ -1915,6 +2038,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     }
     qcrypto_block_free(s->crypto);
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
+    qcow2_compression_dict_free(s->compression_dict);
+    s->compression_dict = NULL;
     return ret;
 }
 
@@ -2770,6 +2895,8 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    qcow2_release_reserved_clusters(bs);
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2806,10 +2933,14 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_decompressed_cache_destroy(s->decompressed_cache);
+    s->decompressed_cache = NULL;
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
+    qcow2_compression_dict_free(s->compression_dict);
+    s->compression_dict = NULL;
 
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
@@ -3046,6 +3177,22 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /* Compression dictionary */
+    if (s->compression_dict_ext.offset != 0) {
+        Qcow2CompressionDictExtension dict_ext = {
+            .offset = cpu_to_be64(s->compression_dict_ext.offset),
+            .length = cpu_to_be64(s->compression_dict_ext.length),
+        };
+
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_COMPRESSION_DICT,
+                             &dict_ext, sizeof(dict_ext), buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
     /*
      * Feature table.  A mere 8 feature names occupies 392 bytes, and
      * when coupled with the v3 minimum header of 104 bytes plus the
@@ -3247,6 +3394,62 @@ qcow2_set_up_encryption(BlockDriverState *bs,
     return ret;
 }
 
+/*
+ * Store the zstd dictionary @buf of @len bytes in the image and switch the
+ * image to the zstd-dict compression type.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_set_up_compression_dict(BlockDriverState *bs, const void *buf,
+                              size_t len, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressionDict *dict;
+    int64_t offset;
+    int ret;
+
+    dict = qcow2_compression_dict_new(buf, len, errp);
+    if (!dict) {
+        return -EINVAL;
+    }
+
+    offset = qcow2_alloc_clusters(bs, len);
+    if (offset < 0) {
+        error_setg_errno(errp, -offset, "Cannot allocate clusters for the "
+                         "compression dictionary");
+        ret = offset;
+        goto fail;
+    }
+
+    ret = qcow2_pre_write_overlap_check(bs, 0, offset, len, false);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write compression dictionary");
+        goto fail;
+    }
+
+    ret = bdrv_co_pwrite(bs->file, offset, len, buf, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write compression dictionary");
+        goto fail;
+    }
+
+    s->compression_dict_ext.offset = offset;
+    s->compression_dict_ext.length = len;
+    s->compression_type = QCOW2_COMPRESSION_TYPE_ZSTD_DICT;
+    s->compression_dict = dict;
+
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not update qcow2 header");
+        return ret;
+    }
+
+    return 0;
+
+fail:
+    qcow2_compression_dict_free(dict);
+    return ret;
+}
+
 /**
  * Preallocates metadata structures for data clusters between @offset (in the
  * guest disk) and @new_length (which is thus generally the new guest disk
@@ -3523,6 +3726,8 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
     uint64_t *refcount_table;
     int ret;
     uint8_t compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
+    g_autofree char *compression_dict = NULL;
+    gsize compression_dict_len = 0;
 
     assert(create_options->driver == BLOCKDEV_DRIVER_QCOW2);
     qcow2_opts = &create_options->u.qcow2;
@@ -3692,6 +3897,13 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
 #ifdef CONFIG_ZSTD
         case QCOW2_COMPRESSION_TYPE_ZSTD:
             break;
+        case QCOW2_COMPRESSION_TYPE_ZSTD_DICT:
+            if (!qcow2_opts->compression_dictionary) {
+                error_setg(errp, "Compression type 'zstd-dict' requires a "
+                           "compression dictionary");
+                goto out;
+            }
+            break;
 #endif
         default:
             error_setg(errp, "Unknown compression type");
@@ -3701,6 +3913,41 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         compression_type = qcow2_opts->compression_type;
     }
 
+    if (qcow2_opts->compression_dictionary) {
+        GError *gerr = NULL;
+
+        if (compression_type != QCOW2_COMPRESSION_TYPE_ZSTD_DICT) {
+            error_setg(errp, "A compression dictionary can only be used with "
+                       "compression type 'zstd-dict'");
+            ret = -EINVAL;
+            goto out;
+        }
+
+        if (!g_file_get_contents(qcow2_opts->compression_dictionary,
+                                 &compression_dict, &compression_dict_len,
+                                 &gerr)) {
+            error_setg(errp, "Could not read compression dictionary: %s",
+                       gerr->message);
+            g_error_free(gerr);
+            ret = -EIO;
+            goto out;
+        }
+        if (!compression_dict_len ||
+            compression_dict_len > QCOW2_MAX_COMPRESSION_DICT_SIZE) {
+            error_setg(errp, "Compression dictionary must be between 1 byte "
+                       "and %d MiB in size",
+                       QCOW2_MAX_COMPRESSION_DICT_SIZE / MiB);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        /*
+         * The dictionary is only stored after the image has been opened, so
+         * until then, pretend to use plain zstd
+         */
+        compression_type = QCOW2_COMPRESSION_TYPE_ZSTD;
+    }
+
     /* Create BlockBackend to write to the image */
     blk = blk_co_new_with_bs(bs, BLK_PERM_WRITE | BLK_PERM_RESIZE, BLK_PERM_ALL,
                              errp);
@@ -3861,6 +4108,18 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         }
     }
 
+    /* Store the compression dictionary */
+    if (compression_dict) {
+        bdrv_graph_co_rdlock();
+        ret = qcow2_set_up_compression_dict(blk_bs(blk), compression_dict,
+                                            compression_dict_len, errp);
+        bdrv_graph_co_rdunlock();
+
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
     blk_co_unref(blk);
     blk = NULL;
 
@@ -3945,6 +4204,7 @@ qcow2_co_create_opts(BlockDriver *drv, const char *filename, QemuOpts *opts,
         { BLOCK_OPT_COMPAT_LEVEL,       "version" },
         { BLOCK_OPT_DATA_FILE_RAW,      "data-file-raw" },
         { BLOCK_OPT_COMPRESSION_TYPE,   "compression-type" },
+        { BLOCK_OPT_COMPRESSION_DICT,   "compression-dictionary" },
         { NULL, NULL },
     };
 
@@ -4132,6 +4392,14 @@ qcow2_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
          * complete partial cluster at the end of an unaligned file */
         if (!QEMU_IS_ALIGNED(offset, s->cluster_size) ||
             offset + bytes != bs->total_sectors * BDRV_SECTOR_SIZE) {
+            /* With extended L2 entries, whole subclusters can be discarded */
+            if (has_subclusters(s) &&
+                QEMU_IS_ALIGNED(offset | bytes, s->subcluster_size)) {
+                qemu_co_mutex_lock(&s->lock);
+                ret = qcow2_subcluster_discard(bs, offset, bytes);
+                qemu_co_mutex_unlock(&s->lock);
+                return ret;
+            }
             return -ENOTSUP;
         }
     }
@@ -4321,6 +4589,9 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* Don't let reserved clusters keep the image file from shrinking */
+    qcow2_release_reserved_clusters(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4818,49 +5089,6 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
-static int coroutine_fn GRAPH_RDLOCK
-qcow2_co_preadv_compressed(BlockDriverState *bs,
-                           uint64_t l2_entry,
-                           uint64_t offset,
-                           uint64_t bytes,
-                           QEMUIOVector *qiov,
-                           size_t qiov_offset)
-{
-    BDRVQcow2State *s = bs->opaque;
-    int ret = 0, csize;
-    uint64_t coffset;
-    uint8_t *buf, *out_buf;
-    int offset_in_cluster = offset_into_cluster(s, offset);
-
-    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
-
-    buf = g_try_malloc(csize);
-    if (!buf) {
-        return -ENOMEM;
-    }
-
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
-    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
-    if (ret < 0) {
-        goto fail;
-    }
-
-    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
-        ret = -EIO;
-        goto fail;
-    }
-
-    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
-
-fail:
-    qemu_vfree(out_buf);
-    g_free(buf);
-
-    return ret;
-}
-
 static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -4891,6 +5119,12 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
         goto fail;
     }
 
+    /*
+     * All host clusters are about to be freed without going through
+     * update_refcount(), and will be reused for new data
+     */
+    qcow2_decompressed_cache_invalidate(bs);
+
     BLKDBG_EVENT(bs->file, BLKDBG_L1_UPDATE);
 
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
@@ -5021,19 +5255,22 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
 
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
+    qcow2_release_reserved_clusters(bs);
+
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
         3 + l1_clusters <= s->refcount_block_size &&
         s->crypt_method_header != QCOW_CRYPT_LUKS &&
+        !s->compression_dict_ext.length &&
         !has_data_file(bs)) {
         /* The following function only works for qcow2 v3 images (it
          * requires the dirty flag) and only as long as there are no
          * features that reserve extra clusters (such as snapshots,
-         * LUKS header, or persistent bitmaps), because it completely
-         * empties the image.  Furthermore, the L1 table and three
-         * additional clusters (image header, refcount table, one
-         * refcount block) have to fit inside one refcount block. It
-         * only resets the image file, i.e. does not work with an
-         * external data file. */
+         * LUKS header, compression dictionary, or persistent bitmaps),
+         * because it completely empties the image.  Furthermore, the L1
+         * table and three additional clusters (image header, refcount
+         * table, one refcount block) have to fit inside one refcount
+         * block. It only resets the image file, i.e. does not work with
+         * an external data file. */
         return make_completely_empty(bs);
     }
 
@@ -5503,6 +5740,12 @@ qcow2_downgrade(BlockDriverState *bs, int target_version,
         return -ENOTSUP;
     }
 
+    if (s->compression_type == QCOW2_COMPRESSION_TYPE_ZSTD_DICT) {
+        error_setg(errp, "Cannot downgrade an image with a compression "
+                   "dictionary");
+        return -ENOTSUP;
+    }
+
     /* since we can ignore compatible features, we can set them to 0 as well */
     s->compatible_features = 0;
     /* if lazy refcounts have been used, they have already been fixed through
@@ -6113,6 +6356,12 @@ static QemuOptsList qcow2_create_opts = {
             .help = "Compression method used for image cluster "        \
                     "compression",                                      \
             .def_value_str = "zlib"                                     \
+        },                                                              \
+        {                                                               \
+            .name = BLOCK_OPT_COMPRESSION_DICT,                         \
+            .type = QEMU_OPT_STRING,                                    \
+            .help = "File name of a zstd dictionary used with the "     \
+                    "zstd-dict compression type",                       \
         },
         QCOW_COMMON_OPTIONS,
         { /* end of list */ }
@@ -57,6 +57,9 @@
  * (128 GB for 512 byte clusters, 2 EB for 2 MB clusters) */
 #define QCOW_MAX_L1_SIZE (32 * MiB)
 
+/* Maximum size of a zstd compression dictionary */
+#define QCOW2_MAX_COMPRESSION_DICT_SIZE (8 * MiB)
+
 /* Allow for an average of 1k per snapshot table entry, should be plenty of
  * space for snapshot names and IDs */
 #define QCOW_MAX_SNAPSHOTS_SIZE (1024 * QCOW_MAX_SNAPSHOTS)
@@ -145,11 +148,14 @@
 #define QCOW2_OPT_OVERLAP_INACTIVE_L1 "overlap-check.inactive-l1"
 #define QCOW2_OPT_OVERLAP_INACTIVE_L2 "overlap-check.inactive-l2"
 #define QCOW2_OPT_OVERLAP_BITMAP_DIRECTORY "overlap-check.bitmap-directory"
+#define QCOW2_OPT_OVERLAP_COMPRESSION_DICT "overlap-check.compression-dictionary"
 #define QCOW2_OPT_CACHE_SIZE "cache-size"
 #define QCOW2_OPT_L2_CACHE_SIZE "l2-cache-size"
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_BATCH_SIZE "alloc-batch-size"
+#define QCOW2_OPT_WORKER_THREADS "worker-threads"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -236,6 +242,11 @@ typedef struct Qcow2CryptoHeaderExtension {
     uint64_t length;
 } QEMU_PACKED Qcow2CryptoHeaderExtension;
 
+typedef struct Qcow2CompressionDictExtension {
+    uint64_t offset;
+    uint64_t length;
+} QEMU_PACKED Qcow2CompressionDictExtension;
+
 typedef struct Qcow2UnknownHeaderExtension {
     uint32_t magic;
     uint32_t len;
@@ -322,7 +333,20 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/*
+ * Number of thread pool workers that a single image may keep busy with
+ * compression and encryption (see qcow2-threads.c)
+ */
+#define QCOW2_DEFAULT_WORKER_THREADS 4
+#define QCOW2_MAX_WORKER_THREADS 64
+
+/* Decompressed cluster cache, see qcow2-threads.c */
+#define QCOW2_DECOMPRESSED_CACHE_ENTRIES 16
+#define QCOW2_DECOMPRESSED_CACHE_MAX_SIZE (4 * MiB)
+#define QCOW2_COMPRESSED_READAHEAD 4 /* clusters */
+
+typedef struct Qcow2DecompressedCache Qcow2DecompressedCache;
+typedef struct Qcow2CompressionDict Qcow2CompressionDict;
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -357,6 +381,15 @@ typedef struct BDRVQcow2State {
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
 
+    /*
+     * Host clusters that have been allocated for guest data ahead of time
+     * (see qcow2_alloc_data_clusters()), but are not referenced by any L2
+     * entry yet
+     */
+    uint64_t alloc_batch_clusters;
+    uint64_t reserved_offset;
+    uint64_t reserved_clusters;
+
     CoMutex lock;
 
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
@@ -410,6 +443,9 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
+
+    Qcow2DecompressedCache *decompressed_cache;
 
     BdrvChild *data_file;
 
@@ -422,6 +458,14 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+
+    /*
+     * Dictionary for QCOW2_COMPRESSION_TYPE_ZSTD_DICT: location in the image
+     * file, and the digested form used by the compression threads (NULL if
+     * the image was opened with BDRV_O_NO_IO)
+     */
+    Qcow2CompressionDictExtension compression_dict_ext;
+    Qcow2CompressionDict *compression_dict;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -474,6 +518,15 @@ typedef struct QCowL2Meta
      */
     Qcow2COWRegion cow_end;
 
+    /**
+     * Subclusters of @cow_start (in the first cluster) and of @cow_end (in
+     * the last cluster) that are unallocated or read as zeroes in the old
+     * cluster. Their data is not copied, and they keep their state in the
+     * L2 bitmap of the new cluster.
+     */
+    uint32_t cow_start_skip;
+    uint32_t cow_end_skip;
+
     /*
      * Indicates that COW regions are already handled and do not require
      * any more processing.
@@ -557,8 +610,9 @@ typedef enum QCow2MetadataOverlap {
     QCOW2_OL_INACTIVE_L1_BITNR      = 6,
     QCOW2_OL_INACTIVE_L2_BITNR      = 7,
     QCOW2_OL_BITMAP_DIRECTORY_BITNR = 8,
+    QCOW2_OL_COMPRESSION_DICT_BITNR = 9,
 
-    QCOW2_OL_MAX_BITNR              = 9,
+    QCOW2_OL_MAX_BITNR              = 10,
 
     QCOW2_OL_NONE             = 0,
     QCOW2_OL_MAIN_HEADER      = (1 << QCOW2_OL_MAIN_HEADER_BITNR),
@@ -572,12 +626,14 @@ typedef enum QCow2MetadataOverlap {
      * reads. */
     QCOW2_OL_INACTIVE_L2      = (1 << QCOW2_OL_INACTIVE_L2_BITNR),
     QCOW2_OL_BITMAP_DIRECTORY = (1 << QCOW2_OL_BITMAP_DIRECTORY_BITNR),
+    QCOW2_OL_COMPRESSION_DICT = (1 << QCOW2_OL_COMPRESSION_DICT_BITNR),
 } QCow2MetadataOverlap;
 
 /* Perform all overlap checks which can be done in constant time */
 #define QCOW2_OL_CONSTANT \
     (QCOW2_OL_MAIN_HEADER | QCOW2_OL_ACTIVE_L1 | QCOW2_OL_REFCOUNT_TABLE | \
-     QCOW2_OL_SNAPSHOT_TABLE | QCOW2_OL_BITMAP_DIRECTORY)
+     QCOW2_OL_SNAPSHOT_TABLE | QCOW2_OL_BITMAP_DIRECTORY | \
+     QCOW2_OL_COMPRESSION_DICT)
 
 /* Perform all overlap checks which don't require disk access */
 #define QCOW2_OL_CACHED \
@@ -873,6 +929,11 @@ int64_t GRAPH_RDLOCK coroutine_fn
 qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
+int64_t GRAPH_RDLOCK coroutine_fn
+qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t offset,
+                          uint64_t *nb_clusters);
+void GRAPH_RDLOCK qcow2_release_reserved_clusters(BlockDriverState *bs);
+
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
@@ -957,6 +1018,9 @@ qcow2_cluster_discard(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 int coroutine_fn GRAPH_RDLOCK
 qcow2_subcluster_zeroize(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                          int flags);
+int coroutine_fn GRAPH_RDLOCK
+qcow2_subcluster_discard(BlockDriverState *bs, uint64_t offset,
+                         uint64_t bytes);
 
 int GRAPH_RDLOCK
 qcow2_expand_zero_clusters(BlockDriverState *bs,
@@ -1064,6 +1128,18 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
 ssize_t coroutine_fn
 qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size);
+
+Qcow2DecompressedCache *qcow2_decompressed_cache_create(BlockDriverState *bs);
+void qcow2_decompressed_cache_destroy(Qcow2DecompressedCache *c);
+void qcow2_decompressed_cache_invalidate(BlockDriverState *bs);
+Qcow2CompressionDict *qcow2_compression_dict_new(const void *buf, size_t len,
+                                                 Error **errp);
+void qcow2_compression_dict_free(Qcow2CompressionDict *dict);
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_compressed(BlockDriverState *bs, uint64_t l2_entry,
+                           uint64_t offset, uint64_t bytes,
+                           QEMUIOVector *qiov, size_t qiov_offset);
+
 int coroutine_fn
 qcow2_co_encrypt(BlockDriverState *bs, uint64_t host_offset,
                  uint64_t guest_offset, void *buf, size_t len);
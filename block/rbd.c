@@ -104,6 +104,7 @@ typedef struct BDRVRBDState {
 typedef struct RBDTask {
     BlockDriverState *bs;
     Coroutine *co;
+    AioContext *ctx; /* where @co runs */
     bool complete;
     int64_t ret;
 } RBDTask;
@@ -1264,13 +1265,17 @@ static void qemu_rbd_finish_bh(void *opaque)
  * we need to be careful about what we do here. Generally we only
  * schedule a BH, and do the rest of the io completion handling
  * from qemu_rbd_finish_bh() which runs in a qemu context.
+ *
+ * The BH runs in the AioContext of the request coroutine rather than the
+ * BDS's, so requests from other iothreads of a multiqueue device are
+ * woken without a second hop, and task->complete is only ever accessed
+ * from the coroutine's thread.
  */
 static void qemu_rbd_completion_cb(rbd_completion_t c, RBDTask *task)
 {
     task->ret = rbd_aio_get_return_value(c);
     rbd_aio_release(c);
-    aio_bh_schedule_oneshot(bdrv_get_aio_context(task->bs),
-                            qemu_rbd_finish_bh, task);
+    aio_bh_schedule_oneshot(task->ctx, qemu_rbd_finish_bh, task);
 }
 
 static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
@@ -1281,7 +1286,11 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
                                           RBDAIOCmd cmd)
 {
     BDRVRBDState *s = bs->opaque;
-    RBDTask task = { .bs = bs, .co = qemu_coroutine_self() };
+    RBDTask task = {
+        .bs = bs,
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
+    };
     rbd_completion_t c;
     int r;
 
@@ -0,0 +1,573 @@
+/*
+ * Read cache filter block driver
+ *
+ * Caches the data read from its child in a file that can be shared by many
+ * QEMU processes on one host, e.g. on hugetlbfs or tmpfs, or on a local
+ * disk.  VMs booting from the same slow or remote base image then read
+ * each part of it over the network only once.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/file.h>
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "qemu/memalign.h"
+#include "qemu/mmap-alloc.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "qemu/xxhash.h"
+#include "trace.h"
+
+#define READ_CACHE_MAGIC "QEMURDCA"
+#define READ_CACHE_VERSION 1
+#define READ_CACHE_CLUSTER_SIZE (64 * KiB)
+
+/* Missing clusters are read from the child in requests of up to 1 MB */
+#define READ_CACHE_MAX_READ (1 * MiB)
+
+/*
+ * The cache file is mapped shared by all processes using it:
+ *
+ *   ReadCacheHeader | ReadCacheSlot[nslots] | padding | cluster data[nslots]
+ *
+ * It is a direct-mapped cache, each slot holds one cluster of one image.
+ * A slot's sequence counter is odd while the slot is rewritten.  Writers
+ * take it with a compare-and-swap and give up if they lose; readers check
+ * it again after copying the data out.  So processes never wait for each
+ * other, and a lost race only costs a read from the child.
+ *
+ * A process that dies while rewriting a slot leaves it odd.  Every user
+ * holds a shared flock() on the file, so whoever opens it while nobody
+ * else does resets such slots, see read_cache_recover().
+ */
+typedef struct ReadCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t cluster_size;
+    uint64_t nslots;
+    uint64_t data_offset;
+} ReadCacheHeader;
+
+typedef struct ReadCacheSlot {
+    uint32_t seq;
+    uint32_t reserved;
+    uint64_t id;
+    uint64_t cluster;       /* cluster index + 1, 0 if the slot is empty */
+} ReadCacheSlot;
+
+typedef struct BDRVReadCacheState {
+    int fd;
+    void *map;
+    size_t map_size;
+    ReadCacheSlot *slots;
+    uint8_t *data;
+    uint64_t nslots;
+
+    /*
+     * Identifies the child's content in the shared cache, see
+     * read_cache_image_id()
+     */
+    uint64_t id;
+} BDRVReadCacheState;
+
+#define READ_CACHE_OPT_FILE "cache-file"
+#define READ_CACHE_OPT_SIZE "cache-size"
+#define READ_CACHE_OPT_ID "cache-id"
+static QemuOptsList runtime_opts = {
+    .name = "read-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = READ_CACHE_OPT_FILE,
+            .type = QEMU_OPT_STRING,
+            .help = "path of the (shared) cache file",
+        },
+        {
+            .name = READ_CACHE_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "size of a newly created cache file, default 1G",
+        },
+        {
+            .name = READ_CACHE_OPT_ID,
+            .type = QEMU_OPT_STRING,
+            .help = "identifies the cached image, default is its filename",
+        },
+        { /* end of list */ }
+    },
+};
+
+/* FNV-1a */
+static uint64_t read_cache_hash(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    for (; len; len--, p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * The cache file outlives the node, and the image may be rewritten or
+ * replaced by another one at the same path in the meantime.  So besides
+ * @id, the length of @child and, if the image is a local file in the end,
+ * that file's inode and modification time identify the cached data.
+ *
+ * Never returns 0, so that empty slots cannot match.
+ */
+static uint64_t GRAPH_RDLOCK
+read_cache_image_id(BlockDriverState *child, const char *id, Error **errp)
+{
+    BlockDriverState *leaf = child;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int64_t len;
+
+    hash = read_cache_hash(hash, id, strlen(id));
+
+    len = bdrv_getlength(child);
+    if (len < 0) {
+        error_setg_errno(errp, -len, "Could not get the image length");
+        return 0;
+    }
+    hash = read_cache_hash(hash, &len, sizeof(len));
+
+    while (leaf->file) {
+        leaf = leaf->file->bs;
+    }
+    if (!strcmp(leaf->drv->format_name, "file") ||
+        !strcmp(leaf->drv->format_name, "host_device")) {
+        struct stat st;
+        struct timespec mtime;
+
+        if (stat(leaf->filename, &st) < 0) {
+            error_setg_errno(errp, errno, "Could not stat '%s'",
+                             leaf->filename);
+            return 0;
+        }
+#ifdef CONFIG_DARWIN
+        mtime = st.st_mtimespec;
+#else
+        mtime = st.st_mtim;
+#endif
+        hash = read_cache_hash(hash, &st.st_dev, sizeof(st.st_dev));
+        hash = read_cache_hash(hash, &st.st_ino, sizeof(st.st_ino));
+        hash = read_cache_hash(hash, &mtime.tv_sec, sizeof(mtime.tv_sec));
+        hash = read_cache_hash(hash, &mtime.tv_nsec, sizeof(mtime.tv_nsec));
+    }
+
+    return hash ?: 1;
+}
+
+static ReadCacheSlot *read_cache_slot(BDRVReadCacheState *s, uint64_t cluster)
+{
+    return &s->slots[qemu_xxhash4(s->id, cluster) % s->nslots];
+}
+
+static uint8_t *read_cache_slot_data(BDRVReadCacheState *s,
+                                     ReadCacheSlot *slot)
+{
+    return s->data + (slot - s->slots) * READ_CACHE_CLUSTER_SIZE;
+}
+
+static bool read_cache_slot_matches(BDRVReadCacheState *s,
+                                    ReadCacheSlot *slot, uint32_t seq,
+                                    uint64_t cluster)
+{
+    return !(seq & 1) && slot->id == s->id && slot->cluster == cluster + 1;
+}
+
+/* Only a hint, the slot may change right after */
+static bool read_cache_contains(BDRVReadCacheState *s, uint64_t cluster)
+{
+    ReadCacheSlot *slot = read_cache_slot(s, cluster);
+
+    return read_cache_slot_matches(s, slot, qatomic_load_acquire(&slot->seq),
+                                   cluster);
+}
+
+/*
+ * Copy @bytes at @offset_in_cluster of @cluster from the cache to @qiov.
+ * Return false if the cluster is not cached (@qiov may be overwritten
+ * anyway).
+ */
+static bool read_cache_lookup(BDRVReadCacheState *s, uint64_t cluster,
+                              size_t offset_in_cluster, size_t bytes,
+                              QEMUIOVector *qiov, size_t qiov_offset)
+{
+    ReadCacheSlot *slot = read_cache_slot(s, cluster);
+    uint32_t seq = qatomic_load_acquire(&slot->seq);
+
+    if (!read_cache_slot_matches(s, slot, seq, cluster)) {
+        return false;
+    }
+
+    qemu_iovec_from_buf(qiov, qiov_offset,
+                        read_cache_slot_data(s, slot) + offset_in_cluster,
+                        bytes);
+
+    /* The slot must not have been rewritten while we copied it */
+    smp_rmb();
+    return qatomic_read(&slot->seq) == seq;
+}
+
+static void read_cache_insert(BDRVReadCacheState *s, uint64_t cluster,
+                              const uint8_t *buf)
+{
+    ReadCacheSlot *slot = read_cache_slot(s, cluster);
+    uint32_t seq = qatomic_read(&slot->seq);
+
+    /* Leave the slot alone if somebody else is updating it */
+    if ((seq & 1) || qatomic_cmpxchg(&slot->seq, seq, seq + 1) != seq) {
+        return;
+    }
+
+    slot->id = s->id;
+    slot->cluster = cluster + 1;
+    memcpy(read_cache_slot_data(s, slot), buf, READ_CACHE_CLUSTER_SIZE);
+    qatomic_store_release(&slot->seq, seq + 2);
+}
+
+/*
+ * Empty the slots a dead process left odd.  Must be called with the file
+ * locked exclusively, i.e. while nobody else can write to a slot.
+ */
+static uint64_t read_cache_recover(BDRVReadCacheState *s)
+{
+    uint64_t i, n = 0;
+
+    for (i = 0; i < s->nslots; i++) {
+        ReadCacheSlot *slot = &s->slots[i];
+
+        if (slot->seq & 1) {
+            slot->id = 0;
+            slot->cluster = 0;
+            slot->seq++;
+            n++;
+        }
+    }
+    return n;
+}
+
+static void read_cache_unmap(BDRVReadCacheState *s)
+{
+    if (s->map) {
+        munmap(s->map, s->map_size);
+        s->map = NULL;
+    }
+    if (s->fd >= 0) {
+        qemu_close(s->fd);
+        s->fd = -1;
+    }
+}
+
+/* Open @path, creating a cache of about @size bytes if it is empty */
+static int read_cache_map(BDRVReadCacheState *s, const char *path,
+                          uint64_t size, Error **errp)
+{
+    ReadCacheHeader *header;
+    struct stat st;
+    size_t pagesize;
+    uint64_t nslots = 0, data_offset = 0, recovered = 0;
+    bool created = false, exclusive = true;
+    int ret;
+
+    s->fd = qemu_create(path, O_RDWR, 0600, errp);
+    if (s->fd < 0) {
+        return -errno;
+    }
+
+    /*
+     * Users hold a shared lock for as long as they have the file open.  The
+     * first one takes it exclusively to set up the file, or to clean up
+     * after users that died; the others wait until that is done.
+     */
+    if (flock(s->fd, LOCK_EX | LOCK_NB) < 0) {
+        if (errno != EWOULDBLOCK) {
+            ret = -errno;
+            error_setg_errno(errp, errno, "Could not lock '%s'", path);
+            goto fail;
+        }
+        exclusive = false;
+        if (flock(s->fd, LOCK_SH) < 0) {
+            ret = -errno;
+            error_setg_errno(errp, errno, "Could not lock '%s'", path);
+            goto fail;
+        }
+    }
+
+    if (fstat(s->fd, &st) < 0) {
+        ret = -errno;
+        error_setg_errno(errp, errno, "Could not stat '%s'", path);
+        goto fail;
+    }
+
+    pagesize = qemu_fd_getpagesize(s->fd);
+    if (st.st_size == 0 && exclusive) {
+        nslots = MAX(size / READ_CACHE_CLUSTER_SIZE, 1);
+        data_offset = ROUND_UP(sizeof(*header) + nslots * sizeof(ReadCacheSlot),
+                               MAX(pagesize, READ_CACHE_CLUSTER_SIZE));
+        s->map_size = ROUND_UP(data_offset + nslots * READ_CACHE_CLUSTER_SIZE,
+                               pagesize);
+        if (ftruncate(s->fd, s->map_size) < 0) {
+            ret = -errno;
+            error_setg_errno(errp, errno, "Could not resize '%s'", path);
+            goto fail;
+        }
+        created = true;
+    } else if (st.st_size < sizeof(*header)) {
+        goto invalid;
+    } else {
+        s->map_size = st.st_size;
+    }
+
+    s->map = mmap(NULL, s->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  s->fd, 0);
+    if (s->map == MAP_FAILED) {
+        s->map = NULL;
+        ret = -errno;
+        error_setg_errno(errp, errno, "Could not map '%s'", path);
+        goto fail;
+    }
+    header = s->map;
+
+    if (created) {
+        /* The new file is all zeroes, i.e. all slots are empty */
+        header->version = READ_CACHE_VERSION;
+        header->cluster_size = READ_CACHE_CLUSTER_SIZE;
+        header->nslots = nslots;
+        header->data_offset = data_offset;
+        memcpy(header->magic, READ_CACHE_MAGIC, sizeof(header->magic));
+    } else {
+        if (memcmp(header->magic, READ_CACHE_MAGIC, sizeof(header->magic))) {
+            goto invalid;
+        }
+        if (header->version != READ_CACHE_VERSION ||
+            header->cluster_size != READ_CACHE_CLUSTER_SIZE) {
+            error_setg(errp, "Unsupported read cache file '%s'", path);
+            ret = -ENOTSUP;
+            goto fail;
+        }
+        nslots = header->nslots;
+        data_offset = header->data_offset;
+        if (!nslots ||
+            nslots > (s->map_size - sizeof(*header)) / sizeof(ReadCacheSlot) ||
+            data_offset < sizeof(*header) + nslots * sizeof(ReadCacheSlot) ||
+            data_offset > s->map_size ||
+            nslots > (s->map_size - data_offset) / READ_CACHE_CLUSTER_SIZE) {
+            goto invalid;
+        }
+    }
+
+    s->nslots = nslots;
+    s->slots = (ReadCacheSlot *)(header + 1);
+    s->data = (uint8_t *)s->map + data_offset;
+
+    if (exclusive) {
+        if (!created) {
+            recovered = read_cache_recover(s);
+        }
+        /*
+         * The conversion is not atomic, but we do not write to the slots
+         * yet, so it does not matter if somebody else recovers them again
+         */
+        if (flock(s->fd, LOCK_SH) < 0) {
+            ret = -errno;
+            error_setg_errno(errp, errno, "Could not lock '%s'", path);
+            goto fail;
+        }
+    }
+    trace_read_cache_map(path, nslots, created, recovered);
+    return 0;
+
+invalid:
+    error_setg(errp, "'%s' is not a read cache file", path);
+    ret = -EINVAL;
+fail:
+    read_cache_unmap(s);
+    return ret;
+}
+
+static int read_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                           Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    QemuOpts *opts;
+    const char *path, *id;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    s->fd = -1;
+
+    bdrv_graph_rdlock_main_loop();
+    ret = bdrv_apply_auto_read_only(bs, "The read-cache filter is read-only",
+                                    errp);
+    bdrv_graph_rdunlock_main_loop();
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    path = qemu_opt_get(opts, READ_CACHE_OPT_FILE);
+    if (!path) {
+        error_setg(errp, "Parameter '" READ_CACHE_OPT_FILE "' is required");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    id = qemu_opt_get(opts, READ_CACHE_OPT_ID);
+    bdrv_graph_rdlock_main_loop();
+    s->id = read_cache_image_id(bs->file->bs, id ?: bs->file->bs->filename,
+                                errp);
+    bdrv_graph_rdunlock_main_loop();
+    if (!s->id) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    ret = read_cache_map(s, path,
+                         qemu_opt_get_size(opts, READ_CACHE_OPT_SIZE, 1 * GiB),
+                         errp);
+
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void read_cache_close(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+
+    read_cache_unmap(s);
+}
+
+static void read_cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                  BdrvChildRole role,
+                                  BlockReopenQueue *reopen_queue,
+                                  uint64_t perm, uint64_t shared,
+                                  uint64_t *nperm, uint64_t *nshared)
+{
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared,
+                       nperm, nshared);
+
+    /* Cached data would go stale if somebody changed the child */
+    *nshared &= ~BLK_PERM_WRITE;
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+read_cache_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset,
+                          BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    uint8_t *buf = NULL;
+    int ret = 0;
+
+    while (bytes) {
+        uint64_t cluster = offset / READ_CACHE_CLUSTER_SIZE;
+        int64_t offset_in_cluster = offset % READ_CACHE_CLUSTER_SIZE;
+        int64_t n = MIN(bytes, READ_CACHE_CLUSTER_SIZE - offset_in_cluster);
+        int64_t run_start, run_bytes, run_len, len, i;
+
+        if (read_cache_lookup(s, cluster, offset_in_cluster, n,
+                              qiov, qiov_offset)) {
+            trace_read_cache_hit(bs, offset, n);
+            offset += n;
+            qiov_offset += n;
+            bytes -= n;
+            continue;
+        }
+
+        /* Read the following missing clusters of the request in one go */
+        run_start = cluster * READ_CACHE_CLUSTER_SIZE;
+        run_bytes = READ_CACHE_CLUSTER_SIZE;
+        while (run_bytes < READ_CACHE_MAX_READ &&
+               run_start + run_bytes < offset + bytes &&
+               !read_cache_contains(s, cluster +
+                                    run_bytes / READ_CACHE_CLUSTER_SIZE)) {
+            run_bytes += READ_CACHE_CLUSTER_SIZE;
+        }
+
+        len = bdrv_co_getlength(bs->file->bs);
+        if (len < 0) {
+            ret = len;
+            goto out;
+        }
+        run_len = MIN(run_bytes, len - run_start);
+
+        if (!buf) {
+            buf = qemu_try_blockalign(bs->file->bs, READ_CACHE_MAX_READ);
+            if (!buf) {
+                ret = -ENOMEM;
+                goto out;
+            }
+        }
+
+        trace_read_cache_miss(bs, run_start, run_len);
+        ret = bdrv_co_pread(bs->file, run_start, run_len, buf, 0);
+        if (ret < 0) {
+            goto out;
+        }
+
+        /* The tail of the last cluster is never read, cache it as zeroes */
+        memset(buf + run_len, 0, run_bytes - run_len);
+        for (i = 0; i < run_bytes; i += READ_CACHE_CLUSTER_SIZE) {
+            read_cache_insert(s, cluster + i / READ_CACHE_CLUSTER_SIZE,
+                              buf + i);
+        }
+
+        n = MIN(bytes, run_start + run_len - offset);
+        qemu_iovec_from_buf(qiov, qiov_offset, buf + (offset - run_start), n);
+        offset += n;
+        qiov_offset += n;
+        bytes -= n;
+    }
+
+out:
+    qemu_vfree(buf);
+    return ret;
+}
+
+static BlockDriver bdrv_read_cache = {
+    .format_name                        = "read-cache",
+    .instance_size                      = sizeof(BDRVReadCacheState),
+
+    .bdrv_open                          = read_cache_open,
+    .bdrv_close                         = read_cache_close,
+    .bdrv_child_perm                    = read_cache_child_perm,
+
+    .bdrv_co_getlength                  = read_cache_co_getlength,
+    .bdrv_co_preadv_part                = read_cache_co_preadv_part,
+
+    .is_filter                          = true,
+};
+
+static void bdrv_read_cache_init(void)
+{
+    bdrv_register(&bdrv_read_cache);
+}
+
+block_init(bdrv_read_cache_init);
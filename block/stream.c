@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/block_int.h"
 #include "block/blockjob_int.h"
 #include "qapi/error.h"
@@ -28,6 +29,9 @@ enum {
      * that populating contiguous regions of the image is efficient.
      */
     STREAM_CHUNK = 512 * 1024, /* in bytes */
+
+    /* Number of chunks that are populated in parallel */
+    STREAM_MAX_WORKERS = 8,
 };
 
 typedef struct StreamBlockJob {
@@ -51,6 +55,28 @@ static int coroutine_fn stream_populate(BlockBackend *blk,
     return blk_co_preadv(blk, offset, bytes, NULL, BDRV_REQ_PREFETCH);
 }
 
+typedef struct StreamExtent {
+    int64_t offset;
+    int64_t bytes;
+    bool copy;
+    int ret;
+} StreamExtent;
+
+typedef struct StreamTask {
+    AioTask task;
+    BlockBackend *blk;
+    StreamExtent *extent;
+} StreamTask;
+
+static int coroutine_fn stream_task_entry(AioTask *task)
+{
+    StreamTask *t = container_of(task, StreamTask, task);
+
+    t->extent->ret = stream_populate(t->blk, t->extent->offset,
+                                     t->extent->bytes);
+    return t->extent->ret;
+}
+
 static int stream_prepare(Job *job)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
@@ -159,7 +185,6 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     int64_t len = -1;
     int64_t offset = 0;
     int error = 0;
-    int64_t n = 0; /* bytes */
 
     WITH_GRAPH_RDLOCK_GUARD() {
         unfiltered_bs = bdrv_skip_filters(s->target_bs);
@@ -175,9 +200,10 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     }
     job_progress_set_remaining(&s->common.job, len);
 
-    for ( ; offset < len; offset += n) {
-        bool copy;
-        int ret = -1;
+    while (offset < len) {
+        StreamExtent extents[STREAM_MAX_WORKERS];
+        AioTaskPool *pool;
+        int nr_extents = 0;
 
         /* Note that even when no rate limit is applied we need to yield
          * with no pending I/O here so that bdrv_drain_all() returns.
@@ -187,51 +213,88 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             break;
         }
 
-        copy = false;
-
-        WITH_GRAPH_RDLOCK_GUARD() {
-            ret = bdrv_co_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, &n);
-            if (ret == 1) {
-                /* Allocated in the top, no need to copy.  */
-            } else if (ret >= 0) {
-                /*
-                 * Copy if allocated in the intermediate images.  Limit to the
-                 * known-unallocated area [offset, offset+n*BDRV_SECTOR_SIZE).
-                 */
-                ret = bdrv_co_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
-                                                 s->base_overlay, true,
-                                                 offset, n, &n);
-                /* Finish early if end of backing file has been reached */
-                if (ret == 0 && n == 0) {
-                    n = len - offset;
+        /* Populate the next few chunks that need copying in parallel */
+        pool = aio_task_pool_new(STREAM_MAX_WORKERS);
+        while (nr_extents < STREAM_MAX_WORKERS && offset < len) {
+            StreamExtent *e = &extents[nr_extents++];
+            int64_t n = 0; /* bytes */
+            bool copy = false;
+            int ret = -1;
+
+            WITH_GRAPH_RDLOCK_GUARD() {
+                ret = bdrv_co_is_allocated(unfiltered_bs, offset, STREAM_CHUNK,
+                                           &n);
+                if (ret == 1) {
+                    /* Allocated in the top, no need to copy.  */
+                } else if (ret >= 0) {
+                    /*
+                     * Copy if allocated in the intermediate images.  Limit to
+                     * the known-unallocated area
+                     * [offset, offset+n*BDRV_SECTOR_SIZE).
+                     */
+                    ret = bdrv_co_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
+                                                     s->base_overlay, true,
+                                                     offset, n, &n);
+                    /* Finish early if end of backing file has been reached */
+                    if (ret == 0 && n == 0) {
+                        n = len - offset;
+                    }
+
+                    copy = (ret > 0);
                 }
-
-                copy = (ret > 0);
             }
-        }
-        trace_stream_one_iteration(s, offset, n, ret);
-        if (copy) {
-            ret = stream_populate(s->blk, offset, n);
-        }
-        if (ret < 0) {
-            BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error, true, -ret);
-            if (action == BLOCK_ERROR_ACTION_STOP) {
-                n = 0;
-                continue;
-            }
-            if (error == 0) {
-                error = ret;
-            }
-            if (action == BLOCK_ERROR_ACTION_REPORT) {
+            trace_stream_one_iteration(s, offset, n, ret);
+
+            *e = (StreamExtent) {
+                .offset = offset,
+                .bytes = n,
+                .copy = copy,
+                .ret = ret,
+            };
+            offset += n;
+
+            if (copy) {
+                StreamTask *t = g_new(StreamTask, 1);
+
+                *t = (StreamTask) {
+                    .task.func = stream_task_entry,
+                    .blk = s->blk,
+                    .extent = e,
+                };
+                aio_task_pool_start_task(pool, &t->task);
+            } else if (ret < 0) {
                 break;
             }
         }
+        aio_task_pool_wait_all(pool);
+        aio_task_pool_free(pool);
+
+        /* Account for the chunks in order, as if copied one by one */
+        for (int i = 0; i < nr_extents; i++) {
+            StreamExtent *e = &extents[i];
+
+            if (e->ret < 0) {
+                BlockErrorAction action =
+                    block_job_error_action(&s->common, s->on_error, true,
+                                           -e->ret);
+                if (action == BLOCK_ERROR_ACTION_STOP) {
+                    /* Retry from here, later chunks are redone as well */
+                    offset = e->offset;
+                    break;
+                }
+                if (error == 0) {
+                    error = e->ret;
+                }
+                if (action == BLOCK_ERROR_ACTION_REPORT) {
+                    return error;
+                }
+            }
 
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
-        if (copy) {
-            block_job_ratelimit_processed_bytes(&s->common, n);
+            /* Publish progress */
+            job_progress_update(&s->common.job, e->bytes);
+            if (e->copy) {
+                block_job_ratelimit_processed_bytes(&s->common, e->bytes);
+            }
         }
     }
 
@@ -70,11 +70,18 @@ struct ThrottleGroup {
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    /*
+     * Requests also have to fit into the budget of this group, if set.
+     * Constant after initialization; holds a reference.
+     */
+    ThrottleGroup *parent_group;
+
+    QemuMutex lock; /* This lock protects the following five fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[THROTTLE_MAX];
     bool any_timer_armed[THROTTLE_MAX];
+    ThrottleGroupStats stats;
     QEMUClockType clock_type;
 
     /* This field is protected by the global QEMU mutex */
@@ -111,6 +118,20 @@ bool throttle_group_exists(const char *name)
     return throttle_group_by_name(name) != NULL;
 }
 
+/* This function reads throttle_groups and must be called under the global
+ * mutex.
+ */
+ThrottleGroup *throttle_group_next(ThrottleGroup *tg)
+{
+    return tg ? QTAILQ_NEXT(tg, list) : QTAILQ_FIRST(&throttle_groups);
+}
+
+void throttle_group_get_stats(ThrottleGroup *tg, ThrottleGroupStats *stats)
+{
+    QEMU_LOCK_GUARD(&tg->lock);
+    *stats = tg->stats;
+}
+
 /* Increments the reference count of a ThrottleGroup given its name.
  *
  * If no ThrottleGroup is found with the given name a new one is
@@ -254,6 +275,34 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
     return token;
 }
 
+/* Check if the next I/O request for a ThrottleGroupMember would exceed the
+ * budget of one of the ancestors of its group, and arm the member's timer for
+ * when that budget allows the request if so.
+ *
+ * This assumes that tg->lock is held. The ancestors' locks are taken here,
+ * always in this order from the child to the root.
+ *
+ * @tgm:        the current ThrottleGroupMember
+ * @direction:  the ThrottleDirection
+ * @ret:        whether the I/O request needs to be throttled or not
+ */
+static bool throttle_group_parents_schedule_timer(ThrottleGroupMember *tgm,
+                                                  ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    ThrottleGroup *parent;
+
+    for (parent = tg->parent_group; parent; parent = parent->parent_group) {
+        QEMU_LOCK_GUARD(&parent->lock);
+        if (throttle_schedule_timer(&parent->ts, &tgm->throttle_timers,
+                                    direction)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /* Check if the next I/O request for a ThrottleGroupMember needs to be
  * throttled or not. If there's no timer set in this group, set one and update
  * the token accordingly.
@@ -281,7 +330,8 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
         return true;
     }
 
-    must_wait = throttle_schedule_timer(ts, tt, direction);
+    must_wait = throttle_schedule_timer(ts, tt, direction) ||
+                throttle_group_parents_schedule_timer(tgm, direction);
 
     /* If a timer just got armed, set tgm as the current token */
     if (must_wait) {
@@ -365,6 +415,7 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     bool must_wait;
     ThrottleGroupMember *token;
     ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    ThrottleGroup *parent;
 
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
@@ -377,6 +428,7 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
+        tg->stats.throttled[direction]++;
         tgm->pending_reqs[direction]++;
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
@@ -389,6 +441,14 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* The I/O will be executed, so do the accounting */
     throttle_account(tgm->throttle_state, direction, bytes);
+    tg->stats.requests[direction]++;
+    tg->stats.bytes[direction] += bytes;
+    for (parent = tg->parent_group; parent; parent = parent->parent_group) {
+        QEMU_LOCK_GUARD(&parent->lock);
+        throttle_account(&parent->ts, direction, bytes);
+        parent->stats.requests[direction]++;
+        parent->stats.bytes[direction] += bytes;
+    }
 
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
@@ -804,6 +864,9 @@ static void throttle_group_obj_finalize(Object *obj)
     if (tg->is_initialized) {
         QTAILQ_REMOVE(&throttle_groups, tg, list);
     }
+    if (tg->parent_group) {
+        object_unref(OBJECT(tg->parent_group));
+    }
     qemu_mutex_destroy(&tg->lock);
     g_free(tg->name);
 }
@@ -929,6 +992,44 @@ static void throttle_group_get_limits(Object *obj, Visitor *v,
     visit_type_ThrottleLimits(v, name, &argp, errp);
 }
 
+static char *throttle_group_get_parent_group(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    return g_strdup(tg->parent_group ? tg->parent_group->name : "");
+}
+
+static void throttle_group_set_parent_group(Object *obj, const char *value,
+                                            Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    ThrottleGroup *parent = NULL;
+
+    /* Members' requests may already be accounted in the current ancestors */
+    if (tg->is_initialized) {
+        error_setg(errp, "Property cannot be set after initialization");
+        return;
+    }
+
+    /*
+     * Only groups that have completed initialization can be found by name.
+     * This group cannot have any children yet, so no loop can form.
+     */
+    if (*value) {
+        parent = throttle_group_by_name(value);
+        if (!parent) {
+            error_setg(errp, "Throttle group '%s' not found", value);
+            return;
+        }
+        object_ref(OBJECT(parent));
+    }
+
+    if (tg->parent_group) {
+        object_unref(OBJECT(tg->parent_group));
+    }
+    tg->parent_group = parent;
+}
+
 static bool throttle_group_can_be_deleted(UserCreatable *uc)
 {
     return OBJECT(uc)->ref == 1;
@@ -958,6 +1059,10 @@ static void throttle_group_obj_class_init(ObjectClass *klass, void *class_data)
                               throttle_group_get_limits,
                               throttle_group_set_limits,
                               NULL, NULL);
+
+    object_class_property_add_str(klass, "parent-group",
+                                  throttle_group_get_parent_group,
+                                  throttle_group_set_parent_group);
 }
 
 static const TypeInfo throttle_group_info = {
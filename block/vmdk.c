@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "block/block_int.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "qapi/qmp/qdict.h"
 #include "qemu/error-report.h"
@@ -161,6 +162,15 @@ typedef struct VmdkExtent {
     int64_t cluster_sectors;
     int64_t next_cluster_sector;
     char *type;
+
+    /*
+     * Last decompressed grain of a compressed extent.  Grains are never
+     * rewritten in place, so the cache is keyed by the grain's offset in the
+     * file and needs no invalidation.
+     */
+    void *grain_cache;
+    int64_t grain_cache_offset;
+    uLongf grain_cache_len;
 } VmdkExtent;
 
 typedef struct BDRVVmdkState {
@@ -277,6 +287,7 @@ static void vmdk_free_extents(BlockDriverState *bs)
         g_free(e->l1_table);
         g_free(e->l2_cache);
         g_free(e->l1_backup_table);
+        g_free(e->grain_cache);
         g_free(e->type);
         if (e->file != bs->file) {
             bdrv_unref_child(bs, e->file);
@@ -1826,6 +1837,50 @@ vmdk_co_block_status(BlockDriverState *bs, bool want_zero,
     return ret;
 }
 
+typedef struct VmdkZlibTask {
+    bool compress;
+    Bytef *dest;
+    uLongf dest_len;
+    const Bytef *src;
+    uLong src_len;
+} VmdkZlibTask;
+
+static int vmdk_zlib_worker(void *opaque)
+{
+    VmdkZlibTask *t = opaque;
+    int ret;
+
+    if (t->compress) {
+        ret = compress(t->dest, &t->dest_len, t->src, t->src_len);
+    } else {
+        ret = uncompress(t->dest, &t->dest_len, t->src, t->src_len);
+    }
+    return ret == Z_OK ? 0 : -EINVAL;
+}
+
+/*
+ * (De)compress a grain in a thread pool worker, so that the AioContext keeps
+ * serving other requests and several images can use separate host CPUs.
+ * Returns the output length in *dest_len.
+ */
+static int coroutine_fn
+vmdk_co_zlib(bool compress, void *dest, uLongf *dest_len,
+             const void *src, uLong src_len)
+{
+    VmdkZlibTask t = {
+        .compress = compress,
+        .dest = dest,
+        .dest_len = *dest_len,
+        .src = src,
+        .src_len = src_len,
+    };
+    int ret;
+
+    ret = thread_pool_submit_co(vmdk_zlib_worker, &t);
+    *dest_len = t.dest_len;
+    return ret;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 vmdk_write_extent(VmdkExtent *extent, int64_t cluster_offset,
                   int64_t offset_in_cluster, QEMUIOVector *qiov,
@@ -1861,10 +1916,11 @@ vmdk_write_extent(VmdkExtent *extent, int64_t cluster_offset,
 
         compressed_data = g_malloc(n_bytes);
         qemu_iovec_to_buf(qiov, qiov_offset, compressed_data, n_bytes);
-        ret = compress(data->data, &buf_len, compressed_data, n_bytes);
+        ret = vmdk_co_zlib(true, data->data, &buf_len, compressed_data,
+                           n_bytes);
         g_free(compressed_data);
 
-        if (ret != Z_OK || buf_len == 0) {
+        if (ret < 0 || buf_len == 0) {
             ret = -EINVAL;
             goto out;
         }
@@ -1914,8 +1970,8 @@ vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
 {
     int ret;
     int cluster_bytes, buf_bytes;
-    uint8_t *cluster_buf, *compressed_data;
-    uint8_t *uncomp_buf;
+    uint8_t *cluster_buf = NULL, *compressed_data;
+    uint8_t *uncomp_buf = NULL;
     uint32_t data_len;
     VmdkGrainMarker *marker;
     uLongf buf_len;
@@ -1932,6 +1988,11 @@ vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
         return 0;
     }
     cluster_bytes = extent->cluster_sectors * 512;
+    if (extent->grain_cache && extent->grain_cache_offset == cluster_offset) {
+        buf_len = extent->grain_cache_len;
+        goto copy;
+    }
+
     /* Read two clusters in case GrainMarker + compressed data > one cluster */
     buf_bytes = cluster_bytes * 2;
     cluster_buf = g_malloc(buf_bytes);
@@ -1954,18 +2015,26 @@ vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
         ret = -EINVAL;
         goto out;
     }
-    ret = uncompress(uncomp_buf, &buf_len, compressed_data, data_len);
-    if (ret != Z_OK) {
-        ret = -EINVAL;
+    ret = vmdk_co_zlib(false, uncomp_buf, &buf_len, compressed_data, data_len);
+    if (ret < 0) {
         goto out;
-
     }
+
+    /* Guests often read a grain in several pieces, keep it around */
+    g_free(extent->grain_cache);
+    extent->grain_cache = uncomp_buf;
+    extent->grain_cache_offset = cluster_offset;
+    extent->grain_cache_len = buf_len;
+    uncomp_buf = NULL;
+
+ copy:
     if (offset_in_cluster < 0 ||
             offset_in_cluster + bytes > buf_len) {
         ret = -EINVAL;
         goto out;
     }
-    qemu_iovec_from_buf(qiov, 0, uncomp_buf + offset_in_cluster, bytes);
+    qemu_iovec_from_buf(qiov, 0, (uint8_t *)extent->grain_cache +
+                        offset_in_cluster, bytes);
     ret = 0;
 
  out:
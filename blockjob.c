@@ -24,6 +24,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "block/accounting.h"
 #include "block/aio-wait.h"
 #include "block/block.h"
 #include "block/blockjob_int.h"
@@ -35,6 +36,32 @@
 #include "qapi/qmp/qerror.h"
 #include "qemu/main-loop.h"
 #include "qemu/timer.h"
+#include "qemu/units.h"
+
+/* Interval at which the latency-driven rate control adjusts the rate */
+#define BLOCK_JOB_LATENCY_PERIOD_NS (500 * SCALE_MS)
+/* The latency-driven rate control starts at this rate ... */
+#define BLOCK_JOB_LATENCY_INITIAL_RATE (64 * MiB)
+/* ... and never goes below this one */
+#define BLOCK_JOB_LATENCY_MIN_RATE (1 * MiB)
+
+static const enum BlockAcctType block_job_latency_types[] = {
+    BLOCK_ACCT_READ,
+    BLOCK_ACCT_WRITE,
+};
+
+typedef struct BlockJobLatencyControl {
+    BlockBackend *blk;
+    uint64_t target_ns;
+    /* Rate in bytes per second picked by the control */
+    int64_t rate;
+    /* Job progress at the previous adjustment */
+    uint64_t last_progress;
+    QEMUTimer *timer;
+    BlockLatencyPercentileHistogram since[ARRAY_SIZE(block_job_latency_types)];
+} BlockJobLatencyControl;
+
+static void block_job_latency_control_free(BlockJob *job);
 
 static bool is_block_job(Job *job)
 {
@@ -80,6 +107,7 @@ void block_job_free(Job *job)
     GLOBAL_STATE_CODE();
 
     block_job_remove_all_bdrv(bjob);
+    block_job_latency_control_free(bjob);
     ratelimit_destroy(&bjob->limit);
     error_free(bjob->blocker);
 }
@@ -270,9 +298,34 @@ static bool job_timer_pending(Job *job)
     return timer_pending(&job->sleep_timer);
 }
 
-bool block_job_set_speed_locked(BlockJob *job, int64_t speed, Error **errp)
+/* The rate limit to apply: @speed, unless the latency control picks less */
+static int64_t block_job_effective_speed(BlockJob *job)
+{
+    if (job->latency_ctl) {
+        return MIN_NON_ZERO(job->speed, job->latency_ctl->rate);
+    }
+    return job->speed;
+}
+
+/*
+ * Apply @speed to the job's rate limit.  Called with job lock held, but might
+ * release it temporarily.
+ */
+static void block_job_apply_speed_locked(BlockJob *job, int64_t speed)
 {
     const BlockJobDriver *drv = block_job_driver(job);
+
+    ratelimit_set_speed(&job->limit, speed, BLOCK_JOB_SLICE_TIME);
+
+    if (drv->set_speed) {
+        job_unlock();
+        drv->set_speed(job, speed);
+        job_lock();
+    }
+}
+
+bool block_job_set_speed_locked(BlockJob *job, int64_t speed, Error **errp)
+{
     int64_t old_speed = job->speed;
 
     GLOBAL_STATE_CODE();
@@ -286,15 +339,8 @@ bool block_job_set_speed_locked(BlockJob *job, int64_t speed, Error **errp)
         return false;
     }
 
-    ratelimit_set_speed(&job->limit, speed, BLOCK_JOB_SLICE_TIME);
-
     job->speed = speed;
-
-    if (drv->set_speed) {
-        job_unlock();
-        drv->set_speed(job, speed);
-        job_lock();
-    }
+    block_job_apply_speed_locked(job, block_job_effective_speed(job));
 
     if (speed && speed <= old_speed) {
         return true;
@@ -312,6 +358,139 @@ static bool block_job_set_speed(BlockJob *job, int64_t speed, Error **errp)
     return block_job_set_speed_locked(job, speed, errp);
 }
 
+static void block_job_latency_timer_cb(void *opaque)
+{
+    static const double p99 = 99.0;
+    BlockJob *job = opaque;
+    BlockJobLatencyControl *ctl = job->latency_ctl;
+    BlockAcctStats *stats = blk_get_stats(ctl->blk);
+    int64_t old_rate = ctl->rate;
+    uint64_t latency = 0;
+    uint64_t progress, total, copied;
+    int i;
+
+    GLOBAL_STATE_CODE();
+
+    for (i = 0; i < ARRAY_SIZE(block_job_latency_types); i++) {
+        uint64_t value;
+
+        if (block_latency_percentiles_since(stats, block_job_latency_types[i],
+                                            &ctl->since[i], &p99, &value, 1)) {
+            latency = MAX(latency, value);
+        }
+    }
+
+    progress_get_snapshot(&job->job.progress, &progress, &total);
+    copied = progress - ctl->last_progress;
+    ctl->last_progress = progress;
+
+    /*
+     * Back off quickly when the guest suffers, but only raise the rate slowly,
+     * and only as long as the job actually makes use of it.
+     */
+    if (latency > ctl->target_ns) {
+        ctl->rate = MAX(ctl->rate / 2, BLOCK_JOB_LATENCY_MIN_RATE);
+    } else if (copied * (NANOSECONDS_PER_SECOND / BLOCK_JOB_LATENCY_PERIOD_NS) >=
+               ctl->rate / 2) {
+        ctl->rate += ctl->rate / 8;
+        if (job->speed) {
+            ctl->rate = MIN(ctl->rate, job->speed);
+        }
+    }
+
+    trace_block_job_latency_control(job, latency, copied, ctl->rate);
+
+    if (ctl->rate != old_rate) {
+        JOB_LOCK_GUARD();
+        block_job_apply_speed_locked(job, block_job_effective_speed(job));
+        if (ctl->rate > old_rate) {
+            job_enter_cond_locked(&job->job, job_timer_pending);
+        }
+    }
+
+    timer_mod(ctl->timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                          BLOCK_JOB_LATENCY_PERIOD_NS);
+}
+
+static void block_job_latency_control_free(BlockJob *job)
+{
+    BlockJobLatencyControl *ctl = job->latency_ctl;
+
+    if (!ctl) {
+        return;
+    }
+
+    job->latency_ctl = NULL;
+    timer_free(ctl->timer);
+    blk_unref(ctl->blk);
+    g_free(ctl);
+}
+
+bool block_job_set_latency_target_locked(BlockJob *job, BlockBackend *blk,
+                                         uint64_t target_ns, Error **errp)
+{
+    BlockJobLatencyControl *ctl = job->latency_ctl;
+    BlockBackend *old_blk = NULL;
+    uint64_t total;
+    int i;
+
+    GLOBAL_STATE_CODE();
+
+    if (job_apply_verb_locked(&job->job, JOB_VERB_SET_SPEED, errp) < 0) {
+        return false;
+    }
+
+    if (!target_ns) {
+        if (ctl) {
+            job->latency_ctl = NULL;
+            timer_free(ctl->timer);
+            old_blk = ctl->blk;
+            g_free(ctl);
+        }
+    } else {
+        if (!ctl) {
+            ctl = g_new0(BlockJobLatencyControl, 1);
+            ctl->rate = MIN_NON_ZERO(job->speed,
+                                     BLOCK_JOB_LATENCY_INITIAL_RATE);
+            ctl->timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                      block_job_latency_timer_cb, job);
+            job->latency_ctl = ctl;
+        } else {
+            old_blk = ctl->blk;
+        }
+
+        blk_ref(blk);
+        ctl->blk = blk;
+        ctl->target_ns = target_ns;
+
+        /* Only look at requests from now on */
+        memset(ctl->since, 0, sizeof(ctl->since));
+        for (i = 0; i < ARRAY_SIZE(block_job_latency_types); i++) {
+            double p = 0.0;
+            uint64_t value;
+
+            block_latency_percentiles_since(blk_get_stats(blk),
+                                            block_job_latency_types[i],
+                                            &ctl->since[i], &p, &value, 1);
+        }
+        progress_get_snapshot(&job->job.progress, &ctl->last_progress, &total);
+
+        timer_mod(ctl->timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                              BLOCK_JOB_LATENCY_PERIOD_NS);
+    }
+
+    block_job_apply_speed_locked(job, block_job_effective_speed(job));
+    job_enter_cond_locked(&job->job, job_timer_pending);
+
+    if (old_blk) {
+        job_unlock();
+        blk_unref(old_blk);
+        job_lock();
+    }
+
+    return true;
+}
+
 void block_job_change_locked(BlockJob *job, BlockJobChangeOptions *opts,
                              Error **errp)
 {
@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 #include "qemu/osdep.h"
+#include "qemu/iov.h"
 #include "chardev/char-io.h"
 
 typedef struct IOWatchPoll {
@@ -146,19 +147,21 @@ void remove_fd_in_watch(Chardev *chr)
     }
 }
 
-int io_channel_send_full(QIOChannel *ioc,
-                         const void *buf, size_t len,
-                         int *fds, size_t nfds)
+int io_channel_sendv_full(QIOChannel *ioc,
+                          const struct iovec *iov, unsigned int iovcnt,
+                          int *fds, size_t nfds)
 {
+    g_autofree struct iovec *local_iov_base =
+        g_memdup2(iov, iovcnt * sizeof(*iov));
+    struct iovec *local_iov = local_iov_base;
+    size_t len = iov_size(iov, iovcnt);
     size_t offset = 0;
 
     while (offset < len) {
         ssize_t ret = 0;
-        struct iovec iov = { .iov_base = (char *)buf + offset,
-                             .iov_len = len - offset };
 
         ret = qio_channel_writev_full(
-            ioc, &iov, 1,
+            ioc, local_iov, iovcnt,
             fds, nfds, 0, NULL);
         if (ret == QIO_CHANNEL_ERR_BLOCK) {
             if (offset) {
@@ -173,11 +176,21 @@ int io_channel_send_full(QIOChannel *ioc,
         }
 
         offset += ret;
+        iov_discard_front(&local_iov, &iovcnt, ret);
     }
 
     return offset;
 }
 
+int io_channel_send_full(QIOChannel *ioc,
+                         const void *buf, size_t len,
+                         int *fds, size_t nfds)
+{
+    struct iovec iov = { .iov_base = (char *)buf, .iov_len = len };
+
+    return io_channel_sendv_full(ioc, &iov, 1, fds, nfds);
+}
+
 int io_channel_send(QIOChannel *ioc, const void *buf, size_t len)
 {
     return io_channel_send_full(ioc, buf, len, NULL, 0);
@@ -39,6 +39,7 @@
 #include "qemu/option.h"
 #include "qemu/id.h"
 #include "qemu/coroutine.h"
+#include "qemu/iov.h"
 #include "qemu/yank.h"
 
 #include "chardev-internal.h"
@@ -195,6 +196,56 @@ int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
     return offset;
 }
 
+static void qemu_chr_write_log_iov(Chardev *s, const struct iovec *iov,
+                                   int iovcnt, size_t len)
+{
+    int i;
+
+    for (i = 0; i < iovcnt && len; i++) {
+        size_t n = MIN(len, iov[i].iov_len);
+
+        qemu_chr_write_log(s, iov[i].iov_base, n);
+        len -= n;
+    }
+}
+
+int qemu_chr_writev(Chardev *s, const struct iovec *iov, int iovcnt)
+{
+    ChardevClass *cc = CHARDEV_GET_CLASS(s);
+    int offset = 0;
+    int res, i;
+
+    /*
+     * Record/replay keeps one event per write, so go through the buffers
+     * one at a time then, as well as for backends without vectored I/O.
+     */
+    if (!cc->chr_writev || replay_mode != REPLAY_MODE_NONE) {
+        for (i = 0; i < iovcnt; i++) {
+            res = qemu_chr_write(s, iov[i].iov_base, iov[i].iov_len, false);
+            if (res < 0) {
+                return offset ? offset : res;
+            }
+            offset += res;
+            if (res < iov[i].iov_len) {
+                break;
+            }
+        }
+        return offset;
+    }
+
+    qemu_mutex_lock(&s->chr_write_lock);
+    res = cc->chr_writev(s, iov, iovcnt);
+    if (res > 0) {
+        qemu_chr_write_log_iov(s, iov, iovcnt, res);
+    } else if (res < 0) {
+        /* as in qemu_chr_write_buffer(), the data is lost */
+        qemu_chr_write_log_iov(s, iov, iovcnt, iov_size(iov, iovcnt));
+    }
+    qemu_mutex_unlock(&s->chr_write_lock);
+
+    return res;
+}
+
 int qemu_chr_be_can_write(Chardev *s)
 {
     CharBackend *be = s->be;
@@ -1247,13 +1247,13 @@ qcrypto_block_luks_open(QCryptoBlock *block,
         block->niv = qcrypto_cipher_get_iv_len(luks->cipher_alg,
                                                luks->cipher_mode);
 
-        block->ivgen = qcrypto_ivgen_new(luks->ivgen_alg,
-                                         luks->ivgen_cipher_alg,
-                                         luks->ivgen_hash_alg,
-                                         masterkey,
-                                         luks->header.master_key_len,
-                                         errp);
-        if (!block->ivgen) {
+        if (qcrypto_block_init_ivgen(block,
+                                     luks->ivgen_alg,
+                                     luks->ivgen_cipher_alg,
+                                     luks->ivgen_hash_alg,
+                                     masterkey,
+                                     luks->header.master_key_len,
+                                     errp) < 0) {
             goto fail;
         }
 
@@ -1462,13 +1462,12 @@ qcrypto_block_luks_create(QCryptoBlock *block,
     block->kdfhash = luks_opts.hash_alg;
     block->niv = qcrypto_cipher_get_iv_len(luks_opts.cipher_alg,
                                            luks_opts.cipher_mode);
-    block->ivgen = qcrypto_ivgen_new(luks_opts.ivgen_alg,
-                                     luks->ivgen_cipher_alg,
-                                     luks_opts.ivgen_hash_alg,
-                                     masterkey, luks->header.master_key_len,
-                                     errp);
-
-    if (!block->ivgen) {
+    if (qcrypto_block_init_ivgen(block,
+                                 luks_opts.ivgen_alg,
+                                 luks->ivgen_cipher_alg,
+                                 luks_opts.ivgen_hash_alg,
+                                 masterkey, luks->header.master_key_len,
+                                 errp) < 0) {
         goto error;
     }
 
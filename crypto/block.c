@@ -232,25 +232,33 @@ QCryptoCipher *qcrypto_block_get_cipher(QCryptoBlock *block)
 }
 
 
+/*
+ * Returns a free cipher together with the IV generator paired with it,
+ * which is NULL until the first request sets it up.
+ */
 static QCryptoCipher *qcrypto_block_pop_cipher(QCryptoBlock *block,
+                                               QCryptoIVGen **ivgen,
                                                Error **errp)
 {
     /* Usually there is a free cipher available */
     WITH_QEMU_LOCK_GUARD(&block->mutex) {
         if (block->n_free_ciphers > 0) {
             block->n_free_ciphers--;
+            *ivgen = block->free_ivgens[block->n_free_ciphers];
             return block->free_ciphers[block->n_free_ciphers];
         }
     }
 
     /* Otherwise allocate a new cipher */
+    *ivgen = NULL;
     return qcrypto_cipher_new(block->alg, block->mode, block->key,
                               block->nkey, errp);
 }
 
 
 static void qcrypto_block_push_cipher(QCryptoBlock *block,
-                                      QCryptoCipher *cipher)
+                                      QCryptoCipher *cipher,
+                                      QCryptoIVGen *ivgen)
 {
     QEMU_LOCK_GUARD(&block->mutex);
 
@@ -259,9 +267,13 @@ static void qcrypto_block_push_cipher(QCryptoBlock *block,
         block->free_ciphers = g_renew(QCryptoCipher *,
                                       block->free_ciphers,
                                       block->max_free_ciphers);
+        block->free_ivgens = g_renew(QCryptoIVGen *,
+                                     block->free_ivgens,
+                                     block->max_free_ciphers);
     }
 
     block->free_ciphers[block->n_free_ciphers] = cipher;
+    block->free_ivgens[block->n_free_ciphers] = ivgen;
     block->n_free_ciphers++;
 }
 
@@ -273,6 +285,7 @@ int qcrypto_block_init_cipher(QCryptoBlock *block,
                               Error **errp)
 {
     QCryptoCipher *cipher;
+    QCryptoIVGen *ivgen;
 
     assert(!block->free_ciphers && !block->max_free_ciphers &&
            !block->n_free_ciphers);
@@ -287,14 +300,14 @@ int qcrypto_block_init_cipher(QCryptoBlock *block,
      * Create a new cipher to validate the parameters now. This reduces the
      * chance of cipher creation failing at I/O time.
      */
-    cipher = qcrypto_block_pop_cipher(block, errp);
+    cipher = qcrypto_block_pop_cipher(block, &ivgen, errp);
     if (!cipher) {
         g_free(block->key);
         block->key = NULL;
         return -1;
     }
 
-    qcrypto_block_push_cipher(block, cipher);
+    qcrypto_block_push_cipher(block, cipher, ivgen);
     return 0;
 }
 
@@ -305,6 +318,8 @@ void qcrypto_block_free_cipher(QCryptoBlock *block)
 
     g_free(block->key);
     block->key = NULL;
+    g_free(block->ivgen_key);
+    block->ivgen_key = NULL;
 
     if (!block->free_ciphers) {
         return;
@@ -315,17 +330,44 @@ void qcrypto_block_free_cipher(QCryptoBlock *block)
 
     for (i = 0; i < block->max_free_ciphers; i++) {
         qcrypto_cipher_free(block->free_ciphers[i]);
+        qcrypto_ivgen_free(block->free_ivgens[i]);
     }
 
     g_free(block->free_ciphers);
+    g_free(block->free_ivgens);
     block->free_ciphers = NULL;
+    block->free_ivgens = NULL;
     block->max_free_ciphers = block->n_free_ciphers = 0;
 }
 
+
+int qcrypto_block_init_ivgen(QCryptoBlock *block,
+                             QCryptoIVGenAlgo alg,
+                             QCryptoCipherAlgo cipheralg,
+                             QCryptoHashAlgo hash,
+                             const uint8_t *key, size_t nkey,
+                             Error **errp)
+{
+    assert(!block->ivgen);
+
+    block->ivgen = qcrypto_ivgen_new(alg, cipheralg, hash, key, nkey, errp);
+    if (!block->ivgen) {
+        return -1;
+    }
+
+    /* Stash away the parameters for the IV generators of the free ciphers */
+    block->ivgen_alg = alg;
+    block->ivgen_cipher_alg = cipheralg;
+    block->ivgen_hash_alg = hash;
+    block->ivgen_key = g_memdup2(key, nkey);
+    block->nivgen_key = nkey;
+    return 0;
+}
+
 QCryptoIVGen *qcrypto_block_get_ivgen(QCryptoBlock *block)
 {
-    /* ivgen should be accessed under mutex. However, this function is used only
-     * in test with one thread, so it's enough to assert it here:
+    /* I/O uses the ivgens paired with the free ciphers. This function is used
+     * only in test with one thread, so it's enough to assert it here:
      */
     assert(block->max_free_ciphers <= 1);
     return block->ivgen;
@@ -374,7 +416,6 @@ typedef int (*QCryptoCipherEncDecFunc)(QCryptoCipher *cipher,
 static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
                                           size_t niv,
                                           QCryptoIVGen *ivgen,
-                                          QemuMutex *ivgen_mutex,
                                           int sectorsize,
                                           uint64_t offset,
                                           uint8_t *buf,
@@ -392,14 +433,7 @@ static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
     while (len > 0) {
         size_t nbytes;
         if (niv) {
-            if (ivgen_mutex) {
-                qemu_mutex_lock(ivgen_mutex);
-            }
             ret = qcrypto_ivgen_calculate(ivgen, startsector, iv, niv, errp);
-            if (ivgen_mutex) {
-                qemu_mutex_unlock(ivgen_mutex);
-            }
-
             if (ret < 0) {
                 return -1;
             }
@@ -434,7 +468,7 @@ int qcrypto_block_cipher_decrypt_helper(QCryptoCipher *cipher,
                                         size_t len,
                                         Error **errp)
 {
-    return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
+    return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, sectorsize,
                                           offset, buf, len,
                                           qcrypto_cipher_decrypt, errp);
 }
@@ -449,51 +483,63 @@ int qcrypto_block_cipher_encrypt_helper(QCryptoCipher *cipher,
                                         size_t len,
                                         Error **errp)
 {
-    return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
+    return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, sectorsize,
                                           offset, buf, len,
                                           qcrypto_cipher_encrypt, errp);
 }
 
-int qcrypto_block_decrypt_helper(QCryptoBlock *block,
-                                 int sectorsize,
-                                 uint64_t offset,
-                                 uint8_t *buf,
-                                 size_t len,
-                                 Error **errp)
+static int qcrypto_block_encdec(QCryptoBlock *block,
+                                int sectorsize,
+                                uint64_t offset,
+                                uint8_t *buf,
+                                size_t len,
+                                QCryptoCipherEncDecFunc func,
+                                Error **errp)
 {
     int ret;
-    QCryptoCipher *cipher = qcrypto_block_pop_cipher(block, errp);
+    QCryptoIVGen *ivgen;
+    QCryptoCipher *cipher = qcrypto_block_pop_cipher(block, &ivgen, errp);
     if (!cipher) {
         return -1;
     }
 
-    ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
-                                         &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_decrypt, errp);
+    if (!ivgen && block->niv) {
+        ivgen = qcrypto_ivgen_new(block->ivgen_alg, block->ivgen_cipher_alg,
+                                  block->ivgen_hash_alg, block->ivgen_key,
+                                  block->nivgen_key, errp);
+        if (!ivgen) {
+            qcrypto_block_push_cipher(block, cipher, NULL);
+            return -1;
+        }
+    }
 
-    qcrypto_block_push_cipher(block, cipher);
+    ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, ivgen,
+                                         sectorsize, offset, buf, len, func,
+                                         errp);
+
+    qcrypto_block_push_cipher(block, cipher, ivgen);
 
     return ret;
 }
 
-int qcrypto_block_encrypt_helper(QCryptoBlock *block,
+int qcrypto_block_decrypt_helper(QCryptoBlock *block,
                                  int sectorsize,
                                  uint64_t offset,
                                  uint8_t *buf,
                                  size_t len,
                                  Error **errp)
 {
-    int ret;
-    QCryptoCipher *cipher = qcrypto_block_pop_cipher(block, errp);
-    if (!cipher) {
-        return -1;
-    }
-
-    ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
-                                         &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_encrypt, errp);
-
-    qcrypto_block_push_cipher(block, cipher);
+    return qcrypto_block_encdec(block, sectorsize, offset, buf, len,
+                                qcrypto_cipher_decrypt, errp);
+}
 
-    return ret;
+int qcrypto_block_encrypt_helper(QCryptoBlock *block,
+                                 int sectorsize,
+                                 uint64_t offset,
+                                 uint8_t *buf,
+                                 size_t len,
+                                 Error **errp)
+{
+    return qcrypto_block_encdec(block, sectorsize, offset, buf, len,
+                                qcrypto_cipher_encrypt, errp);
 }
@@ -38,7 +38,19 @@ struct QCryptoBlock {
     uint8_t *key;
     size_t nkey;
 
+    /* IV generator parameters */
+    QCryptoIVGenAlgo ivgen_alg;
+    QCryptoCipherAlgo ivgen_cipher_alg;
+    QCryptoHashAlgo ivgen_hash_alg;
+    uint8_t *ivgen_key;
+    size_t nivgen_key;
+
+    /*
+     * Each free cipher is paired with its own IV generator, created on
+     * first use, so that I/O only takes the mutex to pop and push them.
+     */
     QCryptoCipher **free_ciphers;
+    QCryptoIVGen **free_ivgens;
     size_t max_free_ciphers;
     size_t n_free_ciphers;
     QCryptoIVGen *ivgen;
@@ -139,4 +151,11 @@ int qcrypto_block_init_cipher(QCryptoBlock *block,
 
 void qcrypto_block_free_cipher(QCryptoBlock *block);
 
+int qcrypto_block_init_ivgen(QCryptoBlock *block,
+                             QCryptoIVGenAlgo alg,
+                             QCryptoCipherAlgo cipheralg,
+                             QCryptoHashAlgo hash,
+                             const uint8_t *key, size_t nkey,
+                             Error **errp);
+
 #endif /* QCRYPTO_BLOCKPRIV_H */
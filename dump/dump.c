@@ -1470,21 +1470,308 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     return 0;
 }
 
+/*
+ * Pages are compressed in batches by a pool of threads, while the dump
+ * thread gathers the next batch and writes out the previous one in order.
+ */
+#define DUMP_COMPRESS_BATCH     128
+#define DUMP_COMPRESS_THREADS   16
+
+typedef struct DumpCompressPage {
+    uint8_t *buf;       /* page contents, in guest RAM or in @copy */
+    uint8_t *copy;      /* for pages that straddle guest physical blocks */
+    uint8_t *out;       /* compressed page */
+    size_t size_out;
+    uint32_t flags;     /* DUMP_DH_COMPRESSED_* of @out, 0 to write @buf */
+    bool zero;
+} DumpCompressPage;
+
+typedef struct DumpCompressBatch {
+    DumpCompressPage pages[DUMP_COMPRESS_BATCH];
+    size_t num_pages;
+} DumpCompressBatch;
+
+typedef struct DumpCompressThread DumpCompressThread;
+
+typedef struct DumpCompressor {
+    DumpState *s;
+    size_t len_buf_out;
+    DumpCompressBatch batch[2];
+    /* batch handed to the threads, published by the start semaphores */
+    DumpCompressBatch *current;
+    DumpCompressThread *threads;
+    int num_threads;
+    bool quit;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+} DumpCompressor;
+
+struct DumpCompressThread {
+    DumpCompressor *c;
+    QemuThread thread;
+    QemuSemaphore start;
+    QemuSemaphore done;
+    int index;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+};
+
+static void dump_compress_page(DumpState *s, DumpCompressPage *p,
+                               size_t len_buf_out, void *wrkmem)
+{
+    size_t page_size = s->dump_info.page_size;
+    size_t size_out = len_buf_out;
+
+    p->zero = buffer_is_zero(p->buf, page_size);
+    if (p->zero) {
+        return;
+    }
+
+    /*
+     * only one compression format will be used here, for
+     * s->flag_compress is set. But when compression fails to work,
+     * we fall back to save in plaintext.
+     */
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        (compress2(p->out, (uLongf *)&size_out, p->buf, page_size,
+                   Z_BEST_SPEED) == Z_OK) &&
+        (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+               (lzo1x_1_compress(p->buf, page_size, p->out,
+                                 (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
+               (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+               (snappy_compress((char *)p->buf, page_size,
+                                (char *)p->out, &size_out) == SNAPPY_OK) &&
+               (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+    } else {
+        /*
+         * fall back to save in plaintext, size_out should be
+         * assigned the target's page size
+         */
+        p->flags = 0;
+        size_out = page_size;
+    }
+    p->size_out = size_out;
+}
+
+static void dump_compress_batch(DumpCompressor *c, DumpCompressBatch *b,
+                                int first, int stride, void *wrkmem)
+{
+    size_t i;
+
+    for (i = first; i < b->num_pages; i += stride) {
+        dump_compress_page(c->s, &b->pages[i], c->len_buf_out, wrkmem);
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressThread *t = opaque;
+    DumpCompressor *c = t->c;
+    void *wrkmem = NULL;
+
+#ifdef CONFIG_LZO
+    wrkmem = t->wrkmem;
+#endif
+
+    for (;;) {
+        qemu_sem_wait(&t->start);
+        if (c->quit) {
+            break;
+        }
+        dump_compress_batch(c, c->current, t->index, c->num_threads, wrkmem);
+        qemu_sem_post(&t->done);
+    }
+    return NULL;
+}
+
+static void dump_compressor_init(DumpCompressor *c, DumpState *s)
+{
+    size_t page_size = s->dump_info.page_size;
+    int i, j;
+
+    memset(c, 0, sizeof(*c));
+    c->s = s;
+    c->len_buf_out = get_len_buf_out(page_size, s->flag_compress);
+    assert(c->len_buf_out != 0);
+
+    for (i = 0; i < ARRAY_SIZE(c->batch); i++) {
+        for (j = 0; j < DUMP_COMPRESS_BATCH; j++) {
+            c->batch[i].pages[j].copy = g_malloc(page_size);
+            c->batch[i].pages[j].out = g_malloc(c->len_buf_out);
+        }
+    }
+
+    /* With a single host CPU, compress on the dump thread itself */
+    c->num_threads = MIN(g_get_num_processors(), DUMP_COMPRESS_THREADS);
+    if (c->num_threads <= 1) {
+        c->num_threads = 0;
+#ifdef CONFIG_LZO
+        c->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+        return;
+    }
+
+    c->threads = g_new0(DumpCompressThread, c->num_threads);
+    for (i = 0; i < c->num_threads; i++) {
+        DumpCompressThread *t = &c->threads[i];
+
+        t->c = c;
+        t->index = i;
+        qemu_sem_init(&t->start, 0);
+        qemu_sem_init(&t->done, 0);
+#ifdef CONFIG_LZO
+        t->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+        qemu_thread_create(&t->thread, "dump_compress", dump_compress_thread,
+                           t, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void dump_compressor_cleanup(DumpCompressor *c)
+{
+    int i, j;
+
+    c->quit = true;
+    for (i = 0; i < c->num_threads; i++) {
+        qemu_sem_post(&c->threads[i].start);
+    }
+    for (i = 0; i < c->num_threads; i++) {
+        DumpCompressThread *t = &c->threads[i];
+
+        qemu_thread_join(&t->thread);
+        qemu_sem_destroy(&t->start);
+        qemu_sem_destroy(&t->done);
+#ifdef CONFIG_LZO
+        g_free(t->wrkmem);
+#endif
+    }
+    g_free(c->threads);
+#ifdef CONFIG_LZO
+    g_free(c->wrkmem);
+#endif
+
+    for (i = 0; i < ARRAY_SIZE(c->batch); i++) {
+        for (j = 0; j < DUMP_COMPRESS_BATCH; j++) {
+            g_free(c->batch[i].pages[j].copy);
+            g_free(c->batch[i].pages[j].out);
+        }
+    }
+}
+
+/* Must be followed by dump_compressor_wait() before the next batch */
+static void dump_compressor_start(DumpCompressor *c, DumpCompressBatch *b)
+{
+    void *wrkmem = NULL;
+    int i;
+
+    if (!c->num_threads) {
+#ifdef CONFIG_LZO
+        wrkmem = c->wrkmem;
+#endif
+        dump_compress_batch(c, b, 0, 1, wrkmem);
+        return;
+    }
+
+    c->current = b;
+    for (i = 0; i < c->num_threads; i++) {
+        qemu_sem_post(&c->threads[i].start);
+    }
+}
+
+static void dump_compressor_wait(DumpCompressor *c)
+{
+    int i;
+
+    for (i = 0; i < c->num_threads; i++) {
+        qemu_sem_wait(&c->threads[i].done);
+    }
+}
+
+/* Gather the next pages of the guest, returns false once there are none */
+static bool dump_fill_batch(DumpState *s, DumpCompressBatch *b,
+                            GuestPhysBlock **block_iter, uint64_t *pfn_iter)
+{
+    b->num_pages = 0;
+    while (b->num_pages < DUMP_COMPRESS_BATCH) {
+        DumpCompressPage *p = &b->pages[b->num_pages];
+
+        p->buf = p->copy;
+        if (!get_next_page(block_iter, pfn_iter, &p->buf, s)) {
+            break;
+        }
+        b->num_pages++;
+    }
+    return b->num_pages > 0;
+}
+
+static int dump_write_batch(DumpState *s, DumpCompressBatch *b,
+                            DataCache *page_desc, DataCache *page_data,
+                            PageDescriptor *pd_zero, off_t *offset_data,
+                            Error **errp)
+{
+    PageDescriptor pd;
+    size_t i;
+    int ret;
+
+    for (i = 0; i < b->num_pages; i++) {
+        DumpCompressPage *p = &b->pages[i];
+
+        if (p->zero) {
+            ret = write_cache(page_desc, pd_zero, sizeof(PageDescriptor),
+                              false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return ret;
+            }
+        } else {
+            ret = write_cache(page_data, p->flags ? p->out : p->buf,
+                              p->size_out, false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                return ret;
+            }
+
+            /* get and write page desc here */
+            pd.flags = cpu_to_dump32(s, p->flags);
+            pd.size = cpu_to_dump32(s, p->size_out);
+            pd.page_flags = cpu_to_dump64(s, 0);
+            pd.offset = cpu_to_dump64(s, *offset_data);
+            *offset_data += p->size_out;
+
+            ret = write_cache(page_desc, &pd, sizeof(PageDescriptor), false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return ret;
+            }
+        }
+        s->written_size += s->dump_info.page_size;
+    }
+    return 0;
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    g_autofree DumpCompressor *c = g_new(DumpCompressor, 1);
+    DumpCompressBatch *cur, *next;
     off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
+    PageDescriptor pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
-    g_autofree uint8_t *page = NULL;
+    bool more;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1493,15 +1780,7 @@ static void write_dump_pages(DumpState *s, Error **errp)
     prepare_data_cache(&page_desc, s, offset_desc);
     prepare_data_cache(&page_data, s, offset_data);
 
-    /* prepare buffer to store compressed data */
-    len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
-    assert(len_buf_out != 0);
-
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    dump_compressor_init(c, s);
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1520,103 +1799,39 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
     offset_data += s->dump_info.page_size;
-    page = g_malloc(s->dump_info.page_size);
 
     /*
      * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * first page of page section.  While one batch is being compressed, the
+     * next one is gathered and then the compressed one is written.
      */
-    for (buf = page; get_next_page(&block_iter, &pfn_iter, &buf, s); buf = page) {
-        /* check zero page */
-        if (buffer_is_zero(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-            }
-
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+    cur = &c->batch[0];
+    next = &c->batch[1];
+    more = dump_fill_batch(s, cur, &block_iter, &pfn_iter);
+    if (more) {
+        dump_compressor_start(c, cur);
+    }
+    while (more) {
+        DumpCompressBatch *tmp;
+
+        more = dump_fill_batch(s, next, &block_iter, &pfn_iter);
+        dump_compressor_wait(c);
+        if (more) {
+            dump_compressor_start(c, next);
+        }
 
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+        ret = dump_write_batch(s, cur, &page_desc, &page_data, &pd_zero,
+                               &offset_data, errp);
+        if (ret < 0) {
+            if (more) {
+                dump_compressor_wait(c);
             }
+            goto out;
         }
-        s->written_size += s->dump_info.page_size;
+
+        tmp = cur;
+        cur = next;
+        next = tmp;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1633,12 +1848,7 @@ static void write_dump_pages(DumpState *s, Error **errp)
 out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
+    dump_compressor_cleanup(c);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
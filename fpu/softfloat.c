@@ -339,6 +339,37 @@ static inline bool f64_is_inf(union_float64 a)
     return float64_is_infinity(a.s);
 }
 
+/*
+ * Truncating an in-range zero or normal input to an integer can only
+ * raise inexact, so the host can do it when that flag is already set or
+ * when the input is an integer.  The bounds are exclusive.
+ */
+static inline bool f32_can_trunc_to_int(union_float32 a, double lo, double hi,
+                                        const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT || !float32_is_zero_or_normal(a.s)) {
+        return false;
+    }
+    if (!(a.h > lo && a.h < hi)) {
+        return false;
+    }
+    return (s->float_exception_flags & float_flag_inexact) ||
+           truncf(a.h) == a.h;
+}
+
+static inline bool f64_can_trunc_to_int(union_float64 a, double lo, double hi,
+                                        const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT || !float64_is_zero_or_normal(a.s)) {
+        return false;
+    }
+    if (!(a.h > lo && a.h < hi)) {
+        return false;
+    }
+    return (s->float_exception_flags & float_flag_inexact) ||
+           trunc(a.h) == a.h;
+}
+
 static inline float32
 float32_gen2(float32 xa, float32 xb, float_status *s,
              hard_f32_op2_fn hard, soft_f32_op2_fn soft,
@@ -3360,6 +3391,12 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
 
 int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
+    union_float32 ua;
+
+    ua.s = a;
+    if (f32_can_trunc_to_int(ua, INT32_MIN - 1.0, INT32_MAX + 1.0, s)) {
+        return ua.h;
+    }
     return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -3375,11 +3412,24 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
 
 int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
+    union_float64 ua;
+
+    ua.s = a;
+    if (f64_can_trunc_to_int(ua, INT32_MIN - 1.0, INT32_MAX + 1.0, s)) {
+        return ua.h;
+    }
     return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
+    union_float64 ua;
+
+    ua.s = a;
+    /* INT64_MIN - 1.0 rounds to INT64_MIN, which is left to softfloat */
+    if (f64_can_trunc_to_int(ua, INT64_MIN - 1.0, INT64_MAX + 1.0, s)) {
+        return ua.h;
+    }
     return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -3880,8 +3930,14 @@ float32 int64_to_float32_scalbn(int64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /*
+     * Without scaling, there are no overflow concerns.  Small integers
+     * convert exactly, so they need neither inexact nor the rounding mode.
+     */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT &&
+          a >= -(INT64_C(1) << 24) && a <= INT64_C(1) << 24))) {
         union_float32 ur;
         ur.h = a;
         return ur.s;
@@ -3920,8 +3976,14 @@ float64 int64_to_float64_scalbn(int64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /*
+     * Without scaling, there are no overflow concerns.  Small integers
+     * convert exactly, so they need neither inexact nor the rounding mode.
+     */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT &&
+          a >= -(INT64_C(1) << 53) && a <= INT64_C(1) << 53))) {
         union_float64 ur;
         ur.h = a;
         return ur.s;
@@ -4100,8 +4162,13 @@ float32 uint64_to_float32_scalbn(uint64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /*
+     * Without scaling, there are no overflow concerns.  Small integers
+     * convert exactly, so they need neither inexact nor the rounding mode.
+     */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT && a <= UINT64_C(1) << 24))) {
         union_float32 ur;
         ur.h = a;
         return ur.s;
@@ -4140,8 +4207,13 @@ float64 uint64_to_float64_scalbn(uint64_t a, int scale, float_status *status)
 {
     FloatParts64 p;
 
-    /* Without scaling, there are no overflow concerns. */
-    if (likely(scale == 0) && can_use_fpu(status)) {
+    /*
+     * Without scaling, there are no overflow concerns.  Small integers
+     * convert exactly, so they need neither inexact nor the rounding mode.
+     */
+    if (likely(scale == 0) &&
+        (can_use_fpu(status) ||
+         (!QEMU_NO_HARDFLOAT && a <= UINT64_C(1) << 53))) {
         union_float64 ur;
         ur.h = a;
         return ur.s;
@@ -4283,6 +4355,21 @@ static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
+    /*
+     * Distinct zero or normal inputs raise no flag and produce one of
+     * them: only NaNs, denormals, magnitudes and zeros of opposite sign
+     * need the full treatment.
+     */
+    if (!QEMU_NO_HARDFLOAT && !(flags & minmax_ismag)) {
+        union_float32 ua, ub;
+
+        ua.s = a;
+        ub.s = b;
+        if (f32_is_zon2(ua, ub) && ua.h != ub.h) {
+            return (ua.h < ub.h) == !!(flags & minmax_ismin) ? a : b;
+        }
+    }
+
     float32_unpack_canonical(&pa, a, s);
     float32_unpack_canonical(&pb, b, s);
     pr = parts_minmax(&pa, &pb, s, flags);
@@ -4294,6 +4381,16 @@ static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
+    if (!QEMU_NO_HARDFLOAT && !(flags & minmax_ismag)) {
+        union_float64 ua, ub;
+
+        ua.s = a;
+        ub.s = b;
+        if (f64_is_zon2(ua, ub) && ua.h != ub.h) {
+            return (ua.h < ub.h) == !!(flags & minmax_ismin) ? a : b;
+        }
+    }
+
     float64_unpack_canonical(&pa, a, s);
     float64_unpack_canonical(&pb, b, s);
     pr = parts_minmax(&pa, &pb, s, flags);
@@ -76,6 +76,10 @@ typedef struct ExtendedOps {
  * Disables certain performance warnings from being logged on host side.
  */
 #define V9FS_NO_PERF_WARN           0x00000800
+/*
+ * Cache file attributes, kept coherent with the host by inotify.
+ */
+#define V9FS_ATTR_CACHE             0x00001000
 
 #define V9FS_SEC_MASK               0x0000003C
 
@@ -270,6 +270,21 @@ SRST
     Show dynamic compiler opcode counters
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tcg-profile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show guest program counter samples",
+    },
+#endif
+
+SRST
+  ``info tcg-profile``
+    Show the guest program counters sampled since ``x-tcg-profile`` was
+    last enabled, most sampled first.
+ERST
+
     {
         .name       = "sync-profile",
         .args_type  = "mean:-m,no_coalesce:-n,max:i?",
@@ -839,6 +854,20 @@ SRST
     Display the vcpu dirty rate information.
 ERST
 
+    {
+        .name       = "ram_sharing",
+        .args_type  = "",
+        .params     = "",
+        .help       = "estimate how much of guest RAM could be merged",
+        .cmd        = hmp_info_ram_sharing,
+    },
+
+SRST
+  ``info ram_sharing``
+    Sample guest RAM and show, for each RAM block, how many of the
+    sampled pages are zero or found more than once.
+ERST
+
     {
         .name       = "vcpu_dirty_limit",
         .args_type  = "",
@@ -886,7 +915,7 @@ ERST
         .name       = "stats",
         .args_type  = "target:s,names:s?,provider:s?",
         .params     = "target [names] [provider]",
-        .help       = "show statistics for the given target (vm or vcpu); optionally filter by"
+        .help       = "show statistics for the given target (vm, vcpu, cryptodev, block, virtio, net or throttle-group); optionally filter by"
                       "name (comma-separated list, or * for all) and provider",
         .cmd        = hmp_info_stats,
     },
@@ -30,6 +30,8 @@
 #include "qapi/error.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/filemonitor.h"
+#include "qemu/lockable.h"
 #include "qemu/option.h"
 #include <libgen.h>
 #ifdef CONFIG_LINUX
@@ -53,10 +55,39 @@
 #define BTRFS_SUPER_MAGIC 0x9123683E
 #endif
 
+/*
+ * Bounds of the attribute cache.  Entries are only cached while all of
+ * their parent directories are watched, see local_attr_cache_watch_path().
+ */
+#define LOCAL_ATTR_CACHE_MAX_ENTRIES    65536
+#define LOCAL_ATTR_CACHE_MAX_WATCHES    8192
+
 typedef struct {
     int mountfd;
+
+    /* The rest is only used with cache=metadata */
+    QFileMonitor *mon;
+    /* Serializes changes to the watches with the file monitor */
+    QemuMutex watch_lock;
+    /* Protects attrs, watches, cache_gen and stale_watches */
+    QemuMutex cache_lock;
+    /* Path relative to the export root -> struct stat */
+    GHashTable *attrs;
+    /* Directory relative to the export root -> LocalCacheWatch */
+    GHashTable *watches;
+    /* Bumped on every invalidation, see local_attr_cache_insert() */
+    uint64_t cache_gen;
+    unsigned int stale_watches;
 } LocalData;
 
+typedef struct LocalCacheWatch {
+    LocalData *data;
+    char *dir;
+    int64_t id;
+    /* The directory may have moved, the watch must be set up again */
+    bool stale;
+} LocalCacheWatch;
+
 int local_open_nofollow(FsContext *fs_ctx, const char *path, int flags,
                         mode_t mode)
 {
@@ -182,7 +213,258 @@ static void local_mapped_file_attr(int dirfd, const char *name,
     fclose(fp);
 }
 
-static int local_lstat(FsContext *fs_ctx, V9fsPath *fs_path, struct stat *stbuf)
+static void local_cache_watch_free(gpointer opaque)
+{
+    LocalCacheWatch *w = opaque;
+
+    g_free(w->dir);
+    g_free(w);
+}
+
+static bool local_path_is_under(const char *path, const char *dir)
+{
+    size_t len = strlen(dir);
+
+    return !strncmp(path, dir, len) && (!path[len] || path[len] == '/');
+}
+
+static gboolean local_attr_cache_is_under(gpointer key, gpointer value,
+                                          gpointer opaque)
+{
+    return local_path_is_under(key, opaque);
+}
+
+static void local_cache_watch_mark_stale(gpointer key, gpointer value,
+                                         gpointer opaque)
+{
+    LocalCacheWatch *w = value;
+
+    if (!w->stale && local_path_is_under(w->dir, opaque)) {
+        w->stale = true;
+        w->data->stale_watches++;
+    }
+}
+
+static gboolean local_cache_watch_steal_stale(gpointer key, gpointer value,
+                                              gpointer opaque)
+{
+    LocalCacheWatch *w = value;
+
+    if (w->stale) {
+        g_ptr_array_add(opaque, w);
+    }
+    return w->stale;
+}
+
+/* @path and everything below it is gone, or somewhere else now */
+static void local_attr_cache_forget_locked(LocalData *data, const char *path)
+{
+    data->cache_gen++;
+    g_hash_table_foreach_remove(data->attrs, local_attr_cache_is_under,
+                                (gpointer)path);
+    g_hash_table_foreach(data->watches, local_cache_watch_mark_stale,
+                         (gpointer)path);
+}
+
+static void local_attr_cache_event(int64_t id, QFileMonitorEvent event,
+                                   const char *filename, void *opaque)
+{
+    LocalCacheWatch *w = opaque;
+    LocalData *data = w->data;
+    g_autofree char *path = NULL;
+
+    QEMU_LOCK_GUARD(&data->cache_lock);
+
+    if (event == QFILE_MONITOR_EVENT_OVERFLOW) {
+        /*
+         * Any change, including the move of a watched directory, may have
+         * been missed, so start over.  Every watch gets this, only the
+         * first one needs to do the work.
+         */
+        if (data->stale_watches < g_hash_table_size(data->watches)) {
+            local_attr_cache_forget_locked(data, ".");
+        }
+        return;
+    }
+
+    data->cache_gen++;
+    /* Whatever happened, the directory itself may have changed as well */
+    g_hash_table_remove(data->attrs, w->dir);
+
+    if (event == QFILE_MONITOR_EVENT_IGNORED) {
+        /* The directory was removed */
+        local_attr_cache_forget_locked(data, w->dir);
+        return;
+    }
+    if (!*filename) {
+        return;
+    }
+
+    path = g_strdup_printf("%s/%s", w->dir, filename);
+    if (event == QFILE_MONITOR_EVENT_DELETED) {
+        /* This includes renames, which take the whole subtree along */
+        local_attr_cache_forget_locked(data, path);
+    } else {
+        g_hash_table_remove(data->attrs, path);
+    }
+}
+
+/* Returns whether changes to the entries of @dir are tracked */
+static bool local_attr_cache_watch_dir(FsContext *ctx, const char *dir)
+{
+    LocalData *data = ctx->private;
+    g_autoptr(GPtrArray) stale = g_ptr_array_new();
+    g_autofree char *host_path = NULL;
+    LocalCacheWatch *w;
+
+    /*
+     * The file monitor calls local_attr_cache_event() with its own lock
+     * held, so cache_lock must not be held while calling into it.
+     */
+    QEMU_LOCK_GUARD(&data->watch_lock);
+
+    WITH_QEMU_LOCK_GUARD(&data->cache_lock) {
+        w = g_hash_table_lookup(data->watches, dir);
+        if (w && !w->stale) {
+            return true;
+        }
+        /*
+         * The file monitor knows directories by their path, and inotify by
+         * their inode.  Drop all stale watches before adding one, a moved
+         * directory is watched under its old path until then.
+         */
+        if (data->stale_watches) {
+            g_hash_table_foreach_steal(data->watches,
+                                       local_cache_watch_steal_stale, stale);
+            data->stale_watches = 0;
+        }
+        if (g_hash_table_size(data->watches) >=
+            LOCAL_ATTR_CACHE_MAX_WATCHES) {
+            return false;
+        }
+    }
+
+    for (guint i = 0; i < stale->len; i++) {
+        g_autofree char *old_path = NULL;
+
+        w = g_ptr_array_index(stale, i);
+        old_path = g_strdup_printf("%s/%s", ctx->fs_root, w->dir);
+        qemu_file_monitor_remove_watch(data->mon, old_path, w->id);
+        local_cache_watch_free(w);
+    }
+    host_path = g_strdup_printf("%s/%s", ctx->fs_root, dir);
+
+    w = g_new0(LocalCacheWatch, 1);
+    w->data = data;
+    w->dir = g_strdup(dir);
+    /* Insert it first, so that the events of a move can mark it stale */
+    WITH_QEMU_LOCK_GUARD(&data->cache_lock) {
+        g_hash_table_insert(data->watches, w->dir, w);
+    }
+
+    w->id = qemu_file_monitor_add_watch(data->mon, host_path, NULL,
+                                        local_attr_cache_event, w, NULL);
+    if (w->id < 0) {
+        WITH_QEMU_LOCK_GUARD(&data->cache_lock) {
+            g_hash_table_remove(data->watches, dir);
+        }
+        return false;
+    }
+    return true;
+}
+
+/*
+ * A path is only cached while all directories above it are watched, so
+ * that a rename of any of them is seen.
+ */
+static bool local_attr_cache_watch_path(FsContext *ctx, const char *path)
+{
+    g_autofree char *dir = g_strdup(path);
+    char *sep;
+
+    if (!strcmp(path, ".")) {
+        return local_attr_cache_watch_dir(ctx, ".");
+    }
+    if (!g_str_has_prefix(path, "./")) {
+        return false;
+    }
+
+    while ((sep = strrchr(dir, '/'))) {
+        *sep = '\0';
+        if (!local_attr_cache_watch_dir(ctx, dir)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool local_attr_cache_lookup(FsContext *ctx, const char *path,
+                                    struct stat *stbuf, uint64_t *gen)
+{
+    LocalData *data = ctx->private;
+    struct stat *st;
+
+    QEMU_LOCK_GUARD(&data->cache_lock);
+    st = g_hash_table_lookup(data->attrs, path);
+    if (st) {
+        *stbuf = *st;
+        return true;
+    }
+    *gen = data->cache_gen;
+    return false;
+}
+
+/*
+ * @gen is the generation read by local_attr_cache_lookup() before @stbuf
+ * was retrieved.  If anything was invalidated since then, @stbuf may be
+ * out of date already.
+ */
+static void local_attr_cache_insert(FsContext *ctx, const char *path,
+                                    const struct stat *stbuf, uint64_t gen)
+{
+    LocalData *data = ctx->private;
+
+    QEMU_LOCK_GUARD(&data->cache_lock);
+    if (gen != data->cache_gen) {
+        return;
+    }
+    if (g_hash_table_size(data->attrs) >= LOCAL_ATTR_CACHE_MAX_ENTRIES) {
+        g_hash_table_remove_all(data->attrs);
+    }
+    g_hash_table_replace(data->attrs, g_strdup(path),
+                         g_memdup2(stbuf, sizeof(*stbuf)));
+}
+
+/*
+ * Called after every operation that modifies the export.  inotify reports
+ * the changes as well, but only later on from the main loop, so forget
+ * all attributes right away.  If the operation removed or renamed an
+ * entry, @dir and @name designate it.
+ */
+static void local_attr_cache_invalidate(FsContext *ctx, const char *dir,
+                                        const char *name)
+{
+    LocalData *data = ctx->private;
+    g_autofree char *path = NULL;
+    int saved_errno = errno;
+
+    if (!(ctx->export_flags & V9FS_ATTR_CACHE)) {
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&data->cache_lock) {
+        data->cache_gen++;
+        g_hash_table_remove_all(data->attrs);
+        if (dir) {
+            path = g_strdup_printf("%s/%s", dir, name);
+            local_attr_cache_forget_locked(data, path);
+        }
+    }
+    errno = saved_errno;
+}
+
+static int local_do_lstat(FsContext *fs_ctx, V9fsPath *fs_path,
+                          struct stat *stbuf)
 {
     int err = -1;
     char *dirpath = g_path_get_dirname(fs_path->data);
@@ -233,6 +515,26 @@ out:
     return err;
 }
 
+static int local_lstat(FsContext *fs_ctx, V9fsPath *fs_path, struct stat *stbuf)
+{
+    bool cache = fs_ctx->export_flags & V9FS_ATTR_CACHE;
+    uint64_t gen = 0;
+    int err;
+
+    if (cache) {
+        if (local_attr_cache_lookup(fs_ctx, fs_path->data, stbuf, &gen)) {
+            return 0;
+        }
+        cache = local_attr_cache_watch_path(fs_ctx, fs_path->data);
+    }
+
+    err = local_do_lstat(fs_ctx, fs_path, stbuf);
+    if (!err && cache) {
+        local_attr_cache_insert(fs_ctx, fs_path->data, stbuf, gen);
+    }
+    return err;
+}
+
 static int local_set_mapped_file_attrat(int dirfd, const char *name,
                                         FsCred *credp)
 {
@@ -508,6 +810,9 @@ static int local_open(FsContext *ctx, V9fsPath *fs_path,
     int fd;
 
     fd = local_open_nofollow(ctx, fs_path->data, flags, 0);
+    if (flags & O_TRUNC) {
+        local_attr_cache_invalidate(ctx, NULL, NULL);
+    }
     if (fd == -1) {
         return -1;
     }
@@ -630,6 +935,7 @@ static ssize_t local_pwritev(FsContext *ctx, V9fsFidOpenState *fs,
                         SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE);
     }
 #endif
+    local_attr_cache_invalidate(ctx, NULL, NULL);
     return ret;
 }
 
@@ -658,6 +964,7 @@ static int local_chmod(FsContext *fs_ctx, V9fsPath *fs_path, FsCred *credp)
 out:
     g_free(dirpath);
     g_free(name);
+    local_attr_cache_invalidate(fs_ctx, NULL, NULL);
     return ret;
 }
 
@@ -710,6 +1017,7 @@ err_end:
     unlinkat_preserve_errno(dirfd, name, 0);
 out:
     close_preserve_errno(dirfd);
+    local_attr_cache_invalidate(fs_ctx, NULL, NULL);
     return err;
 }
 
@@ -763,6 +1071,7 @@ err_end:
     unlinkat_preserve_errno(dirfd, name, AT_REMOVEDIR);
 out:
     close_preserve_errno(dirfd);
+    local_attr_cache_invalidate(fs_ctx, NULL, NULL);
     return err;
 }
 
@@ -872,6 +1181,7 @@ err_end:
     close_preserve_errno(fd);
 out:
     close_preserve_errno(dirfd);
+    local_attr_cache_invalidate(fs_ctx, NULL, NULL);
     return err;
 }
 
@@ -949,6 +1259,7 @@ err_end:
     unlinkat_preserve_errno(dirfd, name, 0);
 out:
     close_preserve_errno(dirfd);
+    local_attr_cache_invalidate(fs_ctx, NULL, NULL);
     return err;
 }
 
@@ -1023,6 +1334,7 @@ out_close:
 out:
     g_free(oname);
     g_free(odirpath);
+    local_attr_cache_invalidate(ctx, NULL, NULL);
     return ret;
 }
 
@@ -1036,6 +1348,7 @@ static int local_truncate(FsContext *ctx, V9fsPath *fs_path, off_t size)
     }
     ret = ftruncate(fd, size);
     close_preserve_errno(fd);
+    local_attr_cache_invalidate(ctx, NULL, NULL);
     return ret;
 }
 
@@ -1066,6 +1379,7 @@ static int local_chown(FsContext *fs_ctx, V9fsPath *fs_path, FsCred *credp)
 out:
     g_free(name);
     g_free(dirpath);
+    local_attr_cache_invalidate(fs_ctx, NULL, NULL);
     return ret;
 }
 
@@ -1086,6 +1400,7 @@ static int local_utimensat(FsContext *s, V9fsPath *fs_path,
 out:
     g_free(dirpath);
     g_free(name);
+    local_attr_cache_invalidate(s, NULL, NULL);
     return ret;
 }
 
@@ -1156,6 +1471,7 @@ static int local_remove(FsContext *ctx, const char *path)
     }
 
     err = local_unlinkat_common(ctx, dirfd, name, flags);
+    local_attr_cache_invalidate(ctx, dirpath, name);
 err_out:
     close_preserve_errno(dirfd);
 out:
@@ -1215,16 +1531,22 @@ static int local_lsetxattr(FsContext *ctx, V9fsPath *fs_path, const char *name,
                            void *value, size_t size, int flags)
 {
     char *path = fs_path->data;
+    int ret;
 
-    return v9fs_set_xattr(ctx, path, name, value, size, flags);
+    ret = v9fs_set_xattr(ctx, path, name, value, size, flags);
+    local_attr_cache_invalidate(ctx, NULL, NULL);
+    return ret;
 }
 
 static int local_lremovexattr(FsContext *ctx, V9fsPath *fs_path,
                               const char *name)
 {
     char *path = fs_path->data;
+    int ret;
 
-    return v9fs_remove_xattr(ctx, path, name);
+    ret = v9fs_remove_xattr(ctx, path, name);
+    local_attr_cache_invalidate(ctx, NULL, NULL);
+    return ret;
 }
 
 static int local_name_to_path(FsContext *ctx, V9fsPath *dir_path,
@@ -1335,6 +1657,7 @@ err_undo_rename:
 out:
     close_preserve_errno(ndirfd);
     close_preserve_errno(odirfd);
+    local_attr_cache_invalidate(ctx, olddir->data, old_name);
     return ret;
 }
 
@@ -1384,6 +1707,7 @@ static int local_unlinkat(FsContext *ctx, V9fsPath *dir,
 
     ret = local_unlinkat_common(ctx, dirfd, name, flags);
     close_preserve_errno(dirfd);
+    local_attr_cache_invalidate(ctx, dir->data, name);
     return ret;
 }
 
@@ -1439,7 +1763,8 @@ static int local_ioc_getversion_init(FsContext *ctx, LocalData *data, Error **er
 
 static int local_init(FsContext *ctx, Error **errp)
 {
-    LocalData *data = g_malloc(sizeof(*data));
+    ERRP_GUARD();
+    LocalData *data = g_new0(LocalData, 1);
 
     data->mountfd = open(ctx->fs_root, O_DIRECTORY | O_RDONLY);
     if (data->mountfd == -1) {
@@ -1467,6 +1792,21 @@ static int local_init(FsContext *ctx, Error **errp)
     }
     ctx->export_flags |= V9FS_PATHNAME_FSCONTEXT;
 
+    if (ctx->export_flags & V9FS_ATTR_CACHE) {
+        data->mon = qemu_file_monitor_new(errp);
+        if (!data->mon) {
+            error_prepend(errp, "cache=metadata needs inotify: ");
+            close(data->mountfd);
+            goto err;
+        }
+        qemu_mutex_init(&data->watch_lock);
+        qemu_mutex_init(&data->cache_lock);
+        data->attrs = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, g_free);
+        data->watches = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                              local_cache_watch_free);
+    }
+
     ctx->private = data;
     return 0;
 
@@ -1483,6 +1823,15 @@ static void local_cleanup(FsContext *ctx)
         return;
     }
 
+    if (data->mon) {
+        /* No more events after this */
+        qemu_file_monitor_free(data->mon);
+        g_hash_table_destroy(data->watches);
+        g_hash_table_destroy(data->attrs);
+        qemu_mutex_destroy(&data->cache_lock);
+        qemu_mutex_destroy(&data->watch_lock);
+    }
+
     close(data->mountfd);
     g_free(data);
 }
@@ -1499,6 +1848,7 @@ static int local_parse_opts(QemuOpts *opts, FsDriverEntry *fse, Error **errp)
     const char *sec_model = qemu_opt_get(opts, "security_model");
     const char *path = qemu_opt_get(opts, "path");
     const char *multidevs = qemu_opt_get(opts, "multidevs");
+    const char *cache = qemu_opt_get(opts, "cache");
 
     if (!sec_model) {
         error_setg(errp, "security_model property not set");
@@ -1540,6 +1890,25 @@ static int local_parse_opts(QemuOpts *opts, FsDriverEntry *fse, Error **errp)
         }
     }
 
+    if (cache) {
+        if (!strcmp(cache, "metadata")) {
+            fse->export_flags |= V9FS_ATTR_CACHE;
+        } else if (strcmp(cache, "none")) {
+            error_setg(errp, "invalid cache property '%s'", cache);
+            error_append_hint(errp, "Valid options are: cache="
+                              "[none|metadata]\n");
+            return -1;
+        }
+    }
+
+    if (fse->export_flags & V9FS_ATTR_CACHE &&
+        fse->export_flags & V9FS_SM_MAPPED_FILE) {
+        /* Changes to the metadata files would go unnoticed */
+        error_setg(errp, "cache=metadata is not supported with "
+                   "security_model=mapped-file");
+        return -1;
+    }
+
     if (!path) {
         error_setg(errp, "path property not set");
         return -1;
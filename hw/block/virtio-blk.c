@@ -18,6 +18,7 @@
 #include "qemu/module.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/rcu.h"
 #include "block/block_int.h"
 #include "trace.h"
 #include "hw/block/block.h"
@@ -35,6 +36,7 @@
 #include "migration/qemu-file-types.h"
 #include "hw/virtio/virtio-access.h"
 #include "hw/virtio/virtio-blk-common.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "qemu/coroutine.h"
 
 static void virtio_blk_ioeventfd_attach(VirtIOBlock *s);
@@ -52,25 +54,114 @@ static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
 
 static void virtio_blk_free_request(VirtIOBlockReq *req)
 {
-    g_free(req);
+    virtqueue_element_free(req);
+}
+
+/*
+ * Completed requests are put into the used ring right away, but the used
+ * index is only published once per defer_call_begin()/defer_call_end()
+ * section.  Interrupts can additionally be coalesced with the
+ * irq-coalesce-usecs and irq-coalesce-count properties.
+ *
+ * All fields are only accessed from the virtqueue's AioContext, or with
+ * the BQL held when ioeventfd is not in use.
+ */
+typedef struct VirtIOBlockVqCompletion {
+    VirtIOBlock *s;
+    VirtQueue *vq;
+    unsigned pending_used;  /* used elements filled but not flushed yet */
+    unsigned pending_irqs;  /* used elements flushed since the last irq */
+    QEMUTimer *irq_timer;   /* only with irq-coalesce-usecs > 0 */
+} VirtIOBlockVqCompletion;
+
+static void virtio_blk_vq_notify(VirtIOBlockVqCompletion *c)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(c->s);
+
+    if (qemu_in_iothread()) {
+        virtio_notify_irqfd(vdev, c->vq);
+    } else {
+        virtio_notify(vdev, c->vq);
+    }
+}
+
+/* Send the interrupt for coalesced completions */
+static void virtio_blk_vq_irq(void *opaque)
+{
+    VirtIOBlockVqCompletion *c = opaque;
+
+    trace_virtio_blk_irq_coalesced(c->s, c->vq, c->pending_irqs);
+    c->pending_irqs = 0;
+    virtio_blk_vq_notify(c);
+
+    /* Taken in virtio_blk_vq_flush() */
+    blk_dec_in_flight(c->s->blk);
+}
+
+/* Called by defer_call_end() or immediately if not in a deferred section */
+static void virtio_blk_vq_flush(void *opaque)
+{
+    VirtIOBlockVqCompletion *c = opaque;
+    VirtIOBlock *s = c->s;
+    unsigned n = c->pending_used;
+
+    c->pending_used = 0;
+    WITH_RCU_READ_LOCK_GUARD() {
+        virtqueue_flush(c->vq, n);
+    }
+
+    /*
+     * Coalescing needs the timer, which runs in the virtqueue's AioContext.
+     * Completions elsewhere (e.g. in the main loop while ioeventfd is off)
+     * are signalled immediately.
+     */
+    if (!c->irq_timer || !qemu_in_iothread() ||
+        qemu_get_current_aio_context() !=
+            s->vq_aio_context[virtio_get_queue_index(c->vq)]) {
+        virtio_blk_vq_notify(c);
+    } else {
+        if (c->pending_irqs == 0) {
+            /* Keep drain waiting until the interrupt has been sent */
+            blk_inc_in_flight(s->blk);
+            timer_mod(c->irq_timer, qemu_clock_get_us(QEMU_CLOCK_REALTIME) +
+                                    s->conf.irq_coalesce_usecs);
+        }
+        c->pending_irqs += n;
+        if (s->conf.irq_coalesce_count &&
+            c->pending_irqs >= s->conf.irq_coalesce_count) {
+            timer_del(c->irq_timer);
+            virtio_blk_vq_irq(c);
+        }
+    }
+
+    /* Taken in virtio_blk_req_complete() */
+    blk_dec_in_flight(s->blk);
 }
 
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlock *s = req->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    VirtIOBlockVqCompletion *c =
+        &s->vq_completion[virtio_get_queue_index(req->vq)];
 
     trace_virtio_blk_req_complete(vdev, req, status);
 
     stb_p(&req->in->status, status);
     iov_discard_undo(&req->inhdr_undo);
     iov_discard_undo(&req->outhdr_undo);
-    virtqueue_push(req->vq, &req->elem, req->in_len);
-    if (qemu_in_iothread()) {
-        virtio_notify_irqfd(vdev, req->vq);
-    } else {
-        virtio_notify(vdev, req->vq);
+
+    if (c->pending_used == 0) {
+        /*
+         * Until the used index is published, drain must not consider this
+         * request complete.  Released in virtio_blk_vq_flush().
+         */
+        blk_inc_in_flight(s->blk);
     }
+    WITH_RCU_READ_LOCK_GUARD() {
+        virtqueue_fill(req->vq, &req->elem, req->in_len, c->pending_used++);
+    }
+    defer_call(virtio_blk_vq_flush, c);
 }
 
 static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
@@ -156,25 +247,34 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
 
 static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
 {
-    VirtIOBlockReq *req = opaque;
-    VirtIOBlock *s = req->dev;
-    bool is_write_zeroes = (virtio_ldl_p(VIRTIO_DEVICE(s), &req->out.type) &
+    VirtIOBlockReq *next = opaque;
+    VirtIOBlock *s = next->dev;
+    bool is_write_zeroes = (virtio_ldl_p(VIRTIO_DEVICE(s), &next->out.type) &
                             ~VIRTIO_BLK_T_BARRIER) == VIRTIO_BLK_T_WRITE_ZEROES;
 
-    if (ret && virtio_blk_handle_rw_error(req, -ret, false, is_write_zeroes)) {
-        return;
-    }
+    /* Merged requests are all of the same type */
+    while (next) {
+        VirtIOBlockReq *req = next;
+        next = req->mr_next;
 
-    virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-    if (is_write_zeroes) {
-        block_acct_done(blk_get_stats(s->blk), &req->acct);
+        if (ret &&
+            virtio_blk_handle_rw_error(req, -ret, false, is_write_zeroes)) {
+            continue;
+        }
+
+        virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
+        if (is_write_zeroes) {
+            block_acct_done(blk_get_stats(s->blk), &req->acct);
+        }
+        virtio_blk_free_request(req);
     }
-    virtio_blk_free_request(req);
 }
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq,
+                                              VirtQueuePopBatch *batch)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    VirtIOBlockReq *req = virtqueue_pop_batched(vq, sizeof(VirtIOBlockReq),
+                                                batch);
 
     if (req) {
         virtio_blk_init_request(s, vq, req);
@@ -339,6 +439,81 @@ static void virtio_blk_submit_multireq(VirtIOBlock *s, MultiReqBuffer *mrb)
     mrb->num_reqs = 0;
 }
 
+static void virtio_blk_submit_dwz(VirtIOBlock *s, MultiReqBuffer *mrb)
+{
+    VirtIOBlockReq *req = mrb->dwz_head;
+    int64_t offset = mrb->dwz_sector << BDRV_SECTOR_BITS;
+    int64_t bytes = (int64_t)mrb->dwz_num_sectors << BDRV_SECTOR_BITS;
+
+    if (!req) {
+        return;
+    }
+
+    mrb->dwz_head = mrb->dwz_tail = NULL;
+
+    if (mrb->dwz_is_write_zeroes) { /* VIRTIO_BLK_T_WRITE_ZEROES */
+        int blk_aio_flags = 0;
+
+        if (mrb->dwz_flags & VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP) {
+            blk_aio_flags |= BDRV_REQ_MAY_UNMAP;
+        }
+
+        blk_aio_pwrite_zeroes(s->blk, offset, bytes, blk_aio_flags,
+                              virtio_blk_discard_write_zeroes_complete, req);
+    } else { /* VIRTIO_BLK_T_DISCARD */
+        blk_aio_pdiscard(s->blk, offset, bytes,
+                         virtio_blk_discard_write_zeroes_complete, req);
+    }
+}
+
+/*
+ * Queue a discard or write zeroes request.  It is merged with the previous
+ * one if both are of the same kind and cover adjacent sector ranges.
+ */
+static void virtio_blk_add_dwz(VirtIOBlockReq *req, MultiReqBuffer *mrb,
+                               uint64_t sector, uint32_t num_sectors,
+                               uint32_t flags, bool is_write_zeroes,
+                               uint32_t max_sectors)
+{
+    VirtIOBlock *s = req->dev;
+
+    if (mrb->dwz_head &&
+        (is_write_zeroes != mrb->dwz_is_write_zeroes ||
+         flags != mrb->dwz_flags ||
+         sector != mrb->dwz_sector + mrb->dwz_num_sectors ||
+         num_sectors > max_sectors - mrb->dwz_num_sectors)) {
+        virtio_blk_submit_dwz(s, mrb);
+    }
+
+    if (mrb->dwz_head) {
+        mrb->dwz_tail->mr_next = req;
+        mrb->dwz_tail = req;
+        mrb->dwz_num_sectors += num_sectors;
+        if (is_write_zeroes) {
+            block_acct_merge_done(blk_get_stats(s->blk), BLOCK_ACCT_WRITE, 1);
+        }
+    } else {
+        mrb->dwz_head = mrb->dwz_tail = req;
+        mrb->dwz_sector = sector;
+        mrb->dwz_num_sectors = num_sectors;
+        mrb->dwz_flags = flags;
+        mrb->dwz_is_write_zeroes = is_write_zeroes;
+    }
+
+    if (!s->conf.request_merging) {
+        virtio_blk_submit_dwz(s, mrb);
+    }
+}
+
+/* Submit everything that was collected in @mrb */
+static void virtio_blk_submit_mrb(VirtIOBlock *s, MultiReqBuffer *mrb)
+{
+    virtio_blk_submit_dwz(s, mrb);
+    if (mrb->num_reqs) {
+        virtio_blk_submit_multireq(s, mrb);
+    }
+}
+
 static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 {
     VirtIOBlock *s = req->dev;
@@ -378,7 +553,8 @@ static bool virtio_blk_sect_range_ok(VirtIOBlock *dev,
 }
 
 static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
-    struct virtio_blk_discard_write_zeroes *dwz_hdr, bool is_write_zeroes)
+    MultiReqBuffer *mrb, struct virtio_blk_discard_write_zeroes *dwz_hdr,
+    bool is_write_zeroes)
 {
     VirtIOBlock *s = req->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
@@ -420,18 +596,8 @@ static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
     }
 
     if (is_write_zeroes) { /* VIRTIO_BLK_T_WRITE_ZEROES */
-        int blk_aio_flags = 0;
-
-        if (flags & VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP) {
-            blk_aio_flags |= BDRV_REQ_MAY_UNMAP;
-        }
-
         block_acct_start(blk_get_stats(s->blk), &req->acct, bytes,
                          BLOCK_ACCT_WRITE);
-
-        blk_aio_pwrite_zeroes(s->blk, sector << BDRV_SECTOR_BITS,
-                              bytes, blk_aio_flags,
-                              virtio_blk_discard_write_zeroes_complete, req);
     } else { /* VIRTIO_BLK_T_DISCARD */
         /*
          * The device MUST set the status byte to VIRTIO_BLK_S_UNSUPP for
@@ -441,11 +607,10 @@ static uint8_t virtio_blk_handle_discard_write_zeroes(VirtIOBlockReq *req,
             err_status = VIRTIO_BLK_S_UNSUPP;
             goto err;
         }
-
-        blk_aio_pdiscard(s->blk, sector << BDRV_SECTOR_BITS, bytes,
-                         virtio_blk_discard_write_zeroes_complete, req);
     }
 
+    virtio_blk_add_dwz(req, mrb, sector, num_sectors, flags, is_write_zeroes,
+                       max_sectors);
     return VIRTIO_BLK_S_OK;
 
 err:
@@ -832,6 +997,13 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
     type = virtio_ldl_p(vdev, &req->out.type);
 
+    /* Keep discard and write zeroes ordered against other requests */
+    if (mrb->dwz_head &&
+        (type & ~VIRTIO_BLK_T_BARRIER) != VIRTIO_BLK_T_DISCARD &&
+        (type & ~VIRTIO_BLK_T_BARRIER) != VIRTIO_BLK_T_WRITE_ZEROES) {
+        virtio_blk_submit_dwz(s, mrb);
+    }
+
     /* VIRTIO_BLK_T_OUT defines the command direction. VIRTIO_BLK_T_BARRIER
      * is an optional flag. Although a guest should not send this flag if
      * not negotiated we ignored it in the past. So keep ignoring it. */
@@ -956,7 +1128,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
             return -1;
         }
 
-        err_status = virtio_blk_handle_discard_write_zeroes(req, &dwz_hdr,
+        err_status = virtio_blk_handle_discard_write_zeroes(req, mrb, &dwz_hdr,
                                                             is_write_zeroes);
         if (err_status != VIRTIO_BLK_S_OK) {
             virtio_blk_req_complete(req, err_status);
@@ -972,12 +1144,127 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     return 0;
 }
 
+/*
+ * With merge-window-usecs, read/write requests that continue a sequential
+ * stream are held back for a short while when the virtqueue runs empty, so
+ * that they can be merged with requests from the guest's next kick.  This
+ * helps guests that submit sequential I/O one request per kick.  The window
+ * starts with the first held request and is not extended by later ones.
+ *
+ * Nothing is held back in drained sections: drained_begin submits the held
+ * requests, and new windows only open again after drained_end.
+ *
+ * Except for @drained, all fields are only accessed from the virtqueue's
+ * AioContext.
+ */
+typedef struct VirtIOBlockVqMerge {
+    VirtIOBlock *s;
+    MultiReqBuffer mrb;     /* held requests, read/write only */
+    uint64_t next_sector;   /* sector following the last request */
+    bool open;              /* window timer armed and in-flight ref held */
+    bool drained;           /* atomic, set by the main loop */
+    QEMUTimer *timer;
+} VirtIOBlockVqMerge;
+
+static void virtio_blk_merge_window_expired(void *opaque)
+{
+    VirtIOBlockVqMerge *m = opaque;
+    MultiReqBuffer mrb = m->mrb;
+
+    m->mrb.num_reqs = 0;
+    m->open = false;
+
+    if (mrb.num_reqs) {
+        trace_virtio_blk_merge_window_expired(m->s, mrb.num_reqs);
+        defer_call_begin();
+        virtio_blk_submit_multireq(m->s, &mrb);
+        defer_call_end();
+    }
+
+    /* Taken in virtio_blk_merge_window_hold() */
+    blk_dec_in_flight(m->s->blk);
+}
+
+/* Submit the held requests right away */
+static void virtio_blk_merge_window_flush(VirtIOBlockVqMerge *m)
+{
+    if (m->open) {
+        timer_del(m->timer);
+        virtio_blk_merge_window_expired(m);
+    }
+}
+
+static void virtio_blk_merge_window_flush_bh(void *opaque)
+{
+    VirtIOBlockVqMerge *m = opaque;
+
+    virtio_blk_merge_window_flush(m);
+
+    /* Taken in virtio_blk_drained_begin() */
+    blk_dec_in_flight(m->s->blk);
+}
+
+/*
+ * Returns true if the read/write requests in @mrb were taken over by the
+ * merge window, false if the caller must submit them.
+ */
+static bool virtio_blk_merge_window_hold(VirtIOBlockVqMerge *m,
+                                         MultiReqBuffer *mrb)
+{
+    VirtIOBlockReq *last = mrb->reqs[mrb->num_reqs - 1];
+    bool sequential = last->sector_num == m->next_sector;
+
+    m->next_sector = last->sector_num + last->qiov.size / BDRV_SECTOR_SIZE;
+
+    if (!sequential || mrb->num_reqs == VIRTIO_BLK_MAX_MERGE_REQS ||
+        qatomic_read(&m->drained)) {
+        virtio_blk_merge_window_flush(m);
+        return false;
+    }
+
+    if (!m->open) {
+        /* Keep drain waiting until the held requests are submitted */
+        blk_inc_in_flight(m->s->blk);
+        timer_mod(m->timer, qemu_clock_get_us(QEMU_CLOCK_REALTIME) +
+                            m->s->conf.merge_window_usecs);
+        m->open = true;
+    }
+
+    m->mrb = *mrb;
+    mrb->num_reqs = 0;
+    return true;
+}
+
+static VirtIOBlockVqMerge *virtio_blk_vq_merge(VirtIOBlock *s, VirtQueue *vq)
+{
+    unsigned idx = virtio_get_queue_index(vq);
+
+    if (!s->vq_merge || !s->conf.request_merging) {
+        return NULL;
+    }
+
+    /* The timer runs in the virtqueue's AioContext */
+    if (qemu_get_current_aio_context() != s->vq_aio_context[idx]) {
+        return NULL;
+    }
+
+    return &s->vq_merge[idx];
+}
+
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
     VirtIOBlockReq *req;
     MultiReqBuffer mrb = {};
+    VirtQueuePopBatch batch = {};
+    VirtIOBlockVqMerge *m = virtio_blk_vq_merge(s, vq);
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
+    if (m && m->mrb.num_reqs) {
+        /* Pick up held requests, they may merge with new ones */
+        mrb = m->mrb;
+        m->mrb.num_reqs = 0;
+    }
+
     defer_call_begin();
 
     do {
@@ -985,10 +1272,11 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
+        while ((req = virtio_blk_get_request(s, vq, &batch))) {
             if (virtio_blk_handle_request(req, &mrb)) {
                 virtqueue_detach_element(req->vq, &req->elem, 0);
                 virtio_blk_free_request(req);
+                virtqueue_pop_batch_drop(vq, &batch);
                 break;
             }
         }
@@ -998,7 +1286,8 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         }
     } while (!virtio_queue_empty(vq));
 
-    if (mrb.num_reqs) {
+    virtio_blk_submit_dwz(s, &mrb);
+    if (mrb.num_reqs && !(m && virtio_blk_merge_window_hold(m, &mrb))) {
         virtio_blk_submit_multireq(s, &mrb);
     }
 
@@ -1046,9 +1335,7 @@ static void virtio_blk_dma_restart_bh(void *opaque)
         req = next;
     }
 
-    if (mrb.num_reqs) {
-        virtio_blk_submit_multireq(s, &mrb);
-    }
+    virtio_blk_submit_mrb(s, &mrb);
 
     /* Paired with inc in virtio_blk_dma_restart_cb() */
     blk_dec_in_flight(s->conf.conf.blk);
@@ -1400,6 +1687,20 @@ static void virtio_blk_drained_begin(void *opaque)
     if (s->ioeventfd_started) {
         virtio_blk_ioeventfd_detach(s);
     }
+
+    /*
+     * Submit requests held for merging now rather than from the window
+     * timer in the middle of the drained section.  Drain waits for them
+     * through the in-flight reference of the window.
+     */
+    for (uint16_t i = 0; s->vq_merge && i < s->conf.num_queues; i++) {
+        VirtIOBlockVqMerge *m = &s->vq_merge[i];
+
+        qatomic_set(&m->drained, true);
+        blk_inc_in_flight(s->blk);
+        aio_bh_schedule_oneshot(s->vq_aio_context[i],
+                                virtio_blk_merge_window_flush_bh, m);
+    }
 }
 
 /* Resume virtqueue ioeventfd processing after drain */
@@ -1407,6 +1708,10 @@ static void virtio_blk_drained_end(void *opaque)
 {
     VirtIOBlock *s = opaque;
 
+    for (uint16_t i = 0; s->vq_merge && i < s->conf.num_queues; i++) {
+        qatomic_set(&s->vq_merge[i].drained, false);
+    }
+
     if (s->ioeventfd_started) {
         virtio_blk_ioeventfd_attach(s);
     }
@@ -1418,128 +1723,6 @@ static const BlockDevOps virtio_block_ops = {
     .drained_end   = virtio_blk_drained_end,
 };
 
-static bool
-validate_iothread_vq_mapping_list(IOThreadVirtQueueMappingList *list,
-        uint16_t num_queues, Error **errp)
-{
-    g_autofree unsigned long *vqs = bitmap_new(num_queues);
-    g_autoptr(GHashTable) iothreads =
-        g_hash_table_new(g_str_hash, g_str_equal);
-
-    for (IOThreadVirtQueueMappingList *node = list; node; node = node->next) {
-        const char *name = node->value->iothread;
-        uint16List *vq;
-
-        if (!iothread_by_id(name)) {
-            error_setg(errp, "IOThread \"%s\" object does not exist", name);
-            return false;
-        }
-
-        if (!g_hash_table_add(iothreads, (gpointer)name)) {
-            error_setg(errp,
-                    "duplicate IOThread name \"%s\" in iothread-vq-mapping",
-                    name);
-            return false;
-        }
-
-        if (node != list) {
-            if (!!node->value->vqs != !!list->value->vqs) {
-                error_setg(errp, "either all items in iothread-vq-mapping "
-                                 "must have vqs or none of them must have it");
-                return false;
-            }
-        }
-
-        for (vq = node->value->vqs; vq; vq = vq->next) {
-            if (vq->value >= num_queues) {
-                error_setg(errp, "vq index %u for IOThread \"%s\" must be "
-                        "less than num_queues %u in iothread-vq-mapping",
-                        vq->value, name, num_queues);
-                return false;
-            }
-
-            if (test_and_set_bit(vq->value, vqs)) {
-                error_setg(errp, "cannot assign vq %u to IOThread \"%s\" "
-                        "because it is already assigned", vq->value, name);
-                return false;
-            }
-        }
-    }
-
-    if (list->value->vqs) {
-        for (uint16_t i = 0; i < num_queues; i++) {
-            if (!test_bit(i, vqs)) {
-                error_setg(errp,
-                        "missing vq %u IOThread assignment in iothread-vq-mapping",
-                        i);
-                return false;
-            }
-        }
-    }
-
-    return true;
-}
-
-/**
- * apply_iothread_vq_mapping:
- * @iothread_vq_mapping_list: The mapping of virtqueues to IOThreads.
- * @vq_aio_context: The array of AioContext pointers to fill in.
- * @num_queues: The length of @vq_aio_context.
- * @errp: If an error occurs, a pointer to the area to store the error.
- *
- * Fill in the AioContext for each virtqueue in the @vq_aio_context array given
- * the iothread-vq-mapping parameter in @iothread_vq_mapping_list.
- *
- * Returns: %true on success, %false on failure.
- **/
-static bool apply_iothread_vq_mapping(
-        IOThreadVirtQueueMappingList *iothread_vq_mapping_list,
-        AioContext **vq_aio_context,
-        uint16_t num_queues,
-        Error **errp)
-{
-    IOThreadVirtQueueMappingList *node;
-    size_t num_iothreads = 0;
-    size_t cur_iothread = 0;
-
-    if (!validate_iothread_vq_mapping_list(iothread_vq_mapping_list,
-                                           num_queues, errp)) {
-        return false;
-    }
-
-    for (node = iothread_vq_mapping_list; node; node = node->next) {
-        num_iothreads++;
-    }
-
-    for (node = iothread_vq_mapping_list; node; node = node->next) {
-        IOThread *iothread = iothread_by_id(node->value->iothread);
-        AioContext *ctx = iothread_get_aio_context(iothread);
-
-        /* Released in virtio_blk_vq_aio_context_cleanup() */
-        object_ref(OBJECT(iothread));
-
-        if (node->value->vqs) {
-            uint16List *vq;
-
-            /* Explicit vq:IOThread assignment */
-            for (vq = node->value->vqs; vq; vq = vq->next) {
-                assert(vq->value < num_queues);
-                vq_aio_context[vq->value] = ctx;
-            }
-        } else {
-            /* Round-robin vq:IOThread assignment */
-            for (unsigned i = cur_iothread; i < num_queues;
-                 i += num_iothreads) {
-                vq_aio_context[i] = ctx;
-            }
-        }
-
-        cur_iothread++;
-    }
-
-    return true;
-}
-
 /* Context: BQL held */
 static bool virtio_blk_vq_aio_context_init(VirtIOBlock *s, Error **errp)
 {
@@ -1581,7 +1764,7 @@ static bool virtio_blk_vq_aio_context_init(VirtIOBlock *s, Error **errp)
     s->vq_aio_context = g_new(AioContext *, conf->num_queues);
 
     if (conf->iothread_vq_mapping_list) {
-        if (!apply_iothread_vq_mapping(conf->iothread_vq_mapping_list,
+        if (!iothread_vq_mapping_apply(conf->iothread_vq_mapping_list,
                                        s->vq_aio_context,
                                        conf->num_queues,
                                        errp)) {
@@ -1615,12 +1798,7 @@ static void virtio_blk_vq_aio_context_cleanup(VirtIOBlock *s)
     assert(!s->ioeventfd_started);
 
     if (conf->iothread_vq_mapping_list) {
-        IOThreadVirtQueueMappingList *node;
-
-        for (node = conf->iothread_vq_mapping_list; node; node = node->next) {
-            IOThread *iothread = iothread_by_id(node->value->iothread);
-            object_unref(OBJECT(iothread));
-        }
+        iothread_vq_mapping_cleanup(conf->iothread_vq_mapping_list);
     }
 
     if (conf->iothread) {
@@ -1887,6 +2065,11 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (conf->irq_coalesce_count && !conf->irq_coalesce_usecs) {
+        error_setg(errp, "irq-coalesce-count requires irq-coalesce-usecs");
+        return;
+    }
+
     if (virtio_has_feature(s->host_features, VIRTIO_BLK_F_WRITE_ZEROES) &&
         (!conf->max_write_zeroes_sectors ||
          conf->max_write_zeroes_sectors > BDRV_REQUEST_MAX_SECTORS)) {
@@ -1908,7 +2091,9 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     s->sector_mask = (s->conf.conf.logical_block_size / BDRV_SECTOR_SIZE) - 1;
 
     for (i = 0; i < conf->num_queues; i++) {
-        virtio_add_queue(vdev, conf->queue_size, virtio_blk_handle_output);
+        VirtQueue *vq = virtio_add_queue(vdev, conf->queue_size,
+                                         virtio_blk_handle_output);
+        virtio_queue_enable_element_pool(vq);
     }
     qemu_coroutine_inc_pool_size(conf->num_queues * conf->queue_size / 2);
 
@@ -1927,6 +2112,31 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    s->vq_completion = g_new0(VirtIOBlockVqCompletion, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        VirtIOBlockVqCompletion *c = &s->vq_completion[i];
+
+        c->s = s;
+        c->vq = virtio_get_queue(vdev, i);
+        if (conf->irq_coalesce_usecs) {
+            c->irq_timer = aio_timer_new(s->vq_aio_context[i],
+                                         QEMU_CLOCK_REALTIME, SCALE_US,
+                                         virtio_blk_vq_irq, c);
+        }
+    }
+
+    if (conf->merge_window_usecs) {
+        s->vq_merge = g_new0(VirtIOBlockVqMerge, conf->num_queues);
+        for (i = 0; i < conf->num_queues; i++) {
+            VirtIOBlockVqMerge *m = &s->vq_merge[i];
+
+            m->s = s;
+            m->timer = aio_timer_new(s->vq_aio_context[i],
+                                     QEMU_CLOCK_REALTIME, SCALE_US,
+                                     virtio_blk_merge_window_expired, m);
+        }
+    }
+
     /*
      * This must be after virtio_init() so virtio_blk_dma_restart_cb() gets
      * called after ->start_ioeventfd() has already set blk's AioContext.
@@ -1954,6 +2164,24 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
 
     blk_drain(s->blk);
     del_boot_device_lchs(dev, "/disk@0,0");
+    for (i = 0; i < conf->num_queues; i++) {
+        /* blk_drain() waited for pending interrupts */
+        assert(!s->vq_completion[i].pending_irqs);
+        if (s->vq_completion[i].irq_timer) {
+            timer_free(s->vq_completion[i].irq_timer);
+        }
+    }
+    g_free(s->vq_completion);
+    s->vq_completion = NULL;
+    if (s->vq_merge) {
+        for (i = 0; i < conf->num_queues; i++) {
+            /* blk_drain() waited for held requests */
+            assert(!s->vq_merge[i].open);
+            timer_free(s->vq_merge[i].timer);
+        }
+        g_free(s->vq_merge);
+        s->vq_merge = NULL;
+    }
     virtio_blk_vq_aio_context_cleanup(s);
     for (i = 0; i < conf->num_queues; i++) {
         virtio_del_queue(vdev, i);
@@ -2014,6 +2242,12 @@ static Property virtio_blk_properties[] = {
                        conf.max_write_zeroes_sectors, BDRV_REQUEST_MAX_SECTORS),
     DEFINE_PROP_BOOL("x-enable-wce-if-config-wce", VirtIOBlock,
                      conf.x_enable_wce_if_config_wce, true),
+    DEFINE_PROP_UINT32("irq-coalesce-count", VirtIOBlock,
+                       conf.irq_coalesce_count, 0),
+    DEFINE_PROP_UINT32("irq-coalesce-usecs", VirtIOBlock,
+                       conf.irq_coalesce_usecs, 0),
+    DEFINE_PROP_UINT32("merge-window-usecs", VirtIOBlock,
+                       conf.merge_window_usecs, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -157,6 +157,41 @@ static void discard_throttle_data(VirtIOSerialPort *port)
     }
 }
 
+/*
+ * Hand the rest of the current element to the port in a single call.
+ * *@len is set to the number of bytes that were left.
+ */
+static ssize_t flush_elem_iov(VirtIOSerialPort *port,
+                              VirtIOSerialPortClass *vsc, size_t *len)
+{
+    struct iovec *sg = port->elem->out_sg;
+    unsigned int num = port->elem->out_num;
+    g_autofree struct iovec *iov = g_new(struct iovec, num);
+    size_t skip = iov_size(sg, port->iov_idx) + port->iov_offset;
+    unsigned int cnt;
+
+    cnt = iov_copy(iov, num, sg, num, skip, SIZE_MAX);
+    *len = iov_size(iov, cnt);
+    return vsc->have_datav(port, iov, cnt);
+}
+
+/* Skip @bytes the port consumed before it got throttled */
+static void advance_elem_iov(VirtIOSerialPort *port, size_t bytes)
+{
+    while (bytes && port->iov_idx < port->elem->out_num) {
+        size_t left = port->elem->out_sg[port->iov_idx].iov_len -
+                      port->iov_offset;
+
+        if (bytes < left) {
+            port->iov_offset += bytes;
+            return;
+        }
+        bytes -= left;
+        port->iov_idx++;
+        port->iov_offset = 0;
+    }
+}
+
 static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
                                  VirtIODevice *vdev)
 {
@@ -180,26 +215,50 @@ static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
             port->iov_offset = 0;
         }
 
-        for (i = port->iov_idx; i < port->elem->out_num; i++) {
-            size_t buf_size;
-            ssize_t ret;
+        if (vsc->have_datav) {
+            while (port->iov_idx < port->elem->out_num) {
+                size_t len;
+                ssize_t ret = flush_elem_iov(port, vsc, &len);
 
-            buf_size = port->elem->out_sg[i].iov_len - port->iov_offset;
-            ret = vsc->have_data(port,
-                                  port->elem->out_sg[i].iov_base
-                                  + port->iov_offset,
-                                  buf_size);
-            if (!port->elem) { /* bail if we got disconnected */
-                return;
-            }
-            if (port->throttled) {
-                port->iov_idx = i;
+                if (!port->elem) { /* bail if we got disconnected */
+                    return;
+                }
                 if (ret > 0) {
-                    port->iov_offset += ret;
+                    advance_elem_iov(port, ret);
                 }
-                break;
+                if (port->throttled || ret >= (ssize_t)len) {
+                    break;
+                }
+                /*
+                 * A short write that did not throttle the port drops the
+                 * rest of the current buffer only, as with have_data.
+                 * Resume after it with the next one.
+                 */
+                port->iov_idx++;
+                port->iov_offset = 0;
+            }
+        } else {
+            for (i = port->iov_idx; i < port->elem->out_num; i++) {
+                size_t buf_size;
+                ssize_t ret;
+
+                buf_size = port->elem->out_sg[i].iov_len - port->iov_offset;
+                ret = vsc->have_data(port,
+                                      port->elem->out_sg[i].iov_base
+                                      + port->iov_offset,
+                                      buf_size);
+                if (!port->elem) { /* bail if we got disconnected */
+                    return;
+                }
+                if (port->throttled) {
+                    port->iov_idx = i;
+                    if (ret > 0) {
+                        port->iov_offset += ret;
+                    }
+                    break;
+                }
+                port->iov_offset = 0;
             }
-            port->iov_offset = 0;
         }
         if (port->throttled) {
             break;
@@ -613,7 +613,6 @@ static const char *io_port_to_string(uint32_t io_port)
 static int interface_get_command(QXLInstance *sin, struct QXLCommandExt *ext)
 {
     PCIQXLDevice *qxl = container_of(sin, PCIQXLDevice, ssd.qxl);
-    SimpleSpiceUpdate *update;
     QXLCommandRing *ring;
     QXLCommand *cmd;
     int notify, ret;
@@ -622,15 +621,7 @@ static int interface_get_command(QXLInstance *sin, struct QXLCommandExt *ext)
 
     switch (qxl->mode) {
     case QXL_MODE_VGA:
-        ret = false;
-        qemu_mutex_lock(&qxl->ssd.lock);
-        update = QTAILQ_FIRST(&qxl->ssd.updates);
-        if (update != NULL) {
-            QTAILQ_REMOVE(&qxl->ssd.updates, update, next);
-            *ext = update->ext;
-            ret = true;
-        }
-        qemu_mutex_unlock(&qxl->ssd.lock);
+        ret = qemu_spice_get_update(&qxl->ssd, ext);
         if (ret) {
             trace_qxl_ring_command_get(qxl->id, qxl_mode_to_string(qxl->mode));
             qxl_log_command(qxl, "vga", ext);
@@ -1207,7 +1198,9 @@ static void qxl_reset_state(PCIQXLDevice *d)
     init_qxl_ram(d);
     d->num_free_res = 0;
     d->last_release = NULL;
-    memset(&d->ssd.dirty, 0, sizeof(d->ssd.dirty));
+    WITH_QEMU_LOCK_GUARD(&d->ssd.lock) {
+        memset(&d->ssd.dirty, 0, sizeof(d->ssd.dirty));
+    }
     qxl_update_irq(d);
 }
 
@@ -41,6 +41,9 @@ virtio_gpu_find_check_resource(VirtIOGPU *g, uint32_t resource_id,
                                const char *caller, uint32_t *error);
 
 static void virtio_gpu_reset_bh(void *opaque);
+static void
+virtio_gpu_resource_end_zero_copy(VirtIOGPU *g,
+                                  struct virtio_gpu_simple_resource *res);
 
 void virtio_gpu_update_cursor_data(VirtIOGPU *g,
                                    struct virtio_gpu_scanout *s,
@@ -398,6 +401,7 @@ static void virtio_gpu_resource_destroy(VirtIOGPU *g,
     }
 
     qemu_pixman_image_unref(res->image);
+    res->image = NULL;
     virtio_gpu_cleanup_mapping(g, res);
     QTAILQ_REMOVE(&g->reslist, res, next);
     g->hostmem -= res->hostmem;
@@ -465,6 +469,14 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
     format = pixman_image_get_format(res->image);
     bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
     stride = pixman_image_get_stride(res->image);
+
+    if (res->zero_copy) {
+        if (t2d.offset == t2d.r.y * stride + t2d.r.x * bpp) {
+            /* The data is in place already */
+            return;
+        }
+        virtio_gpu_resource_end_zero_copy(g, res);
+    }
     img_data = pixman_image_get_data(res->image);
 
     if (t2d.r.x || t2d.r.width != pixman_image_get_width(res->image)) {
@@ -507,6 +519,8 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
         return;
     }
 
+    qemu_rect_init(&flush_rect, rf.r.x, rf.r.y, rf.r.width, rf.r.height);
+
     if (res->blob) {
         for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
             scanout = &g->parent_obj.scanout[i];
@@ -518,8 +532,16 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
                 within_bounds = true;
 
                 if (console_has_gl(scanout->con)) {
-                    dpy_gl_update(scanout->con, 0, 0, scanout->width,
-                                  scanout->height);
+                    QemuRect rect;
+
+                    /* only the flushed area needs to be redrawn */
+                    qemu_rect_init(&rect, scanout->x, scanout->y,
+                                   scanout->width, scanout->height);
+                    if (qemu_rect_intersect(&flush_rect, &rect, &rect)) {
+                        qemu_rect_translate(&rect, -scanout->x, -scanout->y);
+                        dpy_gl_update(scanout->con, rect.x, rect.y,
+                                      rect.width, rect.height);
+                    }
                     update_submitted = true;
                 }
             }
@@ -553,7 +575,6 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
         return;
     }
 
-    qemu_rect_init(&flush_rect, rf.r.x, rf.r.y, rf.r.width, rf.r.height);
     for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
         QemuRect rect;
 
@@ -680,6 +701,104 @@ static bool virtio_gpu_do_set_scanout(VirtIOGPU *g,
     return true;
 }
 
+/*
+ * With zero-copy-2d, a resource whose backing is contiguous guest RAM uses
+ * the backing as its image.  The guest's transfers then do not need to be
+ * copied, and scanouts show the backing directly.
+ */
+static void
+virtio_gpu_resource_try_zero_copy(VirtIOGPU *g,
+                                  struct virtio_gpu_simple_resource *res)
+{
+    pixman_image_t *image;
+    ram_addr_t offset;
+    size_t size = 0;
+    int i;
+
+    if (!virtio_gpu_zero_copy_2d_enabled(g->parent_obj.conf) ||
+        !res->image || res->scanout_bitmask) {
+        return;
+    }
+
+    for (i = 0; i < res->iov_cnt; i++) {
+        /* Bounce buffers are only a copy */
+        if (!qemu_ram_block_from_host(res->iov[i].iov_base, false, &offset)) {
+            return;
+        }
+        if (i && res->iov[i].iov_base !=
+            (uint8_t *)res->iov[i - 1].iov_base + res->iov[i - 1].iov_len) {
+            return;
+        }
+        size += res->iov[i].iov_len;
+    }
+    if (size < res->hostmem) {
+        return;
+    }
+
+    image = pixman_image_create_bits(pixman_image_get_format(res->image),
+                                     res->width, res->height,
+                                     res->iov[0].iov_base,
+                                     pixman_image_get_stride(res->image));
+    if (!image) {
+        return;
+    }
+
+    /* The hostmem accounting is kept, ending zero-copy needs it again */
+    qemu_pixman_image_unref(res->image);
+    res->image = image;
+    res->share_handle = SHAREABLE_NONE;
+    res->zero_copy = true;
+}
+
+/* Give the resource its own image again, before the backing goes away */
+static void
+virtio_gpu_resource_end_zero_copy(VirtIOGPU *g,
+                                  struct virtio_gpu_simple_resource *res)
+{
+    pixman_format_code_t format;
+    pixman_image_t *image;
+    uint32_t stride;
+    int i;
+
+    if (!res->zero_copy) {
+        return;
+    }
+
+    format = pixman_image_get_format(res->image);
+    stride = pixman_image_get_stride(res->image);
+    if (!qemu_pixman_image_new_shareable(&image, &res->share_handle,
+                                         "virtio-gpu res", format,
+                                         res->width, res->height, stride,
+                                         &error_warn)) {
+        res->share_handle = SHAREABLE_NONE;
+        image = pixman_image_create_bits(format, res->width, res->height,
+                                         NULL, stride);
+        g_assert(image);
+    }
+    memcpy(pixman_image_get_data(image), pixman_image_get_data(res->image),
+           stride * res->height);
+
+    qemu_pixman_image_unref(res->image);
+    res->image = image;
+    res->zero_copy = false;
+
+    /* The surfaces of the scanouts still point to the backing */
+    for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
+        struct virtio_gpu_scanout *scanout = &g->parent_obj.scanout[i];
+        struct virtio_gpu_rect r;
+        uint32_t error;
+
+        if (!(res->scanout_bitmask & (1 << i))) {
+            continue;
+        }
+        r.x = scanout->x;
+        r.y = scanout->y;
+        r.width = scanout->width;
+        r.height = scanout->height;
+        virtio_gpu_do_set_scanout(g, i, &scanout->fb, res, &r, &error);
+    }
+}
+
 static void virtio_gpu_set_scanout(VirtIOGPU *g,
                                    struct virtio_gpu_ctrl_command *cmd)
 {
@@ -880,6 +999,9 @@ void virtio_gpu_cleanup_mapping_iov(VirtIOGPU *g,
 void virtio_gpu_cleanup_mapping(VirtIOGPU *g,
                                 struct virtio_gpu_simple_resource *res)
 {
+    if (res->image) {
+        virtio_gpu_resource_end_zero_copy(g, res);
+    }
     virtio_gpu_cleanup_mapping_iov(g, res->iov, res->iov_cnt);
     res->iov = NULL;
     res->iov_cnt = 0;
@@ -922,6 +1044,8 @@ virtio_gpu_resource_attach_backing(VirtIOGPU *g,
         cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
         return;
     }
+
+    virtio_gpu_resource_try_zero_copy(g, res);
 }
 
 static void
@@ -1641,6 +1765,8 @@ static Property virtio_gpu_properties[] = {
                      256 * MiB),
     DEFINE_PROP_BIT("blob", VirtIOGPU, parent_obj.conf.flags,
                     VIRTIO_GPU_FLAG_BLOB_ENABLED, false),
+    DEFINE_PROP_BIT("zero-copy-2d", VirtIOGPU, parent_obj.conf.flags,
+                    VIRTIO_GPU_FLAG_ZERO_COPY_2D_ENABLED, false),
     DEFINE_PROP_SIZE("hostmem", VirtIOGPU, parent_obj.conf.hostmem, 0),
     DEFINE_PROP_UINT8("x-scanout-vmstate-version", VirtIOGPU, scanout_vmstate_version, 2),
     DEFINE_PROP_END_OF_LIST(),
@@ -330,6 +330,7 @@ static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
     assert(s->iotlb);
     g_hash_table_remove_all(s->iotlb);
+    s->iotlb_gen++;
 }
 
 static void vtd_reset_iotlb(IntelIOMMUState *s)
@@ -375,6 +376,34 @@ out:
     return entry;
 }
 
+/*
+ * Must be called with IOMMU lock held.  Devices mostly hit the same
+ * page again, so check that before the up to three lookups into the
+ * IOTLB hash table.
+ */
+static VTDIOTLBEntry *vtd_as_lookup_iotlb(VTDAddressSpace *vtd_as,
+                                          uint16_t source_id,
+                                          uint32_t pasid, hwaddr addr)
+{
+    IntelIOMMUState *s = vtd_as->iommu_state;
+    VTDIOTLBEntry *entry = &vtd_as->last_iotlb;
+
+    if (vtd_as->last_iotlb_gen == s->iotlb_gen &&
+        vtd_as->last_iotlb_sid == source_id &&
+        entry->pasid == pasid &&
+        ((addr & entry->mask) >> VTD_PAGE_SHIFT_4K) == entry->gfn) {
+        return entry;
+    }
+
+    entry = vtd_lookup_iotlb(s, source_id, pasid, addr);
+    if (entry) {
+        vtd_as->last_iotlb = *entry;
+        vtd_as->last_iotlb_sid = source_id;
+        vtd_as->last_iotlb_gen = s->iotlb_gen;
+    }
+    return entry;
+}
+
 /* Must be with IOMMU lock held */
 static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
                              uint16_t domain_id, hwaddr addr, uint64_t slpte,
@@ -1917,7 +1946,7 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
 
     /* Try to fetch slpte form IOTLB, we don't need RID2PASID logic */
     if (!rid2pasid) {
-        iotlb_entry = vtd_lookup_iotlb(s, source_id, pasid, addr);
+        iotlb_entry = vtd_as_lookup_iotlb(vtd_as, source_id, pasid, addr);
         if (iotlb_entry) {
             trace_vtd_iotlb_page_hit(source_id, addr, iotlb_entry->slpte,
                                      iotlb_entry->domain_id);
@@ -1995,7 +2024,7 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
 
     /* Try to fetch slpte form IOTLB for RID2PASID slow path */
     if (rid2pasid) {
-        iotlb_entry = vtd_lookup_iotlb(s, source_id, pasid, addr);
+        iotlb_entry = vtd_as_lookup_iotlb(vtd_as, source_id, pasid, addr);
         if (iotlb_entry) {
             trace_vtd_iotlb_page_hit(source_id, addr, iotlb_entry->slpte,
                                      iotlb_entry->domain_id);
@@ -2204,6 +2233,7 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
     vtd_iommu_lock(s);
     g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
                                 &domain_id);
+    s->iotlb_gen++;
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -2273,6 +2303,7 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     info.mask = ~((1 << am) - 1);
     vtd_iommu_lock(s);
     g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    s->iotlb_gen++;
     vtd_iommu_unlock(s);
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am, PCI_NO_PASID);
 }
@@ -4352,6 +4383,8 @@ static void vtd_realize(DeviceState *dev, Error **errp)
     /* No corresponding destroy */
     s->iotlb = g_hash_table_new_full(vtd_iotlb_hash, vtd_iotlb_equal,
                                      g_free, g_free);
+    /* Address spaces start with last_iotlb_gen == 0, i.e. invalid */
+    s->iotlb_gen = 1;
     s->vtd_address_spaces = g_hash_table_new_full(vtd_as_hash, vtd_as_equal,
                                       g_free, g_free);
     s->vtd_host_iommu_dev = g_hash_table_new_full(vtd_hiod_hash, vtd_hiod_equal,
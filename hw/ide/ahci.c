@@ -28,6 +28,7 @@
 #include "hw/qdev-properties.h"
 #include "migration/vmstate.h"
 
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
@@ -592,17 +593,23 @@ static void ahci_reg_init(AHCIState *s)
     }
 }
 
+/*
+ * Guests usually issue several NCQ commands with one write to PxCI, so
+ * submit the block requests for all of them in one deferred section.
+ */
 static void check_cmd(AHCIState *s, int port)
 {
     AHCIPortRegs *pr = &s->dev[port].port_regs;
     uint8_t slot;
 
     if ((pr->cmd & PORT_CMD_START) && pr->cmd_issue) {
+        defer_call_begin();
         for (slot = 0; (slot < 32) && pr->cmd_issue; slot++) {
             if (pr->cmd_issue & (1U << slot)) {
                 handle_cmd(s, port, slot);
             }
         }
+        defer_call_end();
     }
 }
 
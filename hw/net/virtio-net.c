@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/atomic.h"
+#include "qemu/defer-call.h"
 #include "qemu/iov.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
@@ -31,6 +32,7 @@
 #include "net/vhost_net.h"
 #include "net/announce.h"
 #include "hw/virtio/virtio-bus.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-net.h"
 #include "hw/qdev-properties.h"
@@ -40,6 +42,7 @@
 #include "migration/misc.h"
 #include "standard-headers/linux/ethtool.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/iothread.h"
 #include "sysemu/replay.h"
 #include "trace.h"
 #include "monitor/qdev.h"
@@ -189,6 +192,9 @@ static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
     }
 }
 
+static void virtio_net_iothreads_detach(VirtIONet *n);
+static void virtio_net_iothreads_attach(VirtIONet *n);
+
 static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -200,8 +206,11 @@ static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
     if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_CTRL_MAC_ADDR) &&
         !virtio_vdev_has_feature(vdev, VIRTIO_F_VERSION_1) &&
         memcmp(netcfg.mac, n->mac, ETH_ALEN)) {
+        /* The receive filter checks n->mac */
+        virtio_net_iothreads_detach(n);
         memcpy(n->mac, netcfg.mac, ETH_ALEN);
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
+        virtio_net_iothreads_attach(n);
     }
 
     /*
@@ -374,11 +383,129 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+static void virtio_net_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (qemu_in_iothread()) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(vdev, vq);
+    }
+}
+
+static void virtio_net_tx_bh(void *opaque);
+
+/*
+ * With iothread-vq-mapping, queue pairs are processed in their IOThreads
+ * while ioeventfd is started.  Main loop code that touches the state of the
+ * queue pairs or the receive filters moves them back to the main loop with
+ * virtio_net_iothreads_detach() first and returns them to their IOThreads
+ * with virtio_net_iothreads_attach() afterwards.
+ *
+ * Context: main loop if q->ctx is NULL, otherwise BH in q->ctx
+ */
+static void virtio_net_queue_set_aio_context(VirtIONetQueue *q,
+                                             AioContext *ctx)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+    VirtQueue *vqs[] = { q->rx_vq, q->tx_vq };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(vqs); i++) {
+        if (q->ctx) {
+            virtio_queue_aio_detach_host_notifier(vqs[i], q->ctx);
+        } else {
+            event_notifier_set_handler(virtio_queue_get_host_notifier(vqs[i]),
+                                       NULL);
+        }
+    }
+
+    qemu_set_net_aio_context(nc, ctx);
+    qemu_set_net_aio_context(nc->peer, ctx);
+
+    /* The TX bottom half must run where the queue pair is processed */
+    qemu_bh_delete(q->tx_bh);
+    q->tx_bh = aio_bh_new_guarded(ctx ?: qemu_get_aio_context(),
+                                  virtio_net_tx_bh, q,
+                                  &DEVICE(vdev)->mem_reentrancy_guard);
+    if (q->tx_waiting && vdev->vm_running) {
+        replay_bh_schedule_event(q->tx_bh);
+    }
+
+    q->ctx = ctx;
+
+    for (i = 0; i < ARRAY_SIZE(vqs); i++) {
+        EventNotifier *notifier = virtio_queue_get_host_notifier(vqs[i]);
+
+        if (ctx) {
+            /* This also kicks the virtqueue */
+            virtio_queue_aio_attach_host_notifier(vqs[i], ctx);
+        } else {
+            event_notifier_set_handler(notifier,
+                                       virtio_queue_host_notifier_read);
+            event_notifier_set(notifier);
+        }
+    }
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_queue_detach_bh(void *opaque)
+{
+    virtio_net_queue_set_aio_context(opaque, NULL);
+}
+
+static uint16_t virtio_net_iothread_queue_pairs(VirtIONet *n)
+{
+    return MIN(n->ioeventfd_queue_pairs,
+               n->multiqueue ? n->max_queue_pairs : 1);
+}
+
+/* Context: BQL held */
+static void virtio_net_iothreads_detach(VirtIONet *n)
+{
+    int i;
+
+    if (!n->vq_aio_context || n->iothreads_detached++) {
+        return;
+    }
+
+    for (i = 0; i < virtio_net_iothread_queue_pairs(n); i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->ctx) {
+            aio_wait_bh_oneshot(q->ctx, virtio_net_queue_detach_bh, q);
+        }
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_iothreads_attach(VirtIONet *n)
+{
+    int i;
+
+    if (!n->vq_aio_context) {
+        return;
+    }
+
+    if (n->iothreads_detached && --n->iothreads_detached) {
+        return;
+    }
+
+    for (i = 0; i < virtio_net_iothread_queue_pairs(n); i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (!q->ctx) {
+            virtio_net_queue_set_aio_context(q, n->vq_aio_context[i]);
+        }
     }
 }
 
@@ -389,6 +516,8 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     int i;
     uint8_t queue_status;
 
+    virtio_net_iothreads_detach(n);
+
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
@@ -437,6 +566,8 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+
+    virtio_net_iothreads_attach(n);
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -571,7 +702,9 @@ static void virtio_net_queue_reset(VirtIODevice *vdev, uint32_t queue_index)
         vhost_net_virtqueue_reset(vdev, nc, queue_index);
     }
 
+    virtio_net_iothreads_detach(n);
     flush_or_purge_queued_packets(nc);
+    virtio_net_iothreads_attach(n);
 }
 
 static void virtio_net_queue_enable(VirtIODevice *vdev, uint32_t queue_index)
@@ -1585,8 +1718,12 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
 
 static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 {
+    VirtIONet *n = VIRTIO_NET(vdev);
     VirtQueueElement *elem;
 
+    /* Commands change state that is used by the RX and TX paths */
+    virtio_net_iothreads_detach(n);
+
     for (;;) {
         size_t written;
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
@@ -1599,13 +1736,15 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         if (written > 0) {
             virtqueue_push(vq, elem, written);
             virtio_notify(vdev, vq);
-            g_free(elem);
+            virtqueue_element_free(elem);
         } else {
             virtqueue_detach_element(vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_free(elem);
             break;
         }
     }
+
+    virtio_net_iothreads_attach(n);
 }
 
 /* RX */
@@ -1889,6 +2028,17 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+/*
+ * Backends that deliver a burst of packets inside a defer_call section get a
+ * single RX interrupt for the whole burst.
+ */
+static void virtio_net_rx_notify(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    virtio_net_notify(VIRTIO_DEVICE(q->n), q->rx_vq);
+}
+
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                       size_t size, bool no_rss)
 {
@@ -1958,7 +2108,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             virtio_error(vdev,
                          "virtio-net receive queue contains no in buffers");
             virtqueue_detach_element(q->rx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_free(elem);
             err = -1;
             goto err;
         }
@@ -1998,7 +2148,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
          * Otherwise, drop it. */
         if (!n->mergeable_rx_bufs && offset < size) {
             virtqueue_unpop(q->rx_vq, elem, total);
-            g_free(elem);
+            virtqueue_element_free(elem);
             err = size;
             goto err;
         }
@@ -2019,18 +2169,18 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     for (j = 0; j < i; j++) {
         /* signal other side */
         virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
-        g_free(elems[j]);
+        virtqueue_element_free(elems[j]);
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    defer_call(virtio_net_rx_notify, q);
 
     return size;
 
 err:
     for (j = 0; j < i; j++) {
         virtqueue_detach_element(q->rx_vq, elems[j], lens[j]);
-        g_free(elems[j]);
+        virtqueue_element_free(elems[j]);
     }
 
     return err;
@@ -2658,9 +2808,9 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     int ret;
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(vdev, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2683,6 +2833,16 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Publish the used elements of a TX burst and send a single notification */
+static void virtio_net_tx_flush_used(VirtIONetQueue *q, unsigned int count)
+{
+    if (count) {
+        virtqueue_flush(q->tx_vq, count);
+        virtio_net_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
@@ -2690,6 +2850,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
     VirtQueueElement *elem;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    int32_t ret_val;
+
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2699,6 +2861,14 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
+    /*
+     * The used ring is only updated (and the guest notified) once per burst,
+     * and backends may defer their own per-packet work, e.g. kicking the
+     * kernel, until defer_call_end().
+     */
+    RCU_READ_LOCK_GUARD();
+    defer_call_begin();
+
     for (;;) {
         ssize_t ret;
         unsigned int out_num;
@@ -2765,24 +2935,30 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
-            return -EBUSY;
+            ret_val = -EBUSY;
+            goto out;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        virtqueue_fill(q->tx_vq, elem, 0, num_packets);
+        virtqueue_element_free(elem);
 
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
-    return num_packets;
+    ret_val = num_packets;
+    goto out;
 
 detach:
     virtqueue_detach_element(q->tx_vq, elem, 0);
-    g_free(elem);
-    return -EINVAL;
+    virtqueue_element_free(elem);
+    ret_val = -EINVAL;
+
+out:
+    virtio_net_tx_flush_used(q, num_packets);
+    defer_call_end();
+    return ret_val;
 }
 
 static void virtio_net_tx_timer(void *opaque);
@@ -2963,6 +3139,9 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
                                                   &DEVICE(vdev)->mem_reentrancy_guard);
     }
 
+    virtio_queue_enable_element_pool(n->vqs[index].rx_vq);
+    virtio_queue_enable_element_pool(n->vqs[index].tx_vq);
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -3026,10 +3205,14 @@ static void virtio_net_set_multiqueue(VirtIONet *n, int multiqueue)
 {
     int max = multiqueue ? n->max_queue_pairs : 1;
 
+    virtio_net_iothreads_detach(n);
+
     n->multiqueue = multiqueue;
     virtio_net_change_num_queue_pairs(n, max);
 
     virtio_net_set_queue_pairs(n);
+
+    virtio_net_iothreads_attach(n);
 }
 
 static int virtio_net_post_load_device(void *opaque, int version_id)
@@ -3590,6 +3773,139 @@ static bool failover_hide_primary_device(DeviceListener *listener,
     return qatomic_read(&n->failover_primary_hidden);
 }
 
+/* Context: BQL held */
+static bool virtio_net_vq_aio_context_init(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    if (!n->iothread_vq_mapping_list) {
+        return true;
+    }
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp,
+                   "device is incompatible with iothread-vq-mapping "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread-vq-mapping");
+        return false;
+    }
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "tx=timer is not supported with iothread-vq-mapping");
+        return false;
+    }
+
+    /* Software RSS and RSC share state between queue pairs */
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS) ||
+        virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "rss and guest_rsc_ext are not supported with "
+                   "iothread-vq-mapping");
+        return false;
+    }
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (peer && get_vhost_net(peer)) {
+            error_setg(errp, "vhost is not supported with iothread-vq-mapping");
+            return false;
+        }
+        if (!qemu_can_set_net_aio_context(peer)) {
+            error_setg(errp, "the netdev of queue pair %d does not support "
+                       "iothread-vq-mapping", i);
+            return false;
+        }
+        if (!QTAILQ_EMPTY(&peer->filters)) {
+            error_setg(errp, "network filters are not supported with "
+                       "iothread-vq-mapping");
+            return false;
+        }
+    }
+
+    n->vq_aio_context = g_new0(AioContext *, n->max_queue_pairs);
+    if (!iothread_vq_mapping_apply(n->iothread_vq_mapping_list,
+                                   n->vq_aio_context, n->max_queue_pairs,
+                                   errp)) {
+        g_free(n->vq_aio_context);
+        n->vq_aio_context = NULL;
+        return false;
+    }
+
+    /* guest_notifier_mask() and guest_notifier_pending() are vhost-only */
+    vdev->use_guest_notifier_mask = false;
+    return true;
+}
+
+/* Context: BQL held */
+static void virtio_net_vq_aio_context_cleanup(VirtIONet *n)
+{
+    if (!n->vq_aio_context) {
+        return;
+    }
+
+    assert(!n->ioeventfd_queue_pairs);
+    iothread_vq_mapping_cleanup(n->iothread_vq_mapping_list);
+    g_free(n->vq_aio_context);
+    n->vq_aio_context = NULL;
+}
+
+/* Context: BQL held */
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    uint16_t queue_pairs = n->multiqueue ? n->max_queue_pairs : 1;
+    int r;
+
+    r = virtio_device_start_ioeventfd_impl(vdev);
+    if (r < 0 || !n->vq_aio_context) {
+        return r;
+    }
+
+    /* IOThreads can only send interrupts through irqfds */
+    r = k->set_guest_notifiers(qbus->parent, queue_pairs * 2 + 1, true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set.", r);
+        virtio_device_stop_ioeventfd_impl(vdev);
+        return r;
+    }
+
+    n->ioeventfd_queue_pairs = queue_pairs;
+    if (!n->iothreads_detached) {
+        virtio_net_iothreads_attach(n);
+    }
+    return 0;
+}
+
+/* Context: BQL held */
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    uint16_t queue_pairs = n->ioeventfd_queue_pairs;
+
+    if (!queue_pairs) {
+        virtio_device_stop_ioeventfd_impl(vdev);
+        return;
+    }
+
+    /* Bring all queue pairs back to the main loop for good */
+    virtio_net_iothreads_detach(n);
+    n->ioeventfd_queue_pairs = 0;
+    virtio_net_iothreads_attach(n);
+
+    virtio_device_stop_ioeventfd_impl(vdev);
+    k->set_guest_notifiers(qbus->parent, queue_pairs * 2 + 1, false);
+}
+
 static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -3684,6 +4000,12 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    if (!virtio_net_vq_aio_context_init(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
+
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -3805,6 +4127,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
     net_rx_pkt_uninit(n->rx_pkt);
+    virtio_net_vq_aio_context_cleanup(n);
     virtio_cleanup(vdev);
 }
 
@@ -3994,6 +4317,8 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIONet,
+                                         iothread_vq_mapping_list),
     DEFINE_PROP_BIT64("guest_uso4", VirtIONet, host_features,
                       VIRTIO_NET_F_GUEST_USO4, true),
     DEFINE_PROP_BIT64("guest_uso6", VirtIONet, host_features,
@@ -4022,6 +4347,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->queue_reset = virtio_net_queue_reset;
     vdc->queue_enable = virtio_net_queue_enable;
     vdc->set_status = virtio_net_set_status;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
@@ -514,6 +514,9 @@ typedef struct NvmeCQueue {
     QEMUBH      *bh;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
+    /* completions posted since the last coalesced interrupt */
+    uint32_t    coalesced;
+    QEMUTimer   *coalesce_timer;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
@@ -567,6 +570,7 @@ typedef struct NvmeCtrl {
     uint32_t    page_size;
     uint16_t    page_bits;
     uint16_t    max_prp_ents;
+    uint64_t    *prp_list;      /* max_prp_ents, for nvme_map_prp */
     uint32_t    max_q_ents;
     uint8_t     outstanding_aers;
     uint32_t    irq_status;
@@ -622,10 +626,14 @@ typedef struct NvmeCtrl {
             uint16_t temp_thresh_low;
         };
 
+        uint32_t                int_coalescing;
         uint32_t                async_config;
         NvmeHostBehaviorSupport hbs;
     } features;
 
+    /* Interrupt vectors with Coalescing Disable set */
+    unsigned long   *intvc_cd;
+
     NvmePriCtrlCap  pri_ctrl_cap;
     uint32_t nr_sec_ctrls;
     NvmeSecCtrlEntry *sec_ctrl_list;
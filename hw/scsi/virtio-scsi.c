@@ -21,10 +21,12 @@
 #include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "qemu/lockable.h"
 #include "qemu/module.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/dma.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
 #include "hw/scsi/scsi.h"
 #include "scsi/constants.h"
 #include "hw/virtio/virtio-bus.h"
@@ -99,7 +101,7 @@ static void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_element_free(req);
 }
 
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
@@ -107,14 +109,21 @@ static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
     VirtIOSCSI *s = req->dev;
     VirtQueue *vq = req->vq;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    bool ctrl = vq == VIRTIO_SCSI_COMMON(s)->ctrl_vq;
 
     qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
+    if (ctrl) {
+        qemu_mutex_lock(&s->ctrl_lock);
+    }
     virtqueue_push(vq, &req->elem, req->qsgl.size + req->resp_iov.size);
     if (s->dataplane_started && !s->dataplane_fenced) {
         virtio_notify_irqfd(vdev, vq);
     } else {
         virtio_notify(vdev, vq);
     }
+    if (ctrl) {
+        qemu_mutex_unlock(&s->ctrl_lock);
+    }
 
     if (req->sreq) {
         req->sreq->hba_private = NULL;
@@ -137,20 +146,29 @@ static void virtio_scsi_complete_req_bh(void *opaque)
 static void virtio_scsi_complete_req_from_main_loop(VirtIOSCSIReq *req)
 {
     VirtIOSCSI *s = req->dev;
+    AioContext *ctx = s->vq_aio_context ? s->vq_aio_context[0] : NULL;
 
-    if (!s->ctx || s->ctx == qemu_get_aio_context()) {
+    if (!ctx || ctx == qemu_get_aio_context()) {
         /* No need to schedule a BH when there is no IOThread */
         virtio_scsi_complete_req(req);
     } else {
         /* Run request completion in the IOThread */
-        aio_wait_bh_oneshot(s->ctx, virtio_scsi_complete_req_bh, req);
+        aio_wait_bh_oneshot(ctx, virtio_scsi_complete_req_bh, req);
     }
 }
 
 static void virtio_scsi_bad_req(VirtIOSCSIReq *req)
 {
-    virtio_error(VIRTIO_DEVICE(req->dev), "wrong size for virtio-scsi headers");
-    virtqueue_detach_element(req->vq, &req->elem, 0);
+    VirtIOSCSI *s = req->dev;
+
+    virtio_error(VIRTIO_DEVICE(s), "wrong size for virtio-scsi headers");
+    if (req->vq == VIRTIO_SCSI_COMMON(s)->ctrl_vq) {
+        WITH_QEMU_LOCK_GUARD(&s->ctrl_lock) {
+            virtqueue_detach_element(req->vq, &req->elem, 0);
+        }
+    } else {
+        virtqueue_detach_element(req->vq, &req->elem, 0);
+    }
     virtio_scsi_free_req(req);
 }
 
@@ -235,12 +253,14 @@ static int virtio_scsi_parse_req(VirtIOSCSIReq *req,
     return 0;
 }
 
-static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq)
+static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq,
+                                          VirtQueuePopBatch *batch)
 {
     VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
+    size_t sz = sizeof(VirtIOSCSIReq) + vs->cdb_size;
     VirtIOSCSIReq *req;
 
-    req = virtqueue_pop(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size);
+    req = batch ? virtqueue_pop_batched(vq, sz, batch) : virtqueue_pop(vq, sz);
     if (!req) {
         return NULL;
     }
@@ -275,6 +295,11 @@ static void *virtio_scsi_load_request(QEMUFile *f, SCSIRequest *sreq)
                                      sizeof(VirtIOSCSIReq) + vs->cdb_size);
     virtio_scsi_init_req(s, vs->cmd_vqs[n], req);
 
+    /* Restart the request in the AioContext of its virtqueue */
+    if (s->vq_aio_context) {
+        sreq->ctx = s->vq_aio_context[VIRTIO_SCSI_VQ_NUM_FIXED + n];
+    }
+
     if (virtio_scsi_parse_req(req, sizeof(VirtIOSCSICmdReq) + vs->cdb_size,
                               sizeof(VirtIOSCSICmdResp) + vs->sense_size) < 0) {
         error_report("invalid SCSI request migration data");
@@ -294,26 +319,121 @@ typedef struct {
     VirtIOSCSIReq  *tmf_req;
 } VirtIOSCSICancelNotifier;
 
+/*
+ * TMFs that cancel requests complete once the last cancellation is done,
+ * which can happen in any AioContext that runs requests.
+ */
+static void virtio_scsi_tmf_dec_remaining(VirtIOSCSIReq *tmf)
+{
+    if (qatomic_fetch_dec(&tmf->remaining) == 1) {
+        trace_virtio_scsi_tmf_resp(virtio_scsi_get_lun(tmf->req.tmf.lun),
+                                   tmf->req.tmf.tag, tmf->resp.tmf.response);
+        virtio_scsi_complete_req(tmf);
+    }
+}
+
 static void virtio_scsi_cancel_notify(Notifier *notifier, void *data)
 {
     VirtIOSCSICancelNotifier *n = container_of(notifier,
                                                VirtIOSCSICancelNotifier,
                                                notifier);
 
-    if (--n->tmf_req->remaining == 0) {
-        VirtIOSCSIReq *req = n->tmf_req;
+    virtio_scsi_tmf_dec_remaining(n->tmf_req);
+    g_free(n);
+}
 
-        trace_virtio_scsi_tmf_resp(virtio_scsi_get_lun(req->req.tmf.lun),
-                                   req->req.tmf.tag, req->resp.tmf.response);
-        virtio_scsi_complete_req(req);
+/* Called in the AioContext of @r */
+static void virtio_scsi_tmf_cancel_req(VirtIOSCSIReq *tmf, SCSIRequest *r)
+{
+    VirtIOSCSICancelNotifier *notifier;
+
+    assert(r->ctx == qemu_get_current_aio_context());
+
+    /* Decremented in virtio_scsi_cancel_notify() */
+    qatomic_inc(&tmf->remaining);
+
+    notifier = g_new(VirtIOSCSICancelNotifier, 1);
+    notifier->notifier.notify = virtio_scsi_cancel_notify;
+    notifier->tmf_req = tmf;
+    scsi_req_cancel_async(r, &notifier->notifier);
+}
+
+/* Cancel the requests targeted by a TMF that run in this AioContext */
+static void virtio_scsi_do_tmf_aio_context(void *opaque)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    VirtIOSCSIReq *tmf = opaque;
+    VirtIOSCSI *s = tmf->dev;
+    SCSIDevice *d = virtio_scsi_device_get(s, tmf->req.tmf.lun);
+    bool match_tag = tmf->req.tmf.subtype == VIRTIO_SCSI_T_TMF_ABORT_TASK;
+    g_autoptr(GList) reqs = NULL;
+
+    if (d) {
+        /* Cancelling dequeues the request, which takes requests_lock */
+        WITH_QEMU_LOCK_GUARD(&d->requests_lock) {
+            SCSIRequest *r;
+
+            QTAILQ_FOREACH(r, &d->requests, next) {
+                VirtIOSCSIReq *cmd_req = r->hba_private;
+
+                if (r->ctx != ctx || !cmd_req) {
+                    continue;
+                }
+                if (match_tag && cmd_req->req.cmd.tag != tmf->req.tmf.tag) {
+                    continue;
+                }
+                scsi_req_ref(r);
+                reqs = g_list_prepend(reqs, r);
+            }
+        }
+
+        for (GList *elem = reqs; elem; elem = elem->next) {
+            virtio_scsi_tmf_cancel_req(tmf, elem->data);
+            scsi_req_unref(elem->data);
+        }
+        object_unref(OBJECT(d));
     }
-    g_free(n);
+
+    /* Incremented by virtio_scsi_defer_tmf_to_aio_context() */
+    virtio_scsi_tmf_dec_remaining(tmf);
+}
+
+/*
+ * Requests can only be cancelled from the AioContext they run in, and with
+ * iothread-vq-mapping that need not be the one of the control virtqueue.
+ */
+static void virtio_scsi_defer_tmf_to_aio_context(VirtIOSCSIReq *tmf,
+                                                 AioContext *ctx)
+{
+    /* Decremented in virtio_scsi_do_tmf_aio_context() */
+    qatomic_inc(&tmf->remaining);
+
+    /* See virtio_scsi_flush_defer_tmf_to_aio_context() */
+    aio_bh_schedule_oneshot(ctx, virtio_scsi_do_tmf_aio_context, tmf);
 }
 
-static inline void virtio_scsi_ctx_check(VirtIOSCSI *s, SCSIDevice *d)
+static void virtio_scsi_flush_bh(void *opaque)
 {
-    if (s->dataplane_started && d && blk_is_available(d->conf.blk)) {
-        assert(blk_get_aio_context(d->conf.blk) == s->ctx);
+}
+
+/* Wait for the BHs of virtio_scsi_defer_tmf_to_aio_context() to run */
+static void virtio_scsi_flush_defer_tmf_to_aio_context(VirtIOSCSI *s)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+
+    GLOBAL_STATE_CODE();
+
+    /* A BH only runs after the ones that were scheduled before it */
+    aio_wait_bh_oneshot(qemu_get_aio_context(), virtio_scsi_flush_bh, NULL);
+    if (!s->vq_aio_context) {
+        return;
+    }
+    for (uint32_t i = 0; i < vs->conf.num_queues; i++) {
+        AioContext *ctx = s->vq_aio_context[VIRTIO_SCSI_VQ_NUM_FIXED + i];
+
+        if (ctx != qemu_get_aio_context()) {
+            aio_wait_bh_oneshot(ctx, virtio_scsi_flush_bh, NULL);
+        }
     }
 }
 
@@ -432,10 +552,12 @@ static void virtio_scsi_defer_tmf_to_bh(VirtIOSCSIReq *req)
 static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
 {
     SCSIDevice *d = virtio_scsi_device_get(s, req->req.tmf.lun);
-    SCSIRequest *r, *next;
+    g_autoptr(GHashTable) aio_contexts = NULL;
+    SCSIRequest *r;
+    GHashTableIter iter;
+    gpointer ctx;
     int ret = 0;
 
-    virtio_scsi_ctx_check(s, d);
     /* Here VIRTIO_SCSI_S_OK means "FUNCTION COMPLETE".  */
     req->resp.tmf.response = VIRTIO_SCSI_S_OK;
 
@@ -458,32 +580,33 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
         if (d->lun != virtio_scsi_get_lun(req->req.tmf.lun)) {
             goto incorrect_lun;
         }
-        QTAILQ_FOREACH_SAFE(r, &d->requests, next, next) {
-            VirtIOSCSIReq *cmd_req = r->hba_private;
-            if (cmd_req && cmd_req->req.cmd.tag == req->req.tmf.tag) {
-                break;
+
+        ctx = NULL;
+        WITH_QEMU_LOCK_GUARD(&d->requests_lock) {
+            QTAILQ_FOREACH(r, &d->requests, next) {
+                VirtIOSCSIReq *cmd_req = r->hba_private;
+                if (cmd_req && cmd_req->req.cmd.tag == req->req.tmf.tag) {
+                    ctx = r->ctx;
+                    break;
+                }
             }
         }
-        if (r) {
-            /*
-             * Assert that the request has not been completed yet, we
-             * check for it in the loop above.
-             */
-            assert(r->hba_private);
+        if (ctx) {
             if (req->req.tmf.subtype == VIRTIO_SCSI_T_TMF_QUERY_TASK) {
                 /* "If the specified command is present in the task set, then
                  * return a service response set to FUNCTION SUCCEEDED".
                  */
                 req->resp.tmf.response = VIRTIO_SCSI_S_FUNCTION_SUCCEEDED;
             } else {
-                VirtIOSCSICancelNotifier *notifier;
-
+                /*
+                 * The request may complete before it can be cancelled, which
+                 * virtio_scsi_do_tmf_aio_context() copes with.
+                 */
                 req->remaining = 1;
-                notifier = g_new(VirtIOSCSICancelNotifier, 1);
-                notifier->tmf_req = req;
-                notifier->notifier.notify = virtio_scsi_cancel_notify;
-                scsi_req_cancel_async(r, &notifier->notifier);
-                ret = -EINPROGRESS;
+                virtio_scsi_defer_tmf_to_aio_context(req, ctx);
+                if (qatomic_fetch_dec(&req->remaining) > 1) {
+                    ret = -EINPROGRESS;
+                }
             }
         }
         break;
@@ -504,32 +627,37 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
             goto incorrect_lun;
         }
 
-        /* Add 1 to "remaining" until virtio_scsi_do_tmf returns.
-         * This way, if the bus starts calling back to the notifiers
-         * even before we finish the loop, virtio_scsi_cancel_notify
-         * will not complete the TMF too early.
-         */
-        req->remaining = 1;
-        QTAILQ_FOREACH_SAFE(r, &d->requests, next, next) {
-            if (r->hba_private) {
-                if (req->req.tmf.subtype == VIRTIO_SCSI_T_TMF_QUERY_TASK_SET) {
-                    /* "If there is any command present in the task set, then
-                     * return a service response set to FUNCTION SUCCEEDED".
-                     */
-                    req->resp.tmf.response = VIRTIO_SCSI_S_FUNCTION_SUCCEEDED;
-                    break;
-                } else {
-                    VirtIOSCSICancelNotifier *notifier;
-
-                    req->remaining++;
-                    notifier = g_new(VirtIOSCSICancelNotifier, 1);
-                    notifier->notifier.notify = virtio_scsi_cancel_notify;
-                    notifier->tmf_req = req;
-                    scsi_req_cancel_async(r, &notifier->notifier);
+        /* The AioContexts that run the requests of the task set */
+        aio_contexts = g_hash_table_new(NULL, NULL);
+        WITH_QEMU_LOCK_GUARD(&d->requests_lock) {
+            QTAILQ_FOREACH(r, &d->requests, next) {
+                if (r->hba_private) {
+                    g_hash_table_add(aio_contexts, r->ctx);
                 }
             }
         }
-        if (--req->remaining > 0) {
+
+        if (req->req.tmf.subtype == VIRTIO_SCSI_T_TMF_QUERY_TASK_SET) {
+            /* "If there is any command present in the task set, then
+             * return a service response set to FUNCTION SUCCEEDED".
+             */
+            if (g_hash_table_size(aio_contexts)) {
+                req->resp.tmf.response = VIRTIO_SCSI_S_FUNCTION_SUCCEEDED;
+            }
+            break;
+        }
+
+        /* Add 1 to "remaining" until all BHs are scheduled.
+         * This way, if the requests are cancelled even before we
+         * finish the loop, virtio_scsi_cancel_notify will not complete
+         * the TMF too early.
+         */
+        req->remaining = 1;
+        g_hash_table_iter_init(&iter, aio_contexts);
+        while (g_hash_table_iter_next(&iter, &ctx, NULL)) {
+            virtio_scsi_defer_tmf_to_aio_context(req, ctx);
+        }
+        if (qatomic_fetch_dec(&req->remaining) > 1) {
             ret = -EINPROGRESS;
         }
         break;
@@ -610,7 +738,13 @@ static void virtio_scsi_handle_ctrl_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
     VirtIOSCSIReq *req;
 
-    while ((req = virtio_scsi_pop_req(s, vq))) {
+    for (;;) {
+        WITH_QEMU_LOCK_GUARD(&s->ctrl_lock) {
+            req = virtio_scsi_pop_req(s, vq, NULL);
+        }
+        if (!req) {
+            break;
+        }
         virtio_scsi_handle_ctrl_req(s, req);
     }
 }
@@ -625,7 +759,7 @@ static void virtio_scsi_handle_ctrl_vq(VirtIOSCSI *s, VirtQueue *vq)
  */
 static bool virtio_scsi_defer_to_dataplane(VirtIOSCSI *s)
 {
-    if (!s->ctx || s->dataplane_started) {
+    if (!s->vq_aio_context || s->dataplane_started) {
         return false;
     }
 
@@ -801,7 +935,6 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
         virtio_scsi_complete_cmd_req(req);
         return -ENOENT;
     }
-    virtio_scsi_ctx_check(s, d);
     req->sreq = scsi_req_new(d, req->req.cmd.tag,
                              virtio_scsi_get_lun(req->req.cmd.lun),
                              req->req.cmd.cdb, vs->cdb_size, req);
@@ -833,6 +966,7 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
 static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
     VirtIOSCSIReq *req, *next;
+    VirtQueuePopBatch batch = {};
     int ret = 0;
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -843,7 +977,7 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_scsi_pop_req(s, vq))) {
+        while ((req = virtio_scsi_pop_req(s, vq, &batch))) {
             ret = virtio_scsi_handle_cmd_req_prepare(s, req);
             if (!ret) {
                 QTAILQ_INSERT_TAIL(&reqs, req, next);
@@ -936,6 +1070,7 @@ static void virtio_scsi_reset(VirtIODevice *vdev)
 
     assert(!s->dataplane_started);
 
+    virtio_scsi_flush_defer_tmf_to_aio_context(s);
     virtio_scsi_reset_tmf_bh(s);
 
     qatomic_inc(&s->resetting);
@@ -973,7 +1108,7 @@ static void virtio_scsi_push_event(VirtIOSCSI *s,
         return;
     }
 
-    req = virtio_scsi_pop_req(s, vs->event_vq);
+    req = virtio_scsi_pop_req(s, vs->event_vq, NULL);
     if (!req) {
         s->events_dropped = true;
         return;
@@ -1064,11 +1199,17 @@ static void virtio_scsi_hotplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     SCSIDevice *sd = SCSI_DEVICE(dev);
     int ret;
 
-    if (s->ctx && !s->dataplane_fenced) {
+    if (s->vq_aio_context && !s->dataplane_fenced) {
+        /*
+         * With iothread-vq-mapping the requests are submitted from several
+         * AioContexts, the BlockBackend just lives in the first one.
+         */
+        AioContext *ctx = s->vq_aio_context[VIRTIO_SCSI_VQ_NUM_FIXED];
+
         if (blk_op_is_blocked(sd->conf.blk, BLOCK_OP_TYPE_DATAPLANE, errp)) {
             return;
         }
-        ret = blk_set_aio_context(sd->conf.blk, s->ctx, errp);
+        ret = blk_set_aio_context(sd->conf.blk, ctx, errp);
         if (ret < 0) {
             return;
         }
@@ -1106,7 +1247,7 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
 
     qdev_simple_device_unplug_cb(hotplug_dev, dev, errp);
 
-    if (s->ctx) {
+    if (s->vq_aio_context) {
         /* If other users keep the BlockBackend in the iothread, that's ok */
         blk_set_aio_context(sd->conf.blk, qemu_get_aio_context(), NULL);
     }
@@ -1140,7 +1281,7 @@ static void virtio_scsi_drained_begin(SCSIBus *bus)
 
     for (uint32_t i = 0; i < total_queues; i++) {
         VirtQueue *vq = virtio_get_queue(vdev, i);
-        virtio_queue_aio_detach_host_notifier(vq, s->ctx);
+        virtio_queue_aio_detach_host_notifier(vq, s->vq_aio_context[i]);
     }
 }
 
@@ -1166,10 +1307,12 @@ static void virtio_scsi_drained_end(SCSIBus *bus)
 
     for (uint32_t i = 0; i < total_queues; i++) {
         VirtQueue *vq = virtio_get_queue(vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
+
         if (vq == vs->event_vq) {
-            virtio_queue_aio_attach_host_notifier_no_poll(vq, s->ctx);
+            virtio_queue_aio_attach_host_notifier_no_poll(vq, ctx);
         } else {
-            virtio_queue_aio_attach_host_notifier(vq, s->ctx);
+            virtio_queue_aio_attach_host_notifier(vq, ctx);
         }
     }
 }
@@ -1236,10 +1379,13 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(dev);
     Error *err = NULL;
+    int i;
 
     QTAILQ_INIT(&s->tmf_bh_list);
     qemu_mutex_init(&s->tmf_bh_lock);
+    qemu_mutex_init(&s->ctrl_lock);
 
     virtio_scsi_common_realize(dev,
                                virtio_scsi_handle_ctrl,
@@ -1251,6 +1397,10 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        virtio_queue_enable_element_pool(vs->cmd_vqs[i]);
+    }
+
     scsi_bus_init_named(&s->bus, sizeof(s->bus), dev,
                        &virtio_scsi_scsi_info, vdev->bus_name);
     /* override default SCSI bus hotplug-handler, with virtio-scsi's one */
@@ -1281,7 +1431,9 @@ static void virtio_scsi_device_unrealize(DeviceState *dev)
     virtio_scsi_reset_tmf_bh(s);
 
     qbus_set_hotplug_handler(BUS(&s->bus), NULL);
+    virtio_scsi_dataplane_cleanup(s);
     virtio_scsi_common_unrealize(dev);
+    qemu_mutex_destroy(&s->ctrl_lock);
     qemu_mutex_destroy(&s->tmf_bh_lock);
 }
 
@@ -1302,6 +1454,8 @@ static Property virtio_scsi_properties[] = {
                                                 VIRTIO_SCSI_F_CHANGE, true),
     DEFINE_PROP_LINK("iothread", VirtIOSCSI, parent_obj.conf.iothread,
                      TYPE_IOTHREAD, IOThread *),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIOSCSI,
+            parent_obj.conf.iothread_vq_mapping_list),
     DEFINE_PROP_END_OF_LIST(),
 };
 
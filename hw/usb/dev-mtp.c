@@ -580,6 +580,7 @@ static void file_monitor_event(int64_t id,
         break;
 
     case QFILE_MONITOR_EVENT_ATTRIBUTES:
+    case QFILE_MONITOR_EVENT_OVERFLOW:
         break;
 
     default:
@@ -683,15 +683,59 @@ static void xhci_ring_init(XHCIState *xhci, XHCIRing *ring,
     ring->ccs = 1;
 }
 
+/*
+ * TRBs are read from guest memory a few at a time, so that looking at a
+ * TD and then fetching it costs one DMA access instead of one per TRB
+ * per pass.  The cache only lives for one endpoint kick: the guest rings
+ * the doorbell again after queueing more TRBs.
+ */
+#define XHCI_TRB_CACHE_SIZE 16
+
+typedef struct XHCITRBCache {
+    dma_addr_t base;
+    unsigned int count;
+    uint8_t data[XHCI_TRB_CACHE_SIZE * TRB_SIZE];
+} XHCITRBCache;
+
+static MemTxResult xhci_trb_read(XHCIState *xhci, XHCITRBCache *cache,
+                                 dma_addr_t addr, XHCITRB *trb)
+{
+    unsigned int count;
+
+    if (cache) {
+        if (addr >= cache->base &&
+            addr - cache->base < cache->count * TRB_SIZE &&
+            !((addr - cache->base) % TRB_SIZE)) {
+            memcpy(trb, cache->data + (addr - cache->base), TRB_SIZE);
+            return MEMTX_OK;
+        }
+
+        /* Read ahead, but not across a 4 KiB page into what may not be RAM */
+        count = MIN(XHCI_TRB_CACHE_SIZE,
+                    (4096 - (addr & 4095)) / TRB_SIZE);
+        cache->count = 0;
+        if (count > 1 &&
+            dma_memory_read(xhci->as, addr, cache->data, count * TRB_SIZE,
+                            MEMTXATTRS_UNSPECIFIED) == MEMTX_OK) {
+            cache->base = addr;
+            cache->count = count;
+            memcpy(trb, cache->data, TRB_SIZE);
+            return MEMTX_OK;
+        }
+    }
+
+    return dma_memory_read(xhci->as, addr, trb, TRB_SIZE,
+                           MEMTXATTRS_UNSPECIFIED);
+}
+
 static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
-                               dma_addr_t *addr)
+                               dma_addr_t *addr, XHCITRBCache *cache)
 {
     uint32_t link_cnt = 0;
 
     while (1) {
         TRBType type;
-        if (dma_memory_read(xhci->as, ring->dequeue, trb, TRB_SIZE,
-                            MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (xhci_trb_read(xhci, cache, ring->dequeue, trb) != MEMTX_OK) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return 0;
@@ -730,7 +774,8 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
     }
 }
 
-static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
+static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring,
+                                  XHCITRBCache *cache)
 {
     XHCITRB trb;
     int length = 0;
@@ -742,8 +787,7 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
 
     do {
         TRBType type;
-        if (dma_memory_read(xhci->as, dequeue, &trb, TRB_SIZE,
-                        MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (xhci_trb_read(xhci, cache, dequeue, &trb) != MEMTX_OK) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return -1;
@@ -1870,6 +1914,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
     XHCIStreamContext *stctx = NULL;
     XHCITransfer *xfer;
     XHCIRing *ring;
+    XHCITRBCache trb_cache = { .count = 0 };
     USBEndpoint *ep = NULL;
     uint64_t mfindex;
     unsigned int count = 0;
@@ -1954,7 +1999,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
 
     epctx->kick_active++;
     while (1) {
-        length = xhci_ring_chain_length(xhci, ring);
+        length = xhci_ring_chain_length(xhci, ring, &trb_cache);
         if (length <= 0) {
             if (epctx->type == ET_ISO_OUT || epctx->type == ET_ISO_IN) {
                 /* 4.10.3.1 */
@@ -1975,7 +2020,8 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
 
         for (i = 0; i < length; i++) {
             TRBType type;
-            type = xhci_ring_fetch(xhci, ring, &xfer->trbs[i], NULL);
+            type = xhci_ring_fetch(xhci, ring, &xfer->trbs[i], NULL,
+                                   &trb_cache);
             if (!type) {
                 xhci_die(xhci);
                 xhci_ep_free_xfer(xfer);
@@ -2477,7 +2523,8 @@ static void xhci_process_commands(XHCIState *xhci)
 
     xhci->crcr_low |= CRCR_CRR;
 
-    while ((type = xhci_ring_fetch(xhci, &xhci->cmd_ring, &trb, &addr))) {
+    while ((type = xhci_ring_fetch(xhci, &xhci->cmd_ring, &trb, &addr,
+                                   NULL))) {
         event.ptr = addr;
         switch (type) {
         case CR_ENABLE_SLOT:
@@ -31,6 +31,7 @@
 #include "exec/memory.h"
 #include "exec/ram_addr.h"
 #include "hw/hw.h"
+#include "qemu/bitmap.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/range.h"
@@ -1131,12 +1132,99 @@ static int vfio_device_dma_logging_report(VFIODevice *vbasedev, hwaddr iova,
     return 0;
 }
 
+/*
+ * With several devices in a container, their DMA logging reports are
+ * fetched concurrently, each into its own bitmap, and merged afterwards.
+ */
+typedef struct VFIODirtyReport {
+    QemuThread thread;
+    VFIODevice *vbasedev;
+    VFIOBitmap vbmap;
+    hwaddr iova;
+    hwaddr size;
+    int ret;
+} VFIODirtyReport;
+
+static void *vfio_device_dma_logging_report_thread(void *opaque)
+{
+    VFIODirtyReport *report = opaque;
+
+    report->ret = vfio_device_dma_logging_report(report->vbasedev,
+                                                 report->iova, report->size,
+                                                 report->vbmap.bitmap);
+    return NULL;
+}
+
+static int vfio_devices_query_dirty_bitmap_parallel(
+                 const VFIOContainerBase *bcontainer, int ndevices,
+                 VFIOBitmap *vbmap, hwaddr iova, hwaddr size, Error **errp)
+{
+    g_autofree VFIODirtyReport *reports = g_new0(VFIODirtyReport, ndevices);
+    VFIODevice *vbasedev;
+    int i = 0, ret = 0;
+
+    /* The first device reports into @vbmap from this thread */
+    QLIST_FOREACH(vbasedev, &bcontainer->device_list, container_next) {
+        VFIODirtyReport *report = &reports[i++];
+
+        report->vbasedev = vbasedev;
+        report->iova = iova;
+        report->size = size;
+        if (report == reports) {
+            report->vbmap = *vbmap;
+            continue;
+        }
+
+        report->ret = vfio_bitmap_alloc(&report->vbmap, size);
+        if (!report->ret) {
+            qemu_thread_create(&report->thread, "vfio-dirty",
+                               vfio_device_dma_logging_report_thread, report,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+
+    vfio_device_dma_logging_report_thread(&reports[0]);
+
+    for (i = 0; i < ndevices; i++) {
+        VFIODirtyReport *report = &reports[i];
+
+        if (i > 0 && report->vbmap.bitmap) {
+            qemu_thread_join(&report->thread);
+            if (!report->ret) {
+                bitmap_or(vbmap->bitmap, vbmap->bitmap, report->vbmap.bitmap,
+                          vbmap->pages);
+            }
+            g_free(report->vbmap.bitmap);
+        }
+
+        if (report->ret && !ret) {
+            ret = report->ret;
+            error_setg_errno(errp, -ret,
+                             "%s: Failed to get DMA logging report, iova: "
+                             "0x%" HWADDR_PRIx ", size: 0x%" HWADDR_PRIx,
+                             report->vbasedev->name, iova, size);
+        }
+    }
+
+    return ret;
+}
+
 int vfio_devices_query_dirty_bitmap(const VFIOContainerBase *bcontainer,
                  VFIOBitmap *vbmap, hwaddr iova, hwaddr size, Error **errp)
 {
     VFIODevice *vbasedev;
+    int ndevices = 0;
     int ret;
 
+    QLIST_FOREACH(vbasedev, &bcontainer->device_list, container_next) {
+        ndevices++;
+    }
+    if (ndevices > 1) {
+        return vfio_devices_query_dirty_bitmap_parallel(bcontainer, ndevices,
+                                                        vbmap, iova, size,
+                                                        errp);
+    }
+
     QLIST_FOREACH(vbasedev, &bcontainer->device_list, container_next) {
         ret = vfio_device_dma_logging_report(vbasedev, iova, size,
                                              vbmap->bitmap);
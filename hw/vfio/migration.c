@@ -12,6 +12,8 @@
 #include "qemu/cutils.h"
 #include "qemu/units.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/stats64.h"
 #include <linux/vfio.h>
 #include <sys/ioctl.h>
 
@@ -47,6 +49,22 @@
 #define VFIO_MIG_FLAG_DEV_SETUP_STATE   (0xffffffffef100003ULL)
 #define VFIO_MIG_FLAG_DEV_DATA_STATE    (0xffffffffef100004ULL)
 #define VFIO_MIG_FLAG_DEV_INIT_DATA_SENT (0xffffffffef100005ULL)
+#define VFIO_MIG_FLAG_DEV_DATA_STATE_MULTIFD (0xffffffffef100006ULL)
+
+/*
+ * With x-migration-multifd-transfer, the stop-copy data is split into
+ * buffers that travel over the multifd channels, each prefixed with
+ * this header.  The last buffer is empty and has the END flag set.
+ */
+#define VFIO_DEVICE_STATE_PACKET_VERSION 0
+#define VFIO_DEVICE_STATE_PACKET_FLAG_END (1 << 0)
+
+typedef struct VFIODeviceStatePacket {
+    uint32_t version;
+    uint32_t idx;
+    uint32_t flags;
+    uint8_t data[];
+} QEMU_PACKED VFIODeviceStatePacket;
 
 /*
  * This is an arbitrary size based on migration of mlx5 devices, where typically
@@ -55,7 +73,7 @@
  */
 #define VFIO_MIG_DEFAULT_DATA_BUFFER_SIZE (1 * MiB)
 
-static int64_t bytes_transferred;
+static Stat64 bytes_transferred;
 
 static const char *mig_state_to_str(enum vfio_device_mig_state state)
 {
@@ -382,7 +400,7 @@ static ssize_t vfio_save_block(QEMUFile *f, VFIOMigration *migration)
     qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
     qemu_put_be64(f, data_size);
     qemu_put_buffer(f, migration->data_buffer, data_size);
-    bytes_transferred += data_size;
+    stat64_add(&bytes_transferred, data_size);
 
     trace_vfio_save_block(migration->vbasedev->name, data_size);
 
@@ -494,6 +512,9 @@ static int vfio_save_setup(QEMUFile *f, void *opaque, Error **errp)
         }
     }
 
+    migration->multifd_transfer = vbasedev->migration_multifd_transfer &&
+                                  multifd_device_state_supported();
+
     trace_vfio_save_setup(vbasedev->name, migration->data_buffer_size);
 
     qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
@@ -633,6 +654,15 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
     int ret;
     Error *local_err = NULL;
 
+    if (vbasedev->migration->multifd_transfer) {
+        /* The data goes out from vfio_save_complete_precopy_thread() */
+        qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE_MULTIFD);
+        qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
+        ret = qemu_file_get_error(f);
+        trace_vfio_save_complete_precopy(vbasedev->name, ret);
+        return ret;
+    }
+
     /* We reach here with device state STOP or STOP_COPY only */
     ret = vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_STOP_COPY,
                                    VFIO_DEVICE_STATE_STOP, &local_err);
@@ -656,6 +686,75 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
     return ret;
 }
 
+static int vfio_save_complete_precopy_thread(char *idstr,
+                                             uint32_t instance_id,
+                                             bool *abort_flag,
+                                             void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    g_autofree VFIODeviceStatePacket *packet = NULL;
+    Error *local_err = NULL;
+    ssize_t data_size;
+    uint32_t idx;
+    int ret;
+
+    if (!migration->multifd_transfer) {
+        return 0;
+    }
+
+    /* We reach here with device state STOP or STOP_COPY only */
+    ret = vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_STOP_COPY,
+                                   VFIO_DEVICE_STATE_STOP, &local_err);
+    if (ret) {
+        error_report_err(local_err);
+        return ret;
+    }
+
+    packet = g_malloc0(sizeof(*packet) + migration->data_buffer_size);
+    packet->version = cpu_to_be32(VFIO_DEVICE_STATE_PACKET_VERSION);
+
+    for (idx = 0; ; idx++) {
+        if (qatomic_read(abort_flag)) {
+            ret = -ECANCELED;
+            break;
+        }
+
+        data_size = read(migration->data_fd, packet->data,
+                         migration->data_buffer_size);
+        if (data_size < 0) {
+            if (errno != ENOMSG) {
+                ret = -errno;
+                error_report("%s: Failed to read device state: %s",
+                             vbasedev->name, strerror(errno));
+                break;
+            }
+            /* Same as in vfio_save_block(): no more data */
+            data_size = 0;
+        }
+
+        packet->idx = cpu_to_be32(idx);
+        packet->flags = cpu_to_be32(data_size ? 0 :
+                                    VFIO_DEVICE_STATE_PACKET_FLAG_END);
+
+        if (!multifd_queue_device_state(idstr, instance_id, (char *)packet,
+                                        sizeof(*packet) + data_size)) {
+            ret = -EIO;
+            break;
+        }
+
+        stat64_add(&bytes_transferred, data_size);
+
+        if (!data_size) {
+            break;
+        }
+    }
+
+    trace_vfio_save_complete_precopy_thread(vbasedev->name, idx, ret);
+
+    return ret;
+}
+
 static void vfio_save_state(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
@@ -671,17 +770,65 @@ static void vfio_save_state(QEMUFile *f, void *opaque)
     }
 }
 
+static void vfio_load_buf_free(gpointer data)
+{
+    /* Slots of buffers that were already written are NULL */
+    if (data) {
+        g_byte_array_unref(data);
+    }
+}
+
 static int vfio_load_setup(QEMUFile *f, void *opaque, Error **errp)
 {
     VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+
+    /*
+     * Whether the source uses multifd is only known once its stream
+     * arrives, so be ready to take buffers whenever it could.
+     */
+    if (multifd_device_state_supported()) {
+        qemu_mutex_init(&migration->load_bufs_mutex);
+        qemu_cond_init(&migration->load_bufs_cond);
+        migration->load_bufs = g_ptr_array_new_with_free_func(vfio_load_buf_free);
+        migration->load_bufs_thread_running = false;
+        migration->load_bufs_thread_exit = false;
+        migration->load_buf_idx = 0;
+        migration->load_buf_idx_last = UINT32_MAX;
+        migration->load_bufs_expected = false;
+        migration->load_bufs_complete = false;
+        migration->load_bufs_ret = 0;
+    }
 
     return vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_RESUMING,
-                                    vbasedev->migration->device_state, errp);
+                                    migration->device_state, errp);
+}
+
+static void vfio_load_bufs_thread_stop(VFIOMigration *migration)
+{
+    if (!migration->load_bufs_thread_running) {
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&migration->load_bufs_mutex) {
+        migration->load_bufs_thread_exit = true;
+        qemu_cond_broadcast(&migration->load_bufs_cond);
+    }
+    qemu_thread_join(&migration->load_bufs_thread);
+    migration->load_bufs_thread_running = false;
 }
 
 static int vfio_load_cleanup(void *opaque)
 {
     VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+
+    if (migration->load_bufs) {
+        vfio_load_bufs_thread_stop(migration);
+        g_clear_pointer(&migration->load_bufs, g_ptr_array_unref);
+        qemu_cond_destroy(&migration->load_bufs_cond);
+        qemu_mutex_destroy(&migration->load_bufs_mutex);
+    }
 
     vfio_migration_cleanup(vbasedev);
     trace_vfio_load_cleanup(vbasedev->name);
@@ -689,6 +836,167 @@ static int vfio_load_cleanup(void *opaque)
     return 0;
 }
 
+static int vfio_load_state_buffer(void *opaque, char *buf, size_t len,
+                                  Error **errp)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    VFIODeviceStatePacket *packet = (VFIODeviceStatePacket *)buf;
+    uint32_t idx, flags;
+    int ret;
+
+    if (!migration->load_bufs) {
+        error_setg(errp, "%s: got device state buffer without multifd "
+                   "device state support", vbasedev->name);
+        return -EINVAL;
+    }
+
+    if (len < sizeof(*packet) ||
+        be32_to_cpu(packet->version) != VFIO_DEVICE_STATE_PACKET_VERSION) {
+        error_setg(errp, "%s: invalid device state buffer", vbasedev->name);
+        return -EINVAL;
+    }
+
+    idx = be32_to_cpu(packet->idx);
+    flags = be32_to_cpu(packet->flags);
+    trace_vfio_load_state_device_buffer(vbasedev->name, idx, len);
+
+    QEMU_LOCK_GUARD(&migration->load_bufs_mutex);
+
+    if (migration->load_bufs_ret) {
+        error_setg(errp, "%s: device state load already failed",
+                   vbasedev->name);
+        return migration->load_bufs_ret;
+    }
+
+    if (idx < migration->load_buf_idx ||
+        idx > migration->load_buf_idx_last ||
+        (idx < migration->load_bufs->len &&
+         g_ptr_array_index(migration->load_bufs, idx))) {
+        error_setg(errp, "%s: unexpected device state buffer %"PRIu32,
+                   vbasedev->name, idx);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    if (flags & VFIO_DEVICE_STATE_PACKET_FLAG_END) {
+        if (migration->load_bufs->len > idx + 1) {
+            error_setg(errp, "%s: device state buffer %"PRIu32" is not last",
+                       vbasedev->name, idx);
+            ret = -EINVAL;
+            goto fail;
+        }
+        migration->load_buf_idx_last = idx;
+    }
+
+    if (idx >= migration->load_bufs->len) {
+        g_ptr_array_set_size(migration->load_bufs, idx + 1);
+    }
+    g_ptr_array_index(migration->load_bufs, idx) =
+        g_byte_array_append(g_byte_array_new(), packet->data,
+                            len - sizeof(*packet));
+
+    /*
+     * Nothing is written to the device here, so that the multifd channel
+     * is not held up by the device: that is up to load_bufs_thread.
+     */
+    qemu_cond_broadcast(&migration->load_bufs_cond);
+
+    return 0;
+
+fail:
+    migration->load_bufs_ret = ret;
+    qemu_cond_broadcast(&migration->load_bufs_cond);
+    return ret;
+}
+
+/*
+ * Write the buffers to the device in sequence, as they arrive.  This only
+ * starts once the main channel is done with the device data, as it loads
+ * that into the same data_fd.
+ */
+static void *vfio_load_bufs_thread(void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    GByteArray *buf;
+    uint32_t idx;
+    int ret;
+
+    QEMU_LOCK_GUARD(&migration->load_bufs_mutex);
+
+    while (!migration->load_bufs_complete) {
+        idx = migration->load_buf_idx;
+        buf = idx < migration->load_bufs->len ?
+              g_ptr_array_index(migration->load_bufs, idx) : NULL;
+
+        if (migration->load_bufs_ret || migration->load_bufs_thread_exit) {
+            break;
+        }
+        if (!buf) {
+            qemu_cond_wait(&migration->load_bufs_cond,
+                           &migration->load_bufs_mutex);
+            continue;
+        }
+
+        /* Only this thread advances load_buf_idx and frees the slot */
+        qemu_mutex_unlock(&migration->load_bufs_mutex);
+        ret = 0;
+        if (buf->len &&
+            qemu_write_full(migration->data_fd, buf->data, buf->len) !=
+            (ssize_t)buf->len) {
+            ret = -errno;
+            error_report("%s: Failed to load device state buffer %"PRIu32
+                         ": %s", vbasedev->name, idx, strerror(-ret));
+        }
+        trace_vfio_load_state_device_data(vbasedev->name, buf->len, ret);
+        qemu_mutex_lock(&migration->load_bufs_mutex);
+
+        g_ptr_array_index(migration->load_bufs, idx) = NULL;
+        g_byte_array_unref(buf);
+
+        if (ret) {
+            migration->load_bufs_ret = ret;
+        } else if (idx == migration->load_buf_idx_last) {
+            trace_vfio_load_state_device_buffers_complete(vbasedev->name,
+                                                          idx + 1);
+            migration->load_bufs_complete = true;
+        }
+        migration->load_buf_idx++;
+        qemu_cond_broadcast(&migration->load_bufs_cond);
+    }
+
+    return NULL;
+}
+
+/*
+ * Called from the main channel right before the config state: wait for
+ * load_bufs_thread to write all of the buffers.
+ */
+static int vfio_load_bufs_wait(VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    int ret = 0;
+
+    WITH_QEMU_LOCK_GUARD(&migration->load_bufs_mutex) {
+        while (!migration->load_bufs_complete && !migration->load_bufs_ret) {
+            if (multifd_device_state_recv_aborted()) {
+                error_report("%s: multifd channels closed before all device "
+                             "state arrived", vbasedev->name);
+                migration->load_bufs_ret = -ECANCELED;
+                break;
+            }
+            qemu_cond_timedwait(&migration->load_bufs_cond,
+                                &migration->load_bufs_mutex, 100);
+        }
+        ret = migration->load_bufs_ret;
+    }
+
+    vfio_load_bufs_thread_stop(migration);
+
+    return ret;
+}
+
 static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
 {
     VFIODevice *vbasedev = opaque;
@@ -703,8 +1011,35 @@ static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
         switch (data) {
         case VFIO_MIG_FLAG_DEV_CONFIG_STATE:
         {
+            if (vbasedev->migration->load_bufs_expected) {
+                ret = vfio_load_bufs_wait(vbasedev);
+                if (ret) {
+                    return ret;
+                }
+            }
             return vfio_load_device_config_state(f, opaque);
         }
+        case VFIO_MIG_FLAG_DEV_DATA_STATE_MULTIFD:
+        {
+            if (!vbasedev->migration->load_bufs) {
+                error_report("%s: device state sent over multifd, but "
+                             "multifd device state is not supported here",
+                             vbasedev->name);
+                return -EINVAL;
+            }
+            if (vbasedev->migration->load_bufs_expected) {
+                error_report("%s: multifd device state announced twice",
+                             vbasedev->name);
+                return -EINVAL;
+            }
+            /* Nothing else goes to data_fd from the main channel now */
+            vbasedev->migration->load_bufs_expected = true;
+            vbasedev->migration->load_bufs_thread_running = true;
+            qemu_thread_create(&vbasedev->migration->load_bufs_thread,
+                               "mig/dst/vfio", vfio_load_bufs_thread,
+                               vbasedev, QEMU_THREAD_JOINABLE);
+            break;
+        }
         case VFIO_MIG_FLAG_DEV_SETUP_STATE:
         {
             data = qemu_get_be64(f);
@@ -721,6 +1056,12 @@ static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
         {
             uint64_t data_size = qemu_get_be64(f);
 
+            if (vbasedev->migration->load_bufs_expected) {
+                error_report("%s: device data after the multifd transfer "
+                             "started", vbasedev->name);
+                return -EINVAL;
+            }
+
             if (data_size) {
                 ret = vfio_load_buffer(f, vbasedev, data_size);
                 if (ret < 0) {
@@ -777,10 +1118,12 @@ static const SaveVMHandlers savevm_vfio_handlers = {
     .is_active_iterate = vfio_is_active_iterate,
     .save_live_iterate = vfio_save_iterate,
     .save_live_complete_precopy = vfio_save_complete_precopy,
+    .save_live_complete_precopy_thread = vfio_save_complete_precopy_thread,
     .save_state = vfio_save_state,
     .load_setup = vfio_load_setup,
     .load_cleanup = vfio_load_cleanup,
     .load_state = vfio_load_state,
+    .load_state_buffer = vfio_load_state_buffer,
     .switchover_ack_needed = vfio_switchover_ack_needed,
 };
 
@@ -997,12 +1340,12 @@ static int vfio_block_migration(VFIODevice *vbasedev, Error *err, Error **errp)
 
 int64_t vfio_mig_bytes_transferred(void)
 {
-    return bytes_transferred;
+    return stat64_get(&bytes_transferred);
 }
 
 void vfio_reset_bytes_transferred(void)
 {
-    bytes_transferred = 0;
+    stat64_set(&bytes_transferred, 0);
 }
 
 /*
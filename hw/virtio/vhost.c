@@ -17,6 +17,7 @@
 #include "qapi/error.h"
 #include "hw/virtio/vhost.h"
 #include "qemu/atomic.h"
+#include "qemu/cutils.h"
 #include "qemu/range.h"
 #include "qemu/error-report.h"
 #include "qemu/memfd.h"
@@ -87,6 +88,21 @@ unsigned int vhost_get_free_memslots(void)
     return free;
 }
 
+/* Marks a run of pages of the vhost log dirty with a single call */
+static void vhost_dev_sync_run(MemoryRegionSection *section,
+                               hwaddr page_addr, hwaddr len)
+{
+    hwaddr section_offset = page_addr - section->offset_within_address_space;
+    hwaddr mr_offset = section_offset + section->offset_within_region;
+
+    if (len) {
+        memory_region_set_dirty(section->mr, mr_offset, len);
+    }
+}
+
+/* Clean stretches of the log are skipped this many chunks at a time */
+#define VHOST_LOG_SKIP_CHUNKS 64
+
 static void vhost_dev_sync_region(struct vhost_dev *dev,
                                   MemoryRegionSection *section,
                                   uint64_t mfirst, uint64_t mlast,
@@ -99,6 +115,7 @@ static void vhost_dev_sync_region(struct vhost_dev *dev,
     vhost_log_chunk_t *from = dev_log + start / VHOST_LOG_CHUNK;
     vhost_log_chunk_t *to = dev_log + end / VHOST_LOG_CHUNK + 1;
     uint64_t addr = QEMU_ALIGN_DOWN(start, VHOST_LOG_CHUNK);
+    hwaddr run_addr = 0, run_len = 0;
 
     if (end < start) {
         return;
@@ -108,6 +125,14 @@ static void vhost_dev_sync_region(struct vhost_dev *dev,
 
     for (;from < to; ++from) {
         vhost_log_chunk_t log;
+
+        /* Most of the log is usually clean, skip it in large steps */
+        if (to - from >= VHOST_LOG_SKIP_CHUNKS &&
+            buffer_is_zero(from, VHOST_LOG_SKIP_CHUNKS * sizeof(*from))) {
+            from += VHOST_LOG_SKIP_CHUNKS - 1;
+            addr += VHOST_LOG_SKIP_CHUNKS * VHOST_LOG_CHUNK;
+            continue;
+        }
         /* We first check with non-atomic: much cheaper,
          * and we expect non-dirty to be the common case. */
         if (!*from) {
@@ -119,17 +144,28 @@ static void vhost_dev_sync_region(struct vhost_dev *dev,
         log = qatomic_xchg(from, 0);
         while (log) {
             int bit = ctzl(log);
-            hwaddr page_addr;
-            hwaddr section_offset;
-            hwaddr mr_offset;
-            page_addr = addr + bit * VHOST_LOG_PAGE;
-            section_offset = page_addr - section->offset_within_address_space;
-            mr_offset = section_offset + section->offset_within_region;
-            memory_region_set_dirty(section->mr, mr_offset, VHOST_LOG_PAGE);
-            log &= ~(0x1ull << bit);
+            /* Length of the run of set bits starting at @bit */
+            int nbits = ctzl(~(log >> bit));
+            hwaddr page_addr = addr + bit * VHOST_LOG_PAGE;
+
+            if (bit + nbits >= VHOST_LOG_BITS) {
+                log = 0;
+            } else {
+                log &= ~((((vhost_log_chunk_t)1 << nbits) - 1) << bit);
+            }
+
+            /* Runs continue across chunks */
+            if (run_len && page_addr == run_addr + run_len) {
+                run_len += nbits * VHOST_LOG_PAGE;
+            } else {
+                vhost_dev_sync_run(section, run_addr, run_len);
+                run_addr = page_addr;
+                run_len = nbits * VHOST_LOG_PAGE;
+            }
         }
         addr += VHOST_LOG_CHUNK;
     }
+    vhost_dev_sync_run(section, run_addr, run_len);
 }
 
 bool vhost_dev_has_iommu(struct vhost_dev *dev)
@@ -626,6 +662,7 @@ static void vhost_commit(MemoryListener *listener)
     struct vhost_dev *dev = container_of(listener, struct vhost_dev,
                                          memory_listener);
     MemoryRegionSection *old_sections;
+    struct vhost_memory *old_mem;
     int n_old_sections;
     uint64_t log_size;
     size_t regions_size;
@@ -663,7 +700,8 @@ static void vhost_commit(MemoryListener *listener)
     /* Rebuild the regions list from the new sections list */
     regions_size = offsetof(struct vhost_memory, regions) +
                        dev->n_mem_sections * sizeof dev->mem->regions[0];
-    dev->mem = g_realloc(dev->mem, regions_size);
+    old_mem = dev->mem;
+    dev->mem = g_malloc(regions_size);
     dev->mem->nregions = dev->n_mem_sections;
 
     if (dev->vhost_ops->vhost_backend_no_private_memslots &&
@@ -685,7 +723,18 @@ static void vhost_commit(MemoryListener *listener)
         cur_vmr->flags_padding   = 0;
     }
 
-    if (!dev->started) {
+    /*
+     * Sections can change without changing what the backend sees, for
+     * example when neighbouring sections of one RAM block are split or
+     * merged again.  Do not make every backend remap its memory then.
+     */
+    changed = old_mem->nregions != dev->mem->nregions ||
+              memcmp(old_mem->regions, dev->mem->regions,
+                     dev->mem->nregions * sizeof dev->mem->regions[0]);
+    g_free(old_mem);
+    trace_vhost_commit_regions(dev->started, changed);
+
+    if (!dev->started || !changed) {
         goto out;
     }
 
@@ -323,11 +323,34 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+/* Range of a reported free page run, discarded as late as possible */
+typedef struct VirtIOBalloonReport {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+} VirtIOBalloonReport;
+
+static void virtio_balloon_report_flush(VirtIOBalloon *dev,
+                                        VirtIOBalloonReport *report)
+{
+    if (report->size &&
+        !ram_block_discard_range(report->rb, report->offset, report->size)) {
+        dev->free_page_report_discarded += report->size;
+    }
+    report->size = 0;
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
+    VirtIOBalloonReport report = { };
     VirtQueueElement *elem;
+    bool notify = false;
 
+    /*
+     * Guests report free pages in chunks of a few MiB, often adjacent
+     * ones, so merge contiguous ranges into a single discard.
+     */
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
@@ -374,14 +397,31 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            if (report.size && report.rb == rb &&
+                report.offset + report.size == ram_offset) {
+                report.size += size;
+                continue;
+            }
+            virtio_balloon_report_flush(dev, &report);
+            report.rb = rb;
+            report.offset = ram_offset;
+            report.size = size;
         }
 
 skip_element:
+        /*
+         * The guest may reuse the pages as soon as the element is back,
+         * so the discard must be done by then.
+         */
+        virtio_balloon_report_flush(dev, &report);
         virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
+        notify = true;
         g_free(elem);
     }
+
+    if (notify) {
+        virtio_notify(vdev, vq);
+    }
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -989,6 +1029,10 @@ static void virtio_balloon_instance_init(Object *obj)
                         balloon_stats_get_poll_interval,
                         balloon_stats_set_poll_interval,
                         NULL, NULL);
+
+    object_property_add_uint64_ptr(obj, "free-page-report-discarded",
+                                   &s->free_page_report_discarded,
+                                   OBJ_PROP_FLAG_READ);
 }
 
 static const VMStateDescription vmstate_virtio_balloon = {
@@ -1003,14 +1003,20 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
     unsigned int iov_cnt;
     struct iovec *iov;
     void *buf = NULL;
+    bool notify = false;
     size_t sz;
 
+    /*
+     * With strict invalidation, guests queue a MAP or UNMAP request for
+     * each DMA.  Complete all the pending ones before interrupting the
+     * guest.
+     */
     for (;;) {
         size_t output_size = sizeof(tail);
 
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         if (iov_size(elem->in_sg, elem->in_num) < sizeof(tail) ||
@@ -1086,11 +1092,15 @@ out:
         assert(sz == output_size);
 
         virtqueue_push(vq, elem, sz);
-        virtio_notify(vdev, vq);
+        notify = true;
         g_free(elem);
         g_free(buf);
         buf = NULL;
     }
+
+    if (notify) {
+        virtio_notify(vdev, vq);
+    }
 }
 
 static void virtio_iommu_report_fault(VirtIOIOMMU *viommu, uint8_t reason,
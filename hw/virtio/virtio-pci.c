@@ -941,6 +941,59 @@ static int kvm_virtio_pci_vector_config_use(VirtIOPCIProxy *proxy)
     return kvm_virtio_pci_vector_use_one(proxy, VIRTIO_CONFIG_IRQ_IDX);
 }
 
+/* Drop the references taken by kvm_virtio_pci_vector_routes_get() */
+static void kvm_virtio_pci_vector_routes_put(VirtIOPCIProxy *proxy, int nvqs)
+{
+    unsigned int vector;
+    EventNotifier *n;
+    int queue_no;
+
+    for (queue_no = VIRTIO_CONFIG_IRQ_IDX; queue_no < nvqs; queue_no++) {
+        if (virtio_pci_get_notifier(proxy, queue_no, &n, &vector) < 0) {
+            break;
+        }
+        if (vector >= msix_nr_vectors_allocated(&proxy->pci_dev)) {
+            continue;
+        }
+        kvm_virtio_pci_vq_vector_release(proxy, vector);
+    }
+}
+
+/*
+ * Take a reference to the routes of the config interrupt and of the
+ * first @nvqs queues, adding the missing ones in a single routing table
+ * reload.  KVM looks up the route of an irqfd when it is assigned, so
+ * the routes must be committed before kvm_virtio_pci_vector_vq_use()
+ * and kvm_virtio_pci_vector_config_use() assign irqfds to them.
+ */
+static int kvm_virtio_pci_vector_routes_get(VirtIOPCIProxy *proxy, int nvqs)
+{
+    unsigned int vector;
+    EventNotifier *n;
+    int queue_no;
+    int ret = 0;
+
+    kvm_irqchip_begin_route_batch(kvm_state);
+    for (queue_no = VIRTIO_CONFIG_IRQ_IDX; queue_no < nvqs; queue_no++) {
+        if (virtio_pci_get_notifier(proxy, queue_no, &n, &vector) < 0) {
+            break;
+        }
+        if (vector >= msix_nr_vectors_allocated(&proxy->pci_dev)) {
+            continue;
+        }
+        ret = kvm_virtio_pci_vq_vector_use(proxy, vector);
+        if (ret < 0) {
+            break;
+        }
+    }
+    kvm_irqchip_end_route_batch(kvm_state);
+
+    if (ret < 0) {
+        kvm_virtio_pci_vector_routes_put(proxy, queue_no);
+    }
+    return ret;
+}
+
 static void kvm_virtio_pci_vector_release_one(VirtIOPCIProxy *proxy,
                                               int queue_no)
 {
@@ -1277,11 +1330,18 @@ static int virtio_pci_set_guest_notifiers(DeviceState *d, int nvqs, bool assign)
             proxy->vector_irqfd =
                 g_malloc0(sizeof(*proxy->vector_irqfd) *
                           msix_nr_vectors_allocated(&proxy->pci_dev));
+            /* One routing table reload for all vectors of the device */
+            r = kvm_virtio_pci_vector_routes_get(proxy, nvqs);
+            if (r < 0) {
+                goto config_assign_error;
+            }
             r = kvm_virtio_pci_vector_vq_use(proxy, nvqs);
             if (r < 0) {
+                kvm_virtio_pci_vector_routes_put(proxy, nvqs);
                 goto config_assign_error;
             }
             r = kvm_virtio_pci_vector_config_use(proxy);
+            kvm_virtio_pci_vector_routes_put(proxy, nvqs);
             if (r < 0) {
                 goto config_error;
             }
@@ -0,0 +1,126 @@
+/*
+ * Virtqueue statistics for the query-stats QMP command
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/virtio/virtio.h"
+#include "qapi/qapi-types-stats.h"
+#include "qemu/module.h"
+#include "sysemu/stats.h"
+
+/* Every statistic is a list with one value per virtqueue */
+static const struct {
+    const char *name;
+    size_t offset;
+} virtio_stats_fields[] = {
+    { "kicks", offsetof(VirtQueueStats, kicks) },
+    { "elements", offsetof(VirtQueueStats, elements) },
+    { "notifications", offsetof(VirtQueueStats, notifications) },
+    { "suppressed-notifications",
+      offsetof(VirtQueueStats, suppressed_notifications) },
+};
+
+typedef struct VirtioStatsState {
+    StatsResultList **result;
+    strList *names;
+} VirtioStatsState;
+
+static int virtio_stats_dev(Object *child, void *opaque)
+{
+    VirtioStatsState *s = opaque;
+    Object *dev = object_dynamic_cast(child, TYPE_VIRTIO_DEVICE);
+    VirtIODevice *vdev;
+    g_autofree VirtQueueStats *vq_stats = NULL;
+    g_autofree char *qom_path = NULL;
+    StatsList *stats_list = NULL;
+    int num_queues;
+    int i, j;
+
+    if (!dev || !DEVICE(dev)->realized) {
+        return 0;
+    }
+
+    vdev = VIRTIO_DEVICE(dev);
+    num_queues = virtio_get_num_queues(vdev);
+    if (!num_queues) {
+        return 0;
+    }
+
+    vq_stats = g_new(VirtQueueStats, num_queues);
+    for (i = 0; i < num_queues; i++) {
+        virtio_queue_get_stats(vdev, i, &vq_stats[i]);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(virtio_stats_fields); i++) {
+        uint64List *values = NULL;
+        Stats *st;
+
+        if (!apply_str_list_filter(virtio_stats_fields[i].name, s->names)) {
+            continue;
+        }
+
+        for (j = num_queues - 1; j >= 0; j--) {
+            QAPI_LIST_PREPEND(values,
+                              *(uint64_t *)((char *)&vq_stats[j] +
+                                            virtio_stats_fields[i].offset));
+        }
+
+        st = g_new0(Stats, 1);
+        st->name = g_strdup(virtio_stats_fields[i].name);
+        st->value = g_new0(StatsValue, 1);
+        st->value->type = QTYPE_QLIST;
+        st->value->u.list = values;
+        QAPI_LIST_PREPEND(stats_list, st);
+    }
+
+    if (stats_list) {
+        qom_path = object_get_canonical_path(dev);
+        add_stats_entry(s->result, STATS_PROVIDER_VIRTIO, qom_path,
+                        stats_list);
+    }
+    return 0;
+}
+
+static void virtio_stats_cb(StatsResultList **result, StatsTarget target,
+                            strList *names, strList *targets, Error **errp)
+{
+    VirtioStatsState s = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_VIRTIO) {
+        return;
+    }
+
+    object_child_foreach_recursive(object_get_root(), virtio_stats_dev, &s);
+}
+
+static void virtio_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(virtio_stats_fields); i++) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(virtio_stats_fields[i].name);
+        value->type = STATS_TYPE_CUMULATIVE;
+        QAPI_LIST_PREPEND(stats_list, value);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_VIRTIO, STATS_TARGET_VIRTIO,
+                     stats_list);
+}
+
+static void virtio_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_VIRTIO, virtio_stats_cb,
+                        virtio_schemas_cb, false);
+}
+
+type_init(virtio_stats_register);
@@ -27,6 +27,7 @@
 #include "hw/virtio/vhost.h"
 #include "migration/qemu-file-types.h"
 #include "qemu/atomic.h"
+#include "qemu/stats64.h"
 #include "hw/virtio/virtio-bus.h"
 #include "hw/qdev-properties.h"
 #include "hw/virtio/virtio-access.h"
@@ -117,10 +118,35 @@ typedef struct VRingPackedDescEvent {
     uint16_t flags;
 } VRingPackedDescEvent ;
 
+/*
+ * Maximum number of descriptors (in_num + out_num) of an element that can be
+ * served from the element pool, larger elements fall back to g_malloc().
+ */
+#define VIRTQUEUE_ELEMENT_POOL_MAX_SG 8
+
+typedef struct VirtQueueElementSlot {
+    QSLIST_ENTRY(VirtQueueElementSlot) next;
+} VirtQueueElementSlot;
+
+struct VirtQueueElementPool {
+    /* Size of each slot, fixed on the first allocation */
+    size_t slot_size;
+
+    /* Only accessed by the thread that pops from the virtqueue */
+    QSLIST_HEAD(, VirtQueueElementSlot) free;
+
+    /* Elements freed from any thread, moved to @free when it runs empty */
+    QSLIST_HEAD(, VirtQueueElementSlot) returned;
+
+    /* One reference for the VirtQueue plus one per outstanding element */
+    unsigned int refcnt;
+};
+
 struct VirtQueue
 {
     VRing vring;
     VirtQueueElement *used_elems;
+    VirtQueueElementPool *elem_pool;
 
     /* Next head to pop */
     uint16_t last_avail_idx;
@@ -153,6 +179,12 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Statistics for query-stats, see VirtQueueStats */
+    Stat64 kicks;
+    Stat64 elements;
+    Stat64 notifications;
+    Stat64 suppressed_notifications;
 };
 
 const char *virtio_device_names[] = {
@@ -1648,10 +1680,70 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * The layout only depends on the total number of descriptors, so elements
+ * for any split between in_num and out_num fit into the same amount of memory.
+ */
+static size_t virtqueue_element_size(size_t sz, unsigned num)
 {
     VirtQueueElement *elem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
+    size_t addr_end = in_addr_ofs + num * sizeof(elem->in_addr[0]);
+    size_t in_sg_ofs = QEMU_ALIGN_UP(addr_end, __alignof__(elem->in_sg[0]));
+
+    return in_sg_ofs + num * sizeof(elem->in_sg[0]);
+}
+
+static void virtqueue_element_pool_unref(VirtQueueElementPool *pool)
+{
+    VirtQueueElementSlot *slot, *next;
+
+    if (qatomic_fetch_dec(&pool->refcnt) != 1) {
+        return;
+    }
+
+    QSLIST_FOREACH_SAFE(slot, &pool->free, next, next) {
+        g_free(slot);
+    }
+    QSLIST_FOREACH_SAFE(slot, &pool->returned, next, next) {
+        g_free(slot);
+    }
+    g_free(pool);
+}
+
+static void *virtqueue_element_pool_get(VirtQueueElementPool *pool,
+                                        size_t size)
+{
+    VirtQueueElementSlot *slot;
+
+    if (!pool->slot_size) {
+        pool->slot_size = size;
+    }
+    if (size > pool->slot_size) {
+        return NULL;
+    }
+
+    if (QSLIST_EMPTY(&pool->free)) {
+        QSLIST_MOVE_ATOMIC(&pool->free, &pool->returned);
+    }
+
+    slot = QSLIST_FIRST(&pool->free);
+    if (slot) {
+        QSLIST_REMOVE_HEAD(&pool->free, next);
+    } else {
+        slot = g_malloc(pool->slot_size);
+    }
+
+    qatomic_inc(&pool->refcnt);
+    return slot;
+}
+
+static void *virtqueue_alloc_element(VirtQueue *vq, size_t sz,
+                                     unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem = NULL;
+    VirtQueueElementPool *pool = NULL;
+    size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
@@ -1659,7 +1751,21 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+
+    if (vq && vq->elem_pool &&
+        in_num + out_num <= VIRTQUEUE_ELEMENT_POOL_MAX_SG) {
+        size_t size = virtqueue_element_size(sz,
+                                             VIRTQUEUE_ELEMENT_POOL_MAX_SG);
+
+        elem = virtqueue_element_pool_get(vq->elem_pool, size);
+        if (elem) {
+            pool = vq->elem_pool;
+        }
+    }
+    if (!elem) {
+        elem = g_malloc(out_sg_end);
+    }
+
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -1667,10 +1773,43 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     elem->out_addr = (void *)elem + out_addr_ofs;
     elem->in_sg = (void *)elem + in_sg_ofs;
     elem->out_sg = (void *)elem + out_sg_ofs;
+    elem->pool = pool;
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+void virtqueue_element_free(void *opaque)
+{
+    VirtQueueElement *elem = opaque;
+    VirtQueueElementPool *pool;
+    VirtQueueElementSlot *slot;
+
+    if (!elem) {
+        return;
+    }
+
+    pool = elem->pool;
+    if (!pool) {
+        g_free(elem);
+        return;
+    }
+
+    slot = opaque;
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->returned, slot, next);
+    virtqueue_element_pool_unref(pool);
+}
+
+void virtio_queue_enable_element_pool(VirtQueue *vq)
+{
+    if (vq->elem_pool) {
+        return;
+    }
+
+    vq->elem_pool = g_new0(VirtQueueElementPool, 1);
+    vq->elem_pool->refcnt = 1;
+}
+
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz,
+                                 bool update_avail_event)
 {
     unsigned int i, head, max, idx;
     VRingMemoryRegionCaches *caches;
@@ -1709,7 +1848,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (update_avail_event &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -1784,7 +1924,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1924,7 +2064,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1967,15 +2107,93 @@ err_undo_map:
 
 void *virtqueue_pop(VirtQueue *vq, size_t sz)
 {
+    void *elem;
+
     if (virtio_device_disabled(vq->vdev)) {
         return NULL;
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        elem = virtqueue_packed_pop(vq, sz);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        elem = virtqueue_split_pop(vq, sz, true);
+    }
+
+    if (elem) {
+        stat64_add(&vq->elements, 1);
     }
+    return elem;
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    VirtIODevice *vdev = vq->vdev;
+    bool packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vdev)) {
+        return 0;
+    }
+
+    /*
+     * Keep the RCU read side critical section (and with it the region
+     * caches) across the whole batch and only publish the avail event once
+     * at the end instead of once per element.
+     */
+    RCU_READ_LOCK_GUARD();
+
+    while (n < max) {
+        void *elem = packed ? virtqueue_packed_pop(vq, sz) :
+                              virtqueue_split_pop(vq, sz, false);
+        if (!elem) {
+            break;
+        }
+        elems[n++] = elem;
+
+        /* virtio_error() may have been called for a later element */
+        if (virtio_device_disabled(vdev)) {
+            break;
+        }
+    }
+
+    if (n && !packed && !vdev->broken &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    stat64_add(&vq->elements, n);
+    trace_virtqueue_pop_batch(vq, n, max);
+    return n;
+}
+
+void *virtqueue_pop_batched(VirtQueue *vq, size_t sz, VirtQueuePopBatch *batch)
+{
+    if (batch->next == batch->num) {
+        batch->next = 0;
+        batch->num = virtqueue_pop_batch(vq, sz, batch->elems,
+                                         ARRAY_SIZE(batch->elems));
+        if (!batch->num) {
+            return NULL;
+        }
+    } else if (virtio_device_disabled(vq->vdev)) {
+        /* Don't hand out elements popped before the device broke */
+        virtqueue_pop_batch_drop(vq, batch);
+        return NULL;
+    }
+
+    return batch->elems[batch->next++];
+}
+
+void virtqueue_pop_batch_drop(VirtQueue *vq, VirtQueuePopBatch *batch)
+{
+    while (batch->next < batch->num) {
+        VirtQueueElement *elem = batch->elems[batch->next++];
+
+        virtqueue_detach_element(vq, elem, 0);
+        virtqueue_element_free(elem);
+    }
+    batch->next = batch->num = 0;
 }
 
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
@@ -2113,7 +2331,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2418,6 +2636,18 @@ int virtio_queue_get_max_num(VirtIODevice *vdev, int n)
     return vdev->vq[n].vring.num_default;
 }
 
+void virtio_queue_get_stats(VirtIODevice *vdev, int n,
+                            VirtQueueStats *stats)
+{
+    VirtQueue *vq = &vdev->vq[n];
+
+    stats->kicks = stat64_get(&vq->kicks);
+    stats->elements = stat64_get(&vq->elements);
+    stats->notifications = stat64_get(&vq->notifications);
+    stats->suppressed_notifications =
+        stat64_get(&vq->suppressed_notifications);
+}
+
 int virtio_get_num_queues(VirtIODevice *vdev)
 {
     int i;
@@ -2481,6 +2711,7 @@ static void virtio_queue_notify_vq(VirtQueue *vq)
         }
 
         trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
+        stat64_add(&vq->kicks, 1);
         vq->handle_output(vdev, vq);
 
         if (unlikely(vdev->start_on_kick)) {
@@ -2501,6 +2732,7 @@ void virtio_queue_notify(VirtIODevice *vdev, int n)
     if (vq->host_notifier_enabled) {
         event_notifier_set(&vq->host_notifier);
     } else if (vq->handle_output) {
+        stat64_add(&vq->kicks, 1);
         vq->handle_output(vdev, vq);
 
         if (unlikely(vdev->start_on_kick)) {
@@ -2561,6 +2793,11 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    if (vq->elem_pool) {
+        /* Outstanding elements keep the pool alive until they are freed */
+        virtqueue_element_pool_unref(vq->elem_pool);
+        vq->elem_pool = NULL;
+    }
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2662,6 +2899,19 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+bool virtio_queue_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    RCU_READ_LOCK_GUARD();
+
+    if (!virtio_should_notify(vdev, vq)) {
+        stat64_add(&vq->suppressed_notifications, 1);
+        return false;
+    }
+
+    stat64_add(&vq->notifications, 1);
+    return true;
+}
+
 /* Batch irqs while inside a defer_call_begin()/defer_call_end() section */
 static void virtio_notify_irqfd_deferred_fn(void *opaque)
 {
@@ -2676,11 +2926,13 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
+            stat64_add(&vq->suppressed_notifications, 1);
             return;
         }
     }
 
     trace_virtio_notify_irqfd(vdev, vq);
+    stat64_add(&vq->notifications, 1);
 
     /*
      * virtio spec 1.0 says ISR bit 0 should be ignored with MSI, but
@@ -2711,11 +2963,13 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
+            stat64_add(&vq->suppressed_notifications, 1);
             return;
         }
     }
 
     trace_virtio_notify(vdev, vq);
+    stat64_add(&vq->notifications, 1);
     virtio_irq(vq);
 }
 
@@ -4014,7 +4268,7 @@ static Property virtio_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -4084,7 +4338,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
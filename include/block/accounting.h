@@ -79,6 +79,28 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
+/*
+ * Log-linear latency histogram used to compute percentiles, in the style of
+ * HDR histograms: every power of two is split into
+ * BLOCK_LATENCY_PCT_SUB_BUCKETS equally sized buckets, so the relative error
+ * of any reported value is bounded by 1 / BLOCK_LATENCY_PCT_SUB_BUCKETS,
+ * independently of its magnitude.  Latencies below
+ * BLOCK_LATENCY_PCT_SUB_BUCKETS nanoseconds are counted exactly, latencies of
+ * 2^BLOCK_LATENCY_PCT_MAX_BITS nanoseconds (about 18 minutes) and more all end
+ * up in the last bucket.
+ */
+#define BLOCK_LATENCY_PCT_SUB_BITS      4
+#define BLOCK_LATENCY_PCT_SUB_BUCKETS   (1 << BLOCK_LATENCY_PCT_SUB_BITS)
+#define BLOCK_LATENCY_PCT_MAX_BITS      40
+#define BLOCK_LATENCY_PCT_BUCKETS \
+    ((BLOCK_LATENCY_PCT_MAX_BITS - BLOCK_LATENCY_PCT_SUB_BITS + 1) * \
+     BLOCK_LATENCY_PCT_SUB_BUCKETS)
+
+typedef struct BlockLatencyPercentileHistogram {
+    uint64_t count;
+    uint64_t buckets[BLOCK_LATENCY_PCT_BUCKETS];
+} BlockLatencyPercentileHistogram;
+
 struct BlockAcctStats {
     QemuMutex lock;
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
@@ -92,6 +114,7 @@ struct BlockAcctStats {
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    BlockLatencyPercentileHistogram latency_pct[BLOCK_MAX_IOTYPE];
 };
 
 typedef struct BlockAcctCookie {
@@ -120,5 +143,13 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
+bool block_latency_percentiles(BlockAcctStats *stats, enum BlockAcctType type,
+                               const double *percentiles, uint64_t *values,
+                               int count);
+bool block_latency_percentiles_since(BlockAcctStats *stats,
+                                     enum BlockAcctType type,
+                                     BlockLatencyPercentileHistogram *since,
+                                     const double *percentiles,
+                                     uint64_t *values, int count);
 
 #endif
@@ -218,6 +218,7 @@ struct AioContext {
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+    bool fdmon_io_uring_multishot; /* kernel supports multishot poll */
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -229,7 +230,8 @@ struct AioContext {
     int poll_disable_cnt;
 
     /* Polling mode parameters */
-    int64_t poll_ns;        /* current polling time in nanoseconds */
+    int64_t poll_ns;        /* current polling time in nanoseconds, the
+                               maximum of the polled handlers' times */
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
@@ -237,6 +239,11 @@ struct AioContext {
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
 
+    /* io_uring parameters, see aio_context_set_io_uring_params() */
+    bool io_uring_sqpoll;
+    int64_t io_uring_sqpoll_idle_ms;
+    int64_t io_uring_sqpoll_cpu;
+
     /*
      * List of handlers participating in userspace polling.  Protected by
      * ctx->list_lock.  Iterated and modified mostly by the event loop thread
@@ -713,6 +720,23 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
  */
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
 
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @sqpoll: whether the kernel polls the submission queue of the io_uring ring
+ *          in a dedicated thread, so that no system call is needed to submit
+ *          requests
+ * @sqpoll_idle_ms: how long the kernel thread keeps polling without new
+ *                  requests before going to sleep, 0 means the kernel default
+ * @sqpoll_cpu: the host CPU to bind the kernel thread to, -1 for no binding
+ *
+ * These parameters only take effect when the io_uring ring for block I/O is
+ * set up, so they cannot be changed afterwards.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int64_t sqpoll_idle_ms,
+                                     int64_t sqpoll_cpu, Error **errp);
+
 /**
  * aio_context_set_thread_pool_params:
  * @ctx: the aio context
@@ -82,6 +82,21 @@ bool block_copy_call_failed(BlockCopyCallState *call_state);
 bool block_copy_call_cancelled(BlockCopyCallState *call_state);
 int block_copy_call_status(BlockCopyCallState *call_state, bool *error_is_read);
 
+/*
+ * Let block_copy() calls stage copies: read the source data into memory
+ * (at most @max_bytes at a time) and return before it has been written to the
+ * target.  Zero disables staging.  Must be called prior any actual copy
+ * request.
+ */
+void block_copy_set_staging(BlockCopyState *s, uint64_t max_bytes);
+
+/*
+ * Wait until all staged copies intersecting @offset/@bytes have reached the
+ * target.  Returns the error of the first staged copy that failed, if any.
+ */
+int coroutine_fn block_copy_wait_staged(BlockCopyState *s, int64_t offset,
+                                        int64_t bytes);
+
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed);
 void block_copy_kick(BlockCopyCallState *call_state);
 
@@ -55,6 +55,10 @@ int co_wrapper_mixed_bdrv_rdlock
 bdrv_pwrite(BdrvChild *child, int64_t offset,int64_t bytes,
             const void *buf, BdrvRequestFlags flags);
 
+int co_wrapper_mixed_bdrv_rdlock
+bdrv_pwritev(BdrvChild *child, int64_t offset, int64_t bytes,
+             QEMUIOVector *qiov, BdrvRequestFlags flags);
+
 int co_wrapper_mixed_bdrv_rdlock
 bdrv_pwrite_sync(BdrvChild *child, int64_t offset, int64_t bytes,
                  const void *buf, BdrvRequestFlags flags);
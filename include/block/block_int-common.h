@@ -30,6 +30,7 @@
 #include "block/snapshot.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
+#include "qemu/seqlock.h"
 #include "qemu/stats64.h"
 
 #define BLOCK_FLAG_LAZY_REFCOUNTS   8
@@ -56,6 +57,7 @@
 #define BLOCK_OPT_DATA_FILE         "data_file"
 #define BLOCK_OPT_DATA_FILE_RAW     "data_file_raw"
 #define BLOCK_OPT_COMPRESSION_TYPE  "compression_type"
+#define BLOCK_OPT_COMPRESSION_DICT  "compression_dictionary"
 #define BLOCK_OPT_EXTL2             "extended_l2"
 
 #define BLOCK_PROBE_BUF_SIZE        512
@@ -84,12 +86,20 @@ typedef struct BdrvTrackedRequest {
     int64_t overlap_bytes;
 
     QLIST_ENTRY(BdrvTrackedRequest) list;
+    struct BdrvTrackedRequestShard *shard; /* the list @list belongs to */
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
     struct BdrvTrackedRequest *waiting_for;
 } BdrvTrackedRequest;
 
+#define BDRV_TRACKED_REQUEST_SHARDS 8
+
+typedef struct BdrvTrackedRequestShard {
+    QemuMutex lock;
+    QLIST_HEAD(, BdrvTrackedRequest) reqs;
+} BdrvTrackedRequestShard;
+
 
 struct BlockDriver {
     /*
@@ -1210,6 +1220,18 @@ struct BlockDriverState {
     QemuMutex dirty_bitmap_mutex;
     QLIST_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
 
+    /*
+     * Range that is known to be set in all enabled dirty bitmaps, so that
+     * bdrv_set_dirty() can skip taking dirty_bitmap_mutex for writes that
+     * only touch already dirty areas.  Written with dirty_bitmap_mutex held;
+     * read locklessly under dirty_bitmap_seqlock.  Any other taker of
+     * dirty_bitmap_mutex empties the range, because it may clear bits or
+     * enable bitmaps.
+     */
+    QemuSeqLock dirty_bitmap_seqlock;
+    int64_t dirty_known_offset;
+    int64_t dirty_known_bytes;
+
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
@@ -1235,9 +1257,16 @@ struct BlockDriverState {
 
     unsigned int write_gen;               /* Current data generation */
 
+    /*
+     * In-flight requests. Requests are added to the shard of the thread that
+     * starts them, so that iothreads don't contend on a single lock. Each
+     * list is protected by the lock of its shard; looking for conflicts with
+     * serialising requests takes the locks of all shards.
+     */
+    BdrvTrackedRequestShard tracked_requests[BDRV_TRACKED_REQUEST_SHARDS];
+
     /* Protected by reqs_lock.  */
     QemuMutex reqs_lock;
-    QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
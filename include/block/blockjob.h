@@ -64,6 +64,13 @@ typedef struct BlockJob {
      */
     RateLimit limit;
 
+    /**
+     * State of the latency-driven rate control, or %NULL if it is not
+     * enabled.  See block_job_set_latency_target_locked().
+     * Always modified and read under the BQL (GLOBAL_STATE_CODE).
+     */
+    struct BlockJobLatencyControl *latency_ctl;
+
     /**
      * Block other operations when block job is running.
      * Always modified and read under the BQL (GLOBAL_STATE_CODE).
@@ -173,6 +180,24 @@ bool block_job_has_bdrv(BlockJob *job, BlockDriverState *bs);
  */
 bool block_job_set_speed_locked(BlockJob *job, int64_t speed, Error **errp);
 
+/**
+ * block_job_set_latency_target_locked:
+ * @job: The job to control.
+ * @blk: The BlockBackend whose request latency is watched.
+ * @target_ns: The 99th percentile latency to keep @blk's requests under, or 0
+ *             to disable the control.
+ * @errp: Error object.
+ *
+ * Let the job's rate follow the latency that @blk's users see: the rate is
+ * lowered while the 99th percentile of their request latencies is above
+ * @target_ns, and raised while it is below, up to the speed set with
+ * block_job_set_speed_locked() (if any).
+ *
+ * Called with job lock held, but might release it temporarily.
+ */
+bool block_job_set_latency_target_locked(BlockJob *job, BlockBackend *blk,
+                                         uint64_t target_ns, Error **errp);
+
 /**
  * block_job_change_locked:
  * @job: The job to change.
@@ -80,6 +80,31 @@ struct BlockExport {
     QLIST_ENTRY(BlockExport) next;
 };
 
+/* IOThreads named in an export's options, each of them referenced */
+typedef struct BlockExportIOThreads {
+    struct IOThread **iothreads;
+    size_t num_iothreads;
+} BlockExportIOThreads;
+
+bool blk_exp_iothreads_init(BlockExportIOThreads *threads, strList *iothreads,
+                            Error **errp);
+void blk_exp_iothreads_cleanup(BlockExportIOThreads *threads);
+
+/*
+ * IOThreads in which the virtqueues of an export are processed. Virtqueue i is
+ * assigned to threads.iothreads[i % threads.num_iothreads], its AioContext is
+ * vq_ctx[i].
+ */
+typedef struct BlockExportVqIOThreads {
+    BlockExportIOThreads threads;
+    AioContext **vq_ctx;
+} BlockExportVqIOThreads;
+
+bool blk_exp_vq_iothreads_init(BlockExportVqIOThreads *vq_iothreads,
+                               strList *iothreads, uint16_t num_queues,
+                               Error **errp);
+void blk_exp_vq_iothreads_cleanup(BlockExportVqIOThreads *vq_iothreads);
+
 BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp);
 BlockExport *blk_exp_find(const char *id);
 void blk_exp_ref(BlockExport *exp);
@@ -66,7 +66,8 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(bool sqpoll, unsigned int sqpoll_idle_ms,
+                         int sqpoll_cpu, Error **errp);
 void luring_cleanup(LuringState *s);
 
 /* luring_co_submit: submit I/O requests in the thread's current AioContext. */
@@ -74,6 +75,16 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
+
+/*
+ * Register memory as fixed buffers and file descriptors as registered files
+ * with all io_uring rings.  These are optimizations only, so failure is not
+ * reported; requests for unregistered memory or files work as before.
+ */
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
+void luring_register_file(int fd);
+void luring_unregister_file(int fd);
 #endif
 
 #ifdef _WIN32
@@ -62,6 +62,13 @@ typedef struct ThrottleGroupMember {
 #define TYPE_THROTTLE_GROUP "throttle-group"
 OBJECT_DECLARE_SIMPLE_TYPE(ThrottleGroup, THROTTLE_GROUP)
 
+/* Cumulative counters of a group, for the query-stats QMP command */
+typedef struct ThrottleGroupStats {
+    uint64_t requests[THROTTLE_MAX];    /* requests that passed the group */
+    uint64_t throttled[THROTTLE_MAX];   /* those that had to wait */
+    uint64_t bytes[THROTTLE_MAX];
+} ThrottleGroupStats;
+
 const char *throttle_group_get_name(ThrottleGroupMember *tgm);
 
 ThrottleState *throttle_group_incref(const char *name);
@@ -88,4 +95,11 @@ void throttle_group_detach_aio_context(ThrottleGroupMember *tgm);
  */
 bool throttle_group_exists(const char *name);
 
+/*
+ * throttle_group_next() must be called under the global mutex.
+ * Returns the first group if @tg is NULL, and NULL after the last one.
+ */
+ThrottleGroup *throttle_group_next(ThrottleGroup *tg);
+void throttle_group_get_stats(ThrottleGroup *tg, ThrottleGroupStats *stats);
+
 #endif
@@ -60,6 +60,8 @@ struct SocketChardev {
     int do_nodelay;
     int *read_msgfds;
     size_t read_msgfds_num;
+    uint8_t *read_buf;
+    int read_buf_size;
     int *write_msgfds;
     size_t write_msgfds_num;
     bool registered_yank;
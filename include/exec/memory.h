@@ -765,6 +765,7 @@ struct MemoryRegion {
     bool nonvolatile;
     bool rom_device;
     bool flush_coalesced_mmio;
+    bool lockless_io;
     bool unmergeable;
     uint8_t dirty_log_mask;
     bool is_iommu;
@@ -2237,6 +2238,22 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_enable_lockless_io: Dispatch accesses without the BQL.
+ *
+ * Accesses from vCPU threads to a region with lockless I/O enabled are
+ * dispatched without taking the BQL.  The callbacks of the region must
+ * therefore be thread-safe and protect the device state they touch
+ * themselves.  Because accesses may run concurrently, the re-entrancy
+ * guard of the owning device is not applied to the region either.
+ *
+ * Regions that need a coalesced MMIO flush before access still take the
+ * BQL.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_enable_lockless_io(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
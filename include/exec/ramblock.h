@@ -45,6 +45,16 @@ struct RAMBlock {
     size_t page_size;
     /* dirty bitmap used during migration */
     unsigned long *bmap;
+    /*
+     * Pages that were dirtied again after being sent, as of the last
+     * dirty bitmap sync.  Only used by the defer-hot-pages capability.
+     */
+    unsigned long *hot_bmap;
+    /*
+     * Pages queued for postcopy prefetching, protected by the RAMState's
+     * src_page_req_mutex.  Only allocated for postcopy.
+     */
+    unsigned long *prefetch_bmap;
 
     /*
      * Below fields are only used by mapped-ram migration
@@ -198,8 +198,15 @@ struct CPUClass {
  */
 #define NB_MMU_MODES 16
 
-/* Use a fully associative victim tlb of 8 entries. */
-#define CPU_VTLB_SIZE 8
+/*
+ * Use a set associative victim tlb of 8 sets with 4 ways each.  The set
+ * is chosen by a hash of the page number: the pages that conflict in
+ * the direct mapped main tlb share its index bits.
+ */
+#define CPU_VTLB_SET_BITS 3
+#define CPU_VTLB_SETS (1 << CPU_VTLB_SET_BITS)
+#define CPU_VTLB_WAYS 4
+#define CPU_VTLB_SIZE (CPU_VTLB_SETS * CPU_VTLB_WAYS)
 
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
@@ -282,8 +289,10 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
-    size_t vindex;
+    /* number of valid entries evicted from the main table in the window */
+    size_t window_evictions;
+    /* The next way to use in each set of the tlb victim table.  */
+    uint8_t vindex[CPU_VTLB_SETS];
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
@@ -302,6 +311,12 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * A synchronisation point for the *_all_cpus_synced flushes has been
+     * queued on this cpu and has not run yet.  Only accessed by the cpu
+     * itself.
+     */
+    bool sync_pending;
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -310,6 +325,8 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t vtlb_hit_count;
+    size_t fill_count;
 } CPUTLBCommon;
 
 /*
@@ -489,6 +506,8 @@ struct CPUState {
     bool exit_request;
     int exclusive_context_count;
     uint32_t cflags_next_tb;
+    /* set by the TCG sampling profiler, cleared when the sample is taken */
+    bool profile_sample_pending;
     /* updates protected by BQL */
     uint32_t interrupt_request;
     int singlestep_enabled;
@@ -94,6 +94,15 @@ struct VTDPASIDEntry {
     uint64_t val[8];
 };
 
+struct VTDIOTLBEntry {
+    uint64_t gfn;
+    uint16_t domain_id;
+    uint32_t pasid;
+    uint64_t slpte;
+    uint64_t mask;
+    uint8_t access_flags;
+};
+
 struct VTDAddressSpace {
     PCIBus *bus;
     uint8_t devfn;
@@ -106,6 +115,10 @@ struct VTDAddressSpace {
     MemoryRegion iommu_ir_fault; /* Interrupt region for catching fault */
     IntelIOMMUState *iommu_state;
     VTDContextCacheEntry context_cache_entry;
+    /* Copy of the IOTLB entry used last, valid if iotlb_gen still matches */
+    VTDIOTLBEntry last_iotlb;
+    uint16_t last_iotlb_sid;
+    uint64_t last_iotlb_gen;
     QLIST_ENTRY(VTDAddressSpace) next;
     /* Superset of notifier flags that this address space has */
     IOMMUNotifierFlag notifier_flags;
@@ -148,15 +161,6 @@ struct VTDAddressSpace {
     IOVATree *iova_tree;
 };
 
-struct VTDIOTLBEntry {
-    uint64_t gfn;
-    uint16_t domain_id;
-    uint32_t pasid;
-    uint64_t slpte;
-    uint64_t mask;
-    uint8_t access_flags;
-};
-
 /* VT-d Source-ID Qualifier types */
 enum {
     VTD_SQ_FULL = 0x00,     /* Full SID verification */
@@ -286,6 +290,7 @@ struct IntelIOMMUState {
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
     GHashTable *iotlb;              /* IOTLB */
+    uint64_t iotlb_gen;             /* Bumped when IOTLB entries go away */
 
     GHashTable *vtd_address_spaces;             /* VTD address spaces */
     VTDAddressSpace *vtd_as_cache[VTD_PCI_BUS_MAX]; /* VTD address space cache */
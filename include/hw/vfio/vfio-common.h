@@ -73,6 +73,26 @@ typedef struct VFIOMigration {
     uint64_t precopy_init_size;
     uint64_t precopy_dirty_size;
     bool initial_data_sent;
+
+    /* Send the stop-copy state over the multifd channels */
+    bool multifd_transfer;
+    /*
+     * Destination side of the multifd transfer: buffers may arrive out
+     * of order and are held in @load_bufs.  Once the main channel is done
+     * with the device data, @load_bufs_thread writes them to the device
+     * in sequence, and the config state waits for it to finish.
+     */
+    QemuMutex load_bufs_mutex;
+    QemuCond load_bufs_cond;
+    GPtrArray *load_bufs;
+    QemuThread load_bufs_thread;
+    bool load_bufs_thread_running;
+    bool load_bufs_thread_exit;
+    uint32_t load_buf_idx;
+    uint32_t load_buf_idx_last;
+    bool load_bufs_expected;
+    bool load_bufs_complete;
+    int load_bufs_ret;
 } VFIOMigration;
 
 struct VFIOGroup;
@@ -131,6 +151,7 @@ typedef struct VFIODevice {
     bool ram_block_discard_allowed;
     OnOffAuto enable_migration;
     bool migration_events;
+    bool migration_multifd_transfer;
     VFIODeviceOps *ops;
     unsigned int num_irqs;
     unsigned int num_regions;
@@ -48,6 +48,9 @@ struct VirtIOBlkConf
     uint32_t max_discard_sectors;
     uint32_t max_write_zeroes_sectors;
     bool x_enable_wce_if_config_wce;
+    uint32_t irq_coalesce_count;
+    uint32_t irq_coalesce_usecs;
+    uint32_t merge_window_usecs;
 };
 
 struct VirtIOBlockReq;
@@ -71,6 +74,12 @@ struct VirtIOBlock {
      */
     AioContext **vq_aio_context;
 
+    /* Used ring batching and interrupt coalescing state for each virtqueue */
+    struct VirtIOBlockVqCompletion *vq_completion;
+
+    /* Read/write requests held back across kicks for merging, per virtqueue */
+    struct VirtIOBlockVqMerge *vq_merge;
+
     uint64_t host_features;
     size_t config_size;
     BlockRAMRegistrar blk_ram_registrar;
@@ -98,6 +107,14 @@ typedef struct MultiReqBuffer {
     VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
     unsigned int num_reqs;
     bool is_write;
+
+    /* Adjacent discard or write zeroes requests, chained through mr_next */
+    VirtIOBlockReq *dwz_head;
+    VirtIOBlockReq *dwz_tail;
+    uint64_t dwz_sector;
+    uint32_t dwz_num_sectors;
+    uint32_t dwz_flags;
+    bool dwz_is_write_zeroes;
 } MultiReqBuffer;
 
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq);
@@ -20,6 +20,7 @@
 #include "net/announce.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "qapi/qapi-types-virtio.h"
 
 #include "ebpf/ebpf_rss.h"
 
@@ -161,6 +162,8 @@ typedef struct VirtIONetQueue {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+    /* IOThread processing this queue pair, NULL for the main loop */
+    AioContext *ctx;
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -227,6 +230,13 @@ struct VirtIONet {
     struct EBPFRSSContext ebpf_rss;
     uint32_t nr_ebpf_rss_fds;
     char **ebpf_rss_fds;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    /* IOThread AioContext of each queue pair, NULL without a mapping */
+    AioContext **vq_aio_context;
+    /* Queue pairs that had their host notifiers set up by ioeventfd start */
+    uint16_t ioeventfd_queue_pairs;
+    /* Nesting level of virtio_net_iothreads_detach() */
+    unsigned int iothreads_detached;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
@@ -62,6 +62,8 @@ typedef struct VirtQueue VirtQueue;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
+typedef struct VirtQueueElementPool VirtQueueElementPool;
+
 typedef struct VirtQueueElement
 {
     unsigned int index;
@@ -75,6 +77,8 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    /* Pool the element was allocated from, NULL if it was g_malloc()ed */
+    VirtQueueElementPool *pool;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -268,6 +272,74 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+
+/**
+ * virtio_queue_enable_element_pool:
+ * @vq: a VirtQueue pointer
+ *
+ * Serve elements popped from @vq from a per-virtqueue pool instead of
+ * allocating each of them with g_malloc().  Devices that call this must free
+ * all elements of @vq with virtqueue_element_free() rather than g_free().
+ */
+void virtio_queue_enable_element_pool(VirtQueue *vq);
+
+/**
+ * virtqueue_element_free:
+ * @elem: an element returned by virtqueue_pop() or
+ *        qemu_get_virtqueue_element(), or NULL
+ *
+ * Free @elem, returning it to its virtqueue's element pool if it came from
+ * one.  This may be called from any thread.
+ */
+void virtqueue_element_free(void *elem);
+
+/**
+ * virtqueue_pop_batch:
+ * @vq: a VirtQueue pointer
+ * @sz: size of the elements to allocate, as for virtqueue_pop()
+ * @elems: array that receives the popped elements
+ * @max: maximum number of elements to pop
+ *
+ * Pop up to @max elements in one go.  This is equivalent to calling
+ * virtqueue_pop() repeatedly, but the ring state is accessed under a single
+ * RCU read side critical section and, with VIRTIO_RING_F_EVENT_IDX, the avail
+ * event is only updated once for the whole batch.
+ *
+ * Returns: the number of elements stored in @elems
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
+
+#define VIRTQUEUE_POP_BATCH_SIZE 16
+
+/* Elements popped ahead of time by virtqueue_pop_batched() */
+typedef struct VirtQueuePopBatch {
+    void *elems[VIRTQUEUE_POP_BATCH_SIZE];
+    unsigned int num;
+    unsigned int next;
+} VirtQueuePopBatch;
+
+/**
+ * virtqueue_pop_batched:
+ * @vq: a VirtQueue pointer
+ * @sz: size of the elements to allocate, as for virtqueue_pop()
+ * @batch: zero-initialised batch state, must only be used with @vq
+ *
+ * Drop-in replacement for virtqueue_pop() in processing loops that refills
+ * @batch with virtqueue_pop_batch() whenever it runs empty.  Callers that may
+ * leave the loop before this returns NULL must call
+ * virtqueue_pop_batch_drop() afterwards.
+ */
+void *virtqueue_pop_batched(VirtQueue *vq, size_t sz, VirtQueuePopBatch *batch);
+
+/**
+ * virtqueue_pop_batch_drop:
+ * @vq: a VirtQueue pointer
+ * @batch: batch state used with virtqueue_pop_batched()
+ *
+ * Detach and free all elements in @batch that have not been handed out yet.
+ */
+void virtqueue_pop_batch_drop(VirtQueue *vq, VirtQueuePopBatch *batch);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -283,6 +355,12 @@ int virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
                               unsigned max_out_bytes);
 
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq);
+/*
+ * For devices that signal the guest notifier themselves: returns whether
+ * the driver wants to be notified about the buffers used since the last
+ * notification.
+ */
+bool virtio_queue_should_notify(VirtIODevice *vdev, VirtQueue *vq);
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq);
 
 int virtio_save(VirtIODevice *vdev, QEMUFile *f);
@@ -348,6 +426,20 @@ void virtio_queue_set_num(VirtIODevice *vdev, int n, int num);
 int virtio_queue_get_num(VirtIODevice *vdev, int n);
 int virtio_queue_get_max_num(VirtIODevice *vdev, int n);
 int virtio_get_num_queues(VirtIODevice *vdev);
+
+typedef struct VirtQueueStats {
+    /* Calls to the output handler, after a kick or a successful poll */
+    uint64_t kicks;
+    /* Elements popped; divided by @kicks, the average batch size */
+    uint64_t elements;
+    /* Interrupts sent to the guest */
+    uint64_t notifications;
+    /* Interrupts the guest asked not to receive */
+    uint64_t suppressed_notifications;
+} VirtQueueStats;
+
+void virtio_queue_get_stats(VirtIODevice *vdev, int n,
+                            VirtQueueStats *stats);
 void virtio_queue_set_rings(VirtIODevice *vdev, int n, hwaddr desc,
                             hwaddr avail, hwaddr used);
 void virtio_queue_update_rings(VirtIODevice *vdev, int n);
@@ -411,6 +503,12 @@ EventNotifier *virtio_queue_get_guest_notifier(VirtQueue *vq);
 void virtio_queue_set_guest_notifier_fd_handler(VirtQueue *vq, bool assign,
                                                 bool with_irqfd);
 int virtio_device_start_ioeventfd(VirtIODevice *vdev);
+/*
+ * Default VirtioDeviceClass::start_ioeventfd/stop_ioeventfd implementations,
+ * for devices that override them but still rely on the generic setup.
+ */
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev);
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev);
 int virtio_device_grab_ioeventfd(VirtIODevice *vdev);
 void virtio_device_release_ioeventfd(VirtIODevice *vdev);
 bool virtio_device_ioeventfd_enabled(VirtIODevice *vdev);
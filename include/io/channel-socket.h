@@ -49,6 +49,11 @@ struct QIOChannelSocket {
     socklen_t remoteAddrLen;
     ssize_t zero_copy_queued;
     ssize_t zero_copy_sent;
+    /* AIO fd handlers, called after reaping zero copy notifications */
+    IOHandler *zero_copy_io_read;
+    IOHandler *zero_copy_io_write;
+    void *zero_copy_read_opaque;
+    void *zero_copy_write_opaque;
 };
 
 
@@ -262,4 +267,36 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Try to enable MSG_ZEROCOPY for a connected socket, e.g. one
+ * returned by qio_channel_socket_accept(). Sockets connected
+ * with qio_channel_socket_connect_sync() already have it
+ * enabled where possible.
+ *
+ * Returns: true if QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY is set
+ */
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc);
+
+/**
+ * qio_channel_socket_zero_copy_poll:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Process the completion notifications of sends made with
+ * QIO_CHANNEL_WRITE_FLAG_ZERO_COPY that are available without
+ * blocking. Afterwards, the first @zero_copy_sent such sends
+ * have completed and their buffers may be reused.
+ *
+ * Unlike qio_channel_flush(), this never waits, so it can be
+ * used from coroutines and event loop callbacks.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc,
+                                      Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
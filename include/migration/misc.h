@@ -111,4 +111,12 @@ bool migration_in_bg_snapshot(void);
 /* migration/block-dirty-bitmap.c */
 void dirty_bitmap_mig_init(void);
 
+/* migration/multifd-device-state.c */
+bool multifd_queue_device_state(const char *idstr, uint32_t instance_id,
+                                const char *data, size_t len);
+bool multifd_device_state_supported(void);
+
+/* migration/multifd.c */
+bool multifd_device_state_recv_aborted(void);
+
 #endif
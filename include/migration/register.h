@@ -103,6 +103,29 @@ typedef struct SaveVMHandlers {
      */
     int (*save_live_complete_precopy)(QEMUFile *f, void *opaque);
 
+    /**
+     * @save_live_complete_precopy_thread
+     *
+     * Called at the end of a precopy phase from a separate thread,
+     * without the BQL, when the device state can be sent over the
+     * multifd channels (see multifd_device_state_supported()).  It
+     * runs concurrently with the other complete_precopy handlers and
+     * should send its data via multifd_queue_device_state().
+     *
+     * @idstr: this device section idstr
+     * @instance_id: this device section instance_id
+     * @abort_flag: flag indicating that the migration core wants to
+     * abort the transmission and the handler should exit ASAP.  To be
+     * read by qatomic_read() or similar.
+     * @opaque: data pointer passed to register_savevm_live()
+     *
+     * Returns zero to indicate success and negative for error
+     */
+    int (*save_live_complete_precopy_thread)(char *idstr,
+                                             uint32_t instance_id,
+                                             bool *abort_flag,
+                                             void *opaque);
+
     /* This runs both outside and inside the BQL.  */
 
     /**
@@ -227,6 +250,24 @@ typedef struct SaveVMHandlers {
      */
     int (*load_state)(QEMUFile *f, void *opaque, int version_id);
 
+    /**
+     * @load_state_buffer
+     *
+     * Load device state buffer provided to multifd_queue_device_state()
+     * on the source.  Called from a multifd receive thread, without
+     * the BQL, so it may run concurrently with itself and with any
+     * other handler of this device.
+     *
+     * @opaque: data pointer passed to register_savevm_live()
+     * @buf: the data buffer to load
+     * @len: the data length in buffer
+     * @errp: pointer to Error*, to store an error if it happens.
+     *
+     * Returns zero to indicate success and negative for error
+     */
+    int (*load_state_buffer)(void *opaque, char *buf, size_t len,
+                             Error **errp);
+
     /**
      * @load_setup
      *
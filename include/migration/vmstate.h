@@ -198,6 +198,15 @@ struct VMStateDescription {
      * a QEMU_VM_SECTION_START section.
      */
     bool early_setup;
+    /*
+     * The state described by this VMSD rarely changes once the guest
+     * runs.  With the device-state-precopy capability, it is sent
+     * during the setup phase of migration, and at switchover only
+     * if it changed since.  Devices with large state of which only a
+     * small part changes benefit most by describing that part in a
+     * separate VMSD.  Cannot be combined with early_setup.
+     */
+    bool precopy;
     int version_id;
     int minimum_version_id;
     MigrationPriority priority;
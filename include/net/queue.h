@@ -30,6 +30,14 @@ typedef struct NetQueue NetQueue;
 
 typedef void (NetPacketSent) (NetClientState *sender, ssize_t ret);
 
+/* Cumulative counters of a queue, for the query-stats QMP command */
+typedef struct NetQueueStats {
+    uint64_t packets;       /* packets delivered to the receiver */
+    uint64_t queued;        /* packets that waited for the receiver */
+    uint64_t queue_full;    /* packets that found the queue full */
+    uint64_t dropped;       /* packets dropped or rejected by the receiver */
+} NetQueueStats;
+
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
 
@@ -75,5 +83,6 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
 bool qemu_net_queue_flush(NetQueue *queue);
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats);
 
 #endif /* QEMU_NET_QUEUE_H */
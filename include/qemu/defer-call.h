@@ -11,6 +11,7 @@
 /* See documentation in util/defer-call.c */
 void defer_call_begin(void);
 void defer_call_end(void);
+void defer_call_flush(void);
 void defer_call(void (*fn)(void *), void *opaque);
 
 #endif /* QEMU_DEFER_CALL_H */
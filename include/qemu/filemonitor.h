@@ -36,6 +36,8 @@ typedef enum {
     QFILE_MONITOR_EVENT_ATTRIBUTES,
     /* Dir is no longer being monitored (due to deletion) */
     QFILE_MONITOR_EVENT_IGNORED,
+    /* Events were lost, anything in any dir may have changed */
+    QFILE_MONITOR_EVENT_OVERFLOW,
 } QFileMonitorEvent;
 
 
@@ -47,8 +49,9 @@ typedef enum {
  * @opaque: opaque data provided to qemu_file_monitor_add_watch()
  *
  * Invoked whenever a file changes. If @event is
- * QFILE_MONITOR_EVENT_IGNORED, @filename will be
- * empty.
+ * QFILE_MONITOR_EVENT_IGNORED or QFILE_MONITOR_EVENT_OVERFLOW,
+ * @filename will be empty. QFILE_MONITOR_EVENT_OVERFLOW is
+ * delivered to every watch.
  *
  */
 typedef void (*QFileMonitorHandler)(int64_t id,
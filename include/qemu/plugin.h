@@ -70,6 +70,7 @@ enum plugin_dyn_cb_type {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_COND,
     PLUGIN_CB_MEM_REGULAR,
+    PLUGIN_CB_MEM_BUFFER,
     PLUGIN_CB_INLINE_ADD_U64,
     PLUGIN_CB_INLINE_STORE_U64,
 };
@@ -96,6 +97,27 @@ struct qemu_plugin_conditional_cb {
     uint64_t imm;
 };
 
+/*
+ * Per-vCPU memory access buffers.  The scoreboard entry of a vCPU is an
+ * array of @capacity + 1 records, the first of which only holds in its
+ * vaddr field the number of records that follow.  Inline code does not
+ * branch, so it clamps that number to @capacity; with @capacity above
+ * @size by the accesses any single instruction can make, nothing is lost
+ * as the buffer is drained before each instrumented instruction.
+ */
+struct qemu_plugin_mem_buffer {
+    struct qemu_plugin_scoreboard *score;
+    size_t size;
+    size_t capacity;
+    qemu_plugin_vcpu_mem_buffer_cb_t cb;
+    void *userp;
+};
+
+struct qemu_plugin_buffer_cb {
+    struct qemu_plugin_mem_buffer *buf;
+    enum qemu_plugin_mem_rw rw;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -107,6 +129,7 @@ struct qemu_plugin_dyn_cb {
         struct qemu_plugin_regular_cb regular;
         struct qemu_plugin_conditional_cb cond;
         struct qemu_plugin_inline_cb inline_insn;
+        struct qemu_plugin_buffer_cb buffer;
     };
 };
 
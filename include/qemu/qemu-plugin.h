@@ -65,11 +65,15 @@ typedef uint64_t qemu_plugin_id_t;
  *
  * version 4:
  * - added qemu_plugin_read_memory_vaddr
+ *
+ * version 5:
+ * - added qemu_plugin_mem_buffer_{new,free,flush} and
+ *   qemu_plugin_register_vcpu_mem_buffer
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 4
+#define QEMU_PLUGIN_VERSION 5
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -701,6 +705,91 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * struct qemu_plugin_mem_record - a memory access stored in a buffer
+ * @vaddr: the virtual address of the access
+ * @info: the access information
+ *
+ * Only the accessors that decode @info itself, such as
+ * qemu_plugin_mem_size_shift() or qemu_plugin_mem_is_store(), can be
+ * used on it: qemu_plugin_get_hwaddr() and qemu_plugin_mem_get_value()
+ * need to run during the access.
+ */
+struct qemu_plugin_mem_record {
+    uint64_t vaddr;
+    qemu_plugin_meminfo_t info;
+};
+
+/**
+ * typedef qemu_plugin_vcpu_mem_buffer_cb_t - memory buffer drain function
+ * @vcpu_index: the vCPU the accesses took place on
+ * @records: the buffered accesses, oldest first
+ * @n: the number of records
+ * @userdata: opaque pointer given to qemu_plugin_mem_buffer_new()
+ */
+typedef void (*qemu_plugin_vcpu_mem_buffer_cb_t)(
+    unsigned int vcpu_index,
+    const struct qemu_plugin_mem_record *records,
+    size_t n, void *userdata);
+
+struct qemu_plugin_mem_buffer;
+
+/**
+ * qemu_plugin_mem_buffer_new() - allocate per-vCPU memory access buffers
+ * @n_records: number of accesses to collect before calling @cb
+ * @cb: callback draining the buffer of a vCPU
+ * @userdata: opaque pointer passed to @cb
+ *
+ * Accesses registered with qemu_plugin_register_vcpu_mem_buffer() are
+ * appended to the buffer of the vCPU by inline code. Once it holds at
+ * least @n_records accesses, @cb is called on that vCPU before the
+ * next instrumented instruction, so that the plugin handles them in
+ * bulk instead of taking a callback on every access.
+ *
+ * Returns a handle to pass to qemu_plugin_register_vcpu_mem_buffer().
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_mem_buffer *
+qemu_plugin_mem_buffer_new(size_t n_records,
+                           qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                           void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_free() - free memory access buffers
+ * @buf: buffers to free
+ *
+ * Any code instrumented with @buf must have been flushed first.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf);
+
+/**
+ * qemu_plugin_mem_buffer_flush() - drain the buffer of a vCPU
+ * @buf: memory access buffers
+ * @vcpu_index: vCPU whose buffer to drain
+ *
+ * Calls the drain callback with whatever the buffer of @vcpu_index
+ * holds. This must run on that vCPU, or when no vCPU runs, e.g. from
+ * the atexit callback.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf,
+                                  unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_register_vcpu_mem_buffer() - buffer memory accesses
+ * @insn: handle for instruction to instrument
+ * @rw: monitor reads, writes or both
+ * @buf: buffers to append the accesses to
+ *
+ * This appends every memory access generated by the instruction to the
+ * buffer of the vCPU, see qemu_plugin_mem_buffer_new().
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_buffer(struct qemu_plugin_insn *insn,
+                                          enum qemu_plugin_mem_rw rw,
+                                          struct qemu_plugin_mem_buffer *buf);
+
 /**
  * qemu_plugin_request_time_control() - request the ability to control time
  *
@@ -490,6 +490,17 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg,
                                  PCIDevice *dev);
 void kvm_irqchip_commit_routes(KVMState *s);
 
+/**
+ * kvm_irqchip_begin_route_batch/kvm_irqchip_end_route_batch:
+ *
+ * Defer kvm_irqchip_commit_routes() until the outermost batch ends, so
+ * that setting up many vectors only reloads the routing table once.
+ * Routes added inside the batch are not known to KVM until it ends, so
+ * irqfds must only be assigned to them afterwards.
+ */
+void kvm_irqchip_begin_route_batch(KVMState *s);
+void kvm_irqchip_end_route_batch(KVMState *s);
+
 static inline KVMRouteChange kvm_irqchip_begin_route_changes(KVMState *s)
 {
     return (KVMRouteChange) { .s = s, .changes = 0 };
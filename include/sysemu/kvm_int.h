@@ -89,6 +89,19 @@ enum KVMDirtyRingReaperState {
     KVM_DIRTY_RING_REAPER_REAPING,
 };
 
+/*
+ * Helper thread collecting the dirty rings of one shard of the vCPUs
+ * whenever all of the rings are reaped.
+ */
+struct KVMDirtyRingReapHelper {
+    QemuThread thread;
+    /* Posted to start reaping the shard */
+    QemuSemaphore sem;
+    unsigned int shard;
+    /* Dirty pages collected by the last reap */
+    uint64_t total;
+};
+
 /*
  * KVM reaper instance, responsible for collecting the KVM dirty bits
  * via the dirty ring.
@@ -98,6 +111,15 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /*
+     * The vCPUs are split in @nr_shards shards of consecutive indexes.
+     * The first shard is reaped by the thread asking for the reap, the
+     * others by @helpers.
+     */
+    unsigned int nr_shards;
+    unsigned int vcpus_per_shard;
+    struct KVMDirtyRingReapHelper *helpers;
+    QemuSemaphore helpers_done;
 };
 struct KVMState
 {
@@ -142,6 +164,10 @@ struct KVMState
     int nr_allocated_irq_routes;
     unsigned long *used_gsi_bitmap;
     unsigned int gsi_count;
+    /* irq_routes differs from the table last handed to KVM */
+    bool irq_routes_dirty;
+    /* nesting depth of kvm_irqchip_begin_route_batch() */
+    int irq_routes_batch;
 #endif
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
@@ -155,6 +181,7 @@ struct KVMState
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     bool kvm_dirty_ring_with_bitmap;
+    uint32_t kvm_dirty_ring_reapers; /* Number of vCPU shards, 0 for auto */
     uint64_t kvm_eager_split_size;  /* Eager Page Splitting chunk size */
     struct KVMDirtyRingReaper reaper;
     struct KVMMsrEnergy msr_energy;
@@ -82,6 +82,32 @@ void *qemu_alloc_stack(size_t *sz);
  */
 void qemu_free_stack(void *stack, size_t sz);
 
+/**
+ * qemu_alloc_pooled_stack:
+ * @sz: pointer to a size_t holding the requested usable stack size
+ *
+ * Like qemu_alloc_stack(), but the stack comes from a process-wide pool
+ * and is carved out of a larger mapping.  This is meant for stacks that
+ * are created and destroyed frequently, like coroutine stacks.  Every
+ * stack still has its own guard page.
+ *
+ * The allocated stack must be freed with qemu_free_pooled_stack().
+ *
+ * Returns: pointer to (the lowest address of) the stack memory.
+ */
+void *qemu_alloc_pooled_stack(size_t *sz);
+
+/**
+ * qemu_free_pooled_stack:
+ * @stack: stack to free
+ * @sz: size of stack in bytes
+ *
+ * Return a stack allocated via qemu_alloc_pooled_stack() to the pool.
+ * Note that sz must be exactly the adjusted stack size returned by
+ * qemu_alloc_pooled_stack().
+ */
+void qemu_free_pooled_stack(void *stack, size_t sz);
+
 /* POSIX and Mingw32 differ in the name of the stdio lock functions.  */
 
 static inline void qemu_flockfile(FILE *f)
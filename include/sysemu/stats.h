@@ -20,10 +20,13 @@ typedef void SchemaRetrieveFunc(StatsSchemaList **result, Error **errp);
  * @provider: stats provider checked against QMP command arguments
  * @stats_fn: routine to query stats:
  * @schema_fn: routine to query stat schemas:
+ * @allow_oob: @stats_fn is thread-safe and doesn't need the BQL, so
+ *     the provider is also available to out-of-band query-stats
  */
 void add_stats_callbacks(StatsProvider provider,
                          StatRetrieveFunc *stats_fn,
-                         SchemaRetrieveFunc *schemas_fn);
+                         SchemaRetrieveFunc *schemas_fn,
+                         bool allow_oob);
 
 /*
  * Helper routines for adding stats entries to the results lists.
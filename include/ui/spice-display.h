@@ -89,12 +89,8 @@ struct SimpleSpiceDisplay {
     void *buf;
     int bufsize;
     QXLInstance qxl;
-    uint32_t unique;
-    pixman_image_t *surface;
-    pixman_image_t *mirror;
     int32_t num_surfaces;
 
-    QXLRect dirty;
     int notify;
 
     /*
@@ -105,6 +101,19 @@ struct SimpleSpiceDisplay {
     QemuMutex lock;
     QTAILQ_HEAD(, SimpleSpiceUpdate) updates;
 
+    /*
+     * Updates are created from the dirty rectangle by the spice server
+     * thread when it asks for a command, not in the main loop.
+     */
+    QXLRect dirty;
+    uint32_t unique;
+    pixman_image_t *surface;
+    pixman_image_t *mirror;
+
+    /* released updates kept for reuse, up to SPICE_UPDATE_CACHE_SIZE */
+    QTAILQ_HEAD(, SimpleSpiceUpdate) free_updates;
+    int num_free_updates;
+
     /* cursor (without qxl): displaychangelistener -> spice server */
     SimpleSpiceCursor *ptr_define;
     SimpleSpiceCursor *ptr_move;
@@ -141,6 +150,7 @@ struct SimpleSpiceUpdate {
     QXLImage image;
     QXLCommandExt ext;
     uint8_t *bitmap;
+    size_t bitmap_size;
     QTAILQ_ENTRY(SimpleSpiceUpdate) next;
 };
 
@@ -155,6 +165,7 @@ extern bool spice_opengl;
 int qemu_spice_rect_is_empty(const QXLRect* r);
 void qemu_spice_rect_union(QXLRect *dest, const QXLRect *r);
 
+bool qemu_spice_get_update(SimpleSpiceDisplay *ssd, QXLCommandExt *ext);
 void qemu_spice_destroy_update(SimpleSpiceDisplay *sdpy, SimpleSpiceUpdate *update);
 void qemu_spice_create_host_memslot(SimpleSpiceDisplay *ssd);
 void qemu_spice_create_host_primary(SimpleSpiceDisplay *ssd);
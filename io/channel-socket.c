@@ -164,9 +164,20 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
+    qio_channel_socket_enable_zero_copy(ioc);
+
+    qio_channel_set_feature(QIO_CHANNEL(ioc),
+                            QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
+
+    return 0;
+}
+
+
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc)
+{
 #ifdef QEMU_MSG_ZEROCOPY
     int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
+    ret = setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
     if (ret == 0) {
         /* Zero copy available on host */
         qio_channel_set_feature(QIO_CHANNEL(ioc),
@@ -174,10 +185,8 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
     }
 #endif
 
-    qio_channel_set_feature(QIO_CHANNEL(ioc),
-                            QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
-
-    return 0;
+    return qio_channel_has_feature(QIO_CHANNEL(ioc),
+                                   QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
 }
 
 
@@ -725,10 +734,17 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 
 
 #ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+/*
+ * Process zero copy completion notifications from the error queue. If @wait
+ * is true, block until all queued sends have completed.
+ *
+ * Returns -1 on error, 1 if @wait is true and every send failed to use zero
+ * copy, 0 otherwise.
+ */
+static int qio_channel_socket_zero_copy_reap(QIOChannelSocket *sioc,
+                                             bool wait, Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    QIOChannel *ioc = QIO_CHANNEL(sioc);
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
@@ -744,13 +760,16 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     msg.msg_controllen = sizeof(control);
     memset(control, 0, sizeof(control));
 
-    ret = 1;
+    ret = wait ? 1 : 0;
 
     while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
         received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
         if (received < 0) {
             switch (errno) {
             case EAGAIN:
+                if (!wait) {
+                    return ret;
+                }
                 /* Nothing on errqueue, wait until something is available */
                 qio_channel_wait(ioc, G_IO_ERR);
                 continue;
@@ -800,8 +819,51 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     return ret;
 }
 
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    return qio_channel_socket_zero_copy_reap(QIO_CHANNEL_SOCKET(ioc), true,
+                                             errp);
+}
+
+/*
+ * Completion notifications of zero copy sends are queued on the socket
+ * error queue, and the socket stays in G_IO_ERR until they are read.  This
+ * wakes up the read and write handlers alike; unless the notifications are
+ * consumed, a coroutine waiting for input or output would be restarted over
+ * and over until the next flush.  Therefore they are reaped before calling
+ * the handlers.
+ *
+ * This assumes that, like for NBD, the handlers of a zero copy channel run
+ * in the same thread as the code that sends and flushes.
+ */
+static void qio_channel_socket_zero_copy_read(void *opaque)
+{
+    QIOChannelSocket *sioc = opaque;
+
+    qio_channel_socket_zero_copy_reap(sioc, false, NULL);
+    sioc->zero_copy_io_read(sioc->zero_copy_read_opaque);
+}
+
+static void qio_channel_socket_zero_copy_write(void *opaque)
+{
+    QIOChannelSocket *sioc = opaque;
+
+    qio_channel_socket_zero_copy_reap(sioc, false, NULL);
+    sioc->zero_copy_io_write(sioc->zero_copy_write_opaque);
+}
+
 #endif /* QEMU_MSG_ZEROCOPY */
 
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc, Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    return qio_channel_socket_zero_copy_reap(ioc, false, errp) < 0 ? -1 : 0;
+#else
+    return 0;
+#endif
+}
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -934,6 +996,23 @@ static void qio_channel_socket_set_aio_fd_handler(QIOChannel *ioc,
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
 
+#ifdef QEMU_MSG_ZEROCOPY
+    if (qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        /* A NULL context leaves the handler of that direction alone */
+        if (read_ctx) {
+            sioc->zero_copy_io_read = io_read;
+            sioc->zero_copy_read_opaque = opaque;
+            io_read = io_read ? qio_channel_socket_zero_copy_read : NULL;
+        }
+        if (write_ctx) {
+            sioc->zero_copy_io_write = io_write;
+            sioc->zero_copy_write_opaque = opaque;
+            io_write = io_write ? qio_channel_socket_zero_copy_write : NULL;
+        }
+        opaque = sioc;
+    }
+#endif
+
     qio_channel_util_set_aio_fd_handler(sioc->fd, read_ctx, io_read,
                                         sioc->fd, write_ctx, io_write,
                                         opaque);
@@ -103,6 +103,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->io_uring_sqpoll_cpu = -1;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -172,6 +173,13 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
     aio_context_set_aio_params(iothread->ctx,
                                iothread->parent_obj.aio_max_batch);
 
+    aio_context_set_io_uring_params(iothread->ctx, iothread->io_uring_sqpoll,
+                                    iothread->io_uring_sqpoll_idle,
+                                    iothread->io_uring_sqpoll_cpu, errp);
+    if (*errp) {
+        return;
+    }
+
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
 }
@@ -222,6 +230,7 @@ static void iothread_init(EventLoopBase *base, Error **errp)
 typedef struct {
     const char *name;
     ptrdiff_t offset; /* field's byte offset in IOThread struct */
+    int64_t min; /* minimum value, 0 if not given */
 } IOThreadParamInfo;
 
 static IOThreadParamInfo poll_max_ns_info = {
@@ -233,6 +242,12 @@ static IOThreadParamInfo poll_grow_info = {
 static IOThreadParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static IOThreadParamInfo io_uring_sqpoll_idle_info = {
+    "io-uring-sqpoll-idle", offsetof(IOThread, io_uring_sqpoll_idle),
+};
+static IOThreadParamInfo io_uring_sqpoll_cpu_info = {
+    "io-uring-sqpoll-cpu", offsetof(IOThread, io_uring_sqpoll_cpu), -1,
+};
 
 static void iothread_get_param(Object *obj, Visitor *v,
         const char *name, IOThreadParamInfo *info, Error **errp)
@@ -243,6 +258,22 @@ static void iothread_get_param(Object *obj, Visitor *v,
     visit_type_int64(v, name, field, errp);
 }
 
+static bool iothread_visit_param(Visitor *v, const char *name,
+        IOThreadParamInfo *info, int64_t *value, Error **errp)
+{
+    if (!visit_type_int64(v, name, value, errp)) {
+        return false;
+    }
+
+    if (*value < info->min) {
+        error_setg(errp, "%s value must be in range [%" PRId64 ", %" PRId64 "]",
+                   info->name, info->min, INT64_MAX);
+        return false;
+    }
+
+    return true;
+}
+
 static bool iothread_set_param(Object *obj, Visitor *v,
         const char *name, IOThreadParamInfo *info, Error **errp)
 {
@@ -250,13 +281,7 @@ static bool iothread_set_param(Object *obj, Visitor *v,
     int64_t *field = (void *)iothread + info->offset;
     int64_t value;
 
-    if (!visit_type_int64(v, name, &value, errp)) {
-        return false;
-    }
-
-    if (value < 0) {
-        error_setg(errp, "%s value must be in range [0, %" PRId64 "]",
-                   info->name, INT64_MAX);
+    if (!iothread_visit_param(v, name, info, &value, errp)) {
         return false;
     }
 
@@ -292,6 +317,75 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+/*
+ * The io_uring parameters cannot change once the ring is set up, so only
+ * take the new values if the AioContext accepts them.  Without an
+ * AioContext yet, they are checked when the IOThread is completed.
+ */
+static bool iothread_set_io_uring_params(IOThread *iothread, bool sqpoll,
+                                         int64_t sqpoll_idle,
+                                         int64_t sqpoll_cpu, Error **errp)
+{
+    ERRP_GUARD();
+
+    if (iothread->ctx) {
+        aio_context_set_io_uring_params(iothread->ctx, sqpoll, sqpoll_idle,
+                                        sqpoll_cpu, errp);
+        if (*errp) {
+            return false;
+        }
+    }
+
+    iothread->io_uring_sqpoll = sqpoll;
+    iothread->io_uring_sqpoll_idle = sqpoll_idle;
+    iothread->io_uring_sqpoll_cpu = sqpoll_cpu;
+    return true;
+}
+
+static void iothread_get_io_uring_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThreadParamInfo *info = opaque;
+
+    iothread_get_param(obj, v, name, info, errp);
+}
+
+static void iothread_set_io_uring_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t sqpoll_idle = iothread->io_uring_sqpoll_idle;
+    int64_t sqpoll_cpu = iothread->io_uring_sqpoll_cpu;
+    int64_t value;
+
+    if (!iothread_visit_param(v, name, info, &value, errp)) {
+        return;
+    }
+
+    if (info == &io_uring_sqpoll_idle_info) {
+        sqpoll_idle = value;
+    } else {
+        sqpoll_cpu = value;
+    }
+    iothread_set_io_uring_params(iothread, iothread->io_uring_sqpoll,
+                                 sqpoll_idle, sqpoll_cpu, errp);
+}
+
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    return IOTHREAD(obj)->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread_set_io_uring_params(iothread, value,
+                                 iothread->io_uring_sqpoll_idle,
+                                 iothread->io_uring_sqpoll_cpu, errp);
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -311,6 +405,17 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll);
+    object_class_property_add(klass, "io-uring-sqpoll-idle", "int",
+                              iothread_get_io_uring_param,
+                              iothread_set_io_uring_param,
+                              NULL, &io_uring_sqpoll_idle_info);
+    object_class_property_add(klass, "io-uring-sqpoll-cpu", "int",
+                              iothread_get_io_uring_param,
+                              iothread_set_io_uring_param,
+                              NULL, &io_uring_sqpoll_cpu_info);
 }
 
 static const TypeInfo iothread_info = {
@@ -357,6 +462,8 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
+    /* Racy read, but the value is only informational */
+    info->poll_ns = iothread->ctx->poll_ns;
 
     QAPI_LIST_APPEND(*tail, info);
     return 0;
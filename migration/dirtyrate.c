@@ -29,6 +29,7 @@
 #include "sysemu/runstate.h"
 #include "exec/memory.h"
 #include "qemu/xxhash.h"
+#include "qemu/cutils.h"
 
 /*
  * total_dirty_pages is procted by BQL and is used
@@ -928,3 +929,126 @@ void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
                    " seconds\n", sec);
     monitor_printf(mon, "[Please use 'info dirty_rate' to check results]\n");
 }
+
+/*
+ * A distinct page content seen while sampling.  Contents with the same
+ * hash are chained through @next, so that a hash collision is not
+ * mistaken for a duplicate.
+ */
+typedef struct RamSharingPage {
+    uint8_t *host;
+    unsigned count;
+    struct RamSharingPage *next;
+} RamSharingPage;
+
+/* g_rand_int_range() takes a gint32, which is too small for large blocks */
+static uint64_t ram_sharing_rand_page(GRand *rand, uint64_t pages)
+{
+    uint64_t r = ((uint64_t)g_rand_int(rand) << 32) | g_rand_int(rand);
+
+    return r % pages;
+}
+
+static RamSharingPage *ram_sharing_find(GHashTable *hashes, GPtrArray *pages,
+                                        uint8_t *page, size_t page_size)
+{
+    uint32_t hash = compute_page_hash(page);
+    RamSharingPage *first, *p;
+
+    first = g_hash_table_lookup(hashes, GUINT_TO_POINTER(hash));
+    for (p = first; p; p = p->next) {
+        if (!memcmp(p->host, page, page_size)) {
+            p->count++;
+            return p;
+        }
+    }
+
+    p = g_new(RamSharingPage, 1);
+    p->host = page;
+    p->count = 1;
+    p->next = first;
+    g_ptr_array_add(pages, p);
+    g_hash_table_insert(hashes, GUINT_TO_POINTER(hash), p);
+    return p;
+}
+
+static RamSharingInfoList *ram_sharing_info(void)
+{
+    g_autoptr(GHashTable) hashes = g_hash_table_new(NULL, NULL);
+    g_autoptr(GPtrArray) pages = g_ptr_array_new_with_free_func(g_free);
+    g_autoptr(GRand) rand = g_rand_new();
+    g_autoptr(GArray) samples = g_array_new(FALSE, FALSE,
+                                            sizeof(RamSharingPage *));
+    g_autoptr(GArray) sizes = g_array_new(FALSE, FALSE, sizeof(unsigned));
+    RamSharingInfoList *head = NULL, **tail = &head;
+    size_t page_size = qemu_target_page_size();
+    RAMBlock *block;
+    unsigned pos = 0, b = 0;
+
+    /* First pass: sample every block and count each distinct content */
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_MIGRATABLE(block) {
+            RamSharingInfo *info;
+            uint8_t *host = qemu_ram_get_host_addr(block);
+            uint64_t npages = qemu_ram_get_used_length(block) /
+                              page_size;
+            uint64_t count, i;
+
+            if (skip_sample_ramblock(block)) {
+                continue;
+            }
+
+            info = g_new0(RamSharingInfo, 1);
+            info->id = g_strdup(qemu_ram_get_idstr(block));
+            count = (qemu_ram_get_used_length(block) *
+                     DIRTYRATE_DEFAULT_SAMPLE_PAGES) >> 30;
+
+            for (i = 0; i < count; i++) {
+                uint8_t *page = host + page_size *
+                                ram_sharing_rand_page(rand, npages);
+                RamSharingPage *p;
+
+                if (buffer_is_zero(page, page_size)) {
+                    info->zero++;
+                    continue;
+                }
+                p = ram_sharing_find(hashes, pages, page, page_size);
+                g_array_append_val(samples, p);
+            }
+            info->sampled = count;
+            g_array_append_val(sizes, samples->len);
+            QAPI_LIST_APPEND(tail, info);
+        }
+    }
+
+    /* Second pass: count the samples whose content was seen more than once */
+    for (RamSharingInfoList *l = head; l; l = l->next, b++) {
+        unsigned end = g_array_index(sizes, unsigned, b);
+
+        for (; pos < end; pos++) {
+            if (g_array_index(samples, RamSharingPage *, pos)->count > 1) {
+                l->value->duplicate++;
+            }
+        }
+    }
+
+    return head;
+}
+
+RamSharingInfoList *qmp_x_query_ram_sharing(Error **errp)
+{
+    return ram_sharing_info();
+}
+
+void hmp_info_ram_sharing(Monitor *mon, const QDict *qdict)
+{
+    g_autoptr(RamSharingInfoList) list = ram_sharing_info();
+
+    for (RamSharingInfoList *l = list; l; l = l->next) {
+        RamSharingInfo *info = l->value;
+
+        monitor_printf(mon, "%s: %" PRIu64 " pages sampled, %" PRIu64
+                       " zero, %" PRIu64 " duplicate\n", info->id,
+                       info->sampled, info->zero, info->duplicate);
+    }
+}
@@ -0,0 +1,470 @@
+/*
+ * Lazy loading of guest RAM from a mapped-ram migration file
+ *
+ * With mapped-ram, every page of guest RAM has a fixed offset in the
+ * migration file.  Instead of reading all of RAM before the guest can
+ * start, the RAM blocks are registered with userfaultfd and the pages
+ * are read in the background; pages the guest touches before that are
+ * read on demand.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/error-report.h"
+#include "qemu/event_notifier.h"
+#include "qemu/lockable.h"
+#include "qemu/thread.h"
+#include "qemu/userfaultfd.h"
+#include "exec/memory.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "io/channel-file.h"
+#include "qapi/error.h"
+#include "mapped-ram-lazy.h"
+#include "options.h"
+#include "trace.h"
+
+#ifdef CONFIG_LINUX
+
+#include <poll.h>
+
+/* Size of the reads done by the background threads */
+#define LAZY_LOAD_CHUNK_SIZE (1 * MiB)
+
+typedef struct {
+    RAMBlock *block;
+    /* Where the pages of the block start in the file */
+    uint64_t pages_offset;
+    /* Target pages present in the file, the others are zero */
+    unsigned long *file_bmap;
+    long num_pages;
+    /* Host pages populated, or claimed by the thread populating them */
+    unsigned long *populated;
+    /* Next chunk for the background threads, taken with qatomic_fetch_inc */
+    unsigned int next_chunk;
+} LazyLoadBlock;
+
+static struct {
+    QIOChannel *ioc;
+    int uffd;
+    EventNotifier quit;
+    QemuThread fault_thread;
+    /* Protects @blocks while they are added */
+    QemuMutex lock;
+    GPtrArray *blocks;
+    /* Background threads still running */
+    unsigned int populating;
+} *lazy_load;
+
+static void G_NORETURN lazy_load_fatal(Error *err)
+{
+    /* The guest is running, and part of its RAM cannot be recovered */
+    error_prepend(&err, "Lazy loading of guest RAM failed: ");
+    error_report_err(err);
+    exit(EXIT_FAILURE);
+}
+
+static bool lazy_load_pread(uint8_t *buf, size_t len, off_t offset,
+                            Error **errp)
+{
+    while (len) {
+        ssize_t ret = qio_channel_pread(lazy_load->ioc, (char *)buf, len,
+                                        offset, errp);
+
+        if (ret < 0) {
+            return false;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Unexpected end of file at offset %" PRId64,
+                       (int64_t)offset);
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+
+    return true;
+}
+
+/* Read @len bytes of @lb at @offset, pages missing from the file are zero */
+static bool lazy_load_read(LazyLoadBlock *lb, ram_addr_t offset,
+                           uint8_t *buf, size_t len, Error **errp)
+{
+    int bits = qemu_target_page_bits();
+    unsigned long start = offset >> bits;
+    unsigned long end = MIN((offset + len) >> bits, lb->num_pages);
+    unsigned long set, clear;
+
+    memset(buf, 0, len);
+
+    for (set = find_next_bit(lb->file_bmap, end, start); set < end;
+         set = find_next_bit(lb->file_bmap, end, clear)) {
+        clear = find_next_zero_bit(lb->file_bmap, end, set);
+
+        if (!lazy_load_pread(buf + ((set - start) << bits),
+                             (clear - set) << bits,
+                             lb->pages_offset + (set << bits), errp)) {
+            error_prepend(errp, "(%s) ", lb->block->idstr);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Place the host page of @lb at @offset, unless another thread claimed it */
+static void lazy_load_place(LazyLoadBlock *lb, ram_addr_t offset,
+                            uint8_t *buf)
+{
+    size_t page_size = qemu_ram_pagesize(lb->block);
+    unsigned long page = offset / page_size;
+    unsigned long mask = BIT_MASK(page);
+    int ret;
+
+    if (qatomic_fetch_or(&lb->populated[BIT_WORD(page)], mask) & mask) {
+        return;
+    }
+
+    ret = uffd_copy_page(lazy_load->uffd, lb->block->host + offset, buf,
+                         page_size, false);
+    if (ret) {
+        Error *err = NULL;
+
+        error_setg_errno(&err, -ret, "(%s) could not place page at offset "
+                         RAM_ADDR_FMT, lb->block->idstr, offset);
+        lazy_load_fatal(err);
+    }
+}
+
+static LazyLoadBlock *lazy_load_find_block(uint64_t addr, ram_addr_t *offset)
+{
+    int i;
+
+    QEMU_LOCK_GUARD(&lazy_load->lock);
+
+    for (i = 0; i < lazy_load->blocks->len; i++) {
+        LazyLoadBlock *lb = g_ptr_array_index(lazy_load->blocks, i);
+        uintptr_t host = (uintptr_t)lb->block->host;
+
+        if (addr >= host && addr - host < lb->block->used_length) {
+            *offset = addr - host;
+            return lb;
+        }
+    }
+
+    return NULL;
+}
+
+static void *lazy_load_fault_thread(void *opaque)
+{
+    struct pollfd pfd[2] = {
+        { .fd = lazy_load->uffd, .events = POLLIN },
+        { .fd = event_notifier_get_fd(&lazy_load->quit), .events = POLLIN },
+    };
+    struct uffd_msg msgs[32];
+    uint8_t *buf = NULL;
+    size_t buf_size = 0;
+
+    while (true) {
+        int i, nr;
+
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_report("%s: poll: %s", __func__, strerror(errno));
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+
+        nr = uffd_read_events(lazy_load->uffd, msgs, ARRAY_SIZE(msgs));
+        if (nr < 0) {
+            break;
+        }
+
+        for (i = 0; i < nr; i++) {
+            uint64_t addr = msgs[i].arg.pagefault.address;
+            Error *err = NULL;
+            ram_addr_t offset;
+            LazyLoadBlock *lb;
+            size_t page_size;
+
+            if (msgs[i].event != UFFD_EVENT_PAGEFAULT) {
+                continue;
+            }
+
+            lb = lazy_load_find_block(addr, &offset);
+            if (!lb) {
+                error_report("%s: fault outside of guest RAM: %" PRIx64,
+                             __func__, addr);
+                continue;
+            }
+
+            page_size = qemu_ram_pagesize(lb->block);
+            offset = ROUND_DOWN(offset, page_size);
+            trace_mapped_ram_lazy_load_fault(lb->block->idstr, offset);
+
+            /*
+             * Already being populated by a background thread.  A page that
+             * was populated cannot fault again: discards are disabled as
+             * long as we are running.
+             */
+            if (test_bit(offset / page_size, lb->populated)) {
+                continue;
+            }
+
+            if (page_size > buf_size) {
+                qemu_vfree(buf);
+                buf = qemu_memalign(qemu_real_host_page_size(), page_size);
+                buf_size = page_size;
+            }
+            if (!lazy_load_read(lb, offset, buf, page_size, &err)) {
+                lazy_load_fatal(err);
+            }
+            lazy_load_place(lb, offset, buf);
+        }
+    }
+
+    qemu_vfree(buf);
+    return NULL;
+}
+
+static void lazy_load_finish(void)
+{
+    int i;
+
+    event_notifier_set(&lazy_load->quit);
+    qemu_thread_join(&lazy_load->fault_thread);
+
+    for (i = 0; i < lazy_load->blocks->len; i++) {
+        LazyLoadBlock *lb = g_ptr_array_index(lazy_load->blocks, i);
+
+        uffd_unregister_memory(lazy_load->uffd, lb->block->host,
+                               lb->block->used_length);
+        memory_region_unref(lb->block->mr);
+        g_free(lb->file_bmap);
+        g_free(lb->populated);
+        g_free(lb);
+    }
+    g_ptr_array_free(lazy_load->blocks, true);
+
+    uffd_close_fd(lazy_load->uffd);
+    ram_block_discard_disable(false);
+    event_notifier_cleanup(&lazy_load->quit);
+    qemu_mutex_destroy(&lazy_load->lock);
+    /* Closes our file descriptor, all threads are done with it */
+    object_unref(OBJECT(lazy_load->ioc));
+    g_free(lazy_load);
+    lazy_load = NULL;
+
+    trace_mapped_ram_lazy_load_finish();
+}
+
+static void *lazy_load_populate_thread(void *opaque)
+{
+    uint8_t *buf = NULL;
+    size_t buf_size = 0;
+    int i;
+
+    for (i = 0; i < lazy_load->blocks->len; i++) {
+        LazyLoadBlock *lb = g_ptr_array_index(lazy_load->blocks, i);
+        size_t page_size = qemu_ram_pagesize(lb->block);
+        size_t chunk_size = MAX(LAZY_LOAD_CHUNK_SIZE, page_size);
+        ram_addr_t length = lb->block->used_length;
+        ram_addr_t offset, pos;
+
+        if (chunk_size > buf_size) {
+            qemu_vfree(buf);
+            buf = qemu_memalign(qemu_real_host_page_size(), chunk_size);
+            buf_size = chunk_size;
+        }
+
+        while ((offset = (ram_addr_t)qatomic_fetch_inc(&lb->next_chunk) *
+                         chunk_size) < length) {
+            size_t len = MIN(chunk_size, length - offset);
+            Error *err = NULL;
+
+            /* Skip chunks the guest already faulted in completely */
+            if (find_next_zero_bit(lb->populated, (offset + len) / page_size,
+                                   offset / page_size) >=
+                (offset + len) / page_size) {
+                continue;
+            }
+
+            if (!lazy_load_read(lb, offset, buf, len, &err)) {
+                lazy_load_fatal(err);
+            }
+            for (pos = 0; pos < len; pos += page_size) {
+                lazy_load_place(lb, offset + pos, buf + pos);
+            }
+        }
+    }
+
+    qemu_vfree(buf);
+
+    /* The last thread to be done tears everything down */
+    if (qatomic_fetch_dec(&lazy_load->populating) == 1) {
+        lazy_load_finish();
+    }
+
+    return NULL;
+}
+
+static bool lazy_load_init(QEMUFile *f, Error **errp)
+{
+    QIOChannelFile *fioc = QIO_CHANNEL_FILE(qemu_file_get_ioc(f));
+    int uffd, fd;
+
+    /*
+     * The incoming side closes its channel once the migration is done,
+     * while the threads keep reading, so they use a file descriptor of
+     * their own.
+     */
+    fd = qemu_dup(fioc->fd);
+    if (fd < 0) {
+        error_setg_errno(errp, errno,
+                         "Could not duplicate the migration file descriptor");
+        return false;
+    }
+
+    /*
+     * A page discarded after it was populated (balloon, virtio-mem) would
+     * fault again, and nothing would resolve that fault.
+     */
+    if (ram_block_discard_disable(true)) {
+        error_setg(errp, "Lazy loading is not compatible with devices that "
+                   "discard guest RAM");
+        qemu_close(fd);
+        return false;
+    }
+
+    uffd = uffd_create_fd(0, true);
+    if (uffd < 0) {
+        error_setg(errp, "Could not create userfaultfd for lazy loading");
+        ram_block_discard_disable(false);
+        qemu_close(fd);
+        return false;
+    }
+
+    lazy_load = g_new0(typeof(*lazy_load), 1);
+    lazy_load->uffd = uffd;
+    lazy_load->ioc = QIO_CHANNEL(qio_channel_file_new_fd(fd));
+    event_notifier_init(&lazy_load->quit, false);
+    qemu_mutex_init(&lazy_load->lock);
+    lazy_load->blocks = g_ptr_array_new();
+
+    /* Loading the devices may already touch guest RAM */
+    qemu_thread_create(&lazy_load->fault_thread, "mig/lazy/fault",
+                       lazy_load_fault_thread, NULL, QEMU_THREAD_JOINABLE);
+
+    return true;
+}
+
+bool mapped_ram_lazy_load_supported(Error **errp)
+{
+    uint64_t features;
+
+    if (uffd_query_features(&features)) {
+        error_setg(errp, "Lazy loading of mapped-ram requires userfaultfd");
+        return false;
+    }
+
+    return true;
+}
+
+bool mapped_ram_lazy_load_add_block(QEMUFile *f, RAMBlock *block,
+                                    uint64_t pages_offset,
+                                    unsigned long *bitmap, long num_pages,
+                                    Error **errp)
+{
+    g_autofree unsigned long *file_bmap = bitmap;
+    size_t page_size = qemu_ram_pagesize(block);
+    LazyLoadBlock *lb;
+    uint64_t ioctls;
+
+    if (!lazy_load && !lazy_load_init(f, errp)) {
+        return false;
+    }
+
+    /* Anything in there now would hide the page in the file */
+    if (ram_block_discard_range(block, 0, block->used_length)) {
+        error_setg(errp, "Could not discard RAM block %s for lazy loading",
+                   block->idstr);
+        return false;
+    }
+
+    if (uffd_register_memory(lazy_load->uffd, block->host,
+                             block->used_length, UFFDIO_REGISTER_MODE_MISSING,
+                             &ioctls) ||
+        !(ioctls & BIT_ULL(_UFFDIO_COPY))) {
+        error_setg(errp, "RAM block %s does not support lazy loading",
+                   block->idstr);
+        return false;
+    }
+
+    lb = g_new0(LazyLoadBlock, 1);
+    lb->block = block;
+    lb->pages_offset = pages_offset;
+    lb->file_bmap = g_steal_pointer(&file_bmap);
+    lb->num_pages = num_pages;
+    lb->populated = bitmap_new(DIV_ROUND_UP(block->used_length, page_size));
+    memory_region_ref(block->mr);
+
+    WITH_QEMU_LOCK_GUARD(&lazy_load->lock) {
+        g_ptr_array_add(lazy_load->blocks, lb);
+    }
+
+    trace_mapped_ram_lazy_load_add_block(block->idstr, pages_offset);
+
+    return true;
+}
+
+void mapped_ram_lazy_load_start(void)
+{
+    unsigned int nr_threads = migrate_multifd() ? migrate_multifd_channels()
+                                                : 1;
+    int i;
+
+    if (!lazy_load) {
+        return;
+    }
+
+    trace_mapped_ram_lazy_load_start(nr_threads);
+
+    lazy_load->populating = nr_threads;
+    for (i = 0; i < nr_threads; i++) {
+        g_autofree char *name = g_strdup_printf("mig/lazy/%d", i);
+        QemuThread thread;
+
+        qemu_thread_create(&thread, name, lazy_load_populate_thread, NULL,
+                           QEMU_THREAD_DETACHED);
+    }
+}
+
+#else
+
+bool mapped_ram_lazy_load_supported(Error **errp)
+{
+    error_setg(errp, "Lazy loading of mapped-ram requires userfaultfd");
+    return false;
+}
+
+bool mapped_ram_lazy_load_add_block(QEMUFile *f, RAMBlock *block,
+                                    uint64_t pages_offset,
+                                    unsigned long *bitmap, long num_pages,
+                                    Error **errp)
+{
+    g_assert_not_reached();
+}
+
+void mapped_ram_lazy_load_start(void)
+{
+}
+
+#endif
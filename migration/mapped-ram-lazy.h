@@ -0,0 +1,22 @@
+/*
+ * Lazy loading of guest RAM from a mapped-ram migration file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_MAPPED_RAM_LAZY_H
+#define QEMU_MIGRATION_MAPPED_RAM_LAZY_H
+
+#include "exec/cpu-common.h"
+#include "qemu-file.h"
+
+bool mapped_ram_lazy_load_supported(Error **errp);
+/* Takes ownership of @bitmap, the pages of @block present in the file */
+bool mapped_ram_lazy_load_add_block(QEMUFile *f, RAMBlock *block,
+                                    uint64_t pages_offset,
+                                    unsigned long *bitmap, long num_pages,
+                                    Error **errp);
+void mapped_ram_lazy_load_start(void);
+
+#endif
@@ -209,6 +209,37 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->vfio->transferred >> 10);
     }
 
+    if (info->downtime_breakdown) {
+        MigrationDowntimeBreakdown *breakdown = info->downtime_breakdown;
+        MigrationDowntimeDeviceList *dev;
+
+        if (breakdown->has_iterable_save) {
+            monitor_printf(mon, "downtime iterable save: %" PRIu64 " us\n",
+                           breakdown->iterable_save);
+        }
+        if (breakdown->has_ram_sync) {
+            monitor_printf(mon, "downtime ram sync: %" PRIu64 " us\n",
+                           breakdown->ram_sync);
+        }
+        if (breakdown->has_non_iterable_save) {
+            monitor_printf(mon, "downtime non-iterable save: %" PRIu64
+                           " us\n", breakdown->non_iterable_save);
+        }
+        if (breakdown->has_device_load) {
+            monitor_printf(mon, "downtime device load: %" PRIu64 " us\n",
+                           breakdown->device_load);
+        }
+        if (breakdown->devices) {
+            monitor_printf(mon, "downtime slowest sections: [\n");
+            for (dev = breakdown->devices; dev; dev = dev->next) {
+                monitor_printf(mon, "\t%s (%" PRIu32 "): %" PRIu64 " us\n",
+                               dev->value->idstr, dev->value->instance_id,
+                               dev->value->time);
+            }
+            monitor_printf(mon, "]\n");
+        }
+    }
+
     qapi_free_MigrationInfo(info);
 }
 
@@ -295,6 +326,9 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %u\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_CHANNELS),
             params->multifd_channels);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_RDMA_CHANNELS),
+            params->rdma_channels);
         monitor_printf(mon, "%s: %s\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_COMPRESSION),
             MultiFDCompression_str(params->multifd_compression));
@@ -309,6 +343,9 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MAX_POSTCOPY_BANDWIDTH),
             params->max_postcopy_bandwidth);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES),
+            params->postcopy_prefetch_pages);
         monitor_printf(mon, "%s: '%s'\n",
             MigrationParameter_str(MIGRATION_PARAMETER_TLS_AUTHZ),
             params->tls_authz);
@@ -567,6 +604,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_multifd_channels = true;
         visit_type_uint8(v, param, &p->multifd_channels, &err);
         break;
+    case MIGRATION_PARAMETER_RDMA_CHANNELS:
+        p->has_rdma_channels = true;
+        visit_type_uint8(v, param, &p->rdma_channels, &err);
+        break;
     case MIGRATION_PARAMETER_MULTIFD_COMPRESSION:
         p->has_multifd_compression = true;
         visit_type_MultiFDCompression(v, param, &p->multifd_compression,
@@ -603,6 +644,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_max_postcopy_bandwidth = true;
         visit_type_size(v, param, &p->max_postcopy_bandwidth, &err);
         break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES:
+        p->has_postcopy_prefetch_pages = true;
+        visit_type_uint32(v, param, &p->postcopy_prefetch_pages, &err);
+        break;
     case MIGRATION_PARAMETER_ANNOUNCE_INITIAL:
         p->has_announce_initial = true;
         visit_type_size(v, param, &p->announce_initial, &err);
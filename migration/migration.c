@@ -1165,6 +1165,63 @@ static bool migrate_show_downtime(MigrationState *s)
     return (s->state == MIGRATION_STATUS_COMPLETED) || migration_in_postcopy();
 }
 
+void migration_downtime_add_device(MigrationDowntimeStats *stats,
+                                   const char *idstr, uint32_t instance_id,
+                                   int64_t time)
+{
+    int i;
+
+    if (stats->nr_devices == MIGRATION_DOWNTIME_DEVICES &&
+        time <= stats->devices[MIGRATION_DOWNTIME_DEVICES - 1].time) {
+        return;
+    }
+
+    /* When the list is full, the fastest entry falls off the end */
+    if (stats->nr_devices < MIGRATION_DOWNTIME_DEVICES) {
+        stats->nr_devices++;
+    }
+    for (i = stats->nr_devices - 1;
+         i > 0 && stats->devices[i - 1].time < time; i--) {
+        stats->devices[i] = stats->devices[i - 1];
+    }
+
+    pstrcpy(stats->devices[i].idstr, sizeof(stats->devices[i].idstr), idstr);
+    stats->devices[i].instance_id = instance_id;
+    stats->devices[i].time = time;
+}
+
+static MigrationDowntimeBreakdown *
+migration_downtime_breakdown(MigrationDowntimeStats *stats, bool incoming)
+{
+    MigrationDowntimeBreakdown *breakdown = g_new0(MigrationDowntimeBreakdown,
+                                                   1);
+    MigrationDowntimeDeviceList **tail = &breakdown->devices;
+    int i;
+
+    if (incoming) {
+        breakdown->has_device_load = true;
+        breakdown->device_load = stats->device_load;
+    } else {
+        breakdown->has_iterable_save = true;
+        breakdown->iterable_save = stats->iterable_save;
+        breakdown->has_ram_sync = true;
+        breakdown->ram_sync = stats->ram_sync;
+        breakdown->has_non_iterable_save = true;
+        breakdown->non_iterable_save = stats->non_iterable_save;
+    }
+
+    for (i = 0; i < stats->nr_devices; i++) {
+        MigrationDowntimeDevice *dev = g_new0(MigrationDowntimeDevice, 1);
+
+        dev->idstr = g_strdup(stats->devices[i].idstr);
+        dev->instance_id = stats->devices[i].instance_id;
+        dev->time = stats->devices[i].time;
+        QAPI_LIST_APPEND(tail, dev);
+    }
+
+    return breakdown;
+}
+
 static void populate_time_info(MigrationInfo *info, MigrationState *s)
 {
     info->has_status = true;
@@ -1183,6 +1240,8 @@ static void populate_time_info(MigrationInfo *info, MigrationState *s)
     if (migrate_show_downtime(s)) {
         info->has_downtime = true;
         info->downtime = s->downtime;
+        info->downtime_breakdown =
+            migration_downtime_breakdown(&s->downtime_stats, false);
     } else {
         info->has_expected_downtime = true;
         info->expected_downtime = s->expected_downtime;
@@ -1342,6 +1401,8 @@ static void fill_destination_migration_info(MigrationInfo *info)
     case MIGRATION_STATUS_COMPLETED:
         info->has_status = true;
         fill_destination_postcopy_migration_info(info);
+        info->downtime_breakdown =
+            migration_downtime_breakdown(&mis->downtime_stats, true);
         break;
     default:
         return;
@@ -1736,6 +1797,7 @@ int migrate_init(MigrationState *s, Error **errp)
     s->threshold_size = 0;
     s->switchover_acked = false;
     s->rdma_migration = false;
+    memset(&s->downtime_stats, 0, sizeof(s->downtime_stats));
     /*
      * set mig_stats memory to zero for a new migration
      */
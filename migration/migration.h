@@ -67,6 +67,30 @@ typedef struct {
     bool all_zero;
 } PostcopyTmpPage;
 
+/* Number of sections listed in the downtime breakdown */
+#define MIGRATION_DOWNTIME_DEVICES 10
+
+typedef struct {
+    char idstr[256];
+    uint32_t instance_id;
+    int64_t time;
+} MigrationDowntimeEntry;
+
+/* Where the downtime goes, in microseconds */
+typedef struct {
+    int64_t iterable_save;
+    int64_t ram_sync;
+    int64_t non_iterable_save;
+    int64_t device_load;
+    /* Slowest sections first */
+    int nr_devices;
+    MigrationDowntimeEntry devices[MIGRATION_DOWNTIME_DEVICES];
+} MigrationDowntimeStats;
+
+void migration_downtime_add_device(MigrationDowntimeStats *stats,
+                                   const char *idstr, uint32_t instance_id,
+                                   int64_t time);
+
 typedef enum {
     PREEMPT_THREAD_NONE = 0,
     PREEMPT_THREAD_CREATED,
@@ -179,6 +203,9 @@ struct MigrationIncomingState {
      * */
     struct PostcopyBlocktimeContext *blocktime_ctx;
 
+    /* Time taken by loading the device state */
+    MigrationDowntimeStats downtime_stats;
+
     /* notify PAUSED postcopy incoming migrations to try to continue */
     QemuSemaphore postcopy_pause_sem_dst;
     QemuSemaphore postcopy_pause_sem_fault;
@@ -339,6 +366,7 @@ struct MigrationState {
     int64_t downtime_start;
     int64_t downtime;
     int64_t expected_downtime;
+    MigrationDowntimeStats downtime_stats;
     bool capabilities[MIGRATION_CAPABILITY__MAX];
     int64_t setup_time;
 
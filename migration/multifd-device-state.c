@@ -0,0 +1,64 @@
+/*
+ * Multifd device state migration
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "migration/misc.h"
+#include "multifd.h"
+#include "options.h"
+
+void multifd_send_data_clear_device_state(MultiFDDeviceState_t *device_state)
+{
+    g_clear_pointer(&device_state->idstr, g_free);
+    g_clear_pointer(&device_state->buf, g_free);
+    device_state->buf_len = 0;
+}
+
+/*
+ * Queue a chunk of device state for transfer over one of the multifd
+ * channels.  @data is copied, so the caller may reuse it right away.
+ *
+ * Can be called from any thread, without the BQL; the destination
+ * passes the chunk to the @load_state_buffer handler of the matching
+ * SaveStateEntry.  Chunks of one device may be spread across channels
+ * and hence arrive in any order: it is up to the device to put them
+ * back in sequence.  @len must not exceed MULTIFD_DEVICE_STATE_MAX_SIZE.
+ *
+ * Returns true on success, false if multifd is shutting down.
+ */
+bool multifd_queue_device_state(const char *idstr, uint32_t instance_id,
+                                const char *data, size_t len)
+{
+    MultiFDSendData *send_data = multifd_send_data_alloc();
+    MultiFDDeviceState_t *device_state = &send_data->u.device_state;
+    bool ret;
+
+    /* The destination would reject the packet */
+    assert(len <= MULTIFD_DEVICE_STATE_MAX_SIZE);
+
+    multifd_set_payload_type(send_data, MULTIFD_PAYLOAD_DEVICE_STATE);
+    device_state->idstr = g_strdup(idstr);
+    device_state->instance_id = instance_id;
+    device_state->buf = g_memdup2(data, len);
+    device_state->buf_len = len;
+
+    ret = multifd_send(&send_data);
+    if (!ret) {
+        multifd_send_data_clear_device_state(device_state);
+    }
+
+    /* On success we got back the (empty) slot of the channel we used */
+    assert(!ret || multifd_payload_empty(send_data));
+    g_free(send_data);
+
+    return ret;
+}
+
+bool multifd_device_state_supported(void)
+{
+    /* mapped-ram has no packets, so there is no way to tag device state */
+    return migrate_multifd() && !migrate_mapped_ram();
+}
@@ -0,0 +1,391 @@
+/*
+ * Multifd XBZRLE delta encoding implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "qemu/lockable.h"
+#include "exec/ramblock.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "multifd.h"
+#include "options.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+
+/*
+ * Pages can be sent from any channel, so the page cache is shared by
+ * all of them.  It is split into shards with a lock each, which keeps
+ * the channels from serializing on a single lock.
+ */
+#define MULTIFD_XBZRLE_MAX_SHARDS 16
+
+typedef struct {
+    QemuMutex lock;
+    PageCache *cache;
+} MultiFDXbzrleShard;
+
+static struct {
+    MultiFDXbzrleShard shards[MULTIFD_XBZRLE_MAX_SHARDS];
+    unsigned int shard_bits;
+    uint8_t *zero_page;
+    /* Channels set up with the cache, the last one to clean up frees it */
+    unsigned int users;
+} *multifd_xbzrle_state;
+
+/*
+ * Every normal page in a packet is preceded by its be32 length:
+ * page size for a raw page, anything below for an encoded delta,
+ * zero for an unchanged page.
+ */
+#define MULTIFD_XBZRLE_HDR_LEN sizeof(uint32_t)
+
+struct xbzrle_data {
+    /* copy of the page being encoded, it may change under our feet */
+    uint8_t *buf;
+    /* packet payload */
+    uint8_t *out;
+    uint32_t out_len;
+};
+
+static void multifd_xbzrle_state_free(void)
+{
+    int i;
+
+    if (!multifd_xbzrle_state) {
+        return;
+    }
+
+    for (i = 0; i < (1 << multifd_xbzrle_state->shard_bits); i++) {
+        MultiFDXbzrleShard *shard = &multifd_xbzrle_state->shards[i];
+
+        if (shard->cache) {
+            cache_fini(shard->cache);
+        }
+        qemu_mutex_destroy(&shard->lock);
+    }
+    qemu_vfree(multifd_xbzrle_state->zero_page);
+    g_free(multifd_xbzrle_state);
+    multifd_xbzrle_state = NULL;
+}
+
+static int multifd_xbzrle_state_init(Error **errp)
+{
+    uint32_t page_size = multifd_ram_page_size();
+    uint64_t cache_pages = migrate_xbzrle_cache_size() / page_size;
+    uint64_t shard_size;
+    int i;
+
+    multifd_xbzrle_state = g_new0(typeof(*multifd_xbzrle_state), 1);
+
+    /* The cache size is a power of two pages, and so is every shard */
+    multifd_xbzrle_state->shard_bits =
+        MIN(ctz32(MULTIFD_XBZRLE_MAX_SHARDS), ctz64(cache_pages));
+    shard_size = migrate_xbzrle_cache_size() >>
+                 multifd_xbzrle_state->shard_bits;
+
+    multifd_xbzrle_state->zero_page = qemu_memalign(page_size, page_size);
+    memset(multifd_xbzrle_state->zero_page, 0, page_size);
+
+    for (i = 0; i < (1 << multifd_xbzrle_state->shard_bits); i++) {
+        qemu_mutex_init(&multifd_xbzrle_state->shards[i].lock);
+    }
+
+    for (i = 0; i < (1 << multifd_xbzrle_state->shard_bits); i++) {
+        MultiFDXbzrleShard *shard = &multifd_xbzrle_state->shards[i];
+
+        shard->cache = cache_init(shard_size, page_size, errp);
+        if (!shard->cache) {
+            multifd_xbzrle_state_free();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static MultiFDXbzrleShard *multifd_xbzrle_shard(ram_addr_t addr)
+{
+    uint64_t page = addr / multifd_ram_page_size();
+    unsigned int bits = multifd_xbzrle_state->shard_bits;
+
+    /*
+     * Use the high bits of a multiplicative hash: the page cache in the
+     * shard picks its slot with the low bits of the page number.
+     */
+    if (!bits) {
+        return &multifd_xbzrle_state->shards[0];
+    }
+    return &multifd_xbzrle_state->shards[(page * 0x9e3779b97f4a7c15ULL) >>
+                                         (64 - bits)];
+}
+
+/* Zero pages are sent without data, but the cache must follow them */
+static void multifd_xbzrle_cache_zero_page(ram_addr_t addr,
+                                           uint64_t generation)
+{
+    MultiFDXbzrleShard *shard = multifd_xbzrle_shard(addr);
+
+    QEMU_LOCK_GUARD(&shard->lock);
+    cache_insert(shard->cache, addr, multifd_xbzrle_state->zero_page,
+                 generation);
+}
+
+/* Returns the number of bytes written to @out */
+static uint32_t multifd_xbzrle_encode_page(struct xbzrle_data *x,
+                                           uint8_t *page, ram_addr_t addr,
+                                           uint64_t generation, uint8_t *out)
+{
+    MultiFDXbzrleShard *shard = multifd_xbzrle_shard(addr);
+    uint32_t page_size = multifd_ram_page_size();
+    uint8_t *data = out + MULTIFD_XBZRLE_HDR_LEN;
+    uint8_t *cached;
+    int len;
+
+    QEMU_LOCK_GUARD(&shard->lock);
+
+    if (!cache_is_cached(shard->cache, addr, generation)) {
+        /*
+         * Send the same copy that goes into the cache, so that the
+         * destination ends up with what the next delta is based on.
+         */
+        memcpy(data, page, page_size);
+        cache_insert(shard->cache, addr, data, generation);
+        len = page_size;
+    } else {
+        cached = get_cached_data(shard->cache, addr);
+        memcpy(x->buf, page, page_size);
+
+        /* Leave room to tell a delta from a raw page by its length */
+        len = xbzrle_encode_buffer(cached, x->buf, page_size, data,
+                                   page_size - 1);
+        if (len < 0) {
+            memcpy(data, x->buf, page_size);
+            len = page_size;
+        }
+        if (len) {
+            memcpy(cached, x->buf, page_size);
+        }
+    }
+
+    stl_be_p(out, len);
+
+    return MULTIFD_XBZRLE_HDR_LEN + len;
+}
+
+static int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    uint32_t page_size = multifd_ram_page_size();
+    struct xbzrle_data *x;
+
+    /* Channels are set up one after another by the migration thread */
+    if (!multifd_xbzrle_state && multifd_xbzrle_state_init(errp) < 0) {
+        return -1;
+    }
+
+    x = g_new0(struct xbzrle_data, 1);
+    x->buf = qemu_memalign(page_size, page_size);
+    x->out_len = multifd_ram_page_count() *
+                 (MULTIFD_XBZRLE_HDR_LEN + page_size);
+    x->out = g_try_malloc(x->out_len);
+    if (!x->out) {
+        qemu_vfree(x->buf);
+        g_free(x);
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffer",
+                   p->id);
+        return -1;
+    }
+    p->compress_data = x;
+    multifd_xbzrle_state->users++;
+
+    /* Needs 2 IOVs, one for packet header and one for encoded data */
+    p->iov = g_new0(struct iovec, 2);
+
+    return 0;
+}
+
+static void multifd_xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    if (x) {
+        qemu_vfree(x->buf);
+        g_free(x->out);
+        g_free(x);
+        p->compress_data = NULL;
+
+        /*
+         * All channel threads have been joined before the first channel
+         * is cleaned up, so nobody can be using the cache any more.
+         */
+        if (!--multifd_xbzrle_state->users) {
+            multifd_xbzrle_state_free();
+        }
+    }
+
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+static int multifd_xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    struct xbzrle_data *x = p->compress_data;
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    ram_addr_t base = pages->block->offset;
+    uint32_t out_size = 0;
+    bool has_normal;
+    uint32_t i;
+
+    has_normal = multifd_send_prepare_common(p);
+
+    for (i = pages->normal_num; i < pages->num; i++) {
+        multifd_xbzrle_cache_zero_page(base + pages->offset[i], generation);
+    }
+
+    if (!has_normal) {
+        goto out;
+    }
+
+    for (i = 0; i < pages->normal_num; i++) {
+        out_size += multifd_xbzrle_encode_page(x, pages->block->host +
+                                               pages->offset[i],
+                                               base + pages->offset[i],
+                                               generation,
+                                               x->out + out_size);
+    }
+
+    p->iov[p->iovs_num].iov_base = x->out;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = out_size;
+
+out:
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+static int multifd_xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+
+    x->out_len = multifd_ram_page_count() *
+                 (MULTIFD_XBZRLE_HDR_LEN + multifd_ram_page_size());
+    x->out = g_try_malloc(x->out_len);
+    if (!x->out) {
+        g_free(x);
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffer",
+                   p->id);
+        return -1;
+    }
+    p->compress_data = x;
+
+    return 0;
+}
+
+static void multifd_xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    if (x) {
+        g_free(x->out);
+        g_free(x);
+        p->compress_data = NULL;
+    }
+}
+
+static int multifd_xbzrle_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t pos = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    if (in_size > x->out_len) {
+        error_setg(errp, "multifd %u: packet size received %u exceeds %u",
+                   p->id, in_size, x->out_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)x->out, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *page = p->host + p->normal[i];
+        uint32_t len;
+
+        if (in_size - pos < MULTIFD_XBZRLE_HDR_LEN) {
+            goto truncated;
+        }
+        len = ldl_be_p(x->out + pos);
+        pos += MULTIFD_XBZRLE_HDR_LEN;
+        if (len > page_size || in_size - pos < len) {
+            goto truncated;
+        }
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+
+        if (len == page_size) {
+            memcpy(page, x->out + pos, page_size);
+        } else if (len &&
+                   xbzrle_decode_buffer(x->out + pos, len, page,
+                                        page_size) == -1) {
+            error_setg(errp, "multifd %u: failed to decode xbzrle page at "
+                       "offset 0x" RAM_ADDR_FMT " of %s", p->id,
+                       p->normal[i], p->block->idstr);
+            return -1;
+        }
+        pos += len;
+    }
+
+    if (pos != in_size) {
+        goto truncated;
+    }
+
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %u: malformed xbzrle packet of size %u",
+               p->id, in_size);
+    return -1;
+}
+
+static const MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = multifd_xbzrle_send_setup,
+    .send_cleanup = multifd_xbzrle_send_cleanup,
+    .send_prepare = multifd_xbzrle_send_prepare,
+    .recv_setup = multifd_xbzrle_recv_setup,
+    .recv_cleanup = multifd_xbzrle_recv_cleanup,
+    .recv = multifd_xbzrle_recv
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
@@ -37,6 +37,18 @@ static void swap_page_offset(ram_addr_t *pages_offset, int a, int b)
     pages_offset[b] = temp;
 }
 
+/*
+ * buffer_is_zero() first samples the start, middle and end of the
+ * page: fetch those for the next page while the current one is being
+ * checked, so that the cache misses of consecutive pages overlap.
+ */
+static inline void prefetch_page(const uint8_t *page, size_t size)
+{
+    __builtin_prefetch(page);
+    __builtin_prefetch(page + size / 2);
+    __builtin_prefetch(page + size - 1);
+}
+
 /**
  * multifd_send_zero_page_detect: Perform zero page detection on all pages.
  *
@@ -49,6 +61,7 @@ void multifd_send_zero_page_detect(MultiFDSendParams *p)
 {
     MultiFDPages_t *pages = &p->data->u.ram;
     RAMBlock *rb = pages->block;
+    size_t page_size = multifd_ram_page_size();
     int i = 0;
     int j = pages->num - 1;
 
@@ -61,10 +74,20 @@ void multifd_send_zero_page_detect(MultiFDSendParams *p)
      * Sort the page offset array by moving all normal pages to
      * the left and all zero pages to the right of the array.
      */
+    if (i <= j) {
+        prefetch_page(rb->host + pages->offset[i], page_size);
+    }
+
     while (i <= j) {
         uint64_t offset = pages->offset[i];
 
-        if (!buffer_is_zero(rb->host + offset, multifd_ram_page_size())) {
+        /* Either i + 1 or j is looked at next, prefetch both */
+        if (i + 1 <= j) {
+            prefetch_page(rb->host + pages->offset[i + 1], page_size);
+            prefetch_page(rb->host + pages->offset[j], page_size);
+        }
+
+        if (!buffer_is_zero(rb->host + offset, page_size)) {
             i++;
             continue;
         }
@@ -85,8 +108,15 @@ void multifd_recv_zero_page_process(MultiFDRecvParams *p)
 {
     for (int i = 0; i < p->zero_num; i++) {
         void *page = p->host + p->zero[i];
+
+        /*
+         * A page that was never received is still fresh, zeroed memory.
+         * One that was received before only needs zeroing if it is not
+         * zero already, which saves dirtying pages that were sent as
+         * zero in an earlier iteration.
+         */
         if (ramblock_recv_bitmap_test_byte_offset(p->block, p->zero[i])) {
-            memset(page, 0, multifd_ram_page_size());
+            ram_handle_zero(page, multifd_ram_page_size());
         } else {
             ramblock_recv_bitmap_set_offset(p->block, p->zero[i]);
         }
@@ -13,6 +13,8 @@
 #include "qemu/osdep.h"
 #include <zlib.h>
 #include "qemu/rcu.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
 #include "exec/ramblock.h"
 #include "exec/target_page.h"
 #include "qapi/error.h"
@@ -30,8 +32,72 @@ struct zlib_data {
     uint32_t zbuff_len;
     /* uncompressed buffer of size qemu_target_page_size() */
     uint8_t *buf;
+    /* multifd-zlib-adaptive: level for compressible pages */
+    int level;
+    /* level the stream currently uses */
+    int cur_level;
+    /* start of the current measurement window */
+    int64_t window_start;
+    /* time spent compressing in the current window */
+    int64_t window_busy;
 };
 
+/*
+ * A page is considered incompressible when a strided sample of its
+ * bytes contains about as many distinct values as random data would.
+ * 256 random samples have about 162 distinct values.
+ */
+#define MULTIFD_ZLIB_SAMPLES        256
+#define MULTIFD_ZLIB_RAW_DISTINCT   144
+
+/* The compression level is reconsidered this often */
+#define MULTIFD_ZLIB_WINDOW_NS      (100 * SCALE_MS)
+
+static bool multifd_zlib_page_compressible(const uint8_t *page,
+                                           uint32_t page_size)
+{
+    uint32_t stride = MAX(page_size / MULTIFD_ZLIB_SAMPLES, 1);
+    uint64_t seen[256 / 64] = { 0 };
+    int distinct;
+    uint32_t i;
+
+    for (i = 0; i < page_size; i += stride) {
+        seen[page[i] / 64] |= 1ULL << (page[i] % 64);
+    }
+    distinct = ctpop64(seen[0]) + ctpop64(seen[1]) +
+               ctpop64(seen[2]) + ctpop64(seen[3]);
+
+    return distinct < MULTIFD_ZLIB_RAW_DISTINCT;
+}
+
+/*
+ * When the channel spends most of its time compressing, the CPU is
+ * the bottleneck and the level goes down.  When it mostly waits for
+ * the link (or for work), there is time to compress harder.
+ */
+static void multifd_zlib_adapt_level(MultiFDSendParams *p,
+                                     struct zlib_data *z, int64_t busy)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - z->window_start;
+
+    z->window_busy += busy;
+    if (elapsed < MULTIFD_ZLIB_WINDOW_NS) {
+        return;
+    }
+
+    if (z->window_busy > elapsed / 4 * 3 && z->level > Z_BEST_SPEED) {
+        z->level--;
+    } else if (z->window_busy < elapsed / 4 &&
+               z->level < Z_BEST_COMPRESSION) {
+        z->level++;
+    }
+    trace_multifd_zlib_adapt_level(p->id, z->level, z->window_busy, elapsed);
+
+    z->window_start = now;
+    z->window_busy = 0;
+}
+
 /* Multifd zlib compression */
 
 static int multifd_zlib_send_setup(MultiFDSendParams *p, Error **errp)
@@ -49,6 +115,13 @@ static int multifd_zlib_send_setup(MultiFDSendParams *p, Error **errp)
     }
     /* This is the maximum size of the compressed buffer */
     z->zbuff_len = compressBound(MULTIFD_PACKET_SIZE);
+    if (migrate_multifd_zlib_adaptive()) {
+        /* Every change of level ends a deflate block */
+        z->zbuff_len += multifd_ram_page_count() * 16;
+        z->level = migrate_multifd_zlib_level() ?: Z_BEST_SPEED;
+        z->window_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
+    z->cur_level = migrate_multifd_zlib_level();
     z->zbuff = g_try_malloc(z->zbuff_len);
     if (!z->zbuff) {
         err_msg = "out of memory for zbuff";
@@ -99,6 +172,8 @@ static int multifd_zlib_send_prepare(MultiFDSendParams *p, Error **errp)
     z_stream *zs = &z->zs;
     uint32_t out_size = 0;
     uint32_t page_size = multifd_ram_page_size();
+    bool adaptive = migrate_multifd_zlib_adaptive();
+    int64_t start = 0;
     int ret;
     uint32_t i;
 
@@ -106,6 +181,10 @@ static int multifd_zlib_send_prepare(MultiFDSendParams *p, Error **errp)
         goto out;
     }
 
+    if (adaptive) {
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
+
     for (i = 0; i < pages->normal_num; i++) {
         uint32_t available = z->zbuff_len - out_size;
         int flush = Z_NO_FLUSH;
@@ -120,12 +199,30 @@ static int multifd_zlib_send_prepare(MultiFDSendParams *p, Error **errp)
          * therefore copy the page before calling deflate().
          */
         memcpy(z->buf, pages->block->host + pages->offset[i], page_size);
-        zs->avail_in = page_size;
-        zs->next_in = z->buf;
 
         zs->avail_out = available;
         zs->next_out = z->zbuff + out_size;
 
+        if (adaptive) {
+            int level = multifd_zlib_page_compressible(z->buf, page_size) ?
+                        z->level : Z_NO_COMPRESSION;
+
+            /* The destination inflates stored blocks like any other */
+            if (level != z->cur_level) {
+                zs->avail_in = 0;
+                ret = deflateParams(zs, level, Z_DEFAULT_STRATEGY);
+                if (ret != Z_OK) {
+                    error_setg(errp, "multifd %u: deflateParams returned %d "
+                               "instead of Z_OK", p->id, ret);
+                    return -1;
+                }
+                z->cur_level = level;
+            }
+        }
+
+        zs->avail_in = page_size;
+        zs->next_in = z->buf;
+
         /*
          * Welcome to deflate semantics
          *
@@ -149,6 +246,10 @@ static int multifd_zlib_send_prepare(MultiFDSendParams *p, Error **errp)
         }
         out_size += available - zs->avail_out;
     }
+    if (adaptive) {
+        multifd_zlib_adapt_level(p, z,
+                                 qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+    }
     p->iov[p->iovs_num].iov_base = z->zbuff;
     p->iov[p->iovs_num].iov_len = out_size;
     p->iovs_num++;
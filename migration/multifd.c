@@ -24,6 +24,7 @@
 #include "socket.h"
 #include "tls.h"
 #include "qemu-file.h"
+#include "savevm.h"
 #include "trace.h"
 #include "multifd.h"
 #include "threadinfo.h"
@@ -75,6 +76,11 @@ struct {
      * We will use atomic operations.  Only valid values are 0 and 1.
      */
     int exiting;
+    /*
+     * Serializes multifd_send() callers: besides the migration thread,
+     * device state save threads can queue data concurrently.
+     */
+    QemuMutex send_mutex;
     /* multifd ops */
     const MultiFDMethods *ops;
 } *multifd_send_state;
@@ -209,10 +215,10 @@ void multifd_send_fill_packet(MultiFDSendParams *p)
 
     memset(packet, 0, p->packet_len);
 
-    packet->magic = cpu_to_be32(MULTIFD_MAGIC);
-    packet->version = cpu_to_be32(MULTIFD_VERSION);
+    packet->hdr.magic = cpu_to_be32(MULTIFD_MAGIC);
+    packet->hdr.version = cpu_to_be32(MULTIFD_VERSION);
 
-    packet->flags = cpu_to_be32(p->flags);
+    packet->hdr.flags = cpu_to_be32(p->flags);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
 
     packet_num = qatomic_fetch_inc(&multifd_send_state->packet_num);
@@ -228,12 +234,40 @@ void multifd_send_fill_packet(MultiFDSendParams *p)
                             p->flags, p->next_packet_size);
 }
 
-static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
+static void multifd_device_state_send_prepare(MultiFDSendParams *p)
 {
-    const MultiFDPacket_t *packet = p->packet;
-    uint32_t magic = be32_to_cpu(packet->magic);
-    uint32_t version = be32_to_cpu(packet->version);
-    int ret = 0;
+    MultiFDPacketDeviceState_t *packet = p->packet_device_state;
+    MultiFDDeviceState_t *device_state = &p->data->u.device_state;
+
+    memset(packet, 0, sizeof(*packet));
+
+    packet->hdr.magic = cpu_to_be32(MULTIFD_MAGIC);
+    packet->hdr.version = cpu_to_be32(MULTIFD_VERSION);
+    packet->hdr.flags = cpu_to_be32(p->flags | MULTIFD_FLAG_DEVICE_STATE);
+
+    pstrcpy(packet->idstr, sizeof(packet->idstr), device_state->idstr);
+    packet->instance_id = cpu_to_be32(device_state->instance_id);
+    packet->next_packet_size = cpu_to_be32(device_state->buf_len);
+
+    p->iov[0].iov_base = packet;
+    p->iov[0].iov_len = sizeof(*packet);
+    p->iov[1].iov_base = device_state->buf;
+    p->iov[1].iov_len = device_state->buf_len;
+    p->iovs_num = 2;
+    p->next_packet_size = device_state->buf_len;
+
+    p->packets_sent++;
+
+    trace_multifd_send_fill(p->id, 0, p->flags | MULTIFD_FLAG_DEVICE_STATE,
+                            p->next_packet_size);
+}
+
+static int multifd_recv_unfill_packet_header(MultiFDRecvParams *p,
+                                             const MultiFDPacketHdr_t *hdr,
+                                             Error **errp)
+{
+    uint32_t magic = be32_to_cpu(hdr->magic);
+    uint32_t version = be32_to_cpu(hdr->version);
 
     if (magic != MULTIFD_MAGIC) {
         error_setg(errp, "multifd: received packet magic %x, expected %x",
@@ -247,7 +281,57 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
-    p->flags = be32_to_cpu(packet->flags);
+    p->flags = be32_to_cpu(hdr->flags);
+
+    return 0;
+}
+
+static int multifd_recv_unfill_packet_device_state(MultiFDRecvParams *p,
+                                                   Error **errp)
+{
+    MultiFDPacketDeviceState_t *packet = p->packet_device_state;
+
+    packet->instance_id = be32_to_cpu(packet->instance_id);
+    p->next_packet_size = be32_to_cpu(packet->next_packet_size);
+    p->packets_recved++;
+
+    /* The sender always terminates idstr, but don't trust the stream */
+    packet->idstr[sizeof(packet->idstr) - 1] = 0;
+
+    trace_multifd_recv_unfill(p->id, 0, p->flags, p->next_packet_size);
+
+    if (p->next_packet_size > MULTIFD_DEVICE_STATE_MAX_SIZE) {
+        error_setg(errp, "multifd: received device state packet of %u bytes, "
+                   "expected maximum %u", p->next_packet_size,
+                   MULTIFD_DEVICE_STATE_MAX_SIZE);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int multifd_device_state_recv(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDPacketDeviceState_t *packet = p->packet_device_state;
+    g_autofree char *buf = NULL;
+    int ret;
+
+    buf = g_malloc(p->next_packet_size);
+
+    ret = qio_channel_read_all(p->c, buf, p->next_packet_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    return qemu_loadvm_load_state_buffer(packet->idstr, packet->instance_id,
+                                         buf, p->next_packet_size, errp);
+}
+
+static int multifd_recv_unfill_packet_ram(MultiFDRecvParams *p, Error **errp)
+{
+    const MultiFDPacket_t *packet = p->packet;
+    int ret = 0;
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
     p->packets_recved++;
@@ -272,6 +356,15 @@ static bool multifd_recv_should_exit(void)
     return qatomic_read(&multifd_recv_state->exiting);
 }
 
+/*
+ * Lets a device waiting for its state to arrive over the multifd
+ * channels notice that no more packets will come.
+ */
+bool multifd_device_state_recv_aborted(void)
+{
+    return !multifd_recv_state || multifd_recv_should_exit();
+}
+
 /*
  * The migration thread can wait on either of the two semaphores.  This
  * function can be used to kick the main thread out of waiting on either of
@@ -309,6 +402,8 @@ bool multifd_send(MultiFDSendData **send_data)
         return false;
     }
 
+    QEMU_LOCK_GUARD(&multifd_send_state->send_mutex);
+
     /* We wait here, until at least one channel is ready */
     qemu_sem_wait(&multifd_send_state->channels_ready);
 
@@ -460,11 +555,16 @@ static bool multifd_send_cleanup_channel(MultiFDSendParams *p, Error **errp)
     qemu_sem_destroy(&p->sem_sync);
     g_free(p->name);
     p->name = NULL;
+    if (p->data && p->data->type == MULTIFD_PAYLOAD_DEVICE_STATE) {
+        multifd_send_data_clear_device_state(&p->data->u.device_state);
+    }
     g_free(p->data);
     p->data = NULL;
     p->packet_len = 0;
     g_free(p->packet);
     p->packet = NULL;
+    g_free(p->packet_device_state);
+    p->packet_device_state = NULL;
     multifd_send_state->ops->send_cleanup(p, errp);
     assert(!p->iov);
 
@@ -477,6 +577,7 @@ static void multifd_send_cleanup_state(void)
     socket_cleanup_outgoing_migration();
     qemu_sem_destroy(&multifd_send_state->channels_created);
     qemu_sem_destroy(&multifd_send_state->channels_ready);
+    qemu_mutex_destroy(&multifd_send_state->send_mutex);
     g_free(multifd_send_state->params);
     multifd_send_state->params = NULL;
     g_free(multifd_send_state);
@@ -600,12 +701,22 @@ static void *multifd_send_thread(void *opaque)
          * qatomic_store_release() in multifd_send().
          */
         if (qatomic_load_acquire(&p->pending_job)) {
+            bool is_device_state =
+                p->data->type == MULTIFD_PAYLOAD_DEVICE_STATE;
+            size_t header_len = p->packet_len;
+
             p->iovs_num = 0;
             assert(!multifd_payload_empty(p->data));
 
-            ret = multifd_send_state->ops->send_prepare(p, &local_err);
-            if (ret != 0) {
-                break;
+            if (is_device_state) {
+                /* Device state is opaque, so it bypasses compression */
+                multifd_device_state_send_prepare(p);
+                header_len = sizeof(*p->packet_device_state);
+            } else {
+                ret = multifd_send_state->ops->send_prepare(p, &local_err);
+                if (ret != 0) {
+                    break;
+                }
             }
 
             if (migrate_mapped_ram()) {
@@ -622,7 +733,11 @@ static void *multifd_send_thread(void *opaque)
             }
 
             stat64_add(&mig_stats.multifd_bytes,
-                       p->next_packet_size + p->packet_len);
+                       p->next_packet_size + header_len);
+
+            if (is_device_state) {
+                multifd_send_data_clear_device_state(&p->data->u.device_state);
+            }
 
             p->next_packet_size = 0;
             multifd_set_payload_type(p->data, MULTIFD_PAYLOAD_NONE);
@@ -824,6 +939,7 @@ bool multifd_send_setup(void)
     multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
     qemu_sem_init(&multifd_send_state->channels_created, 0);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
+    qemu_mutex_init(&multifd_send_state->send_mutex);
     qatomic_set(&multifd_send_state->exiting, 0);
     multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
 
@@ -840,6 +956,7 @@ bool multifd_send_setup(void)
             p->packet_len = sizeof(MultiFDPacket_t)
                           + sizeof(uint64_t) * page_count;
             p->packet = g_malloc0(p->packet_len);
+            p->packet_device_state = g_malloc0(sizeof(*p->packet_device_state));
         }
         p->name = g_strdup_printf("mig/src/send_%d", i);
         p->write_flags = 0;
@@ -1014,6 +1131,8 @@ static void multifd_recv_cleanup_channel(MultiFDRecvParams *p)
     p->packet_len = 0;
     g_free(p->packet);
     p->packet = NULL;
+    g_free(p->packet_device_state);
+    p->packet_device_state = NULL;
     g_free(p->normal);
     p->normal = NULL;
     g_free(p->zero);
@@ -1126,8 +1245,13 @@ static void *multifd_recv_thread(void *opaque)
     rcu_register_thread();
 
     while (true) {
+        MultiFDPacketHdr_t hdr;
         uint32_t flags = 0;
+        bool is_device_state = false;
         bool has_data = false;
+        uint8_t *pkt_buf;
+        size_t pkt_len;
+
         p->normal_num = 0;
 
         if (use_packets) {
@@ -1135,14 +1259,47 @@ static void *multifd_recv_thread(void *opaque)
                 break;
             }
 
-            ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
-                                           p->packet_len, &local_err);
+            ret = qio_channel_read_all_eof(p->c, (void *)&hdr,
+                                           sizeof(hdr), &local_err);
             if (ret == 0 || ret == -1) {   /* 0: EOF  -1: Error */
                 break;
             }
 
+            ret = multifd_recv_unfill_packet_header(p, &hdr, &local_err);
+            if (ret) {
+                break;
+            }
+
+            is_device_state = p->flags & MULTIFD_FLAG_DEVICE_STATE;
+            if (is_device_state) {
+                pkt_buf = (uint8_t *)p->packet_device_state + sizeof(hdr);
+                pkt_len = sizeof(*p->packet_device_state) - sizeof(hdr);
+            } else {
+                pkt_buf = (uint8_t *)p->packet + sizeof(hdr);
+                pkt_len = p->packet_len - sizeof(hdr);
+            }
+
+            /* EOF after the header is an error */
+            ret = qio_channel_read_all(p->c, (char *)pkt_buf, pkt_len,
+                                       &local_err);
+            if (ret != 0) {
+                break;
+            }
+
+            if (is_device_state) {
+                ret = multifd_recv_unfill_packet_device_state(p, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+                ret = multifd_device_state_recv(p, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+                continue;
+            }
+
             qemu_mutex_lock(&p->mutex);
-            ret = multifd_recv_unfill_packet(p, &local_err);
+            ret = multifd_recv_unfill_packet_ram(p, &local_err);
             if (ret) {
                 qemu_mutex_unlock(&p->mutex);
                 break;
@@ -1258,6 +1415,7 @@ int multifd_recv_setup(Error **errp)
             p->packet_len = sizeof(MultiFDPacket_t)
                 + sizeof(uint64_t) * page_count;
             p->packet = g_malloc0(p->packet_len);
+            p->packet_device_state = g_malloc0(sizeof(*p->packet_device_state));
         }
         p->name = g_strdup_printf("mig/dst/recv_%d", i);
         p->normal = g_new0(ram_addr_t, page_count);
@@ -950,16 +950,71 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
     trace_postcopy_pause_fault_thread_continued();
 }
 
+/* Largest number of faults read from the userfaultfd at once */
+#define POSTCOPY_FAULT_BATCH 32
+
+/*
+ * Request the pages of a batch of faults read from the userfaultfd.
+ * Returns non-zero if the fault thread has to stop.
+ */
+static int postcopy_ram_fault_thread_handle(MigrationIncomingState *mis,
+                                            struct uffd_msg *msgs, int nr)
+{
+    int i;
+
+    for (i = 0; i < nr; i++) {
+        struct uffd_msg *msg = &msgs[i];
+        ram_addr_t rb_offset;
+        RAMBlock *rb;
+
+        if (msg->event != UFFD_EVENT_PAGEFAULT) {
+            error_report("%s: Read unexpected event %ud from userfaultfd",
+                         __func__, msg->event);
+            continue; /* It's not a page fault, shouldn't happen */
+        }
+
+        rb = qemu_ram_block_from_host(
+                 (void *)(uintptr_t)msg->arg.pagefault.address,
+                 true, &rb_offset);
+        if (!rb) {
+            error_report("postcopy_ram_fault_thread: Fault outside guest: %"
+                         PRIx64, (uint64_t)msg->arg.pagefault.address);
+            return -1;
+        }
+
+        rb_offset = ROUND_DOWN(rb_offset, qemu_ram_pagesize(rb));
+        trace_postcopy_ram_fault_thread_request(msg->arg.pagefault.address,
+                                            qemu_ram_get_idstr(rb),
+                                            rb_offset,
+                                            msg->arg.pagefault.feat.ptid);
+        mark_postcopy_blocktime_begin(
+                (uintptr_t)(msg->arg.pagefault.address),
+                            msg->arg.pagefault.feat.ptid, rb);
+
+        /*
+         * Send the request to the source - we want to request one
+         * of our host page sizes (which is >= TPS)
+         */
+        while (postcopy_request_page(mis, rb, rb_offset,
+                                     msg->arg.pagefault.address)) {
+            /* May be network failure, try to wait for recovery */
+            postcopy_pause_fault_thread(mis);
+        }
+    }
+
+    return 0;
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    struct uffd_msg msgs[POSTCOPY_FAULT_BATCH];
     struct uffd_msg msg;
     int ret;
     size_t index;
-    RAMBlock *rb = NULL;
 
     trace_postcopy_ram_fault_thread_entry();
     rcu_register_thread();
@@ -986,7 +1041,6 @@ static void *postcopy_ram_fault_thread(void *opaque)
     }
 
     while (true) {
-        ram_addr_t rb_offset;
         int poll_result;
 
         /*
@@ -1027,9 +1081,10 @@ static void *postcopy_ram_fault_thread(void *opaque)
 
         if (pfd[0].revents) {
             poll_result--;
-            ret = read(mis->userfault_fd, &msg, sizeof(msg));
-            if (ret != sizeof(msg)) {
-                if (errno == EAGAIN) {
+            /* Collect all faults that are pending, not just the first */
+            ret = read(mis->userfault_fd, msgs, sizeof(msgs));
+            if (ret <= 0 || ret % sizeof(msgs[0])) {
+                if (ret < 0 && errno == EAGAIN) {
                     /*
                      * if a wake up happens on the other thread just after
                      * the poll, there is nothing to read.
@@ -1043,47 +1098,15 @@ static void *postcopy_ram_fault_thread(void *opaque)
                     break;
                 } else {
                     error_report("%s: Read %d bytes from userfaultfd "
-                                 "expected %zd",
-                                 __func__, ret, sizeof(msg));
+                                 "expected a multiple of %zd",
+                                 __func__, ret, sizeof(msgs[0]));
                     break; /* Lost alignment, don't know what we'd read next */
                 }
             }
-            if (msg.event != UFFD_EVENT_PAGEFAULT) {
-                error_report("%s: Read unexpected event %ud from userfaultfd",
-                             __func__, msg.event);
-                continue; /* It's not a page fault, shouldn't happen */
-            }
-
-            rb = qemu_ram_block_from_host(
-                     (void *)(uintptr_t)msg.arg.pagefault.address,
-                     true, &rb_offset);
-            if (!rb) {
-                error_report("postcopy_ram_fault_thread: Fault outside guest: %"
-                             PRIx64, (uint64_t)msg.arg.pagefault.address);
+            if (postcopy_ram_fault_thread_handle(mis, msgs,
+                                                 ret / sizeof(msgs[0]))) {
                 break;
             }
-
-            rb_offset = ROUND_DOWN(rb_offset, qemu_ram_pagesize(rb));
-            trace_postcopy_ram_fault_thread_request(msg.arg.pagefault.address,
-                                                qemu_ram_get_idstr(rb),
-                                                rb_offset,
-                                                msg.arg.pagefault.feat.ptid);
-            mark_postcopy_blocktime_begin(
-                    (uintptr_t)(msg.arg.pagefault.address),
-                                msg.arg.pagefault.feat.ptid, rb);
-
-retry:
-            /*
-             * Send the request to the source - we want to request one
-             * of our host page sizes (which is >= TPS)
-             */
-            ret = postcopy_request_page(mis, rb, rb_offset,
-                                        msg.arg.pagefault.address);
-            if (ret) {
-                /* May be network failure, try to wait for recovery */
-                postcopy_pause_fault_thread(mis);
-                goto retry;
-            }
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -28,6 +28,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
@@ -56,6 +57,7 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "mapped-ram-lazy.h"
 #include "sysemu/runstate.h"
 #include "rdma.h"
 #include "options.h"
@@ -124,6 +126,8 @@ struct PageSearchStatus {
     unsigned long page;
     /* Set once we wrap around */
     bool         complete_round;
+    /* Whether the search started in the hot pass (defer-hot-pages) */
+    bool         hot_pass_start;
     /* Whether we're sending a host page */
     bool          host_page_sending;
     /* The start/end of current host page.  Invalid if host_page_sending==false */
@@ -385,6 +389,11 @@ struct RAMState {
     uint64_t xbzrle_bytes_prev;
     /* Are we really using XBZRLE (e.g., after the first round). */
     bool xbzrle_started;
+    /*
+     * With defer-hot-pages, every round first sends the cold dirty pages
+     * and then the hot ones.  Set while sending the hot ones.
+     */
+    bool hot_pass;
     /* Are we on the last stage of migration */
     bool last_stage;
 
@@ -403,9 +412,17 @@ struct RAMState {
     QemuMutex bitmap_mutex;
     /* The RAMBlock used in the last src_page_requests */
     RAMBlock *last_req_rb;
+    /* Last postcopy request, to detect strided faults for prefetching */
+    RAMBlock *prefetch_rb;
+    ram_addr_t prefetch_start;
+    int64_t prefetch_stride;
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* Prefetched pages, only sent while src_page_requests is empty */
+    QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_prefetch_requests;
+    /* Number of entries in src_prefetch_requests */
+    uint32_t src_prefetch_queued;
 
     /*
      * This is only used when postcopy is in recovery phase, to communicate
@@ -733,6 +750,39 @@ static void pss_find_next_dirty(PageSearchStatus *pss)
     pss->page = find_next_bit(bitmap, size, pss->page);
 }
 
+/**
+ * pss_find_next_dirty_of_pass: find the next dirty page that the current
+ * pass of the search sends
+ *
+ * With defer-hot-pages the pages that were dirtied again after being
+ * sent are postponed to the end of the round, so that they have less
+ * time to be dirtied once more before the next bitmap sync.
+ *
+ * @rs: current RAM state
+ * @pss: the current page search status
+ */
+static void pss_find_next_dirty_of_pass(RAMState *rs, PageSearchStatus *pss)
+{
+    RAMBlock *rb = pss->block;
+    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
+
+    pss_find_next_dirty(pss);
+
+    if (!rb->hot_bmap) {
+        return;
+    }
+
+    while (pss->page < size &&
+           test_bit(pss->page, rb->hot_bmap) != rs->hot_pass) {
+        if (rs->hot_pass) {
+            pss->page = find_next_bit(rb->hot_bmap, size, pss->page);
+        } else {
+            pss->page = find_next_zero_bit(rb->hot_bmap, size, pss->page);
+        }
+        pss_find_next_dirty(pss);
+    }
+}
+
 static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
                                                        unsigned long page)
 {
@@ -922,6 +972,130 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Syncing the dirty bitmap of a large guest takes long enough to show
+ * up in the downtime, so above this size it is split into chunks of
+ * the dirty log clear granularity, which are synced by several threads.
+ */
+#define RAM_SYNC_PARALLEL_MIN (16 * GiB)
+#define RAM_SYNC_MAX_THREADS 8
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} RAMSyncChunk;
+
+typedef struct {
+    RAMSyncChunk *chunks;
+    unsigned int num_chunks;
+    /* next chunk to sync, taken with qatomic_fetch_inc() */
+    unsigned int next;
+} RAMSyncWork;
+
+typedef struct {
+    RAMSyncWork *work;
+    QemuThread thread;
+    uint64_t new_dirty_pages;
+} RAMSyncThread;
+
+/* Called with RCU critical section */
+static uint64_t ram_sync_chunks(RAMSyncWork *work)
+{
+    uint64_t new_dirty_pages = 0;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&work->next)) < work->num_chunks) {
+        RAMSyncChunk *chunk = &work->chunks[i];
+
+        new_dirty_pages +=
+            cpu_physical_memory_sync_dirty_bitmap(chunk->block, chunk->start,
+                                                  chunk->length);
+    }
+
+    return new_dirty_pages;
+}
+
+static void *ram_sync_thread(void *opaque)
+{
+    RAMSyncThread *t = opaque;
+
+    rcu_register_thread();
+    WITH_RCU_READ_LOCK_GUARD() {
+        t->new_dirty_pages = ram_sync_chunks(t->work);
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/*
+ * Called with RCU critical section and bitmap_mutex held.  The chunks
+ * are multiples of BITS_PER_LONG pages, so no two threads ever touch
+ * the same word of a block's bmap.
+ */
+static void ram_sync_dirty_bitmaps(RAMState *rs)
+{
+    g_autoptr(GArray) chunks = g_array_new(false, false, sizeof(RAMSyncChunk));
+    RAMSyncThread threads[RAM_SYNC_MAX_THREADS];
+    RAMSyncWork work = {};
+    uint64_t new_dirty_pages;
+    uint64_t total = 0;
+    RAMBlock *block;
+    int nthreads, i;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        total += block->used_length;
+    }
+
+    if (total < RAM_SYNC_PARALLEL_MIN) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+        return;
+    }
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        uint8_t shift = block->clear_bmap ? block->clear_bmap_shift
+                                          : CLEAR_BITMAP_SHIFT_DEFAULT;
+        ram_addr_t chunk_size = (ram_addr_t)1 << (shift + TARGET_PAGE_BITS);
+        ram_addr_t start;
+
+        for (start = 0; start < block->used_length; start += chunk_size) {
+            RAMSyncChunk chunk = {
+                .block = block,
+                .start = start,
+                .length = MIN(chunk_size, block->used_length - start),
+            };
+
+            g_array_append_val(chunks, chunk);
+        }
+    }
+
+    work.chunks = (RAMSyncChunk *)chunks->data;
+    work.num_chunks = chunks->len;
+
+    /* The migration thread takes its share, too */
+    nthreads = MIN(RAM_SYNC_MAX_THREADS, work.num_chunks / 2);
+    for (i = 0; i < nthreads; i++) {
+        threads[i].work = &work;
+        threads[i].new_dirty_pages = 0;
+        qemu_thread_create(&threads[i].thread, "mig/src/bmap_sync",
+                           ram_sync_thread, &threads[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    new_dirty_pages = ram_sync_chunks(&work);
+
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_join(&threads[i].thread);
+        new_dirty_pages += threads[i].new_dirty_pages;
+    }
+
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1043,7 +1217,6 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
-    RAMBlock *block;
     int64_t end_time;
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
@@ -1057,9 +1230,7 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
-            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-                ramblock_sync_dirty_bitmap(rs, block);
-            }
+            ram_sync_dirty_bitmaps(rs);
             stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
         }
     }
@@ -1289,6 +1460,27 @@ static int ram_save_multifd_page(RAMBlock *block, ram_addr_t offset)
 #define PAGE_ALL_CLEAN 0
 #define PAGE_TRY_AGAIN 1
 #define PAGE_DIRTY_FOUND 2
+/*
+ * Make sure that all pages queued on the multifd channels so far reach
+ * the destination before any page queued later.
+ */
+static int ram_multifd_flush_and_sync(RAMState *rs)
+{
+    QEMUFile *f = rs->pss[RAM_CHANNEL_PRECOPY].pss_channel;
+    int ret = multifd_ram_flush_and_sync();
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (!migrate_mapped_ram()) {
+        qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_FLUSH);
+        qemu_fflush(f);
+    }
+
+    return 0;
+}
+
 /**
  * find_dirty_block: find the next dirty page and update any state
  * associated with the search process.
@@ -1306,10 +1498,10 @@ static int ram_save_multifd_page(RAMBlock *block, ram_addr_t offset)
 static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
 {
     /* Update pss->page for the next dirty bit in ramblock */
-    pss_find_next_dirty(pss);
+    pss_find_next_dirty_of_pass(rs, pss);
 
     if (pss->complete_round && pss->block == rs->last_seen_block &&
-        pss->page >= rs->last_page) {
+        pss->page >= rs->last_page && rs->hot_pass == pss->hot_pass_start) {
         /*
          * We've been once around the RAM and haven't found anything.
          * Give up.
@@ -1321,20 +1513,31 @@ static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
         /* Didn't find anything in this RAM Block */
         pss->page = 0;
         pss->block = QLIST_NEXT_RCU(pss->block, next);
+        if (!pss->block && migrate_defer_hot_pages() && !rs->hot_pass) {
+            /*
+             * Done with the cold pages, now send the hot ones.  A page
+             * dirtied again since it was sent in the cold pass is sent
+             * again in the hot pass, so the older copy must arrive first.
+             */
+            if (migrate_multifd()) {
+                int ret = ram_multifd_flush_and_sync(rs);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+            rs->hot_pass = true;
+            pss->block = QLIST_FIRST_RCU(&ram_list.blocks);
+            return PAGE_TRY_AGAIN;
+        }
         if (!pss->block) {
+            rs->hot_pass = false;
             if (migrate_multifd() &&
                 (!migrate_multifd_flush_after_each_section() ||
                  migrate_mapped_ram())) {
-                QEMUFile *f = rs->pss[RAM_CHANNEL_PRECOPY].pss_channel;
-                int ret = multifd_ram_flush_and_sync();
+                int ret = ram_multifd_flush_and_sync(rs);
                 if (ret < 0) {
                     return ret;
                 }
-
-                if (!migrate_mapped_ram()) {
-                    qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_FLUSH);
-                    qemu_fflush(f);
-                }
             }
 
             /* Hit the end of the list */
@@ -1368,31 +1571,47 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
 {
     struct RAMSrcPageRequest *entry;
     RAMBlock *block = NULL;
+    bool prefetch;
 
-    if (!postcopy_has_request(rs)) {
+    if (!postcopy_has_request(rs) &&
+        QSIMPLEQ_EMPTY_ATOMIC(&rs->src_prefetch_requests)) {
         return NULL;
     }
 
     QEMU_LOCK_GUARD(&rs->src_page_req_mutex);
 
     /*
-     * This should _never_ change even after we take the lock, because no one
-     * should be taking anything off the request list other than us.
+     * Neither queue can become empty after we take the lock, because no
+     * one should be taking anything off the request lists other than us.
+     * A page request may have come in meanwhile, though, and it goes
+     * before any prefetched page.
      */
-    assert(postcopy_has_request(rs));
-
     entry = QSIMPLEQ_FIRST(&rs->src_page_requests);
+    prefetch = !entry;
+    if (prefetch) {
+        entry = QSIMPLEQ_FIRST(&rs->src_prefetch_requests);
+    }
+    assert(entry);
+
     block = entry->rb;
     *offset = entry->offset;
+    if (prefetch) {
+        clear_bit(*offset >> TARGET_PAGE_BITS, block->prefetch_bmap);
+    }
 
     if (entry->len > TARGET_PAGE_SIZE) {
         entry->len -= TARGET_PAGE_SIZE;
         entry->offset += TARGET_PAGE_SIZE;
     } else {
         memory_region_unref(block->mr);
-        QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
+        if (prefetch) {
+            QSIMPLEQ_REMOVE_HEAD(&rs->src_prefetch_requests, next_req);
+            rs->src_prefetch_queued--;
+        } else {
+            QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
+            migration_consume_urgent_request();
+        }
         g_free(entry);
-        migration_consume_urgent_request();
     }
 
     return block;
@@ -1865,60 +2084,32 @@ static void migration_page_queue_free(RAMState *rs)
         QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
         g_free(mspr);
     }
+    QSIMPLEQ_FOREACH_SAFE(mspr, &rs->src_prefetch_requests, next_req,
+                          next_mspr) {
+        bitmap_clear(mspr->rb->prefetch_bmap, mspr->offset >> TARGET_PAGE_BITS,
+                     mspr->len >> TARGET_PAGE_BITS);
+        memory_region_unref(mspr->rb->mr);
+        QSIMPLEQ_REMOVE_HEAD(&rs->src_prefetch_requests, next_req);
+        g_free(mspr);
+    }
+    rs->src_prefetch_queued = 0;
 }
 
-/**
- * ram_save_queue_pages: queue the page for transmission
- *
- * A request from postcopy destination for example.
+/*
+ * ram_postcopy_request_pages: send or queue pages for the destination
  *
  * Returns zero on success or negative on error
  *
- * @rbname: Name of the RAMBLock of the request. NULL means the
- *          same that last one.
- * @start: starting address from the start of the RAMBlock
- * @len: length (in bytes) to send
+ * @rs: current RAM state
+ * @ramblock: block the pages belong to
+ * @start: offset of the first page in the block
+ * @len: length of the range, a multiple of the host page size
+ * @errp: pointer to an error
  */
-int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
-                         Error **errp)
+static int ram_postcopy_request_pages(RAMState *rs, RAMBlock *ramblock,
+                                      ram_addr_t start, ram_addr_t len,
+                                      Error **errp)
 {
-    RAMBlock *ramblock;
-    RAMState *rs = ram_state;
-
-    stat64_add(&mig_stats.postcopy_requests, 1);
-    RCU_READ_LOCK_GUARD();
-
-    if (!rbname) {
-        /* Reuse last RAMBlock */
-        ramblock = rs->last_req_rb;
-
-        if (!ramblock) {
-            /*
-             * Shouldn't happen, we can't reuse the last RAMBlock if
-             * it's the 1st request.
-             */
-            error_setg(errp, "MIG_RP_MSG_REQ_PAGES has no previous block");
-            return -1;
-        }
-    } else {
-        ramblock = qemu_ram_block_by_name(rbname);
-
-        if (!ramblock) {
-            /* We shouldn't be asked for a non-existent RAMBlock */
-            error_setg(errp, "MIG_RP_MSG_REQ_PAGES has no block '%s'", rbname);
-            return -1;
-        }
-        rs->last_req_rb = ramblock;
-    }
-    trace_ram_save_queue_pages(ramblock->idstr, start, len);
-    if (!offset_in_ramblock(ramblock, start + len - 1)) {
-        error_setg(errp, "MIG_RP_MSG_REQ_PAGES request overrun, "
-                   "start=" RAM_ADDR_FMT " len="
-                   RAM_ADDR_FMT " blocklen=" RAM_ADDR_FMT,
-                   start, len, ramblock->used_length);
-        return -1;
-    }
-
     /*
      * When with postcopy preempt, we send back the page directly in the
      * rp-return thread.
@@ -1984,6 +2175,151 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
     return 0;
 }
 
+/* Number of prefetch windows that may be queued at the same time */
+#define POSTCOPY_PREFETCH_QUEUE_WINDOWS 4
+
+/*
+ * ram_postcopy_prefetch: queue the pages the destination is likely to
+ * fault on after a page request
+ *
+ * If the last requests on the block were a constant stride apart, the
+ * pages along the stride are queued, otherwise the ones following the
+ * request.  Pages that were sent already or are still queued are skipped,
+ * and at most POSTCOPY_PREFETCH_QUEUE_WINDOWS windows are queued at any
+ * time, so that the queue cannot grow without bound when the destination
+ * faults faster than the migration thread sends.
+ *
+ * Nothing is sent here: the return path thread goes straight back to
+ * reading requests, and the migration thread sends the prefetched pages
+ * within its bandwidth limit whenever no page request is pending.
+ *
+ * @rs: current RAM state
+ * @ramblock: block of the request
+ * @start: offset of the request in the block
+ * @len: length of the request
+ */
+static void ram_postcopy_prefetch(RAMState *rs, RAMBlock *ramblock,
+                                  ram_addr_t start, ram_addr_t len)
+{
+    uint32_t window = migrate_postcopy_prefetch_pages();
+    int64_t page_size = qemu_ram_pagesize(ramblock);
+    int64_t stride = 0, step, offset;
+    uint32_t i, queued = 0;
+
+    if (!ramblock->prefetch_bmap) {
+        return;
+    }
+
+    if (ramblock == rs->prefetch_rb) {
+        stride = (int64_t)start - (int64_t)rs->prefetch_start;
+    }
+
+    if (stride && stride == rs->prefetch_stride) {
+        step = stride;
+        offset = start + stride;
+    } else {
+        step = page_size;
+        offset = start + len;
+    }
+
+    rs->prefetch_rb = ramblock;
+    rs->prefetch_start = start;
+    rs->prefetch_stride = stride;
+
+    qemu_mutex_lock(&rs->src_page_req_mutex);
+    for (i = 0; i < window; i++, offset += step) {
+        struct RAMSrcPageRequest *new_entry;
+        unsigned long page = offset >> TARGET_PAGE_BITS;
+
+        if (offset < 0 || !offset_in_ramblock(ramblock, offset) ||
+            rs->src_prefetch_queued >=
+            window * POSTCOPY_PREFETCH_QUEUE_WINDOWS) {
+            break;
+        }
+        if (!test_bit(page, ramblock->bmap) ||
+            test_bit(page, ramblock->prefetch_bmap)) {
+            continue;
+        }
+
+        new_entry = g_new0(struct RAMSrcPageRequest, 1);
+        new_entry->rb = ramblock;
+        new_entry->offset = offset;
+        new_entry->len = page_size;
+
+        memory_region_ref(ramblock->mr);
+        QSIMPLEQ_INSERT_TAIL(&rs->src_prefetch_requests, new_entry, next_req);
+        bitmap_set(ramblock->prefetch_bmap, page,
+                   page_size >> TARGET_PAGE_BITS);
+        rs->src_prefetch_queued++;
+        queued++;
+    }
+    qemu_mutex_unlock(&rs->src_page_req_mutex);
+
+    if (queued) {
+        trace_ram_postcopy_prefetch(ramblock->idstr, start, step, queued);
+    }
+}
+
+/**
+ * ram_save_queue_pages: queue the page for transmission
+ *
+ * A request from postcopy destination for example.
+ *
+ * Returns zero on success or negative on error
+ *
+ * @rbname: Name of the RAMBLock of the request. NULL means the
+ *          same that last one.
+ * @start: starting address from the start of the RAMBlock
+ * @len: length (in bytes) to send
+ */
+int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
+                         Error **errp)
+{
+    RAMBlock *ramblock;
+    RAMState *rs = ram_state;
+
+    stat64_add(&mig_stats.postcopy_requests, 1);
+    RCU_READ_LOCK_GUARD();
+
+    if (!rbname) {
+        /* Reuse last RAMBlock */
+        ramblock = rs->last_req_rb;
+
+        if (!ramblock) {
+            /*
+             * Shouldn't happen, we can't reuse the last RAMBlock if
+             * it's the 1st request.
+             */
+            error_setg(errp, "MIG_RP_MSG_REQ_PAGES has no previous block");
+            return -1;
+        }
+    } else {
+        ramblock = qemu_ram_block_by_name(rbname);
+
+        if (!ramblock) {
+            /* We shouldn't be asked for a non-existent RAMBlock */
+            error_setg(errp, "MIG_RP_MSG_REQ_PAGES has no block '%s'", rbname);
+            return -1;
+        }
+        rs->last_req_rb = ramblock;
+    }
+    trace_ram_save_queue_pages(ramblock->idstr, start, len);
+    if (!offset_in_ramblock(ramblock, start + len - 1)) {
+        error_setg(errp, "MIG_RP_MSG_REQ_PAGES request overrun, "
+                   "start=" RAM_ADDR_FMT " len="
+                   RAM_ADDR_FMT " blocklen=" RAM_ADDR_FMT,
+                   start, len, ramblock->used_length);
+        return -1;
+    }
+
+    if (ram_postcopy_request_pages(rs, ramblock, start, len, errp)) {
+        return -1;
+    }
+
+    ram_postcopy_prefetch(rs, ramblock, start, len);
+    return 0;
+}
+
 /**
  * ram_save_target_page_legacy: save one target page
  *
@@ -2257,6 +2593,7 @@ static int ram_find_and_save_block(RAMState *rs)
     }
 
     pss_init(pss, rs->last_seen_block, rs->last_page);
+    pss->hot_pass_start = rs->hot_pass;
 
     while (true){
         if (!get_queued_page(rs, pss)) {
@@ -2358,6 +2695,10 @@ static void ram_bitmaps_destroy(void)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->hot_bmap);
+        block->hot_bmap = NULL;
+        g_free(block->prefetch_bmap);
+        block->prefetch_bmap = NULL;
         g_free(block->file_bmap);
         block->file_bmap = NULL;
     }
@@ -2403,6 +2744,7 @@ static void ram_state_reset(RAMState *rs)
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     rs->xbzrle_started = false;
+    rs->hot_pass = false;
 }
 
 #define MAX_WAIT 50 /* ms, half buffered_file limit */
@@ -2700,6 +3042,7 @@ static bool ram_state_init(RAMState **rsp, Error **errp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    QSIMPLEQ_INIT(&(*rsp)->src_prefetch_requests);
     (*rsp)->ram_bytes_total = ram_bytes_total();
 
     /*
@@ -2749,6 +3092,12 @@ static void ram_list_init_bitmaps(void)
             if (migrate_mapped_ram()) {
                 block->file_bmap = bitmap_new(pages);
             }
+            if (migrate_defer_hot_pages()) {
+                block->hot_bmap = bitmap_new(pages);
+            }
+            if (migrate_postcopy_ram()) {
+                block->prefetch_bmap = bitmap_new(pages);
+            }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
         }
@@ -3248,7 +3597,11 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     WITH_RCU_READ_LOCK_GUARD() {
         if (!migration_in_postcopy()) {
+            int64_t start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
             migration_bitmap_sync_precopy(rs, true);
+            migrate_get_current()->downtime_stats.ram_sync =
+                qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_ts;
         }
 
         ret = rdma_registration_start(f, RAM_CONTROL_FINISH);
@@ -3839,6 +4192,83 @@ static bool postcopy_is_running(void)
     return ps >= POSTCOPY_INCOMING_LISTENING && ps < POSTCOPY_INCOMING_END;
 }
 
+/*
+ * Copying the dirty pages out of the cache dominates a checkpoint on the
+ * secondary, so large flushes are split across threads.
+ */
+#define COLO_FLUSH_THREADS_MAX      8
+#define COLO_FLUSH_BYTES_PER_THREAD (16 * MiB)
+
+typedef struct ColoFlushRange {
+    void *dst;
+    const void *src;
+    size_t len;
+} ColoFlushRange;
+
+typedef struct ColoFlushWork {
+    QemuThread thread;
+    GArray *ranges;
+    /* Byte interval of the concatenated ranges that this worker copies */
+    uint64_t start;
+    uint64_t end;
+} ColoFlushWork;
+
+static void colo_flush_copy(GArray *ranges, uint64_t start, uint64_t end)
+{
+    uint64_t pos = 0;
+    guint i;
+
+    for (i = 0; i < ranges->len && pos < end; i++) {
+        ColoFlushRange *r = &g_array_index(ranges, ColoFlushRange, i);
+
+        if (pos + r->len > start) {
+            uint64_t from = MAX(start, pos) - pos;
+            uint64_t to = MIN(end, pos + r->len) - pos;
+
+            memcpy(r->dst + from, r->src + from, to - from);
+        }
+        pos += r->len;
+    }
+}
+
+static void *colo_flush_thread(void *opaque)
+{
+    ColoFlushWork *work = opaque;
+
+    colo_flush_copy(work->ranges, work->start, work->end);
+    return NULL;
+}
+
+static void colo_flush_ranges(GArray *ranges, uint64_t total)
+{
+    g_autofree ColoFlushWork *work = NULL;
+    int nthreads, i;
+
+    nthreads = MIN(g_get_num_processors(), COLO_FLUSH_THREADS_MAX);
+    nthreads = MIN(nthreads, total / COLO_FLUSH_BYTES_PER_THREAD);
+    if (nthreads <= 1) {
+        colo_flush_copy(ranges, 0, total);
+        return;
+    }
+
+    /* The last share is copied by this thread */
+    work = g_new(ColoFlushWork, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        work[i].ranges = ranges;
+        work[i].start = total * i / nthreads;
+        work[i].end = total * (i + 1) / nthreads;
+        if (i < nthreads - 1) {
+            qemu_thread_create(&work[i].thread, "colo-flush",
+                               colo_flush_thread, &work[i],
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+    colo_flush_copy(ranges, work[nthreads - 1].start, work[nthreads - 1].end);
+    for (i = 0; i < nthreads - 1; i++) {
+        qemu_thread_join(&work[i].thread);
+    }
+}
+
 /*
  * Flush content of RAM cache into SVM's memory.
  * Only flush the pages that be dirtied by PVM or SVM or both.
@@ -3846,8 +4276,9 @@ static bool postcopy_is_running(void)
 void colo_flush_ram_cache(void)
 {
     RAMBlock *block = NULL;
-    void *dst_host;
-    void *src_host;
+    g_autoptr(GArray) ranges = g_array_new(FALSE, FALSE,
+                                           sizeof(ColoFlushRange));
+    uint64_t total = 0;
     unsigned long offset = 0;
 
     memory_global_dirty_log_sync(false);
@@ -3873,18 +4304,23 @@ void colo_flush_ram_cache(void)
                 block = QLIST_NEXT_RCU(block, next);
             } else {
                 unsigned long i = 0;
+                ColoFlushRange r;
 
                 for (i = 0; i < num; i++) {
                     migration_bitmap_clear_dirty(ram_state, block, offset + i);
                 }
-                dst_host = block->host
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                src_host = block->colo_cache
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                memcpy(dst_host, src_host, TARGET_PAGE_SIZE * num);
+                r.dst = block->host
+                      + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
+                r.src = block->colo_cache
+                      + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
+                r.len = TARGET_PAGE_SIZE * num;
+                g_array_append_val(ranges, r);
+                total += r.len;
                 offset += num;
             }
         }
+
+        colo_flush_ranges(ranges, total);
     }
     qemu_mutex_unlock(&ram_state->bitmap_mutex);
     trace_colo_flush_ram_cache_end();
@@ -3998,7 +4434,13 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
-    if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
+    if (migrate_mapped_ram_lazy_load()) {
+        if (!mapped_ram_lazy_load_add_block(f, block, block->pages_offset,
+                                            g_steal_pointer(&bitmap),
+                                            num_pages, errp)) {
+            return;
+        }
+    } else if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
         return;
     }
 
@@ -4212,6 +4654,10 @@ static int ram_load_precopy(QEMUFile *f)
             if (migrate_mapped_ram()) {
                 multifd_recv_sync_main();
             }
+            /* The pages are read while the guest is already running */
+            if (!ret && migrate_mapped_ram_lazy_load()) {
+                mapped_ram_lazy_load_start();
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
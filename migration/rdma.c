@@ -67,6 +67,11 @@
  * Capabilities for negotiation.
  */
 #define RDMA_CAPABILITY_PIN_ALL 0x01
+/*
+ * Set by the extra connections that only carry RDMA writes for the
+ * migration set up on the first one, never on the first one itself.
+ */
+#define RDMA_CAPABILITY_DATA_CHANNEL 0x02
 
 /*
  * Add the other flags above to this list of known capabilities
@@ -284,6 +289,18 @@ typedef struct RDMALocalBlocks {
     RDMALocalBlock *block;
 } RDMALocalBlocks;
 
+/*
+ * Extra connection used for RDMA writes only.  Its queue pair shares
+ * the protection domain and the completion queues of the main
+ * connection, so that memory keys and write completions work the
+ * same on every connection.
+ */
+typedef struct RDMADataChannel {
+    struct rdma_cm_id *cm_id;
+    /* source only, the destination shares its listening channel */
+    struct rdma_event_channel *channel;
+} RDMADataChannel;
+
 /*
  * Main data structure for RDMA state.
  * While there is only one copy of this structure being allocated right now,
@@ -375,6 +392,10 @@ typedef struct RDMAContext {
     /* the RDMAContext for return path */
     struct RDMAContext *return_path;
     bool is_return_path;
+
+    /* Extra connections the RDMA writes are spread over */
+    RDMADataChannel *data_channels;
+    int nb_data_channels;
 } RDMAContext;
 
 #define TYPE_QIO_CHANNEL_RDMA "qio-channel-rdma"
@@ -1074,7 +1095,10 @@ static int qemu_rdma_alloc_pd_cq(RDMAContext *rdma, Error **errp)
         goto err_alloc_pd_cq;
     }
 
-    rdma->send_cq = ibv_create_cq(rdma->verbs, (RDMA_SIGNALED_SEND_MAX * 3),
+    /* The queue pairs of the data channels complete writes here, too */
+    rdma->send_cq = ibv_create_cq(rdma->verbs,
+                                  RDMA_SIGNALED_SEND_MAX *
+                                  (2 + migrate_rdma_channels()),
                                   NULL, rdma->send_comp_channel, 0);
     if (!rdma->send_cq) {
         error_setg(errp, "failed to allocate send completion queue");
@@ -1127,6 +1151,26 @@ static int qemu_rdma_alloc_qp(RDMAContext *rdma)
     return 0;
 }
 
+/*
+ * Create the queue pair of a data channel.  Only RDMA writes are posted
+ * on it, and they complete on the send queue of the main connection.
+ */
+static int qemu_rdma_alloc_data_qp(RDMAContext *rdma,
+                                   struct rdma_cm_id *cm_id)
+{
+    struct ibv_qp_init_attr attr = { 0 };
+
+    attr.cap.max_send_wr = RDMA_SIGNALED_SEND_MAX;
+    attr.cap.max_recv_wr = 1;
+    attr.cap.max_send_sge = 1;
+    attr.cap.max_recv_sge = 1;
+    attr.send_cq = rdma->send_cq;
+    attr.recv_cq = rdma->recv_cq;
+    attr.qp_type = IBV_QPT_RC;
+
+    return rdma_create_qp(cm_id, rdma->pd, &attr);
+}
+
 /* Check whether On-Demand Paging is supported by RDAM device */
 static bool rdma_support_odp(struct ibv_context *dev)
 {
@@ -1985,6 +2029,18 @@ static int qemu_rdma_exchange_recv(RDMAContext *rdma, RDMAControlHeader *head,
     return 0;
 }
 
+/*
+ * Pick the queue pair for a write.  A chunk always goes through the same
+ * one, so that waiting for the chunk to leave transit keeps working.
+ */
+static struct ibv_qp *qemu_rdma_write_qp(RDMAContext *rdma, int index,
+                                         uint64_t chunk)
+{
+    int qp = (index + chunk) % (rdma->nb_data_channels + 1);
+
+    return qp ? rdma->data_channels[qp - 1].cm_id->qp : rdma->qp;
+}
+
 /*
  * Write an actual chunk of memory using RDMA.
  *
@@ -2185,7 +2241,8 @@ retry:
      * ibv_post_send() does not return negative error numbers,
      * per the specification they are positive - no idea why.
      */
-    ret = ibv_post_send(rdma->qp, &send_wr, &bad_wr);
+    ret = ibv_post_send(qemu_rdma_write_qp(rdma, current_index, chunk),
+                        &send_wr, &bad_wr);
 
     if (ret == ENOMEM) {
         trace_qemu_rdma_write_one_queue_full();
@@ -2342,6 +2399,27 @@ static int qemu_rdma_write(RDMAContext *rdma,
     return 0;
 }
 
+/* Must run before the queues and the listening channel they use go away */
+static void qemu_rdma_cleanup_data_channels(RDMAContext *rdma)
+{
+    for (int i = 0; i < rdma->nb_data_channels; i++) {
+        RDMADataChannel *dc = &rdma->data_channels[i];
+
+        rdma_disconnect(dc->cm_id);
+        if (dc->cm_id->qp) {
+            rdma_destroy_qp(dc->cm_id);
+        }
+        rdma_destroy_id(dc->cm_id);
+        if (dc->channel) {
+            rdma_destroy_event_channel(dc->channel);
+        }
+    }
+
+    g_free(rdma->data_channels);
+    rdma->data_channels = NULL;
+    rdma->nb_data_channels = 0;
+}
+
 static void qemu_rdma_cleanup(RDMAContext *rdma)
 {
     Error *err = NULL;
@@ -2365,6 +2443,8 @@ static void qemu_rdma_cleanup(RDMAContext *rdma)
         rdma->connected = false;
     }
 
+    qemu_rdma_cleanup_data_channels(rdma);
+
     if (rdma->channel) {
         qemu_set_fd_handler(rdma->channel->fd, NULL, NULL, NULL);
     }
@@ -2737,6 +2817,79 @@ static RDMAContext *qemu_rdma_data_init(InetSocketAddress *saddr, Error **errp)
     return rdma;
 }
 
+/*
+ * Open one more connection to the destination, on the same device as
+ * the main one, for RDMA writes only.
+ */
+static int qemu_rdma_connect_data_channel(RDMAContext *rdma,
+                                          InetSocketAddress *host_port,
+                                          Error **errp)
+{
+    RDMACapabilities cap = {
+                                .version = RDMA_CONTROL_VERSION_CURRENT,
+                                .flags = RDMA_CAPABILITY_DATA_CHANNEL,
+                           };
+    struct rdma_conn_param conn_param = { .initiator_depth = 2,
+                                          .retry_count = 5,
+                                          .private_data = &cap,
+                                          .private_data_len = sizeof(cap),
+                                        };
+    RDMAContext *resolve = qemu_rdma_data_init(host_port, errp);
+    struct rdma_cm_event *cm_event;
+    RDMADataChannel *dc;
+    int ret = -1;
+
+    if (qemu_rdma_resolve_host(resolve, errp) < 0) {
+        goto out;
+    }
+
+    /* From now on, qemu_rdma_cleanup() takes care of the connection */
+    rdma->data_channels = g_renew(RDMADataChannel, rdma->data_channels,
+                                  rdma->nb_data_channels + 1);
+    dc = &rdma->data_channels[rdma->nb_data_channels++];
+    dc->cm_id = resolve->cm_id;
+    dc->channel = resolve->channel;
+
+    if (resolve->verbs != rdma->verbs) {
+        error_setg(errp, "RDMA ERROR: data channel resolved to another "
+                   "device than the main connection");
+        goto out;
+    }
+
+    if (qemu_rdma_alloc_data_qp(rdma, dc->cm_id) < 0) {
+        error_setg(errp, "RDMA ERROR: error allocating data channel qp!");
+        goto out;
+    }
+
+    caps_to_network(&cap);
+
+    if (rdma_connect(dc->cm_id, &conn_param) < 0) {
+        error_setg_errno(errp, errno,
+                         "RDMA ERROR: connecting data channel to destination!");
+        goto out;
+    }
+
+    /* Destinations that do not know about data channels never accept */
+    if (qemu_get_cm_event_timeout(resolve, &cm_event, 5000, errp) < 0) {
+        goto out;
+    }
+
+    if (cm_event->event != RDMA_CM_EVENT_ESTABLISHED) {
+        error_setg(errp, "RDMA ERROR: connecting data channel to destination!");
+        rdma_ack_cm_event(cm_event);
+        goto out;
+    }
+    rdma_ack_cm_event(cm_event);
+
+    trace_qemu_rdma_connect_data_channel(rdma->nb_data_channels);
+    ret = 0;
+
+out:
+    g_free(resolve->host);
+    g_free(resolve);
+    return ret;
+}
+
 /*
  * QEMUFile interface to the control channel.
  * SEND messages for control only.
@@ -3301,9 +3454,74 @@ int rdma_control_save_page(QEMUFile *f, ram_addr_t block_offset,
 
 static void rdma_accept_incoming_migration(void *opaque);
 
+/*
+ * Accept an extra connection from the source.  Nothing is ever received
+ * on it: the source writes straight into the RAM registered through the
+ * main connection.
+ */
+static void qemu_rdma_accept_data_channel(RDMAContext *rdma,
+                                          struct rdma_cm_event *cm_event)
+{
+    RDMACapabilities cap;
+    struct rdma_conn_param conn_param = {
+                                            .responder_resources = 2,
+                                            .private_data = &cap,
+                                            .private_data_len = sizeof(cap),
+                                         };
+    struct rdma_cm_id *cm_id = cm_event->id;
+
+    memcpy(&cap, cm_event->param.conn.private_data, sizeof(cap));
+    rdma_ack_cm_event(cm_event);
+    network_to_caps(&cap);
+
+    if (!(cap.flags & RDMA_CAPABILITY_DATA_CHANNEL) ||
+        cap.version < 1 || cap.version > RDMA_CONTROL_VERSION_CURRENT ||
+        !rdma->connected || cm_id->verbs != rdma->verbs) {
+        error_report("RDMA ERROR: rejecting unexpected connection request");
+        rdma_reject(cm_id, NULL, 0);
+        rdma_destroy_id(cm_id);
+        return;
+    }
+
+    if (qemu_rdma_alloc_data_qp(rdma, cm_id) < 0) {
+        error_report("RDMA ERROR: error allocating data channel qp!");
+        rdma_reject(cm_id, NULL, 0);
+        rdma_destroy_id(cm_id);
+        return;
+    }
+
+    rdma->data_channels = g_renew(RDMADataChannel, rdma->data_channels,
+                                  rdma->nb_data_channels + 1);
+    rdma->data_channels[rdma->nb_data_channels++] =
+        (RDMADataChannel) { .cm_id = cm_id };
+
+    cap.flags = RDMA_CAPABILITY_DATA_CHANNEL;
+    caps_to_network(&cap);
+
+    if (rdma_accept(cm_id, &conn_param) < 0) {
+        error_report("RDMA ERROR: rdma_accept of data channel failed");
+        return;
+    }
+
+    trace_qemu_rdma_accept_data_channel(rdma->nb_data_channels);
+}
+
+static bool qemu_rdma_is_data_channel(RDMAContext *rdma,
+                                      struct rdma_cm_id *cm_id)
+{
+    for (int i = 0; i < rdma->nb_data_channels; i++) {
+        if (rdma->data_channels[i].cm_id == cm_id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static void rdma_cm_poll_handler(void *opaque)
 {
     RDMAContext *rdma = opaque;
+    RDMAContext *main_rdma = rdma->is_return_path ? rdma->return_path : rdma;
     struct rdma_cm_event *cm_event;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
@@ -3312,6 +3530,17 @@ static void rdma_cm_poll_handler(void *opaque)
         return;
     }
 
+    if (cm_event->event == RDMA_CM_EVENT_CONNECT_REQUEST) {
+        qemu_rdma_accept_data_channel(main_rdma, cm_event);
+        return;
+    }
+
+    /* A broken data channel shows up as failed writes on the source */
+    if (qemu_rdma_is_data_channel(main_rdma, cm_event->id)) {
+        rdma_ack_cm_event(cm_event);
+        return;
+    }
+
     if (cm_event->event == RDMA_CM_EVENT_DISCONNECTED ||
         cm_event->event == RDMA_CM_EVENT_DEVICE_REMOVAL) {
         if (!rdma->errored &&
@@ -4170,6 +4399,14 @@ void rdma_start_outgoing_migration(void *opaque,
         rdma_return_path->is_return_path = true;
     }
 
+    for (int i = 1; i < migrate_rdma_channels(); i++) {
+        ret = qemu_rdma_connect_data_channel(rdma, host_port, errp);
+
+        if (ret < 0) {
+            goto return_path_err;
+        }
+    }
+
     trace_rdma_start_outgoing_migration_after_rdma_connect();
 
     s->to_dst_file = rdma_new_output(rdma);
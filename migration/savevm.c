@@ -38,6 +38,7 @@
 #include "migration/global_state.h"
 #include "migration/channel-block.h"
 #include "ram.h"
+#include "multifd.h"
 #include "qemu-file.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
@@ -216,6 +217,9 @@ typedef struct SaveStateEntry {
     void *opaque;
     CompatEntry *compat;
     int is_ram;
+    /* State sent (or received) in a QEMU_VM_SECTION_PRECOPY section */
+    uint8_t *precopy_data;
+    size_t precopy_len;
 } SaveStateEntry;
 
 typedef struct SaveState {
@@ -890,6 +894,7 @@ int vmstate_register_with_alias_id(VMStateIf *obj, uint32_t instance_id,
 
     /* If this triggers, alias support can be dropped for the vmsd. */
     assert(alias_id == -1 || required_for_version >= vmsd->minimum_version_id);
+    assert(!(vmsd->early_setup && vmsd->precopy));
 
     se = g_new0(SaveStateEntry, 1);
     se->version_id = vmsd->version_id;
@@ -987,7 +992,8 @@ static void save_section_header(QEMUFile *f, SaveStateEntry *se,
     qemu_put_be32(f, se->section_id);
 
     if (section_type == QEMU_VM_SECTION_FULL ||
-        section_type == QEMU_VM_SECTION_START) {
+        section_type == QEMU_VM_SECTION_START ||
+        section_type == QEMU_VM_SECTION_PRECOPY) {
         /* ID string */
         size_t len = strlen(se->idstr);
         qemu_put_byte(f, len);
@@ -1049,6 +1055,106 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc,
     }
     return 0;
 }
+
+static QIOChannelBuffer *vmstate_save_to_buffer(SaveStateEntry *se,
+                                                JSONWriter *vmdesc,
+                                                Error **errp)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(4096);
+    QEMUFile *fb;
+    int ret;
+
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-precopy-buffer");
+    fb = qemu_file_new_output(QIO_CHANNEL(bioc));
+    if (vmdesc) {
+        json_writer_start_object(vmdesc, NULL);
+        json_writer_str(vmdesc, "name", se->idstr);
+        json_writer_int64(vmdesc, "instance_id", se->instance_id);
+    }
+    ret = vmstate_save_state_with_err(fb, se->vmsd, se->opaque, vmdesc, errp);
+    if (vmdesc) {
+        json_writer_end_object(vmdesc);
+    }
+    if (qemu_fclose(fb) < 0 && !ret) {
+        error_setg(errp, "Failed to buffer the state of '%s'", se->idstr);
+        ret = -EIO;
+    }
+    if (ret) {
+        object_unref(OBJECT(bioc));
+        return NULL;
+    }
+
+    return bioc;
+}
+
+/*
+ * Send the state of a device with a precopy VMSD during setup, and
+ * keep a copy to tell at switchover whether it changed.
+ */
+static int vmstate_save_precopy(QEMUFile *f, SaveStateEntry *se,
+                                Error **errp)
+{
+    QIOChannelBuffer *bioc;
+
+    if (!vmstate_section_needed(se->vmsd, se->opaque)) {
+        trace_savevm_section_skip(se->idstr, se->section_id);
+        return 0;
+    }
+
+    bioc = vmstate_save_to_buffer(se, NULL, errp);
+    if (!bioc) {
+        return -EINVAL;
+    }
+
+    trace_savevm_section_start(se->idstr, se->section_id);
+    save_section_header(f, se, QEMU_VM_SECTION_PRECOPY);
+    qemu_put_be32(f, bioc->usage);
+    qemu_put_buffer(f, bioc->data, bioc->usage);
+    trace_savevm_section_end(se->idstr, se->section_id, 0);
+    save_section_footer(f, se);
+
+    se->precopy_len = bioc->usage;
+    se->precopy_data = g_steal_pointer(&bioc->data);
+    object_unref(OBJECT(bioc));
+    return 0;
+}
+
+/*
+ * Save a device whose state was sent during setup: only tell the
+ * destination to load its copy if the state did not change since.
+ * The description in @vmdesc is that of the state at switchover,
+ * which is the one the destination loads either way.
+ */
+static int vmstate_save_precopied(QEMUFile *f, SaveStateEntry *se,
+                                  JSONWriter *vmdesc, Error **errp)
+{
+    g_autofree uint8_t *data = g_steal_pointer(&se->precopy_data);
+    QIOChannelBuffer *bioc;
+
+    if (!vmstate_section_needed(se->vmsd, se->opaque)) {
+        trace_savevm_section_skip(se->idstr, se->section_id);
+        return 0;
+    }
+
+    bioc = vmstate_save_to_buffer(se, vmdesc, errp);
+    if (!bioc) {
+        return -EINVAL;
+    }
+
+    trace_savevm_section_start(se->idstr, se->section_id);
+    if (bioc->usage == se->precopy_len &&
+        !memcmp(bioc->data, data, bioc->usage)) {
+        save_section_header(f, se, QEMU_VM_SECTION_UNCHANGED);
+    } else {
+        save_section_header(f, se, QEMU_VM_SECTION_FULL);
+        qemu_put_buffer(f, bioc->data, bioc->usage);
+    }
+    trace_savevm_section_end(se->idstr, se->section_id, 0);
+    save_section_footer(f, se);
+
+    object_unref(OBJECT(bioc));
+    return 0;
+}
 /**
  * qemu_savevm_command_send: Send a 'QEMU_VM_COMMAND' type element with the
  *                           command and associated data.
@@ -1333,6 +1439,16 @@ int qemu_savevm_state_setup(QEMUFile *f, Error **errp)
             continue;
         }
 
+        if (se->vmsd && se->vmsd->precopy && migrate_device_state_precopy()) {
+            ret = vmstate_save_precopy(f, se, errp);
+            if (ret) {
+                migrate_set_error(ms, *errp);
+                qemu_file_set_error(f, ret);
+                break;
+            }
+            continue;
+        }
+
         if (!se->ops || !se->ops->save_setup) {
             continue;
         }
@@ -1489,13 +1605,101 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
     qemu_fflush(f);
 }
 
+typedef struct SaveCompletePrecopyThread {
+    SaveStateEntry *se;
+    bool *abort_flag;
+    QemuThread thread;
+    int ret;
+} SaveCompletePrecopyThread;
+
+static void *qemu_savevm_complete_precopy_thread(void *opaque)
+{
+    SaveCompletePrecopyThread *t = opaque;
+    SaveStateEntry *se = t->se;
+
+    t->ret = se->ops->save_live_complete_precopy_thread(se->idstr,
+                                                        se->instance_id,
+                                                        t->abort_flag,
+                                                        se->opaque);
+    return NULL;
+}
+
+/*
+ * Start the @save_live_complete_precopy_thread handlers, so that device
+ * state goes out over the multifd channels while the main channel is
+ * busy with the other devices.
+ */
+static GSList *qemu_savevm_start_complete_precopy_threads(bool in_postcopy,
+                                                          bool *abort_flag)
+{
+    GSList *threads = NULL;
+    SaveStateEntry *se;
+
+    if (!multifd_device_state_supported()) {
+        return NULL;
+    }
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        SaveCompletePrecopyThread *t;
+
+        if (!se->ops ||
+            (in_postcopy && se->ops->has_postcopy &&
+             se->ops->has_postcopy(se->opaque)) ||
+            !se->ops->save_live_complete_precopy_thread) {
+            continue;
+        }
+
+        if (se->ops->is_active && !se->ops->is_active(se->opaque)) {
+            continue;
+        }
+
+        t = g_new0(SaveCompletePrecopyThread, 1);
+        t->se = se;
+        t->abort_flag = abort_flag;
+        qemu_thread_create(&t->thread, "mig/src/devstate",
+                           qemu_savevm_complete_precopy_thread, t,
+                           QEMU_THREAD_JOINABLE);
+        threads = g_slist_prepend(threads, t);
+    }
+
+    return threads;
+}
+
+/* Returns the first error of any of the @threads, or zero */
+static int qemu_savevm_join_complete_precopy_threads(GSList *threads)
+{
+    int ret = 0;
+    GSList *l;
+
+    for (l = threads; l; l = l->next) {
+        SaveCompletePrecopyThread *t = l->data;
+
+        qemu_thread_join(&t->thread);
+        if (t->ret < 0 && !ret) {
+            ret = t->ret;
+        }
+    }
+    g_slist_free_full(threads, g_free);
+
+    return ret;
+}
+
 static
 int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
 {
+    MigrationDowntimeStats *stats = &migrate_get_current()->downtime_stats;
+    int64_t start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     int64_t start_ts_each, end_ts_each;
     SaveStateEntry *se;
+    bool abort_threads = false;
+    GSList *threads;
+    bool have_threads;
     int ret;
 
+    threads = qemu_savevm_start_complete_precopy_threads(in_postcopy,
+                                                         &abort_threads);
+    have_threads = threads != NULL;
+
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
         if (!se->ops ||
             (in_postcopy && se->ops->has_postcopy &&
@@ -1519,14 +1723,35 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         trace_savevm_section_end(se->idstr, se->section_id, ret);
         save_section_footer(f, se);
         if (ret < 0) {
+            qatomic_set(&abort_threads, true);
+            qemu_savevm_join_complete_precopy_threads(threads);
             qemu_file_set_error(f, ret);
             return -1;
         }
         end_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         trace_vmstate_downtime_save("iterable", se->idstr, se->instance_id,
                                     end_ts_each - start_ts_each);
+        migration_downtime_add_device(stats, se->idstr, se->instance_id,
+                                      end_ts_each - start_ts_each);
+    }
+
+    ret = qemu_savevm_join_complete_precopy_threads(threads);
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+        return -1;
+    }
+
+    /*
+     * RAM did its final multifd sync before the threads were done, so the
+     * device state they queued may still sit in the channels: make sure it
+     * is on the wire before the channels are shut down.
+     */
+    if (have_threads && multifd_send_sync_main() < 0) {
+        qemu_file_set_error(f, -EIO);
+        return -1;
     }
 
+    stats->iterable_save = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_ts;
     trace_vmstate_downtime_checkpoint("src-iterable-saved");
 
     return 0;
@@ -1537,6 +1762,7 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool inactivate_disks)
 {
     MigrationState *ms = migrate_get_current();
+    int64_t start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     int64_t start_ts_each, end_ts_each;
     JSONWriter *vmdesc = ms->vmdesc;
     int vmdesc_len;
@@ -1552,7 +1778,11 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
 
         start_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
-        ret = vmstate_save(f, se, vmdesc, &local_err);
+        if (se->precopy_data) {
+            ret = vmstate_save_precopied(f, se, vmdesc, &local_err);
+        } else {
+            ret = vmstate_save(f, se, vmdesc, &local_err);
+        }
         if (ret) {
             migrate_set_error(ms, local_err);
             error_report_err(local_err);
@@ -1563,6 +1793,9 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         end_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         trace_vmstate_downtime_save("non-iterable", se->idstr, se->instance_id,
                                     end_ts_each - start_ts_each);
+        migration_downtime_add_device(&ms->downtime_stats, se->idstr,
+                                      se->instance_id,
+                                      end_ts_each - start_ts_each);
     }
 
     if (inactivate_disks) {
@@ -1597,6 +1830,8 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     json_writer_free(vmdesc);
     ms->vmdesc = NULL;
 
+    ms->downtime_stats.non_iterable_save =
+        qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_ts;
     trace_vmstate_downtime_checkpoint("src-non-iterable-saved");
 
     return 0;
@@ -1698,6 +1933,7 @@ void qemu_savevm_state_cleanup(void)
         if (se->ops && se->ops->save_cleanup) {
             se->ops->save_cleanup(se->opaque);
         }
+        g_clear_pointer(&se->precopy_data, g_free);
     }
 }
 
@@ -2577,6 +2813,38 @@ static bool check_section_footer(QEMUFile *f, SaveStateEntry *se)
     return true;
 }
 
+/* Keep the state of a QEMU_VM_SECTION_PRECOPY section for switchover */
+static int qemu_loadvm_precopy_receive(QEMUFile *f, SaveStateEntry *se)
+{
+    uint32_t len;
+    int ret;
+
+    if (!se->vmsd) {
+        error_report("savevm: section '%s' cannot be sent early", se->idstr);
+        return -EINVAL;
+    }
+
+    len = qemu_get_be32(f);
+    g_free(se->precopy_data);
+    se->precopy_data = g_try_malloc(len);
+    if (len && !se->precopy_data) {
+        error_report("savevm: no memory for the %" PRIu32 " bytes of state "
+                     "of '%s'", len, se->idstr);
+        return -ENOMEM;
+    }
+    se->precopy_len = len;
+
+    ret = qemu_get_buffer(f, se->precopy_data, len);
+    if (ret != len) {
+        g_clear_pointer(&se->precopy_data, g_free);
+        error_report("savevm: failed to receive the state of '%s'",
+                     se->idstr);
+        return ret < 0 ? ret : -EIO;
+    }
+
+    return 0;
+}
+
 static int
 qemu_loadvm_section_start_full(QEMUFile *f, uint8_t type)
 {
@@ -2631,6 +2899,17 @@ qemu_loadvm_section_start_full(QEMUFile *f, uint8_t type)
         return -EINVAL;
     }
 
+    if (type == QEMU_VM_SECTION_PRECOPY) {
+        ret = qemu_loadvm_precopy_receive(f, se);
+        if (ret < 0) {
+            return ret;
+        }
+        return check_section_footer(f, se) ? 0 : -EINVAL;
+    }
+
+    /* Newer state replaces what was received during setup */
+    g_clear_pointer(&se->precopy_data, g_free);
+
     if (trace_downtime) {
         start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     }
@@ -2643,9 +2922,15 @@ qemu_loadvm_section_start_full(QEMUFile *f, uint8_t type)
     }
 
     if (trace_downtime) {
+        MigrationDowntimeStats *stats =
+            &migration_incoming_get_current()->downtime_stats;
+
         end_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         trace_vmstate_downtime_load("non-iterable", se->idstr,
                                     se->instance_id, end_ts - start_ts);
+        stats->device_load += end_ts - start_ts;
+        migration_downtime_add_device(stats, se->idstr, se->instance_id,
+                                      end_ts - start_ts);
     }
 
     if (!check_section_footer(f, se)) {
@@ -2699,8 +2984,75 @@ qemu_loadvm_section_part_end(QEMUFile *f, uint8_t type)
         end_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         trace_vmstate_downtime_load("iterable", se->idstr,
                                     se->instance_id, end_ts - start_ts);
+        migration_downtime_add_device(
+            &migration_incoming_get_current()->downtime_stats,
+            se->idstr, se->instance_id, end_ts - start_ts);
+    }
+
+    if (!check_section_footer(f, se)) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Load the state received in a QEMU_VM_SECTION_PRECOPY section */
+static int qemu_loadvm_section_unchanged(QEMUFile *f)
+{
+    MigrationDowntimeStats *stats =
+        &migration_incoming_get_current()->downtime_stats;
+    int64_t start_ts, end_ts;
+    QIOChannelBuffer *bioc;
+    uint32_t section_id;
+    SaveStateEntry *se;
+    QEMUFile *packf;
+    int ret;
+
+    section_id = qemu_get_be32(f);
+
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        error_report("%s: Failed to read section ID: %d",
+                     __func__, ret);
+        return ret;
     }
 
+    trace_qemu_loadvm_state_section_unchanged(section_id);
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se->load_section_id == section_id && se->precopy_data) {
+            break;
+        }
+    }
+    if (se == NULL) {
+        error_report("No state received early for savevm section %d",
+                     section_id);
+        return -EINVAL;
+    }
+
+    start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
+    bioc = qio_channel_buffer_new(0);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-precopy-buffer");
+    bioc->data = g_steal_pointer(&se->precopy_data);
+    bioc->capacity = bioc->usage = se->precopy_len;
+    packf = qemu_file_new_input(QIO_CHANNEL(bioc));
+
+    ret = vmstate_load(packf, se);
+    qemu_fclose(packf);
+    object_unref(OBJECT(bioc));
+    if (ret < 0) {
+        error_report("error while loading state for instance 0x%"PRIx32" of"
+                     " device '%s'", se->instance_id, se->idstr);
+        return ret;
+    }
+
+    end_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    trace_vmstate_downtime_load("non-iterable", se->idstr,
+                                se->instance_id, end_ts - start_ts);
+    stats->device_load += end_ts - start_ts;
+    migration_downtime_add_device(stats, se->idstr, se->instance_id,
+                                  end_ts - start_ts);
+
     if (!check_section_footer(f, se)) {
         return -EINVAL;
     }
@@ -2797,6 +3149,7 @@ void qemu_loadvm_state_cleanup(void)
         if (se->ops && se->ops->load_cleanup) {
             se->ops->load_cleanup(se->opaque);
         }
+        g_clear_pointer(&se->precopy_data, g_free);
     }
 }
 
@@ -2889,11 +3242,18 @@ retry:
         switch (section_type) {
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
+        case QEMU_VM_SECTION_PRECOPY:
             ret = qemu_loadvm_section_start_full(f, section_type);
             if (ret < 0) {
                 goto out;
             }
             break;
+        case QEMU_VM_SECTION_UNCHANGED:
+            ret = qemu_loadvm_section_unchanged(f);
+            if (ret < 0) {
+                goto out;
+            }
+            break;
         case QEMU_VM_SECTION_PART:
         case QEMU_VM_SECTION_END:
             ret = qemu_loadvm_section_part_end(f, section_type);
@@ -2962,6 +3322,8 @@ int qemu_loadvm_state(QEMUFile *f)
         return ret;
     }
 
+    memset(&mis->downtime_stats, 0, sizeof(mis->downtime_stats));
+
     if (qemu_loadvm_state_setup(f, &local_err) != 0) {
         error_report_err(local_err);
         return -EINVAL;
@@ -3064,6 +3426,32 @@ int qemu_loadvm_approve_switchover(void)
     return migrate_send_rp_switchover_ack(mis);
 }
 
+/*
+ * Called from a multifd receive thread, without the BQL, for every
+ * device state buffer queued with multifd_queue_device_state() on the
+ * source.
+ */
+int qemu_loadvm_load_state_buffer(const char *idstr, uint32_t instance_id,
+                                  char *buf, size_t len, Error **errp)
+{
+    SaveStateEntry *se;
+
+    se = find_se(idstr, instance_id);
+    if (!se) {
+        error_setg(errp, "Unknown idstr %s or instance id %u for "
+                   "load state buffer", idstr, instance_id);
+        return -1;
+    }
+
+    if (!se->ops || !se->ops->load_state_buffer) {
+        error_setg(errp, "idstr %s / instance %u has no load state buffer "
+                   "operation", idstr, instance_id);
+        return -1;
+    }
+
+    return se->ops->load_state_buffer(se->opaque, buf, len, errp);
+}
+
 bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
                   bool has_devices, strList *devices, Error **errp)
 {
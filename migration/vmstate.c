@@ -18,6 +18,7 @@
 #include "qapi/qmp/json-writer.h"
 #include "qemu-file.h"
 #include "qemu/bitops.h"
+#include "qemu/bswap.h"
 #include "qemu/error-report.h"
 #include "trace.h"
 
@@ -100,6 +101,151 @@ static void vmstate_handle_alloc(void *ptr, const VMStateField *field,
     }
 }
 
+/*
+ * Plain integer fields have no hooks of their own, and go on the wire as
+ * their big endian value.  Runs of them are converted through a buffer,
+ * with one call into QEMUFile per buffer instead of one per element.
+ */
+#define VMSTATE_PLAIN_BUF_SIZE 1024
+
+/* Returns the element size of a plain field, 0 if it is not one */
+static size_t vmstate_plain_size(const VMStateField *field)
+{
+    const VMStateInfo *info = field->info;
+    size_t size;
+
+    if (field->flags & ~(VMS_SINGLE | VMS_ARRAY | VMS_MUST_EXIST)) {
+        return 0;
+    }
+
+    if (info == &vmstate_info_bool || info == &vmstate_info_int8 ||
+        info == &vmstate_info_uint8) {
+        size = 1;
+    } else if (info == &vmstate_info_int16 || info == &vmstate_info_uint16) {
+        size = 2;
+    } else if (info == &vmstate_info_int32 || info == &vmstate_info_uint32) {
+        size = 4;
+    } else if (info == &vmstate_info_int64 || info == &vmstate_info_uint64) {
+        size = 8;
+    } else {
+        return 0;
+    }
+
+    return field->size == size ? size : 0;
+}
+
+static void vmstate_plain_to_be(uint8_t *dst, const uint8_t *src,
+                                size_t size, int n)
+{
+    int i;
+
+    switch (size) {
+    case 1:
+        memcpy(dst, src, n);
+        break;
+    case 2:
+        for (i = 0; i < n; i++) {
+            stw_be_p(dst + i * 2, lduw_he_p(src + i * 2));
+        }
+        break;
+    case 4:
+        for (i = 0; i < n; i++) {
+            stl_be_p(dst + i * 4, ldl_he_p(src + i * 4));
+        }
+        break;
+    case 8:
+        for (i = 0; i < n; i++) {
+            stq_be_p(dst + i * 8, ldq_he_p(src + i * 8));
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void vmstate_plain_from_be(uint8_t *dst, const uint8_t *src,
+                                  size_t size, int n, bool is_bool)
+{
+    int i;
+
+    switch (size) {
+    case 1:
+        if (is_bool) {
+            for (i = 0; i < n; i++) {
+                ((bool *)dst)[i] = src[i];
+            }
+        } else {
+            memcpy(dst, src, n);
+        }
+        break;
+    case 2:
+        for (i = 0; i < n; i++) {
+            stw_he_p(dst + i * 2, lduw_be_p(src + i * 2));
+        }
+        break;
+    case 4:
+        for (i = 0; i < n; i++) {
+            stl_he_p(dst + i * 4, ldl_be_p(src + i * 4));
+        }
+        break;
+    case 8:
+        for (i = 0; i < n; i++) {
+            stq_he_p(dst + i * 8, ldq_be_p(src + i * 8));
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * Load the run of plain fields starting at *@pfield, and leave *@pfield
+ * on the first field after it.
+ */
+static int vmstate_load_plain_run(QEMUFile *f, const VMStateDescription *vmsd,
+                                  const VMStateField **pfield, void *opaque,
+                                  int version_id)
+{
+    const VMStateField *field;
+    uint8_t buf[VMSTATE_PLAIN_BUF_SIZE];
+    size_t size;
+
+    for (field = *pfield; field->name && (size = vmstate_plain_size(field));
+         field++) {
+        bool exists = vmstate_field_exists(vmsd, field, opaque, version_id);
+        int done, n, n_elems;
+        int ret;
+
+        trace_vmstate_load_state_field(vmsd->name, field->name, exists);
+        if (!exists) {
+            if (field->flags & VMS_MUST_EXIST) {
+                error_report("Input validation failed: %s/%s",
+                             vmsd->name, field->name);
+                return -1;
+            }
+            continue;
+        }
+
+        n_elems = vmstate_n_elems(opaque, field);
+        for (done = 0; done < n_elems; done += n) {
+            n = MIN(n_elems - done, sizeof(buf) / size);
+            qemu_get_buffer(f, buf, n * size);
+            ret = qemu_file_get_error(f);
+            if (ret < 0) {
+                error_report("Failed to load %s:%s", vmsd->name,
+                             field->name);
+                trace_vmstate_load_field_error(field->name, ret);
+                return ret;
+            }
+            vmstate_plain_from_be(opaque + field->offset + done * size, buf,
+                                  size, n, field->info == &vmstate_info_bool);
+        }
+    }
+
+    *pfield = field;
+    return 0;
+}
+
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id)
 {
@@ -128,7 +274,17 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
         }
     }
     while (field->name) {
-        bool exists = vmstate_field_exists(vmsd, field, opaque, version_id);
+        bool exists;
+
+        if (vmstate_plain_size(field)) {
+            ret = vmstate_load_plain_run(f, vmsd, &field, opaque, version_id);
+            if (ret < 0) {
+                return ret;
+            }
+            continue;
+        }
+
+        exists = vmstate_field_exists(vmsd, field, opaque, version_id);
         trace_vmstate_load_state_field(vmsd->name, field->name, exists);
         if (exists) {
             void *first_elem = opaque + field->offset;
@@ -326,6 +482,77 @@ static void vmsd_desc_field_end(const VMStateDescription *vmsd,
 }
 
 
+/*
+ * Save the run of plain fields starting at *@pfield, describing every
+ * field in @vmdesc just like vmstate_save_state_v() does, and leave
+ * *@pfield on the first field after it.
+ */
+static int vmstate_save_plain_run(QEMUFile *f, const VMStateDescription *vmsd,
+                                  const VMStateField **pfield, void *opaque,
+                                  JSONWriter *vmdesc, int version_id,
+                                  Error **errp)
+{
+    const VMStateField *field;
+    uint8_t buf[VMSTATE_PLAIN_BUF_SIZE];
+    size_t size, used = 0;
+    int ret;
+
+    for (field = *pfield; field->name && (size = vmstate_plain_size(field));
+         field++) {
+        int i, n, n_elems;
+
+        if (!vmstate_field_exists(vmsd, field, opaque, version_id)) {
+            if (field->flags & VMS_MUST_EXIST) {
+                error_report("Output state validation failed: %s/%s",
+                        vmsd->name, field->name);
+                assert(!(field->flags & VMS_MUST_EXIST));
+            }
+            continue;
+        }
+
+        n_elems = vmstate_n_elems(opaque, field);
+        trace_vmstate_save_state_loop(vmsd->name, field->name, n_elems);
+
+        for (i = 0; vmdesc && i < n_elems; i++) {
+            vmsd_desc_field_start(vmsd, vmdesc, field, i, n_elems);
+            vmsd_desc_field_end(vmsd, vmdesc, field, size, i);
+            /* Compressed arrays only care about the first element */
+            if (vmsd_can_compress(field)) {
+                break;
+            }
+        }
+
+        for (i = 0; i < n_elems; i += n) {
+            n = MIN(n_elems - i, (sizeof(buf) - used) / size);
+            if (!n) {
+                qemu_put_buffer(f, buf, used);
+                ret = qemu_file_get_error(f);
+                if (ret < 0) {
+                    error_setg(errp, "Save of field %s/%s failed",
+                               vmsd->name, field->name);
+                    return ret;
+                }
+                used = 0;
+                continue;
+            }
+            vmstate_plain_to_be(buf + used, opaque + field->offset + i * size,
+                                size, n);
+            used += n * size;
+        }
+    }
+
+    qemu_put_buffer(f, buf, used);
+    ret = qemu_file_get_error(f);
+    if (ret < 0) {
+        error_setg(errp, "Save of field %s/%s failed", vmsd->name,
+                   field[-1].name);
+        return ret;
+    }
+
+    *pfield = field;
+    return 0;
+}
+
 bool vmstate_section_needed(const VMStateDescription *vmsd, void *opaque)
 {
     if (vmsd->needed && !vmsd->needed(opaque)) {
@@ -372,6 +599,18 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
     }
 
     while (field->name) {
+        if (vmstate_plain_size(field)) {
+            ret = vmstate_save_plain_run(f, vmsd, &field, opaque, vmdesc,
+                                         version_id, errp);
+            if (ret) {
+                if (vmsd->post_save) {
+                    vmsd->post_save(opaque);
+                }
+                return ret;
+            }
+            continue;
+        }
+
         if (vmstate_field_exists(vmsd, field, opaque, version_id)) {
             void *first_elem = opaque + field->offset;
             int i, n_elems = vmstate_n_elems(opaque, field);
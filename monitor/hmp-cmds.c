@@ -202,6 +202,7 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        monitor_printf(mon, "  poll-ns=%" PRId64 "\n", value->poll_ns);
     }
 
     qapi_free_IOThreadInfoList(info_list);
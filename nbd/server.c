@@ -28,6 +28,7 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -83,8 +84,22 @@ struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
     bool complete;
+    ssize_t zero_copy_seq; /* data in use until this zero copy send is done */
 };
 
+/*
+ * Read replies smaller than this are copied into the socket, MSG_ZEROCOPY only
+ * pays off for large sends.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (64 * KiB)
+
+/* A buffer sent with MSG_ZEROCOPY that the kernel may still be reading from */
+typedef struct NBDZeroCopyBuffer {
+    void *data;
+    ssize_t seq;
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuffer) next;
+} NBDZeroCopyBuffer;
+
 struct NBDExport {
     BlockExport common;
 
@@ -99,8 +114,13 @@ struct NBDExport {
     Notifier eject_notifier;
 
     bool allocation_depth;
+    bool zero_copy;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* Optional IOThreads that client connections are spread across */
+    BlockExportIOThreads iothreads;
+    size_t next_iothread; /* main loop thread only */
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -135,11 +155,21 @@ struct NBDClient {
     QIOChannelSocket *sioc; /* The underlying data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
 
+    /*
+     * AioContext in which requests are processed after negotiation, or NULL
+     * to use the export's AioContext
+     */
+    AioContext *ctx;
+
     Coroutine *recv_coroutine; /* protected by lock */
 
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    /* Read data may be sent with MSG_ZEROCOPY, set after negotiation */
+    bool zero_copy;
+    QSIMPLEQ_HEAD(, NBDZeroCopyBuffer) zero_copy_bufs; /* protected by lock */
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -159,6 +189,11 @@ struct NBDClient {
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return client->ctx ?: client->exp->common.ctx;
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -1546,6 +1581,37 @@ static int coroutine_fn nbd_receive_request(NBDClient *client, NBDRequest *reque
 
 #define MAX_NBD_REQUESTS 16
 
+/*
+ * Free the buffers of completed zero copy sends, or all of them if @all is
+ * true. Once the connection is gone, the kernel holds its own references to
+ * any pages that are still queued, so freeing our mapping is safe.
+ *
+ * Runs in the client AioContext with client->lock held, or in the main loop
+ * thread when the client is freed.
+ */
+static void nbd_client_free_zero_copy_bufs(NBDClient *client, bool all)
+{
+    NBDZeroCopyBuffer *buf;
+
+    if (QSIMPLEQ_EMPTY(&client->zero_copy_bufs)) {
+        return;
+    }
+
+    if (!all && qio_channel_socket_zero_copy_poll(client->sioc, NULL) < 0) {
+        /* The connection is broken, the buffers are freed with the client */
+        return;
+    }
+
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs))) {
+        if (!all && buf->seq > client->sioc->zero_copy_sent) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+        qemu_vfree(buf->data);
+        g_free(buf);
+    }
+}
+
 /* Runs in export AioContext and main loop thread */
 void nbd_client_get(NBDClient *client)
 {
@@ -1573,6 +1639,7 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->contexts.bitmaps);
+        nbd_client_free_zero_copy_bufs(client, true);
         qemu_mutex_destroy(&client->lock);
         g_free(client);
     }
@@ -1645,11 +1712,20 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
+    if (req->data && req->zero_copy_seq) {
+        NBDZeroCopyBuffer *buf = g_new(NBDZeroCopyBuffer, 1);
+
+        /* Sends complete in order, so the queue stays sorted by seq */
+        buf->data = req->data;
+        buf->seq = req->zero_copy_seq;
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_bufs, buf, next);
+    } else if (req->data) {
         qemu_vfree(req->data);
     }
     g_free(req);
 
+    nbd_client_free_zero_copy_bufs(client, false);
+
     client->nb_requests--;
 
     if (client->quiescing && client->nb_requests == 0) {
@@ -1745,7 +1821,7 @@ static bool nbd_drained_poll(void *opaque)
                  * qio_channel_yield().
                  */
                 if (client->recv_coroutine != NULL && client->read_yielding) {
-                    aio_bh_schedule_oneshot(nbd_export_aio_context(client->exp),
+                    aio_bh_schedule_oneshot(nbd_client_aio_context(client),
                                             nbd_wake_read_bh, client);
                 }
 
@@ -1836,6 +1912,11 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         return ret;
     }
 
+    if (arg->has_iothreads &&
+        !blk_exp_iothreads_init(&exp->iothreads, arg->iothreads, errp)) {
+        return -EINVAL;
+    }
+
     QTAILQ_INIT(&exp->clients);
     exp->name = g_strdup(name);
     exp->description = g_strdup(arg->description);
@@ -1923,6 +2004,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1946,6 +2028,7 @@ fail:
     g_free(exp->export_bitmaps);
     g_free(exp->name);
     g_free(exp->description);
+    blk_exp_iothreads_cleanup(&exp->iothreads);
     return ret;
 }
 
@@ -2013,6 +2096,8 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    blk_exp_iothreads_cleanup(&exp->iothreads);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -2040,6 +2125,38 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Send the reply header in @iov normally, followed by @data with MSG_ZEROCOPY.
+ * @req must not free the buffer behind @data before the send has completed.
+ */
+static int coroutine_fn nbd_co_send_iov_zero_copy(NBDClient *client,
+                                                  struct iovec *iov,
+                                                  unsigned niov,
+                                                  struct iovec *data,
+                                                  NBDRequestData *req,
+                                                  Error **errp)
+{
+    int ret;
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    ret = qio_channel_writev_all(client->ioc, iov, niov, errp);
+    if (ret == 0) {
+        ret = qio_channel_writev_full_all(client->ioc, data, 1, NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+        req->zero_copy_seq = client->sioc->zero_copy_queued;
+    }
+    ret = ret < 0 ? -EIO : 0;
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2132,6 +2249,7 @@ static int coroutine_fn nbd_co_send_chunk_done(NBDClient *client,
 
 static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                                                NBDRequest *request,
+                                               NBDRequestData *req,
                                                uint64_t offset,
                                                void *data,
                                                uint64_t size,
@@ -2152,6 +2270,9 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
+    if (client->zero_copy && size >= NBD_ZERO_COPY_MIN_SIZE) {
+        return nbd_co_send_iov_zero_copy(client, iov, 2, &iov[2], req, errp);
+    }
     return nbd_co_send_iov(client, iov, 3, errp);
 }
 
@@ -2187,6 +2308,7 @@ static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
  */
 static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                                                 NBDRequest *request,
+                                                NBDRequestData *req,
                                                 uint64_t offset,
                                                 uint8_t *data,
                                                 uint64_t size,
@@ -2238,8 +2360,9 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                 error_setg_errno(errp, -ret, "reading from file failed");
                 break;
             }
-            ret = nbd_co_send_chunk_read(client, request, offset + progress,
-                                         data + progress, pnum, final, errp);
+            ret = nbd_co_send_chunk_read(client, request, req,
+                                         offset + progress, data + progress,
+                                         pnum, final, errp);
         }
 
         if (ret < 0) {
@@ -2834,10 +2957,11 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
  * Return -errno if sending fails. Other errors are reported directly to the
  * client as an error reply. */
 static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
-                                        uint8_t *data, Error **errp)
+                                        NBDRequestData *req, Error **errp)
 {
     int ret;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
 
     assert(request->type == NBD_CMD_READ);
     assert(request->len <= NBD_MAX_BUFFER_SIZE);
@@ -2854,7 +2978,7 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
     if (client->mode >= NBD_MODE_STRUCTURED &&
         !(request->flags & NBD_CMD_FLAG_DF) && request->len)
     {
-        return nbd_co_send_sparse_read(client, request, request->from,
+        return nbd_co_send_sparse_read(client, request, req, request->from,
                                        data, request->len, errp);
     }
 
@@ -2866,8 +2990,8 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
 
     if (client->mode >= NBD_MODE_STRUCTURED) {
         if (request->len) {
-            return nbd_co_send_chunk_read(client, request, request->from, data,
-                                          request->len, true, errp);
+            return nbd_co_send_chunk_read(client, request, req, request->from,
+                                          data, request->len, true, errp);
         } else {
             return nbd_co_send_chunk_done(client, request, errp);
         }
@@ -2905,11 +3029,12 @@ static coroutine_fn int nbd_do_cmd_cache(NBDClient *client, NBDRequest *request,
  * client as an error reply. */
 static coroutine_fn int nbd_handle_request(NBDClient *client,
                                            NBDRequest *request,
-                                           uint8_t *data, Error **errp)
+                                           NBDRequestData *req, Error **errp)
 {
     int ret;
     int flags;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
     char *msg;
     size_t i;
 
@@ -2918,7 +3043,7 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         return nbd_do_cmd_cache(client, request, errp);
 
     case NBD_CMD_READ:
-        return nbd_do_cmd_read(client, request, data, errp);
+        return nbd_do_cmd_read(client, request, req, errp);
 
     case NBD_CMD_WRITE:
         flags = 0;
@@ -3120,7 +3245,7 @@ static coroutine_fn void nbd_trip(void *opaque)
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
-        ret = nbd_handle_request(client, &request, req->data, &local_err);
+        ret = nbd_handle_request(client, &request, req, &local_err);
     }
     if (request.contexts && request.contexts != &client->contexts) {
         assert(request.type == NBD_CMD_BLOCK_STATUS);
@@ -3182,7 +3307,7 @@ static void nbd_client_receive_next_request(NBDClient *client)
         nbd_client_get(client);
         req = nbd_request_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, req);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client), client->recv_coroutine);
     }
 }
 
@@ -3228,6 +3353,22 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
     }
 
     timer_free(handshake_timer);
+
+    /* TLS channels can't send from user memory directly */
+    if (client->exp->zero_copy && client->ioc == QIO_CHANNEL(client->sioc)) {
+        client->zero_copy = qio_channel_socket_enable_zero_copy(client->sioc);
+    }
+
+    /* Spread the connections of multi-conn clients across the IOThreads */
+    if (client->exp->iothreads.num_iothreads) {
+        NBDExport *exp = client->exp;
+        IOThread *iothread = exp->iothreads.iothreads[exp->next_iothread];
+
+        exp->next_iothread = (exp->next_iothread + 1) %
+                             exp->iothreads.num_iothreads;
+        client->ctx = iothread_get_aio_context(iothread);
+    }
+
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
@@ -3251,6 +3392,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
 
     client = g_new0(NBDClient, 1);
     qemu_mutex_init(&client->lock);
+    QSIMPLEQ_INIT(&client->zero_copy_bufs);
     client->refcount = 1;
     client->tlscreds = tlscreds;
     if (tlscreds) {
@@ -23,6 +23,7 @@
 #include "net/net.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
@@ -59,13 +60,24 @@ typedef struct AFXDPState {
 static void af_xdp_send(void *opaque);
 static void af_xdp_writable(void *opaque);
 
+static void af_xdp_set_fd_handler(AFXDPState *s, AioContext *ctx,
+                                  IOHandler *fd_read, IOHandler *fd_write)
+{
+    int fd = xsk_socket__fd(s->xsk);
+
+    if (ctx) {
+        aio_set_fd_handler(ctx, fd, fd_read, fd_write, NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(fd, fd_read, fd_write, s);
+    }
+}
+
 /* Set the event-loop handlers for the af-xdp backend. */
 static void af_xdp_update_fd_handler(AFXDPState *s)
 {
-    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
-                        s->read_poll ? af_xdp_send : NULL,
-                        s->write_poll ? af_xdp_writable : NULL,
-                        s);
+    af_xdp_set_fd_handler(s, s->nc.ctx,
+                          s->read_poll ? af_xdp_send : NULL,
+                          s->write_poll ? af_xdp_writable : NULL);
 }
 
 /* Update the read handler. */
@@ -97,6 +109,20 @@ static void af_xdp_poll(NetClientState *nc, bool enable)
     }
 }
 
+/* Move the event-loop handlers to a different AioContext. */
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (!s->xsk) {
+        return;
+    }
+
+    af_xdp_set_fd_handler(s, nc->ctx, NULL, NULL);
+    nc->ctx = ctx;
+    af_xdp_update_fd_handler(s);
+}
+
 static void af_xdp_complete_tx(AFXDPState *s)
 {
     uint32_t idx = 0;
@@ -139,10 +165,25 @@ static void af_xdp_writable(void *opaque)
     qemu_flush_queued_packets(&s->nc);
 }
 
-static ssize_t af_xdp_receive(NetClientState *nc,
-                              const uint8_t *buf, size_t size)
+static void af_xdp_tx_kick(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    if (s->xsk && xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, true);
+    }
+}
+
+/*
+ * Copy the packet straight from the sender's iovec into a UMEM frame, so that
+ * scattered packets (e.g. virtio-net header + payload) are not linearized into
+ * a temporary buffer first.
+ */
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
 {
     AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
     struct xdp_desc *desc;
     uint32_t idx;
     void *data;
@@ -169,18 +210,28 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     desc->len = size;
 
     data = xsk_umem__get_data(s->buffer, desc->addr);
-    memcpy(data, buf, size);
+    iov_to_buf(iov, iovcnt, 0, data, size);
 
     xsk_ring_prod__submit(&s->tx, 1);
     s->outstanding_tx++;
 
-    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
-        af_xdp_write_poll(s, true);
-    }
+    /* Kick the kernel once for all packets queued in this batch */
+    defer_call(af_xdp_tx_kick, s);
 
     return size;
 }
 
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
 /*
  * Complete a previous send (backend --> guest) and enable the
  * fd_read callback.
@@ -226,6 +277,9 @@ static void af_xdp_send(void *opaque)
         return;
     }
 
+    /* Let the peer batch its notifications for all packets of this batch */
+    defer_call_begin();
+
     for (i = 0; i < n_rx; i++) {
         const struct xdp_desc *desc;
         struct iovec iov;
@@ -252,6 +306,8 @@ static void af_xdp_send(void *opaque)
         }
     }
 
+    defer_call_end();
+
     /* Release actually sent descriptors and try to re-fill. */
     xsk_ring_cons__release(&s->rx, n_rx);
     af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
@@ -401,8 +457,10 @@ static NetClientInfo net_af_xdp_info = {
     .type = NET_CLIENT_DRIVER_AF_XDP,
     .size = sizeof(AFXDPState),
     .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
     .poll = af_xdp_poll,
     .cleanup = af_xdp_cleanup,
+    .set_aio_context = af_xdp_set_aio_context,
 };
 
 static int *parse_socket_fds(const char *sock_fds_str,
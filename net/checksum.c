@@ -18,25 +18,46 @@
 #include "qemu/osdep.h"
 #include "net/checksum.h"
 #include "net/eth.h"
+#include "qemu/bswap.h"
 
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    uint64_t sum = 0;
+    int i = 0;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    /*
+     * One's complement addition is commutative and 2^16 == 1, so sum
+     * host-endian 32-bit halves of 64-bit words and fold at the end.  The
+     * loop cannot overflow for any int length.
+     */
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w = ldq_he_p(buf + i);
+
+        sum += (w >> 32) + (uint32_t)w;
+    }
+    for (; i + 2 <= len; i += 2) {
+        sum += lduw_he_p(buf + i);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    /* Swapping the bytes of a one's complement sum swaps them in each word */
+    if (!HOST_BIG_ENDIAN) {
+        sum = bswap16(sum);
     }
     if (i < len) {
-        sum1 += (uint32_t)buf[i];
+        sum += (uint32_t)buf[i] << 8;
     }
 
+    /* An odd @seq means that buf[0] is the low byte of a big-endian word */
     if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+        while (sum >> 16) {
+            sum = (sum & 0xffff) + (sum >> 16);
+        }
+        sum = bswap16(sum);
     }
+    return sum;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -722,54 +722,52 @@ static void colo_compare_connection(void *opaque, void *user_data)
     }
 }
 
+/*
+ * Packets queued while the output is busy are framed into one buffer
+ * and written together, instead of with several writes per packet.
+ */
+#define COMPARE_SEND_BATCH_MAX (64 * 1024)
+
+static void compare_chr_send_append(GByteArray *out, SendEntry *entry,
+                                    bool vnet_hdr)
+{
+    uint32_t len = htonl(entry->size);
+
+    g_byte_array_append(out, (uint8_t *)&len, sizeof(len));
+    if (vnet_hdr) {
+        /*
+         * We send vnet header len make other module(like filter-redirector)
+         * know how to parse net packet correctly.
+         */
+        len = htonl(entry->vnet_hdr_len);
+        g_byte_array_append(out, (uint8_t *)&len, sizeof(len));
+    }
+    g_byte_array_append(out, entry->buf, entry->size);
+
+    g_free(entry->buf);
+    g_slice_free(SendEntry, entry);
+}
+
 static void coroutine_fn _compare_chr_send(void *opaque)
 {
     SendCo *sendco = opaque;
     CompareState *s = sendco->s;
+    bool vnet_hdr = !sendco->notify_remote_frame && s->vnet_hdr;
+    g_autoptr(GByteArray) out = g_byte_array_new();
     int ret = 0;
 
     while (!g_queue_is_empty(&sendco->send_list)) {
-        SendEntry *entry = g_queue_pop_tail(&sendco->send_list);
-        uint32_t len = htonl(entry->size);
-
-        ret = qemu_chr_fe_write_all(sendco->chr, (uint8_t *)&len, sizeof(len));
-
-        if (ret != sizeof(len)) {
-            g_free(entry->buf);
-            g_slice_free(SendEntry, entry);
-            goto err;
-        }
-
-        if (!sendco->notify_remote_frame && s->vnet_hdr) {
-            /*
-             * We send vnet header len make other module(like filter-redirector)
-             * know how to parse net packet correctly.
-             */
-            len = htonl(entry->vnet_hdr_len);
-
-            ret = qemu_chr_fe_write_all(sendco->chr,
-                                        (uint8_t *)&len,
-                                        sizeof(len));
-
-            if (ret != sizeof(len)) {
-                g_free(entry->buf);
-                g_slice_free(SendEntry, entry);
-                goto err;
-            }
+        g_byte_array_set_size(out, 0);
+        while (!g_queue_is_empty(&sendco->send_list) &&
+               out->len < COMPARE_SEND_BATCH_MAX) {
+            compare_chr_send_append(out, g_queue_pop_tail(&sendco->send_list),
+                                    vnet_hdr);
         }
 
-        ret = qemu_chr_fe_write_all(sendco->chr,
-                                    (uint8_t *)entry->buf,
-                                    entry->size);
-
-        if (ret != entry->size) {
-            g_free(entry->buf);
-            g_slice_free(SendEntry, entry);
+        ret = qemu_chr_fe_write_all(sendco->chr, out->data, out->len);
+        if (ret != (int)out->len) {
             goto err;
         }
-
-        g_free(entry->buf);
-        g_slice_free(SendEntry, entry);
     }
 
     sendco->ret = 0;
@@ -817,7 +815,7 @@ static int compare_chr_send(CompareState *s,
         entry->buf = g_malloc(size);
         memcpy(entry->buf, buf, size);
     }
-    g_queue_push_tail(&sendco->send_list, entry);
+    g_queue_push_head(&sendco->send_list, entry);
 
     if (sendco->done) {
         sendco->co = qemu_coroutine_create(_compare_chr_send, sendco);
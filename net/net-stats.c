@@ -0,0 +1,166 @@
+/*
+ * Network statistics for the query-stats QMP command
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/qdev-core.h"
+#include "net/net.h"
+#include "net/queue.h"
+#include "qapi/qapi-types-stats.h"
+#include "qemu/module.h"
+#include "sysemu/stats.h"
+
+/*
+ * Every statistic is a list with one value per queue of the NIC.  "rx"
+ * is the queue of the NIC, i.e. packets for the guest, "tx" the queue of
+ * its backend.
+ */
+static const struct {
+    const char *name;
+    size_t offset;
+} net_stats_fields[] = {
+    { "packets", offsetof(NetQueueStats, packets) },
+    { "queued", offsetof(NetQueueStats, queued) },
+    { "queue-full", offsetof(NetQueueStats, queue_full) },
+    { "dropped", offsetof(NetQueueStats, dropped) },
+};
+
+typedef struct NetStatsState {
+    StatsResultList **result;
+    strList *names;
+    /* NICs that were reported already, e.g. by a virtio proxy device */
+    GHashTable *nics;
+} NetStatsState;
+
+static StatsList *net_stats_add(StatsList *stats_list, const char *dir,
+                                NetQueueStats *queue_stats, int queues,
+                                strList *names)
+{
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(net_stats_fields); i++) {
+        g_autofree char *name = g_strdup_printf("%s-%s", dir,
+                                                net_stats_fields[i].name);
+        uint64List *values = NULL;
+        Stats *st;
+
+        if (!apply_str_list_filter(name, names)) {
+            continue;
+        }
+
+        for (j = queues - 1; j >= 0; j--) {
+            QAPI_LIST_PREPEND(values,
+                              *(uint64_t *)((char *)&queue_stats[j] +
+                                            net_stats_fields[i].offset));
+        }
+
+        st = g_new0(Stats, 1);
+        st->name = g_steal_pointer(&name);
+        st->value = g_new0(StatsValue, 1);
+        st->value->type = QTYPE_QLIST;
+        st->value->u.list = values;
+        QAPI_LIST_PREPEND(stats_list, st);
+    }
+
+    return stats_list;
+}
+
+static int net_stats_dev(Object *child, void *opaque)
+{
+    NetStatsState *s = opaque;
+    Object *dev = object_dynamic_cast(child, TYPE_DEVICE);
+    NetClientState *ncs[MAX_QUEUE_NUM];
+    g_autofree NetQueueStats *rx_stats = NULL;
+    g_autofree NetQueueStats *tx_stats = NULL;
+    g_autofree char *netdev = NULL;
+    g_autofree char *qom_path = NULL;
+    StatsList *stats_list = NULL;
+    int queues, i;
+
+    if (!dev || !DEVICE(dev)->realized ||
+        !object_property_find(dev, "netdev")) {
+        return 0;
+    }
+
+    netdev = object_property_get_str(dev, "netdev", NULL);
+    if (!netdev || !*netdev) {
+        return 0;
+    }
+
+    queues = qemu_find_net_clients_except(netdev, ncs, NET_CLIENT_DRIVER_NIC,
+                                          MAX_QUEUE_NUM);
+    if (!queues || !ncs[0]->peer ||
+        ncs[0]->peer->info->type != NET_CLIENT_DRIVER_NIC ||
+        !g_hash_table_add(s->nics, qemu_get_nic(ncs[0]->peer))) {
+        return 0;
+    }
+
+    rx_stats = g_new0(NetQueueStats, queues);
+    tx_stats = g_new0(NetQueueStats, queues);
+    for (i = 0; i < queues; i++) {
+        if (ncs[i]->peer) {
+            qemu_net_queue_get_stats(ncs[i]->peer->incoming_queue,
+                                     &rx_stats[i]);
+        }
+        qemu_net_queue_get_stats(ncs[i]->incoming_queue, &tx_stats[i]);
+    }
+
+    stats_list = net_stats_add(stats_list, "rx", rx_stats, queues, s->names);
+    stats_list = net_stats_add(stats_list, "tx", tx_stats, queues, s->names);
+
+    if (stats_list) {
+        qom_path = object_get_canonical_path(dev);
+        add_stats_entry(s->result, STATS_PROVIDER_NET, qom_path, stats_list);
+    }
+    return 0;
+}
+
+static void net_stats_cb(StatsResultList **result, StatsTarget target,
+                         strList *names, strList *targets, Error **errp)
+{
+    g_autoptr(GHashTable) nics = g_hash_table_new(NULL, NULL);
+    NetStatsState s = {
+        .result = result,
+        .names = names,
+        .nics = nics,
+    };
+
+    if (target != STATS_TARGET_NET) {
+        return;
+    }
+
+    object_child_foreach_recursive(object_get_root(), net_stats_dev, &s);
+}
+
+static void net_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    static const char *const dirs[] = { "rx", "tx" };
+    StatsSchemaValueList *stats_list = NULL;
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(dirs); i++) {
+        for (j = 0; j < ARRAY_SIZE(net_stats_fields); j++) {
+            StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+            value->name = g_strdup_printf("%s-%s", dirs[i],
+                                          net_stats_fields[j].name);
+            value->type = STATS_TYPE_CUMULATIVE;
+            QAPI_LIST_PREPEND(stats_list, value);
+        }
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_NET, STATS_TARGET_NET,
+                     stats_list);
+}
+
+static void net_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_NET, net_stats_cb, net_schemas_cb,
+                        false);
+}
+
+type_init(net_stats_register);
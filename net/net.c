@@ -47,6 +47,7 @@
 #include "qemu/iov.h"
 #include "qemu/qemu-print.h"
 #include "qemu/main-loop.h"
+#include "block/aio-wait.h"
 #include "qemu/option.h"
 #include "qemu/keyval.h"
 #include "qapi/error.h"
@@ -585,6 +586,30 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+bool qemu_can_set_net_aio_context(NetClientState *nc)
+{
+    return nc && nc->info->set_aio_context;
+}
+
+/*
+ * Move packet processing of @nc to @ctx (NULL for the main loop).  The
+ * caller must make sure that nothing is processed for @nc concurrently,
+ * i.e. call this either from the main loop while @nc is still processed
+ * there, or from within its current AioContext.
+ */
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (ctx == qemu_get_aio_context()) {
+        ctx = NULL;
+    }
+
+    /* The callback still sees the old context in nc->ctx */
+    if (nc->info->set_aio_context) {
+        nc->info->set_aio_context(nc, ctx);
+    }
+    nc->ctx = ctx;
+}
+
 int qemu_can_receive_packet(NetClientState *nc)
 {
     if (nc->receive_disabled) {
@@ -750,8 +775,50 @@ ssize_t qemu_receive_packet(NetClientState *nc, const uint8_t *buf, int size)
     return qemu_net_queue_receive(nc->incoming_queue, buf, size);
 }
 
+typedef struct NetSendRawData {
+    NICState *nic;
+    int queue_index;
+    const uint8_t *buf;
+    int size;
+    bool sent;
+} NetSendRawData;
+
+static void qemu_send_packet_raw_bh(void *opaque)
+{
+    NetSendRawData *data = opaque;
+    NetClientState *nc = qemu_get_subqueue(data->nic, data->queue_index);
+
+    /* The queue may have moved while the main loop was waiting for us */
+    if (nc->ctx != qemu_get_current_aio_context()) {
+        return;
+    }
+
+    qemu_send_packet_async_with_flags(nc, QEMU_NET_PACKET_FLAG_RAW,
+                                      data->buf, data->size, NULL);
+    data->sent = true;
+}
+
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size)
 {
+    /*
+     * Raw packets are injected from the main loop (e.g. self-announcements),
+     * hand them to the AioContext that owns the NIC's queues if needed.
+     */
+    while (nc->ctx && nc->ctx != qemu_get_current_aio_context()) {
+        NetSendRawData data = {
+            .nic = qemu_get_nic(nc),
+            .queue_index = nc->queue_index,
+            .buf = buf,
+            .size = size,
+        };
+
+        assert(nc->info->type == NET_CLIENT_DRIVER_NIC);
+        aio_wait_bh_oneshot(nc->ctx, qemu_send_packet_raw_bh, &data);
+        if (data.sent) {
+            return size;
+        }
+    }
+
     return qemu_send_packet_async_with_flags(nc, QEMU_NET_PACKET_FLAG_RAW,
                                              buf, size, NULL);
 }
@@ -24,6 +24,7 @@
 #include "qemu/osdep.h"
 #include "net/queue.h"
 #include "qemu/queue.h"
+#include "qemu/stats64.h"
 #include "net/net.h"
 
 /* The delivery handler may only return zero if it will call
@@ -58,6 +59,12 @@ struct NetQueue {
     QTAILQ_HEAD(, NetPacket) packets;
 
     unsigned delivering : 1;
+
+    /* See NetQueueStats */
+    Stat64 packets_delivered;
+    Stat64 packets_queued;
+    Stat64 packets_queue_full;
+    Stat64 packets_dropped;
 };
 
 NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
@@ -99,8 +106,12 @@ static void qemu_net_queue_append(NetQueue *queue,
 {
     NetPacket *packet;
 
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
+    if (queue->nq_count >= queue->nq_maxlen) {
+        stat64_add(&queue->packets_queue_full, 1);
+        if (!sent_cb) {
+            stat64_add(&queue->packets_dropped, 1);
+            return; /* drop if queue full and no callback */
+        }
     }
     packet = g_malloc(sizeof(NetPacket) + size);
     packet->sender = sender;
@@ -109,6 +120,7 @@ static void qemu_net_queue_append(NetQueue *queue,
     packet->sent_cb = sent_cb;
     memcpy(packet->data, buf, size);
 
+    stat64_add(&queue->packets_queued, 1);
     queue->nq_count++;
     QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
 }
@@ -124,8 +136,12 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     size_t max_len = 0;
     int i;
 
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
+    if (queue->nq_count >= queue->nq_maxlen) {
+        stat64_add(&queue->packets_queue_full, 1);
+        if (!sent_cb) {
+            stat64_add(&queue->packets_dropped, 1);
+            return; /* drop if queue full and no callback */
+        }
     }
     for (i = 0; i < iovcnt; i++) {
         max_len += iov[i].iov_len;
@@ -144,10 +160,20 @@ void qemu_net_queue_append_iov(NetQueue *queue,
         packet->size += len;
     }
 
+    stat64_add(&queue->packets_queued, 1);
     queue->nq_count++;
     QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
 }
 
+static void qemu_net_queue_account(NetQueue *queue, ssize_t ret)
+{
+    if (ret > 0) {
+        stat64_add(&queue->packets_delivered, 1);
+    } else if (ret < 0) {
+        stat64_add(&queue->packets_dropped, 1);
+    }
+}
+
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
                                       NetClientState *sender,
                                       unsigned flags,
@@ -163,6 +189,7 @@ static ssize_t qemu_net_queue_deliver(NetQueue *queue,
     queue->delivering = 1;
     ret = queue->deliver(sender, flags, &iov, 1, queue->opaque);
     queue->delivering = 0;
+    qemu_net_queue_account(queue, ret);
 
     return ret;
 }
@@ -178,6 +205,7 @@ static ssize_t qemu_net_queue_deliver_iov(NetQueue *queue,
     queue->delivering = 1;
     ret = queue->deliver(sender, flags, iov, iovcnt, queue->opaque);
     queue->delivering = 0;
+    qemu_net_queue_account(queue, ret);
 
     return ret;
 }
@@ -291,3 +319,11 @@ bool qemu_net_queue_flush(NetQueue *queue)
     }
     return true;
 }
+
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats)
+{
+    stats->packets = stat64_get(&queue->packets_delivered);
+    stats->queued = stat64_get(&queue->packets_queued);
+    stats->queue_full = stat64_get(&queue->packets_queue_full);
+    stats->dropped = stat64_get(&queue->packets_dropped);
+}
@@ -465,6 +465,31 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->regular = regular_cb;
 }
 
+/*
+ * Accesses of one instruction made inline, on top of the buffer size.
+ * Larger instructions go through helpers, which drain the buffer as they
+ * fill it.
+ */
+#define PLUGIN_MEM_BUFFER_SLACK 256
+
+void plugin_register_vcpu_mem_buffer(GArray **mem_cbs, GArray **insn_cbs,
+                                     enum qemu_plugin_mem_rw rw,
+                                     struct qemu_plugin_mem_buffer *buf)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(mem_cbs);
+    qemu_plugin_u64 count = { .score = buf->score, .offset = 0 };
+
+    dyn_cb->type = PLUGIN_CB_MEM_BUFFER;
+    dyn_cb->buffer.buf = buf;
+    dyn_cb->buffer.rw = rw;
+
+    /* Appending does not branch: drain before the instruction instead */
+    plugin_register_dyn_cond_cb__udata(insn_cbs, plugin_mem_buffer_drain,
+                                       QEMU_PLUGIN_CB_NO_REGS,
+                                       QEMU_PLUGIN_COND_GE, count,
+                                       buf->size, buf);
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -601,6 +626,55 @@ void exec_inline_op(enum plugin_dyn_cb_type type,
     }
 }
 
+static struct qemu_plugin_mem_record *
+plugin_mem_buffer_records(struct qemu_plugin_mem_buffer *buf,
+                          unsigned int vcpu_index)
+{
+    char *base_ptr = buf->score->data->data;
+
+    return (struct qemu_plugin_mem_record *)(base_ptr + vcpu_index *
+                g_array_get_element_size(buf->score->data));
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void plugin_mem_buffer_drain(unsigned int vcpu_index, void *udata)
+{
+    struct qemu_plugin_mem_buffer *buf = udata;
+    struct qemu_plugin_mem_record *rec =
+        plugin_mem_buffer_records(buf, vcpu_index);
+    size_t n = rec[0].vaddr;
+
+    if (n) {
+        buf->cb(vcpu_index, rec + 1, n, buf->userp);
+        rec[0].vaddr = 0;
+    }
+}
+
+/* Same as the inline code, for accesses made from helpers */
+static void plugin_mem_buffer_append(struct qemu_plugin_mem_buffer *buf,
+                                     unsigned int vcpu_index, uint64_t vaddr,
+                                     qemu_plugin_meminfo_t info)
+{
+    struct qemu_plugin_mem_record *rec =
+        plugin_mem_buffer_records(buf, vcpu_index);
+    size_t n = rec[0].vaddr;
+
+    /* Inline appends may have filled the buffer without draining it */
+    if (n >= buf->capacity) {
+        plugin_mem_buffer_drain(vcpu_index, buf);
+        n = 0;
+    }
+
+    rec[n + 1].vaddr = vaddr;
+    rec[n + 1].info = info;
+    rec[0].vaddr = n + 1;
+}
+
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_low,
                              uint64_t value_high,
@@ -628,6 +702,12 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                                        vaddr, cb->regular.userp);
             }
             break;
+        case PLUGIN_CB_MEM_BUFFER:
+            if (rw & cb->buffer.rw) {
+                plugin_mem_buffer_append(cb->buffer.buf, cpu->cpu_index,
+                                         vaddr, make_plugin_meminfo(oi, rw));
+            }
+            break;
         case PLUGIN_CB_INLINE_ADD_U64:
         case PLUGIN_CB_INLINE_STORE_U64:
             if (rw & cb->inline_insn.rw) {
@@ -768,3 +848,25 @@ void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
     g_array_free(score->data, TRUE);
     g_free(score);
 }
+
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t size, qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                      void *userdata)
+{
+    struct qemu_plugin_mem_buffer *buf = g_new0(struct qemu_plugin_mem_buffer,
+                                                1);
+
+    buf->size = MAX(size, 1);
+    buf->capacity = buf->size + PLUGIN_MEM_BUFFER_SLACK;
+    buf->cb = cb;
+    buf->userp = userdata;
+    buf->score = plugin_scoreboard_new((buf->capacity + 1) *
+                                       sizeof(struct qemu_plugin_mem_record));
+    return buf;
+}
+
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf)
+{
+    plugin_scoreboard_free(buf->score);
+    g_free(buf);
+}
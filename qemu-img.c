@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <math.h>
 
 #include "qemu/help-texts.h"
 #include "qemu/qemu-progress.h"
@@ -34,6 +35,7 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qnum.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
@@ -86,6 +88,12 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_THREADS = 278,
+    OPTION_RANDOM = 279,
+    OPTION_ZIPF = 280,
+    OPTION_WRITE_PERCENT = 281,
+    OPTION_SEED = 282,
+    OPTION_WARMUP = 283,
 };
 
 typedef enum OutputFormat {
@@ -207,6 +215,8 @@ void help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--threads' specifies how many threads the target format driver may use\n"
+           "       to compress or encrypt data in parallel (qcow2 only)\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -1155,6 +1165,11 @@ static int64_t find_nonzero(const uint8_t *buf, int64_t n)
     int64_t i;
     int64_t end = QEMU_ALIGN_DOWN(n, BDRV_SECTOR_SIZE);
 
+    /* Only look for the first non-zero sector if there is one */
+    if (buffer_is_zero(buf, n)) {
+        return -1;
+    }
+
     for (i = 0; i < end; i += BDRV_SECTOR_SIZE) {
         if (!buffer_is_zero(buf + i, BDRV_SECTOR_SIZE)) {
             return i;
@@ -1295,6 +1310,11 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
     i = MIN(bytes, chsize);
 
     res = !!memcmp(buf1, buf2, i);
+    if (!res && !memcmp(buf1 + i, buf2 + i, bytes - i)) {
+        /* Identical buffers are the common case, check them in one go */
+        *pnum = bytes;
+        return 0;
+    }
     while (i < bytes) {
         int64_t len = MIN(bytes - i, chsize);
 
@@ -1348,6 +1368,53 @@ static int check_empty_sectors(BlockBackend *blk, int64_t offset,
     return 0;
 }
 
+typedef struct CompareRead {
+    QEMUIOVector qiov;
+    int ret;
+    bool done;
+} CompareRead;
+
+static void compare_read_cb(void *opaque, int ret)
+{
+    CompareRead *r = opaque;
+
+    r->ret = ret;
+    r->done = true;
+}
+
+/*
+ * Read @bytes at @offset from both images at the same time, so that the time
+ * for comparing allocated data is that of the slower image rather than the sum.
+ */
+static int compare_read_both(BlockBackend *blk1, const char *filename1,
+                             uint8_t *buf1, BlockBackend *blk2,
+                             const char *filename2, uint8_t *buf2,
+                             int64_t offset, int64_t bytes)
+{
+    CompareRead r1 = {}, r2 = {};
+
+    qemu_iovec_init_buf(&r1.qiov, buf1, bytes);
+    qemu_iovec_init_buf(&r2.qiov, buf2, bytes);
+
+    blk_aio_preadv(blk1, offset, &r1.qiov, 0, compare_read_cb, &r1);
+    blk_aio_preadv(blk2, offset, &r2.qiov, 0, compare_read_cb, &r2);
+    while (!r1.done || !r2.done) {
+        main_loop_wait(false);
+    }
+
+    if (r1.ret < 0) {
+        error_report("Error while reading offset %" PRId64 " of %s: %s",
+                     offset, filename1, strerror(-r1.ret));
+        return r1.ret;
+    }
+    if (r2.ret < 0) {
+        error_report("Error while reading offset %" PRId64 " of %s: %s",
+                     offset, filename2, strerror(-r2.ret));
+        return r2.ret;
+    }
+    return 0;
+}
+
 /*
  * Compares two images. Exit codes:
  *
@@ -1364,6 +1431,7 @@ static int img_compare(int argc, char **argv)
     uint8_t *buf1 = NULL, *buf2 = NULL;
     int64_t pnum1, pnum2;
     int allocated1, allocated2;
+    bool zero1, zero2;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
@@ -1542,40 +1610,35 @@ static int img_compare(int argc, char **argv)
                 goto out;
             }
         }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
+        /*
+         * Areas that are unallocated in the whole chain read as zeroes, just
+         * like those reported as zero, so neither needs to be read.
+         */
+        zero1 = !allocated1 || (status1 & BDRV_BLOCK_ZERO);
+        zero2 = !allocated2 || (status2 & BDRV_BLOCK_ZERO);
+
+        if (zero1 && zero2) {
             /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
+        } else if (!zero1 && !zero2) {
+            int64_t pnum;
 
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, chunk, buf1, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, chunk, buf2, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, 0, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
+            chunk = MIN(chunk, IO_BUF_SIZE);
+            ret = compare_read_both(blk1, filename1, buf1,
+                                    blk2, filename2, buf2, offset, chunk);
+            if (ret < 0) {
+                ret = 4;
+                goto out;
+            }
+            ret = compare_buffers(buf1, buf2, chunk, 0, &pnum);
+            if (ret || pnum != chunk) {
+                qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
+                        offset + (ret ? 0 : pnum));
+                ret = 1;
+                goto out;
             }
         } else {
             chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
+            if (!zero1) {
                 ret = check_empty_sectors(blk1, offset, chunk,
                                           filename1, buf1, quiet);
             } else {
@@ -1687,6 +1750,7 @@ typedef struct ImgConvertState {
     int64_t target_backing_sectors; /* negative if unknown */
     bool wr_in_order;
     bool copy_range;
+    bool copy_range_worked;
     bool salvage;
     bool quiet;
     int min_sparse;
@@ -1991,7 +2055,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         int n;
         int64_t sector_num;
         enum ImgConvertBlockStatus status;
-        bool copy_range;
+        bool copy_range, try_copy_range = true;
 
         qemu_co_mutex_lock(&s->lock);
         if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
@@ -2024,7 +2088,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
 retry:
-        copy_range = s->copy_range && s->status == BLK_DATA;
+        copy_range = try_copy_range && s->copy_range && status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
             ret = convert_co_read(s, sector_num, n, buf);
             if (ret < 0) {
@@ -2052,9 +2116,20 @@ retry:
                     ret = convert_co_copy_range(s, sector_num, n);
                 }
                 if (ret) {
-                    s->copy_range = false;
+                    /*
+                     * If offloading has never worked, the host doesn't
+                     * support it for this pair of images, so stop trying.
+                     * Otherwise only this area can't be offloaded (e.g.
+                     * because of compressed qcow2 clusters), so fall back to
+                     * read/write for it alone.
+                     */
+                    if (!s->copy_range_worked) {
+                        s->copy_range = false;
+                    }
+                    try_copy_range = false;
                     goto retry;
                 }
+                s->copy_range_worked = true;
             } else {
                 ret = convert_co_write(s, sector_num, n, buf, status);
             }
@@ -2253,6 +2328,8 @@ static int img_convert(int argc, char **argv)
     bool explict_min_sparse = false;
     bool bitmaps = false;
     bool skip_broken = false;
+    bool explicit_num_coroutines = false;
+    long worker_threads = 0;
     int64_t rate_limit = 0;
 
     ImgConvertState s = (ImgConvertState) {
@@ -2275,6 +2352,7 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"threads", required_argument, 0, OPTION_THREADS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2370,6 +2448,7 @@ static int img_convert(int argc, char **argv)
                              " coroutines is between 1 and %d", MAX_COROUTINES);
                 goto fail_getopt;
             }
+            explicit_num_coroutines = true;
             break;
         case 'W':
             s.wr_in_order = false;
@@ -2409,6 +2488,14 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_THREADS:
+            if (qemu_strtol(optarg, NULL, 0, &worker_threads) ||
+                worker_threads < 1 || worker_threads > 64) {
+                error_report("Invalid number of threads. Allowed number of"
+                             " threads is between 1 and 64");
+                goto fail_getopt;
+            }
+            break;
         }
     }
 
@@ -2436,6 +2523,27 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
+    if (worker_threads && tgt_image_opts) {
+        error_report("--threads cannot be used with --target-image-opts; "
+                     "use the worker-threads option of the target instead");
+        goto fail_getopt;
+    }
+
+    /* Only qcow2 has worker-threads, fail before creating the target */
+    if (worker_threads && strcmp(out_fmt, "qcow2")) {
+        error_report("--threads is only supported for qcow2 targets");
+        goto fail_getopt;
+    }
+
+    /*
+     * Each coroutine has at most one request in flight, so there must be at
+     * least as many of them as threads to keep the threads busy.
+     */
+    if (worker_threads && !explicit_num_coroutines) {
+        s.num_coroutines = MIN(MAX(s.num_coroutines, worker_threads),
+                               MAX_COROUTINES);
+    }
+
     if (tgt_image_opts && !skip_create) {
         error_report("--target-image-opts requires use of -n flag");
         goto fail_getopt;
@@ -2693,7 +2801,21 @@ static int img_convert(int argc, char **argv)
         flags |= BDRV_O_RESIZE;
     }
 
-    if (skip_create) {
+    if (worker_threads) {
+        if (!open_opts) {
+            open_opts = qdict_new();
+        }
+        qdict_put_int(open_opts, "worker-threads", worker_threads);
+    }
+
+    if (skip_create && open_opts) {
+        s.target = img_open_file(out_filename, open_opts, out_fmt,
+                                 flags, writethrough, s.quiet, false);
+        open_opts = NULL; /* blk_new_open will have freed it */
+        if (s.target) {
+            blk_set_force_allow_inactivate(s.target);
+        }
+    } else if (skip_create) {
         s.target = img_open(tgt_image_opts, out_filename, out_fmt,
                             flags, writethrough, s.quiet, false);
     } else {
@@ -3531,6 +3653,28 @@ static int img_snapshot(int argc, char **argv)
     return 0;
 }
 
+/*
+ * Return true if block status says that [offset, offset + bytes) of @blk
+ * reads as zeroes.  Errors just make the caller compare the data.
+ */
+static bool rebase_range_is_zero(BlockBackend *blk, int64_t offset,
+                                 int64_t bytes)
+{
+    while (bytes > 0) {
+        int64_t pnum;
+        int ret;
+
+        ret = bdrv_block_status_above(blk_bs(blk), NULL, offset, bytes,
+                                      &pnum, NULL, NULL);
+        if (ret < 0 || !(ret & BDRV_BLOCK_ZERO) || !pnum) {
+            return false;
+        }
+        offset += pnum;
+        bytes -= pnum;
+    }
+    return true;
+}
+
 static int img_rebase(int argc, char **argv)
 {
     BlockBackend *blk = NULL, *blk_old_backing = NULL, *blk_new_backing = NULL;
@@ -3921,6 +4065,16 @@ static int img_rebase(int argc, char **argv)
             n_old = MIN(n, MAX(0, old_backing_size - (int64_t) offset));
             n_new = MIN(n, MAX(0, new_backing_size - (int64_t) offset));
 
+            /*
+             * Nothing can differ where both backings read as zeroes, which
+             * is common for sparse templates.  Skip reading and comparing.
+             */
+            if (rebase_range_is_zero(blk_old_backing, offset, n_old) &&
+                rebase_range_is_zero(blk_new_backing, offset, n_new)) {
+                qemu_progress_print(local_progress, 100);
+                continue;
+            }
+
             /*
              * Read old and new backing file and take into consideration that
              * backing files may be smaller than the COW image.
@@ -4410,10 +4564,24 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+typedef enum BenchOffsets {
+    BENCH_OFFSETS_SEQUENTIAL,
+    BENCH_OFFSETS_RANDOM,
+    BENCH_OFFSETS_ZIPF,
+} BenchOffsets;
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchReq {
+    BenchData *b;
+    QEMUIOVector qiov;
+    BlockAcctCookie acct;
+} BenchReq;
+
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
-    bool write;
+    int write_percent;
     int bufsize;
     int step;
     int nrreq;
@@ -4421,12 +4589,107 @@ typedef struct BenchData {
     int flush_interval;
     bool drain_on_flush;
     uint8_t *buf;
-    QEMUIOVector *qiov;
+    BenchReq *reqs;
+    BenchReq **free_reqs;
+    int nr_free_reqs;
+
+    BenchOffsets offsets;
+    GRand *rand;
+    uint64_t start_offset;
+    uint64_t nr_blocks;
+
+    /* Zipfian distribution over nr_blocks, see bench_zipf_block() */
+    double zipf_theta;
+    double zipf_zetan;
+    double zipf_alpha;
+    double zipf_eta;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+};
+
+/*
+ * Generalized harmonic number of order @theta, sum(1 / i^theta) for i = 1..n.
+ * Beyond the first million terms, the rest of the sum is approximated by the
+ * integral of x^-theta, which is precise enough for picking offsets.
+ */
+static double bench_zeta(uint64_t n, double theta)
+{
+    const uint64_t exact = MIN(n, 1 << 20);
+    double sum = 0;
+    uint64_t i;
+
+    for (i = 1; i <= exact; i++) {
+        sum += 1.0 / pow(i, theta);
+    }
+    if (n > exact) {
+        sum += (pow(n, 1 - theta) - pow(exact, 1 - theta)) / (1 - theta);
+    }
+    return sum;
+}
+
+static void bench_zipf_init(BenchData *b, double theta)
+{
+    uint64_t n = b->nr_blocks;
+
+    b->zipf_theta = theta;
+    b->zipf_zetan = bench_zeta(n, theta);
+    b->zipf_alpha = 1 / (1 - theta);
+    b->zipf_eta = (1 - pow(2.0 / n, 1 - theta)) /
+                  (1 - bench_zeta(2, theta) / b->zipf_zetan);
+}
+
+/*
+ * Pick a block number in [0, nr_blocks) so that block k is chosen with a
+ * probability proportional to 1 / (k + 1)^theta, using the method from Gray
+ * et al., "Quickly Generating Billion-Record Synthetic Databases".
+ */
+static uint64_t bench_zipf_block(BenchData *b)
+{
+    double u = g_rand_double(b->rand);
+    double uz = u * b->zipf_zetan;
+    uint64_t block;
+
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, b->zipf_theta)) {
+        return MIN(1, b->nr_blocks - 1);
+    }
+
+    block = b->nr_blocks *
+            pow(b->zipf_eta * u - b->zipf_eta + 1, b->zipf_alpha);
+    return MIN(block, b->nr_blocks - 1);
+}
+
+static uint64_t bench_next_offset(BenchData *b)
+{
+    uint64_t offset;
+
+    switch (b->offsets) {
+    case BENCH_OFFSETS_SEQUENTIAL:
+        offset = b->offset;
+        b->offset += b->step;
+        b->offset %= b->image_size;
+        return offset;
+    case BENCH_OFFSETS_RANDOM:
+        return b->start_offset +
+               (uint64_t)(g_rand_double(b->rand) * b->nr_blocks) * b->bufsize;
+    case BENCH_OFFSETS_ZIPF:
+        return b->start_offset + bench_zipf_block(b) * b->bufsize;
+    default:
+        abort();
+    }
+}
+
+static bool bench_next_is_write(BenchData *b)
+{
+    if (b->write_percent == 0 || b->write_percent == 100) {
+        return b->write_percent == 100;
+    }
+    return g_rand_int_range(b->rand, 0, 100) < b->write_percent;
+}
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
@@ -4436,6 +4699,23 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
+static void bench_cb(void *opaque, int ret);
+
+static void bench_req_cb(void *opaque, int ret)
+{
+    BenchReq *req = opaque;
+    BenchData *b = req->b;
+
+    if (ret < 0) {
+        error_report("Failed request: %s", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    block_acct_done(blk_get_stats(b->blk), &req->acct);
+    b->free_reqs[b->nr_free_reqs++] = req;
+    bench_cb(b, ret);
+}
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -4481,18 +4761,26 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        int64_t offset = bench_next_offset(b);
+        bool write = bench_next_is_write(b);
+        BenchReq *req;
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        assert(b->nr_free_reqs > 0);
+        req = b->free_reqs[--b->nr_free_reqs];
+
+        block_acct_start(blk_get_stats(b->blk), &req->acct, b->bufsize,
+                         write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
+        if (write) {
+            acb = blk_aio_pwritev(b->blk, offset, &req->qiov, 0,
+                                  bench_req_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, &req->qiov, 0,
+                                 bench_req_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4501,6 +4789,90 @@ static void bench_cb(void *opaque, int ret)
     }
 }
 
+static void bench_run(BenchData *b, int count)
+{
+    b->n = count;
+    bench_cb(b, 0);
+
+    while (b->n > 0) {
+        main_loop_wait(false);
+    }
+}
+
+static const char *const bench_percentile_names[] = {
+    "p50", "p90", "p99", "p999",
+};
+
+static const double bench_percentiles[] = {
+    50.0, 90.0, 99.0, 99.9,
+};
+
+QEMU_BUILD_BUG_ON(ARRAY_SIZE(bench_percentile_names) !=
+                  ARRAY_SIZE(bench_percentiles));
+
+static void bench_report(BenchData *b, OutputFormat output_format,
+                         BlockLatencyPercentileHistogram *since,
+                         double seconds)
+{
+    static const struct {
+        const char *name;
+        enum BlockAcctType type;
+    } types[] = {
+        { "read", BLOCK_ACCT_READ },
+        { "write", BLOCK_ACCT_WRITE },
+    };
+    BlockAcctStats *stats = blk_get_stats(b->blk);
+    QDict *result = qdict_new();
+    int i, j;
+
+    qdict_put(result, "seconds", qnum_from_double(seconds));
+
+    for (i = 0; i < ARRAY_SIZE(types); i++) {
+        uint64_t values[ARRAY_SIZE(bench_percentiles)];
+        uint64_t ops, base = since[types[i].type].count;
+        QDict *type_dict, *latency;
+
+        if (!block_latency_percentiles_since(stats, types[i].type,
+                                             &since[types[i].type],
+                                             bench_percentiles, values,
+                                             ARRAY_SIZE(values))) {
+            continue;
+        }
+        ops = since[types[i].type].count - base;
+
+        type_dict = qdict_new();
+        latency = qdict_new();
+        qdict_put_int(type_dict, "ops", ops);
+        qdict_put(type_dict, "iops", qnum_from_double(ops / seconds));
+        qdict_put(type_dict, "bytes-per-second",
+                  qnum_from_double(ops * b->bufsize / seconds));
+        for (j = 0; j < ARRAY_SIZE(values); j++) {
+            qdict_put_int(latency, bench_percentile_names[j], values[j]);
+        }
+        qdict_put(type_dict, "latency-ns", latency);
+
+        if (output_format == OFORMAT_HUMAN) {
+            printf("%s: %" PRIu64 " requests, %.1f IOPS, %.1f MiB/s, "
+                   "latency (us):", types[i].name, ops, ops / seconds,
+                   ops * b->bufsize / seconds / MiB);
+            for (j = 0; j < ARRAY_SIZE(values); j++) {
+                printf(" %s %.1f", bench_percentile_names[j],
+                       values[j] / 1000.0);
+            }
+            printf("\n");
+        }
+
+        qdict_put(result, types[i].name, type_dict);
+    }
+
+    if (output_format == OFORMAT_JSON) {
+        GString *str = qobject_to_json_pretty(QOBJECT(result), true);
+        printf("%s\n", str->str);
+        g_string_free(str, true);
+    }
+    qobject_unref(result);
+}
+
 static int img_bench(int argc, char **argv)
 {
     int c, ret = 0;
@@ -4508,7 +4880,9 @@ static int img_bench(int argc, char **argv)
     bool quiet = false;
     bool image_opts = false;
     bool is_write = false;
+    int write_percent = -1;
     int count = 75000;
+    int warmup = 0;
     int depth = 64;
     int64_t offset = 0;
     size_t bufsize = 4096;
@@ -4516,12 +4890,18 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    BenchOffsets offsets = BENCH_OFFSETS_SEQUENTIAL;
+    double zipf_theta = 0;
+    uint32_t seed = 1;
+    OutputFormat output_format = OFORMAT_HUMAN;
+    BlockLatencyPercentileHistogram *since = NULL;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
+    double seconds;
     int i;
     bool force_share = false;
     size_t buf_size = 0;
@@ -4534,6 +4914,12 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"zipf", required_argument, 0, OPTION_ZIPF},
+            {"write-percent", required_argument, 0, OPTION_WRITE_PERCENT},
+            {"seed", required_argument, 0, OPTION_SEED},
+            {"warmup", required_argument, 0, OPTION_WARMUP},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4633,7 +5019,6 @@ static int img_bench(int argc, char **argv)
             }
             break;
         case 'w':
-            flags |= BDRV_O_RDWR;
             is_write = true;
             break;
         case 'U':
@@ -4667,6 +5052,62 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_RANDOM:
+            offsets = BENCH_OFFSETS_RANDOM;
+            break;
+        case OPTION_ZIPF:
+            if (qemu_strtod(optarg, NULL, &zipf_theta) < 0 ||
+                !(zipf_theta > 0 && zipf_theta < 1)) {
+                error_report("Invalid zipf exponent specified, it must be "
+                             "between 0 and 1 (exclusive)");
+                return 1;
+            }
+            offsets = BENCH_OFFSETS_ZIPF;
+            break;
+        case OPTION_WRITE_PERCENT:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid write percentage specified");
+                return 1;
+            }
+            write_percent = res;
+            break;
+        }
+        case OPTION_SEED:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > UINT32_MAX) {
+                error_report("Invalid seed specified");
+                return 1;
+            }
+            seed = res;
+            break;
+        }
+        case OPTION_WARMUP:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > INT_MAX) {
+                error_report("Invalid warm-up request count specified");
+                return 1;
+            }
+            warmup = res;
+            break;
+        }
+        case OPTION_OUTPUT:
+            if (!strcmp(optarg, "json")) {
+                output_format = OFORMAT_JSON;
+            } else if (!strcmp(optarg, "human")) {
+                output_format = OFORMAT_HUMAN;
+            } else {
+                error_report("--output must be used with human or json "
+                             "as argument.");
+                return 1;
+            }
+            break;
         }
     }
 
@@ -4675,7 +5116,18 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
-    if (!is_write && flush_interval) {
+    if (write_percent < 0) {
+        write_percent = is_write ? 100 : 0;
+    } else if (is_write && write_percent != 100) {
+        error_report("-w cannot be combined with --write-percent");
+        ret = -1;
+        goto out;
+    }
+    if (write_percent) {
+        flags |= BDRV_O_RDWR;
+    }
+
+    if (!write_percent && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
         goto out;
@@ -4685,6 +5137,11 @@ static int img_bench(int argc, char **argv)
         ret = -1;
         goto out;
     }
+    if (step && offsets != BENCH_OFFSETS_SEQUENTIAL) {
+        error_report("-S cannot be used with --random or --zipf");
+        ret = -1;
+        goto out;
+    }
 
     blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
                    force_share);
@@ -4705,18 +5162,58 @@ static int img_bench(int argc, char **argv)
         .bufsize        = bufsize,
         .step           = step ?: bufsize,
         .nrreq          = depth,
-        .n              = count,
         .offset         = offset,
-        .write          = is_write,
+        .write_percent  = write_percent,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .offsets        = offsets,
+        .rand           = g_rand_new_with_seed(seed),
+        .start_offset   = offset,
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+
+    if (offsets != BENCH_OFFSETS_SEQUENTIAL) {
+        if (offset >= image_size || image_size - offset < bufsize) {
+            error_report("Random offsets need at least one buffer size "
+                         "between the start offset and the end of the image");
+            ret = -1;
+            goto out;
+        }
+        data.nr_blocks = (image_size - offset) / bufsize;
+        if (offsets == BENCH_OFFSETS_ZIPF) {
+            bench_zipf_init(&data, zipf_theta);
+        }
+    }
+
+    if (output_format == OFORMAT_HUMAN) {
+        if (write_percent == 0 || write_percent == 100) {
+            printf("Sending %d %s requests, %d bytes each, %d in parallel ",
+                   count, write_percent ? "write" : "read", data.bufsize,
+                   data.nrreq);
+        } else {
+            printf("Sending %d requests (%d%% writes), %d bytes each, "
+                   "%d in parallel ", count, write_percent, data.bufsize,
+                   data.nrreq);
+        }
+        switch (offsets) {
+        case BENCH_OFFSETS_SEQUENTIAL:
+            printf("(starting at offset %" PRId64 ", step size %d)\n",
+                   offset, data.step);
+            break;
+        case BENCH_OFFSETS_RANDOM:
+            printf("(random offsets from %" PRId64 ", seed %" PRIu32 ")\n",
+                   offset, seed);
+            break;
+        case BENCH_OFFSETS_ZIPF:
+            printf("(zipfian offsets from %" PRId64 ", exponent %g, "
+                   "seed %" PRIu32 ")\n", offset, zipf_theta, seed);
+            break;
+        }
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
+        if (warmup) {
+            printf("Warming up with %d requests first\n", warmup);
+        }
     }
 
     buf_size = data.nrreq * data.bufsize;
@@ -4725,29 +5222,53 @@ static int img_bench(int argc, char **argv)
 
     blk_register_buf(blk, data.buf, buf_size, &error_fatal);
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
+    data.reqs = g_new0(BenchReq, data.nrreq);
+    data.free_reqs = g_new(BenchReq *, data.nrreq);
     for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
+        data.reqs[i].b = &data;
+        qemu_iovec_init(&data.reqs[i].qiov, 1);
+        qemu_iovec_add(&data.reqs[i].qiov,
                        data.buf + i * data.bufsize, data.bufsize);
+        data.free_reqs[data.nr_free_reqs++] = &data.reqs[i];
     }
 
-    gettimeofday(&t1, NULL);
-    bench_cb(&data, 0);
+    if (warmup) {
+        bench_run(&data, warmup);
+    }
 
-    while (data.n > 0) {
-        main_loop_wait(false);
+    /* Only count what happens from here on */
+    since = g_new0(BlockLatencyPercentileHistogram, BLOCK_MAX_IOTYPE);
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        block_latency_percentiles_since(blk_get_stats(blk), i, &since[i],
+                                        NULL, NULL, 0);
     }
+
+    gettimeofday(&t1, NULL);
+    bench_run(&data, count);
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    seconds = (t2.tv_sec - t1.tv_sec)
+              + ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+    if (output_format == OFORMAT_HUMAN) {
+        printf("Run completed in %3.3f seconds.\n", seconds);
+    }
+    bench_report(&data, output_format, since, seconds);
 
 out:
     if (data.buf) {
         blk_unregister_buf(blk, data.buf, buf_size);
     }
+    if (data.reqs) {
+        for (i = 0; i < data.nrreq; i++) {
+            qemu_iovec_destroy(&data.reqs[i].qiov);
+        }
+    }
+    g_free(data.reqs);
+    g_free(data.free_reqs);
+    g_free(since);
+    if (data.rand) {
+        g_rand_free(data.rand);
+    }
     qemu_vfree(data.buf);
     blk_unref(blk);
 
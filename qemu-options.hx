@@ -188,6 +188,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reapers=n (KVM dirty ring reaper threads, default 0, auto)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n"
@@ -248,6 +249,12 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reapers=n``
+        When the KVM dirty ring is used, the vCPUs are split in ``n`` groups
+        of consecutive vCPU indexes whose rings are collected in parallel,
+        each by its own thread.  The default value 0 uses one thread for
+        every 32 vCPUs, up to 16 threads.
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
@@ -1462,6 +1469,17 @@ SRST
             supporting platforms, and 0 on other platforms. Setting it
             to 0 disables this feature.
 
+        ``alloc-batch-size``
+            Allocate host clusters for guest data in batches of this
+            size, so that their refcounts only need to be updated once
+            per batch. Unused clusters are freed when the image is
+            closed. The default value is 0, which disables batching.
+
+        ``worker-threads``
+            Maximum number of threads that compress, decompress, encrypt
+            or decrypt data for the image at the same time (1 to 64;
+            default: 4).
+
         ``pass-discard-request``
             Whether discard requests to the qcow2 device should be
             forwarded to the data source (on/off; default: on if
@@ -1760,7 +1778,7 @@ ERST
 
 DEF("fsdev", HAS_ARG, QEMU_OPTION_fsdev,
     "-fsdev local,id=id,path=path,security_model=mapped-xattr|mapped-file|passthrough|none\n"
-    " [,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode]\n"
+    " [,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode][,cache=none|metadata]\n"
     " [[,throttling.bps-total=b]|[[,throttling.bps-read=r][,throttling.bps-write=w]]]\n"
     " [[,throttling.iops-total=i]|[[,throttling.iops-read=r][,throttling.iops-write=w]]]\n"
     " [[,throttling.bps-total-max=bm]|[[,throttling.bps-read-max=rm][,throttling.bps-write-max=wm]]]\n"
@@ -1770,7 +1788,7 @@ DEF("fsdev", HAS_ARG, QEMU_OPTION_fsdev,
     QEMU_ARCH_ALL)
 
 SRST
-``-fsdev local,id=id,path=path,security_model=security_model [,writeout=writeout][,readonly=on][,fmode=fmode][,dmode=dmode] [,throttling.option=value[,throttling.option=value[,...]]]``
+``-fsdev local,id=id,path=path,security_model=security_model [,writeout=writeout][,readonly=on][,fmode=fmode][,dmode=dmode][,cache=cache] [,throttling.option=value[,throttling.option=value[,...]]]``
   \ 
 ``-fsdev synth,id=id[,readonly=on]``
     Define a new file system device. Valid options are:
@@ -1824,6 +1842,16 @@ SRST
         host. Works only with security models "mapped-xattr" and
         "mapped-file".
 
+    ``cache=cache``
+        Specifies whether file attributes are cached on host side.
+        Supported values are "none", the default, and "metadata". With
+        "metadata" the attributes of files looked up by the guest are
+        kept in memory and changes to the export path on host are
+        tracked with inotify, which makes walking large directory trees
+        much cheaper. Each cached directory uses an inotify watch, so
+        only a bounded number of directories is cached. Only works
+        on Linux and not with security model "mapped-file".
+
     ``throttling.bps-total=b,throttling.bps-read=r,throttling.bps-write=w``
         Specify bandwidth throttling limits in bytes per second, either
         for all request types or for reads or writes only.
@@ -1866,11 +1894,12 @@ ERST
 DEF("virtfs", HAS_ARG, QEMU_OPTION_virtfs,
     "-virtfs local,path=path,mount_tag=tag,security_model=mapped-xattr|mapped-file|passthrough|none\n"
     "        [,id=id][,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode][,multidevs=remap|forbid|warn]\n"
+    "        [,cache=none|metadata]\n"
     "-virtfs synth,mount_tag=tag[,id=id][,readonly=on]\n",
     QEMU_ARCH_ALL)
 
 SRST
-``-virtfs local,path=path,mount_tag=mount_tag ,security_model=security_model[,writeout=writeout][,readonly=on] [,fmode=fmode][,dmode=dmode][,multidevs=multidevs]``
+``-virtfs local,path=path,mount_tag=mount_tag ,security_model=security_model[,writeout=writeout][,readonly=on] [,fmode=fmode][,dmode=dmode][,multidevs=multidevs][,cache=cache]``
   \ 
 ``-virtfs synth,mount_tag=mount_tag``
     Define a new virtual filesystem device and expose it to the guest using
@@ -1964,6 +1993,16 @@ SRST
         "forbid" does currently not block all possible file access
         operations (e.g. readdir() would still return entries from other
         devices).
+
+    ``cache=cache``
+        Specifies whether file attributes are cached on host side.
+        Supported values are "none", the default, and "metadata". With
+        "metadata" the attributes of files looked up by the guest are
+        kept in memory and changes to the export path on host are
+        tracked with inotify, which makes walking large directory trees
+        much cheaper. Each cached directory uses an inotify watch, so
+        only a bounded number of directories is cached. Only works
+        on Linux and not with security model "mapped-file".
 ERST
 
 DEF("iscsi", HAS_ARG, QEMU_OPTION_iscsi,
@@ -5991,7 +6030,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch,io-uring-sqpoll=on|off,io-uring-sqpoll-idle=ms,io-uring-sqpoll-cpu=cpu``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -6031,6 +6070,17 @@ SRST
         in a batch for the AIO engine, 0 means that the engine will use
         its default.
 
+        The ``io-uring-sqpoll`` parameter makes the kernel poll the
+        submission queue of the IOThread's io_uring ring (used by
+        ``aio=io_uring`` block devices) in a dedicated kernel thread, so
+        that no system call is needed to submit requests. This trades a
+        host CPU for lower latency. The ``io-uring-sqpoll-idle``
+        parameter is the number of milliseconds without requests after
+        which the kernel thread goes to sleep (0 means the kernel
+        default), and ``io-uring-sqpoll-cpu`` binds the kernel thread
+        to a host CPU. These three parameters take effect when the ring
+        is set up and cannot be modified afterwards.
+
         The IOThread parameters can be modified at run-time using the
         ``qom-set`` command (where ``iothread1`` is the IOThread's
         ``id``):
@@ -337,8 +337,8 @@ GAChannel *ga_channel_new(GAChannelMethod method, const gchar *path,
     sec_attrs.lpSecurityDescriptor = NULL;
     sec_attrs.bInheritHandle = false;
 
-    c->rstate.buf_size = QGA_READ_COUNT_DEFAULT;
-    c->rstate.buf = g_malloc(QGA_READ_COUNT_DEFAULT);
+    c->rstate.buf_size = QGA_CHANNEL_READ_SIZE;
+    c->rstate.buf = g_malloc(QGA_CHANNEL_READ_SIZE);
     c->rstate.ov.hEvent = CreateEvent(&sec_attrs, FALSE, FALSE, NULL);
 
     c->source = ga_channel_create_watch(c);
@@ -17,6 +17,8 @@
 #include "qga-qapi-types.h"
 
 #define QGA_READ_COUNT_DEFAULT 4096
+/* Large guest-file-write payloads arrive in fewer, bigger reads */
+#define QGA_CHANNEL_READ_SIZE (64 * 1024)
 
 typedef struct GAState GAState;
 typedef struct GACommandState GACommandState;
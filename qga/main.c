@@ -96,6 +96,7 @@ struct GAState {
     JSONMessageParser parser;
     GMainLoop *main_loop;
     GAChannel *channel;
+    gchar *channel_buf; /* QGA_CHANNEL_READ_SIZE + 1 bytes */
     bool virtio; /* fastpath to check for virtio to deal with poll() quirks */
     GACommandState *command_state;
     GLogLevelFlags log_level;
@@ -689,9 +690,10 @@ end:
 static gboolean channel_event_cb(GIOCondition condition, gpointer data)
 {
     GAState *s = data;
-    gchar buf[QGA_READ_COUNT_DEFAULT + 1];
+    gchar *buf = s->channel_buf;
     gsize count;
-    GIOStatus status = ga_channel_read(s->channel, buf, QGA_READ_COUNT_DEFAULT, &count);
+    GIOStatus status = ga_channel_read(s->channel, buf, QGA_CHANNEL_READ_SIZE,
+                                       &count);
     switch (status) {
     case G_IO_STATUS_ERROR:
         g_warning("error reading channel");
@@ -1464,6 +1466,7 @@ static GAState *initialize_agent(GAConfig *config, int socket_activation)
     ga_command_state_init(s, s->command_state);
     ga_command_state_init_all(s->command_state);
     json_message_parser_init(&s->parser, process_event, s, NULL);
+    s->channel_buf = g_malloc(QGA_CHANNEL_READ_SIZE + 1);
 
 #ifndef _WIN32
     if (!register_signal_handlers()) {
@@ -1501,6 +1504,7 @@ static void cleanup_agent(GAState *s)
         ga_command_state_cleanup_all(s->command_state);
         ga_command_state_free(s->command_state);
         json_message_parser_destroy(&s->parser);
+        g_free(s->channel_buf);
     }
     g_free(s->pstate_filepath);
     g_free(s->state_filepath_isfrozen);
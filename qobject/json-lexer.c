@@ -280,6 +280,19 @@ void json_lexer_init(JSONLexer *lexer, bool enable_interpolation)
     lexer->x = lexer->y = 0;
 }
 
+static void json_lexer_limit_token(JSONLexer *lexer)
+{
+    /* Do not let a single token grow to an arbitrarily large size,
+     * this is a security consideration.
+     */
+    if (lexer->token->len > MAX_TOKEN_SIZE) {
+        json_message_process_token(lexer, lexer->token, lexer->state,
+                                   lexer->x, lexer->y);
+        g_string_truncate(lexer->token, 0);
+        lexer->state = lexer->start_state;
+    }
+}
+
 static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
 {
     int new_state;
@@ -331,23 +344,53 @@ static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
         lexer->state = new_state;
     }
 
-    /* Do not let a single token grow to an arbitrarily large size,
-     * this is a security consideration.
-     */
-    if (lexer->token->len > MAX_TOKEN_SIZE) {
-        json_message_process_token(lexer, lexer->token, lexer->state,
-                                   lexer->x, lexer->y);
-        g_string_truncate(lexer->token, 0);
-        lexer->state = lexer->start_state;
+    json_lexer_limit_token(lexer);
+}
+
+/*
+ * Whitespace between tokens and most characters inside a string leave
+ * the state alone.  Take a run of them in one go instead of going
+ * through the state machine character by character.
+ * Returns the number of characters consumed.
+ */
+static size_t json_lexer_feed_run(JSONLexer *lexer,
+                                  const char *buffer, size_t size)
+{
+    uint8_t state = lexer->state;
+    size_t n = 0;
+
+    if (state == lexer->start_state) {
+        while (n < size && json_lexer[state][(uint8_t)buffer[n]] == IN_START) {
+            lexer->x++;
+            if (buffer[n] == '\n') {
+                lexer->x = 0;
+                lexer->y++;
+            }
+            n++;
+        }
+    } else if (state == IN_DQ_STRING || state == IN_SQ_STRING) {
+        /* stop where json_lexer_feed_char() would have to cut the token */
+        size = MIN(size, MAX_TOKEN_SIZE + 1 - lexer->token->len);
+        while (n < size && json_lexer[state][(uint8_t)buffer[n]] == state) {
+            n++;
+        }
+        g_string_append_len(lexer->token, buffer, n);
+        lexer->x += n;
+        json_lexer_limit_token(lexer);
     }
+
+    return n;
 }
 
 void json_lexer_feed(JSONLexer *lexer, const char *buffer, size_t size)
 {
-    size_t i;
+    size_t i = 0;
 
-    for (i = 0; i < size; i++) {
-        json_lexer_feed_char(lexer, buffer[i], false);
+    while (i < size) {
+        i += json_lexer_feed_run(lexer, buffer + i, size - i);
+        if (i < size) {
+            json_lexer_feed_char(lexer, buffer[i++], false);
+        }
     }
 }
 
@@ -143,6 +143,18 @@ static QString *parse_string(JSONParserContext *ctxt, JSONToken *token)
 
     while (*ptr != quote) {
         assert(*ptr);
+
+        /* printable ASCII stands for itself, copy runs of it at once */
+        beg = ptr;
+        while (*ptr >= 0x20 && *ptr < 0x7F && *ptr != quote &&
+               *ptr != '\\' && *ptr != '%') {
+            ptr++;
+        }
+        if (ptr != beg) {
+            g_string_append_len(str, beg, ptr - beg);
+            continue;
+        }
+
         switch (*ptr) {
         case '\\':
             beg = ptr++;
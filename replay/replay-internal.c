@@ -15,6 +15,7 @@
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/thread.h"
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -30,6 +31,38 @@ static unsigned long mutex_head, mutex_tail;
 static bool write_error;
 FILE *replay_file;
 
+/*
+ * When recording, events are collected in memory and a separate thread
+ * writes them to replay_file, so that vCPUs do not wait for the file.
+ * The buffer being filled is protected by the replay mutex, the one
+ * being written by writer.lock.
+ */
+#define REPLAY_WRITE_BUF_SIZE (1 << 20)
+
+static struct {
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+    uint8_t *buf[2];
+    int cur;
+    size_t len;
+    /* File offset of buf[cur] */
+    int64_t offset;
+    bool active;
+    /* Protected by lock */
+    uint8_t *pending;
+    size_t pending_len;
+    bool quit;
+} writer;
+
+/* When replaying, the log is mapped and read with no system calls */
+static struct {
+    GMappedFile *file;
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+} reader;
+
 static void replay_write_error(void)
 {
     if (!write_error) {
@@ -44,11 +77,168 @@ static void replay_read_error(void)
     exit(1);
 }
 
+static void *replay_writer_thread(void *opaque)
+{
+    qemu_mutex_lock(&writer.lock);
+    for (;;) {
+        while (!writer.pending && !writer.quit) {
+            qemu_cond_wait(&writer.cond, &writer.lock);
+        }
+        if (!writer.pending) {
+            break;
+        }
+
+        qemu_mutex_unlock(&writer.lock);
+        if (fwrite(writer.pending, 1, writer.pending_len,
+                   replay_file) != writer.pending_len) {
+            replay_write_error();
+        }
+        qemu_mutex_lock(&writer.lock);
+
+        writer.pending = NULL;
+        qemu_cond_broadcast(&writer.cond);
+    }
+    qemu_mutex_unlock(&writer.lock);
+    return NULL;
+}
+
+/* Hand the filled buffer to the writer thread and switch to the other one */
+static void replay_writer_submit(void)
+{
+    if (!writer.len) {
+        return;
+    }
+
+    qemu_mutex_lock(&writer.lock);
+    while (writer.pending) {
+        qemu_cond_wait(&writer.cond, &writer.lock);
+    }
+    writer.pending = writer.buf[writer.cur];
+    writer.pending_len = writer.len;
+    qemu_cond_broadcast(&writer.cond);
+    qemu_mutex_unlock(&writer.lock);
+
+    writer.offset += writer.len;
+    writer.cur ^= 1;
+    writer.len = 0;
+}
+
+static void replay_write(const void *data, size_t size)
+{
+    if (!writer.active) {
+        if (fwrite(data, 1, size, replay_file) != size) {
+            replay_write_error();
+        }
+        return;
+    }
+
+    while (size) {
+        size_t n = MIN(size, REPLAY_WRITE_BUF_SIZE - writer.len);
+
+        memcpy(writer.buf[writer.cur] + writer.len, data, n);
+        writer.len += n;
+        data = (const uint8_t *)data + n;
+        size -= n;
+
+        if (writer.len == REPLAY_WRITE_BUF_SIZE) {
+            replay_writer_submit();
+        }
+    }
+}
+
+static void replay_read(void *buf, size_t size)
+{
+    if (reader.file) {
+        if (size > reader.len - reader.pos) {
+            replay_read_error();
+        }
+        memcpy(buf, reader.data + reader.pos, size);
+        reader.pos += size;
+    } else if (fread(buf, 1, size, replay_file) != size) {
+        replay_read_error();
+    }
+}
+
+void replay_file_start(const char *fname, int mode)
+{
+    g_autoptr(GError) err = NULL;
+
+    if (mode == REPLAY_MODE_RECORD) {
+        writer.offset = ftell(replay_file);
+        writer.buf[0] = g_malloc(REPLAY_WRITE_BUF_SIZE);
+        writer.buf[1] = g_malloc(REPLAY_WRITE_BUF_SIZE);
+        qemu_mutex_init(&writer.lock);
+        qemu_cond_init(&writer.cond);
+        qemu_thread_create(&writer.thread, "replay-writer",
+                           replay_writer_thread, NULL, QEMU_THREAD_JOINABLE);
+        writer.active = true;
+    } else if (mode == REPLAY_MODE_PLAY) {
+        reader.file = g_mapped_file_new(fname, FALSE, &err);
+        if (!reader.file) {
+            /* Not fatal, reading falls back to replay_file */
+            warn_report("Replay: could not map %s: %s", fname, err->message);
+            return;
+        }
+        reader.data = (const uint8_t *)g_mapped_file_get_contents(reader.file);
+        reader.len = g_mapped_file_get_length(reader.file);
+        reader.pos = ftell(replay_file);
+    }
+}
+
+void replay_file_stop(void)
+{
+    if (writer.active) {
+        replay_writer_submit();
+
+        qemu_mutex_lock(&writer.lock);
+        writer.quit = true;
+        qemu_cond_broadcast(&writer.cond);
+        qemu_mutex_unlock(&writer.lock);
+        qemu_thread_join(&writer.thread);
+
+        qemu_cond_destroy(&writer.cond);
+        qemu_mutex_destroy(&writer.lock);
+        g_free(writer.buf[0]);
+        g_free(writer.buf[1]);
+        memset(&writer, 0, sizeof(writer));
+    }
+
+    if (reader.file) {
+        g_mapped_file_unref(reader.file);
+        memset(&reader, 0, sizeof(reader));
+    }
+}
+
+int64_t replay_file_tell(void)
+{
+    if (writer.active) {
+        return writer.offset + writer.len;
+    }
+    if (reader.file) {
+        return reader.pos;
+    }
+    return ftell(replay_file);
+}
+
+void replay_file_seek(int64_t offset)
+{
+    /* The log is only written sequentially while recording */
+    assert(!writer.active);
+
+    if (reader.file) {
+        reader.pos = MIN((size_t)offset, reader.len);
+    } else {
+        fseek(replay_file, offset, SEEK_SET);
+    }
+}
+
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
+        if (writer.active && writer.len < REPLAY_WRITE_BUF_SIZE - 1) {
+            writer.buf[writer.cur][writer.len++] = byte;
+        } else {
+            replay_write(&byte, 1);
         }
     }
 }
@@ -82,9 +272,7 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
-        }
+        replay_write(buf, size);
     }
 }
 
@@ -92,11 +280,18 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
-            replay_read_error();
+        if (reader.file) {
+            if (reader.pos >= reader.len) {
+                replay_read_error();
+            }
+            byte = reader.data[reader.pos++];
+        } else {
+            int r = getc(replay_file);
+            if (r == EOF) {
+                replay_read_error();
+            }
+            byte = r;
         }
-        byte = r;
     }
     return byte;
 }
@@ -138,9 +333,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_read(buf, *size);
     }
 }
 
@@ -149,9 +342,7 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_read(*buf, *size);
     }
 }
 
@@ -106,6 +106,15 @@ extern uint64_t replay_break_icount;
 /* Timer for the replay breakpoint callback */
 extern QEMUTimer *replay_break_timer;
 
+/*! Starts buffered writing or mapped reading of the open replay_file. */
+void replay_file_start(const char *fname, int mode);
+/*! Writes out buffered events and stops the writer thread. */
+void replay_file_stop(void);
+/*! Returns the current position in the log. */
+int64_t replay_file_tell(void);
+/*! Moves to the specified position; not allowed while recording. */
+void replay_file_seek(int64_t offset);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
@@ -65,6 +65,9 @@ def readvar(self, size = None):
     def tell(self):
         return self.file.tell()
 
+    def seek(self, pos):
+        self.file.seek(pos, 0)
+
     # The VMSD description is at the end of the file, after EOF. Look for
     # the last NULL byte, then for the beginning brace of JSON.
     def read_migration_debug_json(self):
@@ -564,6 +567,8 @@ class MigrationDump(object):
     QEMU_VM_SUBSECTION    = 0x05
     QEMU_VM_VMDESCRIPTION = 0x06
     QEMU_VM_CONFIGURATION = 0x07
+    QEMU_VM_SECTION_PRECOPY = 0x09
+    QEMU_VM_SECTION_UNCHANGED = 0x0a
     QEMU_VM_SECTION_FOOTER= 0x7e
 
     def __init__(self, filename):
@@ -604,6 +609,9 @@ def read(self, desc_only = False, dump_memory = False, write_memory = False):
         ramargs['ignore_shared'] = False
         self.section_classes[('ram',0)][1] = ramargs
 
+        # Position of the state in QEMU_VM_SECTION_PRECOPY sections
+        precopy = {}
+
         while True:
             section_type = file.read8()
             if section_type == self.QEMU_VM_EOF:
@@ -623,6 +631,26 @@ def read(self, desc_only = False, dump_memory = False, write_memory = False):
                 section = classdesc[0](file, version_id, classdesc[1], section_key)
                 self.sections[section_id] = section
                 section.read()
+            elif section_type == self.QEMU_VM_SECTION_PRECOPY:
+                # Parsed once the description at switchover is known to apply
+                section_id = file.read32()
+                name = file.readstr()
+                instance_id = file.read32()
+                version_id = file.read32()
+                length = file.read32()
+                precopy[section_id] = ((name, instance_id), version_id,
+                                       file.tell())
+                file.seek(file.tell() + length)
+            elif section_type == self.QEMU_VM_SECTION_UNCHANGED:
+                section_id = file.read32()
+                section_key, version_id, pos = precopy[section_id]
+                classdesc = self.section_classes[section_key]
+                section = classdesc[0](file, version_id, classdesc[1], section_key)
+                self.sections[section_id] = section
+                endpos = file.tell()
+                file.seek(pos)
+                section.read()
+                file.seek(endpos)
             elif section_type == self.QEMU_VM_SECTION_PART or section_type == self.QEMU_VM_SECTION_END:
                 section_id = file.read32()
                 self.sections[section_id].read()
@@ -157,6 +157,12 @@ static StatsFilter *stats_filter(StatsTarget target, const char *names,
     }
     case STATS_TARGET_CRYPTODEV:
         break;
+    case STATS_TARGET_BLOCK:
+        break;
+    case STATS_TARGET_VIRTIO:
+    case STATS_TARGET_NET:
+    case STATS_TARGET_THROTTLE_GROUP:
+        break;
     default:
         break;
     }
@@ -229,6 +235,10 @@ void hmp_info_stats(Monitor *mon, const QDict *qdict)
         filter = stats_filter(target, names, cpu_index, provider);
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_BLOCK:
+    case STATS_TARGET_VIRTIO:
+    case STATS_TARGET_NET:
+    case STATS_TARGET_THROTTLE_GROUP:
         filter = stats_filter(target, names, -1, provider);
         break;
     default:
@@ -8,6 +8,7 @@
 #include "qemu/osdep.h"
 #include "sysemu/stats.h"
 #include "qapi/qapi-commands-stats.h"
+#include "qemu/main-loop.h"
 #include "qemu/queue.h"
 #include "qapi/error.h"
 
@@ -15,6 +16,7 @@ typedef struct StatsCallbacks {
     StatsProvider provider;
     StatRetrieveFunc *stats_cb;
     SchemaRetrieveFunc *schemas_cb;
+    bool allow_oob;
     QTAILQ_ENTRY(StatsCallbacks) next;
 } StatsCallbacks;
 
@@ -23,12 +25,14 @@ static QTAILQ_HEAD(, StatsCallbacks) stats_callbacks =
 
 void add_stats_callbacks(StatsProvider provider,
                          StatRetrieveFunc *stats_fn,
-                         SchemaRetrieveFunc *schemas_fn)
+                         SchemaRetrieveFunc *schemas_fn,
+                         bool allow_oob)
 {
     StatsCallbacks *entry = g_new(StatsCallbacks, 1);
     entry->provider = provider;
     entry->stats_cb = stats_fn;
     entry->schemas_cb = schemas_fn;
+    entry->allow_oob = allow_oob;
 
     QTAILQ_INSERT_TAIL(&stats_callbacks, entry, next);
 }
@@ -46,6 +50,25 @@ static bool invoke_stats_cb(StatsCallbacks *entry,
         if (request->provider != entry->provider) {
             return true;
         }
+    }
+
+    /*
+     * Out-of-band, the command runs in the monitor I/O thread without
+     * the BQL; only providers that can cope are asked then.
+     */
+    if (!entry->allow_oob && !bql_locked()) {
+        if (request) {
+            error_setg(errp, "Statistics from provider '%s' cannot be "
+                       "queried out-of-band",
+                       StatsProvider_str(entry->provider));
+            qapi_free_StatsResultList(*stats_results);
+            *stats_results = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    if (request) {
         if (request->has_names && !request->names) {
             return true;
         }
@@ -66,6 +89,19 @@ static bool invoke_stats_cb(StatsCallbacks *entry,
         break;
     case STATS_TARGET_CRYPTODEV:
         break;
+    case STATS_TARGET_BLOCK:
+        if (filter->u.block.has_devices) {
+            if (!filter->u.block.devices) {
+                /* No targets allowed?  Return no statistics.  */
+                return true;
+            }
+            targets = filter->u.block.devices;
+        }
+        break;
+    case STATS_TARGET_VIRTIO:
+    case STATS_TARGET_NET:
+    case STATS_TARGET_THROTTLE_GROUP:
+        break;
     default:
         abort();
     }
@@ -557,7 +557,8 @@ void qemu_cond_timedwait_bql(QemuCond *cond, int ms)
 /* signal CPU creation */
 void cpu_thread_signal_created(CPUState *cpu)
 {
-    cpu->created = true;
+    /* Pairs with the load in KVM's query-stats, which runs without BQL */
+    qatomic_store_release(&cpu->created, true);
     qemu_cond_signal(&qemu_cpu_cond);
 }
 
@@ -615,6 +615,8 @@ static struct DirtyLimitInfo *dirtylimit_query_vcpu(int cpu_index)
     info->cpu_index = cpu_index;
     info->limit_rate = dirtylimit_vcpu_get_state(cpu_index)->quota;
     info->current_rate = vcpu_dirty_rate_get(cpu_index);
+    info->throttle_us_per_full =
+        qemu_get_cpu(cpu_index)->throttle_us_per_full;
 
     return info;
 }
@@ -669,9 +671,11 @@ void hmp_info_vcpu_dirty_limit(Monitor *mon, const QDict *qdict)
 
     for (info = head; info != NULL; info = info->next) {
         monitor_printf(mon, "vcpu[%"PRIi64"], limit rate %"PRIi64 " (MB/s),"
-                            " current rate %"PRIi64 " (MB/s)\n",
+                            " current rate %"PRIi64 " (MB/s),"
+                            " throttle %"PRIu64 " (us per ring full)\n",
                             info->value->cpu_index,
                             info->value->limit_rate,
-                            info->value->current_rate);
+                            info->value->current_rate,
+                            info->value->throttle_us_per_full);
     }
 }
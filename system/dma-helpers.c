@@ -10,6 +10,7 @@
 #include "qemu/osdep.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/dma.h"
+#include "sysemu/xen.h"
 #include "trace/trace-root.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
@@ -68,6 +69,8 @@ typedef struct {
     int sg_cur_index;
     dma_addr_t sg_cur_byte;
     QEMUIOVector iov;
+    /* Guest RAM region that the last element of iov points to, or NULL */
+    MemoryRegion *iov_mr;
     QEMUBH *bh;
     DMAIOFunc *io_func;
     void *io_func_opaque;
@@ -95,6 +98,38 @@ static void dma_blk_unmap(DMAAIOCB *dbs)
                          dbs->iov.iov[i].iov_len);
     }
     qemu_iovec_reset(&dbs->iov);
+    dbs->iov_mr = NULL;
+}
+
+/*
+ * A large guest buffer is often described by many SG entries that are
+ * contiguous in host memory as well.  Merge them, so that the block layer
+ * gets a few large iovecs instead of one per SG entry.
+ *
+ * Not under Xen: every mapping there holds a lock on a mapcache entry,
+ * which is only released by unmapping that very same address.
+ */
+static void dma_blk_iov_add(DMAAIOCB *dbs, void *mem, dma_addr_t len)
+{
+    QEMUIOVector *iov = &dbs->iov;
+    MemoryRegion *mr;
+    ram_addr_t offset;
+
+    mr = xen_enabled() ? NULL : memory_region_from_host(mem, &offset);
+    if (mr && mr == dbs->iov_mr) {
+        struct iovec *last = &iov->iov[iov->niov - 1];
+
+        if (last->iov_base + last->iov_len == mem) {
+            /* The mapping of the first entry keeps the region alive */
+            memory_region_unref(mr);
+            last->iov_len += len;
+            iov->size += len;
+            return;
+        }
+    }
+
+    qemu_iovec_add(iov, mem, len);
+    dbs->iov_mr = mr;
 }
 
 static void dma_complete(DMAAIOCB *dbs, int ret)
@@ -158,7 +193,7 @@ static void dma_blk_cb(void *opaque, int ret)
         }
         if (!mem)
             break;
-        qemu_iovec_add(&dbs->iov, mem, cur_len);
+        dma_blk_iov_add(dbs, mem, cur_len);
         dbs->sg_cur_byte += cur_len;
         if (dbs->sg_cur_byte == dbs->sg->sg[dbs->sg_cur_index].len) {
             dbs->sg_cur_byte = 0;
@@ -233,6 +268,7 @@ BlockAIOCB *dma_blk_io(AioContext *ctx,
     dbs->io_func_opaque = io_func_opaque;
     dbs->bh = NULL;
     qemu_iovec_init(&dbs->iov, sg->nsg);
+    dbs->iov_mr = NULL;
     dma_blk_cb(dbs, 0);
     return &dbs->common;
 }
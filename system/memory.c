@@ -750,9 +750,8 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
 }
 
 /* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+static FlatView *render_memory_topology(MemoryRegion *mr)
 {
-    int i;
     FlatView *view;
 
     view = flatview_new(mr);
@@ -764,6 +763,13 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    return view;
+}
+
+static void flatview_build_dispatch(FlatView *view)
+{
+    int i;
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -771,11 +777,59 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
         flatview_add_to_dispatch(view, &mrs);
     }
     address_space_dispatch_compact(view->dispatch);
+}
+
+static FlatView *generate_memory_topology(MemoryRegion *mr)
+{
+    FlatView *view = render_memory_topology(mr);
+
+    flatview_build_dispatch(view);
     g_hash_table_replace(flat_views, mr, view);
 
     return view;
 }
 
+/* Unlike flatrange_equal, this also compares the dirty log masks. */
+static bool flatview_ranges_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i])
+            || a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Views are looked up by their ranges only, so that distinct roots that
+ * render alike share one view.  view->root is then merely the root that
+ * the view was first rendered for; it only matters for tracing and
+ * "info mtree", which lists the roots of all users of a view.
+ */
+static guint flatview_ranges_hash(gconstpointer key)
+{
+    const FlatView *view = key;
+    guint h = view->nr;
+    unsigned i;
+
+    for (i = 0; i < view->nr; i++) {
+        h = h * 31 + g_direct_hash(view->ranges[i].mr);
+        h = h * 31 + int128_getlo(view->ranges[i].addr.start);
+    }
+    return h;
+}
+
+static gboolean flatview_ranges_equal_func(gconstpointer a, gconstpointer b)
+{
+    return flatview_ranges_equal((FlatView *)a, (FlatView *)b);
+}
+
 static void address_space_add_del_ioeventfds(AddressSpace *as,
                                              MemoryRegionIoeventfd *fds_new,
                                              unsigned fds_new_nb,
@@ -1064,23 +1118,57 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
+    g_autoptr(GHashTable) by_ranges = NULL;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
+    /*
+     * A transaction usually touches a single device, and the views of
+     * most address spaces come out unchanged.  Also, distinct roots
+     * often render to the same ranges.  Look up every new view by its
+     * ranges among the old ones and those rendered so far, so that each
+     * distinct topology gets a single view and dispatch tree, built
+     * only when it changed.
+     */
+    by_ranges = g_hash_table_new(flatview_ranges_hash,
+                                 flatview_ranges_equal_func);
+    if (old_views) {
+        GHashTableIter iter;
+        gpointer value;
+
+        g_hash_table_iter_init(&iter, old_views);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            g_hash_table_add(by_ranges, value);
+        }
+    }
+
     /* Render unique FVs */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view, *new_view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        new_view = render_memory_topology(physmr);
+        view = g_hash_table_lookup(by_ranges, new_view);
+        if (view) {
+            flatview_unref(new_view);
+            flatview_ref(view);
+            new_view = view;
+        } else {
+            flatview_build_dispatch(new_view);
+            g_hash_table_add(by_ranges, new_view);
+        }
+        g_hash_table_replace(flat_views, physmr, new_view);
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
 }
 
@@ -1093,6 +1181,10 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
+        /* Listeners still expect to be told about every range. */
+        if (!QTAILQ_EMPTY(&as->listeners)) {
+            address_space_update_topology_pass(as, new_view, new_view, true);
+        }
         return;
     }
 
@@ -2567,6 +2659,12 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_enable_lockless_io(MemoryRegion *mr)
+{
+    mr->lockless_io = true;
+    mr->disable_reentrancy_guard = true;
+}
+
 void memory_region_add_eventfd(MemoryRegion *mr,
                                hwaddr addr,
                                unsigned size,
@@ -3465,6 +3563,7 @@ static void mtree_print_flatview(gpointer key, gpointer value,
     GArray *fv_address_spaces = value;
     struct FlatViewInfo *fvi = user_data;
     FlatRange *range = &view->ranges[0];
+    g_autoptr(GPtrArray) roots = NULL;
     MemoryRegion *mr;
     int n = view->nr;
     int i;
@@ -3483,8 +3582,26 @@ static void mtree_print_flatview(gpointer key, gpointer value,
         qemu_printf("\n");
     }
 
-    qemu_printf(" Root memory region: %s\n",
-      view->root ? memory_region_name(view->root) : "(none)");
+    /* A view is shared by all roots that render to the same ranges */
+    roots = g_ptr_array_new();
+    for (i = 0; i < fv_address_spaces->len; ++i) {
+        as = g_array_index(fv_address_spaces, AddressSpace*, i);
+        mr = memory_region_get_flatview_root(as->root);
+        if (mr && !g_ptr_array_find(roots, mr, NULL)) {
+            g_ptr_array_add(roots, mr);
+        }
+    }
+    if (!roots->len) {
+        qemu_printf(" Root memory region: %s\n",
+          view->root ? memory_region_name(view->root) : "(none)");
+    } else {
+        qemu_printf(" Root memory region%s:", roots->len > 1 ? "s" : "");
+        for (i = 0; i < roots->len; ++i) {
+            qemu_printf("%s %s", i ? "," : "",
+                        memory_region_name(g_ptr_array_index(roots, i)));
+        }
+        qemu_printf("\n");
+    }
 
     if (n <= 0) {
         qemu_printf(MTREE_INDENT "No rendered FlatView\n\n");
@@ -22,10 +22,12 @@
 #include "qapi/error.h"
 
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/cacheflush.h"
 #include "qemu/hbitmap.h"
 #include "qemu/madvise.h"
 #include "qemu/lockable.h"
+#include "qemu/coroutine-tls.h"
 
 #ifdef CONFIG_TCG
 #include "hw/core/tcg-cpu-ops.h"
@@ -2714,6 +2716,10 @@ bool prepare_mmio_access(MemoryRegion *mr)
 {
     bool release_lock = false;
 
+    if (mr->lockless_io && !mr->flush_coalesced_mmio) {
+        return false;
+    }
+
     if (!bql_locked()) {
         bql_lock();
         release_lock = true;
@@ -3089,9 +3095,79 @@ typedef struct {
     MemoryRegion *mr;
     hwaddr addr;
     size_t len;
+    /* allocated size of @buffer, at least @len */
+    size_t size;
     uint8_t buffer[];
 } BounceBuffer;
 
+/*
+ * Devices that DMA through an IOMMU or to MMIO map and unmap a bounce
+ * buffer for every request, from the thread running their AioContext.
+ * Keep a few freed buffers on each thread rather than going back to
+ * the allocator every time.  The size limit of the address space is
+ * still accounted for with bounce_buffer_size.
+ */
+#define BOUNCE_BUFFER_CACHE_ENTRIES 4
+#define BOUNCE_BUFFER_CACHE_MAX_SIZE (64 * KiB)
+
+typedef struct {
+    BounceBuffer *entries[BOUNCE_BUFFER_CACHE_ENTRIES];
+    unsigned nr;
+    Notifier exit_notifier;
+} BounceBufferCache;
+
+/* Use get_ptr_bounce_buffer_cache() to fetch this thread-local value */
+QEMU_DEFINE_STATIC_CO_TLS(BounceBufferCache, bounce_buffer_cache);
+
+static void bounce_buffer_cache_atexit(Notifier *n, void *value)
+{
+    BounceBufferCache *cache = get_ptr_bounce_buffer_cache();
+
+    while (cache->nr) {
+        g_free(cache->entries[--cache->nr]);
+    }
+}
+
+static BounceBuffer *bounce_buffer_alloc(size_t len)
+{
+    BounceBufferCache *cache = get_ptr_bounce_buffer_cache();
+    BounceBuffer *bounce;
+    unsigned i;
+
+    for (i = 0; i < cache->nr; i++) {
+        bounce = cache->entries[i];
+        if (bounce->size >= len) {
+            cache->entries[i] = cache->entries[--cache->nr];
+            return bounce;
+        }
+    }
+
+    bounce = g_malloc(len + sizeof(BounceBuffer));
+    bounce->size = len;
+    return bounce;
+}
+
+static void bounce_buffer_free(BounceBuffer *bounce)
+{
+    BounceBufferCache *cache = get_ptr_bounce_buffer_cache();
+
+    if (bounce->size > BOUNCE_BUFFER_CACHE_MAX_SIZE) {
+        g_free(bounce);
+        return;
+    }
+
+    if (!cache->exit_notifier.notify) {
+        cache->exit_notifier.notify = bounce_buffer_cache_atexit;
+        qemu_thread_atexit_add(&cache->exit_notifier);
+    }
+    if (cache->nr == BOUNCE_BUFFER_CACHE_ENTRIES) {
+        /* Evict the oldest buffer */
+        g_free(cache->entries[0]);
+        cache->entries[0] = cache->entries[--cache->nr];
+    }
+    cache->entries[cache->nr++] = bounce;
+}
+
 static void
 address_space_unregister_map_client_do(AddressSpaceMapClient *client)
 {
@@ -3266,7 +3342,7 @@ void *address_space_map(AddressSpace *as,
             return NULL;
         }
 
-        BounceBuffer *bounce = g_malloc0(l + sizeof(BounceBuffer));
+        BounceBuffer *bounce = bounce_buffer_alloc(l);
         bounce->magic = BOUNCE_BUFFER_MAGIC;
         memory_region_ref(mr);
         bounce->mr = mr;
@@ -3276,6 +3352,9 @@ void *address_space_map(AddressSpace *as,
         if (!is_write) {
             flatview_read(fv, addr, attrs,
                           bounce->buffer, l);
+        } else {
+            /* Do not leak the previous contents of a recycled buffer */
+            memset(bounce->buffer, 0, l);
         }
 
         *plen = l;
@@ -3323,7 +3402,7 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
     qatomic_sub(&as->bounce_buffer_size, bounce->len);
     bounce->magic = ~BOUNCE_BUFFER_MAGIC;
     memory_region_unref(bounce->mr);
-    g_free(bounce);
+    bounce_buffer_free(bounce);
     /* Write bounce_buffer_size before reading map_client_list. */
     smp_mb();
     address_space_notify_map_clients(as);
@@ -671,13 +671,19 @@ void mte_check_fail(CPUARMState *env, uint32_t desc,
  * uses masking to ignore adjacent tags requires 18 logical operations
  * and thus does not begin to pay off until 6 tags.
  * Which, according to the survey above, is unlikely to be common.
+ *
+ * The exception are the memory copy and set insns (FEAT_MOPS), which
+ * check up to a page worth of tags at once.  For those, whole words of
+ * 16 matching tags are skipped with a single compare.
  */
 static int checkN(uint8_t *mem, int odd, int cmp, int count)
 {
     int n = 0, diff;
+    uint64_t cmp64;
 
     /* Replicate the test tag and compare.  */
     cmp *= 0x11;
+    cmp64 = cmp * 0x0101010101010101ull;
     diff = *mem++ ^ cmp;
 
     if (odd) {
@@ -702,6 +708,15 @@ static int checkN(uint8_t *mem, int odd, int cmp, int count)
             break;
         }
 
+        /* Skip 16 tags at a time while they all match. */
+        while (count - n >= 16 && ldq_he_p(mem) == cmp64) {
+            mem += 8;
+            n += 16;
+        }
+        if (n == count) {
+            break;
+        }
+
         diff = *mem++ ^ cmp;
     }
     return n;
@@ -724,9 +739,11 @@ static int checkN(uint8_t *mem, int odd, int cmp, int count)
 static int checkNrev(uint8_t *mem, int odd, int cmp, int count)
 {
     int n = 0, diff;
+    uint64_t cmp64;
 
     /* Replicate the test tag and compare.  */
     cmp *= 0x11;
+    cmp64 = cmp * 0x0101010101010101ull;
     diff = *mem-- ^ cmp;
 
     if (!odd) {
@@ -751,6 +768,15 @@ static int checkNrev(uint8_t *mem, int odd, int cmp, int count)
             break;
         }
 
+        /* Skip 16 tags at a time while they all match. */
+        while (count - n >= 16 && ldq_he_p(mem - 7) == cmp64) {
+            mem -= 8;
+            n += 16;
+        }
+        if (n == count) {
+            break;
+        }
+
         diff = *mem-- ^ cmp;
     }
     return n;
@@ -158,17 +158,32 @@ LOGICAL_PPPP(sve_nand_pppp, DO_NAND)
 /* Fully general three-operand expander, controlled by a predicate.
  * This is complicated by the host-endian storage of the register file.
  */
-/* ??? I don't expect the compiler could ever vectorize this itself.
- * With some tables we can convert bit masks to byte masks, and with
- * extra care wrt byte/word ordering we could use gcc generic vectors
- * and do 16 bytes at a time.
+/*
+ * The predicate is tested 16 bytes at a time.  Chunks with all elements
+ * active take a branch-free loop the compiler can vectorize, chunks with
+ * no element active are skipped, and only the remaining ones are done
+ * element by element.
  */
 #define DO_ZPZZ(NAME, TYPE, H, OP)                                       \
 void HELPER(NAME)(void *vd, void *vn, void *vm, void *vg, uint32_t desc) \
 {                                                                       \
-    intptr_t i, opr_sz = simd_oprsz(desc);                              \
+    const uint16_t all = pred_esz_masks[ctz32(sizeof(TYPE))];           \
+    intptr_t i, j, opr_sz = simd_oprsz(desc);                           \
     for (i = 0; i < opr_sz; ) {                                         \
-        uint16_t pg = *(uint16_t *)(vg + H1_2(i >> 3));                 \
+        uint16_t pg = *(uint16_t *)(vg + H1_2(i >> 3)) & all;           \
+        if (pg == all) {                                                \
+            for (j = i; j < i + 16; j += sizeof(TYPE)) {                \
+                TYPE nn = *(TYPE *)(vn + H(j));                         \
+                TYPE mm = *(TYPE *)(vm + H(j));                         \
+                *(TYPE *)(vd + H(j)) = OP(nn, mm);                      \
+            }                                                           \
+            i += 16;                                                    \
+            continue;                                                   \
+        }                                                               \
+        if (pg == 0) {                                                  \
+            i += 16;                                                    \
+            continue;                                                   \
+        }                                                               \
         do {                                                            \
             if (pg & 1) {                                               \
                 TYPE nn = *(TYPE *)(vn + H(i));                         \
@@ -814,9 +829,22 @@ DO_ZPZW(sve_lsl_zpzw_s, uint32_t, uint64_t, H1_4, DO_LSL)
 #define DO_ZPZ(NAME, TYPE, H, OP)                               \
 void HELPER(NAME)(void *vd, void *vn, void *vg, uint32_t desc)  \
 {                                                               \
-    intptr_t i, opr_sz = simd_oprsz(desc);                      \
+    const uint16_t all = pred_esz_masks[ctz32(sizeof(TYPE))];   \
+    intptr_t i, j, opr_sz = simd_oprsz(desc);                   \
     for (i = 0; i < opr_sz; ) {                                 \
-        uint16_t pg = *(uint16_t *)(vg + H1_2(i >> 3));         \
+        uint16_t pg = *(uint16_t *)(vg + H1_2(i >> 3)) & all;   \
+        if (pg == all) {                                        \
+            for (j = i; j < i + 16; j += sizeof(TYPE)) {        \
+                TYPE nn = *(TYPE *)(vn + H(j));                 \
+                *(TYPE *)(vd + H(j)) = OP(nn);                  \
+            }                                                   \
+            i += 16;                                            \
+            continue;                                           \
+        }                                                       \
+        if (pg == 0) {                                          \
+            i += 16;                                            \
+            continue;                                           \
+        }                                                       \
         do {                                                    \
             if (pg & 1) {                                       \
                 TYPE nn = *(TYPE *)(vn + H(i));                 \
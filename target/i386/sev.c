@@ -1126,7 +1126,22 @@ sev_launch_finish(SevCommonState *sev_common)
 static int
 snp_launch_update_data(uint64_t gpa, void *hva, size_t len, int type)
 {
-    SevLaunchUpdateData *data;
+    SevLaunchUpdateData *data = QTAILQ_LAST(&launch_update);
+
+    /*
+     * Pages are measured in the order they are updated, so extending the
+     * previous range with a contiguous one does not change the launch
+     * digest, but saves a memory attribute update and LAUNCH_UPDATE call.
+     * CPUID and secrets pages are kept separate for error reporting.
+     */
+    if (data && data->type == type &&
+        (type == KVM_SEV_SNP_PAGE_TYPE_NORMAL ||
+         type == KVM_SEV_SNP_PAGE_TYPE_ZERO) &&
+        data->gpa + data->len == gpa &&
+        (uint8_t *)data->hva + data->len == hva) {
+        data->len += len;
+        return 0;
+    }
 
     data = g_new0(SevLaunchUpdateData, 1);
     data->gpa = gpa;
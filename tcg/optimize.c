@@ -2792,6 +2792,111 @@ static bool fold_bitsel_vec(OptContext *ctx, TCGOp *op)
     return false;
 }
 
+/*
+ * Stores to env that are overwritten before anything can observe them.
+ * A store is observed by a load of env that overlaps it, by any access
+ * through another pointer (which may point into env), by calls and
+ * guest memory accesses (which may read env or raise an exception),
+ * and at the end of a basic block.
+ */
+#define MAX_PENDING_ENV_STORES 8
+
+static intptr_t env_access_size(TCGOp *op)
+{
+    switch (op->opc) {
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st_i32:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    case INDEX_op_ld_vec:
+    case INDEX_op_st_vec:
+    case INDEX_op_dupm_vec:
+        return tcg_type_size(TCG_TYPE_V64 + TCGOP_VECL(op));
+    default:
+        return 0;
+    }
+}
+
+static void remove_dead_env_stores(TCGContext *s)
+{
+    struct {
+        TCGOp *op;
+        intptr_t start, last;
+    } pending[MAX_PENDING_ENV_STORES];
+    int nb_pending = 0;
+    TCGOp *op;
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        const TCGOpDef *def = &tcg_op_defs[op->opc];
+        intptr_t size = env_access_size(op);
+        intptr_t start, last;
+        int i, j;
+
+        if (!size) {
+            if (op->opc == INDEX_op_call || op->opc == INDEX_op_mb ||
+                op->opc == INDEX_op_plugin_cb ||
+                op->opc == INDEX_op_plugin_mem_cb ||
+                (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS |
+                               TCG_OPF_CALL_CLOBBER))) {
+                nb_pending = 0;
+            }
+            continue;
+        }
+
+        if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+            nb_pending = 0;
+            continue;
+        }
+
+        start = op->args[2];
+        last = start + size - 1;
+
+        if (def->nb_oargs) {
+            /* A load: drop the stores it reads from. */
+            for (i = j = 0; i < nb_pending; i++) {
+                if (pending[i].last < start || pending[i].start > last) {
+                    pending[j++] = pending[i];
+                }
+            }
+            nb_pending = j;
+            continue;
+        }
+
+        /* A store: the ones it covers entirely are dead. */
+        for (i = j = 0; i < nb_pending; i++) {
+            if (pending[i].start >= start && pending[i].last <= last) {
+                tcg_op_remove(s, pending[i].op);
+            } else {
+                pending[j++] = pending[i];
+            }
+        }
+        nb_pending = j;
+
+        if (nb_pending == MAX_PENDING_ENV_STORES) {
+            memmove(&pending[0], &pending[1],
+                    sizeof(pending[0]) * (MAX_PENDING_ENV_STORES - 1));
+            nb_pending--;
+        }
+        pending[nb_pending].op = op;
+        pending[nb_pending].start = start;
+        pending[nb_pending].last = last;
+        nb_pending++;
+    }
+}
+
 /* Propagate constants and copies, fold constant expressions. */
 void tcg_optimize(TCGContext *s)
 {
@@ -3045,4 +3150,6 @@ void tcg_optimize(TCGContext *s)
             finish_folding(&ctx, op);
         }
     }
+
+    remove_dead_env_stores(s);
 }
@@ -29,6 +29,7 @@
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/qtree.h"
+#include "qemu/bitmap.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
 #include "exec/translation-block.h"
@@ -57,6 +58,10 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Host memory for the buffer is placed on the NUMA node of the thread that
+ * first touches it, so a context is preferably handed back the regions it
+ * has been using: their pages are then likely local to the vCPU thread.
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -70,8 +75,10 @@ struct tcg_region_state {
     size_t total_size; /* size of entire buffer, >= n * stride */
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
+    size_t current; /* number of regions in use */
     size_t agg_size_full; /* aggregate size of full regions */
+    unsigned long *used; /* bitmap of the regions in use */
+    TCGContext **owner; /* last context that used each region */
 };
 
 static struct tcg_region_state region;
@@ -357,12 +364,42 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     s->code_gen_highwater = end - TCG_HIGHWATER;
 }
 
+/*
+ * Pick a free region for @s: first one that @s has used before, then one
+ * that no context has used yet, then any.
+ */
+static size_t tcg_region_find__locked(TCGContext *s)
+{
+    size_t i, fresh = region.n;
+
+    for (i = 0; i < region.n; i++) {
+        if (test_bit(i, region.used)) {
+            continue;
+        }
+        if (region.owner[i] == s) {
+            return i;
+        }
+        if (!region.owner[i] && fresh == region.n) {
+            fresh = i;
+        }
+    }
+    if (fresh != region.n) {
+        return fresh;
+    }
+    return find_first_zero_bit(region.used, region.n);
+}
+
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
+    size_t i;
+
     if (region.current == region.n) {
         return true;
     }
-    tcg_region_assign(s, region.current);
+    i = tcg_region_find__locked(s);
+    set_bit(i, region.used);
+    region.owner[i] = s;
+    tcg_region_assign(s, i);
     region.current++;
     return false;
 }
@@ -412,6 +449,7 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    bitmap_zero(region.used, region.n);
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -788,6 +826,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      * the buffer; we will assign those to the last region.
      */
     region.n = tcg_n_regions(tb_size, max_cpus);
+    region.used = bitmap_new(region.n);
+    region.owner = g_new0(TCGContext *, region.n);
     region_size = tb_size / region.n;
     region_size = QEMU_ALIGN_DOWN(region_size, page_size);
 
@@ -0,0 +1,134 @@
+/*
+ * QEMU block layer speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "block/block.h"
+#include "block/thread-pool.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/coroutine.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qemu/throttle.h"
+#include "qemu/units.h"
+#include "sysemu/block-backend.h"
+
+#define BENCH_REQ_SIZE  (4 * KiB)
+
+typedef struct BlockBench {
+    BlockBackend *blk;
+    uint64_t ops;
+    bool done;
+} BlockBench;
+
+static int noop_worker(void *opaque)
+{
+    return 0;
+}
+
+static void coroutine_fn thread_pool_bench_co(void *opaque)
+{
+    BlockBench *b = opaque;
+
+    g_test_timer_start();
+    do {
+        thread_pool_submit_co(noop_worker, NULL);
+        b->ops++;
+    } while (g_test_timer_elapsed() < 0.5);
+    b->done = true;
+}
+
+static void coroutine_fn preadv_bench_co(void *opaque)
+{
+    BlockBench *b = opaque;
+    void *buf = g_malloc(BENCH_REQ_SIZE);
+    QEMUIOVector qiov;
+    int64_t size = blk_co_getlength(b->blk);
+
+    qemu_iovec_init_buf(&qiov, buf, BENCH_REQ_SIZE);
+    g_test_timer_start();
+    do {
+        int64_t offset = (b->ops * BENCH_REQ_SIZE) % size;
+
+        g_assert(blk_co_preadv(b->blk, offset, BENCH_REQ_SIZE, &qiov, 0) == 0);
+        b->ops++;
+    } while (g_test_timer_elapsed() < 0.5);
+    b->done = true;
+    g_free(buf);
+}
+
+static void bench_run(CoroutineEntry *entry, BlockBench *b)
+{
+    Coroutine *co = qemu_coroutine_create(entry, b);
+
+    qemu_coroutine_enter(co);
+    while (!b->done) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+}
+
+/* Round trip from a coroutine to a pool worker and back */
+static void test_thread_pool(const void *opaque)
+{
+    BlockBench b = {};
+
+    bench_run(thread_pool_bench_co, &b);
+    g_test_minimized_result(g_test_timer_last() * 1e9 / b.ops,
+                            "thread_pool_submit_co: %8.1f ns/op",
+                            g_test_timer_last() * 1e9 / b.ops);
+}
+
+static void test_null_preadv(const void *opaque)
+{
+    bool throttled = GPOINTER_TO_INT(opaque);
+    BlockBench b = {};
+    QDict *options = qdict_new();
+
+    qdict_put_str(options, "driver", "null-co");
+    qdict_put_str(options, "size", "1G");
+    b.blk = blk_new_open(NULL, NULL, options, 0, &error_abort);
+
+    if (throttled) {
+        ThrottleConfig cfg;
+
+        /* Limits high enough never to delay, only account */
+        throttle_config_init(&cfg);
+        cfg.buckets[THROTTLE_OPS_TOTAL].avg = THROTTLE_VALUE_MAX;
+        cfg.buckets[THROTTLE_BPS_TOTAL].avg = THROTTLE_VALUE_MAX;
+        blk_io_limits_enable(b.blk, "bench");
+        blk_set_io_limits(b.blk, &cfg);
+    }
+
+    bench_run(preadv_bench_co, &b);
+    g_test_maximized_result(b.ops / g_test_timer_last(),
+                            "blk_co_preadv null-co%s: %zuKB %10.0f IOPS",
+                            throttled ? " throttled" : "",
+                            (size_t)(BENCH_REQ_SIZE / KiB),
+                            b.ops / g_test_timer_last());
+
+    if (throttled) {
+        blk_io_limits_disable(b.blk);
+    }
+    blk_unref(b.blk);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+    module_call_init(MODULE_INIT_QOM);
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/block/thread-pool/submit-co/speed", NULL,
+                         test_thread_pool);
+    g_test_add_data_func("/block/null-co/preadv/speed", GINT_TO_POINTER(false),
+                         test_null_preadv);
+    g_test_add_data_func("/block/null-co/preadv-throttled/speed",
+                         GINT_TO_POINTER(true), test_null_preadv);
+    return g_test_run();
+}
@@ -0,0 +1,126 @@
+/*
+ * QEMU I/O vector speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "qemu/units.h"
+
+#define BENCH_NIOV      64
+#define BENCH_IOV_LEN   (4 * KiB)
+#define BENCH_SIZE      (BENCH_NIOV * BENCH_IOV_LEN)
+
+typedef struct IovBench {
+    void *chunks[BENCH_NIOV];
+    void *buf;
+    QEMUIOVector qiov;
+} IovBench;
+
+static void iov_bench_init(IovBench *b)
+{
+    int i;
+
+    qemu_iovec_init(&b->qiov, BENCH_NIOV);
+    for (i = 0; i < BENCH_NIOV; i++) {
+        b->chunks[i] = g_malloc0(BENCH_IOV_LEN);
+        qemu_iovec_add(&b->qiov, b->chunks[i], BENCH_IOV_LEN);
+    }
+    b->buf = g_malloc0(BENCH_SIZE);
+}
+
+static void iov_bench_cleanup(IovBench *b)
+{
+    int i;
+
+    qemu_iovec_destroy(&b->qiov);
+    for (i = 0; i < BENCH_NIOV; i++) {
+        g_free(b->chunks[i]);
+    }
+    g_free(b->buf);
+}
+
+static void test_copy(const void *opaque)
+{
+    bool to_buf = GPOINTER_TO_INT(opaque);
+    IovBench b;
+    double total = 0.0;
+
+    iov_bench_init(&b);
+    g_test_timer_start();
+    do {
+        if (to_buf) {
+            qemu_iovec_to_buf(&b.qiov, 0, b.buf, BENCH_SIZE);
+        } else {
+            qemu_iovec_from_buf(&b.qiov, 0, b.buf, BENCH_SIZE);
+        }
+        total += BENCH_SIZE;
+    } while (g_test_timer_elapsed() < 0.5);
+
+    total /= MiB;
+    g_test_maximized_result(total / g_test_timer_last(),
+                            "qemu_iovec_%s_buf: %d x %zuKB %8.0f MB/sec",
+                            to_buf ? "to" : "from", BENCH_NIOV,
+                            (size_t)(BENCH_IOV_LEN / KiB),
+                            total / g_test_timer_last());
+    iov_bench_cleanup(&b);
+}
+
+static void test_is_zero(const void *opaque)
+{
+    IovBench b;
+    double total = 0.0;
+
+    iov_bench_init(&b);
+    g_test_timer_start();
+    do {
+        g_assert(qemu_iovec_is_zero(&b.qiov, 0, BENCH_SIZE));
+        total += BENCH_SIZE;
+    } while (g_test_timer_elapsed() < 0.5);
+
+    total /= MiB;
+    g_test_maximized_result(total / g_test_timer_last(),
+                            "qemu_iovec_is_zero: %d x %zuKB %8.0f MB/sec",
+                            BENCH_NIOV, (size_t)(BENCH_IOV_LEN / KiB),
+                            total / g_test_timer_last());
+    iov_bench_cleanup(&b);
+}
+
+/* Unaligned slices as block drivers build them when splitting requests */
+static void test_concat(const void *opaque)
+{
+    IovBench b;
+    QEMUIOVector dst;
+    uint64_t ops = 0;
+
+    iov_bench_init(&b);
+    qemu_iovec_init(&dst, BENCH_NIOV);
+    g_test_timer_start();
+    do {
+        qemu_iovec_reset(&dst);
+        qemu_iovec_concat(&dst, &b.qiov, 512 + (ops % BENCH_IOV_LEN),
+                          BENCH_SIZE / 2);
+        ops++;
+    } while (g_test_timer_elapsed() < 0.5);
+
+    g_test_minimized_result(g_test_timer_last() * 1e9 / ops,
+                            "qemu_iovec_concat: %zuKB slice %8.1f ns/op",
+                            (size_t)(BENCH_SIZE / 2 / KiB),
+                            g_test_timer_last() * 1e9 / ops);
+    qemu_iovec_destroy(&dst);
+    iov_bench_cleanup(&b);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/iov/to-buf/speed", GINT_TO_POINTER(true),
+                         test_copy);
+    g_test_add_data_func("/iov/from-buf/speed", GINT_TO_POINTER(false),
+                         test_copy);
+    g_test_add_data_func("/iov/is-zero/speed", NULL, test_is_zero);
+    g_test_add_data_func("/iov/concat/speed", NULL, test_concat);
+    return g_test_run();
+}
@@ -136,6 +136,37 @@ def __init__(self, name, scenarios):
                  multifd=True, multifd_channels=64),
     ]),
 
+    # Looking at effect of multifd with
+    # varying compression methods
+    Comparison("compr-multifd-method", scenarios = [
+        Scenario("compr-multifd-method-none",
+                 multifd=True, multifd_compression="none"),
+        Scenario("compr-multifd-method-zlib",
+                 multifd=True, multifd_compression="zlib"),
+        Scenario("compr-multifd-method-zstd",
+                 multifd=True, multifd_compression="zstd"),
+    ]),
+
+    # Looking at effect of where zero pages
+    # are detected
+    Comparison("zero-page", scenarios = [
+        Scenario("zero-page-none",
+                 multifd=True, zero_page_detection="none"),
+        Scenario("zero-page-legacy",
+                 multifd=True, zero_page_detection="legacy"),
+        Scenario("zero-page-multifd",
+                 multifd=True, zero_page_detection="multifd"),
+    ]),
+
+    # Looking at effect of the size of the
+    # guest's working set
+    Comparison("hot-set", scenarios = [
+        Scenario("hot-set-10", hot_set=10),
+        Scenario("hot-set-25", hot_set=25),
+        Scenario("hot-set-50", hot_set=50),
+        Scenario("hot-set-100", hot_set=100),
+    ]),
+
     # Looking at effect of dirty-limit with
     # varying x_vcpu_dirty_limit_period
     Comparison("compr-dirty-limit-period", scenarios = [
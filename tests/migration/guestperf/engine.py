@@ -41,7 +41,7 @@ def __init__(self, binary, dst_host, kernel, initrd, transport="tcp",
         self._dst_host = dst_host # Hostname of target host
         self._kernel = kernel # Path to kernel image
         self._initrd = initrd # Path to stress initrd
-        self._transport = transport # 'unix' or 'tcp' or 'rdma'
+        self._transport = transport # 'unix', 'tcp', 'rdma' or 'file'
         self._sleep = sleep
         self._verbose = verbose
         self._debug = debug
@@ -205,6 +205,29 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
             resp = dst.cmd("migrate-set-parameters",
                            multifd_channels=scenario._multifd_channels)
 
+        if scenario._multifd:
+            resp = src.cmd("migrate-set-parameters",
+                           multifd_compression=scenario._multifd_compression)
+            resp = dst.cmd("migrate-set-parameters",
+                           multifd_compression=scenario._multifd_compression)
+
+        resp = src.cmd("migrate-set-parameters",
+                       zero_page_detection=scenario._zero_page_detection)
+
+        if scenario._mapped_ram:
+            if self._transport != "file":
+                raise Exception("mapped-ram needs the file transport")
+            resp = src.cmd("migrate-set-capabilities",
+                           capabilities = [
+                               { "capability": "mapped-ram",
+                                 "state": True }
+                           ])
+            resp = dst.cmd("migrate-set-capabilities",
+                           capabilities = [
+                               { "capability": "mapped-ram",
+                                 "state": True }
+                           ])
+
         if scenario._dirty_limit:
             if not hardware._dirty_ring_size:
                 raise Exception("dirty ring size must be configured when "
@@ -244,6 +267,9 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                 progress_history.append(progress)
 
             if progress._status in ("completed", "failed", "cancelled"):
+                if progress._status == "completed" and self._transport == "file":
+                    # The destination can only start once the file is complete
+                    self._migrate_incoming(dst, connect_uri)
                 if progress._status == "completed" and paused:
                     dst.cmd("cont")
                 if progress_history[-1] != progress:
@@ -298,6 +324,18 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                 resp = src.cmd("stop")
                 paused = True
 
+    def _migrate_incoming(self, dst, uri):
+        if self._verbose:
+            print("Loading migration file on destination")
+        dst.cmd("migrate-incoming", uri=uri)
+        while True:
+            time.sleep(0.05)
+            status = dst.cmd("query-migrate").get("status")
+            if status == "completed":
+                return
+            if status in ("failed", "cancelled"):
+                raise Exception("Loading migration file failed")
+
     def _is_ppc64le(self):
         _, _, _, _, machine = os.uname()
         if machine == "ppc64le":
@@ -318,7 +356,7 @@ def _get_qemu_serial_args(self):
             return ["-chardev", "stdio,id=cdev0",
                     "-device", "isa-serial,chardev=cdev0"]
 
-    def _get_common_args(self, hardware, tunnelled=False):
+    def _get_common_args(self, hardware, scenario, tunnelled=False):
         args = [
             "noapic",
             "edd=off",
@@ -336,6 +374,7 @@ def _get_common_args(self, hardware, tunnelled=False):
             args.append("quiet")
 
         args.append("ramsize=%s" % hardware._mem)
+        args.append("hotset=%s" % scenario._hot_set)
 
         cmdline = " ".join(args)
         if tunnelled:
@@ -370,14 +409,16 @@ def _get_common_args(self, hardware, tunnelled=False):
 
         return argv
 
-    def _get_src_args(self, hardware):
-        return self._get_common_args(hardware)
+    def _get_src_args(self, hardware, scenario):
+        return self._get_common_args(hardware, scenario)
 
-    def _get_dst_args(self, hardware, uri):
+    def _get_dst_args(self, hardware, scenario, uri):
         tunnelled = False
         if self._dst_host != "localhost":
             tunnelled = True
-        argv = self._get_common_args(hardware, tunnelled)
+        argv = self._get_common_args(hardware, scenario, tunnelled)
+        if self._transport == "file":
+            return argv + ["-incoming", "defer"]
         return argv + ["-incoming", uri]
 
     @staticmethod
@@ -438,6 +479,10 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
                 os.remove(monaddr)
             except:
                 pass
+        elif self._transport == "file":
+            if self._dst_host != "localhost":
+                raise Exception("Running use file migration transport for non-local host")
+            uri = "file:/var/tmp/qemu-migrate-%d.img" % os.getpid()
 
         if self._dst_host != "localhost":
             dstmonaddr = ("localhost", 9001)
@@ -446,13 +491,13 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
         srcmonaddr = "/var/tmp/qemu-src-%d-monitor.sock" % os.getpid()
 
         src = QEMUMachine(self._binary,
-                          args=self._get_src_args(hardware),
+                          args=self._get_src_args(hardware, scenario),
                           wrapper=self._get_src_wrapper(hardware),
                           name="qemu-src-%d" % os.getpid(),
                           monitor_address=srcmonaddr)
 
         dst = QEMUMachine(self._binary,
-                          args=self._get_dst_args(hardware, uri),
+                          args=self._get_dst_args(hardware, scenario, uri),
                           wrapper=self._get_dst_wrapper(hardware),
                           name="qemu-dst-%d" % os.getpid(),
                           monitor_address=dstmonaddr)
@@ -465,7 +510,7 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
             progress_history = ret[0]
             qemu_timings = ret[1]
             vcpu_timings = ret[2]
-            if uri[0:5] == "unix:" and os.path.exists(uri[5:]):
+            if uri[0:5] in ("unix:", "file:") and os.path.exists(uri[5:]):
                 os.remove(uri[5:])
 
             if os.path.exists(srcmonaddr):
@@ -32,7 +32,11 @@ def __init__(self, name,
                  compression_xbzrle=False, compression_xbzrle_cache=10,
                  multifd=False, multifd_channels=2,
                  dirty_limit=False, x_vcpu_dirty_limit_period=500,
-                 vcpu_dirty_limit=1):
+                 vcpu_dirty_limit=1,
+                 multifd_compression="none",
+                 zero_page_detection="multifd",
+                 mapped_ram=False,
+                 hot_set=100):
 
         self._name = name
 
@@ -66,6 +70,15 @@ def __init__(self, name,
         self._x_vcpu_dirty_limit_period = x_vcpu_dirty_limit_period
         self._vcpu_dirty_limit = vcpu_dirty_limit
 
+        self._multifd_compression = multifd_compression
+        self._zero_page_detection = zero_page_detection
+
+        # Only with the 'file' transport
+        self._mapped_ram = mapped_ram
+
+        # Guest workload
+        self._hot_set = hot_set # percentage of guest RAM kept dirty
+
     def serialize(self):
         return {
             "name": self._name,
@@ -88,6 +101,10 @@ def serialize(self):
             "dirty_limit": self._dirty_limit,
             "x_vcpu_dirty_limit_period": self._x_vcpu_dirty_limit_period,
             "vcpu_dirty_limit": self._vcpu_dirty_limit,
+            "multifd_compression": self._multifd_compression,
+            "zero_page_detection": self._zero_page_detection,
+            "mapped_ram": self._mapped_ram,
+            "hot_set": self._hot_set,
         }
 
     @classmethod
@@ -109,4 +126,11 @@ def deserialize(cls, data):
             data["compression_xbzrle"],
             data["compression_xbzrle_cache"],
             data["multifd"],
-            data["multifd_channels"])
+            data["multifd_channels"],
+            data.get("dirty_limit", False),
+            data.get("x_vcpu_dirty_limit_period", 500),
+            data.get("vcpu_dirty_limit", 1),
+            data.get("multifd_compression", "none"),
+            data.get("zero_page_detection", "multifd"),
+            data.get("mapped_ram", False),
+            data.get("hot_set", 100))
@@ -142,6 +142,18 @@ def __init__(self):
                             dest="vcpu_dirty_limit",
                             default=1, type=int)
 
+        parser.add_argument("--multifd-compression",
+                            dest="multifd_compression",
+                            default="none")
+        parser.add_argument("--zero-page-detection",
+                            dest="zero_page_detection",
+                            default="multifd")
+        parser.add_argument("--mapped-ram", dest="mapped_ram",
+                            default=False, action="store_true")
+
+        parser.add_argument("--hot-set", dest="hot_set",
+                            default=100, type=int)
+
     def get_scenario(self, args):
         return Scenario(name="perfreport",
                         downtime=args.downtime,
@@ -170,7 +182,13 @@ def get_scenario(self, args):
                         dirty_limit=args.dirty_limit,
                         x_vcpu_dirty_limit_period=\
                             args.x_vcpu_dirty_limit_period,
-                        vcpu_dirty_limit=args.vcpu_dirty_limit)
+                        vcpu_dirty_limit=args.vcpu_dirty_limit,
+
+                        multifd_compression=args.multifd_compression,
+                        zero_page_detection=args.zero_page_detection,
+                        mapped_ram=args.mapped_ram,
+
+                        hot_set=args.hot_set)
 
     def run(self, argv):
         args = self._parser.parse_args(argv)
@@ -27,6 +27,9 @@
 
 const char *argv0;
 
+/* Percentage of each thread's RAM that keeps getting dirtied */
+static unsigned long long hotsetPct = 100;
+
 #define RAM_PAGE_SIZE 4096
 
 #ifndef CONFIG_GETTID
@@ -165,6 +168,7 @@ static void stressone(unsigned long long ramsizeMB)
     g_autofree char *data = g_malloc(RAM_PAGE_SIZE);
     char *dataptr;
     size_t nMB = 0;
+    size_t hotMB = MAX(ramsizeMB * hotsetPct / 100, 1);
     unsigned long long before, after;
 
     /* We don't care about initial state, but we do want
@@ -183,7 +187,7 @@ static void stressone(unsigned long long ramsizeMB)
     while (1) {
 
         ramptr = ram;
-        for (i = 0; i < ramsizeMB; i++, nMB++) {
+        for (i = 0; i < hotMB; i++, nMB++) {
             for (j = 0; j < pagesPerMB; j++) {
                 dataptr = data;
                 for (k = 0; k < RAM_PAGE_SIZE; k += sizeof(long long)) {
@@ -266,11 +270,12 @@ int main(int argc, char **argv)
     char *end;
     int ch;
     int opt_ind = 0;
-    const char *sopt = "hr:c:";
+    const char *sopt = "hr:c:s:";
     struct option lopt[] = {
         { "help", no_argument, NULL, 'h' },
         { "ramsize", required_argument, NULL, 'r' },
         { "cpus", required_argument, NULL, 'c' },
+        { "hotset", required_argument, NULL, 's' },
         { NULL, 0, NULL, 0 }
     };
     int ret;
@@ -300,9 +305,20 @@ int main(int argc, char **argv)
             }
             break;
 
+        case 's':
+            errno = 0;
+            hotsetPct = strtoll(optarg, &end, 10);
+            if (errno != 0 || *end || hotsetPct > 100) {
+                fprintf(stderr, "%s (%05d): ERROR: Cannot parse hot set %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
         case '?':
         case 'h':
-            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]\n", argv0);
+            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N][--hotset PCT]\n",
+                    argv0);
             exit_failure();
         }
     }
@@ -314,13 +330,17 @@ int main(int argc, char **argv)
         ret = get_command_arg_ull("ramsize", &ramsizeGB);
         if (ret < 0)
             exit_failure();
+
+        ret = get_command_arg_ull("hotset", &hotsetPct);
+        if (ret < 0 || hotsetPct > 100)
+            exit_failure();
     }
 
     if (ncpus == 0)
         ncpus = sysconf(_SC_NPROCESSORS_ONLN);
 
-    fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs\n",
-            argv0, gettid(), ramsizeGB, ncpus);
+    fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs, "
+            "%llu%% hot\n", argv0, gettid(), ramsizeGB, ncpus, hotsetPct);
 
     stress(ramsizeGB, ncpus);
 
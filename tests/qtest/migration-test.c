@@ -66,6 +66,9 @@ static QTestMigrationState dst_state;
 #define ANALYZE_SCRIPT "scripts/analyze-migration.py"
 
 #define QEMU_VM_FILE_MAGIC 0x5145564d
+#define QEMU_VM_SECTION_PRECOPY 0x09
+#define QEMU_VM_SECTION_UNCHANGED 0x0a
+#define QEMU_VM_SECTION_FOOTER 0x7e
 #define FILE_TEST_FILENAME "migfile"
 #define FILE_TEST_OFFSET 0x1000
 #define FILE_TEST_MARKER 'X'
@@ -1358,6 +1361,34 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void *
+test_migrate_postcopy_prefetch_start(QTestState *from,
+                                     QTestState *to)
+{
+    migrate_set_parameter_int(from, "postcopy-prefetch-pages", 16);
+
+    return NULL;
+}
+
+static void test_postcopy_prefetch(void)
+{
+    MigrateCommon args = {
+        .start_hook = test_migrate_postcopy_prefetch_start,
+    };
+
+    test_postcopy_common(&args);
+}
+
+static void test_postcopy_preempt_prefetch(void)
+{
+    MigrateCommon args = {
+        .postcopy_preempt = true,
+        .start_hook = test_migrate_postcopy_prefetch_start,
+    };
+
+    test_postcopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_postcopy_tls_psk(void)
 {
@@ -2083,6 +2114,138 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_defer_hot_pages_start(QTestState *from,
+                                   QTestState *to)
+{
+    migrate_set_capability(from, "defer-hot-pages", true);
+
+    return NULL;
+}
+
+static void test_precopy_unix_defer_hot_pages(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_migrate_defer_hot_pages_start,
+        /* Pages only become hot after the first round */
+        .iterations = 2,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void *
+test_migrate_device_state_precopy_start(QTestState *from,
+                                        QTestState *to)
+{
+    migrate_set_capability(from, "device-state-precopy", true);
+    migrate_set_capability(to, "device-state-precopy", true);
+
+    return NULL;
+}
+
+static void test_precopy_unix_device_state_precopy(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_migrate_device_state_precopy_start,
+    };
+
+    test_precopy_common(&args);
+}
+
+/*
+ * The q35 host bridge sends its state during setup.  With the source
+ * stopped, it cannot change before switchover, where only the marker
+ * that the destination should load its copy must follow.
+ */
+static void test_migrate_device_state_precopy_file_finish(QTestState *from,
+                                                          QTestState *to,
+                                                          void *opaque)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", tmpfs,
+                                            FILE_TEST_FILENAME);
+    static const char idstr[] = "\3mch";
+    g_autofree char *data = NULL;
+    uint32_t section_id;
+    gsize len, i, j;
+
+    g_assert(g_file_get_contents(path, &data, &len, NULL));
+
+    /* Section type, section ID, then the ID string */
+    for (i = 5; i + 4 <= len; i++) {
+        if (data[i - 5] == QEMU_VM_SECTION_PRECOPY &&
+            !memcmp(data + i, idstr, 4)) {
+            break;
+        }
+    }
+    g_assert_cmpint(i + 4, <=, len);
+    section_id = ldl_be_p(data + i - 4);
+
+    /* Section type and ID, directly followed by the footer */
+    for (j = i; j + 10 <= len; j++) {
+        if (data[j] == QEMU_VM_SECTION_UNCHANGED &&
+            ldl_be_p(data + j + 1) == section_id &&
+            data[j + 5] == QEMU_VM_SECTION_FOOTER &&
+            ldl_be_p(data + j + 6) == section_id) {
+            break;
+        }
+    }
+    g_assert_cmpint(j + 10, <=, len);
+}
+
+static void test_precopy_file_device_state_precopy(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_migrate_device_state_precopy_start,
+        .finish_hook = test_migrate_device_state_precopy_file_finish,
+    };
+
+    test_file_common(&args, true);
+}
+
+static void test_migrate_downtime_breakdown_finish(QTestState *from,
+                                                  QTestState *to,
+                                                  void *opaque)
+{
+    QDict *rsp, *breakdown;
+
+    rsp = migrate_query(from);
+    breakdown = qdict_get_qdict(rsp, "downtime-breakdown");
+    g_assert(breakdown);
+    g_assert(qdict_haskey(breakdown, "non-iterable-save"));
+    g_assert(qdict_haskey(breakdown, "devices"));
+    qobject_unref(rsp);
+
+    rsp = migrate_query(to);
+    breakdown = qdict_get_qdict(rsp, "downtime-breakdown");
+    g_assert(breakdown);
+    g_assert(qdict_haskey(breakdown, "device-load"));
+    qobject_unref(rsp);
+}
+
+static void test_precopy_unix_downtime_breakdown(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .finish_hook = test_migrate_downtime_breakdown_finish,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void test_precopy_file(void)
 {
     g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
@@ -2228,6 +2391,28 @@ static void test_precopy_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+static void *migrate_mapped_ram_lazy_load_start(QTestState *from,
+                                                QTestState *to)
+{
+    migrate_mapped_ram_start(from, to);
+    migrate_set_capability(to, "mapped-ram-lazy-load", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_mapped_ram_lazy_load(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_lazy_load_start,
+    };
+
+    test_file_common(&args, true);
+}
+
 static void *migrate_multifd_mapped_ram_start(QTestState *from, QTestState *to)
 {
     migrate_mapped_ram_start(from, to);
@@ -2908,6 +3093,15 @@ test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zlib");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_xbzrle_start(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_set_parameter_int(from, "xbzrle-cache-size", 33554432);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "xbzrle");
+}
+
 #ifdef CONFIG_ZSTD
 static void *
 test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
@@ -3018,6 +3212,38 @@ static void test_multifd_tcp_zlib(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_zlib_adaptive_start(QTestState *from,
+                                                     QTestState *to)
+{
+    void *data = test_migrate_precopy_tcp_multifd_zlib_start(from, to);
+
+    migrate_set_capability(from, "multifd-zlib-adaptive", true);
+
+    return data;
+}
+
+static void test_multifd_tcp_zlib_adaptive(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zlib_adaptive_start,
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_xbzrle_start,
+        /* Make sure later iterations are delta encoded */
+        .iterations = 2,
+    };
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
@@ -3308,6 +3534,71 @@ static void test_multifd_tcp_cancel(void)
     test_migrate_end(from, to2, true);
 }
 
+/*
+ * Connect a fake multifd channel to the destination and announce a device
+ * state packet that is far too large: the destination must drop the
+ * channel instead of allocating the memory and waiting for the data.
+ */
+static void test_multifd_unix_device_state_oversized(void)
+{
+    struct {
+        uint32_t magic;
+        uint32_t version;
+        unsigned char uuid[16];
+        uint8_t id;
+        uint8_t unused1[7];
+        uint64_t unused2[4];
+    } QEMU_PACKED init = {
+        .magic = cpu_to_be32(0x11223344),
+        .version = cpu_to_be32(1),
+    };
+    struct {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t flags;
+        char idstr[256];
+        uint32_t instance_id;
+        uint32_t next_packet_size;
+    } QEMU_PACKED packet = {
+        .magic = cpu_to_be32(0x11223344),
+        .version = cpu_to_be32(1),
+        .flags = cpu_to_be32(1 << 6),   /* MULTIFD_FLAG_DEVICE_STATE */
+        .idstr = "fake-device",
+        .next_packet_size = cpu_to_be32(UINT32_MAX),
+    };
+    MigrateStart args = {
+        .hide_stderr = true,
+    };
+    g_autofree char *path = g_strdup_printf("%s/migsocket", tmpfs);
+    g_autofree char *uri = g_strdup_printf("unix:%s", path);
+    QTestState *from, *to;
+    char c;
+    int fd;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_set_parameter_int(to, "multifd-channels", 1);
+    migrate_set_capability(to, "multifd", true);
+    migrate_incoming_qmp(to, uri, "{}");
+
+    fd = unix_connect(path, &error_abort);
+    g_assert_cmpint(qemu_write_full(fd, &init, sizeof(init)), ==,
+                    sizeof(init));
+    g_assert_cmpint(qemu_write_full(fd, &packet, sizeof(packet)), ==,
+                    sizeof(packet));
+
+    /* The destination shuts the channel down */
+    g_assert_cmpint(read(fd, &c, 1), ==, 0);
+    close(fd);
+
+    /* ...and is still alive */
+    qtest_qmp_assert_success(to, "{ 'execute' : 'query-status' }");
+
+    test_migrate_end(from, to, false);
+}
+
 static void calc_dirty_rate(QTestState *who, uint64_t calc_time)
 {
     qtest_qmp_assert_success(who,
@@ -3797,6 +4088,10 @@ int main(int argc, char **argv)
                            test_postcopy_recovery);
         migration_test_add("/migration/postcopy/preempt/plain",
                            test_postcopy_preempt);
+        migration_test_add("/migration/postcopy/prefetch",
+                           test_postcopy_prefetch);
+        migration_test_add("/migration/postcopy/preempt/prefetch",
+                           test_postcopy_preempt_prefetch);
         migration_test_add("/migration/postcopy/preempt/recovery/plain",
                            test_postcopy_preempt_recovery);
         migration_test_add("/migration/postcopy/recovery/double-failures/handshake",
@@ -3811,6 +4106,17 @@ int main(int argc, char **argv)
 
     migration_test_add("/migration/precopy/unix/plain",
                        test_precopy_unix_plain);
+    migration_test_add("/migration/precopy/unix/defer-hot-pages",
+                       test_precopy_unix_defer_hot_pages);
+    migration_test_add("/migration/precopy/unix/downtime-breakdown",
+                       test_precopy_unix_downtime_breakdown);
+    if (g_str_equal(arch, "x86_64")) {
+        /* Needs the q35 host bridge */
+        migration_test_add("/migration/precopy/unix/device-state-precopy",
+                           test_precopy_unix_device_state_precopy);
+        migration_test_add("/migration/precopy/file/device-state-precopy",
+                           test_precopy_file_device_state_precopy);
+    }
     if (g_test_slow()) {
         migration_test_add("/migration/precopy/unix/xbzrle",
                            test_precopy_unix_xbzrle);
@@ -3838,6 +4144,10 @@ int main(int argc, char **argv)
                        test_precopy_file_mapped_ram);
     migration_test_add("/migration/precopy/file/mapped-ram/live",
                        test_precopy_file_mapped_ram_live);
+    if (has_uffd) {
+        migration_test_add("/migration/precopy/file/mapped-ram/lazy-load",
+                           test_precopy_file_mapped_ram_lazy_load);
+    }
 
     migration_test_add("/migration/multifd/file/mapped-ram",
                        test_multifd_file_mapped_ram);
@@ -3949,8 +4259,14 @@ int main(int argc, char **argv)
                        test_multifd_tcp_no_zero_page);
     migration_test_add("/migration/multifd/tcp/plain/cancel",
                        test_multifd_tcp_cancel);
+    migration_test_add("/migration/multifd/unix/device-state/oversized",
+                       test_multifd_unix_device_state_oversized);
     migration_test_add("/migration/multifd/tcp/plain/zlib",
                        test_multifd_tcp_zlib);
+    migration_test_add("/migration/multifd/tcp/plain/zlib/adaptive",
+                       test_multifd_tcp_zlib_adaptive);
+    migration_test_add("/migration/multifd/tcp/plain/xbzrle",
+                       test_multifd_tcp_xbzrle);
 #ifdef CONFIG_ZSTD
     migration_test_add("/migration/multifd/tcp/plain/zstd",
                        test_multifd_tcp_zstd);
@@ -0,0 +1,141 @@
+/*
+ * QTest testcase for query-stats
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+
+/* ICH9 CPU hotplug registers, see docs/specs/acpi_cpu_hotplug.rst */
+#define CPU_HOTPLUG_IO_BASE 0x0cd8
+#define CPU_HOTPLUG_SELECTOR (CPU_HOTPLUG_IO_BASE + 0)
+#define CPU_HOTPLUG_FLAGS (CPU_HOTPLUG_IO_BASE + 4)
+#define CPU_HOTPLUG_FLAG_EJECT 8
+
+static int query_vcpu_stats(QTestState *qts, bool oob)
+{
+    QDict *resp;
+    QList *results;
+    int n;
+
+    resp = qtest_qmp(qts, "{ %s: 'query-stats', "
+                     "  'arguments': { 'target': 'vcpu', "
+                     "                 'providers': [ { 'provider': 'kvm' } ] } }",
+                     oob ? "exec-oob" : "execute");
+    g_assert(qdict_haskey(resp, "return"));
+    results = qdict_get_qlist(resp, "return");
+    n = qlist_size(results);
+    qobject_unref(resp);
+
+    return n;
+}
+
+static void hotplug_vcpu(QTestState *qts, const char *id)
+{
+    QDict *resp;
+    QList *cpus;
+    QObject *e;
+
+    resp = qtest_qmp(qts, "{ 'execute': 'query-hotpluggable-cpus' }");
+    g_assert(qdict_haskey(resp, "return"));
+    cpus = qdict_get_qlist(resp, "return");
+
+    while ((e = qlist_pop(cpus))) {
+        QDict *cpu = qobject_to(QDict, e);
+
+        if (!qdict_haskey(cpu, "qom-path")) {
+            QDict *props = qdict_clone_shallow(qdict_get_qdict(cpu, "props"));
+
+            qdict_put_str(props, "id", id);
+            qtest_qmp_device_add_qdict(qts, qdict_get_str(cpu, "type"), props);
+            qobject_unref(props);
+            qobject_unref(e);
+            break;
+        }
+        qobject_unref(e);
+    }
+    g_assert(e);
+    qobject_unref(resp);
+}
+
+/* Play the part of the guest OS, which ejects the CPU after device_del */
+static void hotunplug_vcpu(QTestState *qts, const char *id, uint32_t index)
+{
+    QDict *event;
+
+    qtest_qmp_device_del_send(qts, id);
+
+    /* Writing 0 to the legacy CPU bitmap switches to the modern interface */
+    qtest_outl(qts, CPU_HOTPLUG_SELECTOR, 0);
+    qtest_outl(qts, CPU_HOTPLUG_SELECTOR, index);
+    qtest_outb(qts, CPU_HOTPLUG_FLAGS, CPU_HOTPLUG_FLAG_EJECT);
+
+    /* The children of the CPU, like its APIC, go away first */
+    for (;;) {
+        QDict *data;
+
+        event = qtest_qmp_eventwait_ref(qts, "DEVICE_DELETED");
+        data = qdict_get_qdict(event, "data");
+        if (qdict_haskey(data, "device") &&
+            g_str_equal(qdict_get_str(data, "device"), id)) {
+            break;
+        }
+        qobject_unref(event);
+    }
+    qobject_unref(event);
+}
+
+/*
+ * Out-of-band query-stats walks the vCPUs without the BQL;
+ * hot-unplugged vCPUs must disappear from it, along with their
+ * stats file descriptors.
+ */
+static void test_query_stats_vcpu_unplug(void)
+{
+    QTestState *qts;
+    QDict *resp;
+
+    if (!qtest_has_accel("kvm")) {
+        g_test_skip("KVM not available");
+        return;
+    }
+
+    qts = qtest_init_without_qmp_handshake("-machine q35,accel=kvm "
+                                           "-smp 1,maxcpus=2");
+    resp = qtest_qmp_receive_dict(qts);
+    g_assert(qdict_haskey(resp, "QMP"));
+    qobject_unref(resp);
+    resp = qtest_qmp(qts, "{ 'execute': 'qmp_capabilities', "
+                     "  'arguments': { 'enable': [ 'oob' ] } }");
+    g_assert(qdict_haskey(resp, "return"));
+    qobject_unref(resp);
+
+    g_assert_cmpint(query_vcpu_stats(qts, true), ==, 1);
+
+    hotplug_vcpu(qts, "cpu1");
+    g_assert_cmpint(query_vcpu_stats(qts, true), ==, 2);
+    g_assert_cmpint(query_vcpu_stats(qts, false), ==, 2);
+
+    hotunplug_vcpu(qts, "cpu1", 1);
+    g_assert_cmpint(query_vcpu_stats(qts, true), ==, 1);
+    g_assert_cmpint(query_vcpu_stats(qts, false), ==, 1);
+
+    /* The vCPU is parked and can come back, with a stats fd of its own */
+    hotplug_vcpu(qts, "cpu1");
+    g_assert_cmpint(query_vcpu_stats(qts, true), ==, 2);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/stats/kvm/vcpu-unplug", test_query_stats_vcpu_unplug);
+
+    return g_test_run();
+}
@@ -0,0 +1,115 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * crc32c() test
+ *
+ * The host specific versions of crc32c() checksum three lanes at a time
+ * and combine them, so lengths around multiples of the lane size matter
+ * most.  The results are checked against a plain bitwise implementation.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/crc32c.h"
+
+#define LANE 1024
+
+static uint8_t buffer[16 * LANE + 64];
+
+static uint32_t crc32c_ref(uint32_t crc, const uint8_t *data, size_t length)
+{
+    int i;
+
+    while (length--) {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+    }
+    return crc ^ 0xffffffff;
+}
+
+static void fill_buffer(void)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = g_test_rand_int();
+    }
+}
+
+static void test_vector(void)
+{
+    static const char check[] = "123456789";
+
+    g_assert_cmphex(crc32c(0xffffffff, (const uint8_t *)check,
+                           strlen(check)), ==, 0xe3069283);
+    g_assert_cmphex(crc32c(0xffffffff, buffer, 0), ==, 0);
+}
+
+static void test_lengths(void)
+{
+    size_t align, len;
+    int k, d;
+
+    fill_buffer();
+
+    for (align = 0; align < 16; align++) {
+        for (len = 0; len <= 256; len++) {
+            g_assert_cmphex(crc32c(0xffffffff, buffer + align, len), ==,
+                            crc32c_ref(0xffffffff, buffer + align, len));
+        }
+
+        /* Around the sizes of one lane and of every group of three */
+        for (k = 1; k <= 15; k++) {
+            for (d = -9; d <= 9; d++) {
+                len = k * LANE + d;
+                g_assert_cmphex(crc32c(0xffffffff, buffer + align, len), ==,
+                                crc32c_ref(0xffffffff, buffer + align, len));
+            }
+        }
+    }
+}
+
+static void test_seed(void)
+{
+    static const uint32_t seeds[] = {
+        0, 1, 0x80000000, 0x12345678, 0xffffffff,
+    };
+    size_t len = 3 * LANE * 2 + 5;
+    int i;
+
+    fill_buffer();
+
+    for (i = 0; i < ARRAY_SIZE(seeds); i++) {
+        g_assert_cmphex(crc32c(seeds[i], buffer + 1, len), ==,
+                        crc32c_ref(seeds[i], buffer + 1, len));
+    }
+}
+
+static void test_split(void)
+{
+    size_t len = 12 * LANE + 7;
+    uint32_t whole;
+    size_t split;
+
+    fill_buffer();
+    whole = crc32c_ref(0xffffffff, buffer, len);
+
+    /* Continuing from a partial result must not depend on the split */
+    for (split = 0; split <= len; split += 509) {
+        uint32_t crc = crc32c(0xffffffff, buffer, split);
+
+        g_assert_cmphex(crc32c(crc ^ 0xffffffff, buffer + split,
+                               len - split), ==, whole);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/crc32c/vector", test_vector);
+    g_test_add_func("/crc32c/lengths", test_lengths);
+    g_test_add_func("/crc32c/seed", test_seed);
+    g_test_add_func("/crc32c/split", test_split);
+    return g_test_run();
+}
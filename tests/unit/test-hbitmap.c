@@ -911,6 +911,34 @@ static void test_hbitmap_next_x_4(TestHBitmapData *data, const void *unused)
     test_hbitmap_next_x_do(data, 4);
 }
 
+/*
+ * Long runs of set bits with single holes, at every offset within the
+ * blocks that the accelerated scans work on and across their tails.
+ */
+static void test_hbitmap_next_x_dense(TestHBitmapData *data,
+                                      const void *unused)
+{
+    int64_t holes[] = { 0, 1, L1 - 1, L1, 2 * L1 + 3, 8 * L1 - 1,
+                        8 * L1, L2 - 1, L2 + 17, L3 - L1 - 1, L3 - 1 };
+    int i;
+
+    hbitmap_test_init(data, L3, 0);
+    hbitmap_test_set(data, 0, L3);
+    test_hbitmap_next_x_check(data, 0);
+    test_hbitmap_next_x_check(data, L1 + 1);
+
+    for (i = 0; i < ARRAY_SIZE(holes); i++) {
+        hbitmap_test_reset(data, holes[i], 1);
+        test_hbitmap_next_x_check(data, 0);
+        test_hbitmap_next_x_check(data, holes[i] / 2);
+        test_hbitmap_next_x_check_range(data, holes[i] / 2,
+                                        holes[i] - holes[i] / 2 + 1);
+        test_hbitmap_next_x_check_range(data, L1 / 2, L3 - L1);
+
+        hbitmap_test_set(data, holes[i], 1);
+    }
+}
+
 static void test_hbitmap_next_x_after_truncate(TestHBitmapData *data,
                                                const void *unused)
 {
@@ -1101,6 +1129,8 @@ int main(int argc, char **argv)
                      test_hbitmap_next_x_0);
     hbitmap_test_add("/hbitmap/next_zero/next_x_4",
                      test_hbitmap_next_x_4);
+    hbitmap_test_add("/hbitmap/next_zero/next_x_dense",
+                     test_hbitmap_next_x_dense);
     hbitmap_test_add("/hbitmap/next_zero/next_x_after_truncate",
                      test_hbitmap_next_x_after_truncate);
 
@@ -0,0 +1,101 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * net_checksum_add_cont() test
+ *
+ * net_checksum_add_cont() sums whole words in host byte order, so odd
+ * lengths, odd start addresses and odd @seq values are the interesting
+ * cases.  The results are checked against the portable byte-wise sum.
+ */
+
+#include "qemu/osdep.h"
+#include "net/checksum.h"
+
+static uint8_t buffer[4096 + 64];
+
+static uint32_t checksum_ref(int len, const uint8_t *buf, int seq)
+{
+    uint32_t sum1 = 0, sum2 = 0;
+    int i;
+
+    for (i = 0; i < len - 1; i += 2) {
+        sum1 += (uint32_t)buf[i];
+        sum2 += (uint32_t)buf[i + 1];
+    }
+    if (i < len) {
+        sum1 += (uint32_t)buf[i];
+    }
+
+    if (seq & 1) {
+        return sum1 + (sum2 << 8);
+    } else {
+        return sum2 + (sum1 << 8);
+    }
+}
+
+static void fill_buffer(void)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = g_test_rand_int();
+    }
+}
+
+static void test_lengths(void)
+{
+    int align, len, seq;
+
+    fill_buffer();
+
+    for (align = 0; align < 16; align++) {
+        for (len = 0; len <= 4096; len += len < 128 ? 1 : 127) {
+            for (seq = 0; seq < 4; seq++) {
+                g_assert_cmphex(
+                    net_checksum_finish(net_checksum_add_cont(len,
+                                        buffer + align, seq)), ==,
+                    net_checksum_finish(checksum_ref(len, buffer + align,
+                                                     seq)));
+            }
+        }
+    }
+}
+
+static void test_all_ones(void)
+{
+    int len = sizeof(buffer) - 1;
+
+    /* The largest sums must not overflow before they are folded */
+    memset(buffer, 0xff, sizeof(buffer));
+    g_assert_cmphex(net_checksum_finish(net_checksum_add_cont(len,
+                                                              buffer + 1, 0)),
+                    ==, net_checksum_finish(checksum_ref(len, buffer + 1, 0)));
+}
+
+static void test_split(void)
+{
+    int len = 1501;
+    uint16_t whole;
+    int split;
+
+    fill_buffer();
+    whole = net_checksum_finish(checksum_ref(len, buffer + 3, 0));
+
+    /* A packet summed in pieces, e.g. across iovecs */
+    for (split = 0; split <= len; split++) {
+        uint32_t sum = net_checksum_add_cont(split, buffer + 3, 0) +
+                       net_checksum_add_cont(len - split,
+                                             buffer + 3 + split, split);
+
+        g_assert_cmphex(net_checksum_finish(sum), ==, whole);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/checksum/lengths", test_lengths);
+    g_test_add_func("/net/checksum/all-ones", test_all_ones);
+    g_test_add_func("/net/checksum/split", test_split);
+    return g_test_run();
+}
@@ -28,6 +28,7 @@
 #include "migration/qemu-file-types.h"
 #include "../migration/qemu-file.h"
 #include "../migration/savevm.h"
+#include "qemu/bswap.h"
 #include "qemu/module.h"
 #include "io/channel-file.h"
 
@@ -330,6 +331,72 @@ static void test_simple_array(void)
                          sizeof(wire_simple_arr)));
 }
 
+/* Long enough to spill over the buffer of runs of plain fields */
+#define PLAIN_RUN_ARR_LEN 300
+
+typedef struct TestPlainRun {
+    uint8_t u8;
+    uint32_t u32_arr[PLAIN_RUN_ARR_LEN];
+    int16_t i16;
+    bool b;
+    uint64_t u64;
+} TestPlainRun;
+
+static const VMStateDescription vmstate_plain_run = {
+    .name = "simple/plain_run",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT8(u8, TestPlainRun),
+        VMSTATE_UINT32_ARRAY(u32_arr, TestPlainRun, PLAIN_RUN_ARR_LEN),
+        VMSTATE_INT16(i16, TestPlainRun),
+        VMSTATE_BOOL(b, TestPlainRun),
+        VMSTATE_UINT64(u64, TestPlainRun),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void test_simple_plain_run(void)
+{
+    size_t wire_size = 1 + PLAIN_RUN_ARR_LEN * 4 + 2 + 1 + 8 + 1;
+    g_autofree uint8_t *wire = g_malloc(wire_size);
+    g_autofree TestPlainRun *obj = g_new0(TestPlainRun, 1);
+    g_autofree TestPlainRun *obj_load = g_new0(TestPlainRun, 1);
+    uint8_t *p = wire;
+    int i;
+
+    obj->u8 = 0x12;
+    for (i = 0; i < PLAIN_RUN_ARR_LEN; i++) {
+        obj->u32_arr[i] = 0x01020304 * i;
+    }
+    obj->i16 = -2;
+    obj->b = true;
+    obj->u64 = 0x1122334455667788ULL;
+
+    *p++ = obj->u8;
+    for (i = 0; i < PLAIN_RUN_ARR_LEN; i++, p += 4) {
+        stl_be_p(p, obj->u32_arr[i]);
+    }
+    stw_be_p(p, obj->i16);
+    p += 2;
+    *p++ = obj->b;
+    stq_be_p(p, obj->u64);
+    p += 8;
+    *p = QEMU_VM_EOF;
+
+    save_vmstate(&vmstate_plain_run, obj);
+    compare_vmstate(wire, wire_size);
+
+    /* Anything but 0 is true on the wire */
+    wire[1 + PLAIN_RUN_ARR_LEN * 4 + 2] = 0x5a;
+    SUCCESS(load_vmstate_one(&vmstate_plain_run, obj_load, 1, wire,
+                             wire_size));
+    SUCCESS(memcmp(obj, obj_load, sizeof(*obj)));
+
+    FAILURE(load_vmstate_one(&vmstate_plain_run, obj_load, 1, wire,
+                             wire_size / 2));
+}
+
 typedef struct TestStruct {
     uint32_t a, b, c, e;
     uint64_t d, f;
@@ -1492,6 +1559,7 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/vmstate/simple/primitive", test_simple_primitive);
     g_test_add_func("/vmstate/simple/array", test_simple_array);
+    g_test_add_func("/vmstate/simple/plain_run", test_simple_plain_run);
     g_test_add_func("/vmstate/versioned/load/v1", test_load_v1);
     g_test_add_func("/vmstate/versioned/load/v2", test_load_v2);
     g_test_add_func("/vmstate/field_exists/load/noskip", test_load_noskip);
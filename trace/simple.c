@@ -30,12 +30,14 @@
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
-
 /*
- * Trace records are written out by a dedicated thread.  The thread waits for
- * records to become available, writes them out, and then waits again.
+ * Every thread that traces gets its own ring buffer, which only that thread
+ * writes to, so recording an event takes no lock and no atomic
+ * read-modify-write.  Trace records are written out by a dedicated thread.
+ * The thread waits for records to become available, writes them out in
+ * timestamp order across all buffers, and then waits again.  Records that do
+ * not fit in a full buffer are dropped rather than waiting for the writeout
+ * thread.
  */
 static GMutex trace_lock;
 static GCond trace_available_cond;
@@ -43,20 +45,46 @@ static GCond trace_empty_cond;
 
 static bool trace_available;
 static bool trace_writeout_enabled;
+/* Set while the writeout thread sleeps without a timeout */
+static bool trace_writeout_idle;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+/*
+ * Wake up the writeout thread at least this often while records are waiting
+ * to be written out, in microseconds
+ */
+#define TRACE_WRITEOUT_INTERVAL_US (100 * 1000)
+
+typedef struct TraceThreadBuffer TraceThreadBuffer;
+
+struct TraceThreadBuffer {
+    uint8_t buf[TRACE_BUF_LEN];
+    /* Written by the owning thread */
+    unsigned int head;
+    unsigned int dropped;
+    bool in_record;
+    bool exited;
+    /* Written by the writeout thread */
+    unsigned int tail;
+    unsigned int writeout_head;
+    unsigned int dropped_seen;
+    /* Only the writeout thread removes buffers from the list */
+    TraceThreadBuffer *next;
+};
+
+static TraceThreadBuffer *trace_buffers;
+static __thread TraceThreadBuffer *trace_thread_buffer;
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
 
+static void trace_thread_buffer_exit(gpointer data);
+static GPrivate trace_thread_key = G_PRIVATE_INIT(trace_thread_buffer_exit);
+
 #define TRACE_RECORD_TYPE_MAPPING 0
 #define TRACE_RECORD_TYPE_EVENT   1
 
@@ -75,54 +103,43 @@ typedef struct {
     uint64_t header_version;  /* HEADER_VERSION  */
 } TraceLogHeader;
 
+static void read_from_buffer(TraceThreadBuffer *tbuf, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceThreadBuffer *tbuf, unsigned int idx,
+                                    void *dataptr, size_t size);
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
-
-static void clear_buffer_range(unsigned int idx, size_t len)
+/* Called by glib when a thread that has traced exits */
+static void trace_thread_buffer_exit(gpointer data)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
-    }
+    TraceThreadBuffer *tbuf = data;
+
+    /* Events traced from here on go to a new buffer */
+    trace_thread_buffer = NULL;
+    qatomic_store_release(&tbuf->exited, true);
 }
-/**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
- *
- * Returns false if the record is not valid.
- */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+
+static TraceThreadBuffer *trace_thread_buffer_get(void)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    TraceThreadBuffer *tbuf = trace_thread_buffer;
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    if (likely(tbuf)) {
+        return tbuf;
     }
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+    /* don't use g_malloc, can deadlock when traced */
+    tbuf = calloc(1, sizeof(*tbuf));
+    if (!tbuf) {
+        return NULL;
+    }
+
+    do {
+        tbuf->next = g_atomic_pointer_get(&trace_buffers);
+    } while (!g_atomic_pointer_compare_and_exchange(&trace_buffers,
+                                                    tbuf->next, tbuf));
+
+    trace_thread_buffer = tbuf;
+    g_private_set(&trace_thread_key, tbuf);
+    return tbuf;
 }
 
 /**
@@ -143,52 +160,183 @@ static void flush_trace_file(bool wait)
     g_mutex_unlock(&trace_lock);
 }
 
+/*
+ * Kick writeout thread from a tracing thread.  If the writeout thread holds
+ * the lock, it is awake anyway or about to wake up by itself.
+ */
+static void kick_trace_file(void)
+{
+    if (g_mutex_trylock(&trace_lock)) {
+        trace_available = true;
+        g_cond_signal(&trace_available_cond);
+        g_mutex_unlock(&trace_lock);
+    }
+}
+
+/*
+ * Wake up the writeout thread from a tracing thread while it sleeps without
+ * a timeout.  Unlike kick_trace_file(), this cannot get lost.
+ */
+static void wake_trace_file(void)
+{
+    g_mutex_lock(&trace_lock);
+    trace_available = true;
+    g_cond_signal(&trace_available_cond);
+    g_mutex_unlock(&trace_lock);
+}
+
+/* Whether any buffer has records or drops that were not written out yet */
+static bool trace_records_pending(void)
+{
+    TraceThreadBuffer *tbuf;
+
+    for (tbuf = g_atomic_pointer_get(&trace_buffers); tbuf;
+         tbuf = tbuf->next) {
+        if (qatomic_read(&tbuf->head) != tbuf->tail ||
+            qatomic_read(&tbuf->dropped) != tbuf->dropped_seen) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void wait_for_trace_records_available(void)
 {
+    gint64 end_time;
+
     g_mutex_lock(&trace_lock);
+    end_time = g_get_monotonic_time() + TRACE_WRITEOUT_INTERVAL_US;
     while (!(trace_available && trace_writeout_enabled)) {
         g_cond_signal(&trace_empty_cond);
-        g_cond_wait(&trace_available_cond, &trace_lock);
+
+        if (!trace_writeout_enabled) {
+            /* st_set_trace_file_enabled() kicks us when writeout resumes */
+            g_cond_wait(&trace_available_cond, &trace_lock);
+            continue;
+        }
+
+        /*
+         * With nothing to write out, sleep until the next record comes in,
+         * see trace_record_finish().  The barrier pairs with the one there.
+         */
+        qatomic_set(&trace_writeout_idle, true);
+        smp_mb();
+        if (!trace_records_pending()) {
+            g_cond_wait(&trace_available_cond, &trace_lock);
+            qatomic_set(&trace_writeout_idle, false);
+            end_time = g_get_monotonic_time() + TRACE_WRITEOUT_INTERVAL_US;
+            continue;
+        }
+        qatomic_set(&trace_writeout_idle, false);
+
+        if (!g_cond_wait_until(&trace_available_cond, &trace_lock, end_time)) {
+            trace_available = true;
+            end_time = g_get_monotonic_time() + TRACE_WRITEOUT_INTERVAL_US;
+        }
     }
     trace_available = false;
     g_mutex_unlock(&trace_lock);
 }
 
+static void write_buffer_range(TraceThreadBuffer *tbuf, unsigned int idx,
+                               size_t len)
+{
+    size_t off = idx % TRACE_BUF_LEN;
+    size_t first = MIN(len, TRACE_BUF_LEN - off);
+    size_t unused __attribute__ ((unused));
+
+    unused = fwrite(&tbuf->buf[off], first, 1, trace_fp);
+    if (first < len) {
+        unused = fwrite(tbuf->buf, len - first, 1, trace_fp);
+    }
+}
+
+/*
+ * Returns the buffer whose oldest record is the oldest of all, or NULL if
+ * all buffers are empty up to the snapshot taken in writeout_thread().
+ */
+static TraceThreadBuffer *oldest_trace_buffer(void)
+{
+    TraceThreadBuffer *tbuf, *oldest = NULL;
+    uint64_t oldest_ns = 0;
+    TraceRecord record;
+
+    for (tbuf = g_atomic_pointer_get(&trace_buffers); tbuf;
+         tbuf = tbuf->next) {
+        if (tbuf->tail == tbuf->writeout_head) {
+            continue;
+        }
+        read_from_buffer(tbuf, tbuf->tail, &record, sizeof(TraceRecord));
+        if (!oldest || record.timestamp_ns < oldest_ns) {
+            oldest = tbuf;
+            oldest_ns = record.timestamp_ns;
+        }
+    }
+    return oldest;
+}
+
+/* Free the buffers of exited threads once they have been written out */
+static void reap_trace_buffers(void)
+{
+    TraceThreadBuffer *first = g_atomic_pointer_get(&trace_buffers);
+    TraceThreadBuffer **prev, *tbuf;
+
+    for (prev = &first->next; (tbuf = *prev) != NULL; ) {
+        if (qatomic_load_acquire(&tbuf->exited) &&
+            tbuf->tail == qatomic_read(&tbuf->head)) {
+            /* New buffers are only ever added in front of @first */
+            *prev = tbuf->next;
+            free(tbuf); /* don't use g_free, can deadlock when traced */
+        } else {
+            prev = &tbuf->next;
+        }
+    }
+}
+
 static gpointer writeout_thread(gpointer opaque)
 {
-    TraceRecord *recordptr;
+    TraceThreadBuffer *tbuf;
+    TraceRecord record;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
-    int dropped_count;
+    unsigned int dropped_count, total;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
 
     for (;;) {
         wait_for_trace_records_available();
 
-        if (g_atomic_int_get(&dropped_events)) {
+        /* Only write records that were complete when the pass started */
+        total = 0;
+        for (tbuf = g_atomic_pointer_get(&trace_buffers); tbuf;
+             tbuf = tbuf->next) {
+            tbuf->writeout_head = qatomic_load_acquire(&tbuf->head);
+            dropped_count = qatomic_read(&tbuf->dropped);
+            total += dropped_count - tbuf->dropped_seen;
+            tbuf->dropped_seen = dropped_count;
+        }
+
+        if (total) {
             dropped.rec.event = DROPPED_EVENT_ID;
             dropped.rec.timestamp_ns = get_clock();
             dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
             dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
-            dropped.rec.arguments[0] = dropped_count;
+            dropped.rec.arguments[0] = total;
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
+        while ((tbuf = oldest_trace_buffer()) != NULL) {
+            read_from_buffer(tbuf, tbuf->tail, &record, sizeof(TraceRecord));
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+            write_buffer_range(tbuf, tbuf->tail, record.length);
+            qatomic_store_release(&tbuf->tail, tbuf->tail + record.length);
+        }
+
+        if (g_atomic_pointer_get(&trace_buffers)) {
+            reap_trace_buffers();
         }
 
         fflush(trace_fp);
@@ -198,85 +346,106 @@ static gpointer writeout_thread(gpointer opaque)
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(trace_thread_buffer, rec->rec_off,
+                                   &val, sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(trace_thread_buffer, rec->rec_off,
+                                   &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(trace_thread_buffer, rec->rec_off,
+                                   (void *)s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuffer *tbuf = trace_thread_buffer_get();
+    unsigned int rec_off;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
     uint64_t event_u64 = event;
     uint64_t timestamp_ns = get_clock();
 
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    if (!tbuf) {
+        return -ENOMEM;
+    }
 
-    idx = old_idx % TRACE_BUF_LEN;
+    /*
+     * An event traced from a signal handler while the thread is in the
+     * middle of a record cannot be placed in the buffer.
+     */
+    if (tbuf->in_record) {
+        qatomic_set(&tbuf->dropped, tbuf->dropped + 1);
+        return -EBUSY;
+    }
+    tbuf->in_record = true;
+    barrier();
+
+    if (tbuf->head + rec_len - qatomic_load_acquire(&tbuf->tail) >
+        TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        qatomic_set(&tbuf->dropped, tbuf->dropped + 1);
+        tbuf->in_record = false;
+        return -ENOSPC;
+    }
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    rec_off = tbuf->head;
+    rec_off = write_to_buffer(tbuf, rec_off, &event_u64, sizeof(event_u64));
+    rec_off = write_to_buffer(tbuf, rec_off, &timestamp_ns,
+                              sizeof(timestamp_ns));
+    rec_off = write_to_buffer(tbuf, rec_off, &rec_len, sizeof(rec_len));
+    rec_off = write_to_buffer(tbuf, rec_off, &trace_pid, sizeof(trace_pid));
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    rec->tbuf_idx = tbuf->head;
+    rec->rec_off = rec_off;
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceThreadBuffer *tbuf, unsigned int idx,
+                             void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
     while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
+        data_ptr[x++] = tbuf->buf[idx++ % TRACE_BUF_LEN];
     }
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceThreadBuffer *tbuf, unsigned int idx,
+                                    void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
     while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
+        tbuf->buf[idx++ % TRACE_BUF_LEN] = data_ptr[x++];
     }
     return idx; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    TraceThreadBuffer *tbuf = trace_thread_buffer;
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
-        flush_trace_file(false);
+    /* The record ends where the last argument was written */
+    qatomic_store_release(&tbuf->head, rec->rec_off);
+
+    /*
+     * Either the writeout thread sees the record before it goes to sleep,
+     * or we see it sleeping.  Wake it up before clearing in_record, so that
+     * an event traced from a signal handler cannot take trace_lock again.
+     */
+    smp_mb();
+    if (unlikely(qatomic_read(&trace_writeout_idle))) {
+        wake_trace_file();
+    }
+    barrier();
+    tbuf->in_record = false;
+
+    if (rec->rec_off - qatomic_read(&tbuf->tail) >
+        TRACE_BUF_FLUSH_THRESHOLD) {
+        kick_trace_file();
     }
 }
 
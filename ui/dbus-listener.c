@@ -75,6 +75,13 @@ struct _DBusDisplayListener {
     bool ds_mapped;
     bool can_share_map;
 
+    /*
+     * Shareable copy of a surface that has no share handle of its own,
+     * e.g. one backed by guest video memory.
+     */
+    pixman_image_t *shadow;
+    qemu_pixman_shareable shadow_handle;
+
 #ifdef WIN32
     QemuDBusDisplay1ListenerWin32Map *map_proxy;
     QemuDBusDisplay1ListenerWin32D3d11 *d3d11_proxy;
@@ -325,24 +332,89 @@ static void dbus_scanout_dmabuf(DisplayChangeListener *dcl,
 #endif /* GBM */
 #endif /* OPENGL */
 
+static void ddl_shadow_clear(DBusDisplayListener *ddl)
+{
+    g_clear_pointer(&ddl->shadow, qemu_pixman_image_unref);
+    ddl->shadow_handle = SHAREABLE_NONE;
+}
+
+static void ddl_shadow_update(DBusDisplayListener *ddl,
+                              int x, int y, int w, int h)
+{
+    uint8_t *src = (uint8_t *)surface_data(ddl->ds);
+    uint8_t *dst = (uint8_t *)pixman_image_get_data(ddl->shadow);
+    int stride = surface_stride(ddl->ds);
+    int bp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(surface_format(ddl->ds)), 8);
+    int hh;
+
+    for (hh = y; hh < y + h; hh++) {
+        memcpy(&dst[stride * hh + x * bp], &src[stride * hh + x * bp],
+               w * bp);
+    }
+}
+
+/*
+ * Get the handle to map the surface from in the listener.  A surface that
+ * cannot be shared as is gets mirrored in a shareable shadow image, so
+ * that updates only copy the damaged area between two local buffers
+ * rather than serializing it over the bus.
+ */
+static bool ddl_share_handle(DBusDisplayListener *ddl,
+                             qemu_pixman_shareable *handle, uint32_t *offset)
+{
+    Error *err = NULL;
+
+    if (ddl->ds->share_handle != SHAREABLE_NONE) {
+        *handle = ddl->ds->share_handle;
+        *offset = ddl->ds->share_handle_offset;
+        return true;
+    }
+
+    if (!ddl->shadow) {
+        if (!qemu_pixman_image_new_shareable(&ddl->shadow,
+                                             &ddl->shadow_handle,
+                                             "dbus-shadow",
+                                             surface_format(ddl->ds),
+                                             surface_width(ddl->ds),
+                                             surface_height(ddl->ds),
+                                             surface_stride(ddl->ds),
+                                             &err)) {
+            g_debug("Failed to allocate scanout shadow: %s",
+                    error_get_pretty(err));
+            error_free(err);
+            ddl->shadow = NULL;
+            ddl->shadow_handle = SHAREABLE_NONE;
+            return false;
+        }
+        ddl_shadow_update(ddl, 0, 0,
+                          surface_width(ddl->ds), surface_height(ddl->ds));
+    }
+
+    *handle = ddl->shadow_handle;
+    *offset = 0;
+    return true;
+}
+
 #ifdef WIN32
 static bool dbus_scanout_map(DBusDisplayListener *ddl)
 {
     g_autoptr(GError) err = NULL;
     BOOL success;
-    HANDLE target_handle;
+    HANDLE share_handle, target_handle;
+    uint32_t offset;
 
     if (ddl->ds_share == SHARE_KIND_MAPPED) {
         return true;
     }
 
-    if (!ddl->can_share_map || !ddl->ds->share_handle) {
+    if (!ddl->can_share_map ||
+        !ddl_share_handle(ddl, &share_handle, &offset)) {
         return false;
     }
 
     success = DuplicateHandle(
         GetCurrentProcess(),
-        ddl->ds->share_handle,
+        share_handle,
         ddl->peer_process,
         &target_handle,
         FILE_MAP_READ | SECTION_QUERY,
@@ -359,7 +431,7 @@ static bool dbus_scanout_map(DBusDisplayListener *ddl)
     if (!qemu_dbus_display1_listener_win32_map_call_scanout_map_sync(
             ddl->map_proxy,
             GPOINTER_TO_UINT(target_handle),
-            ddl->ds->share_handle_offset,
+            offset,
             surface_width(ddl->ds),
             surface_height(ddl->ds),
             surface_stride(ddl->ds),
@@ -448,18 +520,21 @@ static bool dbus_scanout_map(DBusDisplayListener *ddl)
 {
     g_autoptr(GError) err = NULL;
     g_autoptr(GUnixFDList) fd_list = NULL;
+    int share_handle;
+    uint32_t offset;
 
     if (ddl->ds_share == SHARE_KIND_MAPPED) {
         return true;
     }
 
-    if (!ddl->can_share_map || ddl->ds->share_handle == SHAREABLE_NONE) {
+    if (!ddl->can_share_map ||
+        !ddl_share_handle(ddl, &share_handle, &offset)) {
         return false;
     }
 
     ddl_discard_display_messages(ddl);
     fd_list = g_unix_fd_list_new();
-    if (g_unix_fd_list_append(fd_list, ddl->ds->share_handle, &err) != 0) {
+    if (g_unix_fd_list_append(fd_list, share_handle, &err) != 0) {
         g_debug("Failed to setup scanout map fdlist: %s", err->message);
         ddl->can_share_map = false;
         return false;
@@ -468,7 +543,7 @@ static bool dbus_scanout_map(DBusDisplayListener *ddl)
     if (!qemu_dbus_display1_listener_unix_map_call_scanout_map_sync(
             ddl->map_proxy,
             g_variant_new_handle(0),
-            ddl->ds->share_handle_offset,
+            offset,
             surface_width(ddl->ds),
             surface_height(ddl->ds),
             surface_stride(ddl->ds),
@@ -741,6 +816,9 @@ static void dbus_gfx_update(DisplayChangeListener *dcl,
     trace_dbus_update(x, y, w, h);
 
     if (dbus_scanout_map(ddl)) {
+        if (ddl->shadow) {
+            ddl_shadow_update(ddl, x, y, w, h);
+        }
 #ifdef WIN32
         qemu_dbus_display1_listener_win32_map_call_update_map(
             ddl->map_proxy,
@@ -774,6 +852,7 @@ static void dbus_gl_gfx_switch(DisplayChangeListener *dcl,
 
     ddl->ds = new_surface;
     ddl->ds_share = SHARE_KIND_NONE;
+    ddl_shadow_clear(ddl);
     if (ddl->ds) {
         int width = surface_width(ddl->ds);
         int height = surface_height(ddl->ds);
@@ -792,6 +871,7 @@ static void dbus_gfx_switch(DisplayChangeListener *dcl,
 
     ddl->ds = new_surface;
     ddl->ds_share = SHARE_KIND_NONE;
+    ddl_shadow_clear(ddl);
 }
 
 static void dbus_mouse_set(DisplayChangeListener *dcl,
@@ -870,6 +950,7 @@ dbus_display_listener_dispose(GObject *object)
     DBusDisplayListener *ddl = DBUS_DISPLAY_LISTENER(object);
 
     unregister_displaychangelistener(&ddl->dcl);
+    ddl_shadow_clear(ddl);
     g_clear_object(&ddl->conn);
     g_clear_pointer(&ddl->bus_name, g_free);
     g_clear_object(&ddl->proxy);
@@ -915,6 +996,7 @@ dbus_display_listener_class_init(DBusDisplayListenerClass *klass)
 static void
 dbus_display_listener_init(DBusDisplayListener *ddl)
 {
+    ddl->shadow_handle = SHAREABLE_NONE;
 #ifdef CONFIG_PIXMAN
     pixman_region32_init(&ddl->gl_damage);
 #endif
@@ -117,6 +117,64 @@ void qemu_spice_wakeup(SimpleSpiceDisplay *ssd)
     spice_qxl_wakeup(&ssd->qxl);
 }
 
+/*
+ * Bound on the number of released updates kept around with their bitmap,
+ * so that steady guest activity doesn't go through the allocator for
+ * every dirty block.
+ */
+#define SPICE_UPDATE_CACHE_SIZE 64
+
+static void qemu_spice_free_update(SimpleSpiceUpdate *update)
+{
+    g_free(update->bitmap);
+    g_free(update);
+}
+
+/* Called with ssd->lock held */
+static SimpleSpiceUpdate *qemu_spice_alloc_update(SimpleSpiceDisplay *ssd,
+                                                  size_t bitmap_size)
+{
+    SimpleSpiceUpdate *update;
+
+    QTAILQ_FOREACH(update, &ssd->free_updates, next) {
+        if (update->bitmap_size >= bitmap_size) {
+            QTAILQ_REMOVE(&ssd->free_updates, update, next);
+            ssd->num_free_updates--;
+            memset(update, 0, offsetof(SimpleSpiceUpdate, bitmap));
+            return update;
+        }
+    }
+
+    update = g_malloc0(sizeof(*update));
+    update->bitmap = g_malloc(bitmap_size);
+    update->bitmap_size = bitmap_size;
+    return update;
+}
+
+/* Called with ssd->lock held */
+static void qemu_spice_release_update(SimpleSpiceDisplay *ssd,
+                                      SimpleSpiceUpdate *update)
+{
+    if (ssd->num_free_updates < SPICE_UPDATE_CACHE_SIZE) {
+        QTAILQ_INSERT_HEAD(&ssd->free_updates, update, next);
+        ssd->num_free_updates++;
+    } else {
+        qemu_spice_free_update(update);
+    }
+}
+
+/* Called with ssd->lock held */
+static void qemu_spice_flush_update_cache(SimpleSpiceDisplay *ssd)
+{
+    SimpleSpiceUpdate *update;
+
+    while ((update = QTAILQ_FIRST(&ssd->free_updates)) != NULL) {
+        QTAILQ_REMOVE(&ssd->free_updates, update, next);
+        qemu_spice_free_update(update);
+    }
+    ssd->num_free_updates = 0;
+}
+
 static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
                                          QXLRect *rect)
 {
@@ -132,15 +190,14 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
            rect->left, rect->right,
            rect->top, rect->bottom);
 
-    update   = g_malloc0(sizeof(*update));
+    bw       = rect->right - rect->left;
+    bh       = rect->bottom - rect->top;
+
+    update   = qemu_spice_alloc_update(ssd, bw * bh * 4);
     drawable = &update->drawable;
     image    = &update->image;
     cmd      = &update->ext.cmd;
 
-    bw       = rect->right - rect->left;
-    bh       = rect->bottom - rect->top;
-    update->bitmap = g_malloc(bw * bh * 4);
-
     drawable->bbox            = *rect;
     drawable->clip.type       = SPICE_CLIP_TYPE_NONE;
     drawable->effect          = QXL_EFFECT_OPAQUE;
@@ -185,28 +242,37 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
     QTAILQ_INSERT_TAIL(&ssd->updates, update, next);
 }
 
+/*
+ * Called with ssd->lock held, from the spice server thread.  Only
+ * ssd->surface is used to get at the guest pixels, ssd->ds belongs
+ * to the main loop.
+ */
 static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
 {
     static const int blksize = 32;
-    int blocks = DIV_ROUND_UP(surface_width(ssd->ds), blksize);
     g_autofree int *dirty_top = NULL;
-    int y, yoff1, yoff2, x, xoff, blk, bw;
-    int bpp = surface_bytes_per_pixel(ssd->ds);
+    int blocks, y, yoff1, yoff2, x, xoff, blk, bw;
+    int bpp, stride;
     uint8_t *guest, *mirror;
 
-    if (qemu_spice_rect_is_empty(&ssd->dirty)) {
+    if (!ssd->surface || qemu_spice_rect_is_empty(&ssd->dirty)) {
         return;
     };
 
+    blocks = DIV_ROUND_UP(pixman_image_get_width(ssd->surface), blksize);
+    bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(
+                           pixman_image_get_format(ssd->surface)), 8);
+    stride = pixman_image_get_stride(ssd->surface);
+
     dirty_top = g_new(int, blocks);
     for (blk = 0; blk < blocks; blk++) {
         dirty_top[blk] = -1;
     }
 
-    guest = surface_data(ssd->ds);
+    guest = (void *)pixman_image_get_data(ssd->surface);
     mirror = (void *)pixman_image_get_data(ssd->mirror);
     for (y = ssd->dirty.top; y < ssd->dirty.bottom; y++) {
-        yoff1 = y * surface_stride(ssd->ds);
+        yoff1 = y * stride;
         yoff2 = y * pixman_image_get_stride(ssd->mirror);
         for (x = ssd->dirty.left; x < ssd->dirty.right; x += blksize) {
             xoff = x * bpp;
@@ -297,6 +363,28 @@ qemu_spice_create_cursor_update(SimpleSpiceDisplay *ssd,
     return update;
 }
 
+/*
+ * Called from spice server thread context (via get_command).  Turns
+ * the dirty area into updates once the previous ones were consumed,
+ * which keeps the frame buffer scan out of the main loop.
+ */
+bool qemu_spice_get_update(SimpleSpiceDisplay *ssd, QXLCommandExt *ext)
+{
+    SimpleSpiceUpdate *update;
+
+    QEMU_LOCK_GUARD(&ssd->lock);
+    if (QTAILQ_EMPTY(&ssd->updates)) {
+        qemu_spice_create_update(ssd);
+    }
+    update = QTAILQ_FIRST(&ssd->updates);
+    if (update == NULL) {
+        return false;
+    }
+    QTAILQ_REMOVE(&ssd->updates, update, next);
+    *ext = update->ext;
+    return true;
+}
+
 /*
  * Called from spice server thread context (via interface_release_resource)
  * We do *not* hold the global qemu mutex here, so extra care is needed
@@ -305,8 +393,8 @@ qemu_spice_create_cursor_update(SimpleSpiceDisplay *ssd,
  */
 void qemu_spice_destroy_update(SimpleSpiceDisplay *sdpy, SimpleSpiceUpdate *update)
 {
-    g_free(update->bitmap);
-    g_free(update);
+    QEMU_LOCK_GUARD(&sdpy->lock);
+    qemu_spice_release_update(sdpy, update);
 }
 
 void qemu_spice_create_host_memslot(SimpleSpiceDisplay *ssd)
@@ -358,6 +446,7 @@ void qemu_spice_display_init_common(SimpleSpiceDisplay *ssd)
 {
     qemu_mutex_init(&ssd->lock);
     QTAILQ_INIT(&ssd->updates);
+    QTAILQ_INIT(&ssd->free_updates);
     ssd->mouse_x = -1;
     ssd->mouse_y = -1;
     if (ssd->num_surfaces == 0) {
@@ -378,6 +467,7 @@ void qemu_spice_display_update(SimpleSpiceDisplay *ssd,
     update_area.top = y;
     update_area.bottom = y + h;
 
+    QEMU_LOCK_GUARD(&ssd->lock);
     if (qemu_spice_rect_is_empty(&ssd->dirty)) {
         ssd->notify++;
     }
@@ -416,6 +506,7 @@ void qemu_spice_display_switch(SimpleSpiceDisplay *ssd,
                                      surface_height(surface),
                                      false);
 
+    qemu_mutex_lock(&ssd->lock);
     memset(&ssd->dirty, 0, sizeof(ssd->dirty));
     if (ssd->surface) {
         pixman_image_unref(ssd->surface);
@@ -423,26 +514,27 @@ void qemu_spice_display_switch(SimpleSpiceDisplay *ssd,
         pixman_image_unref(ssd->mirror);
         ssd->mirror = NULL;
     }
-
-    qemu_mutex_lock(&ssd->lock);
     need_destroy = (ssd->ds != NULL);
     ssd->ds = surface;
     while ((update = QTAILQ_FIRST(&ssd->updates)) != NULL) {
         QTAILQ_REMOVE(&ssd->updates, update, next);
-        qemu_spice_destroy_update(ssd, update);
+        qemu_spice_free_update(update);
     }
+    /* cached bitmaps are sized for the old mode */
+    qemu_spice_flush_update_cache(ssd);
     qemu_mutex_unlock(&ssd->lock);
     if (need_destroy) {
         qemu_spice_destroy_host_primary(ssd);
     }
     if (ssd->ds) {
-        ssd->surface = pixman_image_ref(ssd->ds->image);
-        ssd->mirror  = qemu_pixman_mirror_create(surface_format(ssd->ds),
-                                                 ssd->ds->image);
+        WITH_QEMU_LOCK_GUARD(&ssd->lock) {
+            ssd->surface = pixman_image_ref(ssd->ds->image);
+            ssd->mirror  = qemu_pixman_mirror_create(surface_format(ssd->ds),
+                                                     ssd->ds->image);
+        }
         qemu_spice_create_host_primary(ssd);
     }
 
-    memset(&ssd->dirty, 0, sizeof(ssd->dirty));
     ssd->notify++;
 
     qemu_mutex_lock(&ssd->lock);
@@ -487,13 +579,6 @@ void qemu_spice_display_refresh(SimpleSpiceDisplay *ssd)
 {
     graphic_hw_update(ssd->dcl.con);
 
-    WITH_QEMU_LOCK_GUARD(&ssd->lock) {
-        if (QTAILQ_EMPTY(&ssd->updates) && ssd->ds) {
-            qemu_spice_create_update(ssd);
-            ssd->notify++;
-        }
-    }
-
     trace_qemu_spice_display_refresh(ssd->qxl.id, ssd->notify);
     if (ssd->notify) {
         ssd->notify = 0;
@@ -536,19 +621,8 @@ static void interface_get_init_info(QXLInstance *sin, QXLDevInitInfo *info)
 static int interface_get_command(QXLInstance *sin, QXLCommandExt *ext)
 {
     SimpleSpiceDisplay *ssd = container_of(sin, SimpleSpiceDisplay, qxl);
-    SimpleSpiceUpdate *update;
-    int ret = false;
 
-    qemu_mutex_lock(&ssd->lock);
-    update = QTAILQ_FIRST(&ssd->updates);
-    if (update != NULL) {
-        QTAILQ_REMOVE(&ssd->updates, update, next);
-        *ext = update->ext;
-        ret = true;
-    }
-    qemu_mutex_unlock(&ssd->lock);
-
-    return ret;
+    return qemu_spice_get_update(ssd, ext);
 }
 
 static int interface_req_cmd_notification(QXLInstance *sin)
@@ -45,10 +45,10 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
+ * While a VNC worker thread is working, the VncDisplay global lock is held
+ * shared with the other workers to avoid screen corruption (this does not
+ * block vnc_refresh() because it uses trylock()) but the output lock is not
+ * held because the thread works on its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
  */
@@ -61,13 +61,16 @@ struct VncJobQueue {
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
-typedef struct VncJobQueue VncJobQueue;
-
 /*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
+ * Each queue has its own encoding thread.  A client always uses the same
+ * one, which keeps its updates in order and its encoder state private to
+ * one thread, while busy clients do not delay the others.
  */
-static VncJobQueue *queue;
+#define VNC_WORKER_THREADS 4
+
+static VncJobQueue *queues[VNC_WORKER_THREADS];
+/* Only used from the main thread */
+static unsigned int next_queue;
 
 static void vnc_lock_queue(VncJobQueue *queue)
 {
@@ -84,10 +87,13 @@ VncJob *vnc_job_new(VncState *vs)
     VncJob *job = g_new0(VncJob, 1);
 
     assert(vs->magic == VNC_MAGIC);
+    if (!vs->job_queue) {
+        vs->job_queue = queues[next_queue++ % VNC_WORKER_THREADS];
+    }
     job->vs = vs;
-    vnc_lock_queue(queue);
+    vnc_lock_queue(vs->job_queue);
     QLIST_INIT(&job->rectangles);
-    vnc_unlock_queue(queue);
+    vnc_unlock_queue(vs->job_queue);
     return job;
 }
 
@@ -102,14 +108,16 @@ int vnc_job_add_rect(VncJob *job, int x, int y, int w, int h)
     entry->rect.w = w;
     entry->rect.h = h;
 
-    vnc_lock_queue(queue);
+    vnc_lock_queue(job->vs->job_queue);
     QLIST_INSERT_HEAD(&job->rectangles, entry, next);
-    vnc_unlock_queue(queue);
+    vnc_unlock_queue(job->vs->job_queue);
     return 1;
 }
 
 void vnc_job_push(VncJob *job)
 {
+    VncJobQueue *queue = job->vs->job_queue;
+
     vnc_lock_queue(queue);
     if (queue->exit || QLIST_EMPTY(&job->rectangles)) {
         g_free(job);
@@ -120,7 +128,7 @@ void vnc_job_push(VncJob *job)
     vnc_unlock_queue(queue);
 }
 
-static bool vnc_has_job_locked(VncState *vs)
+static bool vnc_has_job_locked(VncJobQueue *queue, VncState *vs)
 {
     VncJob *job;
 
@@ -134,11 +142,15 @@ static bool vnc_has_job_locked(VncState *vs)
 
 void vnc_jobs_join(VncState *vs)
 {
-    vnc_lock_queue(queue);
-    while (vnc_has_job_locked(vs)) {
-        qemu_cond_wait(&queue->cond, &queue->mutex);
+    VncJobQueue *queue = vs->job_queue;
+
+    if (queue) {
+        vnc_lock_queue(queue);
+        while (vnc_has_job_locked(queue, vs)) {
+            qemu_cond_wait(&queue->cond, &queue->mutex);
+        }
+        vnc_unlock_queue(queue);
     }
-    vnc_unlock_queue(queue);
     vnc_jobs_consume_buffer(vs);
 }
 
@@ -283,12 +295,12 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
+    vnc_lock_display_shared(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->ioc == NULL) {
-            vnc_unlock_display(job->vs->vd);
+            vnc_unlock_display_shared(job->vs->vd);
             /* Copy persistent encoding data */
             vnc_async_encoding_end(job->vs, &vs);
             goto disconnected;
@@ -305,7 +317,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         g_free(entry);
     }
     trace_vnc_job_nrects(&vs, job, n_rectangles);
-    vnc_unlock_display(job->vs->vd);
+    vnc_unlock_display_shared(job->vs->vd);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -347,10 +359,16 @@ static VncJobQueue *vnc_queue_init(void)
 
 static void vnc_queue_clear(VncJobQueue *q)
 {
-    qemu_cond_destroy(&queue->cond);
-    qemu_mutex_destroy(&queue->mutex);
+    int i;
+
+    for (i = 0; i < VNC_WORKER_THREADS; i++) {
+        if (queues[i] == q) {
+            queues[i] = NULL; /* Unset global queue */
+        }
+    }
+    qemu_cond_destroy(&q->cond);
+    qemu_mutex_destroy(&q->mutex);
     g_free(q);
-    queue = NULL; /* Unset global queue */
 }
 
 static void *vnc_worker_thread(void *arg)
@@ -366,18 +384,23 @@ static void *vnc_worker_thread(void *arg)
 
 static bool vnc_worker_thread_running(void)
 {
-    return queue; /* Check global queue */
+    return queues[0]; /* Check global queue */
 }
 
 void vnc_start_worker_thread(void)
 {
     VncJobQueue *q;
+    int i;
 
     if (vnc_worker_thread_running())
         return;
 
-    q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
-    queue = q; /* Set global queue */
+    for (i = 0; i < VNC_WORKER_THREADS; i++) {
+        g_autofree char *name = g_strdup_printf("vnc_worker/%d", i);
+
+        q = vnc_queue_init();
+        qemu_thread_create(&q->thread, name, vnc_worker_thread, q,
+                           QEMU_THREAD_DETACHED);
+        queues[i] = q; /* Set global queue */
+    }
 }
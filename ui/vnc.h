@@ -64,6 +64,7 @@ typedef struct VncState VncState;
 typedef struct VncJob VncJob;
 typedef struct VncRect VncRect;
 typedef struct VncRectEntry VncRectEntry;
+typedef struct VncJobQueue VncJobQueue;
 
 typedef int VncReadEvent(VncState *vs, uint8_t *data, size_t len);
 
@@ -158,6 +159,8 @@ struct VncDisplay
     int ledstate;
     QKbdState *kbd;
     QemuMutex mutex;
+    /* encoding jobs sharing the display lock, protected by mutex */
+    unsigned int encoders;
 
     int cursor_msize;
     uint8_t *cursor_mask;
@@ -336,6 +339,8 @@ struct VncState
     QemuMutex output_mutex;
     QEMUBH *bh;
     Buffer jobs_buffer;
+    /* the worker that encodes all updates of this client */
+    VncJobQueue *job_queue;
 
     /* Encoding specific, if you add something here, don't forget to
      *  update vnc_async_encoding_start()
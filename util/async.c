@@ -469,7 +469,9 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx->io_uring_sqpoll,
+                                      ctx->io_uring_sqpoll_idle_ms,
+                                      ctx->io_uring_sqpoll_cpu, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -616,6 +618,10 @@ AioContext *aio_context_new(Error **errp)
 
     ctx->aio_max_batch = 0;
 
+    ctx->io_uring_sqpoll = false;
+    ctx->io_uring_sqpoll_idle_ms = 0;
+    ctx->io_uring_sqpoll_cpu = -1;
+
     ctx->thread_pool_min = 0;
     ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
 
@@ -743,6 +749,38 @@ void qemu_set_current_aio_context(AioContext *ctx)
     set_my_aiocontext(ctx);
 }
 
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int64_t sqpoll_idle_ms,
+                                     int64_t sqpoll_cpu, Error **errp)
+{
+    if (sqpoll_idle_ms < 0 || sqpoll_idle_ms > UINT32_MAX ||
+        sqpoll_cpu < -1 || sqpoll_cpu > INT_MAX) {
+        error_setg(errp, "bad io-uring-sqpoll-idle/io-uring-sqpoll-cpu values");
+        return;
+    }
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (ctx->linux_io_uring) {
+        if (sqpoll != ctx->io_uring_sqpoll ||
+            sqpoll_idle_ms != ctx->io_uring_sqpoll_idle_ms ||
+            sqpoll_cpu != ctx->io_uring_sqpoll_cpu) {
+            error_setg(errp, "io_uring parameters cannot be changed after "
+                       "the io_uring ring has been set up");
+        }
+        return;
+    }
+#else
+    if (sqpoll) {
+        error_setg(errp, "io_uring is not supported by this build");
+        return;
+    }
+#endif
+
+    ctx->io_uring_sqpoll = sqpoll;
+    ctx->io_uring_sqpoll_idle_ms = sqpoll_idle_ms;
+    ctx->io_uring_sqpoll_cpu = sqpoll_cpu;
+}
+
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp)
 {
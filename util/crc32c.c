@@ -27,6 +27,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/crc32c.h"
+#include "host/cpuinfo.h"
 
 /*
  * This is the CRC-32C table
@@ -105,12 +106,88 @@ static const uint32_t crc32c_table[256] = {
 };
 
 
-uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+static uint32_t crc32c_int(uint32_t crc, const uint8_t *data, size_t length)
 {
     while (length--) {
         crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
     }
-    return crc^0xffffffff;
+    return crc;
+}
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *data,
+                              size_t length);
+
+static crc32c_fn crc32c_accel = crc32c_int;
+
+/* The polynomial, bit-reflected like the CRC itself */
+#define CRC32C_POLY_REFLECTED 0x82F63B78
+
+/*
+ * Multiply @a by @b modulo the polynomial.  In the bit-reflected
+ * representation, x^0 is the most significant bit.  @a must be nonzero.
+ */
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                return p;
+            }
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY_REFLECTED : b >> 1;
+    }
+}
+
+/* Return x^(8 * @n) modulo the polynomial, i.e. the effect of @n bytes */
+static uint32_t crc32c_x8nmodp(size_t n)
+{
+    uint32_t res = 1u << 31;        /* x^0 */
+    uint32_t base = 1u << (31 - 8); /* x^8 */
+
+    while (n) {
+        if (n & 1) {
+            res = crc32c_multmodp(res, base);
+        }
+        base = crc32c_multmodp(base, base);
+        n >>= 1;
+    }
+    return res;
+}
+
+/*
+ * Hardware CRC instructions have a latency of several cycles but can
+ * start one every cycle, so the host specific versions checksum three
+ * adjacent lanes of CRC32C_LANE bytes at once, starting the second and
+ * third lane from zero, and then combine the results.
+ */
+#define CRC32C_LANE 1024
+
+static uint32_t crc32c_lane_k1;     /* x^(8 * CRC32C_LANE) */
+static uint32_t crc32c_lane_k2;     /* x^(8 * 2 * CRC32C_LANE) */
+
+static inline uint32_t crc32c_combine3(uint32_t a, uint32_t b, uint32_t c)
+{
+    return crc32c_multmodp(crc32c_lane_k2, a) ^
+           crc32c_multmodp(crc32c_lane_k1, b) ^ c;
+}
+
+#include "host/crc32c.c.inc"
+
+static void __attribute__((constructor)) crc32c_init_accel(void)
+{
+    crc32c_lane_k1 = crc32c_x8nmodp(CRC32C_LANE);
+    crc32c_lane_k2 = crc32c_x8nmodp(2 * CRC32C_LANE);
+    crc32c_select_accel();
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+{
+    return crc32c_accel(crc, data, length) ^ 0xffffffff;
 }
 
 uint32_t iov_crc32c(uint32_t crc, const struct iovec *iov, size_t iov_cnt)
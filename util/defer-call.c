@@ -121,6 +121,27 @@ void defer_call_begin(void)
     thread_state->nesting_level++;
 }
 
+/* Must be called with nesting_level == 0 */
+static void defer_call_run(DeferCallThreadState *thread_state)
+{
+    GArray *array = thread_state->deferred_call_array;
+    if (!array) {
+        return;
+    }
+
+    DeferredCall *fns = (DeferredCall *)array->data;
+
+    for (guint i = 0; i < array->len; i++) {
+        fns[i].fn(fns[i].opaque);
+    }
+
+    /*
+     * This resets the array without freeing memory so that appending is cheap
+     * in the future.
+     */
+    g_array_set_size(array, 0);
+}
+
 /**
  * defer_call_end: Run any pending defer_call() functions
  *
@@ -137,20 +158,24 @@ void defer_call_end(void)
         return;
     }
 
-    GArray *array = thread_state->deferred_call_array;
-    if (!array) {
-        return;
-    }
-
-    DeferredCall *fns = (DeferredCall *)array->data;
+    defer_call_run(thread_state);
+}
 
-    for (guint i = 0; i < array->len; i++) {
-        fns[i].fn(fns[i].opaque);
-    }
+/**
+ * defer_call_flush: Run pending defer_call() functions now
+ *
+ * Run the functions deferred so far without leaving the current
+ * defer_call_begin()/defer_call_end() section.  This is for code that is
+ * about to wait for the work those functions submit, for example a nested
+ * aio_poll(), which would otherwise wait forever.
+ */
+void defer_call_flush(void)
+{
+    DeferCallThreadState *thread_state = get_ptr_defer_call_thread_state();
+    unsigned nesting_level = thread_state->nesting_level;
 
-    /*
-     * This resets the array without freeing memory so that appending is cheap
-     * in the future.
-     */
-    g_array_set_size(array, 0);
+    /* Functions that defer more calls while running get called directly */
+    thread_state->nesting_level = 0;
+    defer_call_run(thread_state);
+    thread_state->nesting_level = nesting_level;
 }
@@ -25,7 +25,11 @@
  *
  * File descriptor monitoring is implemented using the following operations:
  *
- * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.  If the
+ *    kernel supports it, the poll is multishot and stays armed after
+ *    delivering an event, so it does not need to be re-added every time.
+ *    It is level-triggered like a one-shot poll, so handlers need not drain
+ *    their file descriptor completely.
  * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
  *    the poll mask changes for a file descriptor it is first removed and then
  *    re-added with the new poll mask, so this operation is also used as part
@@ -48,6 +52,17 @@
 #include "qemu/rcu_queue.h"
 #include "aio-posix.h"
 
+/*
+ * Multishot poll was added in Linux 5.13, along with IORING_FEAT_RSRC_TAGS.
+ * Without IORING_POLL_ADD_LEVEL it is edge-triggered, and that flag only came
+ * with Linux 5.19: older kernels fail the poll with -EINVAL, and we fall back
+ * to one-shot polls then.
+ */
+#if defined(IORING_POLL_ADD_MULTI) && defined(IORING_POLL_ADD_LEVEL) && \
+    defined(IORING_FEAT_RSRC_TAGS)
+#define FDMON_IO_URING_HAVE_MULTISHOT
+#endif
+
 enum {
     FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
 
@@ -172,9 +187,24 @@ static void add_poll_add_sqe(AioContext *ctx, AioHandler *node)
     int events = poll_events_from_pfd(node->pfd.events);
 
     io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+#ifdef FDMON_IO_URING_HAVE_MULTISHOT
+    if (ctx->fdmon_io_uring_multishot) {
+        sqe->len |= IORING_POLL_ADD_MULTI | IORING_POLL_ADD_LEVEL;
+    }
+#endif
     io_uring_sqe_set_data(sqe, node);
 }
 
+/* Returns true if the IORING_OP_POLL_ADD is still armed after this cqe */
+static inline bool cqe_poll_armed(struct io_uring_cqe *cqe)
+{
+#ifdef FDMON_IO_URING_HAVE_MULTISHOT
+    return cqe->flags & IORING_CQE_F_MORE;
+#else
+    return false;
+#endif
+}
+
 static void add_poll_remove_sqe(AioContext *ctx, AioHandler *node)
 {
     struct io_uring_sqe *sqe = get_sqe(ctx);
@@ -234,6 +264,21 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    /*
+     * A multishot IORING_OP_POLL_ADD produces more cqes until the final one
+     * without IORING_CQE_F_MORE, so the AioHandler must not be deleted yet.
+     * Events for a handler that is being deleted are of no interest.
+     */
+    if (cqe_poll_armed(cqe)) {
+        if (qatomic_read(&node->flags) & FDMON_IO_URING_REMOVE) {
+            return false;
+        }
+
+        aio_add_ready_handler(ready_list, node,
+                              pfd_events_from_poll(cqe->res));
+        return true;
+    }
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -245,9 +290,19 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    if (cqe->res == -EINVAL && ctx->fdmon_io_uring_multishot) {
+        /* The kernel does not know IORING_POLL_ADD_LEVEL */
+        ctx->fdmon_io_uring_multishot = false;
+        add_poll_add_sqe(ctx, node);
+        return false;
+    }
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
+    /*
+     * Either IORING_OP_POLL_ADD is one-shot or the kernel terminated the
+     * multishot poll (e.g. because the cq ring overflowed), so re-arm it.
+     */
     add_poll_add_sqe(ctx, node);
     return true;
 }
@@ -323,13 +378,21 @@ static const FDMonOps fdmon_io_uring_ops = {
 
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
+    struct io_uring_params params = {};
     int ret;
 
-    ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, &ctx->fdmon_io_uring, 0);
+    ret = io_uring_queue_init_params(FDMON_IO_URING_ENTRIES,
+                                     &ctx->fdmon_io_uring, &params);
     if (ret != 0) {
         return false;
     }
 
+#ifdef FDMON_IO_URING_HAVE_MULTISHOT
+    ctx->fdmon_io_uring_multishot = params.features & IORING_FEAT_RSRC_TAGS;
+#else
+    ctx->fdmon_io_uring_multishot = false;
+#endif
+
     QSLIST_INIT(&ctx->submit_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
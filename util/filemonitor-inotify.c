@@ -51,6 +51,30 @@ typedef struct {
 } QFileMonitorDir;
 
 
+static void qemu_file_monitor_dispatch_overflow(QFileMonitor *mon)
+{
+    GHashTableIter iter;
+    QFileMonitorDir *dir;
+    gsize i;
+
+    g_hash_table_iter_init(&iter, mon->dirs);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&dir)) {
+        for (i = 0; i < dir->watches->len; i++) {
+            QFileMonitorWatch *watch = &g_array_index(dir->watches,
+                                                      QFileMonitorWatch,
+                                                      i);
+
+            trace_qemu_file_monitor_dispatch(mon, dir->path, "",
+                                             QFILE_MONITOR_EVENT_OVERFLOW,
+                                             watch->cb, watch->opaque,
+                                             watch->id);
+            watch->cb(watch->id, QFILE_MONITOR_EVENT_OVERFLOW, "",
+                      watch->opaque);
+        }
+    }
+}
+
+
 static void qemu_file_monitor_watch(void *arg)
 {
     QFileMonitor *mon = arg;
@@ -103,6 +127,13 @@ static void qemu_file_monitor_watch(void *arg)
 
         used += sizeof(struct inotify_event) + ev->len;
 
+        /* The kernel queue was full, this one has no watch descriptor */
+        if (ev->mask & IN_Q_OVERFLOW) {
+            trace_qemu_file_monitor_event(mon, "", "", ev->mask, ev->wd);
+            qemu_file_monitor_dispatch_overflow(mon);
+            continue;
+        }
+
         if (!dir) {
             continue;
         }
@@ -14,6 +14,7 @@
 #include "qemu/host-utils.h"
 #include "trace.h"
 #include "crypto/hash.h"
+#include "host/cpuinfo.h"
 
 /* HBitmaps provides an array of bits.  The bits are stored as usual in an
  * array of unsigned longs, but HBitmap is also optimized to provide fast
@@ -101,6 +102,49 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/*
+ * Scans over runs of words in the last level.  They are selected at startup
+ * depending on the host CPU, see host/hbitmap-scan.c.inc.
+ *
+ * hb_find_not_full returns the index of the first word in [@pos, @end) that
+ * is not all ones, or @end if there is none.
+ *
+ * hb_popcount returns the number of set bits in @n words starting at @words.
+ */
+typedef size_t (*hb_find_not_full_fn)(const unsigned long *words,
+                                      size_t pos, size_t end);
+typedef uint64_t (*hb_popcount_fn)(const unsigned long *words, size_t n);
+
+static size_t hb_find_not_full_int(const unsigned long *words,
+                                   size_t pos, size_t end)
+{
+    while (pos < end && words[pos] == (unsigned long)-1) {
+        pos++;
+    }
+    return pos;
+}
+
+static uint64_t hb_popcount_int(const unsigned long *words, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(words[i]);
+    }
+    return count;
+}
+
+static hb_find_not_full_fn hb_find_not_full = hb_find_not_full_int;
+static hb_popcount_fn hb_popcount = hb_popcount_int;
+
+#include "host/hbitmap-scan.c.inc"
+
+static void __attribute__((constructor)) hbitmap_init_accel(void)
+{
+    hbitmap_select_accel();
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -245,10 +289,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_find_not_full(last_lev, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
@@ -349,59 +390,42 @@ uint64_t hbitmap_count(const HBitmap *hb)
     return hb->count << hb->granularity;
 }
 
-/**
- * hbitmap_iter_next_word:
- * @hbi: HBitmapIter to operate on.
- * @p_cur: Location where to store the next non-zero word.
- *
- * Return the index of the next nonzero word that is set in @hbi's
- * associated HBitmap, and set *p_cur to the content of that word
- * (bits before the index that was passed to hbitmap_iter_init are
- * trimmed on the first call).  Return -1, and set *p_cur to zero,
- * if all remaining words are zero.
- */
-static size_t hbitmap_iter_next_word(HBitmapIter *hbi, unsigned long *p_cur)
-{
-    unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1];
-
-    if (cur == 0) {
-        cur = hbitmap_iter_skip_words(hbi);
-        if (cur == 0) {
-            *p_cur = 0;
-            return -1;
-        }
-    }
-
-    /* The next call will resume work from the next word.  */
-    hbi->cur[HBITMAP_LEVELS - 1] = 0;
-    *p_cur = cur;
-    return hbi->pos;
-}
-
-/* Count the number of set bits between start and end, not accounting for
- * the granularity.  Also an example of how to use hbitmap_iter_next_word.
+/*
+ * Count the number of set bits between start and last, not accounting for
+ * the granularity.  Words of the last level whose bit is clear in the
+ * 2nd-last level are zero, so they are skipped 64 (32) at a time; all other
+ * words are counted in bulk.
  */
 static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
 {
-    HBitmapIter hbi;
-    uint64_t count = 0;
+    const unsigned long *words = hb->levels[HBITMAP_LEVELS - 1];
+    const unsigned long *parent = hb->levels[HBITMAP_LEVELS - 2];
     uint64_t end = last + 1;
+    size_t pos = start >> BITS_PER_LEVEL;
+    size_t end_pos = end >> BITS_PER_LEVEL;
     unsigned long cur;
-    size_t pos;
+    uint64_t count = 0;
 
-    hbitmap_iter_init(&hbi, hb, start << hb->granularity);
-    for (;;) {
-        pos = hbitmap_iter_next_word(&hbi, &cur);
-        if (pos >= (end >> BITS_PER_LEVEL)) {
-            break;
+    /* Drop bits representing items before START.  */
+    cur = words[pos] & ~((1UL << (start & (BITS_PER_LONG - 1))) - 1);
+    if (pos == end_pos) {
+        cur &= (1UL << (end & (BITS_PER_LONG - 1))) - 1;
+        return ctpopl(cur);
+    }
+    count += ctpopl(cur);
+
+    for (pos++; pos < end_pos; ) {
+        size_t group_end = MIN(QEMU_ALIGN_UP(pos + 1, BITS_PER_LONG), end_pos);
+
+        if (parent[pos >> BITS_PER_LEVEL]) {
+            count += hb_popcount(words + pos, group_end - pos);
         }
-        count += ctpopl(cur);
+        pos = group_end;
     }
 
-    if (pos == (end >> BITS_PER_LEVEL)) {
+    if (end & (BITS_PER_LONG - 1)) {
         /* Drop bits representing the END-th and subsequent items.  */
-        int bit = end & (BITS_PER_LONG - 1);
-        cur &= (1UL << bit) - 1;
+        cur = words[end_pos] & ((1UL << (end & (BITS_PER_LONG - 1))) - 1);
         count += ctpopl(cur);
     }
 
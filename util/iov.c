@@ -21,6 +21,9 @@
 #include "qemu/iov.h"
 #include "qemu/sockets.h"
 #include "qemu/cutils.h"
+#include "qemu/coroutine-tls.h"
+#include "qemu/notify.h"
+#include "qemu/thread.h"
 
 size_t iov_from_buf_full(const struct iovec *iov, unsigned int iov_cnt,
                          size_t offset, const void *buf, size_t bytes)
@@ -283,9 +286,68 @@ unsigned iov_copy(struct iovec *dst_iov, unsigned int dst_iov_cnt,
 
 /* io vectors */
 
+/*
+ * The block layer creates and destroys small vectors for many requests
+ * (padding, slices, COW, request merging).  Each thread keeps a few freed
+ * arrays of QIOV_POOL_NIOV entries around to avoid the allocation and the
+ * first reallocations in qemu_iovec_add().
+ */
+#define QIOV_POOL_NIOV 16
+#define QIOV_POOL_SIZE 8
+
+typedef struct QIOVPool {
+    int count;
+    struct iovec *iov[QIOV_POOL_SIZE];
+} QIOVPool;
+
+QEMU_DEFINE_STATIC_CO_TLS(QIOVPool, qiov_pool);
+QEMU_DEFINE_STATIC_CO_TLS(Notifier, qiov_pool_cleanup_notifier);
+
+static void qiov_pool_cleanup(Notifier *n, void *value)
+{
+    QIOVPool *pool = get_ptr_qiov_pool();
+
+    while (pool->count) {
+        g_free(pool->iov[--pool->count]);
+    }
+}
+
+static struct iovec *qiov_pool_get(void)
+{
+    QIOVPool *pool = get_ptr_qiov_pool();
+
+    if (pool->count) {
+        return pool->iov[--pool->count];
+    }
+    return g_new(struct iovec, QIOV_POOL_NIOV);
+}
+
+static void qiov_pool_put(struct iovec *iov)
+{
+    QIOVPool *pool = get_ptr_qiov_pool();
+    Notifier *notifier;
+
+    if (pool->count == QIOV_POOL_SIZE) {
+        g_free(iov);
+        return;
+    }
+
+    notifier = get_ptr_qiov_pool_cleanup_notifier();
+    if (!notifier->notify) {
+        notifier->notify = qiov_pool_cleanup;
+        qemu_thread_atexit_add(notifier);
+    }
+    pool->iov[pool->count++] = iov;
+}
+
 void qemu_iovec_init(QEMUIOVector *qiov, int alloc_hint)
 {
-    qiov->iov = g_new(struct iovec, alloc_hint);
+    if (alloc_hint <= QIOV_POOL_NIOV) {
+        qiov->iov = qiov_pool_get();
+        alloc_hint = QIOV_POOL_NIOV;
+    } else {
+        qiov->iov = g_new(struct iovec, alloc_hint);
+    }
     qiov->niov = 0;
     qiov->nalloc = alloc_hint;
     qiov->size = 0;
@@ -477,7 +539,9 @@ void qemu_iovec_init_slice(QEMUIOVector *qiov, QEMUIOVector *source,
 
 void qemu_iovec_destroy(QEMUIOVector *qiov)
 {
-    if (qiov->nalloc != -1) {
+    if (qiov->nalloc == QIOV_POOL_NIOV) {
+        qiov_pool_put(qiov->iov);
+    } else if (qiov->nalloc != -1) {
         g_free(qiov->iov);
     }
 
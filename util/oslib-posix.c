@@ -38,6 +38,7 @@
 #include "qemu/madvise.h"
 #include "qemu/sockets.h"
 #include "qemu/thread.h"
+#include "qemu/lockable.h"
 #include <libgen.h>
 #include "qemu/cutils.h"
 #include "qemu/units.h"
@@ -657,23 +658,25 @@ char *qemu_get_pid_name(pid_t pid)
 }
 
 
-void *qemu_alloc_stack(size_t *sz)
+/* Returns the size of a stack mapping, including its guard page */
+static size_t stack_alloc_size(size_t sz)
 {
-    void *ptr;
-    int flags;
-#ifdef CONFIG_DEBUG_STACK_USAGE
-    void *ptr2;
-#endif
     size_t pagesz = qemu_real_host_page_size();
 #ifdef _SC_THREAD_STACK_MIN
     /* avoid stacks smaller than _SC_THREAD_STACK_MIN */
     long min_stack_sz = sysconf(_SC_THREAD_STACK_MIN);
-    *sz = MAX(MAX(min_stack_sz, 0), *sz);
+    sz = MAX(MAX(min_stack_sz, 0), sz);
 #endif
     /* adjust stack size to a multiple of the page size */
-    *sz = ROUND_UP(*sz, pagesz);
+    sz = ROUND_UP(sz, pagesz);
     /* allocate one extra page for the guard page */
-    *sz += pagesz;
+    return sz + pagesz;
+}
+
+static void *stack_mmap(size_t len)
+{
+    void *ptr;
+    int flags;
 
     flags = MAP_PRIVATE | MAP_ANONYMOUS;
 #if defined(MAP_STACK) && defined(__OpenBSD__)
@@ -686,17 +689,35 @@ void *qemu_alloc_stack(size_t *sz)
     flags |= MAP_STACK;
 #endif
 
-    ptr = mmap(NULL, *sz, PROT_READ | PROT_WRITE, flags, -1, 0);
+    ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
     if (ptr == MAP_FAILED) {
         perror("failed to allocate memory for stack");
         abort();
     }
 
+    return ptr;
+}
+
+static void stack_add_guard_page(void *stack)
+{
     /* Stack grows down -- guard page at the bottom. */
-    if (mprotect(ptr, pagesz, PROT_NONE) != 0) {
+    if (mprotect(stack, qemu_real_host_page_size(), PROT_NONE) != 0) {
         perror("failed to set up stack guard page");
         abort();
     }
+}
+
+void *qemu_alloc_stack(size_t *sz)
+{
+    void *ptr;
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    void *ptr2;
+    size_t pagesz = qemu_real_host_page_size();
+#endif
+
+    *sz = stack_alloc_size(*sz);
+    ptr = stack_mmap(*sz);
+    stack_add_guard_page(ptr);
 
 #ifdef CONFIG_DEBUG_STACK_USAGE
     for (ptr2 = ptr + pagesz; ptr2 < ptr + *sz; ptr2 += sizeof(uint32_t)) {
@@ -734,6 +755,115 @@ void qemu_free_stack(void *stack, size_t sz)
     munmap(stack, sz);
 }
 
+#ifndef CONFIG_DEBUG_STACK_USAGE
+/*
+ * Pooled stacks are carved out of larger mappings, STACK_POOL_SLOTS at a
+ * time, and go back to a free list instead of being unmapped.  Growing
+ * the pool costs one mmap() plus one mprotect() per guard page, but after
+ * that a stack is taken off the free list without any system call, and
+ * freeing it costs a single madvise().  This avoids the mmap()/mprotect()/
+ * munmap() calls, which take mmap_lock for writing and stall page faults
+ * in vCPU threads, every time a coroutine is created or destroyed.  The
+ * guard pages still split each mapping, so the number of VMAs does not
+ * go down.
+ *
+ * All but the top STACK_POOL_WARM_SIZE bytes of a freed stack are given
+ * back to the kernel; the top is where a coroutine's frames live, so it
+ * stays resident for the next user.
+ *
+ * Only one stack size is pooled, the first one that is requested.
+ */
+#define STACK_POOL_SLOTS        16
+#define STACK_POOL_WARM_SIZE    (64 * KiB)
+
+static struct {
+    QemuMutex lock;
+    size_t slot_size;   /* size of a stack including its guard page */
+    void *free_list;    /* linked through the top word of each stack */
+} stack_pool;
+
+static void __attribute__((constructor)) stack_pool_init(void)
+{
+    qemu_mutex_init(&stack_pool.lock);
+}
+
+static void **stack_pool_link(void *stack)
+{
+    return stack + stack_pool.slot_size - sizeof(void *);
+}
+
+/* Called with stack_pool.lock held */
+static void stack_pool_grow(void)
+{
+    void *base = stack_mmap(stack_pool.slot_size * STACK_POOL_SLOTS);
+    int i;
+
+    for (i = STACK_POOL_SLOTS - 1; i >= 0; i--) {
+        void *stack = base + i * stack_pool.slot_size;
+
+        stack_add_guard_page(stack);
+        *stack_pool_link(stack) = stack_pool.free_list;
+        stack_pool.free_list = stack;
+    }
+}
+
+void *qemu_alloc_pooled_stack(size_t *sz)
+{
+    void *ptr = NULL;
+
+    *sz = stack_alloc_size(*sz);
+
+    WITH_QEMU_LOCK_GUARD(&stack_pool.lock) {
+        if (!stack_pool.slot_size) {
+            stack_pool.slot_size = *sz;
+        }
+        if (*sz == stack_pool.slot_size) {
+            if (!stack_pool.free_list) {
+                stack_pool_grow();
+            }
+            ptr = stack_pool.free_list;
+            stack_pool.free_list = *stack_pool_link(ptr);
+        }
+    }
+
+    if (!ptr) {
+        ptr = stack_mmap(*sz);
+        stack_add_guard_page(ptr);
+    }
+    return ptr;
+}
+
+void qemu_free_pooled_stack(void *stack, size_t sz)
+{
+    size_t pagesz = qemu_real_host_page_size();
+
+    if (sz != qatomic_read(&stack_pool.slot_size)) {
+        qemu_free_stack(stack, sz);
+        return;
+    }
+
+    if (sz - pagesz > STACK_POOL_WARM_SIZE) {
+        qemu_madvise(stack + pagesz, sz - pagesz - STACK_POOL_WARM_SIZE,
+                     QEMU_MADV_DONTNEED);
+    }
+
+    QEMU_LOCK_GUARD(&stack_pool.lock);
+    *stack_pool_link(stack) = stack_pool.free_list;
+    stack_pool.free_list = stack;
+}
+#else
+/* Stack usage accounting needs freshly filled stacks, don't pool them */
+void *qemu_alloc_pooled_stack(size_t *sz)
+{
+    return qemu_alloc_stack(sz);
+}
+
+void qemu_free_pooled_stack(void *stack, size_t sz)
+{
+    qemu_free_stack(stack, sz);
+}
+#endif
+
 /*
  * Disable CFI checks.
  * We are going to call a signal handler directly. Such handler may or may not
@@ -264,9 +264,12 @@ static void *call_rcu_thread(void *opaque)
 
         /* Heuristically wait for a decent number of callbacks to pile up.
          * Fetch rcu_call_count now, we only must process elements that were
-         * added before synchronize_rcu() starts.
+         * added before synchronize_rcu() starts.  Do not wait if somebody
+         * is blocked in drain_call_rcu(), batching only delays them.
          */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
+        while (n == 0 ||
+               (n < RCU_CALL_MIN_SIZE && ++tries <= 5 &&
+                !qatomic_read(&in_drain_call_rcu))) {
             g_usleep(10000);
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
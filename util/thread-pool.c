@@ -25,6 +25,12 @@
 
 static void do_spawn_thread(ThreadPool *pool);
 
+/*
+ * Maximum number of requests that are held back in a defer_call() section
+ * before they are handed to the worker threads anyway.
+ */
+#define THREAD_POOL_MAX_DEFERRED 32
+
 typedef struct ThreadPoolElement ThreadPoolElement;
 
 enum ThreadState {
@@ -46,7 +52,14 @@ struct ThreadPoolElement {
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* True while the request sits in deferred_list.  Only used by the
+     * thread pool's mother thread.
+     */
+    bool deferred;
+
+    /* Access to this list is protected by lock, unless the request is
+     * in deferred_list.
+     */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* This list is only written by the thread pool's mother thread.  */
@@ -63,6 +76,11 @@ struct ThreadPool {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QTAILQ_HEAD(, ThreadPoolElement) deferred_list;
+    int deferred_count;
+
+    /* Set by worker threads once they have scheduled completion_bh */
+    bool completion_pending;
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
@@ -115,7 +133,14 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_bh_schedule(pool->completion_bh);
+        /*
+         * Only the first worker to finish a request after completion_bh
+         * started looking for them needs to kick the AioContext; the others
+         * get picked up by the same run of the bottom half.
+         */
+        if (!qatomic_xchg(&pool->completion_pending, true)) {
+            qemu_bh_schedule(pool->completion_bh);
+        }
         qemu_mutex_lock(&pool->lock);
     }
 
@@ -179,6 +204,9 @@ static void thread_pool_completion_bh(void *opaque)
     defer_call_begin(); /* cb() may use defer_call() to coalesce work */
 
 restart:
+    /* Pairs with the qatomic_xchg() in worker_thread() */
+    qatomic_xchg(&pool->completion_pending, false);
+
     QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
         if (elem->state != THREAD_DONE) {
             continue;
@@ -222,6 +250,18 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
+    if (elem->deferred) {
+        /* Not visible to the worker threads yet, no need for the lock */
+        QTAILQ_REMOVE(&pool->deferred_list, elem, reqs);
+        pool->deferred_count--;
+        elem->deferred = false;
+        qemu_bh_schedule(pool->completion_bh);
+
+        elem->state = THREAD_DONE;
+        elem->ret = -ECANCELED;
+        return;
+    }
+
     QEMU_LOCK_GUARD(&pool->lock);
     if (elem->state == THREAD_QUEUED) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
@@ -238,6 +278,43 @@ static const AIOCBInfo thread_pool_aiocb_info = {
     .cancel_async       = thread_pool_cancel,
 };
 
+/*
+ * Hand all requests from deferred_list to the worker threads, taking the
+ * lock only once and waking up no more idle workers than there are requests.
+ *
+ * Called by defer_call_end() or immediately if not in a deferred section.
+ */
+static void thread_pool_deferred_submit(void *opaque)
+{
+    ThreadPool *pool = opaque;
+    ThreadPoolElement *req;
+    int n = pool->deferred_count;
+    int wakeups;
+    int i;
+
+    if (n == 0) {
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    for (i = pool->idle_threads;
+         i < n && pool->cur_threads < pool->max_threads; i++) {
+        spawn_thread(pool);
+    }
+    while ((req = QTAILQ_FIRST(&pool->deferred_list))) {
+        QTAILQ_REMOVE(&pool->deferred_list, req, reqs);
+        req->deferred = false;
+        QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    }
+    pool->deferred_count = 0;
+    wakeups = MIN(n, pool->idle_threads);
+    qemu_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < wakeups; i++) {
+        qemu_cond_signal(&pool->request_cond);
+    }
+}
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
                                    BlockCompletionFunc *cb, void *opaque)
 {
@@ -258,13 +335,17 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    /*
+     * Batch up requests submitted within a defer_call_begin()/defer_call_end()
+     * section so that the lock and the worker wakeups are paid once per batch.
+     */
+    req->deferred = true;
+    QTAILQ_INSERT_TAIL(&pool->deferred_list, req, reqs);
+    if (++pool->deferred_count >= THREAD_POOL_MAX_DEFERRED) {
+        thread_pool_deferred_submit(pool);
+    } else {
+        defer_call(thread_pool_deferred_submit, pool);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -338,6 +419,7 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
 
     QLIST_INIT(&pool->head);
     QTAILQ_INIT(&pool->request_list);
+    QTAILQ_INIT(&pool->deferred_list);
 
     thread_pool_update_params(pool, ctx);
 }
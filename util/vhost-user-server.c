@@ -52,6 +52,15 @@
  * possible by QIOChannel's support for spurious coroutine re-entry in
  * qio_channel_yield(). The coroutine will restart I/O when re-entered from the
  * new AioContext.
+ *
+ * Optionally, the kick fds of individual virtqueues can be monitored in other
+ * AioContexts (VuServer->vq_ctx) so that virtqueues are processed by several
+ * threads. vhost-user protocol messages are still handled by vu_client_trip()
+ * in VuServer->ctx. Since libvhost-user is not thread-safe, virtqueue
+ * processing is quiesced while a message is handled: vu_message_read() stops
+ * monitoring the kick fds in all AioContexts and waits for in-flight requests
+ * once a message has been received, and resumes monitoring before it starts
+ * waiting for the next one.
  */
 
 static void vmsg_close_fds(VhostUserMsg *vmsg)
@@ -89,14 +98,19 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
 
 void vhost_user_server_inc_in_flight(VuServer *server)
 {
-    assert(!server->wait_idle);
+    assert(!qatomic_read(&server->wait_idle));
     qatomic_inc(&server->in_flight);
 }
 
 void vhost_user_server_dec_in_flight(VuServer *server)
 {
+    /*
+     * With vq_ctx this may run in another thread than co_trip.  The
+     * fetch_dec orders the read of wait_idle after the decrement, and
+     * whoever clears wait_idle owns the wakeup.
+     */
     if (qatomic_fetch_dec(&server->in_flight) == 1) {
-        if (server->wait_idle) {
+        if (qatomic_xchg(&server->wait_idle, false)) {
             aio_co_wake(server->co_trip);
         }
     }
@@ -107,8 +121,113 @@ bool vhost_user_server_has_in_flight(VuServer *server)
     return qatomic_load_acquire(&server->in_flight) > 0;
 }
 
+/* Returns the AioContext in which the given kick fd is monitored */
+static AioContext *vu_fd_watch_get_aio_context(VuServer *server,
+                                               VuFdWatch *vu_fd_watch)
+{
+    int idx = (intptr_t)vu_fd_watch->pvt;
+
+    if (server->vq_ctx) {
+        assert(idx >= 0 && idx < server->max_queues);
+        if (server->vq_ctx[idx]) {
+            return server->vq_ctx[idx];
+        }
+    }
+    return server->ctx;
+}
+
+static void kick_handler(void *opaque);
+
+static void vu_fd_watch_attach(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    AioContext *ctx = vu_fd_watch_get_aio_context(server, vu_fd_watch);
+
+    if (ctx) {
+        aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
+                           NULL, NULL, vu_fd_watch);
+    }
+}
+
+static void vu_fd_watch_detach(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    AioContext *ctx = vu_fd_watch_get_aio_context(server, vu_fd_watch);
+
+    if (ctx) {
+        aio_set_fd_handler(ctx, vu_fd_watch->fd, NULL, NULL, NULL, NULL,
+                           vu_fd_watch);
+    }
+}
+
+/* Wait in co_trip until no request is in flight */
+static void coroutine_fn vu_server_wait_idle(VuServer *server)
+{
+    /*
+     * Publish wait_idle before checking in_flight, so that a concurrent
+     * vhost_user_server_dec_in_flight() either sees it or leaves a non-zero
+     * count for us to see.  If the count is zero but wait_idle is already
+     * cleared, the last request beat us to it and its wakeup is on the way.
+     */
+    qatomic_set(&server->wait_idle, true);
+    smp_mb();
+    if (!vhost_user_server_has_in_flight(server) &&
+        qatomic_xchg(&server->wait_idle, false)) {
+        return;
+    }
+    qemu_coroutine_yield();
+    assert(!qatomic_read(&server->wait_idle));
+}
+
+/*
+ * Stop virtqueue processing in all AioContexts so that vu_client_trip() can
+ * safely handle a vhost-user message. Only needed with vq_ctx.
+ */
+static void coroutine_fn vu_server_quiesce_vqs(VuServer *server)
+{
+    AioContext *home_ctx = qemu_get_current_aio_context();
+    VuFdWatch *vu_fd_watch;
+    int i;
+
+    if (!server->vq_ctx || server->vqs_quiesced) {
+        return;
+    }
+
+    server->vqs_quiesced = true;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        vu_fd_watch_detach(server, vu_fd_watch);
+    }
+
+    /*
+     * A kick handler might still be running in another thread. Visiting each
+     * AioContext ensures that it has returned by now.
+     */
+    for (i = 0; i < server->max_queues; i++) {
+        if (server->vq_ctx[i] && server->vq_ctx[i] != home_ctx) {
+            aio_co_reschedule_self(server->vq_ctx[i]);
+        }
+    }
+    aio_co_reschedule_self(home_ctx);
+
+    vu_server_wait_idle(server);
+}
+
+static void vu_server_resume_vqs(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    if (!server->vqs_quiesced || !server->ctx) {
+        return;
+    }
+
+    server->vqs_quiesced = false;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        vu_fd_watch_attach(server, vu_fd_watch);
+    }
+}
+
 static bool coroutine_fn
-vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
+vu_message_recv(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
 {
     struct iovec iov = {
         .iov_base = (char *)vmsg,
@@ -207,6 +326,19 @@ fail:
     return false;
 }
 
+static bool coroutine_fn
+vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
+{
+    VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+    bool ret;
+
+    vu_server_resume_vqs(server);
+    ret = vu_message_recv(vu_dev, conn_fd, vmsg);
+    vu_server_quiesce_vqs(server);
+
+    return ret;
+}
+
 static coroutine_fn void vu_client_trip(void *opaque)
 {
     VuServer *server = opaque;
@@ -224,12 +356,8 @@ static coroutine_fn void vu_client_trip(void *opaque)
         }
     }
 
-    if (vhost_user_server_has_in_flight(server)) {
-        /* Wait for requests to complete before we can unmap the memory */
-        server->wait_idle = true;
-        qemu_coroutine_yield();
-        server->wait_idle = false;
-    }
+    /* Wait for requests to complete before we can unmap the memory */
+    vu_server_wait_idle(server);
     assert(!vhost_user_server_has_in_flight(server));
 
     vu_deinit(vu_dev);
@@ -304,10 +432,13 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
         qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ctx, fd, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+
+        /* Otherwise vu_server_resume_vqs() will attach it */
+        if (!server->vqs_quiesced) {
+            vu_fd_watch_attach(server, vu_fd_watch);
+        }
     }
 }
 
@@ -320,12 +451,23 @@ static void remove_watch(VuDev *vu_dev, int fd)
 
     server = container_of(vu_dev, VuServer, vu_dev);
 
+    /*
+     * A kick handler, which may run in a virtqueue AioContext, must not touch
+     * the list of watches. Just stop monitoring the fd there, the watch is
+     * freed when vu_deinit() removes it again from vu_client_trip().
+     */
+    if (server->vq_ctx && !qemu_in_coroutine()) {
+        aio_set_fd_handler(qemu_get_current_aio_context(), fd,
+                           NULL, NULL, NULL, NULL, NULL);
+        return;
+    }
+
     VuFdWatch *vu_fd_watch = find_vu_fd_watch(server, fd);
 
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    vu_fd_watch_detach(server, vu_fd_watch);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
@@ -385,8 +527,7 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            vu_fd_watch_detach(server, vu_fd_watch);
         }
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -423,9 +564,11 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
         return;
     }
 
-    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
-                           NULL, NULL, vu_fd_watch);
+    /* Quiesced virtqueues are attached by vu_server_resume_vqs() */
+    if (!server->vqs_quiesced) {
+        QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+            vu_fd_watch_attach(server, vu_fd_watch);
+        }
     }
 
     if (server->co_trip) {
@@ -456,8 +599,7 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            vu_fd_watch_detach(server, vu_fd_watch);
         }
     }
 
@@ -474,6 +616,7 @@ void vhost_user_server_detach_aio_context(VuServer *server)
 bool vhost_user_server_start(VuServer *server,
                              SocketAddress *socket_addr,
                              AioContext *ctx,
+                             AioContext **vq_ctx,
                              uint16_t max_queues,
                              const VuDevIface *vu_iface,
                              Error **errp)
@@ -503,6 +646,7 @@ bool vhost_user_server_start(VuServer *server,
         .vu_iface              = vu_iface,
         .max_queues            = max_queues,
         .ctx                   = ctx,
+        .vq_ctx                = vq_ctx,
     };
 
     qio_net_listener_set_name(server->listener, "vhost-user-backend-listener");